@@ -0,0 +1,192 @@
+rem ==================================================
+rem  array kernels
+rem  these work on count elements of integer arrays
+rem  beginning at element start
+rem ==================================================
+
+rem ==================================================
+rem  fill array elements with a value
+rem  @param a - array
+rem  @param start - first element
+rem  @param count - number of elements
+rem  @param value - value to store
+rem ==================================================
+
+def arrfill(a(), start, count, value)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        trap 8
+    end asm
+end def
+
+rem ==================================================
+rem  copy elements from src to dst
+rem  @param dst - destination array
+rem  @param src - source array
+rem  @param start - first element
+rem  @param count - number of elements
+rem ==================================================
+
+def arrcopy(dst(), src(), start, count)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        trap 9
+    end asm
+end def
+
+rem ==================================================
+rem  add the elements of src to dst
+rem  @param dst - destination array
+rem  @param src - source array
+rem  @param start - first element
+rem  @param count - number of elements
+rem ==================================================
+
+def arradd(dst(), src(), start, count)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        trap 10
+    end asm
+end def
+
+rem ==================================================
+rem  add the elements of src times k to dst
+rem  @param dst - destination array
+rem  @param src - source array
+rem  @param start - first element
+rem  @param count - number of elements
+rem  @param k - multiplier
+rem ==================================================
+
+def arrmac(dst(), src(), start, count, k)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        lref 4
+        trap 11
+    end asm
+end def
+
+rem ==================================================
+rem  multiply elements by k and shift them right
+rem  @param a - array
+rem  @param start - first element
+rem  @param count - number of elements
+rem  @param k - multiplier
+rem  @param shift - arithmetic right shift count
+rem ==================================================
+
+def arrscale(a(), start, count, k, shift)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        lref 4
+        trap 12
+    end asm
+end def
+
+rem ==================================================
+rem  return the sum of array elements
+rem  @param a - array
+rem  @param start - first element
+rem  @param count - number of elements
+rem ==================================================
+
+def arrsum(a(), start, count)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        trap 13
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  return the dot product of two arrays
+rem  @param a - first array
+rem  @param b - second array
+rem  @param start - first element
+rem  @param count - number of elements
+rem ==================================================
+
+def arrdot(a(), b(), start, count)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        trap 14
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  return the smallest array element (0 if count is 0)
+rem  @param a - array
+rem  @param start - first element
+rem  @param count - number of elements
+rem ==================================================
+
+def arrmin(a(), start, count)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        trap 15
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  return the largest array element (0 if count is 0)
+rem  @param a - array
+rem  @param start - first element
+rem  @param count - number of elements
+rem ==================================================
+
+def arrmax(a(), start, count)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        trap 16
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  apply radix-2 FFT butterflies to time decimated
+rem  samples (see FFT_bfly in samples/fft/fft.bas)
+rem  @param bx - 2^log2n real parts
+rem  @param by - 2^log2n imaginary parts
+rem  @param wx - 2^(log2n-1) twiddle factor cosines
+rem  @param wy - 2^(log2n-1) twiddle factor minus sines
+rem  @param log2n - log2 of the number of samples
+rem  @param shift - twiddle factor scale (12 for +/- 4096)
+rem ==================================================
+
+def fftbutterflies(bx(), by(), wx(), wy(), log2n, shift)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        lref 4
+        lref 5
+        trap 17
+    end asm
+end def
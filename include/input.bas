@@ -5,6 +5,7 @@ def lineMax = 128
 
 dim lineBuffer(lineMax + 1) as byte
 dim linePtr = 0
+dim lineEnd(1)
 
 def inputGetLine(dev)
     inputLine(dev, lineBuffer)
@@ -12,9 +13,16 @@ def inputGetLine(dev)
 end def
 
 def inputInt(dev)
+    return inputNumber(dev, 10)
+end def
+
+def inputHex(dev)
+    return inputNumber(dev, 16)
+end def
+
+def inputNumber(dev, base)
     dim ch = skipSpaces
-    dim value = 0
-    dim sign = 1
+    dim value
     
     // find the start of the token by skipping spaces
     // read a new line if necessary
@@ -28,19 +36,10 @@ def inputInt(dev)
         return 0
     end if
     
-    // check for a minus sign
-    if ch = '-' then
-        sign = -1
-        ch = lineBuffer(linePtr)
-        linePtr = linePtr + 1
-    end if
-    
-    // build up the integer
-    do while isdigit(ch)
-        value = value * 10 + ch - '0'
-        linePtr = linePtr + 1
-        ch = lineBuffer(linePtr)
-    loop
+    // parse the number
+    value = strToNum(lineBuffer, linePtr, base, lineEnd)
+    linePtr = lineEnd(0)
+    ch = lineBuffer(linePtr)
     
     // look for the closing delimiter
     do while ch <> NUL
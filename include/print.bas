@@ -1,35 +1,120 @@
 /* based on some code by Steve Denson (jazzed) */
 
 def printStr(dev, str() as byte)
-    dim n = 0
-    dim ch = str(n)
-    do while ch
-        uartTX(ch)
-        n = n + 1
-        ch = str(n)
-    loop
+    asm
+        lref 1
+        slit -1
+        trap 2
+    end asm
 end def
 
 def printInt(dev, value)
-    dim n = value
-    dim length = 10
-    dim result = 0
+    asm
+        lref 1
+        slit 10
+        slit 0
+        trap 37
+    end asm
+end def
+
+def printIntHex(dev, value, width)
+    // prints at least width digits padded with zeros
+    asm
+        lref 1
+        slit 16
+        lref 2
+        trap 37
+    end asm
+end def
+
+def printIntBin(dev, value, width)
+    // prints at least width digits padded with zeros
+    asm
+        lref 1
+        slit 2
+        lref 2
+        trap 37
+    end asm
+end def
+
+def printFixed(dev, value)
+    // value is the raw 16.16 fixed point value
+    dim frac
+    dim n = 1000
     if value < 0 then
         value = -value
         uartTX('-')
     end if
-    n = 1000000000
-    do while length > 0
-        length = length - 1
-        if value >= n then
-            uartTX(value / n + '0')
-            value = value mod n
-            result = result + 1
-        else if result or n = 1 then
-            uartTX('0')
-        end if
+    frac = ((value & 0xffff) * 10000 + 0x8000) >> 16
+    value = value >> 16
+    if frac >= 10000 then
+        value = value + 1
+        frac = frac - 10000
+    end if
+    printInt(dev, value)
+    uartTX('.')
+    do
+        uartTX(frac / n + '0')
+        frac = frac mod n
         n = n / 10
-    loop
+    loop until frac = 0
+end def
+
+def printFloat(dev, value as float)
+    // prints 6 significant digits using an exponent for values outside 0.0001 to 999999
+    dim digits, n
+    dim exponent = 0
+    dim point = 0
+    if value < 0 then
+        value = -value
+        uartTX('-')
+    end if
+    if value = 0 then
+        printStr(dev, "0.0")
+    else if value > 3.4028235e38 then
+        printStr(dev, "inf")
+    else
+        do while value >= 10
+            value = value / 10
+            exponent = exponent + 1
+        loop
+        do while value < 1
+            value = value * 10
+            exponent = exponent - 1
+        loop
+        digits = value * 100000 + 0.5
+        if digits >= 1000000 then
+            digits = digits / 10
+            exponent = exponent + 1
+        end if
+        if exponent >= -4 and exponent <= 5 then
+            point = exponent
+        end if
+        if point < 0 then
+            printStr(dev, "0.")
+            do while point < -1
+                uartTX('0')
+                point = point + 1
+            loop
+        end if
+        n = 100000
+        do
+            uartTX(digits / n + '0')
+            digits = digits mod n
+            n = n / 10
+            if point = 0 then
+                uartTX('.')
+                if digits = 0 then
+                    uartTX('0')
+                end if
+            end if
+            point = point - 1
+        loop until point < 0 and digits = 0
+        if exponent < -4 or exponent > 5 then
+            uartTX('e')
+            printInt(dev, exponent)
+        end if
+    end if
 end def
 
 def printTab(dev)
@@ -50,12 +50,10 @@ def cogstop(id)
   end asm
 end def
 
+REM the locks are traps so xbint can share them between the threads it uses for COGSTART
 def locknew
   asm
-    dup                 // make space for the return value
-    native locknew tos wc
-    native if_c mov tos, #1
-    native if_c neg tos, tos
+    trap 28             // push a new lock or -1 if none are free
     returnx
   end asm
 end def
@@ -63,17 +61,14 @@ end def
 def lockret(id)
   asm
     lref 0
-    native locknew tos
-    returnx
+    trap 29
   end asm
 end def
 
 def lockset(id)
   asm
     lref 0
-    native lockset tos wc
-    native mov tos, #0
-    native muxc tos, #1
+    trap 30             // returns 1 if the lock was already set
     returnx
   end asm
 end def
@@ -81,9 +76,70 @@ end def
 def lockclr(id)
   asm
     lref 0
-    native lockclr tos wc
-    native mov tos, #0
-    native muxc tos, #1
+    trap 31             // returns 1 if the lock was set
+    returnx
+  end asm
+end def
+
+REM COGSTART helper: start code on a new VM cog with its arguments at the end of stack
+REM returns the cog id or -1
+def startCog(code, exit, stack, first)
+  asm
+    lref 0
+    lref 1
+    lref 2
+    lref 3
+    trap 27
+    returnx
+  end asm
+end def
+
+REM COGSTART helper: the function started on a new VM cog returns here
+def cogExit
+  asm
+    halt
+  end asm
+end def
+
+REM TASK helper: add a task calling code with its arguments at the end of stack
+REM returns the task id or -1
+def startTask(code, exit, stack, first)
+  asm
+    lref 0
+    lref 1
+    lref 2
+    lref 3
+    trap 32
+    returnx
+  end asm
+end def
+
+REM TASK helper: the function started as a task returns here (the last task to exit halts)
+def taskExit
+  asm
+    trap 33
+    halt
+  end asm
+end def
+
+REM YIELD helper: let the next task run
+def taskYield
+  asm
+    trap 34
+  end asm
+end def
+
+REM WAITFOR helpers: start the timeout in milliseconds and yield until it expires
+def taskTimer(ms)
+  asm
+    lref 0
+    trap 35
+  end asm
+end def
+
+def taskWait
+  asm
+    trap 36             // returns 1 once the timer has expired
     returnx
   end asm
 end def
@@ -15,14 +15,11 @@ rem  @param str - string to measure
 rem ==================================================
 
 def strlen(str() as byte)
-    dim n, ch
-    n = 0
-    ch = str(n)
-    do while ch
-        n = n + 1
-        ch = str(n)
-    loop
-    return n
+    asm
+        lref 0
+        trap 3
+        returnx
+    end asm
 end def
 
 rem ==================================================
@@ -32,13 +29,122 @@ rem  @param str2 - src
 rem ==================================================
 
 def strcpy(str1() as byte, str2() as byte)
-  dim i = 0
-  dim ch
-  do
-    ch = str2(i)
-    str1(i) = ch
-    i = i + 1
-  loop until ch = 0
+    asm
+        lref 0
+        lref 1
+        trap 5
+    end asm
+end def
+
+rem ==================================================
+rem  compare two strings
+rem  @param str1 - first string
+rem  @param str2 - second string
+rem  @return -1, 0, or 1 if str1 is less than, equal
+rem          to, or greater than str2
+rem ==================================================
+
+def strcmp(str1() as byte, str2() as byte)
+    asm
+        lref 0
+        lref 1
+        trap 4
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  copy bytes from src to dst
+rem  @param dst - destination
+rem  @param src - source
+rem  @param n - number of bytes to copy
+rem ==================================================
+
+def memcpy(dst() as byte, src() as byte, n)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        trap 6
+    end asm
+end def
+
+rem ==================================================
+rem  fill bytes with a value
+rem  @param dst - destination
+rem  @param value - value to store in each byte
+rem  @param n - number of bytes to fill
+rem ==================================================
+
+def memset(dst() as byte, value, n)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        trap 7
+    end asm
+end def
+
+rem ==================================================
+rem  format a number as a string of digits
+rem  @param buf - destination (room for 34 bytes is
+rem               always enough)
+rem  @param value - number to format (signed in base 10,
+rem                 unsigned in the other bases)
+rem  @param base - number base from 2 to 36
+rem  @param width - minimum number of digits (the
+rem                 number is padded with zeros)
+rem  @return length of the string
+rem ==================================================
+
+def intToStr(buf() as byte, value, base, width)
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        trap 38
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  return the value of the number at the start of a
+rem  string (0 if there are no digits)
+rem  @param str - string to parse
+rem  @param base - number base from 2 to 36
+rem ==================================================
+
+def strToInt(str() as byte, base)
+    asm
+        lref 0
+        slit 0
+        lref 1
+        slit 0
+        trap 39
+        returnx
+    end asm
+end def
+
+rem ==================================================
+rem  return the value of the number starting at an
+rem  index in a string
+rem  @param str - string to parse
+rem  @param index - index of the first character
+rem  @param base - number base from 2 to 36
+rem  @param last - last(0) gets the index following the
+rem               number (index if there are no digits)
+rem ==================================================
+
+def strToNum(str() as byte, index, base, last())
+    asm
+        lref 0
+        lref 1
+        lref 2
+        lref 3
+        trap 39
+        returnx
+    end asm
 end def
 
 rem ==================================================
@@ -44,6 +44,22 @@ typedef enum {
 #define SRC_SHIFT       0
 #define SRC_MASK        (0x1ff << SRC_SHIFT)
 
+/* number of hash buckets (must be a power of two) */
+#define HASH_SIZE   32
+
+/* hash table entry (embedded in the structure being indexed) */
+typedef struct HashEntry HashEntry;
+struct HashEntry {
+    HashEntry *next;
+    const char *name;
+    void *value;
+};
+
+/* case insensitive hash table */
+typedef struct {
+    HashEntry *buckets[HASH_SIZE];
+} HashTable;
+
 /* forward types */
 typedef struct Symbol Symbol;
 
@@ -51,6 +67,7 @@ typedef struct Symbol Symbol;
 typedef struct {
     Symbol *head;
     Symbol **pTail;
+    HashTable index;
 } SymbolTable;
 
 /* symbol types */
@@ -62,20 +79,23 @@ typedef enum {
 /* symbol structure */
 struct Symbol {
     Symbol *next;
+    HashEntry hashEntry;
     SymbolType type;
     VMVALUE value;
     char name[1];
 };
 
-typedef void RewindFcn(void *cookie);
 typedef int GetLineFcn(void *cookie, char *buf, int len, int *pLineNumber);
 
 /* parse context */
 typedef struct {
     jmp_buf errorTarget;            /* error target */
-    RewindFcn *rewind;              /* scan - function to rewind to the start of the source program */
     GetLineFcn *getLine;            /* scan - function to get a line from the source program */
-    void *getLineCookie;            /* scan - cookie for the rewind and getLine functions */
+    void *getLineCookie;            /* scan - cookie for the getLine function */
+    char *lineCache;                /* scan - lines read on the first pass (a line number and a string each) */
+    size_t lineCacheSize;           /* scan - size of the line cache */
+    size_t lineCacheLength;         /* scan - bytes of the line cache in use */
+    size_t lineCacheOffset;         /* scan - offset of the next line the second pass reads */
     char lineBuf[MAXLINE];          /* scan - line buffer */
     char *linePtr;                  /* scan - pointer to the current character */
     int lineNumber;                 /* scan - current line number */
@@ -254,6 +274,12 @@ static FieldDef fieldDefs[] = {
 {   NULL,           0,              0,                  0               }
 };
 
+/* opcode and field indexes */
+static HashTable opcodeIndex;
+static HashTable fieldIndex;
+static HashEntry opcodeEntries[sizeof(opcodeDefs) / sizeof(OpDef)];
+static HashEntry fieldEntries[sizeof(fieldDefs) / sizeof(FieldDef)];
+
 static int Assemble(ParseContext *c);
 static void ParseFile(ParseContext *c, int pass);
 static VMVALUE ParseExpr(ParseContext *c);
@@ -265,6 +291,8 @@ static VMVALUE ParseExpr6(ParseContext *c);
 static VMVALUE ParseExpr7(ParseContext *c);
 static VMVALUE ParsePrimary(ParseContext *c);
 static int GetLine(ParseContext *c);
+static void CacheLine(ParseContext *c, int lineNumber);
+static void FreeLineCache(ParseContext *c);
 static void FRequire(ParseContext *c, Token requiredToken);
 static void Require(ParseContext *c, Token token, Token requiredToken);
 static char *TokenName(Token token);
@@ -286,6 +314,7 @@ static int BinaryNumberToken(ParseContext *c);
 static int StringToken(ParseContext *c);
 static int CharToken(ParseContext *c);
 static void ParseError(ParseContext *c, char *fmt, ...);
+static void IndexTables(void);
 static OpDef *FindOpcode(char *name);
 static FieldDef *FindField(char *name);
 static void InitSymbolTable(SymbolTable *table);
@@ -293,6 +322,10 @@ static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMV
 static Symbol *FindSymbol(ParseContext *c, const char *name);
 static void EmptySymbolTable(SymbolTable *table);
 static void DumpSymbols(SymbolTable *table);
+static void InitHashTable(HashTable *table);
+static void AddHashEntry(HashTable *table, HashEntry *entry, const char *name, void *value);
+static void *FindHashEntry(HashTable *table, const char *name);
+static unsigned int HashName(const char *name);
 static void putcword(ParseContext *c, VMVALUE w);
 
 typedef struct {
@@ -300,7 +333,6 @@ typedef struct {
     int lineNumber;
 } SourceInfo;
 
-static void SourceRewind(void *cookie);
 static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber);
 
 int main(int argc, char *argv[])
@@ -325,7 +357,6 @@ int main(int argc, char *argv[])
     memset(&context, 0, sizeof(context));
     
     /* setup the parser callbacks */
-    context.rewind = SourceRewind;
     context.getLine = SourceGetLine;
     context.getLineCookie = &sourceInfo;
     
@@ -337,12 +368,6 @@ int main(int argc, char *argv[])
     return 0;
 }
 
-static void SourceRewind(void *cookie)
-{
-    SourceInfo *info = (SourceInfo *)cookie;
-    fseek(info->fp, 0, SEEK_SET);
-}
-
 static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber)
 {
     SourceInfo *info = (SourceInfo *)cookie;
@@ -352,9 +377,20 @@ static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber)
 
 static int Assemble(ParseContext *c)
 {
+    /* the first pass caches the lines for the second */
+    c->lineCache = NULL;
+    c->lineCacheSize = 0;
+    c->lineCacheLength = 0;
+    c->lineCacheOffset = 0;
+
 	/* setup an error target */
-    if (setjmp(c->errorTarget) != 0)
+    if (setjmp(c->errorTarget) != 0) {
+        FreeLineCache(c);
         return FALSE;
+    }
+
+    /* index the opcode and field tables */
+    IndexTables();
 
     /* initialize the symbol tables */
     InitSymbolTable(&c->globals);
@@ -385,8 +421,8 @@ static int Assemble(ParseContext *c)
     AddSymbol(c, "vscl",  SYMBOL_VALUE, 0x1ff);
     
     ParseFile(c, 1);
-    (*c->rewind)(c->getLineCookie);
     ParseFile(c, 2);
+    FreeLineCache(c);
     
     DumpSymbols(&c->globals);
     
@@ -674,18 +710,59 @@ static VMVALUE ParsePrimary(ParseContext *c)
     return expr;
 }
 
-/* GetLine - get the next input line */
+/* GetLine - get the next input line (the second pass reads the lines the first one cached) */
 static int GetLine(ParseContext *c)
 {
+    char *line;
     int lineNumber;
-    if (!(*c->getLine)(c->getLineCookie, c->lineBuf, sizeof(c->lineBuf), &lineNumber))
-        return FALSE;
+    if (c->pass == 1) {
+        if (!(*c->getLine)(c->getLineCookie, c->lineBuf, sizeof(c->lineBuf), &lineNumber))
+            return FALSE;
+        CacheLine(c, lineNumber);
+    }
+    else {
+        if (c->lineCacheOffset >= c->lineCacheLength)
+            return FALSE;
+        line = c->lineCache + c->lineCacheOffset;
+        memcpy(&lineNumber, line, sizeof(int));
+        strcpy(c->lineBuf, line + sizeof(int));
+        c->lineCacheOffset += sizeof(int) + strlen(c->lineBuf) + 1;
+    }
     c->lineNumber = lineNumber;
     c->linePtr = c->lineBuf;
     c->savedToken = T_NONE;
     return TRUE;
 }
 
+/* CacheLine - add the line in the line buffer to the line cache */
+static void CacheLine(ParseContext *c, int lineNumber)
+{
+    size_t size = sizeof(int) + strlen(c->lineBuf) + 1, newSize;
+    char *newCache;
+    
+    /* grow the cache */
+    if (c->lineCacheLength + size > c->lineCacheSize) {
+        newSize = c->lineCacheSize * 2;
+        if (newSize < c->lineCacheLength + size + MAXLINE)
+            newSize = c->lineCacheLength + size + MAXLINE;
+        if (!(newCache = (char *)realloc(c->lineCache, newSize)))
+            ParseError(c, "insufficient memory");
+        c->lineCache = newCache;
+        c->lineCacheSize = newSize;
+    }
+    
+    memcpy(c->lineCache + c->lineCacheLength, &lineNumber, sizeof(int));
+    strcpy(c->lineCache + c->lineCacheLength + sizeof(int), c->lineBuf);
+    c->lineCacheLength += size;
+}
+
+/* FreeLineCache - free the line cache */
+static void FreeLineCache(ParseContext *c)
+{
+    free(c->lineCache);
+    c->lineCache = NULL;
+}
+
 /* FRequire - fetch a token and check it */
 static void FRequire(ParseContext *c, Token requiredToken)
 {
@@ -1134,28 +1211,28 @@ static void ParseError(ParseContext *c, char *fmt, ...)
     longjmp(c->errorTarget, 1);
 }
 
+/* IndexTables - build the opcode and field indexes */
+static void IndexTables(void)
+{
+    int i;
+    InitHashTable(&opcodeIndex);
+    for (i = 0; opcodeDefs[i].opname != NULL; ++i)
+        AddHashEntry(&opcodeIndex, &opcodeEntries[i], opcodeDefs[i].opname, &opcodeDefs[i]);
+    InitHashTable(&fieldIndex);
+    for (i = 0; fieldDefs[i].keyword != NULL; ++i)
+        AddHashEntry(&fieldIndex, &fieldEntries[i], fieldDefs[i].keyword, &fieldDefs[i]);
+}
+
 /* FindOpcode - find an opcode definition */
 static OpDef *FindOpcode(char *name)
 {
-    OpDef *def = opcodeDefs;
-    while (def->opname != NULL) {
-        if (strcasecmp(name, def->opname) == 0)
-            return def;
-        ++def;
-    }
-    return NULL;
+    return (OpDef *)FindHashEntry(&opcodeIndex, name);
 }
 
 /* FindField - find a field definition */
 static FieldDef *FindField(char *name)
 {
-    FieldDef *def = fieldDefs;
-    while (def->keyword != NULL) {
-        if (strcasecmp(name, def->keyword) == 0)
-            return def;
-        ++def;
-    }
-    return NULL;
+    return (FieldDef *)FindHashEntry(&fieldIndex, name);
 }
 
 /* InitSymbolTable - initialize an assembler symbol table */
@@ -1163,6 +1240,7 @@ static void InitSymbolTable(SymbolTable *table)
 {
     table->head = NULL;
     table->pTail = &table->head;
+    InitHashTable(&table->index);
 }
 
 /* AddSymbol - add symbol to the assembler symbol table */
@@ -1191,6 +1269,7 @@ static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMV
     /* add it to the symbol table */
     *table->pTail = sym;
     table->pTail = &sym->next;
+    AddHashEntry(&table->index, &sym->hashEntry, sym->name, sym);
     
     /* return the symbol */
     return sym;
@@ -1202,19 +1281,11 @@ static Symbol *FindSymbol(ParseContext *c, const char *name)
     Symbol *sym;
     
     /* check the local symbol table */
-    for (sym = c->locals.head; sym != NULL; sym = sym->next) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-    }
+    if ((sym = (Symbol *)FindHashEntry(&c->locals.index, name)) != NULL)
+        return sym;
     
     /* check the global symbol table */
-    for (sym = c->globals.head; sym != NULL; sym = sym->next) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-    }
-    
-    /* not found */
-    return NULL;
+    return (Symbol *)FindHashEntry(&c->globals.index, name);
 }
 
 /* EmptySymbolTable - empty and reinitialize a symbol table */
@@ -1236,6 +1307,41 @@ static void DumpSymbols(SymbolTable *table)
         printf("%08x %s\n", sym->value, sym->name);
 }
 
+/* InitHashTable - initialize a hash table */
+static void InitHashTable(HashTable *table)
+{
+    memset(table->buckets, 0, sizeof(table->buckets));
+}
+
+/* AddHashEntry - add an entry to a hash table */
+static void AddHashEntry(HashTable *table, HashEntry *entry, const char *name, void *value)
+{
+    HashEntry **pBucket = &table->buckets[HashName(name) & (HASH_SIZE - 1)];
+    entry->name = name;
+    entry->value = value;
+    entry->next = *pBucket;
+    *pBucket = entry;
+}
+
+/* FindHashEntry - find the value of an entry in a hash table */
+static void *FindHashEntry(HashTable *table, const char *name)
+{
+    HashEntry *entry = table->buckets[HashName(name) & (HASH_SIZE - 1)];
+    for (; entry != NULL; entry = entry->next)
+        if (strcasecmp(name, entry->name) == 0)
+            return entry->value;
+    return NULL;
+}
+
+/* HashName - compute a case insensitive hash value for a name */
+static unsigned int HashName(const char *name)
+{
+    unsigned int hash = 0;
+    while (*name)
+        hash = ((hash << 5) + hash) ^ tolower((unsigned char)*name++);
+    return hash;
+}
+
 static void putcword(ParseContext *c, VMVALUE w)
 {
     printf("%08x\n", w);
@@ -0,0 +1,39 @@
+include "print.bas"
+include "propeller.bas"
+
+rem each worker cog sums part of a series into the shared total
+
+dim stack1(40), stack2(40)
+dim total, done, lock
+
+def worker(first, count)
+  dim j, sum
+  sum = 0
+  for j = first to first + count - 1
+    sum = sum + j
+  next j
+  do while lockset(lock)
+  loop
+  total = total + sum
+  done = done + 1
+  lockclr(lock)
+end def
+
+def started(id)
+  if id < 0 then
+    print "no cog (COGSTART needs a board without a cache)"
+    end
+  end if
+  print "started cog "; id
+end def
+
+dim id
+lock = locknew
+cogstart worker(1, 500), stack1, id
+started(id)
+cogstart worker(501, 500), stack2, id
+started(id)
+do while done < 2
+loop
+print "total "; total
+lockret(lock)
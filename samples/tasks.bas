@@ -0,0 +1,39 @@
+include "print.bas"
+include "propeller.bas"
+
+rem a producer and a consumer task take turns with the main code on one VM cog
+
+dim stack1(30), stack2(30)
+dim item, full, produced, consumed
+
+def producer(count)
+  dim j
+  for j = 1 to count
+    waitfor full = 0
+    item = j * j
+    full = 1
+    produced = produced + 1
+  next j
+end def
+
+def consumer(count)
+  dim j, sum
+  sum = 0
+  for j = 1 to count
+    waitfor full
+    sum = sum + item
+    full = 0
+    consumed = consumed + 1
+  next j
+  print "sum of squares "; sum
+end def
+
+dim id
+task producer(10), stack1, id
+if id < 0 then
+  print "no task"
+  end
+end if
+task consumer(10), stack2
+waitfor consumed = 10, 1000
+print "produced "; produced; " consumed "; consumed
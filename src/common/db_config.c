@@ -171,6 +171,11 @@ void ParseConfigurationFile(System *sys, const char *path)
                     Error(&buf, "invalid numeric value");
                 config->baudrate = iValue;
             }
+            else if (strcasecmp(tag, "load-baudrate") == 0) {
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                config->loadBaudrate = iValue;
+            }
             else if (strcasecmp(tag, "rxpin") == 0) {
                 if (!ParseNumericExpr(&buf, value, &iValue))
                     Error(&buf, "invalid numeric value");
@@ -207,6 +212,44 @@ void ParseConfigurationFile(System *sys, const char *path)
                     Error(&buf, "invalid numeric value");
                 config->cacheParam2 = iValue;
             }
+            else if (strcasecmp(tag, "cache-line-size") == 0) {
+                int width;
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                for (width = 4; width <= 9 && (1 << width) != iValue; ++width)
+                    ;
+                if (width > 9)
+                    Error(&buf, "cache line size must be a power of two from 16 to 512");
+                config->cacheParam2 = (config->cacheParam2 & ~0xff) | width;
+            }
+            else if (strcasecmp(tag, "cache-ways") == 0) {
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                if (iValue == 1)
+                    config->cacheParam2 &= ~CACHE_TWO_WAY;
+                else if (iValue == 2)
+                    config->cacheParam2 |= CACHE_TWO_WAY;
+                else
+                    Error(&buf, "cache ways must be 1 or 2");
+            }
+            else if (strcasecmp(tag, "cache-prefetch") == 0) {
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                if (iValue)
+                    config->cacheParam2 |= CACHE_PREFETCH;
+                else
+                    config->cacheParam2 &= ~CACHE_PREFETCH;
+            }
+            else if (strcasecmp(tag, "cache-miss-cycles") == 0) {
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                config->cacheMissCycles = iValue;
+            }
+            else if (strcasecmp(tag, "compare-branches") == 0) {
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                config->compareBranches = (iValue != 0);
+            }
             else if (strcasecmp(tag, "text") == 0) {
                 if (config->defaultTextSection)
                     free(config->defaultTextSection);
@@ -230,6 +273,30 @@ void ParseConfigurationFile(System *sys, const char *path)
                 pNextSection = &section->next;
                 ++config->sectionCount;
             }
+            else if (strcasecmp(tag, "eeprom-size") == 0) {
+                /* the boot EEPROM above the boot image takes the place of flash */
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                if (!(section = NewSection("eeprom")))
+                    Error(&buf, "insufficient memory");
+                section->base = FLASH_BASE;
+                section->size = iValue;
+                *pNextSection = section;
+                pNextSection = &section->next;
+                ++config->sectionCount;
+            }
+            else if (strcasecmp(tag, "sd-size") == 0) {
+                /* raw sectors of an SD card take the place of flash */
+                if (!ParseNumericExpr(&buf, value, &iValue))
+                    Error(&buf, "invalid numeric value");
+                if (!(section = NewSection("sd")))
+                    Error(&buf, "insufficient memory");
+                section->base = FLASH_BASE;
+                section->size = iValue;
+                *pNextSection = section;
+                pNextSection = &section->next;
+                ++config->sectionCount;
+            }
             else if (strcasecmp(tag, "ram-size") == 0) {
                 if (!ParseNumericExpr(&buf, value, &iValue))
                     Error(&buf, "invalid numeric value");
@@ -12,7 +12,8 @@
 
 /* configuration variables
 
-MAXCODE		the size of the bytecode staging buffer used by the compiler
+MAXCODE		the largest size of the bytecode staging buffer used by the compiler
+COMPACT_COMPILER	use small fixed line, token and code buffers (for compiling on the target)
 
 */
 
@@ -21,7 +22,7 @@ MAXCODE		the size of the bytecode staging buffer used by the compiler
 #define WORD_SIZE_32
 #define FAR_DATA
 #define FLASH_SPACE		const
-#define MAXCODE         (32 * 1024)
+#define MAXCODE         (1024 * 1024)
 #define NEED_STRCASECMP
 
 /* support for posix (cygwin, linux, macosx) */
@@ -29,8 +30,14 @@ MAXCODE		the size of the bytecode staging buffer used by the compiler
 #define WORD_SIZE_32
 #define FAR_DATA
 #define FLASH_SPACE		const
-#define MAXCODE         (32 * 1024)
+#define MAXCODE         (1024 * 1024)
+
+#endif
 
+/* the compact compiler keeps a fixed size staging buffer */
+#ifdef COMPACT_COMPILER
+#undef MAXCODE
+#define MAXCODE         (32 * 1024)
 #endif
 
 /* for all propeller platforms */
@@ -89,16 +96,26 @@ struct Section {
     VMUVALUE base;      // base address
     VMUVALUE size;      // maximum size
     VMUVALUE offset;    // next available offset
+    VMUVALUE packOffset; // next free byte in the long holding packed bytes and words
+    VMUVALUE packEnd;   // end of the long holding packed bytes and words
     FILE *fp;           // image or scratch file pointer
+    uint8_t *buf;       // in-memory section data (NULL if the section is in a file)
+    VMUVALUE bufSize;   // allocated size of the in-memory section data
     Section *next;      // next section
     char name[1];       // section name
 };
 
+/* cache-param2 flags selecting a 2-way set associative cache and prefetching of the line
+   following a miss (the low byte is the line offset width) */
+#define CACHE_TWO_WAY   0x100
+#define CACHE_PREFETCH  0x200
+
 typedef struct BoardConfig BoardConfig;
 struct BoardConfig {
     uint32_t clkfreq;
     uint8_t clkmode;
     uint32_t baudrate;
+    uint32_t loadBaudrate;
     uint8_t rxpin;
     uint8_t txpin;
     uint8_t tvpin;
@@ -106,6 +123,8 @@ struct BoardConfig {
     VMUVALUE cacheSize;
     VMUVALUE cacheParam1;
     VMUVALUE cacheParam2;
+    VMUVALUE cacheMissCycles;   // cycles the cache driver takes to load a line (only xbint's estimates use it)
+    int compareBranches;        // -O can use the compare and branch opcodes (xbint runs them, the Propeller runtime emulates them)
     char *defaultTextSection;
     char *defaultDataSection;
     int sectionCount;
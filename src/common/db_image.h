@@ -10,7 +10,10 @@
 #include "db_config.h"
 
 #define IMAGE_TAG       "XLOD"
-#define IMAGE_VERSION   0x0100
+#define IMAGE_VERSION_1 0x0100      /* original format */
+#define IMAGE_VERSION_2 0x0200      /* adds the short branch, literal, switch, loop, global, call and return opcodes */
+#define IMAGE_VERSION_3 0x0300      /* FRAME gives the stack depth of the function so other pushes aren't checked */
+#define IMAGE_VERSION   IMAGE_VERSION_3
 
 /* image file section */
 typedef struct {
@@ -23,13 +26,57 @@ typedef struct {
 typedef struct {
     uint8_t tag[4];     /* should be 'XLOD' */
     uint16_t version;   /* version number */
-    uint16_t unused;    /* (unused at present) */
+    uint16_t flags;     /* image flags */
     VMUVALUE mainCode;
     VMUVALUE stackSize;
     VMUVALUE sectionCount;
     ImageFileSection sections[1];
 } ImageFileHdr;
 
+/* image flags */
+#define IMAGE_SYMBOLS   (1 << 0)    /* a symbol table follows the section data */
+#define IMAGE_VERIFIED  (1 << 1)    /* the code has passed the bytecode verifier */
+#define IMAGE_DEBUG     (1 << 2)    /* a debug section follows the section data */
+#define IMAGE_COGS      (1 << 3)    /* the code uses COGSTART so the VM code has to stay in hub memory */
+
+/* image file symbol table header */
+typedef struct {
+    VMUVALUE count;     /* number of symbols */
+    VMUVALUE size;      /* size of the symbol entries that follow */
+} ImageFileSymbolHdr;
+
+/* image file symbol (followed by the zero terminated name padded to a word boundary) */
+typedef struct {
+    VMUVALUE value;     /* symbol address */
+    VMUVALUE size;      /* size of the entry including the name */
+} ImageFileSymbol;
+
+/* the debug section is described by one more ImageFileSection that follows the
+   section data (and the symbol table of older images), its base is DEBUG_BASE and
+   its offset and size give the debug data, which is never downloaded to the target:
+     ImageFileDebugHdr
+     function symbols   symbolCount ImageFileSymbol entries taking symbolSize bytes
+     line table         lineCount ImageFileLine entries in increasing address order
+     file names         fileCount zero terminated names padded to a word boundary taking
+                        fileSize bytes (file 0 is the main file and has an empty name) */
+#define DEBUG_BASE      0xffffffff
+
+/* image file debug section header */
+typedef struct {
+    VMUVALUE symbolCount;   /* number of function symbols */
+    VMUVALUE symbolSize;    /* size of the function symbol entries */
+    VMUVALUE lineCount;     /* number of line table entries */
+    VMUVALUE fileCount;     /* number of file names */
+    VMUVALUE fileSize;      /* size of the file names */
+} ImageFileDebugHdr;
+
+/* image file line table entry (the code from the address up to the next entry is from the line) */
+typedef struct {
+    VMUVALUE address;   /* address of the first instruction of the line */
+    VMUVALUE line;      /* line number within the file */
+    VMUVALUE file;      /* index of the file name */
+} ImageFileLine;
+
 /* stack frame offsets */
 #define F_FP    -1
 #define F_SIZE  1
@@ -72,18 +119,205 @@ typedef struct {
 #define OP_PUSHJ        0x22    /* push the pc and jump to a function */
 #define OP_POPJ         0x23    /* return to the address on the stack */
 #define OP_CLEAN        0x24    /* clean arguments off the stack after a function call */
-#define OP_FRAME        0x25    /* create a stack frame */
+#define OP_FRAME        0x25    /* create a stack frame and check the stack for the function's depth */
 #define OP_RETURN       0x26    /* remove a stack frame and return from a function call */
 #define OP_RETURNZ      0x27    /* remove a stack frame and return zero from a function call */
 #define OP_DROP         0x28    /* drop the top element of the stack */
 #define OP_DUP          0x29    /* duplicate the top element of the stack */
 #define OP_NATIVE       0x2a    /* execute native code */
 #define OP_TRAP         0x2b    /* trap to handler */
+#define OP_LINC         0x2c    /* add a short literal to a local variable */
+#define OP_LOADA        0x2d    /* load a long from an absolute address */
+#define OP_STOREA       0x2e    /* store a long at an absolute address */
+#define OP_LOADX        0x2f    /* index into a vector of longs and load an element */
+#define OP_STOREX       0x30    /* index into a vector of longs and store an element */
+#define OP_BR8          0x31    /* branch unconditionally with an 8 bit offset */
+#define OP_BR16         0x32    /* branch unconditionally with a 16 bit offset */
+#define OP_LIT16        0x33    /* load a 16 bit literal (-32768 to 32767) */
+#define OP_SWITCH       0x34    /* branch through a table of BR instructions */
+#define OP_FORLOOP      0x35    /* step a local loop variable and branch back if it hasn't passed the limit */
+#define OP_FORLOOPA     0x36    /* step a loop variable at an absolute address and branch back if it hasn't passed the limit */
+#define OP_GREF         0x37    /* load a global variable with an 8 bit long offset */
+#define OP_GSET         0x38    /* set a global variable with an 8 bit long offset */
+#define OP_GREF16       0x39    /* load a global variable with a 16 bit long offset */
+#define OP_GSET16       0x3a    /* set a global variable with a 16 bit long offset */
+#define OP_CALL         0x3b    /* call a function at an absolute address */
+#define OP_RET          0x3c    /* remove a stack frame and the arguments and return from a function call */
+#define OP_LOADW        0x3d    /* load a 16 bit word from memory */
+#define OP_STOREW       0x3e    /* store a 16 bit word into memory */
+#define OP_BRLT         0x40    /* branch if less than */
+#define OP_BRLE         0x41    /* branch if less than or equal to */
+#define OP_BREQ         0x42    /* branch if equal to */
+#define OP_BRNE         0x43    /* branch if not equal to */
+#define OP_BRGE         0x44    /* branch if greater than or equal to */
+#define OP_BRGT         0x45    /* branch if greater than */
+#define OP_BRLTZ        0x46    /* branch if less than zero */
+#define OP_BRLEZ        0x47    /* branch if less than or equal to zero */
+#define OP_BRGEZ        0x48    /* branch if greater than or equal to zero */
+#define OP_BRGTZ        0x49    /* branch if greater than zero */
+#define OP_CHECK        0x4a    /* check an index against the number of elements of an array */
+#define OP_VREF         0x4b    /* check an index and load an element of a vector of longs */
+#define OP_VSET         0x4c    /* check an index and store an element of a vector of longs */
+
+/* OP_SWITCH n is followed by n + 1 long BR instructions, it pops an index and
+   takes branch 'index' if the index is less than n or the last one otherwise */
+
+/* OP_FORLOOP var, step, disp and OP_FORLOOPA addr, step, disp add the signed byte
+   step to the loop variable, pop the limit and branch by the long displacement
+   if the new value is less than or equal to the limit */
+
+/* OP_GREF n, OP_GSET n, OP_GREF16 n and OP_GSET16 n access the long at hub address
+   n * sizeof(VMVALUE) where the data section lives (the 16 bit offset is 0 to 32767) */
+
+/* OP_CALL addr is OP_LIT addr followed by OP_PUSHJ, OP_RET n is OP_RETURN followed
+   by the caller's OP_CLEAN n so a function that returns with it removes its own arguments */
+
+/* OP_LOADW and OP_STOREW are beyond the opcodes the cache PASM VM dispatches, it reports
+   them as illegal opcodes and the Spin runtime performs them and continues (the hub VM
+   does aligned hub words itself and reports the rest the same way) */
+
+/* OP_BRLT disp to OP_BRGT disp pop the two operands of a comparison and branch by the long
+   displacement if it holds, OP_BRLTZ disp to OP_BRGTZ disp compare the top of the stack with
+   zero (OP_BRT and OP_BRF are the not equal and equal forms), the PASM VMs have no room for
+   them so the compiler only generates them for boards with compare-branches set and the Spin
+   runtime performs them like OP_LOADW (0x3f is the breakpoint it writes over code) */
+
+/* OP_CHECK n, OP_VREF n and OP_VSET n stop the program unless the index in tos is less than
+   the element count n as an unsigned value, OP_VREF and OP_VSET then do what OP_LOADX and
+   OP_STOREX do, the compiler generates them with -C and the Spin runtime performs them */
+
+/* the hub VM keeps a kernel at these cog addresses to run the LMM code the compiler generates
+   for NATIVE functions, the function's bytecode is FRAME, SLIT 0, NATIVE jmp #LMM_ENTER and
+   RETURN or RET n and its LMM code starts at the first long at least two bytes past the end
+   of the NATIVE instruction (xbasic_vm.spin and db_pasm.c must agree with these) */
+#define LMM_PC          0x00a   /* hub address of the next LMM instruction */
+#define LMM_K           0x00b   /* long loaded by LMM_LDI */
+#define LMM_REGS        0x00c   /* registers holding the arguments and locals */
+#define LMM_REG_COUNT   8
+#define LMM_FCACHE      0x00b   /* cog buffer for an ASM FCACHE block (over LMM_K and the registers) */
+#define LMM_FCACHE_SIZE 10
+#define LMM_TAG         0x015   /* VM address of the block in the buffer or -1 */
+#define LMM_ENTER       0x016   /* start the LMM code following the NATIVE instruction */
+#define LMM_CALL        0x01a   /* start the LMM code at the VM address in tos */
+#define LMM_JMP         0x020   /* jump to the VM address in the next long */
+#define LMM_LDI         0x023   /* load the next long into LMM_K and skip over it */
+#define LMM_RET         0x026   /* return to the VM with the function value in tos */
+#define LMM_JMP_INSN(a) (0x5c7c0000 | (a))  /* jmp #a */
+#define LMM_ENTER_INSN  LMM_JMP_INSN(LMM_ENTER)
+#define LMM_CALL_INSN   LMM_JMP_INSN(LMM_CALL)
+
+/* an ASM FCACHE statement is LIT <block>, NATIVE jmp #LMM_CALL and DROP, the block starts with
+   LMM code that copies the PASM that follows it into LMM_FCACHE unless LMM_TAG says it is
+   already there and then jumps to it, the PASM ends with a jmp #LMM_RET */
 
 /* OP_TRAP functions */
 enum {
     TRAP_GETCHAR = 0x00,
-    TRAP_PUTCHAR
+    TRAP_PUTCHAR,
+    TRAP_PUTSTR,
+    TRAP_STRLEN,
+    TRAP_STRCMP,
+    TRAP_STRCPY,
+    TRAP_MEMCPY,
+    TRAP_MEMSET,
+    TRAP_ARRFILL,
+    TRAP_ARRCOPY,
+    TRAP_ARRADD,
+    TRAP_ARRMAC,
+    TRAP_ARRSCALE,
+    TRAP_ARRSUM,
+    TRAP_ARRDOT,
+    TRAP_ARRMIN,
+    TRAP_ARRMAX,
+    TRAP_BUTTERFLY,
+    TRAP_FIXMUL,
+    TRAP_FIXDIV,
+    TRAP_FADD,
+    TRAP_FSUB,
+    TRAP_FMUL,
+    TRAP_FDIV,
+    TRAP_FCMP,
+    TRAP_ITOF,
+    TRAP_FTOI,
+    TRAP_COGSTART,
+    TRAP_LOCKNEW,
+    TRAP_LOCKRET,
+    TRAP_LOCKSET,
+    TRAP_LOCKCLR,
+    TRAP_TASKSTART,
+    TRAP_TASKEXIT,
+    TRAP_YIELD,
+    TRAP_TASKTIMER,
+    TRAP_TASKWAIT,
+    TRAP_PUTNUM,
+    TRAP_FMTNUM,
+    TRAP_PARSENUM
 };
 
+/* TRAP_PUTSTR pops a length and a byte address and prints that many bytes
+   (a negative length prints the bytes up to a terminating zero) */
+
+/* the string and memory traps take their arguments in the order they are pushed:
+     TRAP_STRLEN str            replaces the address with the length of the string
+     TRAP_STRCMP str1 str2      replaces the arguments with -1, 0, or 1
+     TRAP_STRCPY dst src        copies a string including its terminating zero
+     TRAP_MEMCPY dst src count  copies count bytes
+     TRAP_MEMSET dst value count stores value in count bytes */
+
+/* the array traps work on count integer elements beginning at element start:
+     TRAP_ARRFILL a start count value       a(j) = value
+     TRAP_ARRCOPY dst src start count       dst(j) = src(j)
+     TRAP_ARRADD dst src start count        dst(j) = dst(j) + src(j)
+     TRAP_ARRMAC dst src start count k      dst(j) = dst(j) + src(j) * k
+     TRAP_ARRSCALE a start count k shift    a(j) = a(j) * k >> shift
+     TRAP_ARRSUM a start count              replaces the arguments with the sum of a(j)
+     TRAP_ARRDOT a b start count            replaces the arguments with the sum of a(j) * b(j)
+     TRAP_ARRMIN a start count              replaces the arguments with the smallest a(j)
+     TRAP_ARRMAX a start count              replaces the arguments with the largest a(j)
+     TRAP_BUTTERFLY bx by wx wy log2n shift applies the radix-2 FFT butterflies to the
+                                            2^log2n samples in bx and by using the
+                                            2^(log2n-1) twiddle factors in wx and wy */
+
+/* TRAP_FIXMUL and TRAP_FIXDIV multiply and divide 16.16 fixed point values using a 64 bit
+   intermediate result (the compiler generates them for the FIXED type, dividing by zero gives zero) */
+
+/* the float traps operate on IEEE single precision values (the compiler generates them for the FLOAT type)
+     TRAP_FADD a b      replaces the arguments with a + b
+     TRAP_FSUB a b      replaces the arguments with a - b
+     TRAP_FMUL a b      replaces the arguments with a * b
+     TRAP_FDIV a b      replaces the arguments with a / b
+     TRAP_FCMP a b      replaces the arguments with -1, 0, or 1 (-0 equals 0, NaN sorts beyond infinity)
+     TRAP_ITOF n        converts an integer to a float
+     TRAP_FTOI f        converts a float to an integer truncating toward zero (out of range values saturate) */
+
+/* the cog traps run functions in parallel with the main program (the compiler generates TRAP_COGSTART for COGSTART)
+     TRAP_COGSTART code exit stack first    starts a VM that calls the function at code with the stack pointer at
+                                            element first of the stack array and exit as the return address,
+                                            replaces the arguments with the new cog or -1
+     TRAP_LOCKNEW       pushes a new lock or -1 if all eight are in use
+     TRAP_LOCKRET lock  returns a lock to the free pool
+     TRAP_LOCKSET lock  sets a lock and replaces it with 1 if it was already set and 0 otherwise
+     TRAP_LOCKCLR lock  clears a lock and replaces it with its previous state the same way */
+
+/* the first COG_RESERVED longs of a COGSTART stack array hold the mailbox and state of the new VM */
+#define COG_RESERVED    10
+
+/* the task traps switch between the tasks of one VM when the running task yields
+   (the compiler generates TRAP_TASKSTART for TASK, TRAP_YIELD for YIELD and the timer traps for WAITFOR)
+     TRAP_TASKSTART code exit stack first   adds a task that calls the function at code with the stack pointer at
+                                            element first of the stack array and exit as the return address,
+                                            replaces the arguments with the new task or -1
+     TRAP_TASKEXIT      removes the running task and switches to the next one
+     TRAP_YIELD         switches to the next task
+     TRAP_TASKTIMER ms  starts the WAITFOR timer of the running task (a negative timeout never expires)
+     TRAP_TASKWAIT      pushes 1 if the timer has expired, otherwise pushes 0 and switches to the next task */
+
+/* the number traps use digits 0-9 and A-Z in bases 2 to 36 (base 10 is signed, the others are unsigned)
+     TRAP_PUTNUM value base width           prints value with at least width digits (padded with zeros)
+     TRAP_FMTNUM buf value base width       stores the digits and a terminating zero in buf and replaces the
+                                            arguments with the number of characters stored before the zero
+     TRAP_PARSENUM str index base end       replaces the arguments with the value of the number starting at
+                                            str(index) (a sign and the digits valid in base), end is zero or
+                                            the address of a long that gets the index following the number */
+
 #endif
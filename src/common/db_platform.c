@@ -90,3 +90,24 @@ void VM_putchar(int ch)
 }
 
 #endif
+
+/************/
+/* VM_write */
+/************/
+
+#if defined(PROPELLER_CAT)
+
+void VM_write(const char *buf, int size)
+{
+	while (--size >= 0)
+		t_char(CURSOR, *buf++);
+}
+
+#else // posix
+
+void VM_write(const char *buf, int size)
+{
+	fwrite(buf, 1, size, stdout);
+}
+
+#endif
@@ -7,6 +7,8 @@
 #if defined(WIN32)
 #include <windows.h>
 #include <psapi.h>
+#else
+#include <sys/time.h>
 #endif
 
 typedef struct PathEntry PathEntry;
@@ -18,7 +20,7 @@ struct PathEntry {
 static PathEntry *path = NULL;
 static PathEntry **pNextPathEntry = &path;
 
-static const char *MakePath(PathEntry *entry, const char *name);
+static const char *MakePath(PathEntry *entry, const char *name, char *fullpath);
 
 void xbInfo(System *sys, const char *fmt, ...)
 {
@@ -38,6 +40,7 @@ void xbError(System *sys, const char *fmt, ...)
 
 void *xbOpenFileInPath(System *sys, const char *name, const char *mode)
 {
+    char fullpath[PATH_MAX];
     PathEntry *entry;
     void *file;
     
@@ -50,7 +53,7 @@ void *xbOpenFileInPath(System *sys, const char *name, const char *mode)
     
     if (!(file = xbOpenFile(sys, name, mode))) {
         for (entry = path; entry != NULL; entry = entry->next)
-            if ((file = xbOpenFile(sys, MakePath(entry, name), mode)) != NULL)
+            if ((file = xbOpenFile(sys, MakePath(entry, name, fullpath), mode)) != NULL)
                 break;
     }
     return file;
@@ -134,9 +137,8 @@ int xbAddEnvironmentPath(void)
     return TRUE;
 }
 
-static const char *MakePath(PathEntry *entry, const char *name)
+static const char *MakePath(PathEntry *entry, const char *name, char *fullpath)
 {
-    static char fullpath[PATH_MAX];
     sprintf(fullpath, "%s%c%s", entry->path, DIR_SEP, name);
 	return fullpath;
 }
@@ -183,6 +185,21 @@ int xbSeekFile(void *file, long offset, int whence)
     return fseek((FILE *)file, offset, whence);
 }
 
+/* xbGetMicroseconds - get a wall clock time in microseconds (only differences are meaningful) */
+unsigned long xbGetMicroseconds(void)
+{
+#if defined(WIN32)
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (unsigned long)(count.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (unsigned long)now.tv_sec * 1000000 + now.tv_usec;
+#endif
+}
+
 #if defined(NEED_STRCASECMP)
 
 int strcasecmp(const char *s1, const char *s2)
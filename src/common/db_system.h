@@ -23,6 +23,8 @@ typedef struct System System;
 typedef struct {
     void (*info)(System *sys, const char *fmt, va_list ap);
     void (*error)(System *sys, const char *fmt, va_list ap);
+    /* optional - report a compile error with its position (file is NULL for the main file) */
+    void (*diagnostic)(System *sys, const char *file, int line, int column, const char *message);
 } SystemOps;
 
 /* system interface */
@@ -49,5 +51,8 @@ int xbRemoveTmpFile(System *sys, const char *name);
 void *xbGlobalAlloc(System *sys, size_t size);
 void *xbLocalAlloc(System *sys, size_t size);
 void xbLocalFreeAll(System *sys);
+size_t xbHeapAllocated(System *sys);
+size_t xbMaxHeapUsed(System *sys);
+unsigned long xbGetMicroseconds(void);
 
 #endif
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include "db_config.h"
+#include "mem_arena.h"
+
+/* size of a standard arena chunk */
+#define CHUNK_SIZE              (64 * 1024)
+
+/* allocations are aligned for the largest host type the compiler stores */
+#define ARENA_ALIGN_MASK        (sizeof(double) - 1)
+#define ROUND_TO_ARENA(x)       (((x) + ARENA_ALIGN_MASK) & ~ARENA_ALIGN_MASK)
+
+typedef struct Chunk Chunk;
+struct Chunk {
+    Chunk *next;                    /* next chunk in the arena */
+    size_t size;                    /* size of the chunk data */
+    double data[1];                 /* chunk data (double for alignment) */
+};
+
+#define CHUNK_HDR_SIZE          offsetof(Chunk, data)
+
+typedef struct {
+    Chunk *chunks;                  /* chunks with the current chunk first */
+    uint8_t *next;                  /* next free byte in the current chunk */
+    uint8_t *top;                   /* top of the current chunk */
+} Arena;
+
+typedef struct {
+    System sys;
+    Arena global;                   /* global heap arena */
+    Arena local;                    /* local heap arena */
+    Chunk *spareChunks;             /* standard chunks released by xbLocalFreeAll */
+    size_t localHeapUsed;           /* amount of local heap space currently allocated */
+    size_t totalHeapUsed;           /* total amount of heap space currently allocated */
+    size_t maxHeapUsed;             /* maximum amount of heap space allocated so far */
+    size_t heapAllocated;           /* amount of heap space allocated since initialization */
+} MySystem;
+
+static void *ArenaAlloc(MySystem *sys, Arena *arena, size_t size);
+static void FreeChunks(Chunk *chunk);
+
+/* MemInit - initialize the memory allocator */
+System *MemInit(void)
+{
+    MySystem *sys;
+    
+    /* allocate the system interface structure */
+    if (!(sys = (MySystem *)malloc(sizeof(MySystem))))
+        return NULL;
+        
+    /* initialize */
+    sys->global.chunks = NULL;
+    sys->global.next = sys->global.top = NULL;
+    sys->local.chunks = NULL;
+    sys->local.next = sys->local.top = NULL;
+    sys->spareChunks = NULL;
+    sys->localHeapUsed = 0;
+    sys->totalHeapUsed = 0;
+    sys->maxHeapUsed = 0;
+    sys->heapAllocated = 0;
+    
+    /* return the system interface structure */
+    return (System *)sys;
+}
+
+/* MemFree - free all allocated memory */
+void MemFree(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    FreeChunks(sys->global.chunks);
+    FreeChunks(sys->local.chunks);
+    FreeChunks(sys->spareChunks);
+    free(sys);
+}
+
+/* xbGlobalAlloc - allocate memory from the global heap */
+void *xbGlobalAlloc(System *sysbase, size_t size)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    void *p;
+    size = ROUND_TO_ARENA(size);
+    if (!(p = ArenaAlloc(sys, &sys->global, size)))
+        return NULL;
+    sys->heapAllocated += size;
+    if ((sys->totalHeapUsed += size) > sys->maxHeapUsed)
+        sys->maxHeapUsed = sys->totalHeapUsed;
+    return p;
+}
+
+/* xbLocalAlloc - allocate memory from the local heap */
+void *xbLocalAlloc(System *sysbase, size_t size)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    void *p;
+    size = ROUND_TO_ARENA(size);
+    if (!(p = ArenaAlloc(sys, &sys->local, size)))
+        return NULL;
+    sys->localHeapUsed += size;
+    sys->heapAllocated += size;
+    if ((sys->totalHeapUsed += size) > sys->maxHeapUsed)
+        sys->maxHeapUsed = sys->totalHeapUsed;
+    return p;
+}
+
+/* xbLocalFreeAll - free all local memory */
+void xbLocalFreeAll(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    Chunk *chunk, *next;
+    
+    /* keep the standard chunks for the next phase and free the oversized ones */
+    for (chunk = sys->local.chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        if (chunk->size == CHUNK_SIZE) {
+            chunk->next = sys->spareChunks;
+            sys->spareChunks = chunk;
+        }
+        else
+            free(chunk);
+    }
+    sys->local.chunks = NULL;
+    sys->local.next = sys->local.top = NULL;
+    
+    sys->totalHeapUsed -= sys->localHeapUsed;
+    sys->localHeapUsed = 0;
+}
+
+/* xbHeapAllocated - get the amount of heap space allocated since initialization */
+size_t xbHeapAllocated(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->heapAllocated;
+}
+
+/* xbMaxHeapUsed - get the maximum amount of heap space allocated so far */
+size_t xbMaxHeapUsed(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->maxHeapUsed;
+}
+
+/* ArenaAlloc - allocate space from an arena */
+static void *ArenaAlloc(MySystem *sys, Arena *arena, size_t size)
+{
+    Chunk *chunk;
+    void *p;
+    
+    /* allocate from the current chunk if there is room */
+    if (size <= (size_t)(arena->top - arena->next)) {
+        p = arena->next;
+        arena->next += size;
+        return p;
+    }
+    
+    /* give a large allocation a chunk of its own behind the current chunk */
+    if (size > CHUNK_SIZE / 4) {
+        if (!(chunk = (Chunk *)malloc(CHUNK_HDR_SIZE + size)))
+            return NULL;
+        chunk->size = size;
+        if (arena->chunks) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        }
+        else {
+            chunk->next = NULL;
+            arena->chunks = chunk;
+        }
+        return chunk->data;
+    }
+    
+    /* start a new standard chunk (reusing a spare one if possible) */
+    if ((chunk = sys->spareChunks) != NULL)
+        sys->spareChunks = chunk->next;
+    else if (!(chunk = (Chunk *)malloc(CHUNK_HDR_SIZE + CHUNK_SIZE)))
+        return NULL;
+    chunk->size = CHUNK_SIZE;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->next = (uint8_t *)chunk->data + size;
+    arena->top = (uint8_t *)chunk->data + CHUNK_SIZE;
+    
+    /* return the start of the new chunk */
+    return chunk->data;
+}
+
+/* FreeChunks - free a list of chunks */
+static void FreeChunks(Chunk *chunk)
+{
+    Chunk *next;
+    for (; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef __MEM_ARENA_H__
+#define __MEM_ARENA_H__
+
+#include "db_system.h"
+
+System *MemInit(void);
+void MemFree(System *sys);
+
+#endif
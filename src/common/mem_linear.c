@@ -8,6 +8,7 @@ typedef struct {
     uint8_t *heapTop;               /* top of the heap */
     size_t heapSize;                /* size of heap space in bytes */
     size_t maxHeapUsed;             /* maximum amount of heap space allocated so far */
+    size_t heapAllocated;           /* amount of heap space allocated since initialization */
 } MySystem;
 
 /* MemInit - initialize the memory allocator */
@@ -29,6 +30,7 @@ System *MemInit(uint8_t *space, size_t size)
     sys->heapSize = size;
     sys->heapTop = sys->nextLocal = sys->nextGlobal + size;
     sys->maxHeapUsed = 0;
+    sys->heapAllocated = 0;
     
     /* return the system interface structure */
     return (System *)sys;
@@ -44,6 +46,7 @@ void *xbGlobalAlloc(System *sysbase, size_t size)
         return NULL;
     p = sys->nextGlobal;
     sys->nextGlobal += size;
+    sys->heapAllocated += size;
     if (sys->heapSize - (sys->nextLocal - sys->nextGlobal) > sys->maxHeapUsed)
         sys->maxHeapUsed = sys->heapSize - (sys->nextLocal - sys->nextGlobal);
     return p;
@@ -57,6 +60,7 @@ void *xbLocalAlloc(System *sysbase, size_t size)
     if (sys->nextLocal - size < sys->nextGlobal)
         return NULL;
     sys->nextLocal -= size;
+    sys->heapAllocated += size;
     if (sys->heapSize - (sys->nextLocal - sys->nextGlobal) > sys->maxHeapUsed)
         sys->maxHeapUsed = sys->heapSize - (sys->nextLocal - sys->nextGlobal);
     return sys->nextLocal;
@@ -68,3 +72,17 @@ void xbLocalFreeAll(System *sysbase)
     MySystem *sys = (MySystem *)sysbase;
     sys->nextLocal = sys->heapTop;
 }
+
+/* xbHeapAllocated - get the amount of heap space allocated since initialization */
+size_t xbHeapAllocated(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->heapAllocated;
+}
+
+/* xbMaxHeapUsed - get the maximum amount of heap space allocated so far */
+size_t xbMaxHeapUsed(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->maxHeapUsed;
+}
@@ -14,6 +14,7 @@ typedef struct {
     size_t localHeapUsed;           /* amount of local heap space currently allocated */
     size_t totalHeapUsed;           /* total amount of heap space currently allocated */
     size_t maxHeapUsed;             /* maximum amount of heap space allocated so far */
+    size_t heapAllocated;           /* amount of heap space allocated since initialization */
 } MySystem;
 
 /* MemInit - initialize the memory allocator */
@@ -31,6 +32,7 @@ System *MemInit(void)
     sys->localHeapUsed = 0;
     sys->totalHeapUsed = 0;
     sys->maxHeapUsed = 0;
+    sys->heapAllocated = 0;
     
     /* return the system interface structure */
     return (System *)sys;
@@ -59,6 +61,7 @@ void *xbGlobalAlloc(System *sysbase, size_t size)
         return NULL;
     hdr->next = sys->globalBlocks;
     sys->globalBlocks = hdr;
+    sys->heapAllocated += size;
     if ((sys->totalHeapUsed += size) > sys->maxHeapUsed)
         sys->maxHeapUsed = sys->totalHeapUsed;
     return (void *)++hdr;
@@ -75,6 +78,7 @@ void *xbLocalAlloc(System *sysbase, size_t size)
     hdr->next = sys->localBlocks;
     sys->localBlocks = hdr;
     sys->localHeapUsed += size;
+    sys->heapAllocated += size;
     if ((sys->totalHeapUsed += size) > sys->maxHeapUsed)
         sys->maxHeapUsed = sys->totalHeapUsed;
     return (void *)++hdr;
@@ -93,3 +97,17 @@ void xbLocalFreeAll(System *sysbase)
     sys->totalHeapUsed -= sys->localHeapUsed;
     sys->localHeapUsed = 0;
 }
+
+/* xbHeapAllocated - get the amount of heap space allocated since initialization */
+size_t xbHeapAllocated(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->heapAllocated;
+}
+
+/* xbMaxHeapUsed - get the maximum amount of heap space allocated so far */
+size_t xbMaxHeapUsed(System *sysbase)
+{
+    MySystem *sys = (MySystem *)sysbase;
+    return sys->maxHeapUsed;
+}
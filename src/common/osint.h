@@ -8,6 +8,7 @@
 
 /* serial i/o routines */
 int serial_init(const char *port, unsigned long baud);
+int serial_baud(unsigned long baud);
 void serial_done(void);
 int tx(uint8_t* buff, int n);
 int rx(uint8_t* buff, int n);
@@ -19,6 +20,13 @@ int console_kbhit(void);
 int console_getch(void);
 void console_putch(int ch);
 
+/* terminal mode routines */
+#define WAIT_SERIAL     (1 << 0)
+#define WAIT_CONSOLE    (1 << 1)
+void console_raw(int enable);
+int console_read(uint8_t* buff, int n);
+int serial_console_wait(int mask, int timeout);
+
 /* miscellaneous functions */
 void msleep(int ms);
 
@@ -8,9 +8,9 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <termios.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "osint.h"
 
 static HANDLE hSerial;
@@ -89,6 +89,25 @@ int serial_init(const char *port, unsigned long baud)
     return TRUE;
 }
 
+int serial_baud(unsigned long baud)
+{
+    DCB state;
+
+    /* let the last characters go out at the old rate */
+    FlushFileBuffers(hSerial);
+
+    if (!GetCommState(hSerial, &state))
+        return FALSE;
+    state.BaudRate = baud;
+    if (!SetCommState(hSerial, &state))
+        return FALSE;
+
+    /* anything received during the switch is garbage */
+    PurgeComm(hSerial, PURGE_RXABORT | PURGE_RXCLEAR);
+
+    return TRUE;
+}
+
 void serial_done(void)
 {
 	FlushFileBuffers(hSerial);
@@ -160,7 +179,7 @@ void hwreset(void)
     Sleep(100);
     EscapeCommFunction(hSerial, CLRDTR);
     Sleep(50);
-    // Purge here after reset to get rid of buffered data. Prevents "Lost HW Contact 0 f9"
+    // Purge here after reset to get rid of buffered data. Prevents "Lost HW Contact 0 f9"
     PurgeComm(hSerial, PURGE_TXABORT | PURGE_RXABORT | PURGE_TXCLEAR | PURGE_RXCLEAR);
 }
 
@@ -208,57 +227,105 @@ static void ShowLastError(void)
     LocalFree(lpMsgBuf);
 }
 
-/* console i/o functions for Unix/Linux courtesy of 'jazzed' */
-
-int console_kbhit(void)
-{
-  struct termios oldt, newt;
-  int ch;
-  int oldf;
-
-  tcgetattr(STDIN_FILENO, &oldt);
-  newt = oldt;
-  newt.c_lflag &= ~(ICANON | ECHO);
-  tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-  oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-  fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
-
-  ch = getchar();
-
-  tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-  fcntl(STDIN_FILENO, F_SETFL, oldf);
-
-  if(ch != EOF)
-  {
-    ungetc(ch, stdin);
-    return 1;
-  }
-
-  return 0;
-}
-
-int console_getch(void)
-{
-  struct termios oldt, newt;
-  int ch;
-  int oldf;
-
-  tcgetattr(STDIN_FILENO, &oldt);
-  newt = oldt;
-  newt.c_lflag &= ~(ICANON | ECHO);
-  tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-  oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-  fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
-
-  ch = getchar();
-
-  tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-  fcntl(STDIN_FILENO, F_SETFL, oldf);
-
-  return ch;
-}
-
-void console_putch(int ch)
-{
-    putchar(ch);
-}
+/* console i/o functions for Unix/Linux courtesy of 'jazzed' */
+
+int console_kbhit(void)
+{
+  struct termios oldt, newt;
+  int ch;
+  int oldf;
+
+  tcgetattr(STDIN_FILENO, &oldt);
+  newt = oldt;
+  newt.c_lflag &= ~(ICANON | ECHO);
+  tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+  oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
+  fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
+
+  ch = getchar();
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+  fcntl(STDIN_FILENO, F_SETFL, oldf);
+
+  if(ch != EOF)
+  {
+    ungetc(ch, stdin);
+    return 1;
+  }
+
+  return 0;
+}
+
+int console_getch(void)
+{
+  struct termios oldt, newt;
+  int ch;
+  int oldf;
+
+  tcgetattr(STDIN_FILENO, &oldt);
+  newt = oldt;
+  newt.c_lflag &= ~(ICANON | ECHO);
+  tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+  oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
+  fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
+
+  ch = getchar();
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+  fcntl(STDIN_FILENO, F_SETFL, oldf);
+
+  return ch;
+}
+
+void console_putch(int ch)
+{
+    putchar(ch);
+}
+
+/**
+ * put the console in raw mode for terminal mode or restore it
+ * @param enable - non-zero for raw mode
+ */
+void console_raw(int enable)
+{
+    /* console_getch already reads single keys without echo */
+}
+
+/**
+ * read the console input that is available
+ * @param buff - char pointer to buffer
+ * @param n - number of bytes in buffer to read
+ * @returns number of bytes read
+ */
+int console_read(uint8_t* buff, int n)
+{
+    int cnt = 0;
+    while (cnt < n && console_kbhit())
+        buff[cnt++] = (uint8_t)console_getch();
+    return cnt;
+}
+
+/**
+ * wait for input from the serial port or the console
+ * @param mask - WAIT_SERIAL and/or WAIT_CONSOLE
+ * @param timeout - timeout in milliseconds
+ * @returns the sources in mask that have input or zero on timeout
+ */
+int serial_console_wait(int mask, int timeout)
+{
+    COMSTAT stat;
+    DWORD errors;
+    int ready, elapsed;
+
+    /* the console can't be waited on with the port so check both every millisecond */
+    for (elapsed = 0; ; ++elapsed) {
+        ready = 0;
+        if ((mask & WAIT_SERIAL) && ClearCommError(hSerial, &errors, &stat) && stat.cbInQue > 0)
+            ready |= WAIT_SERIAL;
+        if ((mask & WAIT_CONSOLE) && console_kbhit())
+            ready |= WAIT_CONSOLE;
+        if (ready || elapsed >= timeout)
+            return ready;
+        Sleep(1);
+    }
+}
@@ -86,6 +86,57 @@ int serial_init(const char* port, unsigned long baud)
     return hSerial;
 }
 
+/**
+ * change the baud rate of the open serial port
+ * @param baud - new baud rate
+ * @returns zero if the rate is not supported
+ */
+int serial_baud(unsigned long baud)
+{
+    struct termios sparm;
+    speed_t tbaud;
+
+    switch(baud) {
+        case 115200:
+            tbaud = B115200;
+            break;
+        case 230400:
+            tbaud = B230400;
+            break;
+#ifdef B460800
+        case 460800:
+            tbaud = B460800;
+            break;
+#endif
+#ifdef B921600
+        case 921600:
+            tbaud = B921600;
+            break;
+#endif
+#ifdef B2000000
+        case 2000000:
+            tbaud = B2000000;
+            break;
+#endif
+        default:
+            return 0;
+    }
+
+    if (tcgetattr(hSerial, &sparm) != 0)
+        return 0;
+    cfsetispeed(&sparm, tbaud);
+    cfsetospeed(&sparm, tbaud);
+
+    /* let the last characters go out at the old rate */
+    if (tcsetattr(hSerial, TCSADRAIN, &sparm) != 0)
+        return 0;
+
+    /* anything received during the switch is garbage */
+    tcflush(hSerial, TCIFLUSH);
+
+    return 1;
+}
+
 /**
  * close serial port
  */
@@ -269,3 +320,73 @@ void console_putch(int ch)
 {
     putchar(ch);
 }
+
+/* terminal mode console state */
+static struct termios old_console;
+static int console_is_raw = 0;
+
+/**
+ * put the console in raw mode for terminal mode or restore it
+ * @param enable - non-zero for raw mode
+ */
+void console_raw(int enable)
+{
+    struct termios newt;
+    if (enable && !console_is_raw) {
+        if (tcgetattr(STDIN_FILENO, &old_console) != 0)
+            return;
+        newt = old_console;
+        newt.c_lflag &= ~(ICANON | ECHO);
+        newt.c_cc[VMIN] = 1;
+        newt.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+        console_is_raw = 1;
+    }
+    else if (!enable && console_is_raw) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &old_console);
+        console_is_raw = 0;
+    }
+}
+
+/**
+ * read the console input that is available
+ * @param buff - char pointer to buffer
+ * @param n - number of bytes in buffer to read
+ * @returns number of bytes read or -1 at end of file
+ */
+int console_read(uint8_t* buff, int n)
+{
+    ssize_t bytes = read(STDIN_FILENO, buff, n);
+    return bytes > 0 ? (int)bytes : bytes == 0 ? -1 : 0;
+}
+
+/**
+ * wait for input from the serial port or the console
+ * @param mask - WAIT_SERIAL and/or WAIT_CONSOLE
+ * @param timeout - timeout in milliseconds
+ * @returns the sources in mask that have input or zero on timeout
+ */
+int serial_console_wait(int mask, int timeout)
+{
+    struct timeval toval;
+    int ready = 0;
+    fd_set set;
+
+    FD_ZERO(&set);
+    if (mask & WAIT_SERIAL)
+        FD_SET(hSerial, &set);
+    if (mask & WAIT_CONSOLE)
+        FD_SET(STDIN_FILENO, &set);
+
+    toval.tv_sec = timeout / 1000;
+    toval.tv_usec = (timeout % 1000) * 1000;
+
+    if (select((hSerial > STDIN_FILENO ? hSerial : STDIN_FILENO) + 1, &set, NULL, NULL, &toval) > 0) {
+        if ((mask & WAIT_SERIAL) && FD_ISSET(hSerial, &set))
+            ready |= WAIT_SERIAL;
+        if ((mask & WAIT_CONSOLE) && FD_ISSET(STDIN_FILENO, &set))
+            ready |= WAIT_CONSOLE;
+    }
+
+    return ready;
+}
@@ -8,8 +8,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <conio.h>
-#include <fcntl.h>
+#include <conio.h>
+#include <fcntl.h>
 #include "osint.h"
 
 static HANDLE hSerial;
@@ -88,6 +88,25 @@ int serial_init(const char *port, unsigned long baud)
     return TRUE;
 }
 
+int serial_baud(unsigned long baud)
+{
+    DCB state;
+
+    /* let the last characters go out at the old rate */
+    FlushFileBuffers(hSerial);
+
+    if (!GetCommState(hSerial, &state))
+        return FALSE;
+    state.BaudRate = baud;
+    if (!SetCommState(hSerial, &state))
+        return FALSE;
+
+    /* anything received during the switch is garbage */
+    PurgeComm(hSerial, PURGE_RXABORT | PURGE_RXCLEAR);
+
+    return TRUE;
+}
+
 void serial_done(void)
 {
 	FlushFileBuffers(hSerial);
@@ -207,17 +226,65 @@ static void ShowLastError(void)
     LocalFree(lpMsgBuf);
 }
 
-int console_kbhit(void)
-{
-  return _kbhit();
-}
-
-int console_getch(void)
-{
-  return _getch();
-}
-
-void console_putch(int ch)
-{
-    _putch(ch);
-}
+int console_kbhit(void)
+{
+  return _kbhit();
+}
+
+int console_getch(void)
+{
+  return _getch();
+}
+
+void console_putch(int ch)
+{
+    _putch(ch);
+}
+
+/**
+ * put the console in raw mode for terminal mode or restore it
+ * @param enable - non-zero for raw mode
+ */
+void console_raw(int enable)
+{
+    /* console_getch already reads single keys without echo */
+}
+
+/**
+ * read the console input that is available
+ * @param buff - char pointer to buffer
+ * @param n - number of bytes in buffer to read
+ * @returns number of bytes read
+ */
+int console_read(uint8_t* buff, int n)
+{
+    int cnt = 0;
+    while (cnt < n && console_kbhit())
+        buff[cnt++] = (uint8_t)console_getch();
+    return cnt;
+}
+
+/**
+ * wait for input from the serial port or the console
+ * @param mask - WAIT_SERIAL and/or WAIT_CONSOLE
+ * @param timeout - timeout in milliseconds
+ * @returns the sources in mask that have input or zero on timeout
+ */
+int serial_console_wait(int mask, int timeout)
+{
+    COMSTAT stat;
+    DWORD errors;
+    int ready, elapsed;
+
+    /* the console can't be waited on with the port so check both every millisecond */
+    for (elapsed = 0; ; ++elapsed) {
+        ready = 0;
+        if ((mask & WAIT_SERIAL) && ClearCommError(hSerial, &errors, &stat) && stat.cbInQue > 0)
+            ready |= WAIT_SERIAL;
+        if ((mask & WAIT_CONSOLE) && console_kbhit())
+            ready |= WAIT_CONSOLE;
+        if (ready || elapsed >= timeout)
+            return ready;
+        Sleep(1);
+    }
+}
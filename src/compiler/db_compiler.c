@@ -14,15 +14,36 @@
 #include "db_compiler.h"
 #include "db_vmdebug.h"
 
+/* start of a compile phase */
+typedef struct {
+    unsigned long start;        /* time the phase started */
+    size_t allocated;           /* heap space allocated before the phase started */
+} PhaseTimer;
+
 /* local function prototypes */
+static void StartPhase(ParseContext *c, PhaseTimer *timer);
+static void EndPhase(ParseContext *c, PhaseTimer *timer, const char *phase, const char *name);
+static BoardConfig *CopyBoardConfig(System *sys, BoardConfig *config);
+static void PlaceLocalArrays(ParseContext *c);
+static void MarkArraysPrivate(ParseContext *c, Type *type);
+static VMUVALUE ArrayHeight(ParseContext *c, Symbol *sym, Symbol *caller);
 static void GenerateDependencies(ParseContext *c);
+static void PlaceGlobalData(ParseContext *c);
+static void PlaceStrings(ParseContext *c);
+static int CompareStringTails(const void *p1, const void *p2);
 static void ApplyLocalFixups(ParseContext *c, VMUVALUE base);
+static int DebugFileIndex(ParseContext *c, IncludedFile *include);
+static void PlaceDebugLines(ParseContext *c, VMUVALUE base, VMUVALUE codeSize);
 static void DumpLocalFixups(ParseContext *c);
 static void UpdateReferences(ParseContext *c);
+static void UpdateChain(ParseContext *c, VMUVALUE chain, VMUVALUE addr);
+static Section *CodeSection(ParseContext *c, VMUVALUE addr);
 
-/* InitCompiler - initialize the compiler */
-ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize)
+/* InitCompiler - initialize the compiler
+   (the code buffer starts small and grows as needed up to maxCode) */
+ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t maxCode)
 {
+    size_t codeBufSize = (maxCode < INITIAL_CODE_SIZE ? maxCode : INITIAL_CODE_SIZE);
     ParseContext *c;
     
     /* allocate a parse context */
@@ -42,10 +63,38 @@ ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize)
     c->byteArrayType.u.arrayInfo.elementType = &c->byteType;
     c->bytePointerType.id = TYPE_POINTER;
     c->bytePointerType.u.pointerInfo.targetType = &c->byteType;
+    c->wordType.id = TYPE_WORD;
+    c->wordArrayType.id = TYPE_ARRAY;
+    c->wordArrayType.u.arrayInfo.elementType = &c->wordType;
+    c->wordPointerType.id = TYPE_POINTER;
+    c->wordPointerType.u.pointerInfo.targetType = &c->wordType;
+    c->fixedType.id = TYPE_FIXED;
+    c->fixedArrayType.id = TYPE_ARRAY;
+    c->fixedArrayType.u.arrayInfo.elementType = &c->fixedType;
+    c->fixedPointerType.id = TYPE_POINTER;
+    c->fixedPointerType.u.pointerInfo.targetType = &c->fixedType;
+    c->floatType.id = TYPE_FLOAT;
+    c->floatArrayType.id = TYPE_ARRAY;
+    c->floatArrayType.u.arrayInfo.elementType = &c->floatType;
+    c->floatPointerType.id = TYPE_POINTER;
+    c->floatPointerType.u.pointerInfo.targetType = &c->floatType;
     c->codeBuf = (uint8_t *)c + sizeof(ParseContext);
     c->ctop = c->codeBuf + codeBufSize;
+    c->maxCode = maxCode;
     c->sys = sys;
-    c->config = config;
+
+    /* the sections hold the image being written so each context needs its own copy of them */
+    if (!(c->config = CopyBoardConfig(sys, config)))
+        return NULL;
+
+    /* build the keyword index */
+    if (!InitScan(c))
+        return NULL;
+
+    /* build the assembler indexes once instead of for each line it assembles */
+    if (!(c->pasmTables = (PasmTables *)xbGlobalAlloc(sys, PasmTablesSize())))
+        return NULL;
+    PasmIndexTables(c->pasmTables);
 
     /* setup the target sections */
     if (!(c->textTarget = GetSection(c->config, c->config->defaultTextSection))) {
@@ -61,9 +110,45 @@ ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize)
     return c;
 }
 
+/* CopyBoardConfig - make a private copy of a board configuration and its sections */
+static BoardConfig *CopyBoardConfig(System *sys, BoardConfig *config)
+{
+    Section *section, *newSection, **pNextSection;
+    BoardConfig *newConfig;
+    size_t size;
+
+    /* copy the board configuration */
+    size = sizeof(BoardConfig) + strlen(config->name);
+    if (!(newConfig = (BoardConfig *)xbGlobalAlloc(sys, size)))
+        return NULL;
+    memcpy(newConfig, config, size);
+    newConfig->next = NULL;
+
+    /* copy the sections */
+    pNextSection = &newConfig->sections;
+    for (section = config->sections; section != NULL; section = section->next) {
+        size = sizeof(Section) + strlen(section->name);
+        if (!(newSection = (Section *)xbGlobalAlloc(sys, size)))
+            return NULL;
+        memcpy(newSection, section, size);
+        newSection->fp = NULL;
+        newSection->buf = NULL;
+        newSection->bufSize = 0;
+        *pNextSection = newSection;
+        pNextSection = &newSection->next;
+    }
+    *pNextSection = NULL;
+
+    /* return the copy */
+    return newConfig;
+}
+
 /* Compile - compile a program */
 int Compile(ParseContext *c, const char *name)
 {
+    static const char *passNames[] = { "pass 1", "pass 2", "pass 3" };
+    PhaseTimer timer;
+    
     /* setup an error target */
     if (setjmp(c->errorTarget) != 0) {
         CloseParseContext(c);
@@ -73,7 +158,13 @@ int Compile(ParseContext *c, const char *name)
     /* start the image and initialize the interpreter stack size */
     if (!StartImage(c, name))
         return FALSE;
-    c->stackSize = DEFAULT_STACK_SIZE;
+    c->stackSize = 0;
+    c->overlay = FALSE;
+    c->mainStackUsage = NULL;
+
+    /* load the code stored by the previous build of the image */
+    if (c->flags & COMPILER_INCREMENTAL)
+        LoadCodeCache(c);
 
     /* initialize block nesting stack */
     c->btop = (Block *)((char *)c->blockBuf + sizeof(c->blockBuf));
@@ -84,6 +175,21 @@ int Compile(ParseContext *c, const char *name)
     
     /* initialize the string and label tables */
     c->strings = NULL;
+    memset(c->stringIndex, 0, sizeof(c->stringIndex));
+    
+    /* initialize the global data waiting to be placed */
+    c->globalData = NULL;
+    c->pNextGlobalData = &c->globalData;
+    c->literalPool = NULL;
+    
+    /* initialize the source lines and files for the debug section */
+    c->debugLines = NULL;
+    c->pNextDebugLine = &c->debugLines;
+    c->debugLineEnd = 0;
+    c->debugLineCount = 0;
+    c->debugFiles = NULL;
+    c->pNextDebugFile = &c->debugFiles;
+    c->debugFileCount = 1;
 
     /* initialize the global symbol table */
     InitSymbolTable(&c->globals);
@@ -115,9 +221,11 @@ int Compile(ParseContext *c, const char *name)
     
     /* do three passes over the source program */
     for (c->pass = 1; c->pass <= 3; ++c->pass) {
+        StartPhase(c, &timer);
         
         /* no main function yet */
         c->mainState = MAIN_NOT_DEFINED;
+        c->fcacheCount = 0;
 
         /* rewind to the start of the source program */
         RewindInput(c);
@@ -143,20 +251,37 @@ int Compile(ParseContext *c, const char *name)
                 break;
             }
     
-            /* make a list of dependencies at the end of the second pass */
-            if (c->pass == 2)
-                GenerateDependencies(c);
+            /* choose the inline functions at the end of the second pass */
+            if (c->pass == 2 && (c->flags & COMPILER_OPTIMIZE))
+                SelectInlineFunctions(c);
+        }
+        EndPhase(c, &timer, passNames[c->pass - 1], NULL);
+    
+        /* make a list of dependencies and place the data they need at the end of the second pass */
+        if (c->pass == 2) {
+            StartPhase(c, &timer);
+            PlaceLocalArrays(c);
+            GenerateDependencies(c);
+            PlaceGlobalData(c);
+            EndPhase(c, &timer, "dependencies", NULL);
         }
-        
-        /* clear the list of included files for the next pass */
-        ClearIncludedFiles(c);
     }
     
+    /* clear the list of included files */
+    ClearIncludedFiles(c);
+    
     /* close the input file */
     CloseParseContext(c);
 
-    /* update all global variable references */
+    /* place the strings referenced by the code */
+    StartPhase(c, &timer);
+    PlaceStrings(c);
+    EndPhase(c, &timer, "strings", NULL);
+
+    /* update all global variable and string references */
+    StartPhase(c, &timer);
     UpdateReferences(c);
+    EndPhase(c, &timer, "references", NULL);
 
     /* show the symbol and string tables */
     if (c->flags & COMPILER_DEBUG) {
@@ -177,14 +302,160 @@ int Compile(ParseContext *c, const char *name)
         }
     }
 
+    /* size the stack for the code that was generated */
+    StartPhase(c, &timer);
+    ComputeStackSize(c);
+    EndPhase(c, &timer, "stack", NULL);
+
     /* build an image in memory */
-    return BuildImage(c, name);
+    StartPhase(c, &timer);
+    if (!BuildImage(c, name))
+        return FALSE;
+    EndPhase(c, &timer, "image", NULL);
+        
+    /* save the code of the functions for the next build */
+    if (c->flags & COMPILER_INCREMENTAL)
+        SaveCodeCache(c);
+        
+    /* return successfully */
+    return TRUE;
+}
+
+/* StartPhase - start timing a compile phase */
+static void StartPhase(ParseContext *c, PhaseTimer *timer)
+{
+    if (c->phaseTiming) {
+        timer->allocated = xbHeapAllocated(c->sys);
+        timer->start = xbGetMicroseconds();
+    }
+}
+
+/* EndPhase - report the time and memory used by a compile phase */
+static void EndPhase(ParseContext *c, PhaseTimer *timer, const char *phase, const char *name)
+{
+    if (c->phaseTiming) {
+        PhaseTiming timing;
+        timing.microseconds = xbGetMicroseconds() - timer->start;
+        timing.phase = phase;
+        timing.name = name;
+        timing.allocated = xbHeapAllocated(c->sys) - timer->allocated;
+        timing.maxHeapUsed = xbMaxHeapUsed(c->sys);
+        (*c->phaseTiming)(c->phaseTimingCookie, &timing);
+    }
+}
+
+/* PlaceLocalArrays - place the arrays declared in the functions the main code can reach so functions that
+   can't be active at the same time share the same memory (each function's arrays go below the arrays of
+   the functions it calls and the functions that can be active more than once get memory of their own,
+   this must be done before GenerateDependencies takes the dependency lists apart) */
+static void PlaceLocalArrays(ParseContext *c)
+{
+    VMUVALUE height = 0, top, base, total = 0, h;
+    Section *section = c->dataTarget;
+    LocalArray *array;
+    uint8_t *zeros;
+    Dependency *d;
+    Symbol *sym;
+    Type *type;
+    
+    /* the functions COGSTART and TASK run and the functions they call can be active alongside any other */
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (sym->type->id == TYPE_FUNCTION && sym->type->u.functionInfo.started)
+            MarkArraysPrivate(c, sym->type);
+    
+    /* the shared memory is as high as the deepest chain of calls from the main code needs */
+    for (d = c->mainDependencies; d != NULL; d = d->next)
+        if (d->symbol->type->id == TYPE_FUNCTION && (h = ArrayHeight(c, d->symbol, NULL)) > height)
+            height = h;
+    
+    /* place the arrays of each function that was reached (OPTION overlay scalars follow the arrays
+       unless the function can be active more than once and needs them in its frame) */
+    for (sym = c->globals.head, top = height; sym != NULL; sym = sym->next) {
+        type = sym->type;
+        if (type->id != TYPE_FUNCTION || !type->u.functionInfo.localArrays || type->u.functionInfo.arrayState != AS_DONE)
+            continue;
+        if (type->u.functionInfo.arrayPrivate) {
+            base = top;
+            top += type->u.functionInfo.localArraySize;
+        }
+        else {
+            base = height - type->u.functionInfo.arrayHeight;
+            type->u.functionInfo.overlayScalars = (type->u.functionInfo.localScalarSize > 0);
+            total += type->u.functionInfo.localScalarSize;
+        }
+        for (array = type->u.functionInfo.localArrays; array != NULL; array = array->next) {
+            if (!array->scalar)
+                array->symbol->v.variable.offset = section->offset + (base + array->offset) * sizeof(VMVALUE);
+            else if (type->u.functionInfo.overlayScalars)
+                array->symbol->v.variable.offset = section->offset + (base + type->u.functionInfo.localArraySize + array->offset) * sizeof(VMVALUE);
+        }
+        total += type->u.functionInfo.localArraySize;
+    }
+    
+    /* the memory starts out clear like the memory of any other array */
+    if (top > 0) {
+        zeros = (uint8_t *)LocalAlloc(c, top * sizeof(VMVALUE));
+        memset(zeros, 0, top * sizeof(VMVALUE));
+        section->offset += WriteSection(c, section, zeros, top * sizeof(VMVALUE));
+        if (c->flags & COMPILER_INFO)
+            xbInfo(c->sys, "%s take %d longs (%d without sharing)\n", c->overlay ? "local arrays and overlaid scalars" : "local arrays", top, total);
+    }
 }
 
-/* GenerateDependencies - generate a list of dependencies of the main function */
+/* MarkArraysPrivate - give a function and the functions it calls array memory of their own */
+static void MarkArraysPrivate(ParseContext *c, Type *type)
+{
+    Dependency *d;
+    if (!type->u.functionInfo.arrayPrivate) {
+        type->u.functionInfo.arrayPrivate = TRUE;
+        for (d = type->u.functionInfo.dependencies; d != NULL; d = d->next)
+            if (d->symbol->type->id == TYPE_FUNCTION)
+                MarkArraysPrivate(c, d->symbol->type);
+    }
+}
+
+/* ArrayHeight - get the longs of shared array memory a function and the functions it calls need
+   (a function that is already on the path of the walk is recursive so it and the functions on the
+   path back to it get memory of their own) */
+static VMUVALUE ArrayHeight(ParseContext *c, Symbol *sym, Symbol *caller)
+{
+    Type *type = sym->type;
+    VMUVALUE height = 0, h;
+    Dependency *d;
+    Symbol *s;
+    
+    switch (type->u.functionInfo.arrayState) {
+    case AS_DONE:
+        return type->u.functionInfo.arrayHeight;
+    case AS_ACTIVE:
+        for (s = caller; s != NULL; s = s->type->u.functionInfo.arrayCaller) {
+            if (s->type->u.functionInfo.localArrays && !s->type->u.functionInfo.arrayPrivate)
+                xbInfo(c->sys, "warning: the calls of recursive function '%s' share its local arrays\n", s->name);
+            s->type->u.functionInfo.arrayPrivate = TRUE;
+            if (s == sym)
+                break;
+        }
+        return 0;
+    }
+    
+    /* the function's arrays go below the arrays of the functions it calls */
+    type->u.functionInfo.arrayState = AS_ACTIVE;
+    type->u.functionInfo.arrayCaller = caller;
+    for (d = type->u.functionInfo.dependencies; d != NULL; d = d->next)
+        if (d->symbol->type->id == TYPE_FUNCTION && (h = ArrayHeight(c, d->symbol, sym)) > height)
+            height = h;
+    if (!type->u.functionInfo.arrayPrivate)
+        height += type->u.functionInfo.localArraySize + type->u.functionInfo.localScalarSize;
+    type->u.functionInfo.arrayHeight = height;
+    type->u.functionInfo.arrayState = AS_DONE;
+    return height;
+}
+
+/* GenerateDependencies - generate a list of dependencies of the main function
+   (the list is also the worklist and each symbol is marked as referenced when it is added) */
 static void GenerateDependencies(ParseContext *c)
 {
-    Dependency *dependencies, **pNext, *d, *d2, *d3, *next;
+    Dependency *dependencies, **pNext, *d, *d2, *next;
     
     /* initialize the main dependency list */
     dependencies = NULL;
@@ -193,22 +464,20 @@ static void GenerateDependencies(ParseContext *c)
     /* add all of the main dependencies */
     for (d = c->mainDependencies; d != NULL; d = next) {
         next = d->next;
+        d->symbol->referenced = TRUE;
         *pNext = d;
         pNext = &d->next;
         d->next = NULL;
     }
     
-    /* add all of the recursive dependencies */
+    /* add the dependencies of each function on the list that haven't been reached yet */
     for (d = dependencies; d != NULL; d = d->next) {
         Symbol *sym = d->symbol;
         if (sym->type->id == TYPE_FUNCTION) {
             for (d2 = sym->type->u.functionInfo.dependencies; d2 != NULL; d2 = next) {
-                sym = d2->symbol;
                 next = d2->next;
-                for (d3 = dependencies; d3 != NULL; d3 = d3->next)
-                    if (sym == d3->symbol)
-                        break;
-                if (!d3) {
+                if (!d2->symbol->referenced) {
+                    d2->symbol->referenced = TRUE;
                     *pNext = d2;
                     pNext = &d2->next;
                     d2->next = NULL;
@@ -217,6 +486,17 @@ static void GenerateDependencies(ParseContext *c)
         }
     }
     
+    /* functions that are always expanded inline need no code */
+    for (pNext = &dependencies; (d = *pNext) != NULL; ) {
+        Type *type = d->symbol->type;
+        if (type->id == TYPE_FUNCTION && type->u.functionInfo.inlined) {
+            d->symbol->referenced = FALSE;
+            *pNext = d->next;
+        }
+        else
+            pNext = &d->next;
+    }
+
     /* save the dependencies of the main function */
     c->mainDependencies = dependencies;
 
@@ -229,78 +509,331 @@ static void GenerateDependencies(ParseContext *c)
     }
 }
 
+/* PlaceGlobalData - place the data of the referenced global symbols in the order they were defined */
+static void PlaceGlobalData(ParseContext *c)
+{
+    int unreferenced = 0;
+    GlobalData *data;
+    
+    for (data = c->globalData; data != NULL; data = data->next) {
+        Symbol *sym = data->symbol;
+        Section *section = sym->section;
+        if (!sym->referenced)
+            ++unreferenced;
+        else if (data->packed)
+            sym->v.variable.offset = PackSection(c, section, data->data, data->size);
+        else {
+            sym->v.variable.offset = section->offset;
+            section->offset += WriteSection(c, section, data->data, data->size);
+        }
+    }
+    
+    if (unreferenced > 0 && (c->flags & COMPILER_INFO))
+        xbInfo(c->sys, "removed %d unreferenced global variables and arrays\n", unreferenced);
+}
+
 /* StoreCode - store the function or method under construction */
 void StoreCode(ParseContext *c)
 {
+    Symbol *symbol = c->function->u.functionDefinition.symbol;
+    Section *section;
+    int reused = FALSE;
+    uint32_t hash = 0;
+    PhaseTimer timer;
     int codeSize;
 
     /* initialize */
+    StartPhase(c, &timer);
     c->symbolFixups = NULL;
-
-    /* generate code for the function */
-    Generate(c, c->function);
+    c->functionLines = c->lastFunctionLine = NULL;
+    
+    /* compile a NATIVE function to LMM code if it can be */
+    c->native = c->functionType && c->functionType->u.functionInfo.native && CheckNativeFunction(c);
+
+    /* reuse the code from the previous build if the function hasn't changed
+       (the hash doesn't cover the source lines so code with symbols is always generated
+        and LMM code has its addresses built in so it is never kept) */
+    if ((c->flags & COMPILER_INCREMENTAL) && !c->native) {
+        hash = HashFunction(c);
+        reused = !(c->flags & COMPILER_SYMBOLS) && ReuseCode(c, hash);
+    }
+    
+    /* otherwise, generate code for the function */
+    if (!reused) {
+        Generate(c, c->function);
+    
+        /* apply the peephole optimizations */
+        if (c->flags & COMPILER_OPTIMIZE) {
+            int saved = OptimizeCode(c);
+            if (c->flags & COMPILER_INFO)
+                xbInfo(c->sys, "%s: peephole optimizer saved %d bytes\n", symbol ? symbol->name : "[main]", saved);
+        }
+    
+        /* use the short branch and literal forms where possible */
+        RelaxCode(c);
+    }
+    
+    /* find the stack usage of the final code */
+    AnalyzeStack(c);
+    
+    /* keep the code for the next build */
+    if ((c->flags & COMPILER_INCREMENTAL) && !c->native)
+        RecordCode(c, hash, reused);
+    
+    /* determine the code size */
+    codeSize = c->cptr - c->codeBuf;
+    
+    /* functions go in the section they were defined in and the main code in the text section
+       (a hot function that doesn't fit in hub memory stays in the text section) */
+    section = c->functionType ? symbol->section : c->textTarget;
+    if (section != c->textTarget && section->size != 0
+    &&  section->offset + codeSize + (c->native ? c->nativeSize + sizeof(VMVALUE) : 0) > section->size) {
+        if (!c->functionType->u.functionInfo.hot)
+            ParseError(c, "insufficient %s section space for %s", section->name, symbol->name);
+        symbol->section = section = c->textTarget;
+        if (c->flags & COMPILER_INFO)
+            xbInfo(c->sys, "%s: no room for the hot function in hub memory\n", symbol->name);
+    }
+    else if (c->functionType && c->functionType->u.functionInfo.hot && (c->flags & COMPILER_INFO))
+        xbInfo(c->sys, "%s: placed the hot function in the %s section\n", symbol->name, section->name);
     
     /* store the function or main offset */
     if (c->functionType)
-        c->function->u.functionDefinition.symbol->v.variable.offset = c->textTarget->offset;
+        symbol->v.variable.offset = section->offset;
     else
-        c->mainCode = c->textTarget->base + c->textTarget->offset;
+        c->mainCode = section->base + section->offset;
 
     /* apply the local symbol and string fixups */
-    ApplyLocalFixups(c, c->textTarget->offset);
+    ApplyLocalFixups(c, section->base + section->offset);
     
-    /* determine the code size */
-    codeSize = c->cptr - c->codeBuf;
+    /* place the source lines along with the code */
+    PlaceDebugLines(c, section->base + section->offset, codeSize);
 
     /* show the function disassembly */
     if (c->flags & COMPILER_DEBUG) {
-        Symbol *symbol = c->function->u.functionDefinition.symbol;
         xbInfo(c->sys, "\n%s:\n", symbol ? symbol->name : "[main]");
-        DecodeFunction(c->sys, c->textTarget->base + c->textTarget->offset, c->codeBuf, codeSize);
+        DecodeFunction(c->sys, section->base + section->offset, c->codeBuf, codeSize);
         if (c->functionType)
             DumpSymbols(c, &c->function->type->u.functionInfo.arguments, "arguments");
         DumpSymbols(c, &c->function->u.functionDefinition.locals, "locals");
-        DumpLabels(c);
+        if (!reused)
+            DumpLabels(c);
         DumpLocalFixups(c);
     }
     
+    /* add the LMM code of a native function after its stub */
+    if (c->native)
+        codeSize = AppendNativeCode(c, section->base + section->offset);
+    
     /* store the code */
-    c->textTarget->offset += WriteSection(c, c->textTarget, c->codeBuf, codeSize);
+    section->offset += WriteSection(c, section, c->codeBuf, codeSize);
 
     /* reset to compile the next code */
     c->cptr = c->codeBuf;
+    EndPhase(c, &timer, "code", symbol ? symbol->name : "[main]");
 }
 
-/* AddString - add a string to the string table */
+/* AddString - add a string to the string table (each distinct value is only stored once) */
 String *AddString(ParseContext *c, char *value)
 {
-    String *str;
+    int length = strlen(value);
+    String *str, **pBucket;
     
     /* check to see if the string is already in the table */
-    for (str = c->strings; str != NULL; str = str->next)
-        if (strcmp(value, (char *)str->value) == 0)
+    pBucket = &c->stringIndex[HashBytes(HASH_INIT, value, length) & (STRING_HASH_SIZE - 1)];
+    for (str = *pBucket; str != NULL; str = str->hashNext)
+        if (str->length == length && memcmp(value, str->value, length) == 0)
             return str;
 
     /* allocate the string structure */
-    str = (String *)GlobalAlloc(c, sizeof(String) + strlen(value));
+    str = (String *)GlobalAlloc(c, sizeof(String) + length);
     memset(str, 0, sizeof(String));
-    strcpy((char *)str->value, value);
+    memcpy(str->value, value, length + 1);
+    str->length = length;
     str->next = c->strings;
     c->strings = str;
+    str->hashNext = *pBucket;
+    *pBucket = str;
 
     /* return the string table entry */
     return str;
 }
 
-/* AddStringRef - add a reference to a string in the string table */
-VMUVALUE AddStringRef(ParseContext *c, String *str)
+/* PlaceStrings - place the strings referenced by the code
+   (a string that is the tail of another string is placed within it) */
+static void PlaceStrings(ParseContext *c)
 {
-    if (!str->placed) {
-        str->offset = c->textTarget->offset;
-        c->textTarget->offset += WriteSection(c, c->textTarget, str->value, strlen((char *)str->value) + 1);
+    String **strings, *str, *prev;
+    int count = 0, merged = 0, saved = 0, i;
+    
+    /* make a list of the referenced strings */
+    for (str = c->strings; str != NULL; str = str->next)
+        if (str->fixups != 0)
+            ++count;
+    if (count == 0)
+        return;
+    strings = (String **)LocalAlloc(c, count * sizeof(String *));
+    for (i = 0, str = c->strings; str != NULL; str = str->next)
+        if (str->fixups != 0)
+            strings[i++] = str;
+    
+    /* sort the strings by their reversed values so each string is just before the strings it is a tail of */
+    qsort(strings, count, sizeof(String *), CompareStringTails);
+    
+    /* place the strings starting with the last so the strings containing a tail are placed first */
+    for (prev = NULL, i = count; --i >= 0; prev = str) {
+        str = strings[i];
+        if (prev && prev->length >= str->length
+        &&  memcmp(prev->value + prev->length - str->length, str->value, str->length) == 0) {
+            str->offset = prev->offset + prev->length - str->length;
+            saved += str->length + 1;
+            ++merged;
+        }
+        else {
+            str->offset = c->textTarget->offset;
+            c->textTarget->offset += WriteSection(c, c->textTarget, str->value, str->length + 1);
+        }
         str->placed = TRUE;
     }
-    return c->textTarget->base + str->offset;
+    xbLocalFreeAll(c->sys);
+    
+    if (merged > 0 && (c->flags & COMPILER_INFO))
+        xbInfo(c->sys, "merged %d strings into the tails of other strings saving %d bytes\n", merged, saved);
+}
+
+/* CompareStringTails - compare two strings starting with their last characters */
+static int CompareStringTails(const void *p1, const void *p2)
+{
+    const String *str1 = *(const String **)p1;
+    const String *str2 = *(const String **)p2;
+    const uint8_t *t1 = str1->value + str1->length;
+    const uint8_t *t2 = str2->value + str2->length;
+    while (t1 > str1->value && t2 > str2->value) {
+        --t1;
+        --t2;
+        if (*t1 != *t2)
+            return *t1 < *t2 ? -1 : 1;
+    }
+    return (t1 > str1->value) - (t2 > str2->value);
+}
+
+/* AddGlobalData - add the initial value of a global symbol to be placed once it is known to be referenced */
+void AddGlobalData(ParseContext *c, Symbol *symbol, const uint8_t *data, VMUVALUE size, int packed)
+{
+    GlobalData *globalData = (GlobalData *)GlobalAlloc(c, sizeof(GlobalData) + size);
+    globalData->next = NULL;
+    globalData->symbol = symbol;
+    globalData->packed = packed;
+    globalData->size = size;
+    memcpy(globalData->data, data, size);
+    *c->pNextGlobalData = globalData;
+    c->pNextGlobalData = &globalData->next;
+}
+
+/* AddDebugLine - tag the code generated from here on with a source line */
+void AddDebugLine(ParseContext *c, CachedLine *line)
+{
+    DebugLine *last = c->lastFunctionLine, *debugLine;
+    VMUVALUE offset = codeaddr(c);
+    int file;
+    
+    /* lines of code built by the compiler have no source line */
+    if (!line)
+        return;
+    file = DebugFileIndex(c, line->file);
+    
+    /* nothing to do if the code is already tagged with the line */
+    if (last && last->lineNumber == line->lineNumber && last->file == file)
+        return;
+    
+    /* a line that didn't generate any code gives way to this one */
+    if (last && last->offset == offset) {
+        last->lineNumber = line->lineNumber;
+        last->file = file;
+        return;
+    }
+    
+    /* add a new line */
+    debugLine = (DebugLine *)GlobalAlloc(c, sizeof(DebugLine));
+    debugLine->next = NULL;
+    debugLine->offset = offset;
+    debugLine->lineNumber = line->lineNumber;
+    debugLine->file = file;
+    if (last)
+        last->next = debugLine;
+    else
+        c->functionLines = debugLine;
+    c->lastFunctionLine = debugLine;
+}
+
+/* DebugFileIndex - get the index of a file in the debug file table */
+static int DebugFileIndex(ParseContext *c, IncludedFile *include)
+{
+    DebugFile *file;
+    
+    /* the main file is always file 0 */
+    if (!include)
+        return 0;
+    
+    /* look for the file */
+    for (file = c->debugFiles; file != NULL; file = file->next)
+        if (file->include == include)
+            return file->index;
+    
+    /* add it to the table (the name is copied since the included files are cleared after the last pass) */
+    file = (DebugFile *)GlobalAlloc(c, sizeof(DebugFile) + strlen(include->name));
+    file->next = NULL;
+    file->include = include;
+    file->index = c->debugFileCount++;
+    strcpy(file->name, include->name);
+    *c->pNextDebugFile = file;
+    c->pNextDebugFile = &file->next;
+    return file->index;
+}
+
+/* PlaceDebugLines - move the source lines of the code being stored at an address to the placed lines
+   (lines that ended up without code after optimization are dropped and the placed lines are kept in
+   address order so code placed below the code that is already there has its lines inserted) */
+static void PlaceDebugLines(ParseContext *c, VMUVALUE base, VMUVALUE codeSize)
+{
+    DebugLine *line, *next, *first = NULL, **pNext = &first, **pInsert;
+    for (line = c->functionLines; line != NULL; line = next) {
+        next = line->next;
+        if (line->offset < codeSize && (!next || next->offset != line->offset)) {
+            line->next = NULL;
+            line->offset += base;
+            *pNext = line;
+            pNext = &line->next;
+            ++c->debugLineCount;
+        }
+    }
+    if (first) {
+        if (base >= c->debugLineEnd) {
+            *c->pNextDebugLine = first;
+            c->pNextDebugLine = pNext;
+            c->debugLineEnd = base + codeSize;
+        }
+        else {
+            for (pInsert = &c->debugLines; *pInsert && (*pInsert)->offset < base; pInsert = &(*pInsert)->next)
+                ;
+            *pNext = *pInsert;
+            *pInsert = first;
+            if (!*pNext)
+                c->pNextDebugLine = pNext;
+        }
+    }
+    c->functionLines = c->lastFunctionLine = NULL;
+}
+
+/* IsHotFunction - check for a function the profile found hot enough to place in hub memory */
+int IsHotFunction(ParseContext *c, const char *name)
+{
+    HotFunction *function;
+    if (c->hotProfile)
+        for (function = c->hotProfile->functions; function != NULL; function = function->next)
+            if (strcmp(name, function->name) == 0)
+                return TRUE;
+    return FALSE;
 }
 
 /* AddLocalSymbolFixup - add a symbol entry to the local fixup list */
@@ -318,6 +851,37 @@ VMUVALUE AddLocalSymbolFixup(ParseContext *c, Symbol *symbol, VMUVALUE offset)
     if (!fixup) {
         fixup = xbLocalAlloc(c->sys, sizeof(LocalFixup));
         fixup->symbol = symbol;
+        fixup->string = NULL;
+        fixup->chain = 0;
+        fixup->next = 0;
+        *pFixups = fixup;
+    }
+    
+    /* link this new fixup into the chain */
+    next = fixup->chain;
+    fixup->chain = offset;
+    
+    /* return the offset to the next entry in the chain */
+    return next;
+}
+
+/* AddLocalStringFixup - add a string reference to the local fixup list
+   (the string isn't placed until all of the code has been stored) */
+VMUVALUE AddLocalStringFixup(ParseContext *c, String *str, VMUVALUE offset)
+{
+    LocalFixup **pFixups = &c->symbolFixups, *fixup;
+    VMUVALUE next;
+    
+    /* look for an existing fixup */
+    for (; (fixup = *pFixups) != NULL; pFixups = &fixup->next)
+        if (str == fixup->string)
+            break;
+    
+    /* add a new fixup if no existing one was found */
+    if (!fixup) {
+        fixup = LocalAlloc(c, sizeof(LocalFixup));
+        fixup->symbol = NULL;
+        fixup->string = str;
         fixup->chain = 0;
         fixup->next = 0;
         *pFixups = fixup;
@@ -331,7 +895,8 @@ VMUVALUE AddLocalSymbolFixup(ParseContext *c, Symbol *symbol, VMUVALUE offset)
     return next;
 }
 
-/* ApplyLocalFixups - apply the local fixups for the current function */
+/* ApplyLocalFixups - apply the local fixups for the current function stored at an address
+   (the global chains link the addresses of the references since code can be in any section) */
 static void ApplyLocalFixups(ParseContext *c, VMUVALUE base)
 {
     LocalFixup *fixup;
@@ -339,8 +904,14 @@ static void ApplyLocalFixups(ParseContext *c, VMUVALUE base)
         VMUVALUE offset, next;
         for (offset = fixup->chain; offset != 0; offset = next) {
             next = rd_cword(c, offset);
-            wr_cword(c, offset, fixup->symbol->v.variable.fixups);
-            fixup->symbol->v.variable.fixups = base + offset;
+            if (fixup->string) {
+                wr_cword(c, offset, fixup->string->fixups);
+                fixup->string->fixups = base + offset;
+            }
+            else {
+                wr_cword(c, offset, fixup->symbol->v.variable.fixups);
+                fixup->symbol->v.variable.fixups = base + offset;
+            }
         }
     }
 }
@@ -352,18 +923,21 @@ static void DumpLocalFixups(ParseContext *c)
     if (c->symbolFixups) {
         printf("symbol fixups:\n");
         for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next)
-            printf("  %08x %s\n", fixup->chain, fixup->symbol->name);
+            if (fixup->string)
+                printf("  %08x \"%s\"\n", fixup->chain, (char *)fixup->string->value);
+            else
+                printf("  %08x %s\n", fixup->chain, fixup->symbol->name);
     }
 }
 
-/* UpdateReferences - update all global symbol references */
+/* UpdateReferences - update all global symbol and string references */
 static void UpdateReferences(ParseContext *c)
 {
+    String *str;
     Symbol *sym;
 
     for (sym = c->globals.head; sym != NULL; sym = sym->next) {
-        VMUVALUE offset, next;
-        if (sym->type->id != TYPE_STRING && (offset = sym->v.variable.fixups) != 0) {
+        if (sym->type->id != TYPE_STRING && sym->v.variable.fixups != 0) {
             VMUVALUE addr;
             switch (sym->storageClass) {
             case SC_CONSTANT: // function text offset
@@ -374,12 +948,34 @@ static void UpdateReferences(ParseContext *c)
                 ParseError(c, "unexpected storage class");
                 break;
             }
-            for (; offset != 0; offset = next) {
-                next = ReadSectionOffset(c, c->textTarget, offset);
-                WriteSectionOffset(c, c->textTarget, offset, addr);
-            }
+            UpdateChain(c, sym->v.variable.fixups, addr);
         }
     }
+    
+    for (str = c->strings; str != NULL; str = str->next)
+        UpdateChain(c, str->fixups, c->textTarget->base + str->offset);
+}
+
+/* UpdateChain - store an address in each of the references on a fixup chain */
+static void UpdateChain(ParseContext *c, VMUVALUE chain, VMUVALUE addr)
+{
+    VMUVALUE next;
+    for (; chain != 0; chain = next) {
+        Section *section = CodeSection(c, chain);
+        next = ReadSectionOffset(c, section, chain - section->base);
+        WriteSectionOffset(c, section, chain - section->base, addr);
+    }
+}
+
+/* CodeSection - find the section holding the code at an address */
+static Section *CodeSection(ParseContext *c, VMUVALUE addr)
+{
+    Section *section;
+    for (section = c->config->sections; section != NULL; section = section->next)
+        if (addr >= section->base && addr - section->base < section->offset)
+            return section;
+    ParseError(c, "no section holds the reference at %08x", addr);
+    return NULL; // not reached
 }
 
 /* AddRegister - add a register to the global symbol table */
@@ -13,14 +13,24 @@
 #include "db_image.h"
 #include "db_system.h"
 #include "xb_api.h"
+#include "db_hash.h"
 
 #ifdef WIN32
 #define strcasecmp  _stricmp
 #endif
 
-/* program limits */
+/* program limits (the compact compiler keeps line offsets in a byte) */
+#ifdef COMPACT_COMPILER
 #define MAXLINE             128
 #define MAXTOKEN            32
+typedef uint8_t LineOffset;
+#else
+#define MAXLINE             1024
+#define MAXTOKEN            256
+typedef uint16_t LineOffset;
+#endif
+#define INITIAL_CODE_SIZE   (32 * 1024)
+#define MAXDIMS             4
 #define DEFAULT_STACK_SIZE  (64 * sizeof(VMVALUE))
 
 /* forward type declarations */
@@ -28,11 +38,17 @@ typedef struct Type Type;
 typedef struct SymbolTable SymbolTable;
 typedef struct Symbol Symbol;
 typedef struct IncludedFile IncludedFile;
+typedef struct SourceFile SourceFile;
+typedef struct CachedLine CachedLine;
 typedef struct Dependency Dependency;
+typedef struct LocalArray LocalArray;
 typedef struct String String;
 typedef struct ParseTreeNode ParseTreeNode;
 typedef struct NodeListEntry NodeListEntry;
 typedef struct CaseListEntry CaseListEntry;
+typedef struct StackUsage StackUsage;
+typedef struct StackCall StackCall;
+typedef struct PasmTables PasmTables;
 
 /* lexical tokens */
 enum {
@@ -70,6 +86,10 @@ enum {
     T_INPUT,
     T_PRINT,
     T_ASM,
+    T_COGSTART,
+    T_TASK,
+    T_YIELD,
+    T_WAITFOR,
     T_ELSE_IF,  /* compound keywords */
     T_END_DEF,
     T_END_IF,
@@ -86,6 +106,8 @@ enum {
     T_SHR,
     T_IDENTIFIER,
     T_NUMBER,
+    T_FIXED_NUMBER,
+    T_FLOAT_NUMBER,
     T_STRING,
     T_EOL,
     T_EOF
@@ -105,10 +127,12 @@ typedef struct {
     BlockType type;
     ParseTreeNode *node;
     NodeListEntry **pNextStatement;
+    NodeListEntry **pLoopEntry;     /* the list link holding a FOR or DO statement */
 } Block;
 
 typedef enum {
-    GEN_BLOCK_SELECT
+    GEN_BLOCK_SELECT,
+    GEN_BLOCK_FOR
 } GenBlockType;
 
 typedef struct {
@@ -119,16 +143,27 @@ typedef struct {
             VMUVALUE nxt;
             VMUVALUE end;
         } selectBlock;
+        struct {
+            int offset;         /* frame offset of the loop variable */
+            VMVALUE min;        /* smallest value the variable has in the body */
+            VMVALUE max;        /* largest value the variable has in the body */
+        } forBlock;
     } u;
 } GenBlock;
 
 struct String {
     String *next;
+    String *hashNext;           /* next string with the same hash */
     int placed;
     VMUVALUE offset;
+    VMUVALUE fixups;            /* chain of references to the string in the text section */
+    int length;                 /* length of the string value */
     uint8_t value[1];
 };
 
+/* number of string table hash buckets (must be a power of two) */
+#define STRING_HASH_SIZE    256
+
 /* label states */
 typedef enum {
     LS_UNDEFINED,
@@ -139,6 +174,7 @@ typedef enum {
 typedef struct Label Label;
 struct Label {
     Label *next;
+    HashEntry hashEntry;
     LabelState state;
     VMUVALUE offset;
     VMUVALUE fixups;
@@ -161,12 +197,14 @@ struct SymbolTable {
     Symbol *head;
     Symbol **pTail;
     int count;
+    HashTable index;
 };
 
 /* symbol structure */
 struct Symbol {
     Symbol *prev;
     Symbol *next;
+    HashEntry hashEntry;
     StorageClass storageClass;
     Section *section;
     Type *type;
@@ -177,10 +215,57 @@ struct Symbol {
         } variable;
         VMVALUE value;
         String *string;
+        Symbol *global;         /* hidden global of an array or overlaid scalar declared in a function */
     } v;
+    int dependencyMark;         /* mark of the last function that depends on the symbol */
+    int referenced;             /* the symbol is reachable from the main code */
+    VMUVALUE arraySize;         /* elements (or rows) of an array or zero if it isn't known */
     char name[1];
 };
 
+/* global data that is placed at the end of pass 2 if its symbol is referenced */
+typedef struct GlobalData GlobalData;
+struct GlobalData {
+    GlobalData *next;           /* next global data in the order it was defined */
+    Symbol *symbol;             /* symbol for the data */
+    int packed;                 /* a byte or word scalar that can share a long */
+    VMUVALUE size;              /* size of the data in bytes */
+    uint8_t data[1];            /* initial value */
+};
+
+/* literal placed in the data section that the code loads with OP_GREF or OP_GREF16 */
+typedef struct PooledLiteral PooledLiteral;
+struct PooledLiteral {
+    PooledLiteral *next;        /* next literal in the pool */
+    VMVALUE value;              /* value of the literal */
+    VMUVALUE index;             /* offset of the value in longs from the start of hub memory */
+};
+
+/* source line of a statement in the code (kept for the debug section of the image) */
+typedef struct DebugLine DebugLine;
+struct DebugLine {
+    DebugLine *next;            /* next line in code order */
+    VMUVALUE offset;            /* offset of the code in the function or, once placed, its address */
+    int lineNumber;             /* line number within the file */
+    int file;                   /* index of the file in the debug file table */
+};
+
+/* file in the debug file table (the main file is file 0 and isn't in the table) */
+typedef struct DebugFile DebugFile;
+struct DebugFile {
+    DebugFile *next;            /* next file in index order */
+    IncludedFile *include;      /* included file the lines came from */
+    int index;                  /* index of the file */
+    char name[1];               /* file name */
+};
+
+/* check for the local symbol of an array or an overlaid scalar declared in a function (it refers to a hidden global) */
+#define IsSharedLocal(sym)  ((sym)->storageClass != SC_LOCAL)
+
+/* check for a symbol whose address depends on where its section is placed in the image */
+#define IsRelocatable(sym)  (((sym)->storageClass == SC_CONSTANT || (sym)->storageClass == SC_GLOBAL) \
+                             && (sym)->section && (sym)->type->id != TYPE_STRING)
+
 /* types */
 typedef enum {
     TYPE_INTEGER,
@@ -188,15 +273,36 @@ typedef enum {
     TYPE_STRING,
     TYPE_ARRAY,
     TYPE_POINTER,
-    TYPE_FUNCTION
+    TYPE_FUNCTION,
+    TYPE_FIXED,
+    TYPE_FLOAT,
+    TYPE_WORD
 } TypeID;
 
+/* fixed point values are 16.16 */
+#define FIXED_SHIFT     16
+#define FIXED_ONE       ((VMVALUE)1 << FIXED_SHIFT)
+
+/* fixed point and float operators in unary and binary operator nodes
+   (these aren't VM opcodes, they are generated as OP_TRAP with the matching TRAP_xxx function) */
+#define OP_FIXMUL       0x100
+#define OP_FIXDIV       0x101
+#define OP_FADD         0x102
+#define OP_FSUB         0x103
+#define OP_FMUL         0x104
+#define OP_FDIV         0x105
+#define OP_FCMP         0x106
+#define OP_ITOF         0x107
+#define OP_FTOI         0x108
+
 /* type definition */
 struct Type {
     TypeID  id;
     union {
         struct {
             Type *elementType;
+            VMUVALUE size;      /* number of elements in a row of a multi-dimensional array */
+            Type *pointerType;  /* pointer to the first row of a multi-dimensional array */
         } arrayInfo;
         struct {
             Type *targetType;
@@ -205,6 +311,21 @@ struct Type {
             Type *returnType;
             SymbolTable arguments;
             Dependency *dependencies;
+            int callerCleans;   /* the caller removes the arguments (inline assembly returns) */
+            ParseTreeNode *inlineDefinition;    /* saved definition of a function small enough to expand inline */
+            int inlined;        /* every call is expanded inline so the function needs no code */
+            StackUsage *stackUsage; /* stack usage of the code stored for the function */
+            int hot;            /* placed in hub memory by the profile (moved back to the text section if it doesn't fit) */
+            int started;        /* COGSTART or TASK runs it so it needs code even if every call is expanded inline */
+            int native;         /* defined with NATIVE so it is compiled to LMM code if it can be */
+            LocalArray *localArrays;    /* arrays declared with DIM in its body and its scalars with OPTION overlay */
+            VMUVALUE localArraySize;    /* longs taken by its arrays */
+            VMUVALUE localScalarSize;   /* longs taken by its scalars if they are overlaid */
+            int overlayScalars; /* its scalars were placed with its arrays so they aren't in its frame */
+            int arrayState;     /* state of the call graph walk that places the arrays */
+            int arrayPrivate;   /* it can be active more than once so its arrays can't be shared */
+            VMUVALUE arrayHeight;   /* longs of arrays taken by it and the functions it calls */
+            Symbol *arrayCaller;    /* caller on the path of the walk */
         } functionInfo;
     } u;
 };
@@ -214,9 +335,30 @@ typedef struct LocalFixup LocalFixup;
 struct LocalFixup {
     LocalFixup *next;
     Symbol *symbol;
+    String *string;             /* string whose address goes on the chain (symbol is NULL) */
     VMUVALUE chain;
 };
 
+/* local fixup of code kept between builds */
+typedef struct {
+    const char *name;           /* symbol name or string value */
+    int isString;               /* the chain needs the address of a string rather than a symbol */
+    VMUVALUE chain;             /* offset of the last operand on the chain */
+} CachedFixup;
+
+/* code stored for a function, kept between builds so it can be reused if the function doesn't change */
+typedef struct CachedCode CachedCode;
+struct CachedCode {
+    CachedCode *next;           /* next function */
+    const char *name;           /* function name ("[main]" for the main code) */
+    uint32_t hash;              /* hash of the parse tree the code was generated from */
+    uint8_t *code;              /* code with its local fixup chains still linked */
+    int codeSize;               /* size of the code */
+    CachedFixup *fixups;        /* local fixups */
+    int fixupCount;             /* number of local fixups */
+    int reused;                 /* the code was reused from the previous build */
+};
+
 /* main code state */
 typedef enum {
     MAIN_NOT_DEFINED,
@@ -238,7 +380,9 @@ typedef struct {
 /* current include file */
 typedef struct {
     IncludedFile *file;
-    void *fp;
+    void *fp;                   /* file pointer or NULL if the file is replayed from the source cache */
+    SourceFile *source;         /* source cache entry recording the lines as they are read */
+    CachedLine *nextLine;       /* next line to replay from the source cache */
 } CurrentIncludeFile;
 
 /* parse file */
@@ -258,14 +402,101 @@ struct IncludedFile {
     char name[1];               /* file name */
 };
 
+/* cached token */
+typedef struct {
+    int token;                  /* token */
+    LineOffset start;           /* line offset before the token */
+    LineOffset end;             /* line offset after the token */
+    LineOffset offset;          /* line offset of the start of the token */
+    uint8_t inComment;          /* comment state before (bit 0) and after (bit 1) the token */
+    VMVALUE value;              /* value of a number token */
+    char *string;               /* token string or NULL if the token doesn't set one */
+} CachedToken;
+
+/* cached source line */
+struct CachedLine {
+    CachedLine *next;           /* next line in the order it was read */
+    IncludedFile *file;         /* include file or NULL for the main file */
+    int lineNumber;             /* line number within the file */
+    CachedToken *tokens;        /* tokens scanned ahead of the parser */
+    int tokenCount;             /* number of cached tokens */
+    char *text;                 /* line text */
+    int size;                   /* size of the block holding the line, its tokens, text and token strings */
+};
+
+/* include file kept in the source cache between compiles */
+struct SourceFile {
+    SourceFile *next;           /* next file in the cache */
+    long size;                  /* file size when it was cached */
+    long time;                  /* file modification time when it was cached */
+    long id;                    /* file serial number when it was cached */
+    int complete;               /* all of the lines of the file have been cached */
+    uint32_t hash;              /* hash of the file contents (only used with a unit directory) */
+    CachedLine *lines;          /* lines and their tokens */
+    CachedLine **pNextLine;     /* place to store the next line */
+    char name[1];               /* file name as it was included */
+};
+
+/* source cache */
+struct SourceCache {
+    SourceFile *files;          /* cached include files */
+    char *unitDirectory;        /* directory for the precompiled units of the include files or NULL */
+    int hits;                   /* number of includes replayed from the cache */
+    int misses;                 /* number of includes read from their files */
+    int unitLoads;              /* number of misses replayed from precompiled units */
+};
+
+/* function that a profile found hot enough to place in hub memory */
+typedef struct HotFunction HotFunction;
+struct HotFunction {
+    HotFunction *next;          /* next hot function */
+    char name[1];               /* function name */
+};
+
+/* hot functions from the profile of a previous run */
+struct HotProfile {
+    HotFunction *functions;     /* hot functions */
+    int count;                  /* number of hot functions */
+};
+
 /* dependency */
 struct Dependency {
     Symbol *symbol;
     Dependency *next;
 };
 
+/* array declared with DIM in a function (a hidden global named function.array so functions that
+   can't be active at the same time can share the memory) or a scalar for OPTION overlay */
+struct LocalArray {
+    LocalArray *next;
+    Symbol *symbol;
+    int scalar;                 /* a scalar that is only overlaid if the function can't be active more than once */
+    VMUVALUE offset;            /* offset in longs from the start of the function's arrays or scalars */
+};
+
+/* states of the call graph walk that places the local arrays */
+#define AS_NEW      0
+#define AS_ACTIVE   1
+#define AS_DONE     2
+
+/* stack usage of the code of a function */
+struct StackUsage {
+    int depth;                      /* most stack words used by the code itself */
+    int unknown;                    /* the code makes calls that can't be followed */
+    StackCall *calls;               /* functions called by the code */
+    int state;                      /* state of the call graph walk */
+    int total;                      /* most stack words used including the functions called */
+};
+
+/* function call in the code of a function */
+struct StackCall {
+    Symbol *symbol;                 /* function being called */
+    int depth;                      /* stack words in use when the function is entered */
+    StackCall *next;
+};
+
 /* parse context */
-typedef struct {
+struct ParseContext {
     jmp_buf errorTarget;            /* error target */
     System *sys;                    /* system interface */
     BoardConfig *config;            /* board configuration */
@@ -274,6 +505,10 @@ typedef struct {
     ParseFile *currentFile;         /* scan - current input file */
     IncludedFile *includedFiles;    /* scan - list of files that have already been included */
     IncludedFile *currentInclude;   /* scan - file currently being included */
+    SourceCache *sourceCache;       /* scan - include files kept between compiles (or NULL) */
+    HotProfile *hotProfile;         /* functions to place in hub memory (or NULL) */
+    PhaseTimingFcn *phaseTiming;    /* function to report the time and memory used by each phase (or NULL) */
+    void *phaseTimingCookie;        /* cookie for the phase timing function */
     char lineBuf[MAXLINE];          /* scan - line buffer */
     char *linePtr;                  /* scan - pointer to the current character */
     int savedToken;                 /* scan - lookahead token */
@@ -281,6 +516,15 @@ typedef struct {
     char token[MAXTOKEN];           /* scan - current token string */
     VMVALUE value;                  /* scan - current token integer value */
     int inComment;                  /* scan - inside of a slash/star comment */
+    CachedLine *lineCache;          /* scan - source lines read on the first pass */
+    CachedLine **pNextCachedLine;   /* scan - place to store the next cached line */
+    CachedLine *nextCachedLine;     /* scan - next cached line to replay */
+    CachedLine *cachedLine;         /* scan - cached copy of the current line */
+    int nextCachedToken;            /* scan - index of the next cached token to check */
+    int prescan;                    /* scan - scanning a line ahead of the parser */
+    HashTable keywordIndex;         /* scan - keyword index */
+    HashEntry *keywordEntries;      /* scan - keyword index entries */
+    PasmTables *pasmTables;         /* scan - assembler indexes the asm lines and NATIVE functions share */
     Type stringType;                /* parse - string type */
     Type integerType;               /* parse - integer type */
     Type integerArrayType;          /* parse - integer array type */
@@ -288,12 +532,32 @@ typedef struct {
     Type byteType;                  /* parse - byte type */
     Type byteArrayType;             /* parse - byte array type */
     Type bytePointerType;           /* parse - byte pointer type */
+    Type wordType;                  /* parse - 16 bit word type */
+    Type wordArrayType;             /* parse - 16 bit word array type */
+    Type wordPointerType;           /* parse - 16 bit word pointer type */
+    Type fixedType;                 /* parse - fixed point type */
+    Type fixedArrayType;            /* parse - fixed point array type */
+    Type fixedPointerType;          /* parse - fixed point pointer type */
+    Type floatType;                 /* parse - float type */
+    Type floatArrayType;            /* parse - float array type */
+    Type floatPointerType;          /* parse - float pointer type */
     SymbolTable globals;            /* parse - global variables and constants */
     String *strings;                /* parse - string constants */
+    String *stringIndex[STRING_HASH_SIZE]; /* parse - string constants by the hash of their values */
     Type *functionType;             /* parse - in a function definition */
     ParseTreeNode *function;        /* parse - function currently being compiled */
     Dependency *dependencies;       /* parse - dependencies for the function currently being compiled */
     Dependency **pNextDependency;   /* parse - place to store the next dependency */
+    int dependencyMark;             /* parse - mark of the function whose dependencies are being collected */
+    GlobalData *globalData;         /* parse - global data waiting to be placed */
+    GlobalData **pNextGlobalData;   /* parse - place to store the next global data */
+    DebugLine *debugLines;          /* parse - source lines of the code placed so far */
+    DebugLine **pNextDebugLine;     /* parse - place to store the next placed line */
+    VMUVALUE debugLineEnd;          /* parse - address following the code of the last placed line */
+    int debugLineCount;             /* parse - number of placed lines */
+    DebugFile *debugFiles;          /* parse - files the placed lines came from */
+    DebugFile **pNextDebugFile;     /* parse - place to store the next file */
+    int debugFileCount;             /* parse - number of files including the main file */
     MainState mainState;            /* parse - state of main code processing */
     VMUVALUE mainCode;              /* parse - main code offset into text space */
     Dependency *mainDependencies;   /* parse - main code dependencies */
@@ -301,17 +565,37 @@ typedef struct {
     Block blockBuf[10];             /* parse - stack of nested blocks */
     Block *bptr;                    /* parse - current block */
     Block *btop;                    /* parse - top of block stack */
-    int stackSize;                  /* parse - interpreter stack size */
+    int stackSize;                  /* parse - interpreter stack size (zero to compute it) */
+    int overlay;                    /* parse - place scalar locals with the shared local arrays (OPTION overlay) */
     int pass;                       /* parse - compiler pass in progress */
+    int fcacheCount;                /* parse - ASM FCACHE blocks so far in this pass */
+    int usesRegisters;              /* parse - the program refers to hardware registers so globals are volatile */
+    int startsCogs;                 /* parse - the program uses COGSTART so globals are volatile */
+    int runsTasks;                  /* parse - the program uses TASK, YIELD or WAITFOR so globals are volatile */
     GenBlock genBlockBuf[10];       /* generate - stack of nested generator blocks */
     GenBlock *gptr;                 /* generate - current generator block */
     GenBlock *gtop;                 /* generate - top of generator block stack */
+    int inlining;                   /* generate - expanding the body of an inline function */
+    int inlineBase;                 /* generate - first frame slot available to an inline expansion */
+    VMUVALUE inlineExit;            /* generate - branches from RETURN statements to the end of an inline expansion */
+    VMUVALUE bodyOffset;            /* generate - code offset of the body of the current function (after its FRAME) */
+    int native;                     /* generate - the current function is compiled to LMM code */
+    VMUVALUE nativeSize;            /* generate - size of the LMM code of the current function */
+    DebugLine *functionLines;       /* generate - source lines of the code being generated */
+    DebugLine *lastFunctionLine;    /* generate - last line of the code being generated */
+    StackUsage *mainStackUsage;     /* generate - stack usage of the main code */
     Section *textTarget;            /* generate - section where text will be placed */
     Section *dataTarget;            /* generate - section where data will be placed */
+    PooledLiteral *literalPool;     /* generate - literals shared through the data section */
+    const char *imageName;          /* generate - name of the image file */
+    CachedCode *previousCode;       /* generate - code stored by the previous build of the image */
+    CachedCode *storedCode;         /* generate - code stored by this build */
+    CachedCode **pNextStoredCode;   /* generate - place to record the next code stored */
     uint8_t *cptr;                  /* generate - next available code staging buffer position */
     uint8_t *ctop;                  /* generate - top of code staging buffer */
+    size_t maxCode;                 /* generate - largest size the code staging buffer can grow to */
     uint8_t *codeBuf;               /* generate - code staging buffer */
-} ParseContext;
+};
 
 /* partial value */
 typedef struct PVAL PVAL;
@@ -375,11 +659,13 @@ typedef enum {
 struct ParseTreeNode {
     NodeType nodeType;
     Type *type;
+    CachedLine *line;           /* line the node was parsed from or NULL */
     union {
         struct {
             Symbol *symbol;
             SymbolTable locals;
             Label *labels;
+            HashTable labelIndex;
             int localOffset;
             NodeListEntry *bodyStatements;
         } functionDefinition;
@@ -427,6 +713,8 @@ struct ParseTreeNode {
         struct {
             uint8_t *code;
             int length;
+            Symbol *fcache;         /* block of an ASM FCACHE statement (no code) */
+            ParseTreeNode *arg;     /* value the block finds in tos or NULL */
         } asmStatement;
         struct {
             Symbol *symbol;
@@ -492,14 +780,17 @@ void HeapReset(void);
 uint8_t *HeapAlloc(size_t size);
 
 /* db_compiler.c */
-ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t codeBufSize);
+ParseContext *InitCompiler(System *sys, BoardConfig *config, size_t maxCode);
 int Compile(ParseContext *c, const char *name);
 void StoreCode(ParseContext *c);
 void AddIntrinsic(ParseContext *c, char *name, char *argTypes, char *retType, int index);
 void AddRegister(ParseContext *c, char *name, VMUVALUE addr);
 String *AddString(ParseContext *c, char *value);
-VMUVALUE AddStringRef(ParseContext *c, String *str);
+void AddGlobalData(ParseContext *c, Symbol *symbol, const uint8_t *data, VMUVALUE size, int packed);
 VMUVALUE AddLocalSymbolFixup(ParseContext *c, Symbol *symbol, VMUVALUE offset);
+VMUVALUE AddLocalStringFixup(ParseContext *c, String *str, VMUVALUE offset);
+void AddDebugLine(ParseContext *c, CachedLine *line);
+int IsHotFunction(ParseContext *c, const char *name);
 void Fatal(ParseContext *c, const char *fmt, ...);
 
 /* db_statement.c */
@@ -517,18 +808,22 @@ void AddNodeToList(ParseContext *c, NodeListEntry ***ppNextEntry, ParseTreeNode
 void PrintNode(ParseTreeNode *node, int indent);
 int IsIntegerLit(ParseTreeNode *node);
 int IsStringLit(ParseTreeNode *node);
+ParseTreeNode *ConvertExpr(ParseContext *c, ParseTreeNode *expr, Type *type);
 
 /* db_scan.c */
+int InitScan(ParseContext *c);
 void RewindInput(ParseContext *c);
 int PushFile(ParseContext *c, const char *name);
 void ClearIncludedFiles(ParseContext *c);
 void CloseParseContext(ParseContext *c);
+void FreeSourceCache(SourceCache *cache);
+uint32_t HashKeywords(uint32_t hash);
 int GetLine(ParseContext *c);
 void FRequire(ParseContext *c, int requiredToken);
 void Require(ParseContext *c, int token, int requiredToken);
 int GetToken(ParseContext *c);
 void SaveToken(ParseContext *c, int token);
-char *TokenName(int token);
+char *TokenName(int token, char *nameBuf);
 int SkipSpaces(ParseContext *c);
 int GetChar(ParseContext *c);
 void UngetC(ParseContext *c);
@@ -542,6 +837,22 @@ void *GlobalAlloc(ParseContext *c, size_t size);
 void *LocalAlloc(ParseContext *c, size_t size);
 void ParseError(ParseContext *c, char *fmt, ...);
 
+/* db_unit.c */
+#define HASH_INIT   2166136261u     /* initial FNV-1a hash value */
+uint32_t HashBytes(uint32_t hash, const void *data, size_t size);
+int ReadHashedData(FILE *fp, void *buf, size_t size, uint32_t *pHash);
+void WriteHashedData(FILE *fp, const void *buf, size_t size, uint32_t *pHash);
+
+/* db_reuse.c */
+void LoadCodeCache(ParseContext *c);
+void SaveCodeCache(ParseContext *c);
+uint32_t HashFunction(ParseContext *c);
+int ReuseCode(ParseContext *c, uint32_t hash);
+void RecordCode(ParseContext *c, uint32_t hash, int reused);
+uint32_t HashSourceFile(void *fp);
+int LoadUnit(SourceCache *cache, SourceFile *source);
+void SaveUnit(SourceCache *cache, SourceFile *source);
+
 /* db_symbols.c */
 void InitSymbolTable(SymbolTable *table);
 void AddDependency(ParseContext *c, Symbol *symbol);
@@ -560,7 +871,11 @@ Type *NewGlobalType(ParseContext *c, TypeID id);
 Type *ArrayTypeToPointerType(ParseContext *c, Type *type);
 int CompareTypes(Type *type1, Type *type2);
 VMUVALUE ValueSize(Type *type, VMUVALUE size);
+VMUVALUE ValueByteSize(Type *type);
 int IsIntegerType(Type *type);
+int IsNumericType(Type *type);
+float ValueToFloat(VMVALUE value);
+VMVALUE FloatToValue(float f);
 
 /* db_generate.c */
 void Generate(ParseContext *c, ParseTreeNode *expr);
@@ -568,6 +883,7 @@ void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 void code_global(ParseContext *c, PValOp fcn, PVAL *pv);
 void code_local(ParseContext *c, PValOp fcn, PVAL *pv);
 VMUVALUE codeaddr(ParseContext *c);
+int GrowCode(ParseContext *c, size_t size);
 VMUVALUE putcbyte(ParseContext *c, int b);
 VMUVALUE putcword(ParseContext *c, VMVALUE w);
 VMVALUE rd_cword(ParseContext *c, VMUVALUE off);
@@ -575,11 +891,48 @@ void wr_cword(ParseContext *c, VMUVALUE off, VMVALUE w);
 int merge(ParseContext *c, VMUVALUE chn, VMUVALUE chn2);
 void fixup(ParseContext *c, VMUVALUE chn, VMUVALUE val);
 void fixupbranch(ParseContext *c, VMUVALUE chn, VMUVALUE val);
+int PopsArguments(Type *type);
+int InvertBranch(int op);
+
+/* db_inline.c */
+typedef void VisitFcn(ParseContext *c, ParseTreeNode *node, void *cookie);
+void SaveInlineCandidate(ParseContext *c);
+void SelectInlineFunctions(ParseContext *c);
+int IsInlineCall(ParseTreeNode *expr);
+int InlineSlots(Type *type);
+int InlineFrameSize(ParseContext *c, NodeListEntry *statements);
+int InlineSlotOffset(ParseContext *c, int slot);
+ParseTreeNode *InstantiateInline(ParseContext *c, Type *type, int base);
+void VisitChildren(ParseContext *c, ParseTreeNode *node, VisitFcn *fcn, void *cookie);
+
+/* db_loop.c */
+void HoistLoopInvariants(ParseContext *c, ParseTreeNode *loop, NodeListEntry **pEntry);
+void OptimizeFunction(ParseContext *c, ParseTreeNode *function);
+
+/* db_native.c */
+int CheckNativeFunction(ParseContext *c);
+VMUVALUE AppendNativeCode(ParseContext *c, VMUVALUE addr);
+
+/* db_pasm.c */
+size_t PasmTablesSize(void);
+void PasmIndexTables(PasmTables *tables);
+int PasmAssemble1(PasmTables *tables, char *line, uint32_t *pValue);
+
+/* db_peep.c */
+int OptimizeCode(ParseContext *c);
+
+/* db_relax.c */
+int RelaxCode(ParseContext *c);
+
+/* db_stack.c */
+void AnalyzeStack(ParseContext *c);
+void ComputeStackSize(ParseContext *c);
 
 /* db_wrimage.c */
 int StartImage(ParseContext *c, const char *name);
 int BuildImage(ParseContext *c, const char *name);
 VMUVALUE WriteSection(ParseContext *c, Section *section, const uint8_t *buf, VMUVALUE size);
+VMUVALUE PackSection(ParseContext *c, Section *section, const uint8_t *buf, VMUVALUE size);
 VMUVALUE ReadSectionOffset(ParseContext *c, Section *section, VMUVALUE offset);
 void WriteSectionOffset(ParseContext *c, Section *section, VMUVALUE offset, VMUVALUE value);
 
@@ -8,6 +8,9 @@
 #include <string.h>
 #include "db_compiler.h"
 
+/* number of bits in a VM word */
+#define VMVALUE_BITS    ((int)(sizeof(VMVALUE) * 8))
+
 /* local function prototypes */
 static ParseTreeNode *ParseExpr2(ParseContext *c);
 static ParseTreeNode *ParseExpr3(ParseContext *c);
@@ -24,6 +27,19 @@ static ParseTreeNode *ParseArrayReference(ParseContext *c, ParseTreeNode *arrayN
 static ParseTreeNode *ParseCall(ParseContext *c, ParseTreeNode *functionNode);
 static ParseTreeNode *MakeUnaryOpNode(ParseContext *c, int op, ParseTreeNode *expr);
 static ParseTreeNode *MakeBinaryOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right);
+static ParseTreeNode *MakeFixedBinaryOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right);
+static int FoldFixedOp(int op, VMVALUE left, VMVALUE right, VMVALUE *pValue);
+static ParseTreeNode *MakeFloatUnaryOpNode(ParseContext *c, int op, ParseTreeNode *expr);
+static ParseTreeNode *MakeFloatBinaryOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right);
+static ParseTreeNode *MakeFloatCompareNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right);
+static ParseTreeNode *MakeFloatOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right);
+static ParseTreeNode *MakeFloatLit(ParseContext *c, float value);
+static ParseTreeNode *ConvertFloatExpr(ParseContext *c, ParseTreeNode *expr, Type *type);
+static void FoldFloatOp(int op, VMVALUE left, VMVALUE right, VMVALUE *pValue);
+static VMVALUE FloatToInteger(VMVALUE value);
+static int FoldBinaryOp(int op, VMVALUE left, VMVALUE right, VMVALUE *pValue);
+static int IsCommutativeOp(int op);
+static ParseTreeNode *SimplifyBinaryOp(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right);
 
 /* ParseExpr - handle the OR operator */
 ParseTreeNode *ParseExpr(ParseContext *c)
@@ -317,11 +333,21 @@ ParseTreeNode *ParsePrimary(ParseContext *c)
 /* ParseArrayReference - parse an array reference */
 static ParseTreeNode *ParseArrayReference(ParseContext *c, ParseTreeNode *arrayNode)
 {
-    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeArrayRef);
-    node->type = arrayNode->type->u.arrayInfo.elementType;
-    node->u.arrayRef.array = arrayNode;
-    node->u.arrayRef.index = ParseExpr(c);
-    FRequire(c, ')');
+    ParseTreeNode *node;
+    int tkn;
+    
+    /* each index selects a row of a multi-dimensional array until the last one selects an element */
+    do {
+        if (arrayNode->type->id != TYPE_ARRAY && arrayNode->type->id != TYPE_POINTER)
+            ParseError(c, "too many array indexes");
+        node = NewParseTreeNode(c, NodeTypeArrayRef);
+        node->type = arrayNode->type->u.arrayInfo.elementType;
+        node->u.arrayRef.array = arrayNode;
+        node->u.arrayRef.index = ParseExpr(c);
+        arrayNode = node;
+    } while ((tkn = GetToken(c)) == ',');
+    Require(c, tkn, ')');
+    
     return node;
 }
 
@@ -352,6 +378,8 @@ static ParseTreeNode *ParseCall(ParseContext *c, ParseTreeNode *functionNode)
             /* check the argument count and type */
             if (!arg)
                 ParseError(c, "too many arguments");
+            else if (IsNumericType(actual->node->type) && IsNumericType(arg->type))
+                actual->node = ConvertExpr(c, actual->node, arg->type);
             else if (!CompareTypes(actual->node->type, arg->type))
                 ParseError(c, "wrong argument type");
 
@@ -389,6 +417,16 @@ static ParseTreeNode *ParseSimplePrimary(ParseContext *c)
         node->type = &c->integerType;
         node->u.integerLit.value = c->value;
         break;
+    case T_FIXED_NUMBER:
+        node = NewParseTreeNode(c, NodeTypeIntegerLit);
+        node->type = &c->fixedType;
+        node->u.integerLit.value = c->value;
+        break;
+    case T_FLOAT_NUMBER:
+        node = NewParseTreeNode(c, NodeTypeIntegerLit);
+        node->type = &c->floatType;
+        node->u.integerLit.value = c->value;
+        break;
     case T_STRING:
         node = NewParseTreeNode(c, NodeTypeStringLit);
         node->type = &c->byteArrayType;
@@ -413,9 +451,23 @@ ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
 
     /* handle local variables within a function */
     if (c->function && (symbol = FindSymbol(&c->function->u.functionDefinition.locals, name)) != NULL) {
-        node = NewParseTreeNode(c, NodeTypeLocalRef);
-        node->type = symbol->type;
-        node->u.localRef.offset = symbol->v.variable.offset;
+        if (IsSharedLocal(symbol) && symbol->type->id == TYPE_ARRAY) {
+            node = NewParseTreeNode(c, NodeTypeArrayLit);
+            node->type = ArrayTypeToPointerType(c, symbol->type);
+            node->u.arrayLit.symbol = symbol->v.global;
+            AddDependency(c, symbol->v.global);
+        }
+        else if (IsSharedLocal(symbol)) {
+            node = NewParseTreeNode(c, NodeTypeGlobalRef);
+            node->type = symbol->type;
+            node->u.globalRef.symbol = symbol->v.global;
+            AddDependency(c, symbol->v.global);
+        }
+        else {
+            node = NewParseTreeNode(c, NodeTypeLocalRef);
+            node->type = symbol->type;
+            node->u.localRef.offset = symbol->v.variable.offset;
+        }
     }
 
     /* handle function arguments */
@@ -447,6 +499,8 @@ ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
                 AddDependency(c, symbol);
                 break;
             case TYPE_INTEGER:
+            case TYPE_FIXED:
+            case TYPE_FLOAT:
                 node = NewParseTreeNode(c, NodeTypeIntegerLit);
                 node->type = symbol->type;
                 node->u.integerLit.value = symbol->v.value;
@@ -462,6 +516,8 @@ ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
             node->type = symbol->type;
             node->u.globalRef.symbol = symbol;
             AddDependency(c, symbol);
+            if (symbol->storageClass == SC_COG)
+                c->usesRegisters = TRUE;
         }
     }
 
@@ -472,11 +528,12 @@ ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
             node->type = &c->integerType;
         else {
             VMVALUE value = 0;
-            symbol = AddGlobalSymbol(c, name, SC_GLOBAL, &c->integerType, c->dataTarget);
+            symbol = AddGlobalOffset(c, name, SC_GLOBAL, &c->integerType, UNDEF_VALUE);
+            symbol->section = c->dataTarget;
             node->type = symbol->type;
             node->u.globalRef.symbol = symbol;
             AddDependency(c, symbol);
-            c->dataTarget->offset += WriteSection(c, c->dataTarget, (uint8_t *)&value, sizeof(VMVALUE));
+            AddGlobalData(c, symbol, (uint8_t *)&value, sizeof(VMVALUE), FALSE);
         }
     }
 
@@ -488,23 +545,26 @@ ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
 static ParseTreeNode *MakeUnaryOpNode(ParseContext *c, int op, ParseTreeNode *expr)
 {
     ParseTreeNode *node;
-    if (IsIntegerLit(expr)) {
+    if (expr->type->id == TYPE_FLOAT)
+        node = MakeFloatUnaryOpNode(c, op, expr);
+    else if (IsIntegerLit(expr)) {
         node = expr;
         switch (op) {
         case OP_NEG:
-            node->u.integerLit.value = -expr->u.integerLit.value;
+            node->u.integerLit.value = (VMVALUE)-(VMUVALUE)expr->u.integerLit.value;
             break;
         case OP_NOT:
             node->u.integerLit.value = !expr->u.integerLit.value;
+            node->type = &c->integerType;
             break;
         case OP_BNOT:
             node->u.integerLit.value = ~expr->u.integerLit.value;
             break;
         }
     }
-    else if (expr->type->id == TYPE_INTEGER) {
+    else if (IsIntegerType(expr->type) || expr->type->id == TYPE_FIXED) {
         node = NewParseTreeNode(c, NodeTypeUnaryOp);
-        node->type = &c->integerType;
+        node->type = (op != OP_NOT && expr->type->id == TYPE_FIXED ? expr->type : &c->integerType);
         node->u.unaryOp.op = op;
         node->u.unaryOp.expr = expr;
     }
@@ -519,86 +579,511 @@ static ParseTreeNode *MakeUnaryOpNode(ParseContext *c, int op, ParseTreeNode *ex
 static ParseTreeNode *MakeBinaryOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right)
 {
     ParseTreeNode *node;
-    if (IsIntegerLit(left) && IsIntegerLit(right)) {
+    VMVALUE value;
+    if (left->type->id == TYPE_FLOAT || right->type->id == TYPE_FLOAT)
+        node = MakeFloatBinaryOpNode(c, op, left, right);
+    else if (left->type->id == TYPE_FIXED || right->type->id == TYPE_FIXED)
+        node = MakeFixedBinaryOpNode(c, op, left, right);
+    else if (IsIntegerLit(left) && IsIntegerLit(right) && FoldBinaryOp(op, left->u.integerLit.value, right->u.integerLit.value, &value)) {
         node = left;
-        switch (op) {
-        case OP_BXOR:
-            node->u.integerLit.value = left->u.integerLit.value ^ right->u.integerLit.value;
-            break;
-        case OP_BOR:
-            node->u.integerLit.value = left->u.integerLit.value | right->u.integerLit.value;
-            break;
-        case OP_BAND:
-            node->u.integerLit.value = left->u.integerLit.value & right->u.integerLit.value;
-            break;
-        case OP_EQ:
-            node->u.integerLit.value = left->u.integerLit.value == right->u.integerLit.value;
-            break;
-        case OP_NE:
-            node->u.integerLit.value = left->u.integerLit.value != right->u.integerLit.value;
-            break;
-        case OP_LT:
-            node->u.integerLit.value = left->u.integerLit.value < right->u.integerLit.value;
-            break;
-        case OP_LE:
-            node->u.integerLit.value = left->u.integerLit.value <= right->u.integerLit.value;
-            break;
-        case OP_GE:
-            node->u.integerLit.value = left->u.integerLit.value >= right->u.integerLit.value;
-            break;
-        case OP_GT:
-            node->u.integerLit.value = left->u.integerLit.value > right->u.integerLit.value;
-            break;
-        case OP_SHL:
-            node->u.integerLit.value = left->u.integerLit.value << right->u.integerLit.value;
-            break;
-        case OP_SHR:
-            node->u.integerLit.value = left->u.integerLit.value >> right->u.integerLit.value;
-            break;
-        case OP_ADD:
-            node->u.integerLit.value = left->u.integerLit.value + right->u.integerLit.value;
-            break;
-        case OP_SUB:
-            node->u.integerLit.value = left->u.integerLit.value - right->u.integerLit.value;
-            break;
-        case OP_MUL:
-            node->u.integerLit.value = left->u.integerLit.value * right->u.integerLit.value;
-            break;
-        case OP_DIV:
-            if (right->u.integerLit.value == 0)
-                ParseError(c, "division by zero in constant expression");
-            node->u.integerLit.value = left->u.integerLit.value / right->u.integerLit.value;
-            break;
-        case OP_REM:
-            if (right->u.integerLit.value == 0)
-                ParseError(c, "division by zero in constant expression");
-            node->u.integerLit.value = left->u.integerLit.value % right->u.integerLit.value;
-            break;
-        default:
-            goto integerOp;
-        }
+        node->u.integerLit.value = value;
     }
     else if (IsIntegerType(left->type) && IsIntegerType(right->type)) {
-integerOp:
+        
+        /* move a constant to the right of a commutative operator */
+        if (IsIntegerLit(left) && IsCommutativeOp(op)) {
+            node = left;
+            left = right;
+            right = node;
+        }
+        
+        /* apply the algebraic identities */
+        if ((node = SimplifyBinaryOp(c, op, left, right)) == NULL) {
+            node = NewParseTreeNode(c, NodeTypeBinaryOp);
+            node->type = &c->integerType;
+            node->u.binaryOp.op = op;
+            node->u.binaryOp.left = left;
+            node->u.binaryOp.right = right;
+        }
+    }
+    else {
+        ParseError(c, "Expecting a numeric expression");
+        node = NULL; /* not reached */
+    }
+    return node;
+}
+
+/* MakeFixedBinaryOpNode - allocate a binary operation node with a fixed point operand
+   (bitwise operators and shifts work on the raw bits, other operators convert an integer operand) */
+static ParseTreeNode *MakeFixedBinaryOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right)
+{
+    ParseTreeNode *node;
+    Type *type;
+    VMVALUE value;
+    
+    if (!IsNumericType(left->type) || !IsNumericType(right->type))
+        ParseError(c, "Expecting a numeric expression");
+    
+    switch (op) {
+    case OP_BXOR:
+    case OP_BOR:
+    case OP_BAND:
+    case OP_SHL:
+    case OP_SHR:
+        type = &c->fixedType;
+        break;
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_LE:
+    case OP_GE:
+    case OP_GT:
+        left = ConvertExpr(c, left, &c->fixedType);
+        right = ConvertExpr(c, right, &c->fixedType);
+        type = &c->integerType;
+        break;
+    case OP_MUL:
+        left = ConvertExpr(c, left, &c->fixedType);
+        right = ConvertExpr(c, right, &c->fixedType);
+        type = &c->fixedType;
+        op = OP_FIXMUL;
+        break;
+    case OP_DIV:
+        left = ConvertExpr(c, left, &c->fixedType);
+        right = ConvertExpr(c, right, &c->fixedType);
+        type = &c->fixedType;
+        op = OP_FIXDIV;
+        break;
+    default:
+        left = ConvertExpr(c, left, &c->fixedType);
+        right = ConvertExpr(c, right, &c->fixedType);
+        type = &c->fixedType;
+        break;
+    }
+    
+    /* fold constant operands */
+    if (IsIntegerLit(left) && IsIntegerLit(right) && FoldFixedOp(op, left->u.integerLit.value, right->u.integerLit.value, &value)) {
+        node = left;
+        node->u.integerLit.value = value;
+    }
+    else {
         node = NewParseTreeNode(c, NodeTypeBinaryOp);
-        node->type = &c->integerType;
         node->u.binaryOp.op = op;
         node->u.binaryOp.left = left;
         node->u.binaryOp.right = right;
     }
-    else {
-        ParseError(c, "Expecting a numeric expression");
+    node->type = type;
+    return node;
+}
+
+/* FoldFixedOp - evaluate a fixed point operator with constant operands the way the VM would */
+static int FoldFixedOp(int op, VMVALUE left, VMVALUE right, VMVALUE *pValue)
+{
+    switch (op) {
+    case OP_FIXMUL:
+        *pValue = (VMVALUE)(((int64_t)left * right) >> FIXED_SHIFT);
+        break;
+    case OP_FIXDIV:
+        *pValue = (right == 0 ? 0 : (VMVALUE)(((int64_t)left * FIXED_ONE) / right));
+        break;
+    default:
+        return FoldBinaryOp(op, left, right, pValue);
+    }
+    return TRUE;
+}
+
+/* MakeFloatUnaryOpNode - allocate a unary operation node with a float operand */
+static ParseTreeNode *MakeFloatUnaryOpNode(ParseContext *c, int op, ParseTreeNode *expr)
+{
+    ParseTreeNode *node;
+    
+    switch (op) {
+    case OP_NEG:
+    
+        /* negate by flipping the sign bit */
+        if (IsIntegerLit(expr)) {
+            node = expr;
+            node->u.integerLit.value ^= (VMVALUE)0x80000000;
+        }
+        else {
+            node = NewParseTreeNode(c, NodeTypeBinaryOp);
+            node->type = &c->floatType;
+            node->u.binaryOp.op = OP_BXOR;
+            node->u.binaryOp.left = expr;
+            node->u.binaryOp.right = NewParseTreeNode(c, NodeTypeIntegerLit);
+            node->u.binaryOp.right->type = &c->integerType;
+            node->u.binaryOp.right->u.integerLit.value = (VMVALUE)0x80000000;
+        }
+        break;
+    case OP_NOT:
+        node = MakeFloatCompareNode(c, OP_EQ, expr, MakeFloatLit(c, 0.0f));
+        break;
+    default:
+        ParseError(c, "Expecting an integer expression");
         node = NULL; /* not reached */
+        break;
     }
     return node;
 }
 
+/* MakeFloatBinaryOpNode - allocate a binary operation node with a float operand
+   (the other operand is converted to a float) */
+static ParseTreeNode *MakeFloatBinaryOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right)
+{
+    if (!IsNumericType(left->type) || !IsNumericType(right->type))
+        ParseError(c, "Expecting a numeric expression");
+    
+    left = ConvertExpr(c, left, &c->floatType);
+    right = ConvertExpr(c, right, &c->floatType);
+    
+    switch (op) {
+    case OP_ADD:
+        op = OP_FADD;
+        break;
+    case OP_SUB:
+        op = OP_FSUB;
+        break;
+    case OP_MUL:
+        op = OP_FMUL;
+        break;
+    case OP_DIV:
+        op = OP_FDIV;
+        break;
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_LE:
+    case OP_GE:
+    case OP_GT:
+        return MakeFloatCompareNode(c, op, left, right);
+    default:
+        ParseError(c, "Expecting an integer expression");
+        break;
+    }
+    
+    return MakeFloatOpNode(c, op, left, right);
+}
+
+/* MakeFloatCompareNode - compare two floats (OP_FCMP gives -1, 0 or 1 to compare with zero) */
+static ParseTreeNode *MakeFloatCompareNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right)
+{
+    ParseTreeNode *zero = NewParseTreeNode(c, NodeTypeIntegerLit);
+    zero->type = &c->integerType;
+    zero->u.integerLit.value = 0;
+    return MakeBinaryOpNode(c, op, MakeFloatOpNode(c, OP_FCMP, left, right), zero);
+}
+
+/* MakeFloatOpNode - allocate a float operator node folding constant operands */
+static ParseTreeNode *MakeFloatOpNode(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right)
+{
+    ParseTreeNode *node;
+    VMVALUE value;
+    
+    if (IsIntegerLit(left) && IsIntegerLit(right)) {
+        FoldFloatOp(op, left->u.integerLit.value, right->u.integerLit.value, &value);
+        node = left;
+        node->u.integerLit.value = value;
+    }
+    else {
+        node = NewParseTreeNode(c, NodeTypeBinaryOp);
+        node->u.binaryOp.op = op;
+        node->u.binaryOp.left = left;
+        node->u.binaryOp.right = right;
+    }
+    node->type = (op == OP_FCMP ? &c->integerType : &c->floatType);
+    return node;
+}
+
+/* MakeFloatLit - make a float constant */
+static ParseTreeNode *MakeFloatLit(ParseContext *c, float value)
+{
+    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeIntegerLit);
+    node->type = &c->floatType;
+    node->u.integerLit.value = FloatToValue(value);
+    return node;
+}
+
+/* FoldFloatOp - evaluate a float operator with constant operands the way the VM would */
+static void FoldFloatOp(int op, VMVALUE left, VMVALUE right, VMVALUE *pValue)
+{
+    switch (op) {
+    case OP_FADD:
+        *pValue = FloatToValue(ValueToFloat(left) + ValueToFloat(right));
+        break;
+    case OP_FSUB:
+        *pValue = FloatToValue(ValueToFloat(left) - ValueToFloat(right));
+        break;
+    case OP_FMUL:
+        *pValue = FloatToValue(ValueToFloat(left) * ValueToFloat(right));
+        break;
+    case OP_FDIV:
+        *pValue = FloatToValue(ValueToFloat(left) / ValueToFloat(right));
+        break;
+    case OP_FCMP:
+        left = (left < 0 ? -(left & 0x7fffffff) : left);
+        right = (right < 0 ? -(right & 0x7fffffff) : right);
+        *pValue = (left < right ? -1 : left > right ? 1 : 0);
+        break;
+    }
+}
+
+/* FloatToInteger - convert a float to an integer truncating toward zero the way TRAP_FTOI does */
+static VMVALUE FloatToInteger(VMVALUE value)
+{
+    float f = ValueToFloat(value);
+    if (f != f || f >= 2147483648.0f || f <= -2147483648.0f)
+        return value < 0 ? -0x7fffffff : 0x7fffffff;
+    return (VMVALUE)f;
+}
+
+/* ConvertFloatExpr - convert a numeric expression to or from the float type */
+static ParseTreeNode *ConvertFloatExpr(ParseContext *c, ParseTreeNode *expr, Type *type)
+{
+    ParseTreeNode *node;
+    
+    /* no conversion needed */
+    if (type->id == expr->type->id || !IsNumericType(type) || !IsNumericType(expr->type))
+        return expr;
+    
+    /* integer or fixed point to float */
+    if (type->id == TYPE_FLOAT) {
+        if (IsIntegerLit(expr)) {
+            float value = (float)expr->u.integerLit.value;
+            if (expr->type->id == TYPE_FIXED)
+                value /= FIXED_ONE;
+            node = expr;
+            node->type = &c->floatType;
+            node->u.integerLit.value = FloatToValue(value);
+        }
+        else {
+            node = NewParseTreeNode(c, NodeTypeUnaryOp);
+            node->type = &c->floatType;
+            node->u.unaryOp.op = OP_ITOF;
+            node->u.unaryOp.expr = expr;
+            if (expr->type->id == TYPE_FIXED)
+                node = MakeFloatOpNode(c, OP_FMUL, node, MakeFloatLit(c, 1.0f / FIXED_ONE));
+        }
+    }
+    
+    /* float to integer or fixed point (truncating toward zero) */
+    else {
+        if (type->id == TYPE_FIXED)
+            expr = MakeFloatOpNode(c, OP_FMUL, expr, MakeFloatLit(c, (float)FIXED_ONE));
+        if (IsIntegerLit(expr)) {
+            node = expr;
+            node->u.integerLit.value = FloatToInteger(expr->u.integerLit.value);
+        }
+        else {
+            node = NewParseTreeNode(c, NodeTypeUnaryOp);
+            node->u.unaryOp.op = OP_FTOI;
+            node->u.unaryOp.expr = expr;
+        }
+        node->type = (type->id == TYPE_FIXED ? &c->fixedType : &c->integerType);
+    }
+    
+    return node;
+}
+
+/* ConvertExpr - convert a numeric expression between the integer, fixed point and float types */
+ParseTreeNode *ConvertExpr(ParseContext *c, ParseTreeNode *expr, Type *type)
+{
+    ParseTreeNode *node;
+    int op;
+    
+    /* conversions to and from float */
+    if (type->id == TYPE_FLOAT || expr->type->id == TYPE_FLOAT)
+        return ConvertFloatExpr(c, expr, type);
+    
+    /* integer to fixed point */
+    if (type->id == TYPE_FIXED && IsIntegerType(expr->type))
+        op = OP_SHL;
+        
+    /* fixed point to integer (rounding toward minus infinity) */
+    else if (IsIntegerType(type) && expr->type->id == TYPE_FIXED)
+        op = OP_SHR;
+        
+    /* no conversion needed */
+    else
+        return expr;
+    
+    /* convert a constant at compile time */
+    if (IsIntegerLit(expr)) {
+        node = expr;
+        FoldBinaryOp(op, expr->u.integerLit.value, FIXED_SHIFT, &node->u.integerLit.value);
+    }
+    
+    /* shift a value at runtime */
+    else {
+        node = NewParseTreeNode(c, NodeTypeBinaryOp);
+        node->u.binaryOp.op = op;
+        node->u.binaryOp.left = expr;
+        node->u.binaryOp.right = NewParseTreeNode(c, NodeTypeIntegerLit);
+        node->u.binaryOp.right->type = &c->integerType;
+        node->u.binaryOp.right->u.integerLit.value = FIXED_SHIFT;
+    }
+    node->type = (type->id == TYPE_FIXED ? &c->fixedType : &c->integerType);
+    return node;
+}
+
+/* FoldBinaryOp - evaluate a binary operator with constant operands the way the VM would
+   (returns FALSE if the result must be left to the VM) */
+static int FoldBinaryOp(int op, VMVALUE left, VMVALUE right, VMVALUE *pValue)
+{
+    switch (op) {
+    case OP_BXOR:
+        *pValue = left ^ right;
+        break;
+    case OP_BOR:
+        *pValue = left | right;
+        break;
+    case OP_BAND:
+        *pValue = left & right;
+        break;
+    case OP_EQ:
+        *pValue = left == right;
+        break;
+    case OP_NE:
+        *pValue = left != right;
+        break;
+    case OP_LT:
+        *pValue = left < right;
+        break;
+    case OP_LE:
+        *pValue = left <= right;
+        break;
+    case OP_GE:
+        *pValue = left >= right;
+        break;
+    case OP_GT:
+        *pValue = left > right;
+        break;
+    case OP_SHL:
+        if (right < 0 || right >= VMVALUE_BITS)
+            return FALSE;
+        *pValue = (VMVALUE)((VMUVALUE)left << right);
+        break;
+    case OP_SHR:
+        if (right < 0 || right >= VMVALUE_BITS)
+            return FALSE;
+        *pValue = left >> right;
+        break;
+    case OP_ADD:
+        *pValue = (VMVALUE)((VMUVALUE)left + (VMUVALUE)right);
+        break;
+    case OP_SUB:
+        *pValue = (VMVALUE)((VMUVALUE)left - (VMUVALUE)right);
+        break;
+    case OP_MUL:
+        *pValue = (VMVALUE)((VMUVALUE)left * (VMUVALUE)right);
+        break;
+    case OP_DIV:
+        /* the VM returns zero for a division by zero */
+        if (right == 0)
+            *pValue = 0;
+        else if (right == -1)
+            *pValue = (VMVALUE)-(VMUVALUE)left;
+        else
+            *pValue = left / right;
+        break;
+    case OP_REM:
+        *pValue = (right == 0 || right == -1 ? 0 : left % right);
+        break;
+    default:
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* IsCommutativeOp - check to see if the operands of a binary operator can be swapped */
+static int IsCommutativeOp(int op)
+{
+    switch (op) {
+    case OP_ADD:
+    case OP_MUL:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_EQ:
+    case OP_NE:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* SimplifyBinaryOp - apply algebraic identities to a binary operation with a constant right operand
+   (returns NULL if no identity applies) */
+static ParseTreeNode *SimplifyBinaryOp(ParseContext *c, int op, ParseTreeNode *left, ParseTreeNode *right)
+{
+    ParseTreeNode *expr;
+    VMVALUE k, value;
+    int shift;
+    
+    /* the other operand must be a non-constant integer expression */
+    if (!IsIntegerLit(right) || left->type->id != TYPE_INTEGER)
+        return NULL;
+    k = right->u.integerLit.value;
+    
+    switch (op) {
+    case OP_ADD:
+    case OP_SUB:
+        if (k == 0)
+            return left;
+        
+        /* combine '(x + k1) + k2' and friends into a single addition */
+        if (left->nodeType == NodeTypeBinaryOp
+        &&  (left->u.binaryOp.op == OP_ADD || left->u.binaryOp.op == OP_SUB)
+        &&  IsIntegerLit(left->u.binaryOp.right)) {
+            FoldBinaryOp(op == left->u.binaryOp.op ? OP_ADD : OP_SUB, left->u.binaryOp.right->u.integerLit.value, k, &value);
+            left->u.binaryOp.right->u.integerLit.value = value;
+            return value == 0 ? left->u.binaryOp.left : left;
+        }
+        break;
+    case OP_MUL:
+        if (k == 1)
+            return left;
+        
+        /* replace a multiplication by a power of two with a shift */
+        if (k > 0 && (k & (k - 1)) == 0) {
+            for (shift = 0; (k >>= 1) != 0; ++shift)
+                ;
+            right->u.integerLit.value = shift;
+            expr = NewParseTreeNode(c, NodeTypeBinaryOp);
+            expr->type = &c->integerType;
+            expr->u.binaryOp.op = OP_SHL;
+            expr->u.binaryOp.left = left;
+            expr->u.binaryOp.right = right;
+            return expr;
+        }
+        break;
+    case OP_DIV:
+        if (k == 1)
+            return left;
+        break;
+    case OP_BAND:
+        if (k == -1)
+            return left;
+        break;
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+        if (k == 0)
+            return left;
+        break;
+    }
+    
+    /* no identity applies */
+    return NULL;
+}
+
 /* NewParseTreeNode - allocate a new parse tree node */
 ParseTreeNode *NewParseTreeNode(ParseContext *c, int type)
 {
     ParseTreeNode *node = (ParseTreeNode *)xbLocalAlloc(c->sys, sizeof(ParseTreeNode));
     memset(node, 0, sizeof(ParseTreeNode));
     node->nodeType = type;
+    node->line = c->cachedLine;
     return node;
 }
 
@@ -733,7 +1218,15 @@ void PrintNode(ParseTreeNode *node, int indent)
         printf("Return\n");
         break;
     case NodeTypeAsmStatement:
-        printf("Asm\n");
+        if (node->u.asmStatement.fcache) {
+            printf("Asm: %s\n", node->u.asmStatement.fcache->name);
+            if (node->u.asmStatement.arg) {
+                printf("%*sarg\n", indent + 2, "");
+                PrintNode(node->u.asmStatement.arg, indent + 4);
+            }
+        }
+        else
+            printf("Asm\n");
         break;
     case NodeTypeGlobalRef:
         printf("GlobalRef: %s\n", node->u.globalRef.symbol->name);
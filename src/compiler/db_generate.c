@@ -7,6 +7,13 @@
 #include <string.h>
 #include "db_compiler.h"
 
+/* check whether a value fits in a signed byte operand */
+#define IsShortLit(n)   ((n) >= -128 && (n) <= 127)
+
+/* limits for compiling a SELECT statement to a jump table */
+#define SWITCH_MIN_CASES    4       /* fewer cases are faster as compares */
+#define SWITCH_MAX_ENTRIES  255     /* the SWITCH count operand is a byte */
+
 /* local function prototypes */
 static void code_lvalue(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 static Type *code_rvalue(ParseContext *c, ParseTreeNode *expr);
@@ -14,26 +21,57 @@ static void code_function_definition(ParseContext *c, ParseTreeNode *node);
 static void code_if_statement(ParseContext *c, ParseTreeNode *node);
 static void code_select_statement(ParseContext *c, ParseTreeNode *node);
 static void code_case_statement(ParseContext *c, ParseTreeNode *node);
+static int code_switch_statement(ParseContext *c, ParseTreeNode *node);
 static void code_for_statement(ParseContext *c, ParseTreeNode *node);
+static int code_counted_loop(ParseContext *c, ParseTreeNode *node);
+static int IsLoopLimit(ParseTreeNode *expr, ParseTreeNode *var);
 static void code_do_while_statement(ParseContext *c, ParseTreeNode *node);
 static void code_do_until_statement(ParseContext *c, ParseTreeNode *node);
 static void code_loop_statement(ParseContext *c, ParseTreeNode *node);
 static void code_loop_while_statement(ParseContext *c, ParseTreeNode *node);
 static void code_loop_until_statement(ParseContext *c, ParseTreeNode *node);
 static void code_return_statement(ParseContext *c, ParseTreeNode *node);
+static int code_tail_call(ParseContext *c, ParseTreeNode *expr);
+static void code_return(ParseContext *c, int op);
 static void code_label_definition(ParseContext *c, ParseTreeNode *node);
 static void code_goto_statement(ParseContext *c, ParseTreeNode *node);
 static void code_asm_statement(ParseContext *c, ParseTreeNode *node);
 static void code_statement_list(ParseContext *c, NodeListEntry *entry);
 static void code_shortcircuit(ParseContext *c, int op, ParseTreeNode *expr);
+static VMUVALUE code_branch(ParseContext *c, ParseTreeNode *test, int op, VMUVALUE chain);
+static VMUVALUE code_compare_branch(ParseContext *c, int rel, int op);
+static int SwapBranch(int op);
+static int ZeroBranch(int op);
+static int IsZeroLit(ParseTreeNode *expr);
+static void code_operator(ParseContext *c, int op);
 static void code_addressof(ParseContext *c, ParseTreeNode *expr);
 static void code_call(ParseContext *c, ParseTreeNode *expr);
+static void code_inline_call(ParseContext *c, ParseTreeNode *expr);
+static int code_increment(ParseContext *c, ParseTreeNode *lvalue, ParseTreeNode *rvalue);
 static void code_globalref(ParseContext *c, Symbol *sym);
+static void code_globaladdr(ParseContext *c, Symbol *sym);
+static int code_globalshort(ParseContext *c, Symbol *sym, int byteOp, int hwordOp);
 static void code_arrayref(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
+static VMUVALUE IndexBound(ParseContext *c, ParseTreeNode *expr);
+static void code_offset(ParseContext *c, ParseTreeNode *index, VMUVALUE size, VMUVALUE bound);
+static void code_lit(ParseContext *c, VMVALUE value);
 static void code_index(ParseContext *c, PValOp fcn, PVAL *pv);
+static void code_index_fused(ParseContext *c, PValOp fcn, PVAL *pv);
+static void code_index_checked(ParseContext *c, PValOp fcn, PVAL *pv);
+static int PushLoopRange(ParseContext *c, ParseTreeNode *node);
+static void ScanLoopVariable(ParseContext *c, ParseTreeNode *node, void *cookie);
 static void PushGenBlock(ParseContext *c, GenBlockType type);
 static void PopGenBlock(ParseContext *c);
 
+/* loop variable scan state */
+typedef struct {
+    int offset;                 /* frame offset of the loop variable */
+    int changed;                /* the loop body can change the variable */
+} LoopVarScan;
+
+/* check whether conditions can use the compare and branch opcodes */
+#define CompareBranches(c)  (((c)->flags & COMPILER_OPTIMIZE) && (c)->config->compareBranches)
+
 /* Generate - generate code for a function */
 void Generate(ParseContext *c, ParseTreeNode *node)
 {
@@ -72,13 +110,15 @@ static Type *code_rvalue(ParseContext *c, ParseTreeNode *expr)
 /* code_expr - generate code for an expression parse tree */
 void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 {
-    VMVALUE ival;
     pv->type = expr->type;
     switch (expr->nodeType) {
     case NodeTypeFunctionDefinition:
         code_function_definition(c, expr);
         break;
     case NodeTypeLetStatement:
+        if ((c->flags & COMPILER_OPTIMIZE)
+        &&  code_increment(c, expr->u.letStatement.lvalue, expr->u.letStatement.rvalue))
+            break;
         code_rvalue(c, expr->u.letStatement.rvalue);
         code_lvalue(c, expr->u.letStatement.lvalue, pv);
         (pv->fcn)(c, PV_STORE, pv);
@@ -147,31 +187,23 @@ void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
         break;
     case NodeTypeStringLit:
         putcbyte(c, OP_LIT);
-        putcword(c, AddStringRef(c, expr->u.stringLit.string));
+        putcword(c, AddLocalStringFixup(c, expr->u.stringLit.string, codeaddr(c)));
         pv->type = &c->bytePointerType;
         pv->fcn = GEN_NULL;
         break;
     case NodeTypeIntegerLit:
-        ival = expr->u.integerLit.value;
-        if (ival >= -128 && ival <= 127) {
-            putcbyte(c, OP_SLIT);
-            putcbyte(c, ival);
-        }
-        else {
-            putcbyte(c, OP_LIT);
-            putcword(c, ival);
-        }
+        code_lit(c, expr->u.integerLit.value);
         pv->fcn = GEN_NULL;
         break;
     case NodeTypeUnaryOp:
         code_rvalue(c, expr->u.unaryOp.expr);
-        putcbyte(c, expr->u.unaryOp.op);
+        code_operator(c, expr->u.unaryOp.op);
         pv->fcn = GEN_NULL;
         break;
     case NodeTypeBinaryOp:
         code_rvalue(c, expr->u.binaryOp.left);
         code_rvalue(c, expr->u.binaryOp.right);
-        putcbyte(c, expr->u.binaryOp.op);
+        code_operator(c, expr->u.binaryOp.op);
         pv->fcn = GEN_NULL;
         break;
     case NodeTypeFunctionCall:
@@ -199,13 +231,39 @@ void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 /* code_function_definition - generate code for a function definition */
 static void code_function_definition(ParseContext *c, ParseTreeNode *node)
 {
-    if (node->type) {
+    int size;
+
+    /* the frame also holds the arguments and locals of the inline expansions */
+    c->inlining = FALSE;
+    c->inlineBase = 0;
+    c->inlineExit = 0;
+    size = F_SIZE + node->u.functionDefinition.localOffset + InlineFrameSize(c, node->u.functionDefinition.bodyStatements);
+    if (size > 128)
+        ParseError(c, "inline expansion needs too many local variables");
+
+    /* a native function is a stub that runs its LMM code (db_native.c adds the code after it) */
+    if (c->native) {
         putcbyte(c, OP_FRAME);
-        putcbyte(c, F_SIZE + node->u.functionDefinition.localOffset);
+        putcbyte(c, F_SIZE);
+        putcbyte(c, 0); // stack depth filled in by AnalyzeStack
+        putcbyte(c, OP_SLIT);
+        putcbyte(c, 0);
+        putcbyte(c, OP_NATIVE);
+        putcword(c, LMM_ENTER_INSN);
+        c->bodyOffset = codeaddr(c);
+        code_return(c, OP_RETURN);
+        return;
+    }
+
+    if (node->type || size > F_SIZE) {
+        putcbyte(c, OP_FRAME);
+        putcbyte(c, size);
+        putcbyte(c, 0); // stack depth filled in by AnalyzeStack
     }
+    c->bodyOffset = codeaddr(c);
     code_statement_list(c, node->u.functionDefinition.bodyStatements);
     if (node->type)
-        putcbyte(c, OP_RETURNZ);
+        code_return(c, OP_RETURNZ);
     else
         putcbyte(c, OP_HALT);
 }
@@ -214,9 +272,7 @@ static void code_function_definition(ParseContext *c, ParseTreeNode *node)
 static void code_if_statement(ParseContext *c, ParseTreeNode *node)
 {
     VMUVALUE nxt, end;
-    code_rvalue(c, node->u.ifStatement.test);
-    putcbyte(c, OP_BRF);
-    nxt = putcword(c, 0);
+    nxt = code_branch(c, node->u.ifStatement.test, OP_BRF, 0);
     code_statement_list(c, node->u.ifStatement.thenStatements);
     putcbyte(c, OP_BR);
     end = putcword(c, 0);
@@ -228,6 +284,10 @@ static void code_if_statement(ParseContext *c, ParseTreeNode *node)
 /* code_select_statement - generate code for a SELECT statement */
 static void code_select_statement(ParseContext *c, ParseTreeNode *node)
 {
+    /* use a jump table if the cases are dense enough */
+    if (code_switch_statement(c, node))
+        return;
+        
     /* generate code for the select expression */
     code_rvalue(c, node->u.selectStatement.expr);
     
@@ -268,6 +328,7 @@ static void code_case_statement(ParseContext *c, ParseTreeNode *node)
     if (entry) {
         VMUVALUE alt = 0;
         VMUVALUE body = 0;
+        int rel;
                 
         while (entry != NULL) {
         
@@ -285,32 +346,31 @@ static void code_case_statement(ParseContext *c, ParseTreeNode *node)
             if (entry->toExpr) {
 
                 /* check the lower bound */
-                putcbyte(c, OP_GE);
-                putcbyte(c, OP_BRF);
+                code_compare_branch(c, OP_GE, OP_BRF);
                 alt = putcword(c, alt);
 
                 /* check the upper bound */
                 putcbyte(c, OP_DUP);
                 code_rvalue(c, entry->toExpr);
-                putcbyte(c, OP_LE);
+                rel = OP_LE;
             }
             
             /* handle 'expr' */
             else
-                putcbyte(c, OP_EQ);
+                rel = OP_EQ;
             
             /* move on to the next entry */
             entry = entry->next;
 
             /* more expressions or ranges follow */
             if (entry) {
-                putcbyte(c, OP_BRT);
+                code_compare_branch(c, rel, OP_BRT);
                 body = putcword(c, body);
             }
 
             /* last expression or range */
             else {
-                putcbyte(c, OP_BRF);
+                code_compare_branch(c, rel, OP_BRF);
                 c->gptr->u.selectBlock.nxt = putcword(c, c->gptr->u.selectBlock.nxt);
             }
         }
@@ -337,60 +397,305 @@ static void code_case_statement(ParseContext *c, ParseTreeNode *node)
     }
 }
 
+/* code_switch_statement - generate code for a SELECT statement whose cases are dense constants
+   (returns FALSE without generating any code if a jump table can't be used) */
+static int code_switch_statement(ParseContext *c, ParseTreeNode *node)
+{
+    ParseTreeNode *elseNode = node->u.selectStatement.elseStatements;
+    VMVALUE min = 0, max = 0, value;
+    NodeListEntry *statement;
+    CaseListEntry *entry;
+    VMUVALUE *table, end = 0, body;
+    int count = 0, span, j;
+    
+    /* all of the cases must be single constant values */
+    for (statement = node->u.selectStatement.caseStatements; statement != NULL; statement = statement->next) {
+        for (entry = statement->node->u.caseStatement.cases; entry != NULL; entry = entry->next) {
+            if (entry->toExpr || !IsIntegerLit(entry->fromExpr))
+                return FALSE;
+            value = entry->fromExpr->u.integerLit.value;
+            if (count == 0 || value < min)
+                min = value;
+            if (count == 0 || value > max)
+                max = value;
+            ++count;
+        }
+    }
+    
+    /* the table must be at least half full */
+    if (count < SWITCH_MIN_CASES || (VMUVALUE)(max - min) >= SWITCH_MAX_ENTRIES)
+        return FALSE;
+    span = (int)(max - min) + 1;
+    if (span > count * 2)
+        return FALSE;
+    
+    /* generate code for the index into the table */
+    code_rvalue(c, node->u.selectStatement.expr);
+    if (min != 0) {
+        putcbyte(c, OP_LIT);
+        putcword(c, min);
+        putcbyte(c, OP_SUB);
+    }
+    
+    /* generate the table with one branch for each value and a final one for everything else */
+    putcbyte(c, OP_SWITCH);
+    putcbyte(c, span);
+    table = (VMUVALUE *)LocalAlloc(c, (span + 1) * sizeof(VMUVALUE));
+    for (j = 0; j <= span; ++j) {
+        putcbyte(c, OP_BR);
+        table[j] = putcword(c, 0);
+    }
+    
+    /* generate code for each of the cases (the first case with a value wins) */
+    for (statement = node->u.selectStatement.caseStatements; statement != NULL; statement = statement->next) {
+        body = codeaddr(c);
+        for (entry = statement->node->u.caseStatement.cases; entry != NULL; entry = entry->next) {
+            j = (int)(entry->fromExpr->u.integerLit.value - min);
+            if (table[j]) {
+                fixupbranch(c, table[j], body);
+                table[j] = 0;
+            }
+        }
+        code_statement_list(c, statement->node->u.caseStatement.bodyStatements);
+        putcbyte(c, OP_BR);
+        end = putcword(c, end);
+    }
+    
+    /* the values without a case go to the CASE ELSE clause or the end of the statement */
+    body = codeaddr(c);
+    for (j = 0; j <= span; ++j)
+        fixupbranch(c, table[j], body);
+    if (elseNode)
+        code_statement_list(c, elseNode->u.caseStatement.bodyStatements);
+    fixupbranch(c, end, codeaddr(c));
+    
+    /* return successfully */
+    return TRUE;
+}
+
 /* code_for_statement - generate code for a FOR statement */
 static void code_for_statement(ParseContext *c, ParseTreeNode *node)
 {
+    ParseTreeNode *stepExpr = node->u.forStatement.stepExpr;
     VMUVALUE nxt, upd, inst;
+    int ranged;
     PVAL pv;
+    
+    /* the body indexes arrays with the loop variable without checks if it stays inside their bounds */
+    ranged = PushLoopRange(c, node);
+    
+    /* use a counted loop instruction if possible */
+    if (code_counted_loop(c, node)) {
+        if (ranged)
+            PopGenBlock(c);
+        return;
+    }
+    
     code_rvalue(c, node->u.forStatement.startExpr);
     code_lvalue(c, node->u.forStatement.var, &pv);
-    putcbyte(c, OP_BR);
-    upd = putcword(c, 0);
-    nxt = codeaddr(c);
-    code_statement_list(c, node->u.forStatement.bodyStatements);
-    (*pv.fcn)(c, PV_LOAD, &pv);
-    if (node->u.forStatement.stepExpr)
-        code_rvalue(c, node->u.forStatement.stepExpr);
+    
+    /* use LINC to update a local loop variable by a short constant step */
+    if ((c->flags & COMPILER_OPTIMIZE)
+    &&  pv.fcn == code_local
+    &&  (!stepExpr || (IsIntegerLit(stepExpr) && IsShortLit(stepExpr->u.integerLit.value)))) {
+        (*pv.fcn)(c, PV_STORE, &pv);
+        putcbyte(c, OP_BR);
+        upd = putcword(c, 0);
+        nxt = codeaddr(c);
+        code_statement_list(c, node->u.forStatement.bodyStatements);
+        putcbyte(c, OP_LINC);
+        putcbyte(c, pv.u.val);
+        putcbyte(c, stepExpr ? stepExpr->u.integerLit.value : 1);
+        fixupbranch(c, upd, codeaddr(c));
+        (*pv.fcn)(c, PV_LOAD, &pv);
+    }
+    
+    /* handle the general case */
     else {
-        putcbyte(c, OP_SLIT);
-        putcbyte(c, 1);
+        putcbyte(c, OP_BR);
+        upd = putcword(c, 0);
+        nxt = codeaddr(c);
+        code_statement_list(c, node->u.forStatement.bodyStatements);
+        (*pv.fcn)(c, PV_LOAD, &pv);
+        if (stepExpr)
+            code_rvalue(c, stepExpr);
+        else {
+            putcbyte(c, OP_SLIT);
+            putcbyte(c, 1);
+        }
+        putcbyte(c, OP_ADD);
+        fixupbranch(c, upd, codeaddr(c));
+        putcbyte(c, OP_DUP);
+        (*pv.fcn)(c, PV_STORE, &pv);
     }
-    putcbyte(c, OP_ADD);
-    fixupbranch(c, upd, codeaddr(c));
-    putcbyte(c, OP_DUP);
-    (*pv.fcn)(c, PV_STORE, &pv);
+    
     code_rvalue(c, node->u.forStatement.endExpr);
-    putcbyte(c, OP_LE);
-    inst = putcbyte(c, OP_BRT);
+    inst = code_compare_branch(c, OP_LE, OP_BRT);
     putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
+    if (ranged)
+        PopGenBlock(c);
+}
+
+/* PushLoopRange - push a block with the values a FOR variable has in the body when they are known
+   (returns TRUE if the block was pushed, the body only runs while the variable is at most the limit) */
+static int PushLoopRange(ParseContext *c, ParseTreeNode *node)
+{
+    ParseTreeNode *var = node->u.forStatement.var;
+    ParseTreeNode *startExpr = node->u.forStatement.startExpr;
+    ParseTreeNode *endExpr = node->u.forStatement.endExpr;
+    ParseTreeNode *stepExpr = node->u.forStatement.stepExpr;
+    NodeListEntry *entry;
+    LoopVarScan scan;
+    
+    /* the variable must be a local stepped up from a constant to a constant */
+    if (!(c->flags & COMPILER_CHECK)
+    ||  var->nodeType != NodeTypeLocalRef
+    ||  var->type->id != TYPE_INTEGER
+    ||  !IsIntegerLit(startExpr)
+    ||  !IsIntegerLit(endExpr)
+    ||  (stepExpr && (!IsIntegerLit(stepExpr) || stepExpr->u.integerLit.value <= 0))
+    ||  c->gptr + 1 >= c->gtop)
+        return FALSE;
+    
+    /* and only the loop can change it */
+    scan.offset = var->u.localRef.offset;
+    scan.changed = FALSE;
+    for (entry = node->u.forStatement.bodyStatements; entry != NULL; entry = entry->next)
+        ScanLoopVariable(c, entry->node, &scan);
+    if (scan.changed)
+        return FALSE;
+    
+    PushGenBlock(c, GEN_BLOCK_FOR);
+    c->gptr->u.forBlock.offset = var->u.localRef.offset;
+    c->gptr->u.forBlock.min = startExpr->u.integerLit.value;
+    c->gptr->u.forBlock.max = endExpr->u.integerLit.value;
+    return TRUE;
+}
+
+/* ScanLoopVariable - check whether a node in a loop body can change the loop variable */
+static void ScanLoopVariable(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    LoopVarScan *scan = (LoopVarScan *)cookie;
+    ParseTreeNode *var = NULL;
+    switch (node->nodeType) {
+    case NodeTypeLetStatement:
+        var = node->u.letStatement.lvalue;
+        break;
+    case NodeTypeForStatement:
+        var = node->u.forStatement.var;
+        break;
+    case NodeTypeAddressOf:
+        var = node->u.addressOf.expr;
+        break;
+    case NodeTypeLabelDefinition:
+    case NodeTypeAsmStatement:
+        scan->changed = TRUE;
+        break;
+    default:
+        break;
+    }
+    if (var && var->nodeType == NodeTypeLocalRef && var->u.localRef.offset == scan->offset)
+        scan->changed = TRUE;
+    VisitChildren(c, node, ScanLoopVariable, cookie);
+}
+
+/* code_counted_loop - generate code for a FOR statement using FORLOOP or FORLOOPA
+   (returns FALSE without generating any code if the loop doesn't qualify) */
+static int code_counted_loop(ParseContext *c, ParseTreeNode *node)
+{
+    ParseTreeNode *var = node->u.forStatement.var;
+    ParseTreeNode *startExpr = node->u.forStatement.startExpr;
+    ParseTreeNode *endExpr = node->u.forStatement.endExpr;
+    ParseTreeNode *stepExpr = node->u.forStatement.stepExpr;
+    VMUVALUE nxt, end = 0;
+    VMVALUE step = 1;
+    PVAL pv;
+    
+    /* the loop variable must be a scalar and the step a short constant */
+    if ((var->nodeType != NodeTypeLocalRef && var->nodeType != NodeTypeGlobalRef) || var->type->id != TYPE_INTEGER)
+        return FALSE;
+    if (stepExpr) {
+        if (!IsIntegerLit(stepExpr) || !IsShortLit(stepExpr->u.integerLit.value))
+            return FALSE;
+        step = stepExpr->u.integerLit.value;
+    }
+    
+    /* the limit is evaluated before the variable is stepped so it can't depend on it */
+    if (!IsLoopLimit(endExpr, var))
+        return FALSE;
+    
+    /* store the initial value and skip the loop if it is already past the limit */
+    code_rvalue(c, startExpr);
+    code_lvalue(c, var, &pv);
+    if (IsIntegerLit(startExpr) && IsIntegerLit(endExpr) && startExpr->u.integerLit.value <= endExpr->u.integerLit.value)
+        (*pv.fcn)(c, PV_STORE, &pv);
+    else {
+        putcbyte(c, OP_DUP);
+        (*pv.fcn)(c, PV_STORE, &pv);
+        code_rvalue(c, endExpr);
+        code_compare_branch(c, OP_LE, OP_BRF);
+        end = putcword(c, 0);
+    }
+    
+    /* the loop instruction pops the limit, steps the variable and branches back to the body */
+    nxt = codeaddr(c);
+    code_statement_list(c, node->u.forStatement.bodyStatements);
+    code_rvalue(c, endExpr);
+    if (var->nodeType == NodeTypeLocalRef) {
+        putcbyte(c, OP_FORLOOP);
+        putcbyte(c, var->u.localRef.offset);
+    }
+    else {
+        putcbyte(c, OP_FORLOOPA);
+        code_globaladdr(c, var->u.globalRef.symbol);
+    }
+    putcbyte(c, step);
+    putcword(c, nxt - codeaddr(c) - sizeof(VMVALUE));
+    fixupbranch(c, end, codeaddr(c));
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* IsLoopLimit - check whether a FOR limit is a constant or a variable other than the loop variable */
+static int IsLoopLimit(ParseTreeNode *expr, ParseTreeNode *var)
+{
+    switch (expr->nodeType) {
+    case NodeTypeIntegerLit:
+        return TRUE;
+    case NodeTypeGlobalRef:
+        return expr->type->id == TYPE_INTEGER
+            && (var->nodeType != NodeTypeGlobalRef || expr->u.globalRef.symbol != var->u.globalRef.symbol);
+    case NodeTypeLocalRef:
+        return expr->type->id == TYPE_INTEGER
+            && (var->nodeType != NodeTypeLocalRef || expr->u.localRef.offset != var->u.localRef.offset);
+    default:
+        return FALSE;
+    }
 }
 
 /* code_do_while_statement - generate code for a DO WHILE statement */
 static void code_do_while_statement(ParseContext *c, ParseTreeNode *node)
 {
-    VMUVALUE nxt, test, inst;
+    VMUVALUE nxt, test;
     putcbyte(c, OP_BR);
     test = putcword(c, 0);
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
     fixupbranch(c, test, codeaddr(c));
-    code_rvalue(c, node->u.loopStatement.test);
-    inst = putcbyte(c, OP_BRT);
-    putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
+    fixupbranch(c, code_branch(c, node->u.loopStatement.test, OP_BRT, 0), nxt);
 }
 
 /* code_do_until_statement - generate code for a DO UNTIL statement */
 static void code_do_until_statement(ParseContext *c, ParseTreeNode *node)
 {
-    VMUVALUE nxt, test, inst;
+    VMUVALUE nxt, test;
     putcbyte(c, OP_BR);
     test = putcword(c, 0);
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
     fixupbranch(c, test, codeaddr(c));
-    code_rvalue(c, node->u.loopStatement.test);
-    inst = putcbyte(c, OP_BRF);
-    putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
+    fixupbranch(c, code_branch(c, node->u.loopStatement.test, OP_BRF, 0), nxt);
 }
 
 /* code_loop_statement - generate code for a LOOP statement */
@@ -406,34 +711,105 @@ static void code_loop_statement(ParseContext *c, ParseTreeNode *node)
 /* code_loop_while_statement - generate code for a LOOP WHILE statement */
 static void code_loop_while_statement(ParseContext *c, ParseTreeNode *node)
 {
-    VMUVALUE nxt, inst;
+    VMUVALUE nxt;
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
-    code_rvalue(c, node->u.loopStatement.test);
-    inst = putcbyte(c, OP_BRT);
-    putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
+    fixupbranch(c, code_branch(c, node->u.loopStatement.test, OP_BRT, 0), nxt);
 }
 
 /* code_loop_until_statement - generate code for a LOOP UNTIL statement */
 static void code_loop_until_statement(ParseContext *c, ParseTreeNode *node)
 {
-    VMUVALUE nxt, inst;
+    VMUVALUE nxt;
     nxt = codeaddr(c);
     code_statement_list(c, node->u.loopStatement.bodyStatements);
-    code_rvalue(c, node->u.loopStatement.test);
-    inst = putcbyte(c, OP_BRF);
-    putcword(c, nxt - inst - 1 - sizeof(VMVALUE));
+    fixupbranch(c, code_branch(c, node->u.loopStatement.test, OP_BRF, 0), nxt);
 }
 
 /* code_return_statement - generate code for a RETURN statement */
 static void code_return_statement(ParseContext *c, ParseTreeNode *node)
 {
-    if (node->u.returnStatement.expr) {
+    /* a RETURN in an inline expansion leaves its value and branches to the end of the expansion */
+    if (c->inlining) {
+        if (node->u.returnStatement.expr)
+            code_rvalue(c, node->u.returnStatement.expr);
+        else {
+            putcbyte(c, OP_SLIT);
+            putcbyte(c, 0);
+        }
+        putcbyte(c, OP_BR);
+        c->inlineExit = putcword(c, c->inlineExit);
+    }
+    else if (node->u.returnStatement.expr) {
+        if ((c->flags & COMPILER_OPTIMIZE) && code_tail_call(c, node->u.returnStatement.expr))
+            return;
         code_rvalue(c, node->u.returnStatement.expr);
-        putcbyte(c, OP_RETURN);
+        code_return(c, OP_RETURN);
+    }
+    else
+        code_return(c, OP_RETURNZ);
+}
+
+/* code_tail_call - code a RETURN of a call to the current function as a branch to its body
+   (returns FALSE without generating any code if the call isn't a self call) */
+static int code_tail_call(ParseContext *c, ParseTreeNode *expr)
+{
+    Symbol *sym = c->function->u.functionDefinition.symbol;
+    NodeListEntry *arg;
+    VMUVALUE inst;
+    int i;
+
+    /* the frame can only be reused by the function it belongs to */
+    if (!sym || expr->nodeType != NodeTypeFunctionCall
+    ||  expr->u.functionCall.fcn->nodeType != NodeTypeFunctionLit
+    ||  expr->u.functionCall.fcn->u.functionLit.symbol != sym)
+        return FALSE;
+
+    /* evaluate all of the arguments before replacing any of them (the first one is on top of the stack) */
+    for (arg = expr->u.functionCall.args; arg != NULL; arg = arg->next)
+        code_rvalue(c, arg->node);
+    for (i = 0; i < expr->u.functionCall.argc; ++i) {
+        putcbyte(c, OP_LSET);
+        putcbyte(c, i);
+    }
+
+    /* the branch skips the FRAME so clear the locals like it would */
+    for (i = 0; i < c->function->u.functionDefinition.localOffset; ++i) {
+        putcbyte(c, OP_SLIT);
+        putcbyte(c, 0);
+        putcbyte(c, OP_LSET);
+        putcbyte(c, -F_SIZE - i - 1);
+    }
+
+    /* branch back to the start of the body */
+    inst = putcbyte(c, OP_BR);
+    putcword(c, c->bodyOffset - inst - 1 - sizeof(VMVALUE));
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* code_return - code a RETURN or RETURNZ from the current function
+   (a function that removes its own arguments uses RET instead) */
+static void code_return(ParseContext *c, int op)
+{
+    Type *type = c->function->type;
+    if (type && PopsArguments(type)) {
+        if (op == OP_RETURNZ) {
+            putcbyte(c, OP_SLIT);
+            putcbyte(c, 0);
+        }
+        putcbyte(c, OP_RET);
+        putcbyte(c, type->u.functionInfo.arguments.count);
     }
     else
-        putcbyte(c, OP_RETURNZ);
+        putcbyte(c, op);
+}
+
+/* PopsArguments - check whether a function removes its own arguments when it returns */
+int PopsArguments(Type *type)
+{
+    return type->u.functionInfo.arguments.count > 0 && !type->u.functionInfo.callerCleans;
 }
 
 /* code_label_definition - generate code for a label definition */
@@ -466,18 +842,41 @@ static void code_goto_statement(ParseContext *c, ParseTreeNode *node)
 static void code_asm_statement(ParseContext *c, ParseTreeNode *node)
 {
     int length = node->u.asmStatement.length;
-    if (c->cptr + length >= c->ctop)
+    
+    /* an FCACHE block is run by the LMM code at its start (LMM_CALL takes its address from tos
+       and the block starts with the value under it in tos) */
+    if (node->u.asmStatement.fcache) {
+        if (node->u.asmStatement.arg)
+            code_rvalue(c, node->u.asmStatement.arg);
+        code_globalref(c, node->u.asmStatement.fcache);
+        putcbyte(c, OP_NATIVE);
+        putcword(c, LMM_CALL_INSN);
+        putcbyte(c, OP_DROP);
+        if (node->u.asmStatement.arg)
+            putcbyte(c, OP_DROP);
+        return;
+    }
+    
+    if (!GrowCode(c, length))
         Fatal(c, "Bytecode buffer overflow");
     memcpy(c->cptr, node->u.asmStatement.code, length);
     c->cptr += length;
 }
 
-/* code_statement_list - code a list of statements */
+/* code_statement_list - code a list of statements
+   (with symbols the code of each statement is tagged with its line, the code after
+   the statements nested in it like the end of a loop is tagged with it again and
+   the code of an inline function body is tagged with the line of the call) */
 static void code_statement_list(ParseContext *c, NodeListEntry *entry)
 {
+    int lines = (c->flags & COMPILER_SYMBOLS) && !c->inlining;
     while (entry) {
         PVAL pv;
+        if (lines)
+            AddDebugLine(c, entry->node->line);
         code_expr(c, entry->node, &pv);
+        if (lines)
+            AddDebugLine(c, entry->node->line);
         entry = entry->next;
     }
 }
@@ -500,30 +899,268 @@ static void code_shortcircuit(ParseContext *c, int op, ParseTreeNode *expr)
     fixupbranch(c, end, codeaddr(c));
 }
 
+/* code_branch - generate code to branch if a condition is true (OP_BRT) or false (OP_BRF)
+   (returns the chain of branches to fix up, with -O the branches are taken straight from the
+    terms of NOT, AND and OR and comparisons can use the compare and branch opcodes) */
+static VMUVALUE code_branch(ParseContext *c, ParseTreeNode *test, int op, VMUVALUE chain)
+{
+    ParseTreeNode *left, *right;
+    NodeListEntry *entry;
+    VMUVALUE skip = 0;
+    int shortOp, br;
+
+    if (c->flags & COMPILER_OPTIMIZE) {
+        switch (test->nodeType) {
+        case NodeTypeUnaryOp:
+            if (test->u.unaryOp.op == OP_NOT)
+                return code_branch(c, test->u.unaryOp.expr, InvertBranch(op), chain);
+            break;
+
+        /* the terms before the last either take the branch or skip over the rest of the test */
+        case NodeTypeConjunction:
+        case NodeTypeDisjunction:
+            shortOp = (test->nodeType == NodeTypeConjunction ? OP_BRF : OP_BRT);
+            for (entry = test->u.exprList.exprs; entry->next != NULL; entry = entry->next) {
+                if (op == shortOp)
+                    chain = code_branch(c, entry->node, op, chain);
+                else
+                    skip = code_branch(c, entry->node, shortOp, skip);
+            }
+            chain = code_branch(c, entry->node, op, chain);
+            fixupbranch(c, skip, codeaddr(c));
+            return chain;
+
+        /* a comparison with zero only needs the other operand */
+        case NodeTypeBinaryOp:
+            if (!CompareBranches(c) || test->u.binaryOp.op < OP_LT || test->u.binaryOp.op > OP_GT)
+                break;
+            left = test->u.binaryOp.left;
+            right = test->u.binaryOp.right;
+            br = OP_BRLT + test->u.binaryOp.op - OP_LT;
+            if (op == OP_BRF)
+                br = InvertBranch(br);
+            if (IsZeroLit(left)) {
+                left = right;
+                right = NULL;
+                br = SwapBranch(br);
+            }
+            else if (IsZeroLit(right))
+                right = NULL;
+            code_rvalue(c, left);
+            if (right)
+                code_rvalue(c, right);
+            else
+                br = ZeroBranch(br);
+            putcbyte(c, br);
+            return putcword(c, chain);
+
+        default:
+            break;
+        }
+    }
+
+    code_rvalue(c, test);
+    putcbyte(c, op);
+    return putcword(c, chain);
+}
+
+/* code_compare_branch - code a comparison of the top two stack entries and a branch on its result
+   (returns the offset of the branch opcode so the caller can add its displacement) */
+static VMUVALUE code_compare_branch(ParseContext *c, int rel, int op)
+{
+    int br = OP_BRLT + rel - OP_LT;
+    if (CompareBranches(c))
+        return putcbyte(c, op == OP_BRT ? br : InvertBranch(br));
+    putcbyte(c, rel);
+    return putcbyte(c, op);
+}
+
+/* InvertBranch - get the conditional branch that is taken when another one isn't */
+int InvertBranch(int op)
+{
+    switch (op) {
+    case OP_BRT:    return OP_BRF;
+    case OP_BRF:    return OP_BRT;
+    case OP_BRLT:   return OP_BRGE;
+    case OP_BRLE:   return OP_BRGT;
+    case OP_BREQ:   return OP_BRNE;
+    case OP_BRNE:   return OP_BREQ;
+    case OP_BRGE:   return OP_BRLT;
+    case OP_BRGT:   return OP_BRLE;
+    case OP_BRLTZ:  return OP_BRGEZ;
+    case OP_BRLEZ:  return OP_BRGTZ;
+    case OP_BRGEZ:  return OP_BRLTZ;
+    case OP_BRGTZ:  return OP_BRLEZ;
+    default:        return -1;
+    }
+}
+
+/* SwapBranch - get the compare and branch that gives the same result with its operands exchanged */
+static int SwapBranch(int op)
+{
+    switch (op) {
+    case OP_BRLT:   return OP_BRGT;
+    case OP_BRLE:   return OP_BRGE;
+    case OP_BRGE:   return OP_BRLE;
+    case OP_BRGT:   return OP_BRLT;
+    default:        return op;
+    }
+}
+
+/* ZeroBranch - get the branch that compares the top of the stack with zero for a compare and branch */
+static int ZeroBranch(int op)
+{
+    switch (op) {
+    case OP_BRLT:   return OP_BRLTZ;
+    case OP_BRLE:   return OP_BRLEZ;
+    case OP_BREQ:   return OP_BRF;
+    case OP_BRNE:   return OP_BRT;
+    case OP_BRGE:   return OP_BRGEZ;
+    case OP_BRGT:   return OP_BRGTZ;
+    default:        return op;
+    }
+}
+
+/* IsZeroLit - check for an integer literal zero */
+static int IsZeroLit(ParseTreeNode *expr)
+{
+    return IsIntegerLit(expr) && expr->u.integerLit.value == 0;
+}
+
+/* code_operator - code a unary or binary operator (fixed point and float operators are traps) */
+static void code_operator(ParseContext *c, int op)
+{
+    switch (op) {
+    case OP_FIXMUL:
+        putcbyte(c, OP_TRAP);
+        putcbyte(c, TRAP_FIXMUL);
+        break;
+    case OP_FIXDIV:
+        putcbyte(c, OP_TRAP);
+        putcbyte(c, TRAP_FIXDIV);
+        break;
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+    case OP_FCMP:
+    case OP_ITOF:
+    case OP_FTOI:
+        putcbyte(c, OP_TRAP);
+        putcbyte(c, TRAP_FADD + op - OP_FADD);
+        break;
+    default:
+        putcbyte(c, op);
+        break;
+    }
+}
+
 /* code_call - code a function call */
 static void code_call(ParseContext *c, ParseTreeNode *expr)
 {
+    ParseTreeNode *fcn = expr->u.functionCall.fcn;
     NodeListEntry *arg;
     
+    /* expand a small function inline */
+    if (IsInlineCall(expr)) {
+        code_inline_call(c, expr);
+        return;
+    }
+
     /* code each argument expression */
     for (arg = expr->u.functionCall.args; arg != NULL; arg = arg->next)
         code_rvalue(c, arg->node);
 
-    /* get the value of the function */
-    code_rvalue(c, expr->u.functionCall.fcn);
-
-    /* call the function */
-    putcbyte(c, OP_PUSHJ);
+    /* call a known function directly (it may remove its own arguments) */
+    if (fcn->nodeType == NodeTypeFunctionLit) {
+        putcbyte(c, OP_CALL);
+        code_globaladdr(c, fcn->u.functionLit.symbol);
+        if (PopsArguments(fcn->type))
+            return;
+    }
+    
+    /* otherwise, get the value of the function and call it */
+    else {
+        code_rvalue(c, fcn);
+        putcbyte(c, OP_PUSHJ);
+    }
+    
+    /* clean the arguments off the stack */
     if (expr->u.functionCall.argc > 0) {
         putcbyte(c, OP_CLEAN);
         putcbyte(c, expr->u.functionCall.argc);
     }
 }
 
+/* code_inline_call - code the body of a function in place of a call to it
+   (the arguments and locals go in the caller's frame after any in use by enclosing expansions) */
+static void code_inline_call(ParseContext *c, ParseTreeNode *expr)
+{
+    Type *type = expr->u.functionCall.fcn->type;
+    int base = c->inlineBase, inlining = c->inlining, i;
+    VMUVALUE inlineExit = c->inlineExit;
+    NodeListEntry *arg, *entry;
+    ParseTreeNode *body;
+
+    /* store the arguments in their frame slots (the first argument is on top of the stack) */
+    for (arg = expr->u.functionCall.args; arg != NULL; arg = arg->next)
+        code_rvalue(c, arg->node);
+    for (i = 0; i < type->u.functionInfo.arguments.count; ++i) {
+        putcbyte(c, OP_LSET);
+        putcbyte(c, InlineSlotOffset(c, base + i));
+    }
+
+    /* the slots are reused by each expansion so clear the locals like a FRAME would */
+    for (; i < InlineSlots(type); ++i) {
+        putcbyte(c, OP_SLIT);
+        putcbyte(c, 0);
+        putcbyte(c, OP_LSET);
+        putcbyte(c, InlineSlotOffset(c, base + i));
+    }
+
+    /* code the body using the slots after the ones it was given */
+    body = InstantiateInline(c, type, base);
+    c->inlineBase = base + InlineSlots(type);
+    c->inlining = TRUE;
+    c->inlineExit = 0;
+    for (entry = body->u.functionDefinition.bodyStatements; entry != NULL; entry = entry->next) {
+        ParseTreeNode *node = entry->node;
+        PVAL pv;
+
+        /* a RETURN at the end of the body just leaves its value */
+        if (!entry->next && node->nodeType == NodeTypeReturnStatement) {
+            if (node->u.returnStatement.expr)
+                code_rvalue(c, node->u.returnStatement.expr);
+            else {
+                putcbyte(c, OP_SLIT);
+                putcbyte(c, 0);
+            }
+            break;
+        }
+        code_expr(c, node, &pv);
+
+        /* falling off the end of the body returns zero */
+        if (!entry->next) {
+            putcbyte(c, OP_SLIT);
+            putcbyte(c, 0);
+        }
+    }
+    if (!body->u.functionDefinition.bodyStatements) {
+        putcbyte(c, OP_SLIT);
+        putcbyte(c, 0);
+    }
+    fixupbranch(c, c->inlineExit, codeaddr(c));
+
+    /* restore the state of any enclosing expansion */
+    c->inlineBase = base;
+    c->inlining = inlining;
+    c->inlineExit = inlineExit;
+}
+
 /* code_addressof - get the address of a data object */
 static void code_addressof(ParseContext *c, ParseTreeNode *expr)
 {
-    if (expr->u.addressOf.expr->type->id == TYPE_POINTER)
+    if (expr->u.addressOf.expr->type->id == TYPE_POINTER || expr->u.addressOf.expr->type->id == TYPE_ARRAY)
         code_rvalue(c, expr->u.addressOf.expr);
     else {
         PVAL pv;
@@ -532,12 +1169,66 @@ static void code_addressof(ParseContext *c, ParseTreeNode *expr)
     }
 }
 
+/* code_increment - code 'var = var + k' as LINC if possible
+   (returns TRUE if code was generated) */
+static int code_increment(ParseContext *c, ParseTreeNode *lvalue, ParseTreeNode *rvalue)
+{
+    ParseTreeNode *left, *right;
+    VMVALUE k;
+    
+    /* only local variables can be incremented in place */
+    if (lvalue->nodeType != NodeTypeLocalRef || rvalue->nodeType != NodeTypeBinaryOp)
+        return FALSE;
+    left = rvalue->u.binaryOp.left;
+    right = rvalue->u.binaryOp.right;
+    
+    /* handle 'var + k', 'k + var' and 'var - k' */
+    switch (rvalue->u.binaryOp.op) {
+    case OP_ADD:
+        if (IsIntegerLit(left)) {
+            ParseTreeNode *tmp = left;
+            left = right;
+            right = tmp;
+        }
+        if (!IsIntegerLit(right))
+            return FALSE;
+        k = right->u.integerLit.value;
+        break;
+    case OP_SUB:
+        if (!IsIntegerLit(right))
+            return FALSE;
+        k = -right->u.integerLit.value;
+        break;
+    default:
+        return FALSE;
+    }
+    
+    /* make sure the other operand is the variable being assigned */
+    if (left->nodeType != NodeTypeLocalRef
+    ||  left->u.localRef.offset != lvalue->u.localRef.offset
+    ||  !IsShortLit(k))
+        return FALSE;
+    
+    putcbyte(c, OP_LINC);
+    putcbyte(c, lvalue->u.localRef.offset);
+    putcbyte(c, k);
+    return TRUE;
+}
+
 /* code_globalref - code a global reference */
 static void code_globalref(ParseContext *c, Symbol *sym)
 {
-    VMUVALUE offset = sym->v.variable.offset;
     putcbyte(c, OP_LIT);
-    if (offset == UNDEF_VALUE)
+    code_globaladdr(c, sym);
+}
+
+/* code_globaladdr - code the address operand of a global reference */
+static void code_globaladdr(ParseContext *c, Symbol *sym)
+{
+    VMUVALUE offset = sym->v.variable.offset;
+    
+    /* code that is kept between builds refers to anything that might move through a fixup */
+    if (offset == UNDEF_VALUE || ((c->flags & COMPILER_INCREMENTAL) && IsRelocatable(sym)))
         putcword(c, AddLocalSymbolFixup(c, sym, codeaddr(c)));
     else {
         switch (sym->storageClass) {
@@ -556,21 +1247,209 @@ static void code_globalref(ParseContext *c, Symbol *sym)
     }
 }
 
+/* code_globalshort - code a global load or store with a short long offset if the address allows it
+   (global addresses are known by the time code is generated unless the symbol is undefined) */
+static int code_globalshort(ParseContext *c, Symbol *sym, int byteOp, int hwordOp)
+{
+    VMUVALUE offset = sym->v.variable.offset, addr;
+    
+    /* only variables in hub memory have a short form (and only if their addresses are fixed) */
+    if (offset == UNDEF_VALUE || ((c->flags & COMPILER_INCREMENTAL) && IsRelocatable(sym)))
+        return FALSE;
+    switch (sym->storageClass) {
+    case SC_GLOBAL:
+        addr = sym->section ? sym->section->base + offset : offset;
+        break;
+    case SC_HUB:
+        addr = offset;
+        break;
+    default:
+        return FALSE;
+    }
+    
+    /* the offset counts longs from the start of hub memory */
+    if ((addr & (sizeof(VMVALUE) - 1)) != 0)
+        return FALSE;
+    addr /= sizeof(VMVALUE);
+    if (addr <= 0xff) {
+        putcbyte(c, byteOp);
+        putcbyte(c, addr);
+    }
+    else if (addr <= 0x7fff) {
+        putcbyte(c, hwordOp);
+        putcbyte(c, addr >> 8);
+        putcbyte(c, addr);
+    }
+    else
+        return FALSE;
+    return TRUE;
+}
+
 /* code_arrayref - code an array reference */
 static void code_arrayref(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 {
+    Type *elementType = expr->u.arrayRef.array->type->u.arrayInfo.elementType;
+    VMUVALUE bound = IndexBound(c, expr);
     code_rvalue(c, expr->u.arrayRef.array);
-    code_rvalue(c, expr->u.arrayRef.index);
-    if (expr->u.arrayRef.array->type->u.arrayInfo.elementType->id == TYPE_BYTE)
-        putcbyte(c, OP_ADD);
-    else
+    
+    /* a row of a multi-dimensional array is just its address */
+    if (elementType->id == TYPE_ARRAY) {
+        code_offset(c, expr->u.arrayRef.index, ValueByteSize(elementType), bound);
+        pv->fcn = GEN_NULL;
+    }
+    else if (elementType->id == TYPE_BYTE || elementType->id == TYPE_WORD) {
+        code_offset(c, expr->u.arrayRef.index, ValueByteSize(elementType), bound);
+        pv->fcn = code_index;
+    }
+    else if (bound) {
+        code_rvalue(c, expr->u.arrayRef.index);
+        pv->fcn = code_index_checked; // the check is combined with the load or store
+        pv->u.val = (VMVALUE)bound;
+    }
+    else if (c->flags & COMPILER_OPTIMIZE) {
+        code_rvalue(c, expr->u.arrayRef.index);
+        pv->fcn = code_index_fused; // the INDEX is combined with the load or store
+    }
+    else {
+        code_rvalue(c, expr->u.arrayRef.index);
         putcbyte(c, OP_INDEX);
-    pv->fcn = code_index;
+        pv->fcn = code_index;
+    }
+}
+
+/* IndexBound - get the number of elements to check the index of an array reference against
+   (zero if the size of the array isn't known or the index is always inside it) */
+static VMUVALUE IndexBound(ParseContext *c, ParseTreeNode *expr)
+{
+    ParseTreeNode *array = expr->u.arrayRef.array;
+    ParseTreeNode *index = expr->u.arrayRef.index;
+    VMUVALUE bound = 0;
+    GenBlock *block;
+    
+    /* only declared arrays and their rows have a known size (array arguments are just pointers) */
+    if (!(c->flags & COMPILER_CHECK))
+        return 0;
+    if (array->nodeType == NodeTypeArrayLit)
+        bound = array->u.arrayLit.symbol->arraySize;
+    else if (array->type->id == TYPE_ARRAY)
+        bound = array->type->u.arrayInfo.size;
+    if (bound == 0)
+        return 0;
+    
+    /* a constant index is checked now */
+    if (IsIntegerLit(index)) {
+        if ((VMUVALUE)index->u.integerLit.value >= bound)
+            ParseError(c, "array index %d is out of bounds", index->u.integerLit.value);
+        return 0;
+    }
+    
+    /* and so is a loop variable whose values in the loop body are all inside the array */
+    if (index->nodeType == NodeTypeLocalRef) {
+        for (block = c->gptr; block >= c->genBlockBuf; --block) {
+            if (block->type == GEN_BLOCK_FOR && block->u.forBlock.offset == index->u.localRef.offset) {
+                if (block->u.forBlock.min >= 0 && (VMUVALUE)block->u.forBlock.max < bound)
+                    return 0;
+                break;
+            }
+        }
+    }
+    
+    return bound;
+}
+
+/* code_offset - add an index times an element size to the address on the stack
+   (the index is checked against bound unless it is zero) */
+static void code_offset(ParseContext *c, ParseTreeNode *index, VMUVALUE size, VMUVALUE bound)
+{
+    int shift;
+    
+    /* fold a constant index into the offset */
+    if (IsIntegerLit(index)) {
+        VMVALUE offset = index->u.integerLit.value * size;
+        if (offset == 0)
+            return;
+        code_lit(c, offset);
+    }
+    
+    /* scale the index with a shift if the size is a power of two */
+    else {
+        code_rvalue(c, index);
+        if (bound) {
+            putcbyte(c, OP_CHECK);
+            putcword(c, bound);
+        }
+        for (shift = 0; ((VMUVALUE)1 << shift) < size; ++shift)
+            ;
+        if (((VMUVALUE)1 << shift) == size) {
+            if (shift > 0) {
+                putcbyte(c, OP_SLIT);
+                putcbyte(c, shift);
+                putcbyte(c, OP_SHL);
+            }
+        }
+        else {
+            code_lit(c, size);
+            putcbyte(c, OP_MUL);
+        }
+    }
+    
+    putcbyte(c, OP_ADD);
+}
+
+/* code_lit - compile a literal value */
+static void code_lit(ParseContext *c, VMVALUE value)
+{
+    if (IsShortLit(value)) {
+        putcbyte(c, OP_SLIT);
+        putcbyte(c, value);
+    }
+    else {
+        putcbyte(c, OP_LIT);
+        putcword(c, value);
+    }
 }
 
 /* code_global - compile a global variable reference */
 void code_global(ParseContext *c, PValOp fcn, PVAL *pv)
 {
+    /* bytes and words are packed so they're accessed through their address */
+    if (pv->type->id == TYPE_BYTE || pv->type->id == TYPE_WORD) {
+        code_globalref(c, pv->u.sym);
+        if (fcn != PV_REFERENCE)
+            code_index(c, fcn, pv);
+        return;
+    }
+    
+    /* use the short offset forms of load and store when the variable is near the start of hub memory */
+    switch (fcn) {
+    case PV_LOAD:
+        if (code_globalshort(c, pv->u.sym, OP_GREF, OP_GREF16))
+            return;
+        break;
+    case PV_STORE:
+        if (code_globalshort(c, pv->u.sym, OP_GSET, OP_GSET16))
+            return;
+        break;
+    case PV_REFERENCE:
+        break;
+    }
+    
+    /* use the absolute address forms of load and store if optimizing */
+    if (c->flags & COMPILER_OPTIMIZE) {
+        switch (fcn) {
+        case PV_LOAD:
+            putcbyte(c, OP_LOADA);
+            code_globaladdr(c, pv->u.sym);
+            return;
+        case PV_STORE:
+            putcbyte(c, OP_STOREA);
+            code_globaladdr(c, pv->u.sym);
+            return;
+        case PV_REFERENCE:
+            break;
+        }
+    }
+    
     code_globalref(c, pv->u.sym);
     switch (fcn) {
     case PV_LOAD:
@@ -610,12 +1489,16 @@ static void code_index(ParseContext *c, PValOp fcn, PVAL *pv)
     case PV_LOAD:
         if (pv->type->id == TYPE_BYTE)
             putcbyte(c, OP_LOADB);
+        else if (pv->type->id == TYPE_WORD)
+            putcbyte(c, OP_LOADW);
         else
             putcbyte(c, OP_LOAD);
         break;
     case PV_STORE:
         if (pv->type->id == TYPE_BYTE)
             putcbyte(c, OP_STOREB);
+        else if (pv->type->id == TYPE_WORD)
+            putcbyte(c, OP_STOREW);
         else
             putcbyte(c, OP_STORE);
         break;
@@ -625,6 +1508,42 @@ static void code_index(ParseContext *c, PValOp fcn, PVAL *pv)
     }
 }
 
+/* code_index_fused - compile a vector reference whose INDEX hasn't been emitted yet */
+static void code_index_fused(ParseContext *c, PValOp fcn, PVAL *pv)
+{
+    switch (fcn) {
+    case PV_LOAD:
+        putcbyte(c, OP_LOADX);
+        break;
+    case PV_STORE:
+        putcbyte(c, OP_STOREX);
+        break;
+    case PV_REFERENCE:
+        putcbyte(c, OP_INDEX);
+        break;
+    }
+}
+
+/* code_index_checked - compile a vector reference whose index is checked against the bound in pv */
+static void code_index_checked(ParseContext *c, PValOp fcn, PVAL *pv)
+{
+    switch (fcn) {
+    case PV_LOAD:
+        putcbyte(c, OP_VREF);
+        putcword(c, pv->u.val);
+        break;
+    case PV_STORE:
+        putcbyte(c, OP_VSET);
+        putcword(c, pv->u.val);
+        break;
+    case PV_REFERENCE:
+        putcbyte(c, OP_CHECK);
+        putcword(c, pv->u.val);
+        putcbyte(c, OP_INDEX);
+        break;
+    }
+}
+
 /* PushGenBlock - push a generate block on the stack */
 static void PushGenBlock(ParseContext *c, GenBlockType type)
 {
@@ -645,11 +1564,41 @@ VMUVALUE codeaddr(ParseContext *c)
     return (VMUVALUE)(c->cptr - c->codeBuf);
 }
 
+/* GrowCode - make room for more bytes after the current position in the code buffer
+   (the buffer doubles in size up to the largest size the compiler was given) */
+int GrowCode(ParseContext *c, size_t size)
+{
+    size_t used = c->cptr - c->codeBuf, bufSize = c->ctop - c->codeBuf, newSize;
+    uint8_t *newBuf;
+    
+    /* check for enough room already */
+    if (size <= bufSize - used)
+        return TRUE;
+    
+    /* make sure the buffer can grow large enough */
+    if (size > c->maxCode - used)
+        return FALSE;
+    for (newSize = bufSize * 2; newSize - used < size; newSize *= 2)
+        ;
+    if (newSize > c->maxCode)
+        newSize = c->maxCode;
+    
+    /* move the code (and anything staged after it) to the new buffer */
+    newBuf = (uint8_t *)GlobalAlloc(c, newSize);
+    memcpy(newBuf, c->codeBuf, bufSize);
+    c->codeBuf = newBuf;
+    c->cptr = newBuf + used;
+    c->ctop = newBuf + newSize;
+    
+    /* return successfully */
+    return TRUE;
+}
+
 /* putcbyte - put a code byte into the code buffer */
 VMUVALUE putcbyte(ParseContext *c, int b)
 {
     VMUVALUE addr = codeaddr(c);
-    if (c->cptr >= c->ctop)
+    if (c->cptr >= c->ctop && !GrowCode(c, 1))
         Fatal(c, "Bytecode buffer overflow");
     *c->cptr++ = b;
     return addr;
@@ -661,7 +1610,7 @@ VMUVALUE putcword(ParseContext *c, VMVALUE w)
     VMUVALUE addr = codeaddr(c);
     uint8_t *p;
     int cnt = sizeof(VMVALUE);
-    if (c->cptr + sizeof(VMVALUE) > c->ctop)
+    if (c->cptr + sizeof(VMVALUE) > c->ctop && !GrowCode(c, sizeof(VMVALUE)))
         Fatal(c, "Bytecode buffer overflow");
      c->cptr += sizeof(VMVALUE);
      p = c->cptr;
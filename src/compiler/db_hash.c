@@ -0,0 +1,64 @@
+/* db_hash.c - case insensitive hash tables
+ *
+ * Copyright (c) 2009 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include "db_hash.h"
+
+#ifdef WIN32
+#define strcasecmp  _stricmp
+#endif
+
+/* InitHashTable - initialize a hash table */
+void InitHashTable(HashTable *table)
+{
+    memset(table->buckets, 0, sizeof(table->buckets));
+}
+
+/* AddHashEntry - add an entry to a hash table */
+void AddHashEntry(HashTable *table, HashEntry *entry, const char *name, void *value)
+{
+    HashEntry **pBucket = &table->buckets[HashName(name) & (HASH_SIZE - 1)];
+    entry->name = name;
+    entry->value = value;
+    entry->next = *pBucket;
+    *pBucket = entry;
+}
+
+/* FindHashEntry - find the value of an entry in a hash table */
+void *FindHashEntry(HashTable *table, const char *name)
+{
+    HashEntry *entry = table->buckets[HashName(name) & (HASH_SIZE - 1)];
+    for (; entry != NULL; entry = entry->next)
+        if (strcasecmp(name, entry->name) == 0)
+            return entry->value;
+    return NULL;
+}
+
+/* IndexKeywords - build an index for a NULL terminated keyword table
+   (entries must have room for one entry per keyword) */
+void IndexKeywords(HashTable *table, Keyword *keywords, HashEntry *entries)
+{
+    InitHashTable(table);
+    for (; keywords->keyword != NULL; ++keywords, ++entries)
+        AddHashEntry(table, entries, keywords->keyword, keywords);
+}
+
+/* FindKeyword - find the token for a keyword (returns zero if the name isn't a keyword) */
+int FindKeyword(HashTable *table, const char *name)
+{
+    Keyword *keyword = (Keyword *)FindHashEntry(table, name);
+    return keyword ? keyword->token : 0;
+}
+
+/* HashName - compute a case insensitive hash value for a name */
+unsigned int HashName(const char *name)
+{
+    unsigned int hash = 0;
+    while (*name)
+        hash = ((hash << 5) + hash) ^ tolower((unsigned char)*name++);
+    return hash;
+}
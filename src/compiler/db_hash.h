@@ -0,0 +1,40 @@
+/* db_hash.h - definitions for case insensitive hash tables
+ *
+ * Copyright (c) 2009 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#ifndef __DB_HASH_H__
+#define __DB_HASH_H__
+
+/* number of hash buckets (must be a power of two) */
+#define HASH_SIZE   32
+
+/* hash table entry (embedded in the structure being indexed) */
+typedef struct HashEntry HashEntry;
+struct HashEntry {
+    HashEntry *next;
+    const char *name;
+    void *value;
+};
+
+/* hash table */
+typedef struct {
+    HashEntry *buckets[HASH_SIZE];
+} HashTable;
+
+/* keyword table entry */
+typedef struct {
+    char *keyword;
+    int token;
+} Keyword;
+
+/* prototypes */
+void InitHashTable(HashTable *table);
+void AddHashEntry(HashTable *table, HashEntry *entry, const char *name, void *value);
+void *FindHashEntry(HashTable *table, const char *name);
+unsigned int HashName(const char *name);
+void IndexKeywords(HashTable *table, Keyword *keywords, HashEntry *entries);
+int FindKeyword(HashTable *table, const char *name);
+
+#endif
@@ -0,0 +1,637 @@
+/* db_inline.c - inline expansion of small functions
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_compiler.h"
+#include "db_vmdebug.h"
+
+/* largest function body that is expanded inline (in parse tree nodes including the inline functions it calls) */
+#define INLINE_MAX_NODES    12
+
+/* candidate body scan state */
+typedef struct {
+    ParseTreeNode *function;    /* definition of the function being scanned */
+    int size;                   /* number of nodes including the bodies of inline callees */
+    int invalid;                /* the body can't be moved into a caller */
+    int blocked;                /* the body calls a candidate that isn't inline (yet) */
+} InlineScan;
+
+/* parse tree copy state */
+typedef struct {
+    int global;                 /* allocate the copy on the global heap */
+    int remap;                  /* move the arguments and locals into the caller's frame */
+    int argc;                   /* number of arguments of the function being copied */
+    int base;                   /* caller frame slot of the first argument */
+} InlineCopy;
+
+/* prototypes for local functions */
+static void ScanNode(ParseContext *c, ParseTreeNode *node, void *cookie);
+static void ScanBody(ParseContext *c, ParseTreeNode *function, InlineScan *scan);
+static int CheckAsm(ParseContext *c, ParseTreeNode *node, ParseTreeNode *function);
+static int IsFrameOffset(ParseTreeNode *function, int offset);
+static int StackEffect(int op, int operand, int *pPops, int *pPushes);
+static void FrameSizeNode(ParseContext *c, ParseTreeNode *node, void *cookie);
+static void VisitList(ParseContext *c, NodeListEntry *entry, VisitFcn *fcn, void *cookie);
+static ParseTreeNode *CopyNode(ParseContext *c, ParseTreeNode *node, InlineCopy *copy);
+static NodeListEntry *CopyNodeList(ParseContext *c, NodeListEntry *entry, InlineCopy *copy);
+static CaseListEntry *CopyCaseList(ParseContext *c, CaseListEntry *entry, InlineCopy *copy);
+static int RemapOffset(ParseContext *c, InlineCopy *copy, int offset);
+static void *CopyAlloc(ParseContext *c, InlineCopy *copy, size_t size);
+
+/* SaveInlineCandidate - save a copy of the function just parsed if it might be expanded inline
+   (called at the end of each function definition on pass 2 since the local heap is emptied after it) */
+void SaveInlineCandidate(ParseContext *c)
+{
+    ParseTreeNode *node = c->function;
+    Type *type = node->type;
+    InlineScan scan;
+    InlineCopy copy;
+
+    /* a function that returns from inline assembly must really be called and so must a native one */
+    if (type->u.functionInfo.callerCleans || type->u.functionInfo.native)
+        return;
+
+    /* the body must be small and contain only code that can be moved into a caller */
+    ScanBody(c, node, &scan);
+    if (scan.invalid || scan.size > INLINE_MAX_NODES)
+        return;
+
+    /* copy the definition to the global heap */
+    copy.global = TRUE;
+    copy.remap = FALSE;
+    type->u.functionInfo.inlineDefinition = CopyNode(c, node, &copy);
+}
+
+/* SelectInlineFunctions - choose the candidates that will be expanded inline
+   (a candidate qualifies once every candidate it calls has so recursive functions never do) */
+void SelectInlineFunctions(ParseContext *c)
+{
+    InlineScan scan;
+    Symbol *sym;
+    int changed;
+
+    do {
+        changed = FALSE;
+        for (sym = c->globals.head; sym != NULL; sym = sym->next) {
+            Type *type = sym->type;
+            if (type->id == TYPE_FUNCTION && type->u.functionInfo.inlineDefinition && !type->u.functionInfo.inlined
+            &&  !type->u.functionInfo.started) {
+                ScanBody(c, type->u.functionInfo.inlineDefinition, &scan);
+                if (!scan.blocked && scan.size <= INLINE_MAX_NODES) {
+                    type->u.functionInfo.inlined = TRUE;
+                    changed = TRUE;
+                    if (c->flags & COMPILER_INFO)
+                        xbInfo(c->sys, "%s: expanded inline\n", sym->name);
+                }
+            }
+        }
+    } while (changed);
+}
+
+/* IsInlineCall - check whether a node is a call to a function that is expanded inline */
+int IsInlineCall(ParseTreeNode *expr)
+{
+    ParseTreeNode *fcn;
+    if (expr->nodeType != NodeTypeFunctionCall)
+        return FALSE;
+    fcn = expr->u.functionCall.fcn;
+    return fcn->nodeType == NodeTypeFunctionLit && fcn->type->u.functionInfo.inlined;
+}
+
+/* InlineSlots - get the number of caller frame slots used by the arguments and locals of an inline function */
+int InlineSlots(Type *type)
+{
+    return type->u.functionInfo.arguments.count + type->u.functionInfo.inlineDefinition->u.functionDefinition.localOffset;
+}
+
+/* InlineFrameSize - get the number of frame slots needed by the inline expansions in a list of statements
+   (sequential expansions share slots, nested ones get slots after those of the function they are in) */
+int InlineFrameSize(ParseContext *c, NodeListEntry *statements)
+{
+    int size = 0;
+    VisitList(c, statements, FrameSizeNode, &size);
+    return size;
+}
+
+/* InlineSlotOffset - get the frame offset of a slot after the locals of the function being generated */
+int InlineSlotOffset(ParseContext *c, int slot)
+{
+    return -F_SIZE - c->function->u.functionDefinition.localOffset - slot - 1;
+}
+
+/* InstantiateInline - make a copy of the body of an inline function for a call site
+   (the arguments and locals of the copy use the caller frame slots starting at base) */
+ParseTreeNode *InstantiateInline(ParseContext *c, Type *type, int base)
+{
+    InlineCopy copy;
+    copy.global = FALSE;
+    copy.remap = TRUE;
+    copy.argc = type->u.functionInfo.arguments.count;
+    copy.base = base;
+    return CopyNode(c, type->u.functionInfo.inlineDefinition, &copy);
+}
+
+/* ScanBody - measure the body of a function and check that it can be expanded inline */
+static void ScanBody(ParseContext *c, ParseTreeNode *function, InlineScan *scan)
+{
+    scan->function = function;
+    scan->size = 0;
+    scan->invalid = FALSE;
+    scan->blocked = FALSE;
+    VisitList(c, function->u.functionDefinition.bodyStatements, ScanNode, scan);
+}
+
+/* ScanNode - measure a node of a candidate body and check that it can be expanded inline */
+static void ScanNode(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    InlineScan *scan = (InlineScan *)cookie;
+    ++scan->size;
+    switch (node->nodeType) {
+    case NodeTypeLabelDefinition:
+    case NodeTypeGotoStatement:
+        scan->invalid = TRUE;
+        break;
+    case NodeTypeAsmStatement:
+        if (!CheckAsm(c, node, scan->function))
+            scan->invalid = TRUE;
+        break;
+    case NodeTypeFunctionCall:
+        if (IsInlineCall(node)) {
+            InlineScan calleeScan;
+            ScanBody(c, node->u.functionCall.fcn->type->u.functionInfo.inlineDefinition, &calleeScan);
+            scan->size += calleeScan.size;
+        }
+        else if (node->u.functionCall.fcn->nodeType == NodeTypeFunctionLit
+             &&  node->u.functionCall.fcn->type->u.functionInfo.inlineDefinition)
+            scan->blocked = TRUE;
+        break;
+    default:
+        break;
+    }
+    VisitChildren(c, node, ScanNode, cookie);
+}
+
+/* CheckAsm - check that inline assembly can be moved into a caller
+   (it must be straight line code that leaves the stack as it found it and only refers to the arguments and locals) */
+static int CheckAsm(ParseContext *c, ParseTreeNode *node, ParseTreeNode *function)
+{
+    uint8_t *code = node->u.asmStatement.code;
+    int length = node->u.asmStatement.length;
+    int depth = 0, offset, fmt, size, pops, pushes;
+
+    for (offset = 0; offset < length; offset += size) {
+        int op = code[offset], operand;
+
+        /* decode the instruction */
+        if ((fmt = InstructionFormat(op)) < 0 || offset + (size = InstructionLength(fmt)) > length)
+            return FALSE;
+        operand = (size > 1 ? (int8_t)code[offset + 1] : 0);
+
+        /* local references must be to slots that are moved */
+        if ((op == OP_LREF || op == OP_LSET || op == OP_LINC) && !IsFrameOffset(function, operand))
+            return FALSE;
+
+        /* the instruction can't take anything off the stack that it didn't put there */
+        if (!StackEffect(op, operand, &pops, &pushes) || (depth -= pops) < 0)
+            return FALSE;
+        depth += pushes;
+    }
+
+    /* the stack must be back where it started */
+    return depth == 0;
+}
+
+/* IsFrameOffset - check whether a frame offset refers to an argument or local of a function */
+static int IsFrameOffset(ParseTreeNode *function, int offset)
+{
+    if (offset >= 0)
+        return offset < function->type->u.functionInfo.arguments.count;
+    offset = -offset - F_SIZE - 1;
+    return offset >= 0 && offset < function->u.functionDefinition.localOffset;
+}
+
+/* StackEffect - get the number of values an instruction pops and pushes
+   (returns FALSE for instructions that can't be moved into a caller) */
+static int StackEffect(int op, int operand, int *pPops, int *pPushes)
+{
+    switch (op) {
+    case OP_LIT:
+    case OP_SLIT:
+    case OP_LIT16:
+    case OP_LREF:
+    case OP_LOADA:
+    case OP_GREF:
+    case OP_GREF16:
+        *pPops = 0;
+        *pPushes = 1;
+        break;
+    case OP_DUP:
+        *pPops = 1;
+        *pPushes = 2;
+        break;
+    case OP_NOT:
+    case OP_NEG:
+    case OP_BNOT:
+    case OP_LOAD:
+    case OP_LOADB:
+    case OP_LOADW:
+    case OP_CHECK:
+        *pPops = 1;
+        *pPushes = 1;
+        break;
+    case OP_NATIVE:
+    case OP_LINC:
+        *pPops = 0;
+        *pPushes = 0;
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+    case OP_INDEX:
+    case OP_LOADX:
+    case OP_VREF:
+        *pPops = 2;
+        *pPushes = 1;
+        break;
+    case OP_LSET:
+    case OP_DROP:
+    case OP_STOREA:
+    case OP_GSET:
+    case OP_GSET16:
+        *pPops = 1;
+        *pPushes = 0;
+        break;
+    case OP_STORE:
+    case OP_STOREB:
+    case OP_STOREW:
+        *pPops = 2;
+        *pPushes = 0;
+        break;
+    case OP_STOREX:
+    case OP_VSET:
+        *pPops = 3;
+        *pPushes = 0;
+        break;
+    case OP_TRAP:
+        switch (operand) {
+        case TRAP_GETCHAR:
+        case TRAP_LOCKNEW:
+        case TRAP_TASKWAIT:
+            *pPops = 0;
+            *pPushes = 1;
+            break;
+        case TRAP_PUTCHAR:
+        case TRAP_LOCKRET:
+        case TRAP_TASKTIMER:
+            *pPops = 1;
+            *pPushes = 0;
+            break;
+        case TRAP_PUTSTR:
+        case TRAP_STRCPY:
+            *pPops = 2;
+            *pPushes = 0;
+            break;
+        case TRAP_STRLEN:
+        case TRAP_ITOF:
+        case TRAP_FTOI:
+        case TRAP_LOCKSET:
+        case TRAP_LOCKCLR:
+            *pPops = 1;
+            *pPushes = 1;
+            break;
+        case TRAP_STRCMP:
+        case TRAP_FIXMUL:
+        case TRAP_FIXDIV:
+        case TRAP_FADD:
+        case TRAP_FSUB:
+        case TRAP_FMUL:
+        case TRAP_FDIV:
+        case TRAP_FCMP:
+            *pPops = 2;
+            *pPushes = 1;
+            break;
+        case TRAP_MEMCPY:
+        case TRAP_MEMSET:
+        case TRAP_PUTNUM:
+            *pPops = 3;
+            *pPushes = 0;
+            break;
+        case TRAP_ARRSUM:
+        case TRAP_ARRMIN:
+        case TRAP_ARRMAX:
+            *pPops = 3;
+            *pPushes = 1;
+            break;
+        case TRAP_ARRDOT:
+        case TRAP_COGSTART:
+        case TRAP_TASKSTART:
+        case TRAP_FMTNUM:
+        case TRAP_PARSENUM:
+            *pPops = 4;
+            *pPushes = 1;
+            break;
+        case TRAP_ARRFILL:
+        case TRAP_ARRCOPY:
+        case TRAP_ARRADD:
+            *pPops = 4;
+            *pPushes = 0;
+            break;
+        case TRAP_ARRMAC:
+        case TRAP_ARRSCALE:
+            *pPops = 5;
+            *pPushes = 0;
+            break;
+        case TRAP_BUTTERFLY:
+            *pPops = 6;
+            *pPushes = 0;
+            break;
+        case TRAP_TASKEXIT:
+        case TRAP_YIELD:
+            *pPops = 0;
+            *pPushes = 0;
+            break;
+        default:
+            return FALSE;
+        }
+        break;
+    default:
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* FrameSizeNode - find the largest number of frame slots needed by the inline expansions under a node */
+static void FrameSizeNode(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    int *pSize = (int *)cookie;
+    if (IsInlineCall(node)) {
+        Type *type = node->u.functionCall.fcn->type;
+        int size = InlineSlots(type) + InlineFrameSize(c, type->u.functionInfo.inlineDefinition->u.functionDefinition.bodyStatements);
+        if (size > *pSize)
+            *pSize = size;
+    }
+    VisitChildren(c, node, FrameSizeNode, cookie);
+}
+
+/* VisitChildren - call a function for each of the nodes directly under a node */
+void VisitChildren(ParseContext *c, ParseTreeNode *node, VisitFcn *fcn, void *cookie)
+{
+    CaseListEntry *entry;
+    switch (node->nodeType) {
+    case NodeTypeFunctionDefinition:
+        VisitList(c, node->u.functionDefinition.bodyStatements, fcn, cookie);
+        break;
+    case NodeTypeLetStatement:
+        (*fcn)(c, node->u.letStatement.lvalue, cookie);
+        (*fcn)(c, node->u.letStatement.rvalue, cookie);
+        break;
+    case NodeTypeIfStatement:
+        (*fcn)(c, node->u.ifStatement.test, cookie);
+        VisitList(c, node->u.ifStatement.thenStatements, fcn, cookie);
+        VisitList(c, node->u.ifStatement.elseStatements, fcn, cookie);
+        break;
+    case NodeTypeSelectStatement:
+        (*fcn)(c, node->u.selectStatement.expr, cookie);
+        VisitList(c, node->u.selectStatement.caseStatements, fcn, cookie);
+        if (node->u.selectStatement.elseStatements)
+            (*fcn)(c, node->u.selectStatement.elseStatements, cookie);
+        break;
+    case NodeTypeCaseStatement:
+        for (entry = node->u.caseStatement.cases; entry != NULL; entry = entry->next) {
+            (*fcn)(c, entry->fromExpr, cookie);
+            if (entry->toExpr)
+                (*fcn)(c, entry->toExpr, cookie);
+        }
+        VisitList(c, node->u.caseStatement.bodyStatements, fcn, cookie);
+        break;
+    case NodeTypeForStatement:
+        (*fcn)(c, node->u.forStatement.var, cookie);
+        (*fcn)(c, node->u.forStatement.startExpr, cookie);
+        (*fcn)(c, node->u.forStatement.endExpr, cookie);
+        if (node->u.forStatement.stepExpr)
+            (*fcn)(c, node->u.forStatement.stepExpr, cookie);
+        VisitList(c, node->u.forStatement.bodyStatements, fcn, cookie);
+        break;
+    case NodeTypeDoWhileStatement:
+    case NodeTypeDoUntilStatement:
+    case NodeTypeLoopStatement:
+    case NodeTypeLoopWhileStatement:
+    case NodeTypeLoopUntilStatement:
+        if (node->u.loopStatement.test)
+            (*fcn)(c, node->u.loopStatement.test, cookie);
+        VisitList(c, node->u.loopStatement.bodyStatements, fcn, cookie);
+        break;
+    case NodeTypeReturnStatement:
+        if (node->u.returnStatement.expr)
+            (*fcn)(c, node->u.returnStatement.expr, cookie);
+        break;
+    case NodeTypeCallStatement:
+        (*fcn)(c, node->u.callStatement.expr, cookie);
+        break;
+    case NodeTypeAsmStatement:
+        if (node->u.asmStatement.arg)
+            (*fcn)(c, node->u.asmStatement.arg, cookie);
+        break;
+    case NodeTypeUnaryOp:
+        (*fcn)(c, node->u.unaryOp.expr, cookie);
+        break;
+    case NodeTypeBinaryOp:
+        (*fcn)(c, node->u.binaryOp.left, cookie);
+        (*fcn)(c, node->u.binaryOp.right, cookie);
+        break;
+    case NodeTypeArrayRef:
+        (*fcn)(c, node->u.arrayRef.array, cookie);
+        (*fcn)(c, node->u.arrayRef.index, cookie);
+        break;
+    case NodeTypeFunctionCall:
+        (*fcn)(c, node->u.functionCall.fcn, cookie);
+        VisitList(c, node->u.functionCall.args, fcn, cookie);
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        VisitList(c, node->u.exprList.exprs, fcn, cookie);
+        break;
+    case NodeTypeAddressOf:
+        (*fcn)(c, node->u.addressOf.expr, cookie);
+        break;
+    default:
+        // no nodes under this one
+        break;
+    }
+}
+
+/* VisitList - call a function for each node in a list */
+static void VisitList(ParseContext *c, NodeListEntry *entry, VisitFcn *fcn, void *cookie)
+{
+    for (; entry != NULL; entry = entry->next)
+        (*fcn)(c, entry->node, cookie);
+}
+
+/* CopyNode - copy a parse tree */
+static ParseTreeNode *CopyNode(ParseContext *c, ParseTreeNode *node, InlineCopy *copy)
+{
+    ParseTreeNode *dst;
+    uint8_t *code;
+    int length, offset, size;
+
+    /* some optional nodes are missing */
+    if (!node)
+        return NULL;
+
+    /* copy the node and then each of the nodes under it */
+    dst = (ParseTreeNode *)CopyAlloc(c, copy, sizeof(ParseTreeNode));
+    *dst = *node;
+    switch (node->nodeType) {
+    case NodeTypeFunctionDefinition:
+        InitSymbolTable(&dst->u.functionDefinition.locals);
+        dst->u.functionDefinition.labels = NULL;
+        InitHashTable(&dst->u.functionDefinition.labelIndex);
+        dst->u.functionDefinition.bodyStatements = CopyNodeList(c, node->u.functionDefinition.bodyStatements, copy);
+        break;
+    case NodeTypeLetStatement:
+        dst->u.letStatement.lvalue = CopyNode(c, node->u.letStatement.lvalue, copy);
+        dst->u.letStatement.rvalue = CopyNode(c, node->u.letStatement.rvalue, copy);
+        break;
+    case NodeTypeIfStatement:
+        dst->u.ifStatement.test = CopyNode(c, node->u.ifStatement.test, copy);
+        dst->u.ifStatement.thenStatements = CopyNodeList(c, node->u.ifStatement.thenStatements, copy);
+        dst->u.ifStatement.elseStatements = CopyNodeList(c, node->u.ifStatement.elseStatements, copy);
+        break;
+    case NodeTypeSelectStatement:
+        dst->u.selectStatement.expr = CopyNode(c, node->u.selectStatement.expr, copy);
+        dst->u.selectStatement.caseStatements = CopyNodeList(c, node->u.selectStatement.caseStatements, copy);
+        dst->u.selectStatement.elseStatements = CopyNode(c, node->u.selectStatement.elseStatements, copy);
+        break;
+    case NodeTypeCaseStatement:
+        dst->u.caseStatement.cases = CopyCaseList(c, node->u.caseStatement.cases, copy);
+        dst->u.caseStatement.bodyStatements = CopyNodeList(c, node->u.caseStatement.bodyStatements, copy);
+        break;
+    case NodeTypeForStatement:
+        dst->u.forStatement.var = CopyNode(c, node->u.forStatement.var, copy);
+        dst->u.forStatement.startExpr = CopyNode(c, node->u.forStatement.startExpr, copy);
+        dst->u.forStatement.endExpr = CopyNode(c, node->u.forStatement.endExpr, copy);
+        dst->u.forStatement.stepExpr = CopyNode(c, node->u.forStatement.stepExpr, copy);
+        dst->u.forStatement.bodyStatements = CopyNodeList(c, node->u.forStatement.bodyStatements, copy);
+        break;
+    case NodeTypeDoWhileStatement:
+    case NodeTypeDoUntilStatement:
+    case NodeTypeLoopStatement:
+    case NodeTypeLoopWhileStatement:
+    case NodeTypeLoopUntilStatement:
+        dst->u.loopStatement.test = CopyNode(c, node->u.loopStatement.test, copy);
+        dst->u.loopStatement.bodyStatements = CopyNodeList(c, node->u.loopStatement.bodyStatements, copy);
+        break;
+    case NodeTypeReturnStatement:
+        dst->u.returnStatement.expr = CopyNode(c, node->u.returnStatement.expr, copy);
+        break;
+    case NodeTypeCallStatement:
+        dst->u.callStatement.expr = CopyNode(c, node->u.callStatement.expr, copy);
+        break;
+    case NodeTypeAsmStatement:
+        length = node->u.asmStatement.length;
+        code = (uint8_t *)CopyAlloc(c, copy, length);
+        memcpy(code, node->u.asmStatement.code, length);
+        if (copy->remap) {
+            for (offset = 0; offset < length; offset += size) {
+                size = InstructionLength(InstructionFormat(code[offset]));
+                if (code[offset] == OP_LREF || code[offset] == OP_LSET || code[offset] == OP_LINC)
+                    code[offset + 1] = RemapOffset(c, copy, (int8_t)code[offset + 1]);
+            }
+        }
+        dst->u.asmStatement.code = code;
+        dst->u.asmStatement.arg = CopyNode(c, node->u.asmStatement.arg, copy);
+        break;
+    case NodeTypeLocalRef:
+        dst->u.localRef.offset = RemapOffset(c, copy, node->u.localRef.offset);
+        break;
+    case NodeTypeUnaryOp:
+        dst->u.unaryOp.expr = CopyNode(c, node->u.unaryOp.expr, copy);
+        break;
+    case NodeTypeBinaryOp:
+        dst->u.binaryOp.left = CopyNode(c, node->u.binaryOp.left, copy);
+        dst->u.binaryOp.right = CopyNode(c, node->u.binaryOp.right, copy);
+        break;
+    case NodeTypeArrayRef:
+        dst->u.arrayRef.array = CopyNode(c, node->u.arrayRef.array, copy);
+        dst->u.arrayRef.index = CopyNode(c, node->u.arrayRef.index, copy);
+        break;
+    case NodeTypeFunctionCall:
+        dst->u.functionCall.fcn = CopyNode(c, node->u.functionCall.fcn, copy);
+        dst->u.functionCall.args = CopyNodeList(c, node->u.functionCall.args, copy);
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        dst->u.exprList.exprs = CopyNodeList(c, node->u.exprList.exprs, copy);
+        break;
+    case NodeTypeAddressOf:
+        dst->u.addressOf.expr = CopyNode(c, node->u.addressOf.expr, copy);
+        break;
+    default:
+        // symbols, strings and literals are shared
+        break;
+    }
+
+    /* return the copy */
+    return dst;
+}
+
+/* CopyNodeList - copy a list of parse trees */
+static NodeListEntry *CopyNodeList(ParseContext *c, NodeListEntry *entry, InlineCopy *copy)
+{
+    NodeListEntry *list = NULL, **pNext = &list;
+    for (; entry != NULL; entry = entry->next) {
+        NodeListEntry *dst = (NodeListEntry *)CopyAlloc(c, copy, sizeof(NodeListEntry));
+        dst->node = CopyNode(c, entry->node, copy);
+        dst->next = NULL;
+        *pNext = dst;
+        pNext = &dst->next;
+    }
+    return list;
+}
+
+/* CopyCaseList - copy the values of a CASE clause */
+static CaseListEntry *CopyCaseList(ParseContext *c, CaseListEntry *entry, InlineCopy *copy)
+{
+    CaseListEntry *list = NULL, **pNext = &list;
+    for (; entry != NULL; entry = entry->next) {
+        CaseListEntry *dst = (CaseListEntry *)CopyAlloc(c, copy, sizeof(CaseListEntry));
+        dst->fromExpr = CopyNode(c, entry->fromExpr, copy);
+        dst->toExpr = CopyNode(c, entry->toExpr, copy);
+        dst->next = NULL;
+        *pNext = dst;
+        pNext = &dst->next;
+    }
+    return list;
+}
+
+/* RemapOffset - move an argument or local offset into the caller's frame */
+static int RemapOffset(ParseContext *c, InlineCopy *copy, int offset)
+{
+    if (!copy->remap)
+        return offset;
+    if (offset >= 0)
+        return InlineSlotOffset(c, copy->base + offset);
+    return InlineSlotOffset(c, copy->base + copy->argc - offset - F_SIZE - 1);
+}
+
+/* CopyAlloc - allocate memory for a copy */
+static void *CopyAlloc(ParseContext *c, InlineCopy *copy, size_t size)
+{
+    return copy->global ? GlobalAlloc(c, size) : LocalAlloc(c, size);
+}
@@ -0,0 +1,540 @@
+/* db_loop.c - loop invariant and common subexpression optimizations
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_compiler.h"
+
+/* limits */
+#define MAX_CHANGED     32  /* number of variables a loop can change and still be optimized */
+#define MAX_HOIST_FRAME 64  /* leave the rest of the frame for inline expansions */
+#define MAX_EXPRS       64  /* number of subexpressions of a statement checked for duplicates */
+#define MAX_CSE_ROUNDS  8   /* number of common subexpressions removed from a statement */
+
+/* loop body scan state */
+typedef struct {
+    int invalid;                /* the loop has labels or inline assembly so nothing can be moved */
+    int globalsChanged;         /* the loop calls functions, takes addresses or uses registers so any global may change */
+    int checked;                /* array indexes are checked so a row reference can fail */
+    ParseTreeNode *changed[MAX_CHANGED];    /* variables assigned in the loop */
+    int changedCount;
+} LoopScan;
+
+/* locals set to the values of expressions in front of a statement */
+typedef struct {
+    NodeListEntry *first;       /* first statement setting a local */
+    NodeListEntry **pNextEntry; /* where to put the next statement (the link to the statement itself) */
+} TempList;
+
+/* loop invariant hoisting state */
+typedef struct {
+    LoopScan *scan;
+    int rowsOnly;               /* only move row address calculations */
+    TempList temps;             /* locals set in front of the loop */
+} LoopHoist;
+
+/* common subexpression scan state */
+typedef struct {
+    int volatileLoads;          /* globals and array elements can change during the statement */
+    ParseTreeNode *exprs[MAX_EXPRS];
+    int count;
+} ExprScan;
+
+/* prototypes for local functions */
+static void HoistLoop(ParseContext *c, ParseTreeNode *loop, NodeListEntry ***ppEntry, int rowsOnly);
+static void ScanLoopNode(ParseContext *c, ParseTreeNode *node, void *cookie);
+static void AddChanged(LoopScan *scan, ParseTreeNode *node);
+static int IsChanged(LoopScan *scan, ParseTreeNode *node);
+static int IsInvariant(LoopScan *scan, ParseTreeNode *node);
+static void HoistNode(ParseContext *c, ParseTreeNode *node, void *cookie);
+static void OptimizeList(ParseContext *c, NodeListEntry **pEntry);
+static NodeListEntry **OptimizeStatement(ParseContext *c, ParseTreeNode *node, NodeListEntry **pEntry);
+static NodeListEntry **EliminateCommonExprs(ParseContext *c, ParseTreeNode *node, NodeListEntry **pEntry);
+static void CollectStatementExprs(ExprScan *scan, ParseTreeNode *node);
+static void CollectExprs(ExprScan *scan, ParseTreeNode *node);
+static void FindCall(ParseContext *c, ParseTreeNode *node, void *cookie);
+static int IsPure(ExprScan *scan, ParseTreeNode *node);
+static int ReplaceWithTemp(ParseContext *c, TempList *temps, ParseTreeNode *node);
+static int IsRegister(ParseTreeNode *node);
+static int ExprWeight(ParseTreeNode *node);
+static int SameExpr(ParseTreeNode *expr1, ParseTreeNode *expr2);
+
+/* HoistLoopInvariants - move row address calculations that don't change in a loop in front of the loop
+   (pEntry is the list link that holds the loop statement) */
+void HoistLoopInvariants(ParseContext *c, ParseTreeNode *loop, NodeListEntry **pEntry)
+{
+    HoistLoop(c, loop, &pEntry, TRUE);
+}
+
+/* OptimizeFunction - remove common subexpressions and move loop invariant expressions out of loops */
+void OptimizeFunction(ParseContext *c, ParseTreeNode *function)
+{
+    OptimizeList(c, &function->u.functionDefinition.bodyStatements);
+}
+
+/* HoistLoop - move the invariant expressions of a loop in front of it
+   (*ppEntry is updated to the list link that holds the loop statement) */
+static void HoistLoop(ParseContext *c, ParseTreeNode *loop, NodeListEntry ***ppEntry, int rowsOnly)
+{
+    NodeListEntry *body, *entry;
+    LoopHoist hoist;
+    LoopScan scan;
+
+    /* find the variables the loop changes */
+    memset(&scan, 0, sizeof(scan));
+    scan.globalsChanged = c->usesRegisters || c->startsCogs || c->runsTasks;
+    scan.checked = (c->flags & COMPILER_CHECK) != 0;
+    if (loop->nodeType == NodeTypeForStatement)
+        AddChanged(&scan, loop->u.forStatement.var);
+    VisitChildren(c, loop, ScanLoopNode, &scan);
+    if (scan.invalid)
+        return;
+
+    /* replace each invariant expression with a local that is set in front of the loop */
+    hoist.scan = &scan;
+    hoist.rowsOnly = rowsOnly;
+    hoist.temps.first = NULL;
+    hoist.temps.pNextEntry = *ppEntry;
+    if (loop->nodeType == NodeTypeForStatement) {
+        body = loop->u.forStatement.bodyStatements;
+        if (!rowsOnly) {
+            HoistNode(c, loop->u.forStatement.endExpr, &hoist);
+            if (loop->u.forStatement.stepExpr)
+                HoistNode(c, loop->u.forStatement.stepExpr, &hoist);
+        }
+    }
+    else {
+        body = loop->u.loopStatement.bodyStatements;
+        if (!rowsOnly && loop->u.loopStatement.test)
+            HoistNode(c, loop->u.loopStatement.test, &hoist);
+    }
+    for (entry = body; entry != NULL; entry = entry->next)
+        HoistNode(c, entry->node, &hoist);
+    *ppEntry = hoist.temps.pNextEntry;
+}
+
+/* ScanLoopNode - find the variables changed by a node in a loop */
+static void ScanLoopNode(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    LoopScan *scan = (LoopScan *)cookie;
+    switch (node->nodeType) {
+    case NodeTypeLetStatement:
+        AddChanged(scan, node->u.letStatement.lvalue);
+        break;
+    case NodeTypeForStatement:
+        AddChanged(scan, node->u.forStatement.var);
+        break;
+    case NodeTypeGlobalRef:
+        if (IsRegister(node))
+            scan->globalsChanged = TRUE;
+        break;
+    case NodeTypeFunctionCall:
+        scan->globalsChanged = TRUE;
+        break;
+    case NodeTypeAddressOf:
+        AddChanged(scan, node->u.addressOf.expr);
+        scan->globalsChanged = TRUE;
+        break;
+    case NodeTypeLabelDefinition:
+    case NodeTypeAsmStatement:
+        scan->invalid = TRUE;
+        break;
+    default:
+        break;
+    }
+    VisitChildren(c, node, ScanLoopNode, cookie);
+}
+
+/* AddChanged - add a variable to the list of variables changed in a loop */
+static void AddChanged(LoopScan *scan, ParseTreeNode *node)
+{
+    if (node->nodeType == NodeTypeLocalRef || node->nodeType == NodeTypeGlobalRef) {
+        if (scan->changedCount >= MAX_CHANGED)
+            scan->invalid = TRUE;
+        else
+            scan->changed[scan->changedCount++] = node;
+    }
+}
+
+/* IsChanged - check whether a variable is changed in a loop */
+static int IsChanged(LoopScan *scan, ParseTreeNode *node)
+{
+    int i;
+    for (i = 0; i < scan->changedCount; ++i)
+        if (SameExpr(scan->changed[i], node))
+            return TRUE;
+    return FALSE;
+}
+
+/* IsInvariant - check whether an expression has the same value each time through a loop
+   (it must not be able to fail either since the loop might not have been entered) */
+static int IsInvariant(LoopScan *scan, ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeIntegerLit:
+    case NodeTypeStringLit:
+    case NodeTypeArrayLit:
+        return TRUE;
+    case NodeTypeLocalRef:
+        return !IsChanged(scan, node);
+    case NodeTypeGlobalRef:
+        return !scan->globalsChanged && !IsRegister(node) && !IsChanged(scan, node);
+    case NodeTypeUnaryOp:
+        return IsInvariant(scan, node->u.unaryOp.expr);
+    case NodeTypeBinaryOp:
+        return node->u.binaryOp.op != OP_DIV
+            && node->u.binaryOp.op != OP_REM
+            && IsInvariant(scan, node->u.binaryOp.left)
+            && IsInvariant(scan, node->u.binaryOp.right);
+    case NodeTypeArrayRef:
+        /* only row addresses since the elements can be stored in the loop (with a constant index if it is checked) */
+        return node->type->id == TYPE_ARRAY
+            && (!scan->checked || IsIntegerLit(node->u.arrayRef.index))
+            && IsInvariant(scan, node->u.arrayRef.array)
+            && IsInvariant(scan, node->u.arrayRef.index);
+    default:
+        return FALSE;
+    }
+}
+
+/* HoistNode - move the largest invariant expressions under a node in front of the loop */
+static void HoistNode(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    LoopHoist *hoist = (LoopHoist *)cookie;
+    int candidate;
+
+    /* look for row references or any expression more than a single value that doesn't change in the loop */
+    if (hoist->rowsOnly)
+        candidate = node->nodeType == NodeTypeArrayRef && node->type->id == TYPE_ARRAY;
+    else
+        candidate = ExprWeight(node) > 1;
+    if (!candidate || !IsInvariant(hoist->scan, node) || !ReplaceWithTemp(c, &hoist->temps, node))
+        VisitChildren(c, node, HoistNode, cookie);
+}
+
+/* OptimizeList - optimize each statement in a statement list */
+static void OptimizeList(ParseContext *c, NodeListEntry **pEntry)
+{
+    while (*pEntry) {
+        pEntry = OptimizeStatement(c, (*pEntry)->node, pEntry);
+        pEntry = &(*pEntry)->next;
+    }
+}
+
+/* OptimizeStatement - optimize a statement and the statements nested inside of it
+   (returns the link to the statement after inserting statements in front of it) */
+static NodeListEntry **OptimizeStatement(ParseContext *c, ParseTreeNode *node, NodeListEntry **pEntry)
+{
+    NodeListEntry *entry;
+    switch (node->nodeType) {
+    case NodeTypeLetStatement:
+    case NodeTypeCallStatement:
+    case NodeTypeReturnStatement:
+        pEntry = EliminateCommonExprs(c, node, pEntry);
+        break;
+    case NodeTypeIfStatement:
+        OptimizeList(c, &node->u.ifStatement.thenStatements);
+        OptimizeList(c, &node->u.ifStatement.elseStatements);
+        pEntry = EliminateCommonExprs(c, node, pEntry);
+        break;
+    case NodeTypeSelectStatement:
+        for (entry = node->u.selectStatement.caseStatements; entry != NULL; entry = entry->next)
+            OptimizeList(c, &entry->node->u.caseStatement.bodyStatements);
+        if (node->u.selectStatement.elseStatements)
+            OptimizeList(c, &node->u.selectStatement.elseStatements->u.caseStatement.bodyStatements);
+        pEntry = EliminateCommonExprs(c, node, pEntry);
+        break;
+    case NodeTypeForStatement:
+        OptimizeList(c, &node->u.forStatement.bodyStatements);
+        HoistLoop(c, node, &pEntry, FALSE);
+        break;
+    case NodeTypeDoWhileStatement:
+    case NodeTypeDoUntilStatement:
+    case NodeTypeLoopStatement:
+    case NodeTypeLoopWhileStatement:
+    case NodeTypeLoopUntilStatement:
+        OptimizeList(c, &node->u.loopStatement.bodyStatements);
+        HoistLoop(c, node, &pEntry, FALSE);
+        break;
+    default:
+        break;
+    }
+    return pEntry;
+}
+
+/* EliminateCommonExprs - compute expressions that appear more than once in a statement into locals in front of it
+   (returns the link to the statement after inserting statements in front of it) */
+static NodeListEntry **EliminateCommonExprs(ParseContext *c, ParseTreeNode *node, NodeListEntry **pEntry)
+{
+    TempList temps;
+    ExprScan scan;
+    int round, i, j;
+
+    /* values in memory can change during a statement that calls a function */
+    scan.volatileLoads = c->usesRegisters || c->startsCogs || c->runsTasks;
+    FindCall(c, node, &scan.volatileLoads);
+
+    temps.first = NULL;
+    temps.pNextEntry = pEntry;
+    for (round = 0; round < MAX_CSE_ROUNDS; ++round) {
+        ParseTreeNode *best = NULL;
+        int bestWeight = 0;
+
+        /* find the heaviest expression that is worth computing only once */
+        scan.count = 0;
+        CollectStatementExprs(&scan, node);
+        for (i = 0; i < scan.count; ++i) {
+            int weight = ExprWeight(scan.exprs[i]), uses = 1;
+            for (j = i + 1; j < scan.count; ++j)
+                if (SameExpr(scan.exprs[i], scan.exprs[j]))
+                    ++uses;
+
+            /* each use of the local costs a load and setting it costs a store */
+            if (uses > 1 && (uses - 1) * weight > uses + 1 && weight > bestWeight) {
+                best = scan.exprs[i];
+                bestWeight = weight;
+            }
+        }
+        if (!best)
+            break;
+
+        /* replace every copy of the expression with the same local */
+        for (i = 0; i < scan.count; ++i)
+            if (scan.exprs[i] != best && SameExpr(scan.exprs[i], best))
+                ReplaceWithTemp(c, &temps, scan.exprs[i]);
+        if (!ReplaceWithTemp(c, &temps, best))
+            break;
+    }
+
+    return temps.pNextEntry;
+}
+
+/* CollectStatementExprs - collect the subexpressions a statement evaluates every time it is executed */
+static void CollectStatementExprs(ExprScan *scan, ParseTreeNode *node)
+{
+    ParseTreeNode *lvalue;
+    switch (node->nodeType) {
+    case NodeTypeLetStatement:
+        /* the element being stored isn't loaded but its address is computed */
+        lvalue = node->u.letStatement.lvalue;
+        if (lvalue->nodeType == NodeTypeArrayRef) {
+            CollectExprs(scan, lvalue->u.arrayRef.array);
+            CollectExprs(scan, lvalue->u.arrayRef.index);
+        }
+        CollectExprs(scan, node->u.letStatement.rvalue);
+        break;
+    case NodeTypeCallStatement:
+        CollectExprs(scan, node->u.callStatement.expr);
+        break;
+    case NodeTypeReturnStatement:
+        if (node->u.returnStatement.expr)
+            CollectExprs(scan, node->u.returnStatement.expr);
+        break;
+    case NodeTypeIfStatement:
+        CollectExprs(scan, node->u.ifStatement.test);
+        break;
+    case NodeTypeSelectStatement:
+        CollectExprs(scan, node->u.selectStatement.expr);
+        break;
+    default:
+        break;
+    }
+}
+
+/* CollectExprs - collect the pure subexpressions of an expression that are more than a single value */
+static void CollectExprs(ExprScan *scan, ParseTreeNode *node)
+{
+    NodeListEntry *entry;
+    switch (node->nodeType) {
+    case NodeTypeUnaryOp:
+        CollectExprs(scan, node->u.unaryOp.expr);
+        break;
+    case NodeTypeBinaryOp:
+        CollectExprs(scan, node->u.binaryOp.left);
+        CollectExprs(scan, node->u.binaryOp.right);
+        break;
+    case NodeTypeArrayRef:
+        CollectExprs(scan, node->u.arrayRef.array);
+        CollectExprs(scan, node->u.arrayRef.index);
+        break;
+    case NodeTypeFunctionCall:
+        for (entry = node->u.functionCall.args; entry != NULL; entry = entry->next)
+            CollectExprs(scan, entry->node);
+        return;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        /* only the first term of a short circuit expression is always evaluated */
+        if ((entry = node->u.exprList.exprs) != NULL)
+            CollectExprs(scan, entry->node);
+        return;
+    case NodeTypeAddressOf:
+        /* the address of an element is computed but the element isn't loaded */
+        if (node->u.addressOf.expr->nodeType == NodeTypeArrayRef) {
+            CollectExprs(scan, node->u.addressOf.expr->u.arrayRef.array);
+            CollectExprs(scan, node->u.addressOf.expr->u.arrayRef.index);
+        }
+        return;
+    default:
+        return;
+    }
+    if (scan->count < MAX_EXPRS && IsPure(scan, node))
+        scan->exprs[scan->count++] = node;
+}
+
+/* FindCall - check whether a node contains a function call */
+static void FindCall(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    if (node->nodeType == NodeTypeFunctionCall)
+        *(int *)cookie = TRUE;
+
+    /* the nested statements of compound statements are optimized separately */
+    switch (node->nodeType) {
+    case NodeTypeIfStatement:
+        FindCall(c, node->u.ifStatement.test, cookie);
+        break;
+    case NodeTypeSelectStatement:
+        FindCall(c, node->u.selectStatement.expr, cookie);
+        break;
+    default:
+        VisitChildren(c, node, FindCall, cookie);
+        break;
+    }
+}
+
+/* IsPure - check whether an expression always has the same value when evaluated twice in a statement */
+static int IsPure(ExprScan *scan, ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeIntegerLit:
+    case NodeTypeStringLit:
+    case NodeTypeArrayLit:
+    case NodeTypeLocalRef:
+        return TRUE;
+    case NodeTypeGlobalRef:
+        return !scan->volatileLoads && !IsRegister(node);
+    case NodeTypeUnaryOp:
+        return IsPure(scan, node->u.unaryOp.expr);
+    case NodeTypeBinaryOp:
+        return IsPure(scan, node->u.binaryOp.left) && IsPure(scan, node->u.binaryOp.right);
+    case NodeTypeArrayRef:
+        return (node->type->id == TYPE_ARRAY || !scan->volatileLoads)
+            && IsPure(scan, node->u.arrayRef.array)
+            && IsPure(scan, node->u.arrayRef.index);
+    default:
+        return FALSE;
+    }
+}
+
+/* ReplaceWithTemp - replace an expression with a local set to its value in front of a statement
+   (returns FALSE if there is no room in the frame for another local) */
+static int ReplaceWithTemp(ParseContext *c, TempList *temps, ParseTreeNode *node)
+{
+    ParseTreeNode *function = c->function;
+    NodeListEntry *entry;
+    int offset;
+
+    /* reuse the local of an identical expression */
+    for (entry = temps->first; entry != NULL && entry != *temps->pNextEntry; entry = entry->next)
+        if (SameExpr(entry->node->u.letStatement.rvalue, node))
+            break;
+    if (entry != NULL && entry != *temps->pNextEntry)
+        offset = entry->node->u.letStatement.lvalue->u.localRef.offset;
+
+    /* otherwise, set a new local to the value */
+    else {
+        ParseTreeNode *let, *var, *expr;
+
+        /* make sure there is room in the frame */
+        if (F_SIZE + function->u.functionDefinition.localOffset >= MAX_HOIST_FRAME)
+            return FALSE;
+        offset = -F_SIZE - function->u.functionDefinition.localOffset - 1;
+        ++function->u.functionDefinition.localOffset;
+
+        /* make 'LET local = expr' */
+        expr = NewParseTreeNode(c, node->nodeType);
+        *expr = *node;
+        var = NewParseTreeNode(c, NodeTypeLocalRef);
+        var->type = node->type;
+        var->u.localRef.offset = offset;
+        let = NewParseTreeNode(c, NodeTypeLetStatement);
+        let->line = node->line;
+        let->u.letStatement.lvalue = var;
+        let->u.letStatement.rvalue = expr;
+
+        /* insert it in front of the statement */
+        entry = (NodeListEntry *)xbLocalAlloc(c->sys, sizeof(NodeListEntry));
+        entry->node = let;
+        entry->next = *temps->pNextEntry;
+        *temps->pNextEntry = entry;
+        temps->pNextEntry = &entry->next;
+        if (!temps->first)
+            temps->first = entry;
+    }
+
+    /* replace the expression with the local */
+    node->nodeType = NodeTypeLocalRef;
+    node->u.localRef.offset = offset;
+    return TRUE;
+}
+
+/* IsRegister - check whether a node refers to a hardware register */
+static int IsRegister(ParseTreeNode *node)
+{
+    return node->nodeType == NodeTypeGlobalRef && node->u.globalRef.symbol->storageClass == SC_COG;
+}
+
+/* ExprWeight - estimate the number of instructions needed to evaluate an expression */
+static int ExprWeight(ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeIntegerLit:
+    case NodeTypeStringLit:
+    case NodeTypeArrayLit:
+    case NodeTypeLocalRef:
+    case NodeTypeGlobalRef:
+        return 1;
+    case NodeTypeUnaryOp:
+        return 1 + ExprWeight(node->u.unaryOp.expr);
+    case NodeTypeBinaryOp:
+        return 1 + ExprWeight(node->u.binaryOp.left) + ExprWeight(node->u.binaryOp.right);
+    case NodeTypeArrayRef:
+        /* scaling the index and adding it to the address of the array */
+        return 2 + ExprWeight(node->u.arrayRef.array) + ExprWeight(node->u.arrayRef.index);
+    default:
+        return 0;
+    }
+}
+
+/* SameExpr - check whether two expressions are the same */
+static int SameExpr(ParseTreeNode *expr1, ParseTreeNode *expr2)
+{
+    if (expr1->nodeType != expr2->nodeType)
+        return FALSE;
+    switch (expr1->nodeType) {
+    case NodeTypeIntegerLit:
+        return expr1->u.integerLit.value == expr2->u.integerLit.value;
+    case NodeTypeStringLit:
+        return expr1->u.stringLit.string == expr2->u.stringLit.string;
+    case NodeTypeArrayLit:
+        return expr1->u.arrayLit.symbol == expr2->u.arrayLit.symbol;
+    case NodeTypeLocalRef:
+        return expr1->u.localRef.offset == expr2->u.localRef.offset;
+    case NodeTypeGlobalRef:
+        return expr1->u.globalRef.symbol == expr2->u.globalRef.symbol;
+    case NodeTypeUnaryOp:
+        return expr1->u.unaryOp.op == expr2->u.unaryOp.op
+            && SameExpr(expr1->u.unaryOp.expr, expr2->u.unaryOp.expr);
+    case NodeTypeBinaryOp:
+        return expr1->u.binaryOp.op == expr2->u.binaryOp.op
+            && SameExpr(expr1->u.binaryOp.left, expr2->u.binaryOp.left)
+            && SameExpr(expr1->u.binaryOp.right, expr2->u.binaryOp.right);
+    case NodeTypeArrayRef:
+        return expr1->type == expr2->type
+            && SameExpr(expr1->u.arrayRef.array, expr2->u.arrayRef.array)
+            && SameExpr(expr1->u.arrayRef.index, expr2->u.arrayRef.index);
+    default:
+        return FALSE;
+    }
+}
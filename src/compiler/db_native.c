@@ -0,0 +1,960 @@
+/* db_native.c - LMM code generation for NATIVE functions
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * A function defined with NATIVE runs as LMM code, PASM instructions in hub
+ * memory that the kernel in the hub VM cog fetches and executes one at a time.
+ * Its bytecode is a stub that enters the LMM code and returns the value the
+ * code leaves in tos.  The arguments and locals are kept in the kernel's
+ * registers and expressions are evaluated in t1 to t4 so only integer, byte
+ * and array code without calls or division can be compiled this way.  A
+ * function that uses anything else is compiled to bytecode with a warning.
+ *
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include "db_compiler.h"
+
+/* the stub is FRAME n d, SLIT 0, NATIVE jmp #LMM_ENTER and RETURN or RET n */
+#define STUB_NATIVE     5       /* offset of the NATIVE instruction */
+#define STUB_NATIVE_END 10      /* offset of the end of the NATIVE instruction */
+
+/* temporary registers for evaluating expressions (t1 to t4) */
+#define TEMP_COUNT      4
+
+/* largest immediate operand */
+#define MAX_IMMEDIATE   511
+
+/* most bits in a constant multiplier that is done with shifts and adds */
+#define MAX_MULTIPLY_BITS   4
+
+/* condition field of an instruction (a long with it clear runs as a nop) */
+#define COND_MASK       0x003c0000
+
+/* LMM code label */
+typedef struct {
+    int defined;                /* the label has been placed */
+    VMUVALUE offset;            /* offset of the label in the LMM code */
+    VMUVALUE fixups;            /* chain of far jump targets (LMM offset + 1 or zero at the end) */
+} NativeLabel;
+
+/* LMM code generation state */
+typedef struct {
+    ParseContext *c;
+    jmp_buf failTarget;         /* target for code that can't be compiled */
+    const char *reason;         /* why the code can't be compiled */
+    int emit;                   /* store the code rather than just count it */
+    VMUVALUE start;             /* offset of the LMM code in the code buffer */
+    VMUVALUE addr;              /* VM address of the LMM code */
+    VMUVALUE size;              /* size of the LMM code so far */
+    int offsets[LMM_REG_COUNT]; /* frame offset of the variable in each register */
+    int regCount;               /* number of registers in use */
+} NativeState;
+
+/* compare operators with the conditions for true and false after CMPS */
+static struct {
+    int op;
+    char *ifTrue;
+    char *ifFalse;
+} compareConds[] = {
+{   OP_LT,  "if_c",         "if_nc"         },
+{   OP_LE,  "if_c_or_z",    "if_nc_and_nz"  },
+{   OP_EQ,  "if_z",         "if_nz"         },
+{   OP_NE,  "if_nz",        "if_z"          },
+{   OP_GE,  "if_nc",        "if_c"          },
+{   OP_GT,  "if_nc_and_nz", "if_c_or_z"     },
+{   0,      NULL,           NULL            }
+};
+
+static void InitState(NativeState *s, ParseContext *c);
+static void GenFunction(NativeState *s);
+static void CollectVariables(ParseContext *c, ParseTreeNode *node, void *cookie);
+static void GenStatementList(NativeState *s, NodeListEntry *entry);
+static void GenStatement(NativeState *s, ParseTreeNode *node);
+static void GenLet(NativeState *s, ParseTreeNode *lvalue, ParseTreeNode *rvalue);
+static void GenIf(NativeState *s, ParseTreeNode *node);
+static void GenFor(NativeState *s, ParseTreeNode *node);
+static void GenTestLoop(NativeState *s, ParseTreeNode *node, int testFirst, int sense);
+static void GenReturn(NativeState *s, ParseTreeNode *node);
+static void GenExpr(NativeState *s, ParseTreeNode *expr, int t);
+static void GenUnaryOp(NativeState *s, ParseTreeNode *expr, int t);
+static void GenBinaryOp(NativeState *s, ParseTreeNode *expr, int t);
+static char *GenCompare(NativeState *s, ParseTreeNode *expr, int t, int sense);
+static void GenShortCircuit(NativeState *s, ParseTreeNode *expr, int t);
+static void GenBranch(NativeState *s, ParseTreeNode *expr, int sense, NativeLabel *label);
+static void GenAddress(NativeState *s, ParseTreeNode *expr, int t);
+static void GenAccess(NativeState *s, Type *type, char *value, int t, int store);
+static int GenConstantMultiply(NativeState *s, ParseTreeNode *expr, VMVALUE k, int t);
+static void GenMultiply(NativeState *s, int a, int b);
+static void GenConstant(NativeState *s, char *dst, VMVALUE value);
+static char *GenOperand(NativeState *s, ParseTreeNode *expr, int t, char *buf);
+static char *GenRegister(NativeState *s, ParseTreeNode *expr, int t, char *buf);
+static VMUVALUE GlobalAddress(NativeState *s, Symbol *sym);
+static int CogRegister(Symbol *sym);
+static ParseTreeNode *NewBinaryOp(NativeState *s, int op, ParseTreeNode *left, ParseTreeNode *right);
+static void CheckType(NativeState *s, Type *type);
+static char *Variable(NativeState *s, ParseTreeNode *expr, char *buf);
+static char *Temp(NativeState *s, int t, char *buf);
+static int IsLocal(ParseTreeNode *expr, ParseTreeNode *var);
+static void DefineLabel(NativeState *s, NativeLabel *label);
+static void Jump(NativeState *s, char *cond, NativeLabel *label);
+static void Emit(NativeState *s, char *fmt, ...);
+static void EmitLong(NativeState *s, VMUVALUE value);
+static void StoreLong(NativeState *s, VMUVALUE value);
+static void Fail(NativeState *s, const char *reason);
+
+/* CheckNativeFunction - check that the current function can be compiled to LMM code
+   (returns FALSE with a warning if it can't, otherwise sets nativeSize to the size of the code) */
+int CheckNativeFunction(ParseContext *c)
+{
+    Symbol *symbol = c->function->u.functionDefinition.symbol;
+    NativeState s;
+
+    InitState(&s, c);
+    if (setjmp(s.failTarget) != 0) {
+        xbInfo(c->sys, "warning: %s: %s, compiling it to bytecode\n", symbol->name, s.reason);
+        return FALSE;
+    }
+
+    /* only the hub VM has the LMM kernel */
+    if (c->config->cacheDriver)
+        Fail(&s, "native code needs a board without a cache driver");
+    if (symbol->section->base >= COG_BASE)
+        Fail(&s, "native code must be in hub memory");
+
+    /* count the code */
+    GenFunction(&s);
+    c->nativeSize = s.size;
+
+    return TRUE;
+}
+
+/* AppendNativeCode - add the LMM code of the current function after its stub now that the
+   function's VM address is known (returns the size of the stub and the LMM code) */
+VMUVALUE AppendNativeCode(ParseContext *c, VMUVALUE addr)
+{
+    NativeState s;
+
+    /* the kernel starts the code at the first long at least two bytes past the NATIVE instruction */
+    if (c->cptr - c->codeBuf <= STUB_NATIVE || c->codeBuf[STUB_NATIVE] != OP_NATIVE)
+        Fatal(c, "unexpected native function stub");
+    InitState(&s, c);
+    s.emit = TRUE;
+    s.addr = (addr + STUB_NATIVE_END + 2 + ALIGN_MASK) & ~ALIGN_MASK;
+    while (addr + codeaddr(c) < s.addr)
+        putcbyte(c, OP_HALT);
+    s.start = codeaddr(c);
+
+    /* the code was checked when the stub was generated */
+    if (setjmp(s.failTarget) != 0)
+        Fatal(c, "native code generation failed: %s", s.reason);
+    GenFunction(&s);
+    if (s.size != c->nativeSize)
+        Fatal(c, "native code size changed");
+
+    return codeaddr(c);
+}
+
+/* InitState - initialize the code generation state */
+static void InitState(NativeState *s, ParseContext *c)
+{
+    s->c = c;
+    s->reason = NULL;
+    s->emit = FALSE;
+    s->start = 0;
+    s->addr = 0;
+    s->size = 0;
+    s->regCount = 0;
+}
+
+/* GenFunction - generate the code for the current function */
+static void GenFunction(NativeState *s)
+{
+    ParseContext *c = s->c;
+    char reg[16];
+    int r;
+
+    /* give each argument and local that the body uses a register */
+    VisitChildren(c, c->function, CollectVariables, s);
+
+    /* the registers overlay the FCACHE buffer so whatever block is in it is lost */
+    Emit(s, "neg lmm_tag,#1");
+
+    /* load the arguments from the frame and clear the locals */
+    for (r = 0; r < s->regCount; ++r) {
+        sprintf(reg, "lmm_r%d", r);
+        if (s->offsets[r] >= 0) {
+            Emit(s, "mov %s,fp", reg);
+            if (s->offsets[r] > 0)
+                Emit(s, "add %s,#%d", reg, s->offsets[r] * (int)sizeof(VMVALUE));
+            Emit(s, "rdlong %s,%s", reg, reg);
+        }
+        else
+            Emit(s, "mov %s,#0", reg);
+    }
+
+    /* generate the body and return zero if it runs off the end */
+    GenStatementList(s, c->function->u.functionDefinition.bodyStatements);
+    Emit(s, "mov tos,#0");
+    Emit(s, "jmp #lmm_ret");
+}
+
+/* CollectVariables - give each variable in a tree a register */
+static void CollectVariables(ParseContext *c, ParseTreeNode *node, void *cookie)
+{
+    NativeState *s = (NativeState *)cookie;
+    int r;
+
+    if (node->nodeType == NodeTypeLocalRef) {
+        for (r = 0; r < s->regCount; ++r)
+            if (s->offsets[r] == node->u.localRef.offset)
+                return;
+        if (s->regCount >= LMM_REG_COUNT)
+            Fail(s, "native code can't use more than 8 arguments and locals");
+        s->offsets[s->regCount++] = node->u.localRef.offset;
+    }
+    else
+        VisitChildren(c, node, CollectVariables, cookie);
+}
+
+/* GenStatementList - generate code for a list of statements */
+static void GenStatementList(NativeState *s, NodeListEntry *entry)
+{
+    for (; entry != NULL; entry = entry->next)
+        GenStatement(s, entry->node);
+}
+
+/* GenStatement - generate code for a statement */
+static void GenStatement(NativeState *s, ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeLetStatement:
+        GenLet(s, node->u.letStatement.lvalue, node->u.letStatement.rvalue);
+        break;
+    case NodeTypeIfStatement:
+        GenIf(s, node);
+        break;
+    case NodeTypeForStatement:
+        GenFor(s, node);
+        break;
+    case NodeTypeDoWhileStatement:
+        GenTestLoop(s, node, TRUE, TRUE);
+        break;
+    case NodeTypeDoUntilStatement:
+        GenTestLoop(s, node, TRUE, FALSE);
+        break;
+    case NodeTypeLoopStatement:
+        GenTestLoop(s, node, FALSE, TRUE);
+        break;
+    case NodeTypeLoopWhileStatement:
+        GenTestLoop(s, node, FALSE, TRUE);
+        break;
+    case NodeTypeLoopUntilStatement:
+        GenTestLoop(s, node, FALSE, FALSE);
+        break;
+    case NodeTypeReturnStatement:
+        GenReturn(s, node);
+        break;
+    case NodeTypeCallStatement:
+        Fail(s, "native code can't make function calls");
+        break;
+    case NodeTypeSelectStatement:
+    case NodeTypeCaseStatement:
+        Fail(s, "native code can't use SELECT");
+        break;
+    case NodeTypeLabelDefinition:
+    case NodeTypeGotoStatement:
+        Fail(s, "native code can't use GOTO or labels");
+        break;
+    case NodeTypeEndStatement:
+        Fail(s, "native code can't use END or STOP");
+        break;
+    case NodeTypeAsmStatement:
+        Fail(s, "native code can't use inline assembly");
+        break;
+    default:
+        Fail(s, "native code can't use this statement");
+        break;
+    }
+}
+
+/* GenLet - generate code for an assignment */
+static void GenLet(NativeState *s, ParseTreeNode *lvalue, ParseTreeNode *rvalue)
+{
+    char dst[16], src[16], addr[16];
+    Symbol *sym;
+    char *inst;
+
+    CheckType(s, lvalue->type);
+    switch (lvalue->nodeType) {
+    case NodeTypeLocalRef:
+        Variable(s, lvalue, dst);
+
+        /* update the register in place for 'var = var op value' */
+        if (rvalue->nodeType == NodeTypeBinaryOp && IsLocal(rvalue->u.binaryOp.left, lvalue)) {
+            switch (rvalue->u.binaryOp.op) {
+            case OP_ADD:    inst = "add";   break;
+            case OP_SUB:    inst = "sub";   break;
+            case OP_BAND:   inst = "and";   break;
+            case OP_BOR:    inst = "or";    break;
+            case OP_BXOR:   inst = "xor";   break;
+            case OP_SHL:    inst = "shl";   break;
+            case OP_SHR:    inst = "sar";   break;
+            default:        inst = NULL;    break;
+            }
+            if (inst) {
+                GenOperand(s, rvalue->u.binaryOp.right, 1, src);
+                Emit(s, "%s %s,%s", inst, dst, src);
+                return;
+            }
+        }
+
+        /* load constants straight into the register */
+        if (rvalue->nodeType == NodeTypeIntegerLit)
+            GenConstant(s, dst, rvalue->u.integerLit.value);
+        else
+            Emit(s, "mov %s,%s", dst, GenOperand(s, rvalue, 1, src));
+        break;
+    case NodeTypeGlobalRef:
+        sym = lvalue->u.globalRef.symbol;
+        if (sym->storageClass == SC_COG)
+            Emit(s, "mov %d,%s", CogRegister(sym), GenOperand(s, rvalue, 1, src));
+        else {
+            GenRegister(s, rvalue, 1, src);
+            GenConstant(s, Temp(s, 2, addr), (VMVALUE)GlobalAddress(s, sym));
+            GenAccess(s, lvalue->type, src, 2, TRUE);
+        }
+        break;
+    case NodeTypeArrayRef:
+        GenRegister(s, rvalue, 1, src);
+        GenAddress(s, lvalue, 2);
+        GenAccess(s, lvalue->type, src, 2, TRUE);
+        break;
+    default:
+        Fail(s, "native code can't use this statement");
+        break;
+    }
+}
+
+/* GenIf - generate code for an IF statement */
+static void GenIf(NativeState *s, ParseTreeNode *node)
+{
+    NativeLabel nxt = { FALSE, 0, 0 }, end = { FALSE, 0, 0 };
+    GenBranch(s, node->u.ifStatement.test, FALSE, &nxt);
+    GenStatementList(s, node->u.ifStatement.thenStatements);
+    if (node->u.ifStatement.elseStatements) {
+        Jump(s, "", &end);
+        DefineLabel(s, &nxt);
+        GenStatementList(s, node->u.ifStatement.elseStatements);
+        DefineLabel(s, &end);
+    }
+    else
+        DefineLabel(s, &nxt);
+}
+
+/* GenFor - generate code for a FOR statement
+   (like the bytecode the variable is stepped and compared with the limit after each pass) */
+static void GenFor(NativeState *s, ParseTreeNode *node)
+{
+    ParseTreeNode *var = node->u.forStatement.var;
+    ParseTreeNode *step = node->u.forStatement.stepExpr;
+    NativeLabel top = { FALSE, 0, 0 }, test = { FALSE, 0, 0 };
+
+    GenLet(s, var, node->u.forStatement.startExpr);
+    Jump(s, "", &test);
+    DefineLabel(s, &top);
+    GenStatementList(s, node->u.forStatement.bodyStatements);
+    if (!step) {
+        step = NewParseTreeNode(s->c, NodeTypeIntegerLit);
+        step->type = &s->c->integerType;
+        step->u.integerLit.value = 1;
+    }
+    GenLet(s, var, NewBinaryOp(s, OP_ADD, var, step));
+    DefineLabel(s, &test);
+    GenBranch(s, NewBinaryOp(s, OP_LE, var, node->u.forStatement.endExpr), TRUE, &top);
+}
+
+/* GenTestLoop - generate code for a DO or LOOP statement with the test at the bottom
+   (a DO WHILE or DO UNTIL loop jumps to the test first, a plain LOOP has no test) */
+static void GenTestLoop(NativeState *s, ParseTreeNode *node, int testFirst, int sense)
+{
+    NativeLabel top = { FALSE, 0, 0 }, test = { FALSE, 0, 0 };
+    if (testFirst)
+        Jump(s, "", &test);
+    DefineLabel(s, &top);
+    GenStatementList(s, node->u.loopStatement.bodyStatements);
+    DefineLabel(s, &test);
+    if (node->u.loopStatement.test)
+        GenBranch(s, node->u.loopStatement.test, sense, &top);
+    else
+        Jump(s, "", &top);
+}
+
+/* GenReturn - generate code for a RETURN statement */
+static void GenReturn(NativeState *s, ParseTreeNode *node)
+{
+    ParseTreeNode *expr = node->u.returnStatement.expr;
+    char src[16];
+    if (!expr)
+        Emit(s, "mov tos,#0");
+    else if (expr->nodeType == NodeTypeIntegerLit)
+        GenConstant(s, "tos", expr->u.integerLit.value);
+    else
+        Emit(s, "mov tos,%s", GenOperand(s, expr, 1, src));
+    Emit(s, "jmp #lmm_ret");
+}
+
+/* GenExpr - generate code to leave the value of an expression in a temporary register */
+static void GenExpr(NativeState *s, ParseTreeNode *expr, int t)
+{
+    char dst[16], reg[16];
+    Type *elementType;
+    ParseTreeNode *target;
+    Symbol *sym;
+
+    CheckType(s, expr->type);
+    Temp(s, t, dst);
+    switch (expr->nodeType) {
+    case NodeTypeIntegerLit:
+        GenConstant(s, dst, expr->u.integerLit.value);
+        break;
+    case NodeTypeLocalRef:
+        Emit(s, "mov %s,%s", dst, Variable(s, expr, reg));
+        break;
+    case NodeTypeGlobalRef:
+        sym = expr->u.globalRef.symbol;
+        if (sym->storageClass == SC_COG)
+            Emit(s, "mov %s,%d", dst, CogRegister(sym));
+        else {
+            GenConstant(s, dst, (VMVALUE)GlobalAddress(s, sym));
+            GenAccess(s, expr->type, dst, t, FALSE);
+        }
+        break;
+    case NodeTypeArrayLit:
+        GenConstant(s, dst, (VMVALUE)GlobalAddress(s, expr->u.arrayLit.symbol));
+        break;
+    case NodeTypeArrayRef:
+        /* a row of a multi-dimensional array is just its address */
+        GenAddress(s, expr, t);
+        elementType = expr->u.arrayRef.array->type->u.arrayInfo.elementType;
+        if (elementType->id != TYPE_ARRAY)
+            GenAccess(s, elementType, dst, t, FALSE);
+        break;
+    case NodeTypeAddressOf:
+        target = expr->u.addressOf.expr;
+        if (target->type->id == TYPE_POINTER || target->type->id == TYPE_ARRAY)
+            GenExpr(s, target, t);
+        else if (target->nodeType == NodeTypeArrayRef)
+            GenAddress(s, target, t);
+        else if (target->nodeType == NodeTypeGlobalRef) {
+            sym = target->u.globalRef.symbol;
+            GenConstant(s, dst, sym->storageClass == SC_COG ? (VMVALUE)sym->v.variable.offset : (VMVALUE)GlobalAddress(s, sym));
+        }
+        else
+            Fail(s, "native code can't take the address of a local variable");
+        break;
+    case NodeTypeUnaryOp:
+        GenUnaryOp(s, expr, t);
+        break;
+    case NodeTypeBinaryOp:
+        GenBinaryOp(s, expr, t);
+        break;
+    case NodeTypeConjunction:
+    case NodeTypeDisjunction:
+        GenShortCircuit(s, expr, t);
+        break;
+    case NodeTypeFunctionCall:
+        Fail(s, "native code can't make function calls");
+        break;
+    case NodeTypeFunctionLit:
+        Fail(s, "native code can't use function values");
+        break;
+    case NodeTypeStringLit:
+        Fail(s, "native code can't use strings");
+        break;
+    default:
+        Fail(s, "native code can't use this expression");
+        break;
+    }
+}
+
+/* GenUnaryOp - generate code for a unary operator */
+static void GenUnaryOp(NativeState *s, ParseTreeNode *expr, int t)
+{
+    GenExpr(s, expr->u.unaryOp.expr, t);
+    switch (expr->u.unaryOp.op) {
+    case OP_NEG:
+        Emit(s, "neg t%d,t%d", t, t);
+        break;
+    case OP_BNOT:
+        Emit(s, "neg t%d,t%d", t, t);
+        Emit(s, "sub t%d,#1", t);
+        break;
+    case OP_NOT:
+        Emit(s, "cmp t%d,#0 wz", t);
+        Emit(s, "mov t%d,#0", t);
+        Emit(s, "if_z mov t%d,#1", t);
+        break;
+    default:
+        Fail(s, "native code can't use fixed point or float values");
+        break;
+    }
+}
+
+/* GenBinaryOp - generate code for a binary operator */
+static void GenBinaryOp(NativeState *s, ParseTreeNode *expr, int t)
+{
+    ParseTreeNode *left = expr->u.binaryOp.left, *right = expr->u.binaryOp.right;
+    char src[16], *inst, *cond;
+
+    switch (expr->u.binaryOp.op) {
+    case OP_ADD:    inst = "add";   break;
+    case OP_SUB:    inst = "sub";   break;
+    case OP_BAND:   inst = "and";   break;
+    case OP_BOR:    inst = "or";    break;
+    case OP_BXOR:   inst = "xor";   break;
+    case OP_SHL:    inst = "shl";   break;
+    case OP_SHR:    inst = "sar";   break;
+    case OP_MUL:
+        if (IsIntegerLit(left) && GenConstantMultiply(s, right, left->u.integerLit.value, t))
+            return;
+        if (IsIntegerLit(right) && GenConstantMultiply(s, left, right->u.integerLit.value, t))
+            return;
+        GenExpr(s, left, t);
+        GenExpr(s, right, t + 1);
+        GenMultiply(s, t, t + 1);
+        return;
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+        cond = GenCompare(s, expr, t, TRUE);
+        Emit(s, "mov t%d,#0", t);
+        Emit(s, "%s mov t%d,#1", cond, t);
+        return;
+    case OP_DIV:
+    case OP_REM:
+        Fail(s, "native code can't divide");
+        return;
+    default:
+        Fail(s, "native code can't use fixed point or float values");
+        return;
+    }
+
+    GenExpr(s, left, t);
+    Emit(s, "%s t%d,%s", inst, t, GenOperand(s, right, t + 1, src));
+}
+
+/* GenCompare - generate a signed compare and get the condition that is met if the result is sense */
+static char *GenCompare(NativeState *s, ParseTreeNode *expr, int t, int sense)
+{
+    char dst[16], src[16];
+    int i;
+    GenRegister(s, expr->u.binaryOp.left, t, dst);
+    Emit(s, "cmps %s,%s wz,wc", dst, GenOperand(s, expr->u.binaryOp.right, t + 1, src));
+    for (i = 0; compareConds[i].op != expr->u.binaryOp.op; ++i)
+        ;
+    return sense ? compareConds[i].ifTrue : compareConds[i].ifFalse;
+}
+
+/* GenShortCircuit - generate code for AND or OR (the value that decides the result is the result) */
+static void GenShortCircuit(NativeState *s, ParseTreeNode *expr, int t)
+{
+    NativeLabel end = { FALSE, 0, 0 };
+    NodeListEntry *entry = expr->u.exprList.exprs;
+    GenExpr(s, entry->node, t);
+    while ((entry = entry->next) != NULL) {
+        Emit(s, "cmp t%d,#0 wz", t);
+        Jump(s, expr->nodeType == NodeTypeConjunction ? "if_z" : "if_nz", &end);
+        GenExpr(s, entry->node, t);
+    }
+    DefineLabel(s, &end);
+}
+
+/* GenBranch - generate a branch to a label taken if an expression is true (sense TRUE) or false */
+static void GenBranch(NativeState *s, ParseTreeNode *expr, int sense, NativeLabel *label)
+{
+    NativeLabel skip = { FALSE, 0, 0 };
+    NodeListEntry *entry;
+    char reg[16];
+    int direct;
+
+    switch (expr->nodeType) {
+    case NodeTypeIntegerLit:
+        if ((expr->u.integerLit.value != 0) == sense)
+            Jump(s, "", label);
+        return;
+    case NodeTypeUnaryOp:
+        if (expr->u.unaryOp.op == OP_NOT) {
+            GenBranch(s, expr->u.unaryOp.expr, !sense, label);
+            return;
+        }
+        break;
+    case NodeTypeBinaryOp:
+        switch (expr->u.binaryOp.op) {
+        case OP_LT:
+        case OP_LE:
+        case OP_EQ:
+        case OP_NE:
+        case OP_GE:
+        case OP_GT:
+            Jump(s, GenCompare(s, expr, 1, sense), label);
+            return;
+        }
+        break;
+    case NodeTypeConjunction:
+    case NodeTypeDisjunction:
+        /* a false term decides an AND and a true term decides an OR */
+        direct = (expr->nodeType == NodeTypeConjunction) ? !sense : sense;
+        for (entry = expr->u.exprList.exprs; entry->next != NULL; entry = entry->next)
+            GenBranch(s, entry->node, direct ? sense : !sense, direct ? label : &skip);
+        GenBranch(s, entry->node, sense, label);
+        DefineLabel(s, &skip);
+        return;
+    default:
+        break;
+    }
+
+    Emit(s, "cmp %s,#0 wz", GenRegister(s, expr, 1, reg));
+    Jump(s, sense ? "if_nz" : "if_z", label);
+}
+
+/* GenAddress - generate code to leave the VM address of an array element in a temporary register */
+static void GenAddress(NativeState *s, ParseTreeNode *expr, int t)
+{
+    Type *elementType = expr->u.arrayRef.array->type->u.arrayInfo.elementType;
+    VMUVALUE size = ValueByteSize(elementType);
+    ParseTreeNode *index = expr->u.arrayRef.index;
+    char tmp[16];
+    VMVALUE offset;
+    int shift;
+
+    GenExpr(s, expr->u.arrayRef.array, t);
+
+    /* fold a constant index into the offset */
+    if (IsIntegerLit(index)) {
+        offset = index->u.integerLit.value * (VMVALUE)size;
+        if (offset > 0 && offset <= MAX_IMMEDIATE)
+            Emit(s, "add t%d,#%d", t, (int)offset);
+        else if (offset < 0 && offset >= -MAX_IMMEDIATE)
+            Emit(s, "sub t%d,#%d", t, (int)-offset);
+        else if (offset != 0) {
+            GenConstant(s, Temp(s, t + 1, tmp), offset);
+            Emit(s, "add t%d,%s", t, tmp);
+        }
+        return;
+    }
+
+    /* scale the index with a shift if the size is a power of two */
+    for (shift = 0; ((VMUVALUE)1 << shift) < size; ++shift)
+        ;
+    if (((VMUVALUE)1 << shift) == size) {
+        if (shift == 0 && index->nodeType == NodeTypeLocalRef) {
+            Emit(s, "add t%d,%s", t, Variable(s, index, tmp));
+            return;
+        }
+        GenExpr(s, index, t + 1);
+        if (shift > 0)
+            Emit(s, "shl t%d,#%d", t + 1, shift);
+    }
+    else {
+        GenExpr(s, index, t + 1);
+        GenConstant(s, Temp(s, t + 2, tmp), (VMVALUE)size);
+        GenMultiply(s, t + 1, t + 2);
+    }
+    Emit(s, "add t%d,t%d", t, t + 1);
+}
+
+/* GenAccess - generate a load or store of a value at the VM address in a temporary register */
+static void GenAccess(NativeState *s, Type *type, char *value, int t, int store)
+{
+    char *size;
+    switch (type->id) {
+    case TYPE_BYTE:
+        size = "byte";
+        break;
+    case TYPE_WORD:
+        size = "word";
+        break;
+    default:
+        size = "long";
+        break;
+    }
+    Emit(s, "add t%d,base", t);
+    Emit(s, "%s%s %s,t%d", store ? "wr" : "rd", size, value, t);
+}
+
+/* GenConstantMultiply - generate code to multiply by a constant with a few bits set using shifts and adds
+   (returns FALSE if the constant has too many bits set) */
+static int GenConstantMultiply(NativeState *s, ParseTreeNode *expr, VMVALUE k, int t)
+{
+    VMUVALUE magnitude = k < 0 ? (VMUVALUE)0 - (VMUVALUE)k : (VMUVALUE)k;
+    int bits = 0, bit, last = -1;
+    char tmp[16];
+
+    for (bit = 0; bit < 32; ++bit)
+        if (magnitude & ((VMUVALUE)1 << bit))
+            ++bits;
+    if (bits > MAX_MULTIPLY_BITS)
+        return FALSE;
+
+    /* the next temporary holds the value shifted to each bit in turn */
+    GenExpr(s, expr, t);
+    if (bits > 1)
+        Temp(s, t + 1, tmp);
+    if (bits == 0)
+        Emit(s, "mov t%d,#0", t);
+    for (bit = 0; bit < 32; ++bit) {
+        if (!(magnitude & ((VMUVALUE)1 << bit)))
+            continue;
+        if (last < 0) {
+            if (bits > 1)
+                Emit(s, "mov t%d,t%d", t + 1, t);
+            if (bit > 0)
+                Emit(s, "shl t%d,#%d", t, bit);
+            if (bits > 1 && bit > 0)
+                Emit(s, "shl t%d,#%d", t + 1, bit);
+        }
+        else {
+            Emit(s, "shl t%d,#%d", t + 1, bit - last);
+            Emit(s, "add t%d,t%d", t, t + 1);
+        }
+        last = bit;
+    }
+    if (k < 0)
+        Emit(s, "neg t%d,t%d", t, t);
+    return TRUE;
+}
+
+/* GenMultiply - generate code to multiply two temporary registers leaving the product in the first
+   (it adds the first shifted left once for each bit shifted out of the second until none are left) */
+static void GenMultiply(NativeState *s, int a, int b)
+{
+    Emit(s, "mov lmm_k,#0");
+    Emit(s, "shr t%d,#1 wz,wc", b);
+    Emit(s, "if_c add lmm_k,t%d", a);
+    Emit(s, "shl t%d,#1", a);
+    Emit(s, "if_nz sub lmm_pc,#16");
+    Emit(s, "mov t%d,lmm_k", a);
+}
+
+/* GenConstant - generate code to load a constant into a register
+   (a long whose condition field is clear runs as a nop so it can follow the RDLONG that loads it) */
+static void GenConstant(NativeState *s, char *dst, VMVALUE value)
+{
+    if (value >= 0 && value <= MAX_IMMEDIATE)
+        Emit(s, "mov %s,#%d", dst, (int)value);
+    else if (value < 0 && value >= -MAX_IMMEDIATE)
+        Emit(s, "neg %s,#%d", dst, (int)-value);
+    else if (((VMUVALUE)value & COND_MASK) == 0) {
+        Emit(s, "rdlong %s,lmm_pc", dst);
+        EmitLong(s, (VMUVALUE)value);
+    }
+    else {
+        Emit(s, "jmp #lmm_ldi");
+        EmitLong(s, (VMUVALUE)value);
+        Emit(s, "mov %s,lmm_k", dst);
+    }
+}
+
+/* GenOperand - get the source operand for an expression
+   (a small constant is an immediate and a variable is its register, anything else is
+    evaluated into a temporary register) */
+static char *GenOperand(NativeState *s, ParseTreeNode *expr, int t, char *buf)
+{
+    if (IsIntegerLit(expr) && expr->u.integerLit.value >= 0 && expr->u.integerLit.value <= MAX_IMMEDIATE) {
+        sprintf(buf, "#%d", (int)expr->u.integerLit.value);
+        return buf;
+    }
+    return GenRegister(s, expr, t, buf);
+}
+
+/* GenRegister - get a register holding the value of an expression
+   (a variable is its register, anything else is evaluated into a temporary register) */
+static char *GenRegister(NativeState *s, ParseTreeNode *expr, int t, char *buf)
+{
+    if (expr->nodeType == NodeTypeLocalRef)
+        return Variable(s, expr, buf);
+    GenExpr(s, expr, t);
+    return Temp(s, t, buf);
+}
+
+/* GlobalAddress - get the VM address of a global variable in hub memory */
+static VMUVALUE GlobalAddress(NativeState *s, Symbol *sym)
+{
+    VMUVALUE offset = sym->v.variable.offset, addr;
+    if (offset == UNDEF_VALUE)
+        Fail(s, "native code can't use a variable that hasn't been placed");
+    switch (sym->storageClass) {
+    case SC_CONSTANT:
+    case SC_GLOBAL:
+        addr = sym->section ? sym->section->base + offset : offset;
+        break;
+    case SC_HUB:
+        addr = offset;
+        break;
+    default:
+        addr = COG_BASE;
+        break;
+    }
+    if (addr >= COG_BASE)
+        Fail(s, "native code can't use variables outside hub memory");
+    return addr;
+}
+
+/* CogRegister - get the register number of a cog variable */
+static int CogRegister(Symbol *sym)
+{
+    return (int)((sym->v.variable.offset - COG_BASE) / sizeof(VMVALUE));
+}
+
+/* NewBinaryOp - make a binary operator node */
+static ParseTreeNode *NewBinaryOp(NativeState *s, int op, ParseTreeNode *left, ParseTreeNode *right)
+{
+    ParseTreeNode *node = NewParseTreeNode(s->c, NodeTypeBinaryOp);
+    node->type = &s->c->integerType;
+    node->u.binaryOp.op = op;
+    node->u.binaryOp.left = left;
+    node->u.binaryOp.right = right;
+    return node;
+}
+
+/* CheckType - make sure a value can be handled by native code */
+static void CheckType(NativeState *s, Type *type)
+{
+    if (type) {
+        switch (type->id) {
+        case TYPE_FIXED:
+        case TYPE_FLOAT:
+            Fail(s, "native code can't use fixed point or float values");
+            break;
+        case TYPE_STRING:
+            Fail(s, "native code can't use strings");
+            break;
+        case TYPE_FUNCTION:
+            Fail(s, "native code can't use function values");
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/* Variable - get the register holding an argument or local */
+static char *Variable(NativeState *s, ParseTreeNode *expr, char *buf)
+{
+    int r;
+    for (r = 0; r < s->regCount; ++r)
+        if (s->offsets[r] == expr->u.localRef.offset) {
+            sprintf(buf, "lmm_r%d", r);
+            return buf;
+        }
+    Fatal(s->c, "native code variable not found");
+    return NULL; /* not reached */
+}
+
+/* Temp - get the name of a temporary register */
+static char *Temp(NativeState *s, int t, char *buf)
+{
+    if (t > TEMP_COUNT)
+        Fail(s, "native code can't nest expressions this deeply");
+    sprintf(buf, "t%d", t);
+    return buf;
+}
+
+/* IsLocal - check whether an expression is a particular local variable */
+static int IsLocal(ParseTreeNode *expr, ParseTreeNode *var)
+{
+    return expr->nodeType == NodeTypeLocalRef && expr->u.localRef.offset == var->u.localRef.offset;
+}
+
+/* DefineLabel - place a label at the current position and fix up the far jumps to it */
+static void DefineLabel(NativeState *s, NativeLabel *label)
+{
+    VMUVALUE link, next, target = s->addr + s->size;
+    uint8_t *p;
+    int i;
+    label->defined = TRUE;
+    label->offset = s->size;
+    if (s->emit) {
+        for (link = label->fixups; link != 0; link = next) {
+            p = s->c->codeBuf + s->start + link - 1;
+            next = p[0] | (p[1] << 8) | (p[2] << 16) | ((VMUVALUE)p[3] << 24);
+            for (i = 0; i < (int)sizeof(VMUVALUE); ++i)
+                p[i] = (uint8_t)(target >> (i * 8));
+        }
+    }
+    label->fixups = 0;
+}
+
+/* Jump - generate a jump to a label
+   (a short jump back subtracts from the LMM pc, a far jump has its target in the next
+    long and runs it as a nop if the jump isn't taken) */
+static void Jump(NativeState *s, char *cond, NativeLabel *label)
+{
+    VMUVALUE disp;
+    if (label->defined) {
+        disp = s->size + sizeof(VMUVALUE) - label->offset;
+        if (disp <= MAX_IMMEDIATE)
+            Emit(s, "%s sub lmm_pc,#%d", cond, (int)disp);
+        else {
+            Emit(s, "%s jmp #lmm_jmp", cond);
+            EmitLong(s, s->addr + label->offset);
+        }
+    }
+    else {
+        Emit(s, "%s jmp #lmm_jmp", cond);
+        disp = s->size + 1;
+        EmitLong(s, label->fixups);
+        label->fixups = disp;
+    }
+}
+
+/* Emit - assemble an instruction and add it to the code (the assembler expects a whole line) */
+static void Emit(NativeState *s, char *fmt, ...)
+{
+    char line[64];
+    uint32_t value;
+    va_list ap;
+    if (s->emit) {
+        va_start(ap, fmt);
+        vsprintf(line, fmt, ap);
+        va_end(ap);
+        strcat(line, "\n");
+        if (!PasmAssemble1(s->c->pasmTables, line, &value))
+            Fatal(s->c, "native assembly failed: %s", line);
+        if (s->c->flags & COMPILER_DEBUG)
+            xbInfo(s->c->sys, "%08x %08x  %s", s->addr + s->size, value, line);
+        StoreLong(s, value);
+    }
+    s->size += sizeof(VMUVALUE);
+}
+
+/* EmitLong - add a data long to the code */
+static void EmitLong(NativeState *s, VMUVALUE value)
+{
+    if (s->emit) {
+        if (s->c->flags & COMPILER_DEBUG)
+            xbInfo(s->c->sys, "%08x %08x  long\n", s->addr + s->size, value);
+        StoreLong(s, value);
+    }
+    s->size += sizeof(VMUVALUE);
+}
+
+/* StoreLong - store a long in the code buffer in hub byte order */
+static void StoreLong(NativeState *s, VMUVALUE value)
+{
+    int i;
+    for (i = 0; i < (int)sizeof(VMUVALUE); ++i)
+        putcbyte(s->c, (uint8_t)(value >> (i * 8)));
+}
+
+/* Fail - give up on compiling the function to native code */
+static void Fail(NativeState *s, const char *reason)
+{
+    s->reason = reason;
+    longjmp(s->failTarget, 1);
+}
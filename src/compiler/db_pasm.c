@@ -5,6 +5,7 @@
 #include <setjmp.h>
 #include <string.h>
 #include <ctype.h>
+#include "db_hash.h"
 
 #ifndef TRUE
 #define TRUE        1
@@ -51,6 +52,7 @@ typedef struct Symbol Symbol;
 typedef struct {
     Symbol *head;
     Symbol **pTail;
+    HashTable index;
 } SymbolTable;
 
 /* symbol types */
@@ -62,33 +64,12 @@ typedef enum {
 /* symbol structure */
 struct Symbol {
     Symbol *next;
+    HashEntry hashEntry;
     SymbolType type;
     VMVALUE value;
     char name[1];
 };
 
-typedef void RewindFcn(void *cookie);
-typedef int GetLineFcn(void *cookie, char *buf, int len, int *pLineNumber);
-
-/* parse context */
-typedef struct {
-    jmp_buf errorTarget;            /* error target */
-    RewindFcn *rewind;              /* scan - function to rewind to the start of the source program */
-    GetLineFcn *getLine;            /* scan - function to get a line from the source program */
-    void *getLineCookie;            /* scan - cookie for the rewind and getLine functions */
-    char lineBuf[MAXLINE];          /* scan - line buffer */
-    char *linePtr;                  /* scan - pointer to the current character */
-    int lineNumber;                 /* scan - current line number */
-    int savedToken;               /* scan - lookahead token */
-    int tokenOffset;                /* scan - offset to the start of the current token */
-    char token[MAXTOKEN];           /* scan - current token string */
-    VMVALUE value;                  /* scan - current token integer value */
-    int inComment;                  /* scan - inside of a slash/star comment */
-    SymbolTable globals;            /* global symbol table */
-    SymbolTable locals;             /* local symbol table */
-    int pass;                       /* current pass number */
-} ParseContext;
-
 /* operand types */
 enum {
     OPERANDS_NONE,
@@ -193,10 +174,7 @@ static OpDef opcodeDefs[] = {
 };
 
 /* keyword table */
-static struct {
-    char *keyword;
-    int token;
-} asmktab[] = {
+static Keyword asmktab[] = {
 {   NULL,           0       }
 };
 
@@ -254,6 +232,100 @@ static FieldDef fieldDefs[] = {
 {   NULL,           0,              0,                  0               }
 };
 
+/* predefined register definition structure */
+typedef struct {
+    char *name;
+    VMVALUE value;
+} RegisterDef;
+
+/* predefined registers (the LMM_xxx addresses must match the ones in db_image.h) */
+static RegisterDef registerDefs[] = {
+{   "t1",           0x001   },
+{   "t2",           0x002   },
+{   "t3",           0x003   },
+{   "t4",           0x004   },
+{   "tos",          0x005   },
+{   "base",         0x006   },
+{   "sp",           0x007   },
+{   "fp",           0x008   },
+{   "lmm_pc",       0x00a   },  // the LMM kernel of the hub VM
+{   "lmm_k",        0x00b   },
+{   "lmm_r0",       0x00c   },
+{   "lmm_r1",       0x00d   },
+{   "lmm_r2",       0x00e   },
+{   "lmm_r3",       0x00f   },
+{   "lmm_r4",       0x010   },
+{   "lmm_r5",       0x011   },
+{   "lmm_r6",       0x012   },
+{   "lmm_r7",       0x013   },
+{   "lmm_fcache",   0x00b   },
+{   "lmm_tag",      0x015   },
+{   "lmm_enter",    0x016   },
+{   "lmm_call",     0x01a   },
+{   "lmm_jmp",      0x020   },
+{   "lmm_ldi",      0x023   },
+{   "lmm_ret",      0x026   },
+{   "par",          0x1f0   },
+{   "cnt",          0x1f1   },
+{   "ina",          0x1f2   },
+{   "inb",          0x1f3   },
+{   "outa",         0x1f4   },
+{   "outb",         0x1f5   },
+{   "dira",         0x1f6   },
+{   "dirb",         0x1f7   },
+{   "ctra",         0x1f8   },
+{   "ctrb",         0x1f9   },
+{   "frqa",         0x1fa   },
+{   "frqb",         0x1fb   },
+{   "phsa",         0x1fc   },
+{   "phsb",         0x1fd   },
+{   "vcfg",         0x1fe   },
+{   "vscl",         0x1ff   },
+{   NULL,           0       }
+};
+
+/* opcode, field, keyword and register indexes (built once and shared by every line assembled with them) */
+typedef struct PasmTables PasmTables;
+struct PasmTables {
+    HashTable opcodeIndex;          /* opcode index */
+    HashTable fieldIndex;           /* condition and effect field index */
+    HashTable keywordIndex;         /* keyword index */
+    HashTable registerIndex;        /* predefined register index */
+    HashEntry opcodeEntries[sizeof(opcodeDefs) / sizeof(OpDef)];       /* opcode index entries */
+    HashEntry fieldEntries[sizeof(fieldDefs) / sizeof(FieldDef)];      /* field index entries */
+    HashEntry keywordEntries[sizeof(asmktab) / sizeof(Keyword)];       /* keyword index entries */
+    HashEntry registerEntries[sizeof(registerDefs) / sizeof(RegisterDef)]; /* register index entries */
+};
+
+typedef int GetLineFcn(void *cookie, char *buf, int len, int *pLineNumber);
+
+/* parse context */
+typedef struct {
+    jmp_buf errorTarget;            /* error target */
+    PasmTables *tables;             /* opcode, field, keyword and register indexes */
+    GetLineFcn *getLine;            /* scan - function to get a line from the source program */
+    void *getLineCookie;            /* scan - cookie for the getLine function */
+    char *lineCache;                /* scan - lines read on the first pass (a line number and a string each) */
+    size_t lineCacheSize;           /* scan - size of the line cache */
+    size_t lineCacheLength;         /* scan - bytes of the line cache in use */
+    size_t lineCacheOffset;         /* scan - offset of the next line the second pass reads */
+    char lineCacheBuf[MAXLINE + sizeof(int)];   /* scan - line cache until it needs more room */
+    char lineBuf[MAXLINE];          /* scan - line buffer */
+    char *linePtr;                  /* scan - pointer to the current character */
+    int lineNumber;                 /* scan - current line number */
+    int savedToken;               /* scan - lookahead token */
+    int tokenOffset;                /* scan - offset to the start of the current token */
+    char token[MAXTOKEN];           /* scan - current token string */
+    VMVALUE value;                  /* scan - current token integer value */
+    int inComment;                  /* scan - inside of a slash/star comment */
+    SymbolTable globals;            /* global symbol table */
+    SymbolTable locals;             /* local symbol table */
+    int pass;                       /* current pass number */
+} ParseContext;
+
+size_t PasmTablesSize(void);
+void PasmIndexTables(PasmTables *tables);
+
 static int Assemble(ParseContext *c);
 static void ParseFile(ParseContext *c, int pass);
 static VMVALUE ParseExpr(ParseContext *c);
@@ -265,9 +337,11 @@ static VMVALUE ParseExpr6(ParseContext *c);
 static VMVALUE ParseExpr7(ParseContext *c);
 static VMVALUE ParsePrimary(ParseContext *c);
 static int GetLine(ParseContext *c);
+static void CacheLine(ParseContext *c, int lineNumber);
+static void FreeLineCache(ParseContext *c);
 static void FRequire(ParseContext *c, int requiredToken);
 static void Require(ParseContext *c, int token, int requiredToken);
-static char *TokenName(int token);
+static char *TokenName(int token, char *nameBuf);
 static int GetIdentifier(ParseContext *c, char *errtext);
 static int GetToken(ParseContext *c);
 static void SaveToken(ParseContext *c, int token);
@@ -286,8 +360,9 @@ static int BinaryNumberToken(ParseContext *c);
 static int StringToken(ParseContext *c);
 static int CharToken(ParseContext *c);
 static void ParseError(ParseContext *c, char *fmt, ...);
-static OpDef *FindOpcode(char *name);
-static FieldDef *FindField(char *name);
+static OpDef *FindOpcode(ParseContext *c, char *name);
+static FieldDef *FindField(ParseContext *c, char *name);
+static RegisterDef *FindRegister(ParseContext *c, const char *name);
 static void InitSymbolTable(SymbolTable *table);
 static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMVALUE value);
 static Symbol *FindSymbol(ParseContext *c, const char *name);
@@ -297,7 +372,6 @@ static void DumpSymbols(SymbolTable *table);
 #endif
 static void putcword(ParseContext *c, VMVALUE w);
 
-static void SourceRewind(void *cookie);
 static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber);
 
 #ifdef MAIN
@@ -311,6 +385,7 @@ int main(int argc, char *argv[])
 {
     ParseContext context;
     SourceInfo sourceInfo;
+    PasmTables tables;
     
     /* check the argument count */
     if (argc != 2) {
@@ -327,9 +402,10 @@ int main(int argc, char *argv[])
     
     /* initialize the parse context */
     memset(&context, 0, sizeof(context));
+    PasmIndexTables(&tables);
+    context.tables = &tables;
     
     /* setup the parser callbacks */
-    context.rewind = SourceRewind;
     context.getLine = SourceGetLine;
     context.getLineCookie = &sourceInfo;
     
@@ -342,12 +418,6 @@ int main(int argc, char *argv[])
     return 0;
 }
 
-static void SourceRewind(void *cookie)
-{
-    SourceInfo *info = (SourceInfo *)cookie;
-    fseek(info->fp, 0, SEEK_SET);
-}
-
 static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber)
 {
     SourceInfo *info = (SourceInfo *)cookie;
@@ -369,10 +439,12 @@ typedef struct {
     uint32_t *pValue;
 } SourceInfo;
 
-int PasmAssemble1(char *line, uint32_t *pValue)
+/* PasmAssemble1 - assemble a line with indexes PasmIndexTables has built */
+int PasmAssemble1(PasmTables *tables, char *line, uint32_t *pValue)
 {
     ParseContext context;
     SourceInfo sourceInfo;
+    int result;
 
     /* setup the source */
     sourceInfo.line = line;
@@ -382,21 +454,17 @@ int PasmAssemble1(char *line, uint32_t *pValue)
 
     /* initialize the parse context */
     memset(&context, 0, sizeof(context));
+    context.tables = tables;
     
     /* setup the parser callbacks */
-    context.rewind = SourceRewind;
     context.getLine = SourceGetLine;
     context.getLineCookie = &sourceInfo;
     
-    /* assemble the line */
-    return Assemble(&context);
-}
-
-static void SourceRewind(void *cookie)
-{
-    SourceInfo *info = (SourceInfo *)cookie;
-    info->line = info->line;
-    info->eof = FALSE;
+    /* assemble the line (the compiler assembles a line at a time so free the symbols each time) */
+    result = Assemble(&context);
+    EmptySymbolTable(&context.globals);
+    EmptySymbolTable(&context.locals);
+    return result;
 }
 
 static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber)
@@ -419,43 +487,49 @@ static void putcword(ParseContext *c, VMVALUE w)
 
 #endif
 
+/* PasmTablesSize - get the size of the assembler indexes */
+size_t PasmTablesSize(void)
+{
+    return sizeof(PasmTables);
+}
+
+/* PasmIndexTables - build the opcode, field, keyword and register indexes */
+void PasmIndexTables(PasmTables *tables)
+{
+    int i;
+    InitHashTable(&tables->opcodeIndex);
+    for (i = 0; opcodeDefs[i].opname != NULL; ++i)
+        AddHashEntry(&tables->opcodeIndex, &tables->opcodeEntries[i], opcodeDefs[i].opname, &opcodeDefs[i]);
+    InitHashTable(&tables->fieldIndex);
+    for (i = 0; fieldDefs[i].keyword != NULL; ++i)
+        AddHashEntry(&tables->fieldIndex, &tables->fieldEntries[i], fieldDefs[i].keyword, &fieldDefs[i]);
+    IndexKeywords(&tables->keywordIndex, asmktab, tables->keywordEntries);
+    InitHashTable(&tables->registerIndex);
+    for (i = 0; registerDefs[i].name != NULL; ++i)
+        AddHashEntry(&tables->registerIndex, &tables->registerEntries[i], registerDefs[i].name, &registerDefs[i]);
+}
+
 static int Assemble(ParseContext *c)
 {
+    /* the first pass caches the lines for the second */
+    c->lineCache = c->lineCacheBuf;
+    c->lineCacheSize = sizeof(c->lineCacheBuf);
+    c->lineCacheLength = 0;
+    c->lineCacheOffset = 0;
+
 	/* setup an error target */
-    if (setjmp(c->errorTarget) != 0)
+    if (setjmp(c->errorTarget) != 0) {
+        FreeLineCache(c);
         return FALSE;
+    }
 
     /* initialize the symbol tables */
     InitSymbolTable(&c->globals);
     InitSymbolTable(&c->locals);
     
-    /* add the initial globals */
-    AddSymbol(c, "t1",    SYMBOL_VALUE, 0x001);
-    AddSymbol(c, "t2",    SYMBOL_VALUE, 0x002);
-    AddSymbol(c, "t3",    SYMBOL_VALUE, 0x003);
-    AddSymbol(c, "t4",    SYMBOL_VALUE, 0x004);
-    AddSymbol(c, "tos",   SYMBOL_VALUE, 0x005);
-    AddSymbol(c, "base",  SYMBOL_VALUE, 0x006);
-    AddSymbol(c, "par",   SYMBOL_VALUE, 0x1f0);
-    AddSymbol(c, "cnt",   SYMBOL_VALUE, 0x1f1);
-    AddSymbol(c, "ina",   SYMBOL_VALUE, 0x1f2);
-    AddSymbol(c, "inb",   SYMBOL_VALUE, 0x1f3);
-    AddSymbol(c, "outa",  SYMBOL_VALUE, 0x1f4);
-    AddSymbol(c, "outb",  SYMBOL_VALUE, 0x1f5);
-    AddSymbol(c, "dira",  SYMBOL_VALUE, 0x1f6);
-    AddSymbol(c, "dirb",  SYMBOL_VALUE, 0x1f7);
-    AddSymbol(c, "ctra",  SYMBOL_VALUE, 0x1f8);
-    AddSymbol(c, "ctrb",  SYMBOL_VALUE, 0x1f9);
-    AddSymbol(c, "frqa",  SYMBOL_VALUE, 0x1fa);
-    AddSymbol(c, "frqb",  SYMBOL_VALUE, 0x1fb);
-    AddSymbol(c, "phsa",  SYMBOL_VALUE, 0x1fc);
-    AddSymbol(c, "phsb",  SYMBOL_VALUE, 0x1fd);
-    AddSymbol(c, "vcfg",  SYMBOL_VALUE, 0x1fe);
-    AddSymbol(c, "vscl",  SYMBOL_VALUE, 0x1ff);
-    
     ParseFile(c, 1);
-    (*c->rewind)(c->getLineCookie);
     ParseFile(c, 2);
+    FreeLineCache(c);
     
 #ifdef MAIN
     DumpSymbols(&c->globals);
@@ -484,10 +558,10 @@ static void ParseFile(ParseContext *c, int pass)
         if ((tkn = GetIdentifier(c, "expecting a label, a conditional, or an opcode")) != T_EOL) {
         
             /* check for an opcode */
-            if (!(odef = FindOpcode(c->token))) {
+            if (!(odef = FindOpcode(c, c->token))) {
             
                 /* check for a conditional */
-                if (!(fdef = FindField(c->token))) {
+                if (!(fdef = FindField(c, c->token))) {
                 
                     /* handle a label */
                     sym = AddSymbol(c, c->token, SYMBOL_VALUE, lc);
@@ -497,21 +571,21 @@ static void ParseFile(ParseContext *c, int pass)
                         continue;
                         
                     /* check again for an opcode */
-                    if (!(odef = FindOpcode(c->token))) {
+                    if (!(odef = FindOpcode(c, c->token))) {
                     
                         /* check for a conditional */
-                        if (!(fdef = FindField(c->token)))
+                        if (!(fdef = FindField(c, c->token)))
                             ParseError(c, "Expecting a conditional or an opcode");
                             
                         /* get an opcode */
-                        if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c->token)))
+                        if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c, c->token)))
                             ParseError(c, "Expecting an opcode");
                     }
                 }
                 
                 /* parse an opcode after a conditional */
                 else {
-                    if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c->token)))
+                    if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c, c->token)))
                         ParseError(c, "Expecting an opcode");
                 }
             }
@@ -561,7 +635,7 @@ static void ParseFile(ParseContext *c, int pass)
             
             /* parse any flag operations */
             while ((tkn = GetIdentifier(c, "expecting effects")) != T_EOL) {
-                if (!(fdef = FindField(c->token)) || fdef->type != FIELD_EFFECT)
+                if (!(fdef = FindField(c, c->token)) || fdef->type != FIELD_EFFECT)
                     ParseError(c, "expecting effects");
                 inst = (inst & ~fdef->mask) | fdef->value;
                 if ((tkn = GetToken(c)) != ',')
@@ -719,6 +793,7 @@ static VMVALUE ParseExpr7(ParseContext *c)
 /* ParsePrimary - parse a primary expression */
 static VMVALUE ParsePrimary(ParseContext *c)
 {
+    RegisterDef *reg;
     VMVALUE expr;
     Symbol *sym;
     switch (GetToken(c)) {
@@ -730,9 +805,12 @@ static VMVALUE ParsePrimary(ParseContext *c)
         expr = c->value;
         break;
     case T_IDENTIFIER:
-        if (!(sym = FindSymbol(c, c->token)))
-            sym = AddSymbol(c, c->token, SYMBOL_UNDEF, 0);
-        expr = sym->value;
+        if ((sym = FindSymbol(c, c->token)) != NULL)
+            expr = sym->value;
+        else if ((reg = FindRegister(c, c->token)) != NULL)
+            expr = reg->value;
+        else
+            expr = AddSymbol(c, c->token, SYMBOL_UNDEF, 0)->value;
         break;
     default:
         ParseError(c, "Expecting a primary expression");
@@ -743,18 +821,66 @@ static VMVALUE ParsePrimary(ParseContext *c)
     return expr;
 }
 
-/* GetLine - get the next input line */
+/* GetLine - get the next input line (the second pass reads the lines the first one cached) */
 static int GetLine(ParseContext *c)
 {
+    char *line;
     int lineNumber;
-    if (!(*c->getLine)(c->getLineCookie, c->lineBuf, sizeof(c->lineBuf), &lineNumber))
-        return FALSE;
+    if (c->pass == 1) {
+        if (!(*c->getLine)(c->getLineCookie, c->lineBuf, sizeof(c->lineBuf), &lineNumber))
+            return FALSE;
+        CacheLine(c, lineNumber);
+    }
+    else {
+        if (c->lineCacheOffset >= c->lineCacheLength)
+            return FALSE;
+        line = c->lineCache + c->lineCacheOffset;
+        memcpy(&lineNumber, line, sizeof(int));
+        strcpy(c->lineBuf, line + sizeof(int));
+        c->lineCacheOffset += sizeof(int) + strlen(c->lineBuf) + 1;
+    }
     c->lineNumber = lineNumber;
     c->linePtr = c->lineBuf;
     c->savedToken = T_NONE;
     return TRUE;
 }
 
+/* CacheLine - add the line in the line buffer to the line cache */
+static void CacheLine(ParseContext *c, int lineNumber)
+{
+    size_t size = sizeof(int) + strlen(c->lineBuf) + 1, newSize;
+    char *newCache;
+    
+    /* grow the cache (it starts in the parse context) */
+    if (c->lineCacheLength + size > c->lineCacheSize) {
+        newSize = c->lineCacheSize * 2;
+        if (newSize < c->lineCacheLength + size)
+            newSize = c->lineCacheLength + size;
+        if (c->lineCache == c->lineCacheBuf) {
+            if ((newCache = (char *)malloc(newSize)) != NULL)
+                memcpy(newCache, c->lineCache, c->lineCacheLength);
+        }
+        else
+            newCache = (char *)realloc(c->lineCache, newSize);
+        if (!newCache)
+            ParseError(c, "insufficient memory");
+        c->lineCache = newCache;
+        c->lineCacheSize = newSize;
+    }
+    
+    memcpy(c->lineCache + c->lineCacheLength, &lineNumber, sizeof(int));
+    strcpy(c->lineCache + c->lineCacheLength + sizeof(int), c->lineBuf);
+    c->lineCacheLength += size;
+}
+
+/* FreeLineCache - free the line cache if it outgrew the parse context */
+static void FreeLineCache(ParseContext *c)
+{
+    if (c->lineCache != c->lineCacheBuf)
+        free(c->lineCache);
+    c->lineCache = c->lineCacheBuf;
+}
+
 /* FRequire - fetch a token and check it */
 static void FRequire(ParseContext *c, int requiredToken)
 {
@@ -764,17 +890,16 @@ static void FRequire(ParseContext *c, int requiredToken)
 /* Require - check for a required token */
 static void Require(ParseContext *c, int token, int requiredToken)
 {
-    char tknbuf[MAXTOKEN];
+    char tknbuf[MAXTOKEN], nameBuf[4];
     if (token != requiredToken) {
-        strcpy(tknbuf, TokenName(requiredToken));
-        ParseError(c, "Expecting '%s', found '%s'", tknbuf, TokenName(token));
+        strcpy(tknbuf, TokenName(requiredToken, nameBuf));
+        ParseError(c, "Expecting '%s', found '%s'", tknbuf, TokenName(token, nameBuf));
     }
 }
 
-/* TokenName - get the name of a token */
-static char *TokenName(int token)
+/* TokenName - get the name of a token (nameBuf holds the name of a character token) */
+static char *TokenName(int token, char *nameBuf)
 {
-    static char nameBuf[4];
     char *name;
 
     switch (token) {
@@ -934,13 +1059,13 @@ static int NextToken(ParseContext *c)
 /* IdentifierToken - get an identifier */
 static int IdentifierToken(ParseContext *c, int ch)
 {
-    int len, i;
+    int len, tkn;
     char *p;
 
     /* get the identifier */
     p = c->token; *p++ = ch; len = 1;
     while ((ch = GetChar(c)) != EOF && IdentifierCharP(ch)) {
-        if (++len > MAXTOKEN)
+        if (++len >= MAXTOKEN)
             ParseError(c, "Identifier too long");
         *p++ = ch;
     }
@@ -948,9 +1073,8 @@ static int IdentifierToken(ParseContext *c, int ch)
     *p = '\0';
 
     /* check to see if it is a keyword */
-    for (i = 0; asmktab[i].keyword != NULL; ++i)
-        if (strcasecmp(asmktab[i].keyword, c->token) == 0)
-            return asmktab[i].token;
+    if ((tkn = FindKeyword(&c->tables->keywordIndex, c->token)) != 0)
+        return tkn;
 
     /* otherwise, it is an identifier */
     return T_IDENTIFIER;
@@ -1043,7 +1167,7 @@ static int StringToken(ParseContext *c)
     /* collect the string */
     p = c->token; len = 0;
     while ((ch = XGetC(c)) != EOF && ch != '"') {
-        if (++len > MAXTOKEN)
+        if (++len >= MAXTOKEN)
             ParseError(c, "String too long");
         *p++ = (ch == '\\' ? LiteralChar(c) : ch);
     }
@@ -1204,27 +1328,21 @@ static void ParseError(ParseContext *c, char *fmt, ...)
 }
 
 /* FindOpcode - find an opcode definition */
-static OpDef *FindOpcode(char *name)
+static OpDef *FindOpcode(ParseContext *c, char *name)
 {
-    OpDef *def = opcodeDefs;
-    while (def->opname != NULL) {
-        if (strcasecmp(name, def->opname) == 0)
-            return def;
-        ++def;
-    }
-    return NULL;
+    return (OpDef *)FindHashEntry(&c->tables->opcodeIndex, name);
 }
 
 /* FindField - find a field definition */
-static FieldDef *FindField(char *name)
+static FieldDef *FindField(ParseContext *c, char *name)
 {
-    FieldDef *def = fieldDefs;
-    while (def->keyword != NULL) {
-        if (strcasecmp(name, def->keyword) == 0)
-            return def;
-        ++def;
-    }
-    return NULL;
+    return (FieldDef *)FindHashEntry(&c->tables->fieldIndex, name);
+}
+
+/* FindRegister - find a predefined register */
+static RegisterDef *FindRegister(ParseContext *c, const char *name)
+{
+    return (RegisterDef *)FindHashEntry(&c->tables->registerIndex, name);
 }
 
 /* InitSymbolTable - initialize an assembler symbol table */
@@ -1232,6 +1350,7 @@ static void InitSymbolTable(SymbolTable *table)
 {
     table->head = NULL;
     table->pTail = &table->head;
+    InitHashTable(&table->index);
 }
 
 /* AddSymbol - add symbol to the assembler symbol table */
@@ -1260,6 +1379,7 @@ static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMV
     /* add it to the symbol table */
     *table->pTail = sym;
     table->pTail = &sym->next;
+    AddHashEntry(&table->index, &sym->hashEntry, sym->name, sym);
     
     /* return the symbol */
     return sym;
@@ -1271,30 +1391,24 @@ static Symbol *FindSymbol(ParseContext *c, const char *name)
     Symbol *sym;
     
     /* check the local symbol table */
-    for (sym = c->locals.head; sym != NULL; sym = sym->next) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-    }
+    if ((sym = (Symbol *)FindHashEntry(&c->locals.index, name)) != NULL)
+        return sym;
     
     /* check the global symbol table */
-    for (sym = c->globals.head; sym != NULL; sym = sym->next) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-    }
-    
-    /* not found */
-    return NULL;
+    return (Symbol *)FindHashEntry(&c->globals.index, name);
 }
 
 /* EmptySymbolTable - empty and reinitialize a symbol table */
 static void EmptySymbolTable(SymbolTable *table)
 {
     Symbol *sym, *next;
-    for (sym = table->head; sym != NULL; sym = next) {
-        next = sym->next;
-        free(sym);
+    if (table->head) {
+        for (sym = table->head; sym != NULL; sym = next) {
+            next = sym->next;
+            free(sym);
+        }
+        InitSymbolTable(table);
     }
-    InitSymbolTable(table);
 }
 
 #ifdef MAIN
@@ -0,0 +1,363 @@
+/* db_peep.c - peephole optimizer
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_compiler.h"
+#include "db_vmdebug.h"
+
+/* instruction being optimized */
+typedef struct {
+    VMUVALUE offset;        /* offset in the original code */
+    VMUVALUE newOffset;     /* offset in the optimized code */
+    int opcode;             /* opcode (possibly rewritten) */
+    int fmt;                /* operand format */
+    int length;             /* length */
+    VMVALUE value;          /* byte or signed byte operand */
+    int target;             /* index of the branch target instruction */
+    int refs;               /* number of branches to this instruction */
+    int deleted;            /* instruction has been removed */
+    int entry;              /* branch is an entry in a switch table */
+} PeepInsn;
+
+/* prototypes for local functions */
+static int ApplyPatterns(PeepInsn *insns, int count, int k);
+static int NextLive(PeepInsn *insns, int k);
+static int BranchTarget(PeepInsn *insns, int k);
+static void Retarget(PeepInsn *insns, int k, int target);
+static void DeleteInsn(PeepInsn *insns, int k);
+static uint8_t *PutWord(uint8_t *p, VMVALUE w, int size);
+
+/* OptimizeCode - apply peephole optimizations to the code in the bytecode buffer
+   (returns the number of bytes saved, leaves the code alone if it can't be fully decoded) */
+int OptimizeCode(ParseContext *c)
+{
+    VMUVALUE length = codeaddr(c), offset;
+    PeepInsn *insns, *insn;
+    int *index, count, changed, k;
+    uint8_t *buf, *p;
+    LocalFixup *fixup;
+    DebugLine *line;
+    Label *label;
+
+    /* allocate the instruction table and the offset index */
+    insns = (PeepInsn *)LocalAlloc(c, (length + 1) * sizeof(PeepInsn));
+    index = (int *)LocalAlloc(c, (length + 1) * sizeof(int));
+    for (offset = 0; offset <= length; ++offset)
+        index[offset] = -1;
+
+    /* decode the instructions */
+    for (count = 0, offset = 0; offset < length; offset += insn->length, ++count) {
+        insn = &insns[count];
+        memset(insn, 0, sizeof(PeepInsn));
+        insn->offset = offset;
+        insn->opcode = c->codeBuf[offset];
+        if ((insn->fmt = InstructionFormat(insn->opcode)) < 0)
+            return 0;
+        insn->length = InstructionLength(insn->fmt);
+        if (offset + insn->length > length)
+            return 0;
+        if (insn->fmt == FMT_SBYTE)
+            insn->value = (int8_t)c->codeBuf[offset + 1];
+        else if (insn->fmt == FMT_BYTE)
+            insn->value = c->codeBuf[offset + 1];
+        insn->target = -1;
+        index[offset] = count;
+    }
+    index[length] = count;
+    memset(&insns[count], 0, sizeof(PeepInsn));
+    insns[count].offset = length;
+    insns[count].opcode = -1;
+    insns[count].target = -1;
+
+    /* resolve the branch targets */
+    for (k = 0; k < count; ++k) {
+        insn = &insns[k];
+        if (insn->fmt == FMT_BR) {
+            VMUVALUE target = insn->offset + insn->length + rd_cword(c, insn->offset + 1);
+            if (target > length || index[target] < 0)
+                return 0;
+            insn->target = index[target];
+            ++insns[insn->target].refs;
+        }
+        else if (IsLoopFormat(insn->fmt)) {
+            VMUVALUE target = insn->offset + insn->length + rd_cword(c, insn->offset + insn->length - sizeof(VMVALUE));
+            if (target > length || index[target] < 0)
+                return 0;
+            insn->target = index[target];
+            ++insns[insn->target].refs;
+        }
+        else if (IsBranchFormat(insn->fmt))
+            return 0; // already relaxed
+    }
+
+    /* the branches in a switch table must stay in place */
+    for (k = 0; k < count; ++k)
+        if (insns[k].opcode == OP_SWITCH) {
+            int j, last = k + 1 + insns[k].value;
+            if (last >= count)
+                return 0;
+            for (j = k + 1; j <= last; ++j) {
+                if (insns[j].opcode != OP_BR)
+                    return 0;
+                insns[j].entry = TRUE;
+            }
+        }
+
+    /* make sure the symbol fixup chains can be relinked
+       (none of the patterns remove the LIT, LOADA, STOREA or CALL instructions on them) */
+    for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next)
+        for (offset = fixup->chain; offset != 0; offset = rd_cword(c, offset))
+            if (index[offset - 1] < 0)
+                return 0;
+
+    /* apply the patterns until nothing changes */
+    do {
+        changed = FALSE;
+        for (k = NextLive(insns, 0); k < count; k = NextLive(insns, k + 1))
+            if (ApplyPatterns(insns, count, k))
+                changed = TRUE;
+    } while (changed);
+
+    /* compute the new instruction offsets (a deleted instruction moves to the next live one) */
+    for (offset = 0, k = 0; k < count; ++k) {
+        insns[k].newOffset = offset;
+        if (!insns[k].deleted)
+            offset += insns[k].length;
+    }
+    insns[count].newOffset = offset;
+
+    /* nothing to do if no instructions were removed */
+    if (offset == length)
+        return 0;
+
+    /* generate the optimized code */
+    buf = p = (uint8_t *)LocalAlloc(c, length);
+    for (k = 0; k < count; ++k) {
+        insn = &insns[k];
+        if (insn->deleted)
+            continue;
+        if (insn->fmt == FMT_BR) {
+            VMVALUE target = insns[BranchTarget(insns, k)].newOffset;
+            *p++ = insn->opcode;
+            p = PutWord(p, target - (VMVALUE)(insn->newOffset + insn->length), sizeof(VMVALUE));
+        }
+        else {
+            memcpy(p, &c->codeBuf[insn->offset], insn->length);
+            *p = insn->opcode;
+            p += insn->length;
+            if (IsLoopFormat(insn->fmt)) {
+                VMVALUE target = insns[BranchTarget(insns, k)].newOffset;
+                PutWord(p - sizeof(VMVALUE), target - (VMVALUE)(insn->newOffset + insn->length), sizeof(VMVALUE));
+            }
+        }
+    }
+
+    /* relink the symbol fixup chains using the new operand offsets */
+    for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next) {
+        VMUVALUE next;
+        for (offset = fixup->chain; offset != 0; offset = next) {
+            next = rd_cword(c, offset);
+            PutWord(&buf[insns[index[offset - 1]].newOffset + 1], next ? insns[index[next - 1]].newOffset + 1 : 0, sizeof(VMVALUE));
+        }
+        if (fixup->chain)
+            fixup->chain = insns[index[fixup->chain - 1]].newOffset + 1;
+    }
+
+    /* move the labels and the source lines */
+    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next)
+        if (label->state == LS_PLACED && label->offset <= length && index[label->offset] >= 0)
+            label->offset = insns[index[label->offset]].newOffset;
+    for (line = c->functionLines; line != NULL; line = line->next)
+        if (line->offset <= length && index[line->offset] >= 0)
+            line->offset = insns[index[line->offset]].newOffset;
+
+    /* replace the original code */
+    memcpy(c->codeBuf, buf, p - buf);
+    c->cptr = c->codeBuf + (p - buf);
+
+    /* return the number of bytes saved */
+    return (int)(length - (p - buf));
+}
+
+/* ApplyPatterns - try each of the patterns on the instructions starting at a live instruction
+   (only the first instruction of a pattern may be a branch target) */
+static int ApplyPatterns(PeepInsn *insns, int count, int k)
+{
+    PeepInsn *insn = &insns[k], *next, *next2;
+    int n, n2, target, i;
+
+    /* find the next two live instructions */
+    n = NextLive(insns, k + 1);
+    n2 = (insns[n].opcode < 0 ? n : NextLive(insns, n + 1));
+    next = &insns[n];
+    next2 = &insns[n2];
+
+    switch (insn->opcode) {
+
+    /* DUP; DROP -> nothing */
+    /* DUP; LSET n; DROP -> LSET n (also GSET, GSET16 and STOREA) */
+    case OP_DUP:
+        if (next->opcode == OP_DROP && !next->refs) {
+            DeleteInsn(insns, k);
+            DeleteInsn(insns, n);
+            return TRUE;
+        }
+        if ((next->opcode == OP_LSET || next->opcode == OP_GSET || next->opcode == OP_GSET16 || next->opcode == OP_STOREA) && !next->refs
+        &&  next2->opcode == OP_DROP && !next2->refs) {
+            DeleteInsn(insns, k);
+            DeleteInsn(insns, n2);
+            return TRUE;
+        }
+        break;
+
+    /* LREF n; DROP -> nothing */
+    /* LREF n; LSET n -> nothing (also GREF and GSET) */
+    case OP_LREF:
+    case OP_GREF:
+        if (insn->opcode == OP_LREF && next->opcode == OP_DROP && !next->refs) {
+            DeleteInsn(insns, k);
+            DeleteInsn(insns, n);
+            return TRUE;
+        }
+        if (next->opcode == (insn->opcode == OP_LREF ? OP_LSET : OP_GSET) && next->value == insn->value && !next->refs) {
+            DeleteInsn(insns, k);
+            DeleteInsn(insns, n);
+            return TRUE;
+        }
+        break;
+
+    /* NOT; BRT -> BRF and NOT; BRF -> BRT */
+    case OP_NOT:
+        if ((next->opcode == OP_BRT || next->opcode == OP_BRF) && !next->refs) {
+            next->opcode = (next->opcode == OP_BRT ? OP_BRF : OP_BRT);
+            DeleteInsn(insns, k);
+            return TRUE;
+        }
+        break;
+
+    /* SLIT n; DROP -> nothing */
+    /* SLIT 0; EQ; BRT -> BRF (also NE and BRF) */
+    case OP_SLIT:
+        if (next->opcode == OP_DROP && !next->refs) {
+            DeleteInsn(insns, k);
+            DeleteInsn(insns, n);
+            return TRUE;
+        }
+        if (insn->value == 0
+        &&  (next->opcode == OP_EQ || next->opcode == OP_NE) && !next->refs
+        &&  (next2->opcode == OP_BRT || next2->opcode == OP_BRF) && !next2->refs) {
+            if (next->opcode == OP_EQ)
+                next2->opcode = (next2->opcode == OP_BRT ? OP_BRF : OP_BRT);
+            DeleteInsn(insns, k);
+            DeleteInsn(insns, n);
+            return TRUE;
+        }
+        break;
+
+    /* branches */
+    case OP_BR:
+    case OP_BRT:
+    case OP_BRF:
+    case OP_BRTSC:
+    case OP_BRFSC:
+    case OP_BRLT:
+    case OP_BRLE:
+    case OP_BREQ:
+    case OP_BRNE:
+    case OP_BRGE:
+    case OP_BRGT:
+    case OP_BRLTZ:
+    case OP_BRLEZ:
+    case OP_BRGEZ:
+    case OP_BRGTZ:
+
+        /* skip over branches to unconditional branches */
+        target = BranchTarget(insns, k);
+        for (i = 0; insns[target].opcode == OP_BR && target != k && i < count; ++i)
+            target = BranchTarget(insns, target);
+        if (target != BranchTarget(insns, k)) {
+            Retarget(insns, k, target);
+            return TRUE;
+        }
+
+        /* BRT L1; BR L2; L1: -> BRF L2 (also BRF and the compare and branch opcodes) */
+        if (InvertBranch(insn->opcode) >= 0 && target == n2
+        &&  next->opcode == OP_BR && !next->refs && !next->entry) {
+            insn->opcode = InvertBranch(insn->opcode);
+            Retarget(insns, k, BranchTarget(insns, n));
+            DeleteInsn(insns, n);
+            return TRUE;
+        }
+
+        /* remove branches to the next instruction */
+        if (target == n && !insn->entry) {
+            switch (insn->opcode) {
+            case OP_BR:
+                DeleteInsn(insns, k);
+                return TRUE;
+            case OP_BRT:
+            case OP_BRF:
+            case OP_BRLTZ:
+            case OP_BRLEZ:
+            case OP_BRGEZ:
+            case OP_BRGTZ:
+                Retarget(insns, k, -1);
+                insn->opcode = OP_DROP;
+                insn->fmt = FMT_NONE;
+                insn->length = 1;
+                return TRUE;
+            }
+        }
+        break;
+    }
+
+    /* no pattern matched */
+    return FALSE;
+}
+
+/* NextLive - find the first instruction at or after an index that hasn't been deleted */
+static int NextLive(PeepInsn *insns, int k)
+{
+    while (insns[k].deleted)
+        ++k;
+    return k;
+}
+
+/* BranchTarget - get the live instruction that a branch lands on */
+static int BranchTarget(PeepInsn *insns, int k)
+{
+    return NextLive(insns, insns[k].target);
+}
+
+/* Retarget - change the target of a branch (-1 to make it no longer a branch) */
+static void Retarget(PeepInsn *insns, int k, int target)
+{
+    --insns[BranchTarget(insns, k)].refs;
+    if ((insns[k].target = target) >= 0)
+        ++insns[target].refs;
+}
+
+/* DeleteInsn - remove an instruction and move its branch references to the next one */
+static void DeleteInsn(PeepInsn *insns, int k)
+{
+    PeepInsn *insn = &insns[k];
+    if (insn->target >= 0)
+        Retarget(insns, k, -1);
+    insn->deleted = TRUE;
+    insns[NextLive(insns, k)].refs += insn->refs;
+    insn->refs = 0;
+}
+
+/* PutWord - store a big endian operand */
+static uint8_t *PutWord(uint8_t *p, VMVALUE w, int size)
+{
+    uint8_t *end = p + size;
+    while (--size >= 0) {
+        p[size] = w;
+        w >>= 8;
+    }
+    return end;
+}
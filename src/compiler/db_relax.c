@@ -0,0 +1,297 @@
+/* db_relax.c - branch and literal relaxation
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_compiler.h"
+#include "db_vmdebug.h"
+
+/* instruction being relaxed */
+typedef struct {
+    VMUVALUE offset;        /* offset in the original code */
+    VMUVALUE newOffset;     /* offset in the relaxed code */
+    int opcode;             /* original opcode */
+    int fmt;                /* original operand format */
+    int length;             /* original length */
+    int newLength;          /* relaxed length */
+    int target;             /* index of the branch target instruction */
+    VMVALUE value;          /* word operand */
+    int pinned;             /* operand is a link in a symbol fixup chain or a switch table entry */
+    PooledLiteral *pooled;  /* the literal is loaded from the constant pool */
+} RelaxInsn;
+
+/* check whether a value fits in a signed operand */
+#define FitsInByte(n)   ((n) >= -128 && (n) <= 127)
+#define FitsInHWord(n)  ((n) >= -32768 && (n) <= 32767)
+
+/* prototypes for local functions */
+static PooledLiteral *PoolLiteral(ParseContext *c, VMVALUE value, int add);
+static VMUVALUE NewOperandOffset(RelaxInsn *insns, int *index, VMUVALUE offset);
+static VMVALUE BranchDisplacement(RelaxInsn *insns, int k, int length);
+static uint8_t *PutWord(uint8_t *p, VMVALUE w, int size);
+
+/* RelaxCode - replace long branches and literals with their short forms
+   (returns FALSE and leaves the code alone if it can't be fully decoded) */
+int RelaxCode(ParseContext *c)
+{
+    VMUVALUE length = codeaddr(c), offset;
+    RelaxInsn *insns, *insn;
+    int *index, count, changed, k;
+    uint8_t *buf, *p;
+    LocalFixup *fixup;
+    DebugLine *line;
+    Label *label;
+
+    /* allocate the instruction table and the offset index */
+    insns = (RelaxInsn *)LocalAlloc(c, (length + 1) * sizeof(RelaxInsn));
+    index = (int *)LocalAlloc(c, (length + 1) * sizeof(int));
+    for (offset = 0; offset <= length; ++offset)
+        index[offset] = -1;
+
+    /* decode the instructions */
+    for (count = 0, offset = 0; offset < length; offset += insn->length, ++count) {
+        insn = &insns[count];
+        insn->offset = offset;
+        insn->opcode = c->codeBuf[offset];
+        if ((insn->fmt = InstructionFormat(insn->opcode)) < 0)
+            return FALSE;
+        insn->length = insn->newLength = InstructionLength(insn->fmt);
+        if (offset + insn->length > length)
+            return FALSE;
+        insn->value = (insn->length == 1 + sizeof(VMVALUE) ? rd_cword(c, offset + 1) : 0);
+        insn->target = -1;
+        insn->pinned = FALSE;
+        insn->pooled = NULL;
+        index[offset] = count;
+    }
+    index[length] = count;
+    insns[count].offset = length;
+
+    /* resolve the branch targets */
+    for (k = 0; k < count; ++k) {
+        insn = &insns[k];
+        if (insn->fmt == FMT_BR) {
+            VMUVALUE target = insn->offset + insn->length + insn->value;
+            if (target > length || index[target] < 0)
+                return FALSE;
+            insn->target = index[target];
+        }
+        else if (IsLoopFormat(insn->fmt)) {
+            VMUVALUE target = insn->offset + insn->length + rd_cword(c, insn->offset + insn->length - sizeof(VMVALUE));
+            if (target > length || index[target] < 0)
+                return FALSE;
+            insn->target = index[target];
+        }
+        else if (IsBranchFormat(insn->fmt))
+            return FALSE; // already relaxed
+    }
+
+    /* the branches in a switch table must keep their size */
+    for (k = 0; k < count; ++k)
+        if (insns[k].opcode == OP_SWITCH) {
+            int j, last = k + 1 + c->codeBuf[insns[k].offset + 1];
+            if (last >= count)
+                return FALSE;
+            for (j = k + 1; j <= last; ++j) {
+                if (insns[j].opcode != OP_BR)
+                    return FALSE;
+                insns[j].pinned = TRUE;
+            }
+        }
+
+    /* operands on a symbol fixup chain are filled in later and must keep their size */
+    for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next)
+        for (offset = fixup->chain; offset != 0; offset = rd_cword(c, offset)) {
+            if (index[offset - 1] < 0)
+                return FALSE;
+            insns[index[offset - 1]].pinned = TRUE;
+        }
+
+    /* shorten the literals whose values are known */
+    for (k = 0; k < count; ++k) {
+        insn = &insns[k];
+        if (insn->opcode == OP_LIT && !insn->pinned) {
+            if (FitsInByte(insn->value))
+                insn->newLength = 2;
+            else if (FitsInHWord(insn->value))
+                insn->newLength = 3;
+        }
+    }
+
+    /* load the long literals that are already in the constant pool or that are used more than once from the pool
+       (the pool is only used for optimized code whose global addresses are fixed) */
+    if ((c->flags & COMPILER_OPTIMIZE) && !(c->flags & COMPILER_INCREMENTAL) && !c->native) {
+        for (k = 0; k < count; ++k) {
+            insn = &insns[k];
+            if (insn->opcode == OP_LIT && !insn->pinned && insn->newLength == insn->length) {
+                int j, add = FALSE;
+                for (j = k + 1; j < count && !add; ++j)
+                    add = (insns[j].opcode == OP_LIT && !insns[j].pinned && insns[j].value == insn->value);
+                if ((insn->pooled = PoolLiteral(c, insn->value, add)) != NULL)
+                    insn->newLength = (insn->pooled->index <= 0xff ? 2 : 3);
+            }
+        }
+    }
+
+    /* shorten the unconditional branches until nothing changes
+       (branches only get shorter so the displacements only shrink) */
+    do {
+        changed = FALSE;
+        for (offset = 0, k = 0; k < count; ++k) {
+            insns[k].newOffset = offset;
+            offset += insns[k].newLength;
+        }
+        insns[count].newOffset = offset;
+        for (k = 0; k < count; ++k) {
+            insn = &insns[k];
+            if (insn->opcode == OP_BR && insn->newLength > 2 && !insn->pinned) {
+                int newLength = insn->newLength;
+                if (FitsInByte(BranchDisplacement(insns, k, 2)))
+                    newLength = 2;
+                else if (FitsInHWord(BranchDisplacement(insns, k, 3)))
+                    newLength = 3;
+                if (newLength != insn->newLength) {
+                    insn->newLength = newLength;
+                    changed = TRUE;
+                }
+            }
+        }
+    } while (changed);
+
+    /* nothing to do if no instructions were shortened */
+    if (insns[count].newOffset == length)
+        return TRUE;
+
+    /* generate the relaxed code */
+    buf = p = (uint8_t *)LocalAlloc(c, length);
+    for (k = 0; k < count; ++k) {
+        VMVALUE disp;
+        insn = &insns[k];
+        switch (insn->fmt) {
+        case FMT_BR:
+            disp = BranchDisplacement(insns, k, insn->newLength);
+            switch (insn->newLength) {
+            case 2:
+                *p++ = OP_BR8;
+                p = PutWord(p, disp, 1);
+                break;
+            case 3:
+                *p++ = OP_BR16;
+                p = PutWord(p, disp, 2);
+                break;
+            default:
+                *p++ = insn->opcode;
+                p = PutWord(p, disp, sizeof(VMVALUE));
+                break;
+            }
+            break;
+        case FMT_LOOP:
+        case FMT_LOOPA:
+            memcpy(p, &c->codeBuf[insn->offset], insn->length);
+            p += insn->length;
+            PutWord(p - sizeof(VMVALUE), BranchDisplacement(insns, k, insn->length), sizeof(VMVALUE));
+            break;
+        default:
+            if (insn->pooled) {
+                *p++ = (insn->newLength == 2 ? OP_GREF : OP_GREF16);
+                p = PutWord(p, insn->pooled->index, insn->newLength - 1);
+            }
+            else if (insn->opcode == OP_LIT && insn->newLength == 2) {
+                *p++ = OP_SLIT;
+                p = PutWord(p, insn->value, 1);
+            }
+            else if (insn->opcode == OP_LIT && insn->newLength == 3) {
+                *p++ = OP_LIT16;
+                p = PutWord(p, insn->value, 2);
+            }
+            else {
+                memcpy(p, &c->codeBuf[insn->offset], insn->length);
+                p += insn->length;
+            }
+            break;
+        }
+    }
+
+    /* relink the symbol fixup chains using the new operand offsets */
+    for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next) {
+        VMUVALUE next;
+        for (offset = fixup->chain; offset != 0; offset = next) {
+            next = rd_cword(c, offset);
+            PutWord(&buf[NewOperandOffset(insns, index, offset)], next ? NewOperandOffset(insns, index, next) : 0, sizeof(VMVALUE));
+        }
+        if (fixup->chain)
+            fixup->chain = NewOperandOffset(insns, index, fixup->chain);
+    }
+
+    /* move the labels and the source lines */
+    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next)
+        if (label->state == LS_PLACED && label->offset <= length && index[label->offset] >= 0)
+            label->offset = insns[index[label->offset]].newOffset;
+    for (line = c->functionLines; line != NULL; line = line->next)
+        if (line->offset <= length && index[line->offset] >= 0)
+            line->offset = insns[index[line->offset]].newOffset;
+
+    /* replace the original code */
+    memcpy(c->codeBuf, buf, p - buf);
+    c->cptr = c->codeBuf + (p - buf);
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* PoolLiteral - find a literal in the constant pool and add it if it isn't there and add is TRUE
+   (the pool is in the data section so the values are written in host order like the other data) */
+static PooledLiteral *PoolLiteral(ParseContext *c, VMVALUE value, int add)
+{
+    Section *section = c->dataTarget;
+    PooledLiteral *literal;
+    VMUVALUE addr;
+    
+    /* look for the literal */
+    for (literal = c->literalPool; literal != NULL; literal = literal->next)
+        if (literal->value == value)
+            return literal;
+    
+    /* the long offset of a new literal must fit in the operand of OP_GREF16 */
+    addr = section->base + section->offset;
+    if (!add || addr / sizeof(VMVALUE) > 0x7fff || (addr & (sizeof(VMVALUE) - 1)) != 0)
+        return NULL;
+    
+    /* add the literal */
+    literal = (PooledLiteral *)GlobalAlloc(c, sizeof(PooledLiteral));
+    literal->value = value;
+    literal->index = addr / sizeof(VMVALUE);
+    section->offset += WriteSection(c, section, (uint8_t *)&value, sizeof(VMVALUE));
+    literal->next = c->literalPool;
+    c->literalPool = literal;
+    return literal;
+}
+
+/* NewOperandOffset - get the relaxed offset of the word operand at an original offset */
+static VMUVALUE NewOperandOffset(RelaxInsn *insns, int *index, VMUVALUE offset)
+{
+    return insns[index[offset - 1]].newOffset + 1;
+}
+
+/* BranchDisplacement - compute the displacement of a branch if it had the given length */
+static VMVALUE BranchDisplacement(RelaxInsn *insns, int k, int length)
+{
+    RelaxInsn *insn = &insns[k];
+    VMVALUE target = insns[insn->target].newOffset;
+    if (insn->target > k)
+        target -= insn->newLength - length;
+    return target - (VMVALUE)(insn->newOffset + length);
+}
+
+/* PutWord - store a big endian operand */
+static uint8_t *PutWord(uint8_t *p, VMVALUE w, int size)
+{
+    uint8_t *end = p + size;
+    while (--size >= 0) {
+        p[size] = w;
+        w >>= 8;
+    }
+    return end;
+}
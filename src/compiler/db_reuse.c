@@ -0,0 +1,607 @@
+/* db_reuse.c - reuse of the code of unchanged functions between builds
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * An incremental build saves the code it stores for each function in a file next
+ * to the image along with a hash of the parse tree the code was generated from.
+ * The next build uses that code in place of generating code for each function
+ * whose parse tree hash is unchanged.  The hash covers the symbols the function
+ * refers to and the bodies of the inline functions it calls.  The code refers to
+ * strings and to anything else that moves when the image changes only through its
+ * local fixups, so it can be placed anywhere in the image.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "db_compiler.h"
+#include "db_vmdebug.h"
+
+/* code cache file format version (change when the generated code changes meaning) */
+#define CODE_CACHE_VERSION  1
+#define CODE_CACHE_MAGIC    "XBF1"
+
+/* deepest nesting of inline function bodies in a parse tree hash */
+#define MAX_HASH_DEPTH      16
+
+/* code cache file header */
+typedef struct {
+    char magic[4];              /* CODE_CACHE_MAGIC */
+    uint32_t key;               /* key of the compiler and options that generated the code */
+    uint32_t bodyHash;          /* hash of everything following the header */
+    uint32_t count;             /* number of functions */
+} CodeCacheHdr;
+
+/* function in the code cache file (followed by its name, code and fixups) */
+typedef struct {
+    uint32_t hash;              /* hash of the parse tree */
+    int32_t nameLength;         /* length of the name */
+    int32_t codeSize;           /* size of the code */
+    int32_t fixupCount;         /* number of local fixups */
+} CodeCacheEntry;
+
+/* local fixup in the code cache file (followed by the symbol name or string value) */
+typedef struct {
+    int32_t isString;           /* the chain needs the address of a string */
+    int32_t chain;              /* offset of the last operand on the chain */
+    int32_t nameLength;         /* length of the symbol name or string value */
+} CodeCacheFixup;
+
+/* parse tree hash state */
+typedef struct {
+    uint32_t hash;              /* hash so far */
+    int depth;                  /* nesting of inline function bodies */
+} TreeHash;
+
+/* prototypes for local functions */
+static uint32_t CodeCacheKey(ParseContext *c);
+static void CodeCacheName(ParseContext *c, char *path);
+static int ParseCodeCache(ParseContext *c, uint8_t *p, uint8_t *end, uint32_t count);
+static uint8_t *GetCacheData(void *buf, uint8_t *p, uint8_t *end, size_t size);
+static char *GetCacheString(ParseContext *c, uint8_t **pp, uint8_t *end, int length);
+static int IsValidChain(CachedCode *code, VMUVALUE chain);
+static const char *FunctionName(ParseContext *c);
+static void HashNode(TreeHash *h, ParseTreeNode *node);
+static void HashList(TreeHash *h, NodeListEntry *entry);
+static void HashSymbol(TreeHash *h, Symbol *sym);
+static void HashType(TreeHash *h, Type *type);
+static void HashInt(TreeHash *h, int32_t value);
+static void HashString(TreeHash *h, const char *str);
+
+/* LoadCodeCache - load the code stored by the previous build of the image */
+void LoadCodeCache(ParseContext *c)
+{
+    uint32_t bodyHash = HASH_INIT;
+    char path[PATH_MAX];
+    CodeCacheHdr hdr;
+    uint8_t *buf;
+    long size;
+    FILE *fp;
+
+    /* start with nothing to reuse */
+    c->previousCode = NULL;
+    c->storedCode = NULL;
+    c->pNextStoredCode = &c->storedCode;
+
+    /* open the code cache file */
+    CodeCacheName(c, path);
+    if (!(fp = fopen(path, "rb")))
+        return;
+
+    /* make sure it was written for the current compiler and options */
+    if (fread(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr)
+    ||  memcmp(hdr.magic, CODE_CACHE_MAGIC, sizeof(hdr.magic)) != 0
+    ||  hdr.key != CodeCacheKey(c)
+    ||  fseek(fp, 0, SEEK_END) != 0
+    ||  (size = ftell(fp) - (long)sizeof(hdr)) < 0
+    ||  fseek(fp, sizeof(hdr), SEEK_SET) != 0) {
+        fclose(fp);
+        return;
+    }
+
+    /* read the functions */
+    buf = (uint8_t *)GlobalAlloc(c, size + 1);
+    if (!ReadHashedData(fp, buf, size, &bodyHash) || bodyHash != hdr.bodyHash) {
+        fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    /* reuse nothing if the file is damaged */
+    if (!ParseCodeCache(c, buf, buf + size, hdr.count))
+        c->previousCode = NULL;
+}
+
+/* ParseCodeCache - build the list of functions with code to reuse */
+static int ParseCodeCache(ParseContext *c, uint8_t *p, uint8_t *end, uint32_t count)
+{
+    CachedCode *code, **pNext = &c->previousCode;
+    CodeCacheFixup fixup;
+    CodeCacheEntry entry;
+    int i;
+
+    while (count-- > 0) {
+
+        /* get the function header */
+        if (!(p = GetCacheData(&entry, p, end, sizeof(entry)))
+        ||  entry.codeSize < 0 || entry.fixupCount < 0 || entry.fixupCount > entry.codeSize)
+            return FALSE;
+
+        /* get the name and code */
+        code = (CachedCode *)GlobalAlloc(c, sizeof(CachedCode) + entry.fixupCount * sizeof(CachedFixup));
+        code->fixups = (CachedFixup *)(code + 1);
+        code->fixupCount = entry.fixupCount;
+        code->hash = entry.hash;
+        code->reused = FALSE;
+        if (!(code->name = GetCacheString(c, &p, end, entry.nameLength))
+        ||  entry.codeSize > end - p)
+            return FALSE;
+        code->code = p;
+        code->codeSize = entry.codeSize;
+        p += entry.codeSize;
+
+        /* get the local fixups */
+        for (i = 0; i < entry.fixupCount; ++i) {
+            if (!(p = GetCacheData(&fixup, p, end, sizeof(fixup)))
+            ||  !(code->fixups[i].name = GetCacheString(c, &p, end, fixup.nameLength)))
+                return FALSE;
+            code->fixups[i].isString = fixup.isString;
+            code->fixups[i].chain = fixup.chain;
+            if (!IsValidChain(code, code->fixups[i].chain))
+                return FALSE;
+        }
+
+        /* add the function to the list */
+        code->next = NULL;
+        *pNext = code;
+        pNext = &code->next;
+    }
+
+    /* return successfully if there is nothing left over */
+    return p == end;
+}
+
+/* GetCacheData - copy a structure from the code cache */
+static uint8_t *GetCacheData(void *buf, uint8_t *p, uint8_t *end, size_t size)
+{
+    if ((size_t)(end - p) < size)
+        return NULL;
+    memcpy(buf, p, size);
+    return p + size;
+}
+
+/* GetCacheString - copy a string from the code cache */
+static char *GetCacheString(ParseContext *c, uint8_t **pp, uint8_t *end, int length)
+{
+    char *str;
+    if (length < 0 || length > end - *pp)
+        return NULL;
+    str = (char *)GlobalAlloc(c, length + 1);
+    memcpy(str, *pp, length);
+    str[length] = '\0';
+    *pp += length;
+    return str;
+}
+
+/* IsValidChain - make sure a fixup chain stays within the code
+   (the chain is linked from the last operand to the first so the offsets always decrease) */
+static int IsValidChain(CachedCode *code, VMUVALUE chain)
+{
+    VMUVALUE offset, next;
+    int i;
+    for (offset = chain; offset != 0; offset = next) {
+        if (offset + sizeof(VMVALUE) > (VMUVALUE)code->codeSize)
+            return FALSE;
+        for (next = 0, i = 0; i < (int)sizeof(VMVALUE); ++i)
+            next = (next << 8) | code->code[offset + i];
+        if (next >= offset)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* SaveCodeCache - save the code stored by this build for the next one */
+void SaveCodeCache(ParseContext *c)
+{
+    CodeCacheFixup fixup;
+    CodeCacheEntry entry;
+    char path[PATH_MAX];
+    int reused = 0, i;
+    CachedCode *code;
+    CodeCacheHdr hdr;
+    FILE *fp;
+
+    /* create the code cache file */
+    CodeCacheName(c, path);
+    if (!(fp = fopen(path, "wb"))) {
+        xbInfo(c->sys, "warning: can't create code cache file: %s\n", path);
+        return;
+    }
+
+    /* write a header that won't match until the body hash is filled in */
+    memcpy(hdr.magic, CODE_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key = CodeCacheKey(c);
+    hdr.bodyHash = HASH_INIT;
+    hdr.count = 0;
+    for (code = c->storedCode; code != NULL; code = code->next)
+        ++hdr.count;
+    fwrite(&hdr, 1, sizeof(hdr), fp);
+
+    /* write the functions */
+    for (code = c->storedCode; code != NULL; code = code->next) {
+        entry.hash = code->hash;
+        entry.nameLength = strlen(code->name);
+        entry.codeSize = code->codeSize;
+        entry.fixupCount = code->fixupCount;
+        WriteHashedData(fp, &entry, sizeof(entry), &hdr.bodyHash);
+        WriteHashedData(fp, code->name, entry.nameLength, &hdr.bodyHash);
+        WriteHashedData(fp, code->code, code->codeSize, &hdr.bodyHash);
+        for (i = 0; i < code->fixupCount; ++i) {
+            fixup.isString = code->fixups[i].isString;
+            fixup.chain = code->fixups[i].chain;
+            fixup.nameLength = strlen(code->fixups[i].name);
+            WriteHashedData(fp, &fixup, sizeof(fixup), &hdr.bodyHash);
+            WriteHashedData(fp, code->fixups[i].name, fixup.nameLength, &hdr.bodyHash);
+        }
+        if (code->reused)
+            ++reused;
+    }
+
+    /* fill in the body hash now that the file is complete */
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&hdr, 1, sizeof(hdr), fp);
+    if (fclose(fp) != 0) {
+        xbInfo(c->sys, "warning: error writing code cache file: %s\n", path);
+        remove(path);
+    }
+
+    /* show how much code was reused */
+    if (c->flags & COMPILER_INFO)
+        xbInfo(c->sys, "reused the code of %d of %d functions\n", reused, (int)hdr.count);
+}
+
+/* CodeCacheKey - compute a key that changes whenever the generated code could */
+static uint32_t CodeCacheKey(ParseContext *c)
+{
+    int32_t values[4];
+    uint32_t hash = HASH_INIT;
+    FLASH_SPACE OTDEF *op;
+    values[0] = CODE_CACHE_VERSION;
+    values[1] = sizeof(VMVALUE);
+    values[2] = c->flags & (COMPILER_OPTIMIZE | COMPILER_OPTIMIZE2 | COMPILER_CHECK);
+    values[3] = c->config->compareBranches;
+    hash = HashBytes(hash, values, sizeof(values));
+    for (op = OpcodeTable; op->name; ++op) {
+        values[0] = op->code;
+        values[1] = op->fmt;
+        hash = HashBytes(hash, values, 2 * sizeof(int32_t));
+    }
+    return hash;
+}
+
+/* CodeCacheName - build the name of the code cache file from the name of the image */
+static void CodeCacheName(ParseContext *c, char *path)
+{
+    const char *name = c->imageName, *ext = NULL, *p;
+    int length;
+    for (p = name; *p != '\0'; ++p) {
+        if (*p == '/' || *p == '\\' || *p == ':')
+            ext = NULL;
+        else if (*p == '.')
+            ext = p;
+    }
+    if ((length = (ext ? ext : p) - name) > PATH_MAX - 5)
+        length = PATH_MAX - 5;
+    sprintf(path, "%.*s.bfc", length, name);
+}
+
+/* ReuseCode - put the code the previous build stored for the function under construction in the code buffer
+   (returns FALSE if there is no code for the function as it is now) */
+int ReuseCode(ParseContext *c, uint32_t hash)
+{
+    const char *name = FunctionName(c);
+    LocalFixup *fixup, **pNext;
+    CachedCode *code;
+    Symbol *sym;
+    int i;
+
+    /* find the code for the function */
+    for (code = c->previousCode; code != NULL; code = code->next)
+        if (code->hash == hash && strcmp(code->name, name) == 0)
+            break;
+    if (!code || !GrowCode(c, code->codeSize))
+        return FALSE;
+
+    /* make sure its symbols are still ones that can be fixed up */
+    for (i = 0; i < code->fixupCount; ++i)
+        if (!code->fixups[i].isString) {
+            if (!(sym = FindSymbol(&c->globals, code->fixups[i].name)) || !IsRelocatable(sym))
+                return FALSE;
+        }
+
+    /* rebuild the local fixups */
+    pNext = &c->symbolFixups;
+    for (i = 0; i < code->fixupCount; ++i) {
+        CachedFixup *cached = &code->fixups[i];
+        fixup = (LocalFixup *)LocalAlloc(c, sizeof(LocalFixup));
+        if (cached->isString) {
+            fixup->symbol = NULL;
+            fixup->string = AddString(c, (char *)cached->name);
+        }
+        else {
+            fixup->symbol = FindSymbol(&c->globals, cached->name);
+            fixup->string = NULL;
+        }
+        fixup->chain = cached->chain;
+        fixup->next = NULL;
+        *pNext = fixup;
+        pNext = &fixup->next;
+    }
+
+    /* copy the code */
+    memcpy(c->codeBuf, code->code, code->codeSize);
+    c->cptr = c->codeBuf + code->codeSize;
+    if (c->flags & COMPILER_INFO)
+        xbInfo(c->sys, "%s: reusing the code from the previous build\n", name);
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* RecordCode - record the code of the function under construction for the next build
+   (must be called before the local fixups are applied) */
+void RecordCode(ParseContext *c, uint32_t hash, int reused)
+{
+    int codeSize = c->cptr - c->codeBuf, count = 0, i;
+    LocalFixup *fixup;
+    CachedCode *code;
+
+    /* allocate the function with its fixups and code */
+    for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next)
+        ++count;
+    code = (CachedCode *)GlobalAlloc(c, sizeof(CachedCode) + count * sizeof(CachedFixup) + codeSize);
+    code->fixups = (CachedFixup *)(code + 1);
+    code->code = (uint8_t *)(code->fixups + count);
+    code->next = NULL;
+    code->name = FunctionName(c);
+    code->hash = hash;
+    code->codeSize = codeSize;
+    code->fixupCount = count;
+    code->reused = reused;
+    memcpy(code->code, c->codeBuf, codeSize);
+
+    /* the names used by the fixups last until the end of the compile */
+    for (fixup = c->symbolFixups, i = 0; fixup != NULL; fixup = fixup->next, ++i) {
+        if (fixup->string) {
+            code->fixups[i].name = (char *)fixup->string->value;
+            code->fixups[i].isString = TRUE;
+        }
+        else {
+            code->fixups[i].name = fixup->symbol->name;
+            code->fixups[i].isString = FALSE;
+        }
+        code->fixups[i].chain = fixup->chain;
+    }
+
+    /* add it to the list of stored code */
+    *c->pNextStoredCode = code;
+    c->pNextStoredCode = &code->next;
+}
+
+/* FunctionName - get the name of the function under construction */
+static const char *FunctionName(ParseContext *c)
+{
+    Symbol *symbol = c->function->u.functionDefinition.symbol;
+    return symbol ? symbol->name : "[main]";
+}
+
+/* HashFunction - hash the parse tree of the function under construction */
+uint32_t HashFunction(ParseContext *c)
+{
+    TreeHash h;
+    h.hash = HASH_INIT;
+    h.depth = 0;
+    HashInt(&h, c->usesRegisters || c->startsCogs || c->runsTasks);    /* the optimizer keeps globals in locals unless they are volatile */
+    HashNode(&h, c->function);
+    return h.hash;
+}
+
+/* HashNode - add a parse tree to a hash */
+static void HashNode(TreeHash *h, ParseTreeNode *node)
+{
+    CaseListEntry *entry;
+
+    /* a missing node is different from any node */
+    if (!node) {
+        HashInt(h, -1);
+        return;
+    }
+
+    /* hash the node type, value type and everything under the node */
+    HashInt(h, node->nodeType);
+    HashType(h, node->type);
+    switch (node->nodeType) {
+    case NodeTypeFunctionDefinition:
+        HashString(h, node->u.functionDefinition.symbol ? node->u.functionDefinition.symbol->name : "");
+        HashInt(h, node->u.functionDefinition.localOffset);
+        HashList(h, node->u.functionDefinition.bodyStatements);
+        break;
+    case NodeTypeLetStatement:
+        HashNode(h, node->u.letStatement.lvalue);
+        HashNode(h, node->u.letStatement.rvalue);
+        break;
+    case NodeTypeIfStatement:
+        HashNode(h, node->u.ifStatement.test);
+        HashList(h, node->u.ifStatement.thenStatements);
+        HashList(h, node->u.ifStatement.elseStatements);
+        break;
+    case NodeTypeSelectStatement:
+        HashNode(h, node->u.selectStatement.expr);
+        HashList(h, node->u.selectStatement.caseStatements);
+        HashNode(h, node->u.selectStatement.elseStatements);
+        break;
+    case NodeTypeCaseStatement:
+        for (entry = node->u.caseStatement.cases; entry != NULL; entry = entry->next) {
+            HashNode(h, entry->fromExpr);
+            HashNode(h, entry->toExpr);
+        }
+        HashInt(h, -2);
+        HashList(h, node->u.caseStatement.bodyStatements);
+        break;
+    case NodeTypeForStatement:
+        HashNode(h, node->u.forStatement.var);
+        HashNode(h, node->u.forStatement.startExpr);
+        HashNode(h, node->u.forStatement.endExpr);
+        HashNode(h, node->u.forStatement.stepExpr);
+        HashList(h, node->u.forStatement.bodyStatements);
+        break;
+    case NodeTypeDoWhileStatement:
+    case NodeTypeDoUntilStatement:
+    case NodeTypeLoopStatement:
+    case NodeTypeLoopWhileStatement:
+    case NodeTypeLoopUntilStatement:
+        HashNode(h, node->u.loopStatement.test);
+        HashList(h, node->u.loopStatement.bodyStatements);
+        break;
+    case NodeTypeReturnStatement:
+        HashNode(h, node->u.returnStatement.expr);
+        break;
+    case NodeTypeCallStatement:
+        HashNode(h, node->u.callStatement.expr);
+        break;
+    case NodeTypeLabelDefinition:
+        HashString(h, node->u.labelDefinition.label->name);
+        break;
+    case NodeTypeGotoStatement:
+        HashString(h, node->u.gotoStatement.label->name);
+        break;
+    case NodeTypeEndStatement:
+        break;
+    case NodeTypeAsmStatement:
+        HashInt(h, node->u.asmStatement.length);
+        h->hash = HashBytes(h->hash, node->u.asmStatement.code, node->u.asmStatement.length);
+        if (node->u.asmStatement.fcache) {
+            HashSymbol(h, node->u.asmStatement.fcache);
+            HashNode(h, node->u.asmStatement.arg);
+        }
+        break;
+    case NodeTypeGlobalRef:
+        HashSymbol(h, node->u.globalRef.symbol);
+        break;
+    case NodeTypeLocalRef:
+        HashInt(h, node->u.localRef.offset);
+        break;
+    case NodeTypeFunctionLit:
+        HashSymbol(h, node->u.functionLit.symbol);
+        break;
+    case NodeTypeArrayLit:
+        HashSymbol(h, node->u.arrayLit.symbol);
+        break;
+    case NodeTypeStringLit:
+        HashString(h, (char *)node->u.stringLit.string->value);
+        break;
+    case NodeTypeIntegerLit:
+        HashInt(h, node->u.integerLit.value);
+        break;
+    case NodeTypeUnaryOp:
+        HashInt(h, node->u.unaryOp.op);
+        HashNode(h, node->u.unaryOp.expr);
+        break;
+    case NodeTypeBinaryOp:
+        HashInt(h, node->u.binaryOp.op);
+        HashNode(h, node->u.binaryOp.left);
+        HashNode(h, node->u.binaryOp.right);
+        break;
+    case NodeTypeArrayRef:
+        HashNode(h, node->u.arrayRef.array);
+        HashNode(h, node->u.arrayRef.index);
+        break;
+    case NodeTypeFunctionCall:
+        HashInt(h, node->u.functionCall.argc);
+        HashNode(h, node->u.functionCall.fcn);
+        HashList(h, node->u.functionCall.args);
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        HashList(h, node->u.exprList.exprs);
+        break;
+    case NodeTypeAddressOf:
+        HashNode(h, node->u.addressOf.expr);
+        break;
+    }
+}
+
+/* HashList - add a list of parse trees to a hash */
+static void HashList(TreeHash *h, NodeListEntry *entry)
+{
+    for (; entry != NULL; entry = entry->next)
+        HashNode(h, entry->node);
+    HashInt(h, -2);
+}
+
+/* HashSymbol - add a symbol that code refers to to a hash */
+static void HashSymbol(TreeHash *h, Symbol *sym)
+{
+    Type *type = sym->type;
+    HashString(h, sym->name);
+    HashInt(h, sym->storageClass);
+    HashType(h, type);
+
+    /* the code has the values of constants and the addresses that don't move */
+    if (type->id == TYPE_STRING)
+        HashString(h, (char *)sym->v.string->value);
+    else if (!IsRelocatable(sym))
+        HashInt(h, sym->v.variable.offset);
+
+    /* checked indexes have the number of elements of the array */
+    if (type->id == TYPE_ARRAY)
+        HashInt(h, sym->arraySize);
+
+    /* calls to inline functions get a copy of their bodies */
+    if (type->id == TYPE_FUNCTION && type->u.functionInfo.inlined && type->u.functionInfo.inlineDefinition) {
+        if (++h->depth <= MAX_HASH_DEPTH)
+            HashNode(h, type->u.functionInfo.inlineDefinition);
+        --h->depth;
+    }
+}
+
+/* HashType - add a type to a hash */
+static void HashType(TreeHash *h, Type *type)
+{
+    if (!type) {
+        HashInt(h, -1);
+        return;
+    }
+    HashInt(h, type->id);
+    switch (type->id) {
+    case TYPE_ARRAY:
+        HashInt(h, type->u.arrayInfo.size);
+        HashType(h, type->u.arrayInfo.elementType);
+        break;
+    case TYPE_POINTER:
+        HashType(h, type->u.pointerInfo.targetType);
+        break;
+    case TYPE_FUNCTION:
+        HashType(h, type->u.functionInfo.returnType);
+        HashInt(h, type->u.functionInfo.arguments.count);
+        HashInt(h, type->u.functionInfo.callerCleans);
+        HashInt(h, type->u.functionInfo.inlined);
+        break;
+    default:
+        break;
+    }
+}
+
+/* HashInt - add an integer to a hash */
+static void HashInt(TreeHash *h, int32_t value)
+{
+    h->hash = HashBytes(h->hash, &value, sizeof(value));
+}
+
+/* HashString - add a string to a hash */
+static void HashString(TreeHash *h, const char *str)
+{
+    h->hash = HashBytes(h->hash, str, strlen(str) + 1);
+}
@@ -10,13 +10,11 @@
 #include <string.h>
 #include <setjmp.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "db_compiler.h"
 
 /* keyword table */
-static struct {
-    char *keyword;
-    int token;
-} ktab[] = {
+static Keyword ktab[] = {
 
 /* these must be in the same order as the int enum */
 {   "REM",      T_REM       },
@@ -52,23 +50,64 @@ static struct {
 {   "INPUT",    T_INPUT     },
 {   "PRINT",    T_PRINT     },
 {   "ASM",      T_ASM       },
+{   "COGSTART", T_COGSTART  },
+{   "TASK",     T_TASK      },
+{   "YIELD",    T_YIELD     },
+{   "WAITFOR",  T_WAITFOR   },
 {   NULL,       0           }
 };
 
 /* local function prototypes */
+static void OpenCachedSource(ParseContext *c, ParseFile *f, const char *name);
+static void FreeSourceFile(SourceFile *source);
+static void CacheLine(ParseContext *c, ParseFile *f);
+static void ReplayLine(ParseContext *c, ParseFile *f, CachedLine *cached);
+static void AddCachedLine(ParseContext *c, CachedLine *line);
+static void CopyCachedLine(CachedLine *copy, CachedLine *line);
+static int PrescanLine(ParseContext *c, CachedToken *tokens, char *strings, int *pStringsLength);
 static int NextToken(ParseContext *c);
+static int ScanToken(ParseContext *c);
 static int IdentifierToken(ParseContext *c, int ch);
 static int LiteralChar(ParseContext *c);
 static int SkipComment(ParseContext *c);
 static int XGetC(ParseContext *c);
 
+/* InitScan - build the keyword index of a parse context */
+int InitScan(ParseContext *c)
+{
+    if (!(c->keywordEntries = (HashEntry *)xbGlobalAlloc(c->sys, sizeof(ktab) / sizeof(Keyword) * sizeof(HashEntry))))
+        return FALSE;
+    IndexKeywords(&c->keywordIndex, ktab, c->keywordEntries);
+    return TRUE;
+}
+
+/* HashKeywords - add the keyword table to a hash (the saved tokens of a unit depend on it) */
+uint32_t HashKeywords(uint32_t hash)
+{
+    Keyword *keyword;
+    for (keyword = ktab; keyword->keyword != NULL; ++keyword) {
+        hash = HashBytes(hash, keyword->keyword, strlen(keyword->keyword) + 1);
+        hash = HashBytes(hash, &keyword->token, sizeof(keyword->token));
+    }
+    return hash;
+}
+
 /* RewindInput - rewind the main input */
 void RewindInput(ParseContext *c)
 {
     ParseFile *f = &c->mainFile;
     
+    /* replay the lines cached on the first pass */
+    if (c->pass > 1)
+        c->nextCachedLine = c->lineCache;
+        
     /* rewind the source input */
-    (*f->u.main.rewind)(f->u.main.getLineCookie);
+    else {
+        (*f->u.main.rewind)(f->u.main.getLineCookie);
+        c->lineCache = NULL;
+        c->pNextCachedLine = &c->lineCache;
+    }
+    c->cachedLine = NULL;
 
     /* initialize the parse context */
     f->lineNumber = 0;
@@ -84,6 +123,10 @@ int PushFile(ParseContext *c, const char *name)
     IncludedFile *inc;
     ParseFile *f;
     
+    /* the lines of included files were cached on the first pass */
+    if (c->pass > 1)
+        return TRUE;
+    
     /* check to see if the file has already been included */
     for (inc = c->includedFiles; inc != NULL; inc = inc->next)
         if (strcmp(name, inc->name) == 0)
@@ -106,6 +149,12 @@ int PushFile(ParseContext *c, const char *name)
         return FALSE;
     }
     f->u.file.file = inc;
+    f->u.file.source = NULL;
+    f->u.file.nextLine = NULL;
+    
+    /* replay the file from the source cache if it hasn't changed */
+    if (c->sourceCache)
+        OpenCachedSource(c, f, name);
     
     /* initialize the parse context */
     f->lineNumber = 0;
@@ -119,6 +168,89 @@ int PushFile(ParseContext *c, const char *name)
     return TRUE;
 }
 
+/* OpenCachedSource - replay an include file from the source cache or start recording it */
+static void OpenCachedSource(ParseContext *c, ParseFile *f, const char *name)
+{
+    SourceCache *cache = c->sourceCache;
+    SourceFile *source, **pSource;
+    struct stat info;
+    
+    /* get the file size and modification time */
+    if (fstat(fileno((FILE *)f->u.file.fp), &info) != 0)
+        return;
+        
+    /* look for the file in the cache */
+    for (pSource = &cache->files; (source = *pSource) != NULL; pSource = &source->next)
+        if (strcmp(name, source->name) == 0)
+            break;
+            
+    /* replay the cached lines if the file hasn't changed */
+    if (source) {
+        if (source->complete
+        &&  source->size == (long)info.st_size
+        &&  source->time == (long)info.st_mtime
+        &&  source->id == (long)info.st_ino) {
+            fclose(f->u.file.fp);
+            f->u.file.fp = NULL;
+            f->u.file.nextLine = source->lines;
+            ++cache->hits;
+            return;
+        }
+        *pSource = source->next;
+        FreeSourceFile(source);
+    }
+    ++cache->misses;
+    
+    /* record the lines as they are read */
+    if (!(source = (SourceFile *)malloc(sizeof(SourceFile) + strlen(name))))
+        return;
+    strcpy(source->name, name);
+    source->size = (long)info.st_size;
+    source->time = (long)info.st_mtime;
+    source->id = (long)info.st_ino;
+    source->complete = FALSE;
+    source->hash = 0;
+    source->lines = NULL;
+    source->pNextLine = &source->lines;
+    source->next = cache->files;
+    cache->files = source;
+    
+    /* replay the precompiled unit for the file contents if there is one */
+    if (cache->unitDirectory) {
+        source->hash = HashSourceFile(f->u.file.fp);
+        if (LoadUnit(cache, source)) {
+            fclose(f->u.file.fp);
+            f->u.file.fp = NULL;
+            f->u.file.nextLine = source->lines;
+            ++cache->unitLoads;
+            return;
+        }
+    }
+    f->u.file.source = source;
+}
+
+/* FreeSourceCache - free a source cache and all of its cached files */
+void FreeSourceCache(SourceCache *cache)
+{
+    SourceFile *source, *next;
+    for (source = cache->files; source != NULL; source = next) {
+        next = source->next;
+        FreeSourceFile(source);
+    }
+    free(cache);
+}
+
+/* FreeSourceFile - free a cached include file */
+static void FreeSourceFile(SourceFile *source)
+{
+    CachedLine *line, *next;
+    for (line = source->lines; line != NULL; line = next) {
+        next = line->next;
+        free(line);
+    }
+    free(source);
+}
+
 /* ClearIncludedFiles - clear the list of included files for the next pass */
 void ClearIncludedFiles(ParseContext *c)
 {
@@ -139,21 +271,41 @@ void CloseParseContext(ParseContext *c)
     /* close all of the currently open files */
     for (f = c->currentFile; f != NULL && f != &c->mainFile; f = next) {
         next = f->next;
-        fclose(f->u.file.fp);
+        if (f->u.file.fp)
+            fclose(f->u.file.fp);
         free(f);
     }
     
     /* restore the input to the main file */
     c->currentFile = &c->mainFile;
     c->currentInclude = NULL;
+    c->cachedLine = NULL;
 }
 
 /* GetLine - get the next input line */
 int GetLine(ParseContext *c)
 {
+    CachedLine *replay = NULL;
     ParseFile *f;
     int len;
 
+    /* replay the next cached line after the first pass */
+    if (c->pass > 1) {
+        CachedLine *line;
+        if (!(line = c->nextCachedLine)) {
+            c->currentFile = NULL;
+            c->cachedLine = NULL;
+            return FALSE;
+        }
+        c->nextCachedLine = line->next;
+        strcpy(c->lineBuf, line->text);
+        c->linePtr = c->lineBuf;
+        c->cachedLine = line;
+        c->nextCachedToken = 0;
+        c->savedToken = T_NONE;
+        return TRUE;
+    }
+
     /* get the next input line */
     for (;;) {
         
@@ -168,9 +320,21 @@ int GetLine(ParseContext *c)
         }
         
         /* get a line from the current include file */
-        else {
+        else if (f->u.file.fp) {
             if (xbGetLine(f->u.file.fp, c->lineBuf, sizeof(c->lineBuf) - 1))
                 break;
+            if (f->u.file.source) {
+                f->u.file.source->complete = TRUE;
+                if (c->sourceCache->unitDirectory)
+                    SaveUnit(c->sourceCache, f->u.file.source);
+            }
+        }
+        
+        /* or replay it from the source cache */
+        else if ((replay = f->u.file.nextLine) != NULL) {
+            f->u.file.nextLine = replay->next;
+            strcpy(c->lineBuf, replay->text);
+            break;
         }
         
         /* pop the input file stack on end of file */
@@ -181,7 +345,8 @@ int GetLine(ParseContext *c)
             
         /* close the file we just finished if it isn't the main file */
         if (f != &c->mainFile) {
-            fclose(f->u.file.fp);
+            if (f->u.file.fp)
+                fclose(f->u.file.fp);
             free(f);
         }
     }
@@ -197,6 +362,12 @@ int GetLine(ParseContext *c)
     c->linePtr = c->lineBuf;
     ++f->lineNumber;
 
+    /* scan the line and add it to the cache for the later passes */
+    if (replay)
+        ReplayLine(c, f, replay);
+    else
+        CacheLine(c, f);
+
     /* clear lookahead token */
     c->savedToken = T_NONE;
 
@@ -204,6 +375,156 @@ int GetLine(ParseContext *c)
     return TRUE;
 }
 
+/* CacheLine - add the current line and its tokens to the line cache */
+static void CacheLine(ParseContext *c, ParseFile *f)
+{
+    CachedToken tokens[MAXLINE];
+    char strings[MAXLINE * 2];
+    int textLength, stringsLength, count, i;
+    SourceFile *source;
+    CachedLine *line;
+    
+    /* scan the tokens ahead of the parser */
+    count = PrescanLine(c, tokens, strings, &stringsLength);
+    
+    /* allocate the line with its tokens, text and token strings in a single block */
+    textLength = strlen(c->lineBuf) + 1;
+    line = (CachedLine *)GlobalAlloc(c, sizeof(CachedLine) + count * sizeof(CachedToken) + textLength + stringsLength);
+    line->next = NULL;
+    line->file = (f == &c->mainFile ? NULL : f->u.file.file);
+    line->lineNumber = f->lineNumber;
+    line->tokens = (CachedToken *)(line + 1);
+    line->tokenCount = count;
+    line->text = (char *)(line->tokens + count);
+    line->size = sizeof(CachedLine) + count * sizeof(CachedToken) + textLength + stringsLength;
+    memcpy(line->text, c->lineBuf, textLength);
+    memcpy(line->text + textLength, strings, stringsLength);
+    
+    /* convert the string offsets to pointers */
+    for (i = 0; i < count; ++i) {
+        line->tokens[i] = tokens[i];
+        if (tokens[i].string)
+            line->tokens[i].string = line->text + textLength + (tokens[i].string - strings);
+    }
+    
+    /* record a copy in the source cache if the file is being recorded */
+    if (f != &c->mainFile && (source = f->u.file.source) != NULL) {
+        CachedLine *copy;
+        if ((copy = (CachedLine *)malloc(line->size)) != NULL) {
+            CopyCachedLine(copy, line);
+            copy->next = NULL;
+            copy->file = NULL;
+            *source->pNextLine = copy;
+            source->pNextLine = &copy->next;
+        }
+        else
+            f->u.file.source = NULL;
+    }
+    
+    /* add it to the cache */
+    AddCachedLine(c, line);
+}
+
+/* ReplayLine - add a line replayed from the source cache to the line cache */
+static void ReplayLine(ParseContext *c, ParseFile *f, CachedLine *cached)
+{
+    CachedLine *line = (CachedLine *)GlobalAlloc(c, cached->size);
+    CopyCachedLine(line, cached);
+    line->next = NULL;
+    line->file = f->u.file.file;
+    line->lineNumber = f->lineNumber;
+    AddCachedLine(c, line);
+}
+
+/* AddCachedLine - add a line to the line cache and use its tokens for the rest of this pass */
+static void AddCachedLine(ParseContext *c, CachedLine *line)
+{
+    /* add it to the cache */
+    *c->pNextCachedLine = line;
+    c->pNextCachedLine = &line->next;
+    
+    /* use the cached tokens for the rest of this pass too */
+    c->cachedLine = line;
+    c->nextCachedToken = 0;
+}
+
+/* CopyCachedLine - copy a cached line with its tokens and strings to a block of line->size bytes */
+static void CopyCachedLine(CachedLine *copy, CachedLine *line)
+{
+    int i;
+    memcpy(copy, line, line->size);
+    copy->tokens = (CachedToken *)(copy + 1);
+    copy->text = (char *)(copy->tokens + copy->tokenCount);
+    for (i = 0; i < copy->tokenCount; ++i)
+        if (line->tokens[i].string)
+            copy->tokens[i].string = copy->text + (line->tokens[i].string - line->text);
+}
+
+/* PrescanLine - scan the tokens on the current line without disturbing the parser
+   (stops quietly at the first scan error and leaves the rest to the parser) */
+static int PrescanLine(ParseContext *c, CachedToken *tokens, char *strings, int *pStringsLength)
+{
+    char saveToken[MAXTOKEN];
+    VMVALUE saveValue = c->value;
+    int saveTokenOffset = c->tokenOffset;
+    int saveInComment = c->inComment;
+    jmp_buf saveTarget;
+    volatile int count = 0;
+    volatile int length = 0;
+    
+    /* save the scanner state */
+    strcpy(saveToken, c->token);
+    memcpy(saveTarget, c->errorTarget, sizeof(jmp_buf));
+    c->prescan = TRUE;
+    
+    /* scan tokens until the end of the line or an error */
+    if (setjmp(c->errorTarget) == 0) {
+        CachedToken *token;
+        do {
+            token = &tokens[count];
+            token->start = (LineOffset)(c->linePtr - c->lineBuf);
+            token->inComment = (c->inComment ? 1 : 0);
+            token->token = ScanToken(c);
+            token->end = (LineOffset)(c->linePtr - c->lineBuf);
+            token->offset = (LineOffset)c->tokenOffset;
+            token->inComment |= (c->inComment ? 2 : 0);
+            token->value = c->value;
+            token->string = NULL;
+            switch (token->token) {
+            case T_IDENTIFIER:
+            case T_NUMBER:
+            case T_FIXED_NUMBER:
+            case T_FLOAT_NUMBER:
+            case T_STRING:
+                token->string = &strings[length];
+                break;
+            default:
+                if (token->token >= T_REM && token->token < T_LE)
+                    token->string = &strings[length];
+                break;
+            }
+            if (token->string) {
+                strcpy(token->string, c->token);
+                length += strlen(c->token) + 1;
+            }
+            ++count;
+        } while (token->token != T_EOL && count < MAXLINE);
+    }
+    
+    /* restore the scanner state */
+    memcpy(c->errorTarget, saveTarget, sizeof(jmp_buf));
+    c->prescan = FALSE;
+    strcpy(c->token, saveToken);
+    c->value = saveValue;
+    c->tokenOffset = saveTokenOffset;
+    c->inComment = saveInComment;
+    c->linePtr = c->lineBuf;
+    
+    /* return the number of tokens scanned */
+    *pStringsLength = length;
+    return count;
+}
+
 /* FRequire - fetch a token and check it */
 void FRequire(ParseContext *c, int requiredToken)
 {
@@ -213,10 +534,10 @@ void FRequire(ParseContext *c, int requiredToken)
 /* Require - check for a required token */
 void Require(ParseContext *c, int token, int requiredToken)
 {
-    char tknbuf[MAXTOKEN];
+    char tknbuf[MAXTOKEN], nameBuf[4];
     if (token != requiredToken) {
-        strcpy(tknbuf, TokenName(requiredToken));
-        ParseError(c, "Expecting '%s', found '%s'", tknbuf, TokenName(token));
+        strcpy(tknbuf, TokenName(requiredToken, nameBuf));
+        ParseError(c, "Expecting '%s', found '%s'", tknbuf, TokenName(token, nameBuf));
     }
 }
 
@@ -243,10 +564,9 @@ void SaveToken(ParseContext *c, int token)
     c->savedToken = token;
 }
 
-/* TokenName - get the name of a token */
-char *TokenName(int token)
+/* TokenName - get the name of a token (nameBuf holds the name of a character token) */
+char *TokenName(int token, char *nameBuf)
 {
-    static char nameBuf[4];
     char *name;
 
     switch (token) {
@@ -285,6 +605,10 @@ char *TokenName(int token)
     case T_INPUT:
     case T_PRINT:
     case T_ASM:
+    case T_COGSTART:
+    case T_TASK:
+    case T_YIELD:
+    case T_WAITFOR:
         name = ktab[token - T_REM].keyword;
         break;
     case T_END_DEF:
@@ -332,6 +656,12 @@ char *TokenName(int token)
     case T_NUMBER:
         name = "<NUMBER>";
         break;
+    case T_FIXED_NUMBER:
+        name = "<FIXED_NUMBER>";
+        break;
+    case T_FLOAT_NUMBER:
+        name = "<FLOAT_NUMBER>";
+        break;
     case T_STRING:
         name = "<STRING>";
         break;
@@ -354,8 +684,42 @@ char *TokenName(int token)
     return name;
 }
 
-/* NextToken - read the next token */
+/* NextToken - get the next token from the line cache or scan it */
 static int NextToken(ParseContext *c)
+{
+    CachedLine *line = c->cachedLine;
+    
+    /* look for a token scanned from the same position and comment state */
+    if (line) {
+        int start = (int)(c->linePtr - c->lineBuf);
+        int inComment = (c->inComment ? 1 : 0);
+        int i = c->nextCachedToken;
+        CachedToken *token;
+        if (i >= line->tokenCount || line->tokens[i].start != start || (line->tokens[i].inComment & 1) != inComment) {
+            for (i = 0; i < line->tokenCount; ++i)
+                if (line->tokens[i].start == start && (line->tokens[i].inComment & 1) == inComment)
+                    break;
+        }
+        if (i < line->tokenCount) {
+            token = &line->tokens[i];
+            c->linePtr = c->lineBuf + token->end;
+            c->tokenOffset = token->offset;
+            c->inComment = (token->inComment & 2) != 0;
+            if (token->string)
+                strcpy(c->token, token->string);
+            if (token->token == T_NUMBER || token->token == T_FIXED_NUMBER || token->token == T_FLOAT_NUMBER)
+                c->value = token->value;
+            c->nextCachedToken = i + 1;
+            return token->token;
+        }
+    }
+    
+    /* scan the token from the line */
+    return ScanToken(c);
+}
+
+/* ScanToken - read the next token */
+static int ScanToken(ParseContext *c)
 {
     int ch, tkn;
     
@@ -508,13 +872,13 @@ static int NextToken(ParseContext *c)
 /* IdentifierToken - get an identifier */
 static int IdentifierToken(ParseContext *c, int ch)
 {
-    int len, i;
+    int len, tkn;
     char *p;
 
     /* get the identifier */
     p = c->token; *p++ = ch; len = 1;
     while ((ch = GetChar(c)) != EOF && IdentifierCharP(ch)) {
-        if (++len > MAXTOKEN)
+        if (++len >= MAXTOKEN)
             ParseError(c, "Identifier too long");
         *p++ = ch;
     }
@@ -522,9 +886,8 @@ static int IdentifierToken(ParseContext *c, int ch)
     *p = '\0';
 
     /* check to see if it is a keyword */
-    for (i = 0; ktab[i].keyword != NULL; ++i)
-        if (strcasecmp(ktab[i].keyword, c->token) == 0)
-            return ktab[i].token;
+    if ((tkn = FindKeyword(&c->keywordIndex, c->token)) != 0)
+        return tkn;
 
     /* otherwise, it is an identifier */
     return T_IDENTIFIER;
@@ -539,10 +902,11 @@ int IdentifierCharP(int ch)
         || ch == '_';
 }
 
-/* NumberToken - get a number */
+/* NumberToken - get a number (a decimal fraction makes it a fixed point number and an exponent makes it a float) */
 int NumberToken(ParseContext *c, int ch)
 {
     char *p = c->token;
+    int isFixed = FALSE;
 
     /* get the number */
     *p++ = ch;
@@ -552,7 +916,47 @@ int NumberToken(ParseContext *c, int ch)
         else if (ch != '_')
             break;
     }
+    
+    /* check for a fraction */
+    if (ch == '.' && isdigit((int)*c->linePtr)) {
+        uint32_t fraction = 0, scale = 1;
+        *p++ = ch;
+        while ((ch = GetChar(c)) != EOF) {
+            if (isdigit(ch)) {
+                *p++ = ch;
+                if (scale < 1000000000) {
+                    fraction = fraction * 10 + ch - '0';
+                    scale *= 10;
+                }
+            }
+            else if (ch != '_')
+                break;
+        }
+        
+        /* convert the string to a rounded fixed point value */
+        *p = '\0';
+        c->value = (VMVALUE)(((VMUVALUE)atol(c->token) << FIXED_SHIFT)
+                 + (VMUVALUE)((((uint64_t)fraction << FIXED_SHIFT) + scale / 2) / scale));
+        isFixed = TRUE;
+    }
+    
+    /* check for an exponent */
+    if ((ch == 'e' || ch == 'E')
+    &&  (isdigit((int)c->linePtr[0]) || ((c->linePtr[0] == '+' || c->linePtr[0] == '-') && isdigit((int)c->linePtr[1])))) {
+        *p++ = ch;
+        *p++ = GetChar(c);
+        while ((ch = GetChar(c)) != EOF && isdigit(ch))
+            *p++ = ch;
+        UngetC(c);
+        *p = '\0';
+        
+        /* convert the string to a float */
+        c->value = FloatToValue((float)strtod(c->token, NULL));
+        return T_FLOAT_NUMBER;
+    }
     UngetC(c);
+    if (isFixed)
+        return T_FIXED_NUMBER;
     *p = '\0';
     
     /* convert the string to an integer */
@@ -617,7 +1021,7 @@ int StringToken(ParseContext *c)
     /* collect the string */
     p = c->token; len = 0;
     while ((ch = XGetC(c)) != EOF && ch != '"') {
-        if (++len > MAXTOKEN)
+        if (++len >= MAXTOKEN)
             ParseError(c, "String too long");
         *p++ = (ch == '\\' ? LiteralChar(c) : ch);
     }
@@ -759,9 +1163,38 @@ void UngetC(ParseContext *c)
 /* ParseError - report a parsing error */
 void ParseError(ParseContext *c, char *fmt, ...)
 {
+    const char *fileName = NULL;
+    int lineNumber = 0;
+    CachedLine *line;
     ParseFile *f;
     va_list ap;
 
+    /* scan errors while scanning ahead are left for the parser to report */
+    if (c->prescan)
+        longjmp(c->errorTarget, 1);
+
+    /* find the position of the error */
+    if (c->pass > 1 && (line = c->cachedLine) != NULL) {
+        if (line->file)
+            fileName = line->file->name;
+        lineNumber = line->lineNumber;
+    }
+    else if ((f = c->currentFile) != NULL) {
+        if (f != &c->mainFile)
+            fileName = f->u.file.file->name;
+        lineNumber = f->lineNumber;
+    }
+
+    /* report the error and its position to the system if it wants them separately */
+    if (c->sys->ops->diagnostic) {
+        char message[MAXLINE * 2];
+        va_start(ap, fmt);
+        vsnprintf(message, sizeof(message), fmt, ap);
+        va_end(ap);
+        (*c->sys->ops->diagnostic)(c->sys, fileName, lineNumber, c->tokenOffset + 1, message);
+        longjmp(c->errorTarget, 1);
+    }
+
     /* print the error message */
     va_start(ap, fmt);
     xbError(c->sys, "error: ");
@@ -770,11 +1203,11 @@ void ParseError(ParseContext *c, char *fmt, ...)
     va_end(ap);
 
     /* show the context */
-    if ((f = c->currentFile) != NULL) {
-        if (f == &c->mainFile)
-            xbError(c->sys, "  line %d\n", c->currentFile->lineNumber);
+    if (lineNumber > 0) {
+        if (!fileName)
+            xbError(c->sys, "  line %d\n", lineNumber);
         else
-            xbError(c->sys, "  file '%s', line %d\n", f->u.file.file->name, f->lineNumber);
+            xbError(c->sys, "  file '%s', line %d\n", fileName, lineNumber);
         xbError(c->sys, "    %s\n", c->lineBuf);
         xbError(c->sys, "    %*s\n", c->tokenOffset, "^");
     }
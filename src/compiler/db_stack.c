@@ -0,0 +1,461 @@
+/* db_stack.c - static stack usage analysis
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "db_compiler.h"
+#include "db_vmdebug.h"
+
+/* most stack words a FRAME can check for */
+#define MAX_FRAME_DEPTH 255
+
+/* states of the call graph walk */
+#define SU_NEW      0
+#define SU_ACTIVE   1
+#define SU_DONE     2
+
+/* code being analyzed */
+typedef struct {
+    VMUVALUE length;        /* length of the code */
+    int *depths;            /* stack depth on entry to each instruction (-1 if not reached yet) */
+    VMUVALUE *work;         /* instructions that still need to be analyzed */
+    int count;              /* number of instructions on the work list */
+} StackScan;
+
+/* prototypes for local functions */
+static int AnalyzeCode(ParseContext *c, StackUsage *usage);
+static int StackEffect(ParseContext *c, int op, VMUVALUE offset, int *pPops, int *pPushes);
+static int SetDepth(StackScan *scan, VMUVALUE offset, int depth);
+static VMUVALUE BranchTarget(ParseContext *c, int fmt, VMUVALUE offset, int length);
+static Symbol *CallTarget(ParseContext *c, VMUVALUE offset);
+static int StackTotal(ParseContext *c, const char *name, StackUsage *usage);
+
+/* AnalyzeStack - find the stack usage of the code in the bytecode buffer and store it in its FRAME
+   (must be called before the local symbol fixups are applied) */
+void AnalyzeStack(ParseContext *c)
+{
+    StackUsage *usage = (StackUsage *)GlobalAlloc(c, sizeof(StackUsage));
+    int depth;
+
+    /* analyze the code */
+    usage->depth = 0;
+    usage->unknown = FALSE;
+    usage->calls = NULL;
+    usage->state = SU_NEW;
+    usage->total = 0;
+    if (!AnalyzeCode(c, usage)) {
+        usage->unknown = TRUE;
+        usage->depth = MAX_FRAME_DEPTH;
+    }
+    if (c->functionType)
+        c->functionType->u.functionInfo.stackUsage = usage;
+    else
+        c->mainStackUsage = usage;
+
+    /* the frame checks for the words the code pushes after it */
+    if (codeaddr(c) >= 3 && c->codeBuf[0] == OP_FRAME) {
+        if ((depth = usage->depth - c->codeBuf[1]) > MAX_FRAME_DEPTH)
+            ParseError(c, "function needs too much stack");
+        c->codeBuf[2] = (depth < 0 ? 0 : depth);
+    }
+}
+
+/* ComputeStackSize - set the interpreter stack size from the stack usage of the main code and the functions it calls */
+void ComputeStackSize(ParseContext *c)
+{
+    StackUsage *usage = c->mainStackUsage;
+    int size = StackTotal(c, "main code", usage);
+
+    /* use the default size if the usage couldn't be determined */
+    if (size < 0) {
+        if (!c->stackSize)
+            c->stackSize = DEFAULT_STACK_SIZE;
+    }
+
+    /* otherwise, use the size that was computed unless one was given */
+    else {
+        if (!c->stackSize)
+            c->stackSize = size;
+        else if (c->stackSize < size)
+            xbInfo(c->sys, "warning: stacksize option is %d but the program needs %d\n", c->stackSize, size);
+        if (c->flags & COMPILER_INFO)
+            xbInfo(c->sys, "program needs %d stack words\n", size);
+    }
+
+    /* functions check the stack in their frames but the main code must always fit */
+    if (usage && c->stackSize < usage->depth)
+        c->stackSize = usage->depth;
+}
+
+/* AnalyzeCode - find the most stack words used by the code in the bytecode buffer and the calls it makes
+   (returns FALSE if the code can't be analyzed) */
+static int AnalyzeCode(ParseContext *c, StackUsage *usage)
+{
+    StackScan scan;
+    VMUVALUE offset;
+
+    /* allocate the depth table and work list */
+    scan.length = codeaddr(c);
+    scan.depths = (int *)LocalAlloc(c, (scan.length + 1) * sizeof(int));
+    scan.work = (VMUVALUE *)LocalAlloc(c, (scan.length + 1) * sizeof(VMUVALUE));
+    for (offset = 0; offset <= scan.length; ++offset)
+        scan.depths[offset] = -1;
+    scan.count = 0;
+
+    /* follow every path through the code from its start */
+    if (!SetDepth(&scan, 0, 0))
+        return FALSE;
+    while (scan.count > 0) {
+        int op, fmt, length, depth, pops, pushes, n;
+        VMUVALUE next;
+        StackCall *call;
+        Symbol *sym;
+
+        /* decode the next instruction */
+        offset = scan.work[--scan.count];
+        depth = scan.depths[offset];
+        op = c->codeBuf[offset];
+        if ((fmt = InstructionFormat(op)) < 0 || offset + (length = InstructionLength(fmt)) > scan.length)
+            return FALSE;
+        next = offset + length;
+
+        switch (op) {
+
+        /* instructions that end a path */
+        case OP_HALT:
+        case OP_RETURN:
+        case OP_RET:
+        case OP_POPJ:
+            break;
+        case OP_RETURNZ:
+            if (depth + 1 > usage->depth)
+                usage->depth = depth + 1;
+            break;
+
+        /* branches */
+        case OP_BR:
+        case OP_BR8:
+        case OP_BR16:
+            if (!SetDepth(&scan, BranchTarget(c, fmt, offset, length), depth))
+                return FALSE;
+            break;
+        case OP_BRT:
+        case OP_BRF:
+        case OP_BRLTZ:
+        case OP_BRLEZ:
+        case OP_BRGEZ:
+        case OP_BRGTZ:
+        case OP_FORLOOP:
+        case OP_FORLOOPA:
+            if (depth < 1
+            ||  !SetDepth(&scan, BranchTarget(c, fmt, offset, length), depth - 1)
+            ||  !SetDepth(&scan, next, depth - 1))
+                return FALSE;
+            break;
+        case OP_BRLT:
+        case OP_BRLE:
+        case OP_BREQ:
+        case OP_BRNE:
+        case OP_BRGE:
+        case OP_BRGT:
+            if (depth < 2
+            ||  !SetDepth(&scan, BranchTarget(c, fmt, offset, length), depth - 2)
+            ||  !SetDepth(&scan, next, depth - 2))
+                return FALSE;
+            break;
+        case OP_BRTSC:
+        case OP_BRFSC:
+            if (depth < 1
+            ||  !SetDepth(&scan, BranchTarget(c, fmt, offset, length), depth)
+            ||  !SetDepth(&scan, next, depth - 1))
+                return FALSE;
+            break;
+
+        /* the switch table follows the instruction and has an entry for each case and one for the default */
+        case OP_SWITCH:
+            if (depth < 1)
+                return FALSE;
+            for (n = 0; n <= c->codeBuf[offset + 1]; ++n)
+                if (!SetDepth(&scan, next + n * (1 + sizeof(VMVALUE)), depth - 1))
+                    return FALSE;
+            break;
+
+        /* a direct call pushes the return address and the called function may remove its arguments */
+        case OP_CALL:
+            if (!(sym = CallTarget(c, offset + 1)))
+                return FALSE;
+            call = (StackCall *)GlobalAlloc(c, sizeof(StackCall));
+            call->symbol = sym;
+            call->depth = depth + 1;
+            call->next = usage->calls;
+            usage->calls = call;
+            if (depth + 1 > usage->depth)
+                usage->depth = depth + 1;
+            if (PopsArguments(sym->type))
+                depth -= sym->type->u.functionInfo.arguments.count;
+            if (depth < 0 || !SetDepth(&scan, next, depth + 1))
+                return FALSE;
+            break;
+
+        /* calls through a function address can't be followed but keep analyzing to check the code */
+        case OP_PUSHJ:
+            usage->unknown = TRUE;
+            if (!SetDepth(&scan, next, depth))
+                return FALSE;
+            break;
+
+        /* everything else just pops and pushes */
+        default:
+            if (!StackEffect(c, op, offset, &pops, &pushes) || (depth -= pops) < 0)
+                return FALSE;
+            depth += pushes;
+            if (depth > usage->depth)
+                usage->depth = depth;
+            if (!SetDepth(&scan, next, depth))
+                return FALSE;
+            break;
+        }
+    }
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* StackEffect - get the number of stack words an instruction pops and pushes
+   (returns FALSE for an unknown instruction) */
+static int StackEffect(ParseContext *c, int op, VMUVALUE offset, int *pPops, int *pPushes)
+{
+    *pPops = 0;
+    *pPushes = 0;
+    switch (op) {
+    case OP_LIT:
+    case OP_SLIT:
+    case OP_LIT16:
+    case OP_LREF:
+    case OP_LOADA:
+    case OP_GREF:
+    case OP_GREF16:
+    case OP_DUP:
+        *pPushes = 1;
+        break;
+    case OP_NOT:
+    case OP_NEG:
+    case OP_BNOT:
+    case OP_LOAD:
+    case OP_LOADB:
+    case OP_LOADW:
+    case OP_NATIVE:
+    case OP_LINC:
+    case OP_CHECK:
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+    case OP_INDEX:
+    case OP_LOADX:
+    case OP_VREF:
+    case OP_LSET:
+    case OP_DROP:
+    case OP_STOREA:
+    case OP_GSET:
+    case OP_GSET16:
+        *pPops = 1;
+        break;
+    case OP_STORE:
+    case OP_STOREB:
+    case OP_STOREW:
+        *pPops = 2;
+        break;
+    case OP_STOREX:
+    case OP_VSET:
+        *pPops = 3;
+        break;
+    case OP_FRAME:
+        *pPushes = c->codeBuf[offset + 1];
+        break;
+    case OP_CLEAN:
+        *pPops = c->codeBuf[offset + 1];
+        break;
+    case OP_TRAP:
+        switch (c->codeBuf[offset + 1]) {
+        case TRAP_GETCHAR:
+        case TRAP_LOCKNEW:
+        case TRAP_TASKWAIT:
+            *pPushes = 1;
+            break;
+        case TRAP_PUTCHAR:
+        case TRAP_LOCKRET:
+        case TRAP_TASKTIMER:
+            *pPops = 1;
+            break;
+        case TRAP_PUTSTR:
+        case TRAP_STRCPY:
+            *pPops = 2;
+            break;
+        case TRAP_STRLEN:
+        case TRAP_LOCKSET:
+        case TRAP_LOCKCLR:
+        case TRAP_TASKEXIT:
+        case TRAP_YIELD:
+            break;
+        case TRAP_STRCMP:
+            *pPops = 1;
+            break;
+        case TRAP_MEMCPY:
+        case TRAP_MEMSET:
+        case TRAP_ARRDOT:
+        case TRAP_COGSTART:
+        case TRAP_TASKSTART:
+        case TRAP_PUTNUM:
+        case TRAP_FMTNUM:
+        case TRAP_PARSENUM:
+            *pPops = 3;
+            break;
+        case TRAP_ARRSUM:
+        case TRAP_ARRMIN:
+        case TRAP_ARRMAX:
+            *pPops = 2;
+            break;
+        case TRAP_FIXMUL:
+        case TRAP_FIXDIV:
+        case TRAP_FADD:
+        case TRAP_FSUB:
+        case TRAP_FMUL:
+        case TRAP_FDIV:
+        case TRAP_FCMP:
+            *pPops = 1;
+            break;
+        case TRAP_ITOF:
+        case TRAP_FTOI:
+            break;
+        case TRAP_ARRFILL:
+        case TRAP_ARRCOPY:
+        case TRAP_ARRADD:
+            *pPops = 4;
+            break;
+        case TRAP_ARRMAC:
+        case TRAP_ARRSCALE:
+            *pPops = 5;
+            break;
+        case TRAP_BUTTERFLY:
+            *pPops = 6;
+            break;
+        default:
+            return FALSE;
+        }
+        break;
+    default:
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* SetDepth - set the stack depth on entry to an instruction and add it to the work list if it's new
+   (returns FALSE if the instruction isn't in the code or is reached with different depths) */
+static int SetDepth(StackScan *scan, VMUVALUE offset, int depth)
+{
+    if (offset >= scan->length)
+        return FALSE;
+    if (scan->depths[offset] < 0) {
+        scan->depths[offset] = depth;
+        scan->work[scan->count++] = offset;
+    }
+    return scan->depths[offset] == depth;
+}
+
+/* BranchTarget - get the target offset of a branch or loop instruction */
+static VMUVALUE BranchTarget(ParseContext *c, int fmt, VMUVALUE offset, int length)
+{
+    switch (fmt) {
+    case FMT_BR8:
+        return offset + length + (int8_t)c->codeBuf[offset + 1];
+    case FMT_BR16:
+        return offset + length + (int16_t)((c->codeBuf[offset + 1] << 8) | c->codeBuf[offset + 2]);
+    default:
+        return offset + length + rd_cword(c, offset + length - sizeof(VMVALUE));
+    }
+}
+
+/* CallTarget - find the function called by the instruction with its operand at an offset */
+static Symbol *CallTarget(ParseContext *c, VMUVALUE offset)
+{
+    VMUVALUE address, link;
+    LocalFixup *fixup;
+    Symbol *sym;
+
+    /* the operand of a call to a function that hasn't been stored yet is on a fixup chain */
+    for (fixup = c->symbolFixups; fixup != NULL; fixup = fixup->next)
+        for (link = fixup->chain; link != 0; link = rd_cword(c, link))
+            if (link == offset)
+                return fixup->symbol && fixup->symbol->type->id == TYPE_FUNCTION ? fixup->symbol : NULL;
+
+    /* otherwise, it's the address of the function */
+    address = rd_cword(c, offset);
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (sym->type->id == TYPE_FUNCTION && sym->type->u.functionInfo.stackUsage && sym->section
+        &&  sym->section->base + sym->v.variable.offset == address)
+            return sym;
+
+    /* not a known function */
+    return NULL;
+}
+
+/* StackTotal - find the most stack words used by code including the functions it calls
+   (returns -1 if it can't be determined) */
+static int StackTotal(ParseContext *c, const char *name, StackUsage *usage)
+{
+    StackCall *call;
+    int total;
+
+    /* check for code that wasn't analyzed */
+    if (!usage)
+        return -1;
+
+    /* check for recursion and functions that are already done */
+    switch (usage->state) {
+    case SU_ACTIVE:
+        if (!c->stackSize && usage->total == 0)
+            xbInfo(c->sys, "warning: %s is recursive, using the default stack size\n", name);
+        usage->total = -1;
+        return -1;
+    case SU_DONE:
+        return usage->total;
+    }
+
+    /* add the usage of each function called to the stack in use when it's called */
+    usage->state = SU_ACTIVE;
+    if (usage->unknown) {
+        if (!c->stackSize)
+            xbInfo(c->sys, "warning: the stack usage of %s can't be determined, using the default stack size\n", name);
+        total = -1;
+    }
+    else
+        total = usage->depth;
+    for (call = usage->calls; call != NULL; call = call->next) {
+        int size = StackTotal(c, call->symbol->name, call->symbol->type->u.functionInfo.stackUsage);
+        if (size < 0)
+            total = -1;
+        else if (total >= 0 && call->depth + size > total)
+            total = call->depth + size;
+    }
+    usage->state = SU_DONE;
+    usage->total = total;
+
+    /* return the total stack usage */
+    return total;
+}
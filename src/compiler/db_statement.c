@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include "db_compiler.h"
@@ -22,9 +23,13 @@ static void ParseFunctionDef_pass23(ParseContext *c, char *name);
 static void ParseEndDef(ParseContext *c);
 static void ParseDim(ParseContext *c);
 static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize);
-static VMVALUE ParseScalarInitializer(ParseContext *c);
+static Type *ParseScalarType(ParseContext *c);
+static VMVALUE ParseScalarInitializer(ParseContext *c, Type *type);
 static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE size);
+static void StoreInitializer(ParseContext *c, Type *type, VMUVALUE index, VMVALUE value);
 static void ClearArrayInitializers(ParseContext *c, VMVALUE size);
+static void ParseLocalArray(ParseContext *c, char *name, Type *type, VMUVALUE size);
+static int OverlayScalar(ParseContext *c, char *name, Type *type);
 static void ParseImpliedLetOrFunctionCall(ParseContext *c);
 static void ParseLet(ParseContext *c);
 static void ParseIf(ParseContext *c);
@@ -44,18 +49,31 @@ static void ParseLoop(ParseContext *c);
 static void ParseLoopWhile(ParseContext *c);
 static void ParseLoopUntil(ParseContext *c);
 static void ParseAsm(ParseContext *c);
+static void ParseFcache(ParseContext *c);
+static uint8_t *AssembleFcache(ParseContext *c, uint8_t *p, const char *fmt, ...);
 static void ParseGoto(ParseContext *c);
 static void ParseReturn(ParseContext *c);
 static void ParseInput(ParseContext *c);
 static void ParsePrint(ParseContext *c);
+static void ParseCogStart(ParseContext *c);
+static void ParseTask(ParseContext *c);
+static void ParseYield(ParseContext *c);
+static void ParseWaitFor(ParseContext *c);
+static void ParseStartCall(ParseContext *c, char *keyword, VMVALUE reserved, char *startName, char *exitName);
 
 /* prototypes */
 static void StartFunction(ParseContext *c, Symbol *sym);
 static ParseTreeNode *BuildHandlerCall(ParseContext *c, char *name, ParseTreeNode *devExpr, ParseTreeNode *expr);
 static ParseTreeNode *BuildHandlerFunctionCall(ParseContext *c, char *name, ParseTreeNode *devExpr, ParseTreeNode *expr);
+static ParseTreeNode *BuildHelperCall(ParseContext *c, char *name, int argc);
+static ParseTreeNode *BuildCogStartArg(ParseContext *c, ParseTreeNode *expr);
+static void AddCallArg(ParseContext *c, ParseTreeNode *call, ParseTreeNode *expr);
 static void DefineLabel(ParseContext *c, char *name);
+static Label *FindLabel(ParseContext *c, const char *name);
+static Label *AddLabel(ParseContext *c, const char *name, LabelState state);
 static void PushBlock(ParseContext *c, BlockType type, ParseTreeNode *node);
 static void PopBlock(ParseContext *c);
+static void PopLoopBlock(ParseContext *c);
 static void Assemble(ParseContext *c, char *opname);
 static VMVALUE ParseIntegerConstant(ParseContext *c);
 
@@ -173,6 +191,18 @@ again:
             case T_PRINT:
                 ParsePrint(c);
                 break;
+            case T_COGSTART:
+                ParseCogStart(c);
+                break;
+            case T_TASK:
+                ParseTask(c);
+                break;
+            case T_YIELD:
+                ParseYield(c);
+                break;
+            case T_WAITFOR:
+                ParseWaitFor(c);
+                break;
             case T_IDENTIFIER:
                 if (SkipSpaces(c) == ':') {
                     DefineLabel(c, c->token);
@@ -212,6 +242,10 @@ static void ParseOption(ParseContext *c)
     /* handle the 'target' option */
     if (strcasecmp(c->token, "stacksize") == 0)
         SetIntegerOption(c, &c->stackSize);
+        
+    /* handle the 'overlay' option */
+    else if (strcasecmp(c->token, "overlay") == 0)
+        SetIntegerOption(c, &c->overlay);
 
     /* unknown option */
     else
@@ -260,7 +294,7 @@ static void ParseConstantDef(ParseContext *c, char *name)
 
         /* make sure it's a constant */
         if (IsIntegerLit(expr))
-            AddGlobalConstantInteger(c, name, expr->u.integerLit.value);
+            AddGlobalConstantInteger(c, name, expr->u.integerLit.value)->type = expr->type;
         else if (IsStringLit(expr))
             AddGlobalConstantString(c, name, expr->u.stringLit.string);
         else
@@ -292,6 +326,7 @@ static void ParseFunctionDef(ParseContext *c, char *name)
 /* ParseFunctionDef_pass1 - parse a 'DEF <name>' statement during pass 1 */
 static void ParseFunctionDef_pass1(ParseContext *c, char *name)
 {
+    Section *hub;
     Symbol *sym;
     Type *type;
     int tkn;
@@ -300,6 +335,21 @@ static void ParseFunctionDef_pass1(ParseContext *c, char *name)
     type = NewGlobalType(c, TYPE_FUNCTION);
     type->u.functionInfo.returnType = &c->integerType;
     InitSymbolTable(&type->u.functionInfo.arguments);
+    type->u.functionInfo.callerCleans = FALSE;
+    type->u.functionInfo.inlineDefinition = NULL;
+    type->u.functionInfo.inlined = FALSE;
+    type->u.functionInfo.hot = FALSE;
+    type->u.functionInfo.started = FALSE;
+    type->u.functionInfo.native = FALSE;
+    type->u.functionInfo.stackUsage = NULL;
+    type->u.functionInfo.localArrays = NULL;
+    type->u.functionInfo.localArraySize = 0;
+    type->u.functionInfo.localScalarSize = 0;
+    type->u.functionInfo.overlayScalars = FALSE;
+    type->u.functionInfo.arrayState = AS_NEW;
+    type->u.functionInfo.arrayPrivate = FALSE;
+    type->u.functionInfo.arrayHeight = 0;
+    type->u.functionInfo.arrayCaller = NULL;
     c->functionType = type;
 
     /* enter the function name in the global symbol table */
@@ -321,7 +371,37 @@ static void ParseFunctionDef_pass1(ParseContext *c, char *name)
             } while ((tkn = GetToken(c)) == ',');
         }
         Require(c, tkn, ')');
+        tkn = GetToken(c);
     }
+    
+    /* check for a return type */
+    if (tkn == T_AS) {
+        c->functionType->u.functionInfo.returnType = ParseScalarType(c);
+        tkn = GetToken(c);
+    }
+    
+    /* check for a target section (otherwise hot functions go to hub memory if there's room) */
+    if (tkn == T_IN) {
+        FRequire(c, T_STRING);
+        if (strcasecmp(c->token, "text") == 0)
+            sym->section = c->textTarget;
+        else if (strcasecmp(c->token, "data") == 0)
+            sym->section = c->dataTarget;
+        else if (!(sym->section = GetSection(c->config, c->token)))
+            ParseError(c, "no section '%s'", c->token);
+    }
+    else {
+        SaveToken(c, tkn);
+        sym->section = c->textTarget;
+        if (IsHotFunction(c, name) && (hub = GetSection(c->config, "hub")) != NULL && hub != c->textTarget) {
+            c->functionType->u.functionInfo.hot = TRUE;
+            sym->section = hub;
+        }
+    }
+    
+    /* check for the native code attribute */
+    if ((tkn = GetToken(c)) == T_IDENTIFIER && strcasecmp(c->token, "native") == 0)
+        c->functionType->u.functionInfo.native = TRUE;
     else
         SaveToken(c, tkn);
         
@@ -333,7 +413,6 @@ static void ParseFunctionDef_pass23(ParseContext *c, char *name)
 {
     Symbol *sym;
     sym = FindSymbol(&c->globals, name);
-    sym->section = c->textTarget;
     StartFunction(c, sym);
 }
 
@@ -348,9 +427,11 @@ static void StartFunction(ParseContext *c, Symbol *sym)
     node->u.functionDefinition.symbol = sym;
     InitSymbolTable(&node->u.functionDefinition.locals);
     node->u.functionDefinition.labels = NULL;
+    InitHashTable(&node->u.functionDefinition.labelIndex);
     node->u.functionDefinition.localOffset = 0;
     c->dependencies = NULL;
     c->pNextDependency = &c->dependencies;
+    ++c->dependencyMark;
     
     /* setup to compile the function body */
     PushBlock(c, BLOCK_FUNCTION, node);
@@ -392,6 +473,10 @@ void EndFunction(ParseContext *c)
         else
             c->mainDependencies = c->dependencies;
             
+        /* save small functions for inline expansion */
+        if (c->functionType && (c->flags & COMPILER_OPTIMIZE))
+            SaveInlineCandidate(c);
+
         /* show the parse tree if requested */
         if (c->flags & COMPILER_DEBUG) {
             xbInfo(c->sys, "\n");
@@ -407,13 +492,18 @@ void EndFunction(ParseContext *c)
     /* generate code on pass 3 */
     else {
     
-        /* handle named functions */
+        /* optimize the parse tree before generating code from it */
+        if (c->flags & COMPILER_OPTIMIZE2) {
+            OptimizeFunction(c, c->function);
+            if (c->flags & COMPILER_DEBUG) {
+                xbInfo(c->sys, "\noptimized ");
+                PrintNode(c->function, 0);
+            }
+        }
+            
+        /* handle named functions that are reachable from the main code */
         if (c->functionType) {
-            Symbol *sym = c->function->u.functionDefinition.symbol;
-            for (d = c->mainDependencies; d != NULL; d = d->next)
-                if (sym == d->symbol)
-                    break;
-            if (d)
+            if (c->function->u.functionDefinition.symbol->referenced)
                 StoreCode(c);
         }
         
@@ -464,13 +554,15 @@ static void ParseDim(ParseContext *c)
         if (c->functionType) {
             ParseTreeNode *expr;
         
-            /* local arrays are not yet supported */
-            if (isArray)
-                ParseError(c, "local arrays are not supported");
+            /* arrays are placed with the global data */
+            if (isArray) {
+                ParseLocalArray(c, name, type, size);
+                continue;
+            }
             
-            /* only integer locals are currently supported */
-            if (type != &c->integerType)
-                ParseError(c, "only integer locals are currently supported");
+            /* only integer, fixed point and float locals are currently supported */
+            if (type != &c->integerType && type != &c->fixedType && type != &c->floatType)
+                ParseError(c, "only integer, fixed point and float locals are currently supported");
                 
             /* check for an initializer */
             if ((tkn = GetToken(c)) == '=')
@@ -484,15 +576,25 @@ static void ParseDim(ParseContext *c)
                 
             if (c->pass > 1) {
             
-                /* add the local symbol */
-                AddLocal(c, name, type, -F_SIZE - c->function->u.functionDefinition.localOffset - 1);
-                c->function->u.functionDefinition.localOffset += ValueSize(type, 0);
+                /* add the local symbol unless OPTION overlay placed it with the shared local arrays
+                   (where it is cleared as it would be in a new frame) */
+                if (c->overlay && OverlayScalar(c, name, type)) {
+                    if (!expr) {
+                        expr = NewParseTreeNode(c, NodeTypeIntegerLit);
+                        expr->type = &c->integerType;
+                        expr->u.integerLit.value = 0;
+                    }
+                }
+                else {
+                    AddLocal(c, name, type, -F_SIZE - c->function->u.functionDefinition.localOffset - 1);
+                    c->function->u.functionDefinition.localOffset += ValueSize(type, 0);
+                }
                 
                 /* compile the initialization code */
                 if (expr) {
                     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeLetStatement);
                     node->u.letStatement.lvalue = GetSymbolRef(c, name);
-                    node->u.letStatement.rvalue = expr;
+                    node->u.letStatement.rvalue = ConvertExpr(c, expr, type);
                     AddNodeToList(c, &c->bptr->pNextStatement, node);
                 }
             }
@@ -521,10 +623,19 @@ static void ParseDim(ParseContext *c)
             
             /* check for initializers */
             if ((tkn = GetToken(c)) == '=') {
-                if (isArray)
+                if (isArray && type->u.arrayInfo.elementType->id == TYPE_ARRAY) {
+                    Type *elementType = type->u.arrayInfo.elementType;
+                    VMUVALUE count = size;
+                    
+                    /* the elements of a multi-dimensional array are initialized in row order */
+                    for (; elementType->id == TYPE_ARRAY; elementType = elementType->u.arrayInfo.elementType)
+                        count *= elementType->u.arrayInfo.size;
+                    ParseArrayInitializers(c, elementType, count);
+                }
+                else if (isArray)
                     size = ParseArrayInitializers(c, type->u.arrayInfo.elementType, size);
                 else
-                    value = ParseScalarInitializer(c);
+                    value = ParseScalarInitializer(c, type);
             }
             
             /* no initializers */
@@ -537,19 +648,26 @@ static void ParseDim(ParseContext *c)
                 }
             }
 
-            /* add the symbol on pass 1 */
+            /* add the symbol on pass 1 (its data is placed at the end of pass 2 if it is referenced) */
             if (c->pass == 1) {
+                Symbol *sym;
             
                 /* handle arrays */
                 if (isArray) {
-                    AddGlobalSymbol(c, name, SC_CONSTANT, type, target);
-                    target->offset += WriteSection(c, target, c->cptr, ValueSize(type, size) * sizeof(VMVALUE));
+                    sym = AddGlobalOffset(c, name, SC_CONSTANT, type, UNDEF_VALUE);
+                    sym->section = target;
+                    sym->arraySize = size;
+                    AddGlobalData(c, sym, c->cptr, ValueSize(type, size) * sizeof(VMVALUE), FALSE);
                 }
                 
-                /* handle scalars */
+                /* handle scalars (bytes and words are packed together) */
                 else {
-                    AddGlobalSymbol(c, name, SC_GLOBAL, type, target);
-                    target->offset += WriteSection(c, target, (uint8_t *)&value, sizeof(VMVALUE));
+                    sym = AddGlobalOffset(c, name, SC_GLOBAL, type, UNDEF_VALUE);
+                    sym->section = target;
+                    if (ValueByteSize(type) < sizeof(VMVALUE))
+                        AddGlobalData(c, sym, (uint8_t *)&value, ValueByteSize(type), TRUE);
+                    else
+                        AddGlobalData(c, sym, (uint8_t *)&value, sizeof(VMVALUE), FALSE);
                 }
             }                
         }
@@ -558,11 +676,98 @@ static void ParseDim(ParseContext *c)
     Require(c, tkn, T_EOL);
 }
 
+/* ParseLocalArray - declare an array in a function (the name refers to a hidden global whose memory
+   PlaceLocalArrays shares with the arrays of functions that can't be active at the same time) */
+static void ParseLocalArray(ParseContext *c, char *name, Type *type, VMUVALUE size)
+{
+    Type *functionType = c->functionType;
+    char globalName[MAXTOKEN * 2 + 2];
+    LocalArray *array, **pNext;
+    Symbol *sym, *local;
+    int tkn;
+    
+    /* the array isn't set up again each time the function is called */
+    if ((tkn = GetToken(c)) == '=' || tkn == T_IN)
+        ParseError(c, "local arrays can't have initializers or a section");
+    SaveToken(c, tkn);
+    if (size == 0)
+        ParseError(c, "no array size specified");
+        
+    if (c->pass > 1) {
+    
+        /* the local symbol refers to the global */
+        local = AddLocal(c, name, type, 0);
+        local->storageClass = SC_CONSTANT;
+        sprintf(globalName, "%s.%s", c->function->u.functionDefinition.symbol->name, name);
+        
+        /* add the global and its place among the function's arrays on pass 2 */
+        if (c->pass == 2) {
+            sym = AddGlobalOffset(c, globalName, SC_CONSTANT, type, UNDEF_VALUE);
+            sym->section = c->dataTarget;
+            sym->arraySize = size;
+            array = (LocalArray *)GlobalAlloc(c, sizeof(LocalArray));
+            array->next = NULL;
+            array->symbol = sym;
+            array->scalar = FALSE;
+            array->offset = functionType->u.functionInfo.localArraySize;
+            functionType->u.functionInfo.localArraySize += ValueSize(type, size);
+            for (pNext = &functionType->u.functionInfo.localArrays; *pNext != NULL; pNext = &(*pNext)->next)
+                ;
+            *pNext = array;
+        }
+        else
+            sym = FindSymbol(&c->globals, globalName);
+        local->v.global = sym;
+    }
+}
+
+/* OverlayScalar - add a hidden global for a scalar declared in a function on pass 2 and refer to it on pass 3
+   if PlaceLocalArrays found that the function can't be active more than once (returns TRUE if the name
+   refers to the global) */
+static int OverlayScalar(ParseContext *c, char *name, Type *type)
+{
+    Type *functionType = c->functionType;
+    char globalName[MAXTOKEN * 2 + 2];
+    LocalArray *array, **pNext;
+    Symbol *sym, *local;
+    
+    /* NATIVE functions keep their locals in registers */
+    if (functionType->u.functionInfo.native)
+        return FALSE;
+    sprintf(globalName, "%s.%s", c->function->u.functionDefinition.symbol->name, name);
+    
+    /* the dependencies are collected with the scalar in the frame */
+    if (c->pass == 2) {
+        sym = AddGlobalOffset(c, globalName, SC_GLOBAL, type, UNDEF_VALUE);
+        sym->section = c->dataTarget;
+        array = (LocalArray *)GlobalAlloc(c, sizeof(LocalArray));
+        array->next = NULL;
+        array->symbol = sym;
+        array->scalar = TRUE;
+        array->offset = functionType->u.functionInfo.localScalarSize;
+        functionType->u.functionInfo.localScalarSize += ValueSize(type, 0);
+        for (pNext = &functionType->u.functionInfo.localArrays; *pNext != NULL; pNext = &(*pNext)->next)
+            ;
+        *pNext = array;
+        return FALSE;
+    }
+    
+    /* the code refers to the global if it was placed */
+    if (!functionType->u.functionInfo.overlayScalars)
+        return FALSE;
+    local = AddLocal(c, name, type, 0);
+    local->storageClass = SC_GLOBAL;
+    local->v.global = FindSymbol(&c->globals, globalName);
+    return TRUE;
+}
+
 /* ParseVariableDecl - parse a variable declaration */
 static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize)
 {
     Type *type = &c->integerType;
+    VMUVALUE dims[MAXDIMS];
     int isArray = FALSE;
+    int dimCount = 1;
     int tkn;
 
     /* parse the variable name */
@@ -577,23 +782,31 @@ static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize)
         if ((tkn = GetToken(c)) == ')')
             *pSize = 0;
 
-        /* otherwise, parse the array size */
+        /* otherwise, parse the size of each dimension */
         else {
             ParseTreeNode *expr;
 
             /* put back the token */
             SaveToken(c, tkn);
 
-            /* get the array size */
-            expr = ParseExpr(c);
-
-            /* make sure it's a constant */
-            if (!IsIntegerLit(expr) || expr->u.integerLit.value <= 0)
-                ParseError(c, "expecting a positive constant expression");
-            *pSize = (VMUVALUE)expr->u.integerLit.value;
+            dimCount = 0;
+            do {
+                if (dimCount >= MAXDIMS)
+                    ParseError(c, "too many array dimensions");
+                    
+                /* get the size of the dimension */
+                expr = ParseExpr(c);
 
-            /* only one dimension allowed for now */
-            FRequire(c, ')');
+                /* make sure it's a constant */
+                if (!IsIntegerLit(expr) || expr->u.integerLit.value <= 0)
+                    ParseError(c, "expecting a positive constant expression");
+                dims[dimCount++] = (VMUVALUE)expr->u.integerLit.value;
+                
+            } while ((tkn = GetToken(c)) == ',');
+            Require(c, tkn, ')');
+            
+            /* the size of an array is the number of elements in its first dimension */
+            *pSize = dims[0];
         }
         
         /* get the next token */
@@ -601,22 +814,28 @@ static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize)
     }
 
     /* check for a type specification */
-    if (tkn == T_AS) {
-        FRequire(c, T_IDENTIFIER);
-        if (strcasecmp(c->token, "INTEGER") == 0)
-            type = &c->integerType;
-        else if (strcasecmp(c->token, "BYTE") == 0)
-            type = &c->byteType;
-        else
-            ParseError(c, "unknown type: %s", c->token);
-    }
+    if (tkn == T_AS)
+        type = ParseScalarType(c);
 
     /* just use the default type */
     else
         SaveToken(c, tkn);
     
+    /* a multi-dimensional array is an array of rows stored one after another */
+    if (isArray && dimCount > 1) {
+        Type *elementType = type;
+        while (--dimCount > 0) {
+            Type *rowType = NewGlobalType(c, TYPE_ARRAY);
+            rowType->u.arrayInfo.elementType = elementType;
+            rowType->u.arrayInfo.size = dims[dimCount];
+            elementType = rowType;
+        }
+        type = NewGlobalType(c, TYPE_ARRAY);
+        type->u.arrayInfo.elementType = elementType;
+    }
+    
     /* handle array types */
-    if (isArray) {
+    else if (isArray) {
         switch (type->id) {
         case TYPE_INTEGER:
             type = &c->integerArrayType;
@@ -624,6 +843,15 @@ static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize)
         case TYPE_BYTE:
             type = &c->byteArrayType;
             break;
+        case TYPE_WORD:
+            type = &c->wordArrayType;
+            break;
+        case TYPE_FIXED:
+            type = &c->fixedArrayType;
+            break;
+        case TYPE_FLOAT:
+            type = &c->floatArrayType;
+            break;
         default:
             ParseError(c, "unknown type: %d", type->id);
             break;                
@@ -634,11 +862,37 @@ static Type *ParseVariableDecl(ParseContext *c, char *name, VMUVALUE *pSize)
     return type;
 }
 
+/* ParseScalarType - parse the type name following AS */
+static Type *ParseScalarType(ParseContext *c)
+{
+    Type *type;
+    FRequire(c, T_IDENTIFIER);
+    if (strcasecmp(c->token, "INTEGER") == 0)
+        type = &c->integerType;
+    else if (strcasecmp(c->token, "BYTE") == 0)
+        type = &c->byteType;
+    else if (strcasecmp(c->token, "WORD") == 0)
+        type = &c->wordType;
+    else if (strcasecmp(c->token, "FIXED") == 0)
+        type = &c->fixedType;
+    else if (strcasecmp(c->token, "FLOAT") == 0)
+        type = &c->floatType;
+    else {
+        ParseError(c, "unknown type: %s", c->token);
+        type = NULL; // never reached
+    }
+    return type;
+}
+
 /* ParseScalarInitializer - parse a scalar initializer */
-static VMVALUE ParseScalarInitializer(ParseContext *c)
+static VMVALUE ParseScalarInitializer(ParseContext *c, Type *type)
 {
     ParseTreeNode *expr = ParseExpr(c);
     VMVALUE value;
+    
+    /* convert between integer and fixed point */
+    if (IsNumericType(expr->type))
+        expr = ConvertExpr(c, expr, type);
 
     if (IsIntegerLit(expr))
         value = expr->u.integerLit.value;
@@ -655,8 +909,6 @@ static VMVALUE ParseScalarInitializer(ParseContext *c)
 /* ParseArrayInitializers - parse array initializers */
 static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE size)
 {
-    VMVALUE *wp = (VMVALUE *)c->cptr;
-    uint8_t *bp = (uint8_t *)c->cptr;
     VMUVALUE remaining = size;
     VMUVALUE count = 0;
     int tkn;
@@ -690,24 +942,10 @@ static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE siz
                 --remaining;
         
                 /* get the initializer */
-                initializer = ParseScalarInitializer(c);
+                initializer = ParseScalarInitializer(c, type);
         
                 /* store the initial value */
-                switch (type->id) {
-                case TYPE_INTEGER:
-                    *wp++ = initializer;
-                    if (wp >= (VMVALUE *)c->ctop)
-                        ParseError(c, "insufficient data space");
-                    break;
-                case TYPE_BYTE:
-                    *bp++ = initializer;
-                    if (bp >= (uint8_t *)c->ctop)
-                        ParseError(c, "insufficient data space");
-                    break;
-                default:
-                    break;
-                }
-                ++count;
+                StoreInitializer(c, type, count++, initializer);
                     
                 switch (tkn = GetToken(c)) {
                 case T_EOL:
@@ -749,57 +987,52 @@ static VMUVALUE ParseArrayInitializers(ParseContext *c, Type *type, VMUVALUE siz
             --remaining;
             
             /* store the initial value */
-            switch (type->id) {
-            case TYPE_INTEGER:
-                *wp++ = *p++;
-                if (wp >= (VMVALUE *)c->ctop)
-                    ParseError(c, "insufficient data space");
-                break;
-            case TYPE_BYTE:
-                *bp++ = *p++;
-                if (bp >= (uint8_t *)c->ctop)
-                    ParseError(c, "insufficient data space");
-                break;
-            default:
-                break;
-            }
-            ++count;
+            StoreInitializer(c, type, count++, *p++);
         }
     }
     
     /* fill the remaining entries with zero */
     if (size > 0) {
-        while (remaining > 0) {
-            switch (type->id) {
-            case TYPE_INTEGER:
-                *wp++ = 0;
-                if (wp >= (VMVALUE *)c->ctop)
-                    ParseError(c, "insufficient data space");
-                break;
-            case TYPE_BYTE:
-                *bp++ = 0;
-                if (bp >= (uint8_t *)c->ctop)
-                    ParseError(c, "insufficient data space");
-                break;
-            default:
-                break;
-            }
-            --remaining;
-        }
+        for (; remaining > 0; --remaining)
+            StoreInitializer(c, type, count++, 0);
     }
     
     /* return the actual number of elements */
     return size > 0 ? size : count;
 }
 
+/* StoreInitializer - store an array initializer after the current position in the code buffer */
+static void StoreInitializer(ParseContext *c, Type *type, VMUVALUE index, VMVALUE value)
+{
+    switch (type->id) {
+    case TYPE_INTEGER:
+    case TYPE_FIXED:
+    case TYPE_FLOAT:
+        if (!GrowCode(c, (index + 1) * sizeof(VMVALUE)))
+            ParseError(c, "insufficient data space");
+        ((VMVALUE *)c->cptr)[index] = value;
+        break;
+    case TYPE_WORD:
+        if (!GrowCode(c, (index + 1) * sizeof(uint16_t)))
+            ParseError(c, "insufficient data space");
+        ((uint16_t *)c->cptr)[index] = value;
+        break;
+    case TYPE_BYTE:
+        if (!GrowCode(c, index + 1))
+            ParseError(c, "insufficient data space");
+        c->cptr[index] = value;
+        break;
+    default:
+        break;
+    }
+}
+
 /* ClearArrayInitializers - clear the array initializers */
 static void ClearArrayInitializers(ParseContext *c, VMVALUE size)
 {
-    VMVALUE *dataPtr = (VMVALUE *)c->cptr;
-    VMVALUE *dataTop = (VMVALUE *)c->ctop;
-    if (dataPtr + size > dataTop)
+    if (!GrowCode(c, size * sizeof(VMVALUE)))
         ParseError(c, "insufficient object initializer space");
-    memset(dataPtr, 0, size * sizeof(VMVALUE));
+    memset(c->cptr, 0, size * sizeof(VMVALUE));
 }
 
 /* ParseImpliedLetOrFunctionCall - parse an implied let statement or a function call */
@@ -812,7 +1045,7 @@ static void ParseImpliedLetOrFunctionCall(ParseContext *c)
     case '=':
         node = NewParseTreeNode(c, NodeTypeLetStatement);
         node->u.letStatement.lvalue = expr;
-        node->u.letStatement.rvalue = ParseExpr(c);
+        node->u.letStatement.rvalue = ConvertExpr(c, ParseExpr(c), expr->type);
         break;
     default:
         SaveToken(c, tkn);
@@ -830,7 +1063,7 @@ static void ParseLet(ParseContext *c)
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeLetStatement);
     node->u.letStatement.lvalue = ParsePrimary(c);
     FRequire(c, '=');
-    node->u.letStatement.rvalue = ParseExpr(c);
+    node->u.letStatement.rvalue = ConvertExpr(c, ParseExpr(c), node->u.letStatement.lvalue->type);
     AddNodeToList(c, &c->bptr->pNextStatement, node);
     FRequire(c, T_EOL);
 }
@@ -909,6 +1142,8 @@ static void ParseSelect(ParseContext *c)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeSelectStatement);
     node->u.selectStatement.expr = ParseExpr(c);
+    if (node->u.selectStatement.expr->type->id == TYPE_FLOAT)
+        ParseError(c, "can't SELECT on a float value");
     AddNodeToList(c, &c->bptr->pNextStatement, node);
     PushBlock(c, BLOCK_SELECT, node);
     c->bptr->pNextStatement = &node->u.selectStatement.caseStatements;
@@ -951,14 +1186,14 @@ static void ParseCase(ParseContext *c)
 
             /* parse the single value or begining of a range */
             entry = (CaseListEntry *)xbLocalAlloc(c->sys, sizeof(CaseListEntry));
-            entry->fromExpr = ParseExpr(c);
+            entry->fromExpr = ConvertExpr(c, ParseExpr(c), c->bptr->node->u.selectStatement.expr->type);
             entry->next = NULL;
             *pNext = entry;
             pNext = &entry->next;
 
             /* handle an 'expr TO expr' range */
             if ((tkn = GetToken(c)) == T_TO) {
-                entry->toExpr = ParseExpr(c);
+                entry->toExpr = ConvertExpr(c, ParseExpr(c), c->bptr->node->u.selectStatement.expr->type);
             }
 
             /* handle a single expression */
@@ -1002,30 +1237,42 @@ static void ParseEnd(ParseContext *c)
 static void ParseFor(ParseContext *c)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeForStatement);
+    NodeListEntry **pEntry = c->bptr->pNextStatement;
+    ParseTreeNode *var;
     int tkn;
 
     AddNodeToList(c, &c->bptr->pNextStatement, node);
 
     PushBlock(c, BLOCK_FOR, node);
     c->bptr->pNextStatement = &node->u.forStatement.bodyStatements;
+    c->bptr->pLoopEntry = pEntry;
 
     /* get the control variable */
     FRequire(c, T_IDENTIFIER);
-    node->u.forStatement.var = GetSymbolRef(c, c->token);
+    node->u.forStatement.var = var = GetSymbolRef(c, c->token);
+    if (var->type->id == TYPE_FLOAT)
+        ParseError(c, "FOR control variable can't be a float");
 
     /* parse the starting value expression */
     FRequire(c, '=');
-    node->u.forStatement.startExpr = ParseExpr(c);
+    node->u.forStatement.startExpr = ConvertExpr(c, ParseExpr(c), var->type);
 
     /* parse the TO expression and generate the loop termination test */
     FRequire(c, T_TO);
-    node->u.forStatement.endExpr = ParseExpr(c);
+    node->u.forStatement.endExpr = ConvertExpr(c, ParseExpr(c), var->type);
 
     /* get the STEP expression */
     if ((tkn = GetToken(c)) == T_STEP) {
-        node->u.forStatement.stepExpr = ParseExpr(c);
+        node->u.forStatement.stepExpr = ConvertExpr(c, ParseExpr(c), var->type);
         tkn = GetToken(c);
     }
+    
+    /* the default step of a fixed point variable is 1.0 */
+    else if (var->type->id == TYPE_FIXED) {
+        node->u.forStatement.stepExpr = NewParseTreeNode(c, NodeTypeIntegerLit);
+        node->u.forStatement.stepExpr->type = &c->fixedType;
+        node->u.forStatement.stepExpr->u.integerLit.value = FIXED_ONE;
+    }
     Require(c, tkn, T_EOL);
 }
 
@@ -1037,7 +1284,7 @@ static void ParseNext(ParseContext *c)
         FRequire(c, T_IDENTIFIER);
         //if (GetSymbolRef(c, c->token) != c->bptr->node->u.forStatement.var)
         //    ParseError(c, "wrong variable in FOR");
-        PopBlock(c);
+        PopLoopBlock(c);
         break;
     default:
         ParseError(c, "NEXT without a matching FOR");
@@ -1050,10 +1297,12 @@ static void ParseNext(ParseContext *c)
 static void ParseDo(ParseContext *c)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeLoopStatement);
+    NodeListEntry **pEntry = c->bptr->pNextStatement;
     node->u.loopStatement.test = NULL;
     AddNodeToList(c, &c->bptr->pNextStatement, node);
     PushBlock(c, BLOCK_DO, node);
     c->bptr->pNextStatement = &node->u.loopStatement.bodyStatements;
+    c->bptr->pLoopEntry = pEntry;
     FRequire(c, T_EOL);
 }
 
@@ -1061,10 +1310,12 @@ static void ParseDo(ParseContext *c)
 static void ParseDoWhile(ParseContext *c)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeDoWhileStatement);
+    NodeListEntry **pEntry = c->bptr->pNextStatement;
     node->u.loopStatement.test = ParseExpr(c);
     AddNodeToList(c, &c->bptr->pNextStatement, node);
     PushBlock(c, BLOCK_DO, node);
     c->bptr->pNextStatement = &node->u.loopStatement.bodyStatements;
+    c->bptr->pLoopEntry = pEntry;
     FRequire(c, T_EOL);
 }
 
@@ -1072,10 +1323,12 @@ static void ParseDoWhile(ParseContext *c)
 static void ParseDoUntil(ParseContext *c)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeDoUntilStatement);
+    NodeListEntry **pEntry = c->bptr->pNextStatement;
     node->u.loopStatement.test = ParseExpr(c);
     AddNodeToList(c, &c->bptr->pNextStatement, node);
     PushBlock(c, BLOCK_DO, node);
     c->bptr->pNextStatement = &node->u.loopStatement.bodyStatements;
+    c->bptr->pLoopEntry = pEntry;
     FRequire(c, T_EOL);
 }
 
@@ -1084,7 +1337,7 @@ static void ParseLoop(ParseContext *c)
 {
     switch (c->bptr->type) {
     case BLOCK_DO:
-        PopBlock(c);
+        PopLoopBlock(c);
         break;
     default:
         ParseError(c, "LOOP without a matching DO");
@@ -1102,7 +1355,7 @@ static void ParseLoopWhile(ParseContext *c)
             ParseError(c, "can't have a test at both the top and bottom of a loop");
         c->bptr->node->nodeType = NodeTypeLoopWhileStatement;
         c->bptr->node->u.loopStatement.test = ParseExpr(c);
-        PopBlock(c);
+        PopLoopBlock(c);
         break;
     default:
         ParseError(c, "LOOP without a matching DO");
@@ -1120,7 +1373,7 @@ static void ParseLoopUntil(ParseContext *c)
             ParseError(c, "can't have a test at both the top and bottom of a loop");
         c->bptr->node->nodeType = NodeTypeLoopUntilStatement;
         c->bptr->node->u.loopStatement.test = ParseExpr(c);
-        PopBlock(c);
+        PopLoopBlock(c);
         break;
     default:
         ParseError(c, "LOOP without a matching DO");
@@ -1132,13 +1385,21 @@ static void ParseLoopUntil(ParseContext *c)
 /* ParseAsm - parse the 'ASM ... END ASM' statement */
 static void ParseAsm(ParseContext *c)
 {
-    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeAsmStatement);
-    uint8_t *start = c->cptr;
+    ParseTreeNode *node;
+    VMUVALUE start;
     int length;
     int tkn;
     
+    /* check for an FCACHE block */
+    if ((tkn = GetToken(c)) == T_IDENTIFIER && strcasecmp(c->token, "FCACHE") == 0) {
+        ParseFcache(c);
+        return;
+    }
+    
     /* check for the end of the 'ASM' statement */
-    FRequire(c, T_EOL);
+    Require(c, tkn, T_EOL);
+    node = NewParseTreeNode(c, NodeTypeAsmStatement);
+    start = codeaddr(c);
     
     /* parse each assembly instruction */
     for (;;) {
@@ -1164,21 +1425,175 @@ static void ParseAsm(ParseContext *c)
     }
     
     /* store the code */
-    length = c->cptr - start;
+    length = codeaddr(c) - start;
     node->u.asmStatement.code = xbLocalAlloc(c->sys, length);
     node->u.asmStatement.length = length;
-    memcpy(node->u.asmStatement.code, start, length);
+    memcpy(node->u.asmStatement.code, c->codeBuf + start, length);
     AddNodeToList(c, &c->bptr->pNextStatement, node);
-    c->cptr = start;
+    c->cptr = c->codeBuf + start;
     
     /* check for the end of the 'END ASM' statement */
     FRequire(c, T_EOL);
 }
 
+/* ParseFcache - parse the 'ASM FCACHE [ expr ] ... END ASM' statement
+   (the lines are PASM that is loaded into the FCACHE buffer of the hub VM cog and run from
+    there with the value of the expression in tos, a line can start with a :name label and
+    the other lines can use :name for the cog address of the instruction after it) */
+static void ParseFcache(ParseContext *c)
+{
+    uint8_t data[(LMM_FCACHE_SIZE * 3 + 6) * sizeof(VMUVALUE)], *p;
+    char names[LMM_FCACHE_SIZE][MAXTOKEN];
+    int addrs[LMM_FCACHE_SIZE];
+    char name[32], line[MAXLINE], *lines, *src, *dst, *label;
+    int count = 0, labelCount = 0, loadCount, i, j;
+    ParseTreeNode *node, *arg = NULL;
+    Symbol *sym;
+    int tkn;
+    
+    /* get the value for tos */
+    if ((tkn = GetToken(c)) != T_EOL) {
+        SaveToken(c, tkn);
+        arg = ConvertExpr(c, ParseExpr(c), &c->integerType);
+        FRequire(c, T_EOL);
+    }
+    
+    /* only the hub VM has the buffer and the block must be where its LMM kernel can read it */
+    if (c->config->cacheDriver)
+        ParseError(c, "ASM FCACHE needs a board without a cache driver");
+    if (c->dataTarget->base >= COG_BASE)
+        ParseError(c, "ASM FCACHE blocks must be in hub memory");
+    
+    /* collect the instructions and the cog addresses of the labels */
+    lines = (char *)xbLocalAlloc(c->sys, (LMM_FCACHE_SIZE - 1) * MAXLINE);
+    for (;;) {
+    
+        /* get the next line */
+        if (!GetLine(c))
+            ParseError(c, "unexpected end of file in ASM statement");
+        src = c->linePtr;
+        
+        /* check for the end of the assembly instructions or an empty line */
+        if ((tkn = GetToken(c)) == T_END_ASM)
+            break;
+        else if (tkn == T_EOL)
+            continue;
+            
+        /* check for a label */
+        while (*src != '\0' && isspace(*src))
+            ++src;
+        if (*src == ':') {
+            for (label = ++src; IdentifierCharP(*src); ++src)
+                ;
+            if (src == label || src - label >= MAXTOKEN)
+                ParseError(c, "expecting a label after ':'");
+            if (labelCount >= LMM_FCACHE_SIZE)
+                ParseError(c, "too many labels in ASM FCACHE");
+            memcpy(names[labelCount], label, src - label);
+            names[labelCount][src - label] = '\0';
+            for (i = 0; i < labelCount; ++i)
+                if (strcmp(names[i], names[labelCount]) == 0)
+                    ParseError(c, "duplicate label: %s", names[i]);
+            addrs[labelCount++] = LMM_FCACHE + count;
+            while (*src != '\0' && isspace(*src))
+                ++src;
+            if (*src == '\0')
+                continue;
+        }
+        
+        /* the block ends with a jump back to the VM */
+        if (count >= LMM_FCACHE_SIZE - 1)
+            ParseError(c, "ASM FCACHE is limited to %d instructions", LMM_FCACHE_SIZE - 1);
+        strcpy(&lines[count++ * MAXLINE], src);
+    }
+    
+    /* check for the end of the 'END ASM' statement */
+    FRequire(c, T_EOL);
+    
+    /* the block is global data added on the second pass (the first skips statements) */
+    sprintf(name, "fcache.%d", ++c->fcacheCount);
+    if (c->pass == 2) {
+        Type *type;
+        
+        /* the LMM code gets the value under the block's address, loads the block from
+           the last long to the first unless it is already there and jumps to it (lmm_pc
+           is past the add when the block's address is taken from it) */
+        loadCount = count + 1;
+        p = AssembleFcache(c, data, "cmp lmm_tag,tos wz");
+        p = AssembleFcache(c, p, "mov lmm_tag,tos");
+        p = AssembleFcache(c, p, "rdlong tos,sp");
+        p = AssembleFcache(c, p, "if_z jmp #lmm_fcache");
+        p = AssembleFcache(c, p, "mov lmm_k,lmm_pc");
+        p = AssembleFcache(c, p, "add lmm_k,#%d", loadCount * 3 * (int)sizeof(VMUVALUE));
+        for (i = loadCount; --i >= 0; ) {
+            p = AssembleFcache(c, p, "rdlong %d,lmm_k", LMM_FCACHE + i);
+            if (i > 0)
+                p = AssembleFcache(c, p, "sub lmm_k,#%d", (int)sizeof(VMUVALUE));
+        }
+        p = AssembleFcache(c, p, "jmp #lmm_fcache");
+        
+        /* assemble the instructions replacing the labels with their addresses */
+        for (i = 0; i < count; ++i) {
+            for (src = &lines[i * MAXLINE], dst = line; *src != '\0'; ) {
+                if (*src == ':' && IdentifierCharP(src[1])) {
+                    for (label = ++src; IdentifierCharP(*src); ++src)
+                        ;
+                    for (j = 0; j < labelCount; ++j)
+                        if (strlen(names[j]) == (size_t)(src - label) && strncmp(names[j], label, src - label) == 0)
+                            break;
+                    if (j >= labelCount)
+                        ParseError(c, "undefined label: %.*s", (int)(src - label), label);
+                    dst += sprintf(dst, "%d", addrs[j]);
+                }
+                else
+                    *dst++ = *src++;
+            }
+            *dst = '\0';
+            p = AssembleFcache(c, p, "%s", line);
+        }
+        p = AssembleFcache(c, p, "jmp #lmm_ret");
+        
+        type = NewGlobalType(c, TYPE_ARRAY);
+        type->u.arrayInfo.elementType = &c->integerType;
+        type->u.arrayInfo.size = (p - data) / sizeof(VMUVALUE);
+        sym = AddGlobalOffset(c, name, SC_CONSTANT, type, UNDEF_VALUE);
+        sym->section = c->dataTarget;
+        AddGlobalData(c, sym, data, p - data, FALSE);
+    }
+    else if (!(sym = FindSymbol(&c->globals, name)))
+        ParseError(c, "ASM FCACHE block not defined: %s", name);
+    AddDependency(c, sym);
+    
+    /* the statement runs the block */
+    node = NewParseTreeNode(c, NodeTypeAsmStatement);
+    node->u.asmStatement.fcache = sym;
+    node->u.asmStatement.arg = arg;
+    AddNodeToList(c, &c->bptr->pNextStatement, node);
+}
+
+/* AssembleFcache - assemble a PASM instruction of an FCACHE block into hub memory order */
+static uint8_t *AssembleFcache(ParseContext *c, uint8_t *p, const char *fmt, ...)
+{
+    char line[MAXLINE];
+    uint32_t value;
+    va_list ap;
+    int i;
+    
+    va_start(ap, fmt);
+    vsprintf(line, fmt, ap);
+    va_end(ap);
+    if ((i = strlen(line)) == 0 || line[i - 1] != '\n')
+        strcat(line, "\n");
+    if (!PasmAssemble1(c->pasmTables, line, &value))
+        ParseError(c, "native assembly failed");
+    for (i = 0; i < (int)sizeof(VMUVALUE); ++i)
+        *p++ = (uint8_t)(value >> (i * 8));
+    return p;
+}
+
 /* Assemble - assemble a single line */
 static void Assemble(ParseContext *c, char *name)
 {
-    int PasmAssemble1(char *line, uint32_t *pValue);
     FLASH_SPACE OTDEF *def;
     uint32_t value;
     char *p;
@@ -1187,6 +1602,11 @@ static void Assemble(ParseContext *c, char *name)
     for (def = OpcodeTable; def->name != NULL; ++def)
         if (strcasecmp(name, def->name) == 0) {
             putcbyte(c, def->code);
+            
+            /* a function that returns from inline assembly leaves its arguments for the caller to clean up */
+            if ((def->code == OP_RETURN || def->code == OP_RETURNZ) && c->functionType)
+                c->functionType->u.functionInfo.callerCleans = TRUE;
+            
             switch (def->fmt) {
             case FMT_NONE:
                 break;
@@ -1194,16 +1614,27 @@ static void Assemble(ParseContext *c, char *name)
             case FMT_SBYTE:
                 putcbyte(c, ParseIntegerConstant(c));
                 break;
+            case FMT_SBYTE2:
+            case FMT_BYTE2:
+                putcbyte(c, ParseIntegerConstant(c));
+                FRequire(c, ',');
+                putcbyte(c, ParseIntegerConstant(c));
+                break;
             case FMT_WORD:
                 putcword(c, ParseIntegerConstant(c));
                 break;
+            case FMT_HWORD:
+                value = ParseIntegerConstant(c);
+                putcbyte(c, value >> 8);
+                putcbyte(c, value);
+                break;
             case FMT_NATIVE:
                 for (p = c->linePtr; *p != '\0' && isspace(*p); ++p)
                     ;
                 if (isdigit(*p))
                     putcword(c, ParseIntegerConstant(c));
                 else {
-                    if (!PasmAssemble1(c->linePtr, &value))
+                    if (!PasmAssemble1(c->pasmTables, c->linePtr, &value))
                         ParseError(c, "native assembly failed");
                     putcword(c, (VMVALUE)value);
                     for (p = c->linePtr; *p != '\0' && *p != '\n'; ++p)
@@ -1239,22 +1670,14 @@ static void DefineLabel(ParseContext *c, char *name)
     Label *label;
     
     /* check to see if the label is already in the table */
-    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next)
-        if (strcasecmp(name, label->name) == 0) {
-            if (label->state != LS_UNDEFINED)
-                ParseError(c, "duplicate label: %s", label->name);
-            break;
-        }
+    if ((label = FindLabel(c, name)) != NULL) {
+        if (label->state != LS_UNDEFINED)
+            ParseError(c, "duplicate label: %s", label->name);
+    }
 
     /* allocate the label structure */
-    if (!label) {
-        label = (Label *)xbLocalAlloc(c->sys, sizeof(Label) + strlen(name));
-        memset(label, 0, sizeof(Label));
-        strcpy(label->name, name);
-        label->state = LS_DEFINED;
-        label->next = c->function->u.functionDefinition.labels;
-        c->function->u.functionDefinition.labels = label;
-    }
+    else
+        label = AddLabel(c, name, LS_DEFINED);
     
     /* add a label definition node */
     node = NewParseTreeNode(c, NodeTypeLabelDefinition);
@@ -1271,19 +1694,8 @@ static void ParseGoto(ParseContext *c)
     FRequire(c, T_IDENTIFIER);
 
     /* check to see if the label is already in the table */
-    for (label = c->function->u.functionDefinition.labels; label != NULL; label = label->next)
-        if (strcasecmp(c->token, label->name) == 0)
-            break;
-
-    /* allocate the label structure */
-    if (!label) {
-        label = (Label *)xbLocalAlloc(c->sys, sizeof(Label) + strlen(c->token));
-        memset(label, 0, sizeof(Label));
-        strcpy(label->name, c->token);
-        label->state = LS_UNDEFINED;
-        label->next = c->function->u.functionDefinition.labels;
-        c->function->u.functionDefinition.labels = label;
-    }
+    if (!(label = FindLabel(c, c->token)))
+        label = AddLabel(c, c->token, LS_UNDEFINED);
 
     node = NewParseTreeNode(c, NodeTypeGotoStatement);
     node->u.gotoStatement.label = label;
@@ -1292,6 +1704,25 @@ static void ParseGoto(ParseContext *c)
     FRequire(c, T_EOL);
 }
 
+/* FindLabel - find a label in the current function */
+static Label *FindLabel(ParseContext *c, const char *name)
+{
+    return (Label *)FindHashEntry(&c->function->u.functionDefinition.labelIndex, name);
+}
+
+/* AddLabel - add a label to the current function */
+static Label *AddLabel(ParseContext *c, const char *name, LabelState state)
+{
+    Label *label = (Label *)xbLocalAlloc(c->sys, sizeof(Label) + strlen(name));
+    memset(label, 0, sizeof(Label));
+    strcpy(label->name, name);
+    label->state = state;
+    label->next = c->function->u.functionDefinition.labels;
+    c->function->u.functionDefinition.labels = label;
+    AddHashEntry(&c->function->u.functionDefinition.labelIndex, &label->hashEntry, label->name, label);
+    return label;
+}
+
 /* ParseReturn - parse the 'RETURN' statement */
 static void ParseReturn(ParseContext *c)
 {
@@ -1306,6 +1737,8 @@ static void ParseReturn(ParseContext *c)
     else {
         SaveToken(c, tkn);
         node->u.returnStatement.expr = ParseExpr(c);
+        if (c->functionType)
+            node->u.returnStatement.expr = ConvertExpr(c, node->u.returnStatement.expr, c->functionType->u.functionInfo.returnType);
         FRequire(c, T_EOL);
     }
     
@@ -1356,6 +1789,7 @@ static void ParseInput(ParseContext *c)
             switch (expr->type->id) {
             case TYPE_INTEGER:
             case TYPE_BYTE:
+            case TYPE_WORD:
                 node = NewParseTreeNode(c, NodeTypeLetStatement);
                 node->u.letStatement.lvalue = expr;
                 node->u.letStatement.rvalue = BuildHandlerFunctionCall(c, "inputInt", devExpr, NULL);
@@ -1416,8 +1850,15 @@ static void ParsePrint(ParseContext *c)
                 break;
             case TYPE_INTEGER:
             case TYPE_BYTE:
+            case TYPE_WORD:
                 AddNodeToList(c, &c->bptr->pNextStatement, BuildHandlerCall(c, "printInt", devExpr, expr));
                 break;
+            case TYPE_FIXED:
+                AddNodeToList(c, &c->bptr->pNextStatement, BuildHandlerCall(c, "printFixed", devExpr, expr));
+                break;
+            case TYPE_FLOAT:
+                AddNodeToList(c, &c->bptr->pNextStatement, BuildHandlerCall(c, "printFloat", devExpr, expr));
+                break;
             default:
                 ParseError(c, "invalid argument to PRINT");
                 break;
@@ -1486,6 +1927,187 @@ static ParseTreeNode *BuildHandlerFunctionCall(ParseContext *c, char *name, Pars
     return callNode;
 }
 
+/* ParseCogStart - handle the 'COGSTART' statement */
+static void ParseCogStart(ParseContext *c)
+{
+    c->startsCogs = TRUE;
+    ParseStartCall(c, "COGSTART", COG_RESERVED, "startCog", "cogExit");
+}
+
+/* ParseTask - handle the 'TASK' statement */
+static void ParseTask(ParseContext *c)
+{
+    c->runsTasks = TRUE;
+    ParseStartCall(c, "TASK", 0, "startTask", "taskExit");
+}
+
+/* ParseYield - handle the 'YIELD' statement */
+static void ParseYield(ParseContext *c)
+{
+    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeCallStatement);
+    c->runsTasks = TRUE;
+    node->u.callStatement.expr = BuildHelperCall(c, "taskYield", 0);
+    AddNodeToList(c, &c->bptr->pNextStatement, node);
+    FRequire(c, T_EOL);
+}
+
+/* ParseWaitFor - handle the 'WAITFOR' statement */
+static void ParseWaitFor(ParseContext *c)
+{
+    ParseTreeNode *loop, *node, *call;
+    NodeListEntry **pNext, *entry;
+    int tkn;
+
+    /* yield until the condition is true */
+    c->runsTasks = TRUE;
+    loop = NewParseTreeNode(c, NodeTypeDoUntilStatement);
+    loop->u.loopStatement.test = ParseExpr(c);
+    loop->u.loopStatement.bodyStatements = NULL;
+
+    /* with a timeout taskWait does the yielding and ends the loop when the timer expires */
+    if ((tkn = GetToken(c)) == ',') {
+        call = BuildHelperCall(c, "taskTimer", 1);
+        AddCallArg(c, call, ConvertExpr(c, ParseExpr(c), &c->integerType));
+        node = NewParseTreeNode(c, NodeTypeCallStatement);
+        node->u.callStatement.expr = call;
+        AddNodeToList(c, &c->bptr->pNextStatement, node);
+        node = NewParseTreeNode(c, NodeTypeDisjunction);
+        node->type = &c->integerType;
+        node->u.exprList.exprs = entry = (NodeListEntry *)xbLocalAlloc(c->sys, sizeof(NodeListEntry));
+        entry->node = loop->u.loopStatement.test;
+        entry->next = (NodeListEntry *)xbLocalAlloc(c->sys, sizeof(NodeListEntry));
+        entry->next->node = BuildHelperCall(c, "taskWait", 0);
+        entry->next->next = NULL;
+        loop->u.loopStatement.test = node;
+    }
+    else {
+        SaveToken(c, tkn);
+        node = NewParseTreeNode(c, NodeTypeCallStatement);
+        node->u.callStatement.expr = BuildHelperCall(c, "taskYield", 0);
+        pNext = &loop->u.loopStatement.bodyStatements;
+        AddNodeToList(c, &pNext, node);
+    }
+    AddNodeToList(c, &c->bptr->pNextStatement, loop);
+    FRequire(c, T_EOL);
+}
+
+/* ParseStartCall - handle COGSTART or TASK (the start helper runs the call on another cog or task) */
+static void ParseStartCall(ParseContext *c, char *keyword, VMVALUE reserved, char *startName, char *exitName)
+{
+    ParseTreeNode *call, *stack, *node, *expr;
+    NodeListEntry *arg;
+    GlobalData *data;
+    Symbol *symbol;
+    VMVALUE index;
+    int tkn;
+
+    /* get the function call */
+    call = ParsePrimary(c);
+    if (call->nodeType != NodeTypeFunctionCall || call->u.functionCall.fcn->nodeType != NodeTypeFunctionLit)
+        ParseError(c, "expecting a function call");
+    call->u.functionCall.fcn->type->u.functionInfo.started = TRUE;
+    FRequire(c, ',');
+
+    /* get the stack array (the size of a one dimensional array is only kept with its data) */
+    stack = ParseExpr(c);
+    if (stack->nodeType != NodeTypeArrayLit
+    ||  stack->u.arrayLit.symbol->type->u.arrayInfo.elementType->id != TYPE_INTEGER)
+        ParseError(c, "expecting an integer array for the stack");
+    for (data = c->globalData; data != NULL; data = data->next)
+        if (data->symbol == stack->u.arrayLit.symbol)
+            break;
+    if (!data)
+        ParseError(c, "expecting an integer array for the stack");
+    index = data->size / sizeof(VMVALUE);
+    if (index < reserved + call->u.functionCall.argc + 1)
+        ParseError(c, "stack array too small");
+
+    /* store the arguments at the top of the stack where a call would have pushed them */
+    for (arg = call->u.functionCall.args; arg != NULL; arg = arg->next) {
+        node = NewParseTreeNode(c, NodeTypeLetStatement);
+        node->u.letStatement.lvalue = NewParseTreeNode(c, NodeTypeArrayRef);
+        node->u.letStatement.lvalue->type = &c->integerType;
+        node->u.letStatement.lvalue->u.arrayRef.array = BuildCogStartArg(c, stack);
+        node->u.letStatement.lvalue->u.arrayRef.index = NewParseTreeNode(c, NodeTypeIntegerLit);
+        node->u.letStatement.lvalue->u.arrayRef.index->type = &c->integerType;
+        node->u.letStatement.lvalue->u.arrayRef.index->u.integerLit.value = --index;
+        node->u.letStatement.rvalue = arg->node;
+        AddNodeToList(c, &c->bptr->pNextStatement, node);
+    }
+
+    /* build the call to the start helper (code, exit, stack, first) with the arguments in reverse order */
+    if (!(symbol = FindSymbol(&c->globals, exitName)))
+        ParseError(c, "%s helper not defined: %s", keyword, exitName);
+    expr = BuildHelperCall(c, startName, 4);
+    AddCallArg(c, expr, call->u.functionCall.fcn);
+    node = NewParseTreeNode(c, NodeTypeFunctionLit);
+    node->type = symbol->type;
+    node->u.functionLit.symbol = symbol;
+    AddDependency(c, symbol);
+    AddCallArg(c, expr, node);
+    AddCallArg(c, expr, BuildCogStartArg(c, stack));
+    node = NewParseTreeNode(c, NodeTypeIntegerLit);
+    node->type = &c->integerType;
+    node->u.integerLit.value = index;
+    AddCallArg(c, expr, node);
+
+    /* store the cog or task id or ignore it */
+    if ((tkn = GetToken(c)) == ',') {
+        node = NewParseTreeNode(c, NodeTypeLetStatement);
+        node->u.letStatement.lvalue = ParsePrimary(c);
+        node->u.letStatement.rvalue = ConvertExpr(c, expr, node->u.letStatement.lvalue->type);
+    }
+    else {
+        SaveToken(c, tkn);
+        node = NewParseTreeNode(c, NodeTypeCallStatement);
+        node->u.callStatement.expr = expr;
+    }
+    AddNodeToList(c, &c->bptr->pNextStatement, node);
+    FRequire(c, T_EOL);
+}
+
+/* BuildHelperCall - build a call to a runtime helper function with no arguments yet */
+static ParseTreeNode *BuildHelperCall(ParseContext *c, char *name, int argc)
+{
+    ParseTreeNode *callNode;
+    Type *functionType;
+    Symbol *symbol;
+
+    if (!(symbol = FindSymbol(&c->globals, name)))
+        ParseError(c, "helper not defined: %s", name);
+    functionType = symbol->type;
+    if (functionType->id != TYPE_FUNCTION || functionType->u.functionInfo.arguments.count != argc)
+        ParseError(c, "handler has wrong prototype: %s", name);
+
+    callNode = NewParseTreeNode(c, NodeTypeFunctionCall);
+    callNode->type = functionType->u.functionInfo.returnType;
+    callNode->u.functionCall.fcn = NewParseTreeNode(c, NodeTypeFunctionLit);
+    callNode->u.functionCall.fcn->type = functionType;
+    callNode->u.functionCall.fcn->u.functionLit.symbol = symbol;
+    callNode->u.functionCall.args = NULL;
+    AddDependency(c, symbol);
+    return callNode;
+}
+
+/* BuildCogStartArg - build a reference to a COGSTART or TASK stack array */
+static ParseTreeNode *BuildCogStartArg(ParseContext *c, ParseTreeNode *expr)
+{
+    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeArrayLit);
+    node->type = expr->type;
+    node->u.arrayLit.symbol = expr->u.arrayLit.symbol;
+    return node;
+}
+
+/* AddCallArg - add the next argument to a function call (the list is in reverse order) */
+static void AddCallArg(ParseContext *c, ParseTreeNode *call, ParseTreeNode *expr)
+{
+    NodeListEntry *actual = (NodeListEntry *)xbLocalAlloc(c->sys, sizeof(NodeListEntry));
+    actual->node = expr;
+    actual->next = call->u.functionCall.args;
+    call->u.functionCall.args = actual;
+    ++call->u.functionCall.argc;
+}
+
 /* CheckLabels - check for undefined labels */
 void CheckLabels(ParseContext *c)
 {
@@ -1521,3 +2143,11 @@ static void PopBlock(ParseContext *c)
 {
     --c->bptr;
 }
+
+/* PopLoopBlock - pop a FOR or DO block off the stack after moving invariant code out of the loop */
+static void PopLoopBlock(ParseContext *c)
+{
+    if (c->flags & COMPILER_OPTIMIZE)
+        HoistLoopInvariants(c, c->bptr->node, c->bptr->pLoopEntry);
+    PopBlock(c);
+}
@@ -18,6 +18,7 @@ void InitSymbolTable(SymbolTable *table)
     table->head = NULL;
     table->pTail = &table->head;
     table->count = 0;
+    InitHashTable(&table->index);
 }
 
 /* AddGlobalSymbol - add a global symbol to the symbol table */
@@ -58,14 +59,13 @@ Symbol *AddFormalArgument(ParseContext *c, SymbolTable *table, const char *name,
     return AddGlobal(c, table, name, SC_LOCAL, type, offset);
 }
 
-/* AddDependency - add a dependency on a global symbol to the current function */
+/* AddDependency - add a dependency on a global symbol to the current function
+   (the symbol is marked with the function so it is only added once) */
 void AddDependency(ParseContext *c, Symbol *symbol)
 {
-    if (c->pass == 2) {
+    if (c->pass == 2 && symbol->dependencyMark != c->dependencyMark) {
         Dependency *d;
-        for (d = c->dependencies; d != NULL; d = d->next)
-            if (symbol == d->symbol)
-                return;
+        symbol->dependencyMark = c->dependencyMark;
         d = (Dependency *)GlobalAlloc(c, sizeof(Dependency));
         d->symbol = symbol;
         d->next = NULL;
@@ -92,11 +92,15 @@ static Symbol *AddGlobal(ParseContext *c, SymbolTable *table, const char *name,
     sym->type = type;
     sym->v.variable.offset = offset;
     sym->v.variable.fixups = 0;
+    sym->dependencyMark = 0;
+    sym->referenced = FALSE;
+    sym->arraySize = 0;
     sym->next = NULL;
 
     /* add it to the symbol table */
     *table->pTail = sym;
     table->pTail = &sym->next;
+    AddHashEntry(&table->index, &sym->hashEntry, sym->name, sym);
     ++table->count;
     
     /* return the symbol */
@@ -121,11 +125,13 @@ Symbol *AddLocal(ParseContext *c, const char *name, Type *type, VMUVALUE offset)
     sym->section = NULL;
     sym->type = type;
     sym->v.variable.offset = offset;
+    sym->arraySize = 0;
     sym->next = NULL;
 
     /* add it to the symbol table */
     *table->pTail = sym;
     table->pTail = &sym->next;
+    AddHashEntry(&table->index, &sym->hashEntry, sym->name, sym);
     ++table->count;
     
     /* return the symbol */
@@ -135,13 +141,7 @@ Symbol *AddLocal(ParseContext *c, const char *name, Type *type, VMUVALUE offset)
 /* FindSymbol - find a symbol in a symbol table */
 Symbol *FindSymbol(SymbolTable *table, const char *name)
 {
-    Symbol *sym = table->head;
-    while (sym) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-        sym = sym->next;
-    }
-    return NULL;
+    return (Symbol *)FindHashEntry(&table->index, name);
 }
 
 /* IsConstant - check to see if the value of a symbol is a constant */
@@ -153,22 +153,26 @@ int IsConstant(Symbol *symbol)
 /* DumpSymbols - dump a symbol table */
 void DumpSymbols(ParseContext *c, SymbolTable *table, char *tag)
 {
-    Symbol *sym;
+    Symbol *sym, *shown;
     if ((sym = table->head) != NULL) {
         xbInfo(c->sys, "%s:\n", tag);
         for (; sym != NULL; sym = sym->next) {
-            VMUVALUE value = sym->v.variable.offset;
+            VMUVALUE value;
+            
+            /* an array or overlaid scalar declared in a function is shown with the address of its hidden global */
+            shown = (IsSharedLocal(sym) ? sym->v.global : sym);
+            value = shown->v.variable.offset;
             switch (sym->storageClass) {
             case SC_CONSTANT:
             case SC_GLOBAL:
-                if (value != UNDEF_VALUE && sym->section)
-                    value += sym->section->base;
+                if (value != UNDEF_VALUE && shown->section)
+                    value += shown->section->base;
                 break;
             default:
                 // no offset
                 break;
             }
-            xbInfo(c->sys, "  %c %c %08x %08x %s\n", "CLTDHR"[sym->storageClass], "IBSAPF"[sym->type->id], value, sym->v.variable.fixups, sym->name);
+            xbInfo(c->sys, "  %c %c %08x %08x %s\n", "CLTDHR"[sym->storageClass], "IBSAPFXRW"[sym->type->id], value, shown->v.variable.fixups, sym->name);
         }
     }
 }
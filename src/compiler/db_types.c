@@ -8,13 +8,11 @@
 #include <string.h>
 #include "db_compiler.h"
 
-/* prototypes */
-static VMUVALUE ValueByteSize(Type *type);
-
 /* NewGlobalType - allocate a new global type */
 Type *NewGlobalType(ParseContext *c, TypeID id)
 {
     Type *type = (Type *)GlobalAlloc(c, sizeof(Type));
+    memset(type, 0, sizeof(Type));
     type->id = id;
     return type;
 }
@@ -30,6 +28,23 @@ Type *ArrayTypeToPointerType(ParseContext *c, Type *type)
     case TYPE_BYTE:
         pointerType = &c->bytePointerType;
         break;
+    case TYPE_WORD:
+        pointerType = &c->wordPointerType;
+        break;
+    case TYPE_FIXED:
+        pointerType = &c->fixedPointerType;
+        break;
+    case TYPE_FLOAT:
+        pointerType = &c->floatPointerType;
+        break;
+    case TYPE_ARRAY:
+        /* a multi-dimensional array is a pointer to its first row */
+        if (!(pointerType = type->u.arrayInfo.pointerType)) {
+            pointerType = NewGlobalType(c, TYPE_POINTER);
+            pointerType->u.pointerInfo.targetType = type->u.arrayInfo.elementType;
+            type->u.arrayInfo.pointerType = pointerType;
+        }
+        break;
     default:
         ParseError(c, "Internal error");
         pointerType = NULL; // never reached
@@ -92,6 +107,8 @@ VMUVALUE ValueSize(Type *type, VMUVALUE size)
 
     switch (type->id) {
     case TYPE_INTEGER:
+    case TYPE_FIXED:
+    case TYPE_FLOAT:
     case TYPE_STRING:
     case TYPE_POINTER:
         valueSize = 1;
@@ -108,13 +125,15 @@ VMUVALUE ValueSize(Type *type, VMUVALUE size)
     return valueSize;
 }
 
-/* ValueByteSize - determine the size of a scalar type in bytes */
-static VMUVALUE ValueByteSize(Type *type)
+/* ValueByteSize - determine the size of a scalar type or an array row in bytes */
+VMUVALUE ValueByteSize(Type *type)
 {
     int size;
 
     switch (type->id) {
     case TYPE_INTEGER:
+    case TYPE_FIXED:
+    case TYPE_FLOAT:
     case TYPE_STRING:
     case TYPE_POINTER:
         size = sizeof(VMVALUE);
@@ -122,6 +141,13 @@ static VMUVALUE ValueByteSize(Type *type)
     case TYPE_BYTE:
         size = 1;
         break;
+    case TYPE_WORD:
+        size = 2;
+        break;
+    case TYPE_ARRAY:
+        /* a row of a multi-dimensional array */
+        size = type->u.arrayInfo.size * ValueByteSize(type->u.arrayInfo.elementType);
+        break;
     default:
         size = 0;   // not reached
         break;
@@ -130,9 +156,30 @@ static VMUVALUE ValueByteSize(Type *type)
     return size;
 }
 
-/* IsIntegerType - verify that an expression has an integer type (integer or byte) */
+/* IsIntegerType - verify that an expression has an integer type (integer, byte or word) */
 int IsIntegerType(Type *type)
 {
-    return type->id == TYPE_INTEGER || type->id == TYPE_BYTE;
+    return type->id == TYPE_INTEGER || type->id == TYPE_BYTE || type->id == TYPE_WORD;
 }
 
+/* IsNumericType - verify that an expression has a numeric type (integer, byte, fixed or float) */
+int IsNumericType(Type *type)
+{
+    return IsIntegerType(type) || type->id == TYPE_FIXED || type->id == TYPE_FLOAT;
+}
+
+/* ValueToFloat - get the float stored in a value */
+float ValueToFloat(VMVALUE value)
+{
+    float f;
+    memcpy(&f, &value, sizeof(f));
+    return f;
+}
+
+/* FloatToValue - store a float in a value */
+VMVALUE FloatToValue(float f)
+{
+    VMVALUE value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
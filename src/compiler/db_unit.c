@@ -0,0 +1,288 @@
+/* db_unit.c - precompiled include units
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * A unit holds the lines of an include file along with the tokens the scanner
+ * found on them.  It is named for the file and a hash of its contents and is
+ * only used when the contents and the compiler that wrote it still match, so a
+ * changed file or a new compiler just results in a new unit.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_compiler.h"
+
+/* unit file format version (change when the meaning of the cached tokens changes) */
+#define UNIT_VERSION    2
+#define UNIT_MAGIC      "XBU1"
+
+/* unit file header */
+typedef struct {
+    char magic[4];              /* UNIT_MAGIC */
+    uint32_t key;               /* key of the compiler that wrote the unit */
+    uint32_t hash;              /* hash of the source file contents */
+    uint32_t bodyHash;          /* hash of everything following the header */
+    uint32_t lineCount;         /* number of lines */
+} UnitHdr;
+
+/* unit line header (followed by the tokens and then the text and token strings) */
+typedef struct {
+    int32_t lineNumber;         /* line number within the file */
+    int32_t tokenCount;         /* number of tokens */
+    int32_t textSize;           /* size of the text and token strings */
+} UnitLine;
+
+/* unit token */
+typedef struct {
+    int32_t token;              /* token */
+    uint16_t start;             /* line offset before the token */
+    uint16_t end;               /* line offset after the token */
+    uint16_t offset;            /* line offset of the start of the token */
+    uint16_t inComment;         /* comment state before and after the token */
+    int32_t value;              /* value of a number token */
+    int32_t string;             /* offset of the token string from the text or -1 */
+} UnitToken;
+
+/* largest line text and token strings in a unit line */
+#define MAXUNITTEXT     (MAXLINE * 3)
+
+/* longest unit path */
+#define MAXUNITPATH     1024
+
+static uint32_t CompilerKey(void);
+static void UnitName(SourceCache *cache, SourceFile *source, char *path);
+
+/* HashBytes - add a block of bytes to an FNV-1a hash */
+uint32_t HashBytes(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (size-- > 0) {
+        hash ^= *p++;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/* HashSourceFile - hash the contents of an open source file and rewind it */
+uint32_t HashSourceFile(void *fp)
+{
+    uint32_t hash = HASH_INIT;
+    char buf[1024];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), (FILE *)fp)) > 0)
+        hash = HashBytes(hash, buf, count);
+    rewind((FILE *)fp);
+    return hash;
+}
+
+/* CompilerKey - compute a key that changes whenever the scanner output could change */
+static uint32_t CompilerKey(void)
+{
+    uint32_t version = UNIT_VERSION, hash = HASH_INIT;
+    int sizes[4];
+    sizes[0] = MAXLINE;
+    sizes[1] = sizeof(VMVALUE);
+    sizes[2] = sizeof(UnitToken);
+    sizes[3] = T_EOF;
+    hash = HashBytes(hash, &version, sizeof(version));
+    hash = HashBytes(hash, sizes, sizeof(sizes));
+    return HashKeywords(hash);
+}
+
+/* UnitName - build the path of the unit for a source file */
+static void UnitName(SourceCache *cache, SourceFile *source, char *path)
+{
+    const char *name = source->name, *p;
+    int length;
+
+    /* use the file name without its directory or extension */
+    for (p = name; *p != '\0'; ++p)
+        if (*p == '/' || *p == '\\' || *p == ':')
+            name = p + 1;
+    if (!(p = strrchr(name, '.')))
+        p = name + strlen(name);
+    if ((length = p - name) > 64)
+        length = 64;
+
+    sprintf(path, "%s/%.*s-%08x.bau", cache->unitDirectory, length, name, (unsigned int)source->hash);
+}
+
+/* LoadUnit - load the lines of a source file from its unit */
+int LoadUnit(SourceCache *cache, SourceFile *source)
+{
+    char path[MAXUNITPATH];
+    CachedLine *line, **pNext;
+    uint32_t bodyHash = HASH_INIT;
+    UnitToken unitToken;
+    UnitLine unitLine;
+    UnitHdr hdr;
+    uint32_t i;
+    int j;
+    FILE *fp;
+
+    /* open the unit */
+    if (strlen(cache->unitDirectory) > MAXUNITPATH - 100)
+        return FALSE;
+    UnitName(cache, source, path);
+    if (!(fp = fopen(path, "rb")))
+        return FALSE;
+
+    /* make sure it was written by this compiler for the current file contents */
+    if (fread(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr)
+    ||  memcmp(hdr.magic, UNIT_MAGIC, sizeof(hdr.magic)) != 0
+    ||  hdr.key != CompilerKey()
+    ||  hdr.hash != source->hash) {
+        fclose(fp);
+        return FALSE;
+    }
+
+    /* read the lines */
+    source->lines = NULL;
+    pNext = &source->lines;
+    for (i = 0; i < hdr.lineCount; ++i) {
+        CachedToken *tokens;
+        char *text;
+
+        /* get the line header */
+        if (!ReadHashedData(fp, &unitLine, sizeof(unitLine), &bodyHash)
+        ||  unitLine.tokenCount < 0 || unitLine.tokenCount > MAXLINE
+        ||  unitLine.textSize <= 0 || unitLine.textSize > MAXUNITTEXT)
+            break;
+
+        /* allocate the line, its tokens, its text and the token strings in a block */
+        if (!(line = (CachedLine *)malloc(sizeof(CachedLine) + unitLine.tokenCount * sizeof(CachedToken) + unitLine.textSize)))
+            break;
+        tokens = (CachedToken *)(line + 1);
+        text = (char *)(tokens + unitLine.tokenCount);
+        line->next = NULL;
+        line->file = NULL;
+        line->lineNumber = unitLine.lineNumber;
+        line->tokens = tokens;
+        line->tokenCount = unitLine.tokenCount;
+        line->text = text;
+        line->size = sizeof(CachedLine) + unitLine.tokenCount * sizeof(CachedToken) + unitLine.textSize;
+        *pNext = line;
+        pNext = &line->next;
+
+        /* get the tokens */
+        for (j = 0; j < unitLine.tokenCount; ++j) {
+            if (!ReadHashedData(fp, &unitToken, sizeof(unitToken), &bodyHash)
+            ||  unitToken.string >= unitLine.textSize)
+                break;
+            tokens[j].token = unitToken.token;
+            tokens[j].start = unitToken.start;
+            tokens[j].end = unitToken.end;
+            tokens[j].offset = unitToken.offset;
+            tokens[j].inComment = unitToken.inComment;
+            tokens[j].value = unitToken.value;
+            tokens[j].string = unitToken.string < 0 ? NULL : text + unitToken.string;
+        }
+
+        /* get the text and token strings (each terminated by a zero byte) */
+        if (j < unitLine.tokenCount
+        ||  !ReadHashedData(fp, text, unitLine.textSize, &bodyHash)
+        ||  text[unitLine.textSize - 1] != '\0')
+            break;
+    }
+    fclose(fp);
+
+    /* discard the unit if it was truncated or damaged */
+    if (i < hdr.lineCount || bodyHash != hdr.bodyHash) {
+        CachedLine *next;
+        for (line = source->lines; line != NULL; line = next) {
+            next = line->next;
+            free(line);
+        }
+        source->lines = NULL;
+        return FALSE;
+    }
+
+    /* the file is complete */
+    source->pNextLine = pNext;
+    source->complete = TRUE;
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* SaveUnit - save the lines of a completely read source file as a unit */
+void SaveUnit(SourceCache *cache, SourceFile *source)
+{
+    char path[MAXUNITPATH];
+    UnitToken unitToken;
+    UnitLine unitLine;
+    CachedLine *line;
+    UnitHdr hdr;
+    FILE *fp;
+    int i;
+
+    /* create the unit */
+    if (strlen(cache->unitDirectory) > MAXUNITPATH - 100)
+        return;
+    UnitName(cache, source, path);
+    if (!(fp = fopen(path, "wb")))
+        return;
+
+    /* write a header that won't match until the body hash is filled in */
+    memcpy(hdr.magic, UNIT_MAGIC, sizeof(hdr.magic));
+    hdr.key = CompilerKey();
+    hdr.hash = source->hash;
+    hdr.bodyHash = HASH_INIT;
+    hdr.lineCount = 0;
+    for (line = source->lines; line != NULL; line = line->next)
+        ++hdr.lineCount;
+    fwrite(&hdr, 1, sizeof(hdr), fp);
+
+    /* write the lines */
+    for (line = source->lines; line != NULL; line = line->next) {
+
+        /* write the line header (the text and token strings end the line block) */
+        unitLine.lineNumber = line->lineNumber;
+        unitLine.tokenCount = line->tokenCount;
+        unitLine.textSize = line->size - (line->text - (char *)line);
+        WriteHashedData(fp, &unitLine, sizeof(unitLine), &hdr.bodyHash);
+
+        /* write the tokens */
+        memset(&unitToken, 0, sizeof(unitToken));
+        for (i = 0; i < line->tokenCount; ++i) {
+            CachedToken *token = &line->tokens[i];
+            unitToken.token = token->token;
+            unitToken.start = token->start;
+            unitToken.end = token->end;
+            unitToken.offset = token->offset;
+            unitToken.inComment = token->inComment;
+            unitToken.value = token->value;
+            unitToken.string = token->string ? token->string - line->text : -1;
+            WriteHashedData(fp, &unitToken, sizeof(unitToken), &hdr.bodyHash);
+        }
+
+        /* write the text and token strings */
+        WriteHashedData(fp, line->text, unitLine.textSize, &hdr.bodyHash);
+    }
+
+    /* fill in the body hash now that the unit is complete */
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&hdr, 1, sizeof(hdr), fp);
+
+    /* remove the unit if it couldn't be written */
+    if (fclose(fp) != 0)
+        remove(path);
+}
+
+/* ReadHashedData - read a block of data and add it to a hash */
+int ReadHashedData(FILE *fp, void *buf, size_t size, uint32_t *pHash)
+{
+    if (fread(buf, 1, size, fp) != size)
+        return FALSE;
+    *pHash = HashBytes(*pHash, buf, size);
+    return TRUE;
+}
+
+/* WriteHashedData - write a block of data and add it to a hash */
+void WriteHashedData(FILE *fp, const void *buf, size_t size, uint32_t *pHash)
+{
+    fwrite(buf, 1, size, fp);
+    *pHash = HashBytes(*pHash, buf, size);
+}
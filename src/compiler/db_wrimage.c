@@ -4,39 +4,57 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include "db_compiler.h"
 #include "db_vmdebug.h"
+#include "db_vmimage.h"
+
+/* check for a function symbol whose code has been placed */
+#define IsCodeSymbol(sym)   ((sym)->type->id == TYPE_FUNCTION && (sym)->section && (sym)->v.variable.offset != UNDEF_VALUE)
+
+/* initial size of an in-memory section buffer */
+#define SECTION_BUFFER_SIZE 4096
 
 /* prototypes */
+static int GrowSection(Section *section, VMUVALUE size);
+static int OpenSectionFile(ParseContext *c, Section *section);
+static void SpillSection(ParseContext *c, Section *section, VMUVALUE length);
+static void PutSection(ParseContext *c, Section *section, VMUVALUE offset, const uint8_t *buf, VMUVALUE size);
+static void FreeSections(ParseContext *c);
 static void MakeTmpName(char *outfile, const char *infile, const char *sectionName);
 static void ShowSectionInfo(ParseContext *c, ImageFileSection *section);
+static void WriteDebugSection(ParseContext *c, VMUVALUE *pImageSize);
+static void PutDebugData(ParseContext *c, VMUVALUE *pImageSize, const void *data, VMUVALUE size);
+static void PutDebugName(ParseContext *c, VMUVALUE *pImageSize, const char *name);
+static void VerifyBuiltImage(ParseContext *c, uint8_t *buf);
 
-/* StartImage - start writing an image */
+/* StartImage - start writing an image
+   (sections are built in memory and only fall back to files if memory runs out) */
 int StartImage(ParseContext *c, const char *name)
 {
     VMUVALUE dataOffset = sizeof(ImageFileHdr) + (c->config->sectionCount - 1) * sizeof(ImageFileSection);
     Section *section;
     
-    /* create temporary files for each section */
+    /* release anything left behind by a failed compile */
+    FreeSections(c);
+    c->imageName = name;
+    
+    /* start each section with an empty buffer */
     for (section = c->config->sections; section != NULL; section = section->next) {
-        if (section == c->textTarget) {
-            if (!(section->fp = fopen(name, "w+b")))
-                return FALSE;
-            section->offset = dataOffset;
-        }
-        else {
-            char tmpname[PATH_MAX];
-            MakeTmpName(tmpname, name, section->name);
-            if (!(section->fp = xbCreateTmpFile(c->sys, tmpname, "w+b")))
-                return FALSE;
-            section->offset = 0;
-        }
+        section->fp = NULL;
+        section->offset = (section == c->textTarget ? dataOffset : 0);
+        section->packOffset = section->packEnd = 0;
+        if (!GrowSection(section, section->offset) && !OpenSectionFile(c, section))
+            return FALSE;
+        if (section->buf)
+            memset(section->buf, 0, section->offset);
     }
     
     /* skip past the image header */
-    xbSeekFile(c->textTarget->fp, dataOffset, SEEK_SET);
+    if (c->textTarget->fp)
+        xbSeekFile(c->textTarget->fp, dataOffset, SEEK_SET);
     
     /* return successfully */
     return TRUE;
@@ -45,7 +63,9 @@ int StartImage(ParseContext *c, const char *name)
 /* BuildImage - build an image from the symbol table and objects already written to the image file */
 int BuildImage(ParseContext *c, const char *name)
 {
+    Section *text = c->textTarget;
     VMUVALUE dataOffset = 0;
+    VMUVALUE imageSize;
     ImageFileHdr fileHdr;
     VMUVALUE size, cnt;
     uint8_t buf[512];
@@ -55,6 +75,10 @@ int BuildImage(ParseContext *c, const char *name)
     memset(&fileHdr, 0, sizeof(fileHdr));
     memcpy(fileHdr.tag, IMAGE_TAG, sizeof(fileHdr.tag));
     fileHdr.version = IMAGE_VERSION;
+    if (c->flags & COMPILER_SYMBOLS)
+        fileHdr.flags |= IMAGE_DEBUG;
+    if (c->startsCogs)
+        fileHdr.flags |= IMAGE_COGS;
     fileHdr.mainCode = c->mainCode;
     fileHdr.stackSize = c->stackSize * sizeof(VMVALUE);
     fileHdr.sectionCount = c->config->sectionCount;
@@ -65,53 +89,193 @@ int BuildImage(ParseContext *c, const char *name)
     fileHdr.sections[0].size = c->textTarget->offset;
     if (c->flags & COMPILER_INFO)
         ShowSectionInfo(c, &fileHdr.sections[0]);
+        
     /* write the image file header */
-    xbSeekFile(c->textTarget->fp, 0, SEEK_SET);
-
-    if (xbWriteFile(c->textTarget->fp, (uint8_t *)&fileHdr, sizeof(fileHdr)) != sizeof(fileHdr))
-        ParseError(c, "error writing image file");
+    imageSize = 0;
+    if (text->fp)
+        xbSeekFile(text->fp, 0, SEEK_SET);
+    PutSection(c, text, imageSize, (uint8_t *)&fileHdr, sizeof(fileHdr));
+    imageSize += sizeof(fileHdr);
     dataOffset += fileHdr.sections[0].size;
 
     for (section = c->config->sections; section != NULL; section = section->next) {
-        if (section != c->textTarget) {
+        if (section != text) {
             ImageFileSection fileSection;
             fileSection.base = section->base;
             fileSection.offset = dataOffset;
             fileSection.size = section->offset;
             if (c->flags & COMPILER_INFO)
                 ShowSectionInfo(c, &fileSection);
-            if (xbWriteFile(c->textTarget->fp, (uint8_t *)&fileSection, sizeof(fileSection)) != sizeof(fileSection))
-                ParseError(c, "error writing image file");
+            PutSection(c, text, imageSize, (uint8_t *)&fileSection, sizeof(fileSection));
+            imageSize += sizeof(fileSection);
             dataOffset += fileSection.size;
         }
     }
 
-    /* write the remaining sections */
-    xbSeekFile(c->textTarget->fp, 0, SEEK_END);
+    /* append the remaining sections to the text section */
+    imageSize = text->offset;
+    if (text->fp)
+        xbSeekFile(text->fp, 0, SEEK_END);
     for (section = c->config->sections; section != NULL; section = section->next) {
-        if (section != c->textTarget && section->fp) {
-            char tmpname[PATH_MAX];
-            xbSeekFile(section->fp, 0, SEEK_SET);
-            for (size = section->offset; size > 0; size -= cnt) {
-                if ((cnt = size) > sizeof(buf))
-                    cnt = sizeof(buf);
-                if (xbReadFile(section->fp, buf, cnt) != cnt)
-                    ParseError(c, "error reading data file");
-                if (xbWriteFile(c->textTarget->fp, buf, cnt) != cnt)
-                    ParseError(c, "error writing image file");
+        if (section != text) {
+            if (section->buf) {
+                PutSection(c, text, imageSize, section->buf, section->offset);
+                imageSize += section->offset;
+            }
+            else if (section->fp) {
+                char tmpname[PATH_MAX];
+                xbSeekFile(section->fp, 0, SEEK_SET);
+                for (size = section->offset; size > 0; size -= cnt) {
+                    if ((cnt = size) > sizeof(buf))
+                        cnt = sizeof(buf);
+                    if (xbReadFile(section->fp, buf, cnt) != cnt)
+                        ParseError(c, "error reading data file");
+                    PutSection(c, text, imageSize, buf, cnt);
+                    imageSize += cnt;
+                }
+                xbCloseFile(section->fp);
+                section->fp = NULL;
+                MakeTmpName(tmpname, name, section->name);
+                xbRemoveTmpFile(c->sys, tmpname);
             }
-            xbCloseFile(section->fp);
-            MakeTmpName(tmpname, name, section->name);
-            xbRemoveTmpFile(c->sys, tmpname);
         }
     }
     
+    /* verify the code so the interpreter can skip its address checks */
+    if (c->flags & COMPILER_VERIFY) {
+        if (text->buf)
+            VerifyBuiltImage(c, text->buf);
+        else
+            xbInfo(c->sys, "warning: the image is too big to verify in memory\n");
+    }
+    
+    /* write the debug section */
+    if (c->flags & COMPILER_SYMBOLS)
+        WriteDebugSection(c, &imageSize);
+    
+    /* write an image built in memory with a single write */
+    if (text->buf) {
+        if (!(text->fp = fopen(name, "wb")))
+            ParseError(c, "can't create image file: %s", name);
+        if (xbWriteFile(text->fp, text->buf, imageSize) != imageSize)
+            ParseError(c, "error writing image file");
+    }
+    
     /* close the image file */
-    xbCloseFile(c->textTarget->fp);
+    xbCloseFile(text->fp);
+    text->fp = NULL;
+    FreeSections(c);
     
     return TRUE;
 }
 
+/* WriteDebugSection - write the function symbols, line table and file names after the section data */
+static void WriteDebugSection(ParseContext *c, VMUVALUE *pImageSize)
+{
+    ImageFileSection debugSection;
+    ImageFileDebugHdr hdr;
+    ImageFileSymbol entry;
+    ImageFileLine lineEntry;
+    DebugLine *line;
+    DebugFile *file;
+    Symbol *sym;
+    
+    /* size the debug data */
+    memset(&hdr, 0, sizeof(hdr));
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (IsCodeSymbol(sym)) {
+            hdr.symbolSize += sizeof(ImageFileSymbol) + ROUND_TO_WORDS(strlen(sym->name) + 1);
+            ++hdr.symbolCount;
+        }
+    hdr.lineCount = c->debugLineCount;
+    hdr.fileCount = c->debugFileCount;
+    hdr.fileSize = ROUND_TO_WORDS(1);
+    for (file = c->debugFiles; file != NULL; file = file->next)
+        hdr.fileSize += ROUND_TO_WORDS(strlen(file->name) + 1);
+    
+    /* write the section entry and the header */
+    debugSection.base = DEBUG_BASE;
+    debugSection.offset = *pImageSize + sizeof(ImageFileSection);
+    debugSection.size = sizeof(hdr) + hdr.symbolSize + hdr.lineCount * sizeof(ImageFileLine) + hdr.fileSize;
+    if (c->flags & COMPILER_INFO)
+        ShowSectionInfo(c, &debugSection);
+    PutDebugData(c, pImageSize, &debugSection, sizeof(debugSection));
+    PutDebugData(c, pImageSize, &hdr, sizeof(hdr));
+        
+    /* write the symbols */
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (IsCodeSymbol(sym)) {
+            entry.value = sym->section->base + sym->v.variable.offset;
+            entry.size = sizeof(ImageFileSymbol) + ROUND_TO_WORDS(strlen(sym->name) + 1);
+            PutDebugData(c, pImageSize, &entry, sizeof(entry));
+            PutDebugName(c, pImageSize, sym->name);
+        }
+    
+    /* write the line table */
+    for (line = c->debugLines; line != NULL; line = line->next) {
+        lineEntry.address = line->offset;
+        lineEntry.line = line->lineNumber;
+        lineEntry.file = line->file;
+        PutDebugData(c, pImageSize, &lineEntry, sizeof(lineEntry));
+    }
+    
+    /* write the file names */
+    PutDebugName(c, pImageSize, "");
+    for (file = c->debugFiles; file != NULL; file = file->next)
+        PutDebugName(c, pImageSize, file->name);
+    
+    if (c->flags & COMPILER_INFO) {
+        xbInfo(c->sys, "%08x symbols\n", hdr.symbolCount);
+        xbInfo(c->sys, "%08x lines\n", hdr.lineCount);
+    }
+}
+
+/* PutDebugData - add a block of data to the debug section */
+static void PutDebugData(ParseContext *c, VMUVALUE *pImageSize, const void *data, VMUVALUE size)
+{
+    PutSection(c, c->textTarget, *pImageSize, (const uint8_t *)data, size);
+    *pImageSize += size;
+}
+
+/* PutDebugName - add a zero terminated name padded to a word boundary to the debug section */
+static void PutDebugName(ParseContext *c, VMUVALUE *pImageSize, const char *name)
+{
+    VMUVALUE length = strlen(name) + 1;
+    uint8_t pad[sizeof(VMUVALUE)];
+    memset(pad, 0, sizeof(pad));
+    PutDebugData(c, pImageSize, name, length);
+    PutDebugData(c, pImageSize, pad, ROUND_TO_WORDS(length) - length);
+}
+
+/* VerifyBuiltImage - verify the code of an image built in memory and mark the image as verified */
+static void VerifyBuiltImage(ParseContext *c, uint8_t *buf)
+{
+    ImageFileHdr *fileHdr = (ImageFileHdr *)buf;
+    ImageHdr *image;
+    VMUVALUE j;
+    
+    /* describe the image the way the loader would */
+    image = (ImageHdr *)LocalAlloc(c, sizeof(ImageHdr) + (fileHdr->sectionCount - 1) * sizeof(ImageSection));
+    memset(image, 0, sizeof(ImageHdr));
+    image->mainCode = fileHdr->mainCode;
+    image->stackSize = fileHdr->stackSize;
+    image->sectionCount = fileHdr->sectionCount;
+    image->flags = fileHdr->flags;
+    for (j = 0; j < fileHdr->sectionCount; ++j) {
+        image->sections[j].fileSection = &fileHdr->sections[j];
+        image->sections[j].data = buf + fileHdr->sections[j].offset;
+    }
+    
+    /* verify the code */
+    if (!VerifyImage(c->sys, image))
+        ParseError(c, "generated code failed verification");
+    fileHdr->flags |= IMAGE_VERIFIED;
+    xbLocalFreeAll(c->sys);
+    
+    if (c->flags & COMPILER_INFO)
+        xbInfo(c->sys, "image verified\n");
+}
+
 /* ShowSectionInfo - show information about a section */
 static void ShowSectionInfo(ParseContext *c, ImageFileSection *section)
 {
@@ -120,25 +284,69 @@ static void ShowSectionInfo(ParseContext *c, ImageFileSection *section)
     xbInfo(c->sys, "%08x size\n", section->size);
 }
 
-/* WriteSection - write a block of memory to a section file */
+/* WriteSection - write a block of memory to a section */
 VMUVALUE WriteSection(ParseContext *c, Section *section, const uint8_t *buf, VMUVALUE size)
 {
     VMUVALUE allocatedSize = ROUND_TO_WORDS(size);
-    if (xbWriteFile(section->fp, (uint8_t *)buf, allocatedSize) != allocatedSize)
-        ParseError(c, "insufficient %s section space", section->name);
+    uint8_t pad[sizeof(VMUVALUE)];
+    if (section->buf && !GrowSection(section, section->offset + allocatedSize))
+        SpillSection(c, section, section->offset);
+    if (section->buf) {
+        memcpy(section->buf + section->offset, buf, size);
+        memset(section->buf + section->offset + size, 0, allocatedSize - size);
+    }
+    else {
+        memset(pad, 0, sizeof(pad));
+        if (xbWriteFile(section->fp, (uint8_t *)buf, size) != size
+        ||  xbWriteFile(section->fp, pad, allocatedSize - size) != allocatedSize - size)
+            ParseError(c, "insufficient %s section space", section->name);
+    }
     return allocatedSize;
 }
 
-/* ReadSectionOffset - read an offset in a section file */
+/* PackSection - pack a byte or word into the last long written to a section if it fits
+   (returns the offset of the value) */
+VMUVALUE PackSection(ParseContext *c, Section *section, const uint8_t *buf, VMUVALUE size)
+{
+    VMUVALUE offset = (section->packOffset + size - 1) & ~(size - 1);
+    
+    /* start a new long if something else was written or this value doesn't fit */
+    if (section->packEnd != section->offset || offset + size > section->packEnd) {
+        offset = section->offset;
+        section->offset += WriteSection(c, section, buf, size);
+        section->packEnd = section->offset;
+    }
+    
+    /* otherwise, store the value in the unused part of the long */
+    else {
+        if (!section->buf)
+            xbSeekFile(section->fp, offset, SEEK_SET);
+        PutSection(c, section, offset, buf, size);
+        if (!section->buf)
+            xbSeekFile(section->fp, section->offset, SEEK_SET);
+    }
+    
+    section->packOffset = offset + size;
+    return offset;
+}
+
+/* ReadSectionOffset - read an offset in a section */
 VMUVALUE ReadSectionOffset(ParseContext *c, Section *section, VMUVALUE offset)
 {
     uint8_t buf[sizeof(VMUVALUE)], *p;
     VMUVALUE value = 0;
     int cnt;
 
-    xbSeekFile(section->fp, offset, SEEK_SET);
-    if (xbReadFile(section->fp, buf, sizeof(VMUVALUE)) != sizeof(VMUVALUE))
-        ParseError(c, "trouble reading offset in the %s section", section->name);
+    if (section->buf) {
+        if (offset + sizeof(VMUVALUE) > section->offset)
+            ParseError(c, "trouble reading offset in the %s section", section->name);
+        memcpy(buf, section->buf + offset, sizeof(VMUVALUE));
+    }
+    else {
+        xbSeekFile(section->fp, offset, SEEK_SET);
+        if (xbReadFile(section->fp, buf, sizeof(VMUVALUE)) != sizeof(VMUVALUE))
+            ParseError(c, "trouble reading offset in the %s section", section->name);
+    }
 
     for (p = buf, cnt = sizeof(VMVALUE); --cnt >= 0; )
         value = (value << 8) | *p++;
@@ -157,9 +365,84 @@ void WriteSectionOffset(ParseContext *c, Section *section, VMUVALUE offset, VMUV
         value >>= 8;
     }
     
-    xbSeekFile(section->fp, offset, SEEK_SET);
-    if (xbWriteFile(section->fp, buf, sizeof(VMUVALUE)) != sizeof(VMUVALUE))
-        ParseError(c, "trouble updating offset in the %s section", section->name);
+    if (section->buf) {
+        if (offset + sizeof(VMUVALUE) > section->offset)
+            ParseError(c, "trouble updating offset in the %s section", section->name);
+        memcpy(section->buf + offset, buf, sizeof(VMUVALUE));
+    }
+    else {
+        xbSeekFile(section->fp, offset, SEEK_SET);
+        if (xbWriteFile(section->fp, buf, sizeof(VMUVALUE)) != sizeof(VMUVALUE))
+            ParseError(c, "trouble updating offset in the %s section", section->name);
+    }
+}
+
+/* PutSection - store data at an offset in a section that is either in memory or in a file
+   (file sections must already be positioned at the offset) */
+static void PutSection(ParseContext *c, Section *section, VMUVALUE offset, const uint8_t *buf, VMUVALUE size)
+{
+    if (section->buf && !GrowSection(section, offset + size)) {
+        SpillSection(c, section, offset > section->offset ? offset : section->offset);
+        xbSeekFile(section->fp, offset, SEEK_SET);
+    }
+    if (section->buf)
+        memcpy(section->buf + offset, buf, size);
+    else if (xbWriteFile(section->fp, (uint8_t *)buf, size) != size)
+        ParseError(c, "insufficient %s section space", section->name);
+}
+
+/* GrowSection - make sure an in-memory section buffer can hold the specified number of bytes */
+static int GrowSection(Section *section, VMUVALUE size)
+{
+    VMUVALUE newSize;
+    uint8_t *newBuf;
+    if (section->buf && size <= section->bufSize)
+        return TRUE;
+    for (newSize = section->bufSize ? section->bufSize : SECTION_BUFFER_SIZE; newSize < size; newSize *= 2)
+        ;
+    if (!(newBuf = (uint8_t *)realloc(section->buf, newSize)))
+        return FALSE;
+    section->buf = newBuf;
+    section->bufSize = newSize;
+    return TRUE;
+}
+
+/* OpenSectionFile - open the image file or the temporary file for a section */
+static int OpenSectionFile(ParseContext *c, Section *section)
+{
+    if (section == c->textTarget)
+        section->fp = fopen(c->imageName, "w+b");
+    else {
+        char tmpname[PATH_MAX];
+        MakeTmpName(tmpname, c->imageName, section->name);
+        section->fp = xbCreateTmpFile(c->sys, tmpname, "w+b");
+    }
+    return section->fp != NULL;
+}
+
+/* SpillSection - move the first length bytes of an in-memory section to its file when memory runs out */
+static void SpillSection(ParseContext *c, Section *section, VMUVALUE length)
+{
+    if (!OpenSectionFile(c, section))
+        ParseError(c, "insufficient memory for the %s section", section->name);
+    if (xbWriteFile(section->fp, section->buf, length) != length)
+        ParseError(c, "insufficient %s section space", section->name);
+    free(section->buf);
+    section->buf = NULL;
+    section->bufSize = 0;
+}
+
+/* FreeSections - free the in-memory section buffers */
+static void FreeSections(ParseContext *c)
+{
+    Section *section;
+    for (section = c->config->sections; section != NULL; section = section->next) {
+        if (section->buf) {
+            free(section->buf);
+            section->buf = NULL;
+            section->bufSize = 0;
+        }
+    }
 }
 
 /* MakeTmpName - make the name of a temporary section data file */
@@ -1,29 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "db_compiler.h"
 #include "xb_api.h"
 
-/* compiler context */
-static ParseContext *c = NULL;
+/* xbCreateSourceCache - create a cache for the include files read by a series of compiles
+   (the include files are also kept as precompiled units in unitDirectory if it isn't NULL) */
+SourceCache *xbCreateSourceCache(const char *unitDirectory)
+{
+    size_t size = sizeof(SourceCache);
+    SourceCache *cache;
+    if (unitDirectory)
+        size += strlen(unitDirectory) + 1;
+    if (!(cache = (SourceCache *)malloc(size)))
+        return NULL;
+    memset(cache, 0, sizeof(SourceCache));
+    if (unitDirectory) {
+        cache->unitDirectory = (char *)(cache + 1);
+        strcpy(cache->unitDirectory, unitDirectory);
+    }
+    return cache;
+}
+
+/* xbUseSourceCache - replay unchanged include files from a source cache */
+void xbUseSourceCache(ParseContext *c, SourceCache *cache)
+{
+    c->sourceCache = cache;
+}
+
+/* xbFreeSourceCache - free a source cache and all of its cached files */
+void xbFreeSourceCache(SourceCache *cache)
+{
+    FreeSourceCache(cache);
+}
+
+/* xbSetPhaseTimingHandler - report the time and memory used by each compile phase */
+void xbSetPhaseTimingHandler(ParseContext *c, PhaseTimingFcn *handler, void *cookie)
+{
+    c->phaseTiming = handler;
+    c->phaseTimingCookie = cookie;
+}
+
+/* xbLoadHotProfile - load the functions that executed at least percent of the instructions from a
+   profile written by xbint -C (the main code is never moved so it isn't included) */
+HotProfile *xbLoadHotProfile(const char *path, int percent)
+{
+    char line[1024], *name, *p;
+    HotFunction *function;
+    unsigned long long count, total = 0;
+    HotProfile *profile;
+    FILE *fp;
+    
+    /* open the profile */
+    if (!(fp = fopen(path, "r")))
+        return NULL;
+    if (!(profile = (HotProfile *)malloc(sizeof(HotProfile)))) {
+        fclose(fp);
+        return NULL;
+    }
+    profile->functions = NULL;
+    profile->count = 0;
+    
+    /* the function counts are compared with the total of all of them */
+    while (fgets(line, sizeof(line), fp))
+        if (strncmp(line, "function,", 9) == 0 && (p = strchr(line + 9, ',')) != NULL)
+            total += strtoull(p + 1, NULL, 10);
+    rewind(fp);
+    
+    /* collect the hot functions */
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "function,", 9) != 0 || !(p = strchr(name = line + 9, ',')))
+            continue;
+        *p++ = '\0';
+        count = strtoull(p, NULL, 10);
+        if (*name == '[' || count == 0 || count * 100 < total * percent)
+            continue;
+        if (!(function = (HotFunction *)malloc(sizeof(HotFunction) + strlen(name)))) {
+            xbFreeHotProfile(profile);
+            fclose(fp);
+            return NULL;
+        }
+        strcpy(function->name, name);
+        function->next = profile->functions;
+        profile->functions = function;
+        ++profile->count;
+    }
+    fclose(fp);
+    
+    /* return the profile */
+    return profile;
+}
+
+/* xbUseHotProfile - place the hot functions of a profile in hub memory */
+void xbUseHotProfile(ParseContext *c, HotProfile *profile)
+{
+    c->hotProfile = profile;
+}
+
+/* xbFreeHotProfile - free a profile and its hot functions */
+void xbFreeHotProfile(HotProfile *profile)
+{
+    HotFunction *function, *next;
+    for (function = profile->functions; function != NULL; function = next) {
+        next = function->next;
+        free(function);
+    }
+    free(profile);
+}
 
 static void SourceRewind(void *cookie);
 static int SourceGetLine(void *cookie, char *buf, int len);
 
-int xbInit(System *sys, BoardConfig *config, size_t maxCode)
+/* xbInit - create a compiler context that allocates its memory from sys */
+ParseContext *xbInit(System *sys, BoardConfig *config, size_t maxCode)
 {
-    /* initialize the compiler */
-    if (!(c = InitCompiler(sys, config, maxCode)))
-        return FALSE;
-    
-    /* return successfully */
-    return TRUE;
+    return InitCompiler(sys, config, maxCode);
 }
 
-int xbCompile(const char *infile, const char *outfile, int flags)
+/* xbCompile - compile a source file to an image file */
+int xbCompile(ParseContext *c, const char *infile, const char *outfile, int flags)
 {
     FILE *ifp;
     
     /* open the input file */
     if (!(ifp = xbOpenFile(c->sys, infile, "r"))) {
-        fprintf(stderr, "error: can't open '%s'\n", infile);
+        xbError(c->sys, "error: can't open '%s'\n", infile);
         return FALSE;
     }
     
@@ -37,7 +138,8 @@ int xbCompile(const char *infile, const char *outfile, int flags)
     
     /* compile the source file */
     if (!Compile(c, outfile)) {
-        fprintf(stderr, "error: compile failed\n");
+        xbError(c->sys, "error: compile of '%s' failed\n", infile);
+        fclose(ifp);
         return FALSE;
     }
     
@@ -2,10 +2,45 @@
 #define __XB_API_H__
 
 /* compiler flags */
-#define COMPILER_DEBUG  (1 << 0)
-#define COMPILER_INFO   (1 << 1)
+#define COMPILER_DEBUG       (1 << 0)
+#define COMPILER_INFO        (1 << 1)
+#define COMPILER_OPTIMIZE    (1 << 2)
+#define COMPILER_SYMBOLS     (1 << 3)
+#define COMPILER_VERIFY      (1 << 4)
+#define COMPILER_OPTIMIZE2   (1 << 5)
+#define COMPILER_INCREMENTAL (1 << 6)
+#define COMPILER_CHECK       (1 << 7)
 
-int xbInit(System *sys, BoardConfig *config, size_t maxCode);
-int xbCompile(const char *infile, const char *outfile, int flags);
+/* compiler context (each context can be used by a different thread) */
+typedef struct ParseContext ParseContext;
+
+/* time and memory used by a compile phase
+   (the code generation of each function is also reported within pass 3) */
+typedef struct {
+    const char *phase;          /* phase name */
+    const char *name;           /* function name for a code generation phase or NULL */
+    unsigned long microseconds; /* wall time spent in the phase */
+    size_t allocated;           /* heap space allocated during the phase */
+    size_t maxHeapUsed;         /* most heap space in use so far */
+} PhaseTiming;
+
+/* function called at the end of each compile phase */
+typedef void PhaseTimingFcn(void *cookie, const PhaseTiming *timing);
+
+/* include files kept between compiles (a cache can be used by only one context at a time) */
+typedef struct SourceCache SourceCache;
+
+/* functions that a profile found hot enough to place in hub memory (can be shared by contexts) */
+typedef struct HotProfile HotProfile;
+
+ParseContext *xbInit(System *sys, BoardConfig *config, size_t maxCode);
+int xbCompile(ParseContext *c, const char *infile, const char *outfile, int flags);
+SourceCache *xbCreateSourceCache(const char *unitDirectory);
+void xbUseSourceCache(ParseContext *c, SourceCache *cache);
+void xbFreeSourceCache(SourceCache *cache);
+void xbSetPhaseTimingHandler(ParseContext *c, PhaseTimingFcn *handler, void *cookie);
+HotProfile *xbLoadHotProfile(const char *path, int percent);
+void xbUseHotProfile(ParseContext *c, HotProfile *profile);
+void xbFreeHotProfile(HotProfile *profile);
 
 #endif
@@ -6,7 +6,13 @@
 #include "db_compiler.h"
 #include "db_loader.h"
 #include "db_packet.h"
-#include "mem_malloc.h"
+#include "mem_arena.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 /* defaults */
 #if defined(CYGWIN) || defined(WIN32)
@@ -20,24 +26,108 @@
 #endif
 #define DEF_BOARD   "hub"
 
+/* functions executing at least this percent of the profiled instructions are hot */
+#define HOT_PERCENT 1
+
+/* batch of source files compiled by a pool of worker threads */
+typedef struct {
+    BoardConfig *config;        /* board configuration (read only) */
+    int flags;                  /* compiler flags */
+    const char *units;          /* directory for precompiled include units or NULL */
+    HotProfile *profile;        /* functions to place in hub memory or NULL */
+    int timing;                 /* show the time and memory used by each compile phase */
+    char **files;               /* source files */
+    int count;                  /* number of source files */
+    int next;                   /* index of the next source file to compile */
+    int failed;                 /* number of source files that failed to compile */
+#if defined(WIN32)
+    CRITICAL_SECTION lock;      /* lock for next and failed */
+#else
+    pthread_mutex_t lock;       /* lock for next and failed */
+#endif
+} Batch;
+
+#if defined(WIN32)
+typedef HANDLE Worker;
+#define LockBatch(b)    EnterCriticalSection(&(b)->lock)
+#define UnlockBatch(b)  LeaveCriticalSection(&(b)->lock)
+#else
+typedef pthread_t Worker;
+#define LockBatch(b)    pthread_mutex_lock(&(b)->lock)
+#define UnlockBatch(b)  pthread_mutex_unlock(&(b)->lock)
+#endif
+
+/* server limits */
+#define MAXREQUEST      1024    /* longest request line */
+#define MAXREQUESTARGS  32      /* most words in a request */
+#define MAXSERVERTEXT   1024    /* longest output line */
+
+/* output text collected into lines for the server reply */
+typedef struct {
+    const char *type;           /* reply record type */
+    char buf[MAXSERVERTEXT];    /* text of the partial line */
+    int length;                 /* length of the partial line */
+} ServerStream;
+
+/* server state (the ops table comes first so the system callbacks can find the rest) */
+typedef struct {
+    SystemOps ops;              /* system operations for the compiler contexts */
+    SourceCache *cache;         /* include files kept between requests */
+    const char *mainFile;       /* main file of the request being compiled */
+    ServerStream info;          /* informational output */
+    ServerStream error;         /* error output that doesn't have a position */
+    BoardConfig *defaultConfig; /* board configuration selected on the command line */
+    int defaultFlags;           /* compiler flags given on the command line */
+    int defaultTiming;          /* report the compile phases (-T on the command line) */
+    HotProfile *profile;        /* functions to place in hub memory (-H on the command line) or NULL */
+} Server;
+
 static void Usage(void);
+static int CompileBatch(BoardConfig *config, char **files, int count, int flags, const char *units, HotProfile *profile, int timing, int jobs);
+static void CompileBatchFiles(Batch *batch);
+static int StartWorker(Batch *batch, Worker *pWorker);
+static void WaitForWorker(Worker worker);
+static int CompileFile(BoardConfig *config, const char *infile, int flags, const char *units, HotProfile *profile, int timing);
+static void ShowPhaseTiming(void *cookie, const PhaseTiming *timing);
+static int RunServer(BoardConfig *defaultConfig, int defaultFlags, const char *units, HotProfile *profile, int timing);
+static int ServerCompile(Server *server, char **args, int argCount);
+static int SplitRequest(char *line, char **args, int maxArgs);
+static void ServerInfo(System *sys, const char *fmt, va_list ap);
+static void ServerError(System *sys, const char *fmt, va_list ap);
+static void ServerDiagnostic(System *sys, const char *file, int line, int column, const char *message);
+static void ServerText(ServerStream *stream, const char *fmt, va_list ap);
+static void ServerFlush(ServerStream *stream);
+static void ServerPhaseTiming(void *cookie, const PhaseTiming *timing);
+static void ServerFail(const char *message);
+static void PutJsonString(const char *str);
 static char *ConstructOutputName(const char *infile, char *outfile, char *ext);
 
 static void MyInfo(System *sys, const char *fmt, va_list ap);
 static void MyError(System *sys, const char *fmt, va_list ap);
 static SystemOps myOps = {
     MyInfo,
-    MyError
+    MyError,
+    NULL
 };
 
 int main(int argc, char *argv[])
 {
-    char *infile = NULL, outfile[PATH_MAX];
-    char *port, *board, *p;
+    char **infiles, outfile[PATH_MAX], loaderfile[PATH_MAX];
+    char *port, *board, *units = NULL, *p;
+    HotProfile *profile = NULL;
+    int infileCount = 0;
+    int serverMode = FALSE;
+    int timing = FALSE;
+    unsigned long start;
+    size_t allocated;
+    int jobs = 1;
     BoardConfig *config;
     int writeEepromLoader = FALSE;
+    char *loaderExt = NULL;
     int runImage = FALSE;
     int terminalMode = FALSE;
+    int terminalFlags = 0;
+    char *capture = NULL;
     int compilerFlags = 0;
     int runFlags = 0;
     System *sys;
@@ -49,12 +139,28 @@ int main(int argc, char *argv[])
     if (!(board = getenv("BOARD")))
         board = DEF_BOARD;
         
+    /* make room for the input filenames */
+    if (!(infiles = (char **)malloc(argc * sizeof(char *)))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return 1;
+    }
+        
     /* get the arguments */
     for(i = 1; i < argc; ++i) {
 
         /* handle switches */
         if(argv[i][0] == '-') {
             switch(argv[i][1]) {
+            case '-':
+                if (strcmp(&argv[i][2], "server") == 0)
+                    serverMode = TRUE;
+                else if (strcmp(&argv[i][2], "binary") == 0)
+                    loaderExt = ".binary";
+                else if (strcmp(&argv[i][2], "eeprom") == 0)
+                    loaderExt = ".eeprom";
+                else
+                    Usage();
+                break;
             case 'b':   // select a target board
                 if (argv[i][2])
                     board = &argv[i][2];
@@ -95,6 +201,17 @@ int main(int argc, char *argv[])
             case 't':
                 terminalMode = TRUE;
                 break;
+            case 'o':   // capture what the target sends in terminal mode
+            case 'L':   // the same with each line timestamped
+                terminalFlags = argv[i][1] == 'L' ? TERMINAL_TIMESTAMPS : 0;
+                if (argv[i][2])
+                    capture = &argv[i][2];
+                else if (++i < argc)
+                    capture = argv[i];
+                else
+                    Usage();
+                terminalMode = TRUE;
+                break;
             case 'd':
                 runFlags |= RUN_PAUSE;
                 break;
@@ -104,6 +221,26 @@ int main(int argc, char *argv[])
             case 'v':
                 compilerFlags |= COMPILER_INFO;
                 break;
+            case 'O':
+                compilerFlags |= COMPILER_OPTIMIZE;
+                if (argv[i][2] == '2')
+                    compilerFlags |= COMPILER_OPTIMIZE2;
+                break;
+            case 'g':
+                compilerFlags |= COMPILER_SYMBOLS;
+                break;
+            case 'V':
+                compilerFlags |= COMPILER_VERIFY;
+                break;
+            case 'C':
+                compilerFlags |= COMPILER_CHECK;
+                break;
+            case 'i':
+                compilerFlags |= COMPILER_INCREMENTAL;
+                break;
+            case 'T':
+                timing = TRUE;
+                break;
             case 'I':
                 if(argv[i][2])
                     p = &argv[i][2];
@@ -113,27 +250,57 @@ int main(int argc, char *argv[])
                     Usage();
                 xbAddToPath(p);
                 break;
+            case 'u':
+                if(argv[i][2])
+                    units = &argv[i][2];
+                else if(++i < argc)
+                    units = argv[i];
+                else
+                    Usage();
+                break;
+            case 'H':
+                if(argv[i][2])
+                    p = &argv[i][2];
+                else if(++i < argc)
+                    p = argv[i];
+                else
+                    Usage();
+                if (!(profile = xbLoadHotProfile(p, HOT_PERCENT))) {
+                    fprintf(stderr, "error: can't read profile '%s'\n", p);
+                    return 1;
+                }
+                break;
+            case 'j':
+                if(argv[i][2])
+                    p = &argv[i][2];
+                else if(++i < argc)
+                    p = argv[i];
+                else
+                    Usage();
+                if ((jobs = atoi(p)) < 1)
+                    Usage();
+                break;
             default:
                 Usage();
                 break;
             }
         }
 
-        /* handle the input filename */
-        else {
-            if (infile)
-                Usage();
-            infile = argv[i];
-        }
+        /* handle the input filenames */
+        else
+            infiles[infileCount++] = argv[i];
     }
     
-    /* make sure an input file was specified */
-    if (!infile)
+    /* make sure an input file was specified (the server gets them from its requests) */
+    if (serverMode ? infileCount > 0 : infileCount == 0)
         Usage();
 
-    /* create the output file name */
-    ConstructOutputName(infile, outfile, ".bai");
-    
+    /* make sure a batch of files is only compiled */
+    if (infileCount > 1 && (writeEepromLoader || loaderExt || runImage || terminalMode)) {
+        fprintf(stderr, "error: only a single program can be loaded or run\n");
+        return 1;
+    }
+        
     /* make sure -e and -r aren't used together */
     if (writeEepromLoader && runImage) {
         fprintf(stderr, "error: writing the eeprom loader and running the program are mutually exclusive\n");
@@ -151,7 +318,11 @@ int main(int argc, char *argv[])
     xbAddEnvironmentPath();
     
     /* load the board configuration file */
+    start = xbGetMicroseconds();
+    allocated = xbHeapAllocated(sys);
     ParseConfigurationFile(sys, "xbasic.cfg");
+    if (timing && !serverMode)
+        printf("config: %.3f ms, %lu bytes\n", (xbGetMicroseconds() - start) / 1000.0, (unsigned long)(xbHeapAllocated(sys) - allocated));
 
     /* setup for the selected board */
     if (!(config = GetBoardConfig(board))) {
@@ -159,18 +330,23 @@ int main(int argc, char *argv[])
         return 1;
     }
     
-    /* initialize the compiler */
-    if (!xbInit(sys, config, MAXCODE)) {
-        fprintf(stderr, "error: compiler initialization failed\n");
+    /* handle compile requests until told to quit */
+    if (serverMode)
+        return RunServer(config, compilerFlags, units, profile, timing) ? 0 : 1;
+    
+    /* create the output file name */
+    ConstructOutputName(infiles[0], outfile, ".bai");
+    
+    /* compile the source files */
+    if (!CompileBatch(config, infiles, infileCount, compilerFlags, units, profile, timing, jobs))
         return 1;
+    
+    /* write the loader with the program to a file for the ROM loader if requested */
+    if (loaderExt) {
+        ConstructOutputName(infiles[0], loaderfile, loaderExt);
+        if (!WriteLoaderFile(sys, config, outfile, loaderfile, loaderExt[1] == 'e'))
+            return 1;
     }
-        
-    /* compile the source file */
-    if (!xbCompile(infile, outfile, compilerFlags))
-        return 1;
-        
-    /* free allocated memory */
-    MemFree(sys);
     
     /* open the port if necessary */
     if (runImage || writeEepromLoader || terminalMode) {
@@ -206,7 +382,11 @@ int main(int argc, char *argv[])
     
     /* enter terminal mode if requested */
     if (terminalMode)
-        TerminalMode();
+        TerminalMode(capture, terminalFlags);
+    
+    /* free allocated memory */
+    MemFree(sys);
+    free(infiles);
     
     return 0;
 }
@@ -216,20 +396,495 @@ static void Usage(void)
 {
     fprintf(stderr, "\
 usage: xbcom\n\
-         [ -b <type> ]   select target board (c3 | ssf | hub | hub96) (default is hub)\n\
+         [ -b <type> ]   select target board (c3 | ssf | eeprom | sd | hub | hub96 | host) (default is hub)\n\
          [ -p <port> ]   serial port (default is %s)\n\
          [ -e ]          write loader to eeprom\n\
+         [ --binary ]    write the loader to a .binary file for the ROM loader\n\
+         [ --eeprom ]    the same as a 32K .eeprom file\n\
+                         (the loader has the program on hub boards and runs\n\
+                         the program in flash on the others)\n\
          [ -r ]          load and run the compiled program\n\
          [ -t ]          enter terminal mode after running the program\n\
+         [ -o <file> ]   terminal mode capturing what the target sends to a file\n\
+         [ -L <file> ]   the same with each captured line timestamped\n\
          [ -d ]          add a delay to allow the terminal emulator to start\n\
          [ -D ]          display compiler debug information\n\
          [ -v ]          display verbose compiler statistics\n\
+         [ -O ]          optimize the generated code\n\
+         [ -O2 ]         also remove common subexpressions and move loop invariants\n\
+         [ -g ]          write a debug section with the function symbols and source lines\n\
+         [ -V ]          verify the generated code and mark the image as verified\n\
+         [ -C ]          check array indexes against the array sizes\n\
+         [ -i ]          reuse the code of unchanged functions from the last build\n\
+         [ -T ]          show the time and memory used by each compile phase\n\
          [ -I <path> ]   set the path for include files\n\
-         <name>          file to compile\n\
+         [ -j <n> ]      compile the files using n threads\n\
+         [ -u <dir> ]    keep precompiled include units in dir\n\
+         [ -H <file> ]   place the hot functions of an xbint -C profile in hub memory\n\
+         [ --server ]    handle compile requests from stdin and reply on stdout\n\
+         <name> ...      files to compile (only one with -e, -r or -t)\n\
 ", DEF_PORT);
     exit(1);
 }
 
+/* CompileBatch - compile a batch of source files using a pool of worker threads */
+static int CompileBatch(BoardConfig *config, char **files, int count, int flags, const char *units, HotProfile *profile, int timing, int jobs)
+{
+    Worker *workers = NULL;
+    int started = 0, i;
+    Batch batch;
+    
+    /* setup the batch */
+    batch.config = config;
+    batch.flags = flags;
+    batch.units = units;
+    batch.profile = profile;
+    batch.timing = timing;
+    batch.files = files;
+    batch.count = count;
+    batch.next = 0;
+    batch.failed = 0;
+#if defined(WIN32)
+    InitializeCriticalSection(&batch.lock);
+#else
+    pthread_mutex_init(&batch.lock, NULL);
+#endif
+
+    /* start the workers */
+    if (jobs > count)
+        jobs = count;
+    if (jobs > 1 && (workers = (Worker *)malloc(jobs * sizeof(Worker))) != NULL) {
+        while (started < jobs && StartWorker(&batch, &workers[started]))
+            ++started;
+    }
+    
+    /* compile in this thread if there is only one job or no workers could be started */
+    if (started == 0)
+        CompileBatchFiles(&batch);
+        
+    /* wait for the workers to finish */
+    for (i = 0; i < started; ++i)
+        WaitForWorker(workers[i]);
+    if (workers)
+        free(workers);
+
+#if defined(WIN32)
+    DeleteCriticalSection(&batch.lock);
+#else
+    pthread_mutex_destroy(&batch.lock);
+#endif
+
+    /* report failures in a batch */
+    if (batch.failed > 0 && count > 1)
+        fprintf(stderr, "error: %d of %d files failed to compile\n", batch.failed, count);
+        
+    /* return successfully if all of the files compiled */
+    return batch.failed == 0;
+}
+
+/* CompileBatchFiles - compile files from a batch until there are none left */
+static void CompileBatchFiles(Batch *batch)
+{
+    int i;
+    for (;;) {
+    
+        /* get the next file */
+        LockBatch(batch);
+        i = batch->next++;
+        UnlockBatch(batch);
+        if (i >= batch->count)
+            break;
+            
+        /* compile it */
+        if (!CompileFile(batch->config, batch->files[i], batch->flags, batch->units, batch->profile, batch->timing)) {
+            LockBatch(batch);
+            ++batch->failed;
+            UnlockBatch(batch);
+        }
+    }
+}
+
+#if defined(WIN32)
+
+static DWORD WINAPI WorkerThread(LPVOID cookie)
+{
+    CompileBatchFiles((Batch *)cookie);
+    return 0;
+}
+
+/* StartWorker - start a worker thread compiling files from a batch */
+static int StartWorker(Batch *batch, Worker *pWorker)
+{
+    return (*pWorker = CreateThread(NULL, 0, WorkerThread, batch, 0, NULL)) != NULL;
+}
+
+/* WaitForWorker - wait for a worker thread to finish */
+static void WaitForWorker(Worker worker)
+{
+    WaitForSingleObject(worker, INFINITE);
+    CloseHandle(worker);
+}
+
+#else
+
+static void *WorkerThread(void *cookie)
+{
+    CompileBatchFiles((Batch *)cookie);
+    return NULL;
+}
+
+/* StartWorker - start a worker thread compiling files from a batch */
+static int StartWorker(Batch *batch, Worker *pWorker)
+{
+    return pthread_create(pWorker, NULL, WorkerThread, batch) == 0;
+}
+
+/* WaitForWorker - wait for a worker thread to finish */
+static void WaitForWorker(Worker worker)
+{
+    pthread_join(worker, NULL);
+}
+
+#endif
+
+/* CompileFile - compile a source file using a compiler context of its own */
+static int CompileFile(BoardConfig *config, const char *infile, int flags, const char *units, HotProfile *profile, int timing)
+{
+    SourceCache *cache = NULL;
+    char outfile[PATH_MAX];
+    ParseContext *c;
+    System *sys;
+    int sts;
+    
+    /* create the output file name */
+    ConstructOutputName(infile, outfile, ".bai");
+    
+    /* use the precompiled include units in the unit directory */
+    if (units && !(cache = xbCreateSourceCache(units))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return FALSE;
+    }
+    
+    /* each context allocates from its own memory allocator */
+    if (!(sys = MemInit())) {
+        fprintf(stderr, "error: memory initialization failed\n");
+        return FALSE;
+    }
+    sys->ops = &myOps;
+    
+    /* initialize the compiler and compile the source file */
+    if (!(c = xbInit(sys, config, MAXCODE))) {
+        fprintf(stderr, "error: compiler initialization failed\n");
+        sts = FALSE;
+    }
+    else {
+        if (cache)
+            xbUseSourceCache(c, cache);
+        if (profile)
+            xbUseHotProfile(c, profile);
+        if (timing)
+            xbSetPhaseTimingHandler(c, ShowPhaseTiming, (void *)infile);
+        sts = xbCompile(c, infile, outfile, flags);
+        if (flags & COMPILER_INFO)
+            xbInfo(sys, "%s: compiler heap high-water mark %lu bytes\n", infile, (unsigned long)xbMaxHeapUsed(sys));
+    }
+        
+    /* free the memory used by the context */
+    MemFree(sys);
+    if (cache)
+        xbFreeSourceCache(cache);
+    return sts;
+}
+
+/* ShowPhaseTiming - show the time and memory used by a compile phase */
+static void ShowPhaseTiming(void *cookie, const PhaseTiming *timing)
+{
+    printf("%s: %s%s%s: %.3f ms, %lu bytes, %lu bytes peak\n",
+           (const char *)cookie,
+           timing->phase,
+           timing->name ? " " : "",
+           timing->name ? timing->name : "",
+           timing->microseconds / 1000.0,
+           (unsigned long)timing->allocated,
+           (unsigned long)timing->maxHeapUsed);
+}
+
+/* RunServer - compile the files named by requests on stdin until told to quit
+
+   The board configuration and the lines and tokens of the include files are kept
+   between requests (and also saved as precompiled units if a unit directory is given).  Each request is a line of words separated by spaces, with
+   double quotes around words that contain spaces:
+   
+     compile [ -b <type> ] [ -O ] [ -O2 ] [ -g ] [ -V ] [ -C ] [ -i ] [ -v ] [ -T ] <name>
+     quit
+     
+   Each reply is a series of JSON objects, one per line, ending with a "done" object:
+   
+     {"type":"info","text":"..."}
+     {"type":"error","text":"..."}
+     {"type":"diagnostic","file":"x.bas","line":12,"column":5,"message":"..."}
+     {"type":"phase","phase":"code","name":"foo","microseconds":52,"allocated":1024,"maxHeapUsed":65536}
+     {"type":"done","status":"ok","output":"x.bai","cacheHits":2,"cacheMisses":1,"unitLoads":1}
+*/
+static int RunServer(BoardConfig *defaultConfig, int defaultFlags, const char *units, HotProfile *profile, int timing)
+{
+    char line[MAXREQUEST], *args[MAXREQUESTARGS];
+    int argCount;
+    Server server;
+    
+    /* setup the server */
+    memset(&server, 0, sizeof(server));
+    server.ops.info = ServerInfo;
+    server.ops.error = ServerError;
+    server.ops.diagnostic = ServerDiagnostic;
+    server.info.type = "info";
+    server.error.type = "error";
+    server.defaultConfig = defaultConfig;
+    server.defaultFlags = defaultFlags;
+    server.defaultTiming = timing;
+    server.profile = profile;
+    if (!(server.cache = xbCreateSourceCache(units))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return FALSE;
+    }
+    
+    /* handle requests */
+    while (fgets(line, sizeof(line), stdin)) {
+        if ((argCount = SplitRequest(line, args, MAXREQUESTARGS)) == 0)
+            continue;
+        if (strcmp(args[0], "quit") == 0)
+            break;
+        else if (strcmp(args[0], "compile") == 0)
+            ServerCompile(&server, args + 1, argCount - 1);
+        else
+            ServerFail("unknown request");
+        fflush(stdout);
+    }
+    
+    /* free the source cache */
+    xbFreeSourceCache(server.cache);
+    return TRUE;
+}
+
+/* ServerCompile - handle a compile request */
+static int ServerCompile(Server *server, char **args, int argCount)
+{
+    BoardConfig *config = server->defaultConfig;
+    int flags = server->defaultFlags;
+    int timing = server->defaultTiming;
+    char outfile[PATH_MAX];
+    const char *infile = NULL;
+    int hits, misses, unitLoads, sts, i;
+    ParseContext *c;
+    System *sys;
+    
+    /* get the request options */
+    for (i = 0; i < argCount; ++i) {
+        if (args[i][0] == '-') {
+            if (strcmp(args[i], "-b") == 0 && i + 1 < argCount) {
+                if (!(config = GetBoardConfig(args[++i]))) {
+                    ServerFail("no such board type");
+                    return FALSE;
+                }
+            }
+            else if (strcmp(args[i], "-O") == 0)
+                flags |= COMPILER_OPTIMIZE;
+            else if (strcmp(args[i], "-O2") == 0)
+                flags |= COMPILER_OPTIMIZE | COMPILER_OPTIMIZE2;
+            else if (strcmp(args[i], "-g") == 0)
+                flags |= COMPILER_SYMBOLS;
+            else if (strcmp(args[i], "-V") == 0)
+                flags |= COMPILER_VERIFY;
+            else if (strcmp(args[i], "-C") == 0)
+                flags |= COMPILER_CHECK;
+            else if (strcmp(args[i], "-i") == 0)
+                flags |= COMPILER_INCREMENTAL;
+            else if (strcmp(args[i], "-v") == 0)
+                flags |= COMPILER_INFO;
+            else if (strcmp(args[i], "-T") == 0)
+                timing = TRUE;
+            else
+                break;
+        }
+        else if (!infile)
+            infile = args[i];
+        else
+            break;
+    }
+    if (i < argCount || !infile) {
+        ServerFail("usage: compile [ -b <type> ] [ -O ] [ -O2 ] [ -g ] [ -V ] [ -i ] [ -v ] [ -T ] <name>");
+        return FALSE;
+    }
+    
+    /* the parse tree dump is written directly to stdout so it can't be part of a reply */
+    flags &= ~COMPILER_DEBUG;
+    
+    /* create the output file name */
+    ConstructOutputName(infile, outfile, ".bai");
+    
+    /* compile the file with a context of its own that shares the source cache */
+    hits = server->cache->hits;
+    misses = server->cache->misses;
+    unitLoads = server->cache->unitLoads;
+    server->mainFile = infile;
+    if (!(sys = MemInit())) {
+        ServerFail("memory initialization failed");
+        return FALSE;
+    }
+    sys->ops = &server->ops;
+    if (!(c = xbInit(sys, config, MAXCODE))) {
+        xbError(sys, "error: compiler initialization failed\n");
+        sts = FALSE;
+    }
+    else {
+        xbUseSourceCache(c, server->cache);
+        if (server->profile)
+            xbUseHotProfile(c, server->profile);
+        if (timing)
+            xbSetPhaseTimingHandler(c, ServerPhaseTiming, server);
+        sts = xbCompile(c, infile, outfile, flags);
+    }
+    MemFree(sys);
+    ServerFlush(&server->info);
+    ServerFlush(&server->error);
+    
+    /* finish the reply */
+    printf("{\"type\":\"done\",\"status\":\"%s\"", sts ? "ok" : "failed");
+    if (sts) {
+        printf(",\"output\":");
+        PutJsonString(outfile);
+    }
+    printf(",\"cacheHits\":%d,\"cacheMisses\":%d", server->cache->hits - hits, server->cache->misses - misses);
+    printf(",\"unitLoads\":%d}\n", server->cache->unitLoads - unitLoads);
+    return sts;
+}
+
+/* SplitRequest - split a request line into words */
+static int SplitRequest(char *line, char **args, int maxArgs)
+{
+    char *p = line;
+    int count = 0;
+    for (;;) {
+    
+        /* skip spaces between words */
+        while (*p != '\0' && isspace((int)*p))
+            ++p;
+        if (*p == '\0' || count >= maxArgs)
+            break;
+            
+        /* find the end of the word */
+        if (*p == '"') {
+            args[count++] = ++p;
+            while (*p != '\0' && *p != '"')
+                ++p;
+        }
+        else {
+            args[count++] = p;
+            while (*p != '\0' && !isspace((int)*p))
+                ++p;
+        }
+        if (*p != '\0')
+            *p++ = '\0';
+    }
+    return count;
+}
+
+/* ServerInfo - add informational output to the reply */
+static void ServerInfo(System *sys, const char *fmt, va_list ap)
+{
+    ServerText(&((Server *)sys->ops)->info, fmt, ap);
+}
+
+/* ServerError - add error output that doesn't have a position to the reply */
+static void ServerError(System *sys, const char *fmt, va_list ap)
+{
+    ServerText(&((Server *)sys->ops)->error, fmt, ap);
+}
+
+/* ServerDiagnostic - add a compile error and its position to the reply */
+static void ServerDiagnostic(System *sys, const char *file, int line, int column, const char *message)
+{
+    Server *server = (Server *)sys->ops;
+    printf("{\"type\":\"diagnostic\",\"file\":");
+    PutJsonString(file ? file : server->mainFile);
+    printf(",\"line\":%d,\"column\":%d,\"message\":", line, column);
+    PutJsonString(message);
+    printf("}\n");
+}
+
+/* ServerText - add text to a stream and write each line it completes to the reply */
+static void ServerText(ServerStream *stream, const char *fmt, va_list ap)
+{
+    char text[MAXSERVERTEXT], *p;
+    vsnprintf(text, sizeof(text), fmt, ap);
+    for (p = text; *p != '\0'; ++p) {
+        if (*p == '\n')
+            ServerFlush(stream);
+        else if (stream->length < MAXSERVERTEXT - 1)
+            stream->buf[stream->length++] = *p;
+    }
+}
+
+/* ServerFlush - write the partial line of a stream to the reply */
+static void ServerFlush(ServerStream *stream)
+{
+    if (stream->length > 0) {
+        stream->buf[stream->length] = '\0';
+        printf("{\"type\":\"%s\",\"text\":", stream->type);
+        PutJsonString(stream->buf);
+        printf("}\n");
+        stream->length = 0;
+    }
+}
+
+/* ServerPhaseTiming - add the time and memory used by a compile phase to the reply */
+static void ServerPhaseTiming(void *cookie, const PhaseTiming *timing)
+{
+    Server *server = (Server *)cookie;
+    ServerFlush(&server->info);
+    printf("{\"type\":\"phase\",\"phase\":");
+    PutJsonString(timing->phase);
+    if (timing->name) {
+        printf(",\"name\":");
+        PutJsonString(timing->name);
+    }
+    printf(",\"microseconds\":%lu,\"allocated\":%lu,\"maxHeapUsed\":%lu}\n",
+           timing->microseconds, (unsigned long)timing->allocated, (unsigned long)timing->maxHeapUsed);
+}
+
+/* ServerFail - reply to a request that couldn't be handled */
+static void ServerFail(const char *message)
+{
+    printf("{\"type\":\"error\",\"text\":");
+    PutJsonString(message);
+    printf("}\n{\"type\":\"done\",\"status\":\"failed\"}\n");
+}
+
+/* PutJsonString - write a string as a JSON string */
+static void PutJsonString(const char *str)
+{
+    putchar('"');
+    for (; *str != '\0'; ++str) {
+        switch (*str) {
+        case '"':
+        case '\\':
+            putchar('\\');
+            putchar(*str);
+            break;
+        case '\t':
+            printf("\\t");
+            break;
+        default:
+            if ((unsigned char)*str < ' ')
+                printf("\\u%04x", (unsigned char)*str);
+            else
+                putchar(*str);
+            break;
+        }
+    }
+    putchar('"');
+}
+
 /* ConstructOutputName - construct an output filename from an input filename */
 static char *ConstructOutputName(const char *infile, char *outfile, char *ext)
 {
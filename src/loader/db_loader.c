@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include "db_loader.h"
@@ -9,6 +10,14 @@
 /* default baud rate */
 #define BAUD_RATE               115200
 
+/* time to find the helper at a new baud rate and after going back to the old one */
+#define NEW_RATE_TIMEOUT        1000
+#define OLD_RATE_TIMEOUT        3000
+
+/* frames to send before checking the error rate and the largest tolerable resend rate */
+#define LINK_CHECK_FRAMES       32
+#define LINK_MAX_RESENDS(n)     ((n) / 8)
+
 /* maximum cog image size */
 #define COG_IMAGE_MAX           (496 * 4)
 
@@ -60,6 +69,8 @@ typedef struct {
     uint8_t rxpin;
     uint8_t txpin;
     uint16_t unused;
+    uint32_t cache_param1;
+    uint32_t cache_param2;
     uint32_t vm_code_off;
     uint32_t cache_code_off;
 } FlashLoaderDatHdr;
@@ -67,6 +78,10 @@ typedef struct {
 /* target checksum for a binary file */
 #define SPIN_TARGET_CHECKSUM    0x14
 
+/* size of an eeprom file and the long the ROM loader stores twice below the stack of a binary file */
+#define EEPROM_SIZE             (32 * 1024)
+#define SPIN_STACK_MARKER       0xfff9ffff
+
 /* packet types */
 #define TYPE_VM_INIT            1
 #define TYPE_CACHE_INIT         2
@@ -76,6 +91,73 @@ typedef struct {
 #define TYPE_DATA               6
 #define TYPE_EOF                7
 #define TYPE_RUN                8
+#define TYPE_BAUD               9
+#define TYPE_DATA_Z             10
+#define TYPE_FLASH_HASH         11
+#define TYPE_FLASH_UPDATE       12
+#define TYPE_FLASH_SEEK         13
+#define TYPE_HELLO              14
+#define TYPE_IDENTITY           15
+#define TYPE_MEM_READ           16
+#define TYPE_MEM_WRITE          17
+#define TYPE_PROFILE_INIT       18
+#define TYPE_PROFILE_READ       19
+#define TYPE_BREAK_SET          20
+#define TYPE_BREAK_CLEAR        21
+#define TYPE_COUNTERS_INIT      22
+#define TYPE_COUNTERS_READ      23
+
+/* helper protocol version a resident helper must report to be reused */
+#define HELPER_VERSION          3
+
+/* time to wait for a resident helper to answer and for a block of memory */
+#define HELLO_TIMEOUT           300
+#define MEM_TIMEOUT             1000
+
+/* most profile buckets (they take hub memory below the VM state), the smallest bucket
+   (the VM puts its command in the low bits of the address) and the sample period in clocks */
+#define PROFILE_MAX_BUCKETS     1024
+#define PROFILE_MIN_SHIFT       2
+#define PROFILE_PERIOD          8000
+
+/* longs in the profile header the helper sends ahead of the buckets */
+#define PROFILE_HDR_LONGS       8
+
+/* longs in the counters header the helper sends ahead of the lines, longs for each line
+   and the most lines counted (see counters.spin) */
+#define COUNTERS_HDR_LONGS      5
+#define COUNTERS_LINE_LONGS     3
+#define COUNTERS_MAX_LINES      256
+
+/* features the helper advertises */
+#define FEATURE_DATA_Z          0x01
+#define FEATURE_FLASH_HASH      0x02
+
+/* flash erase block size, most block hashes in a reply and the time to wait for them */
+#define FLASH_BLOCK_SIZE        4096
+#define HASH_BATCH              (PKTMAXLEN / 8)
+#define HASH_TIMEOUT(n)         (1000 + (n) * 100)
+
+/* compressed data (each packet decodes to at most PKTMAXLEN bytes):
+ *   0x00-0x7f  copy the next n+1 bytes
+ *   0x80-0xbf  fill (n & 0x3f)+3 bytes with the next byte
+ *   0xc0-0xff  copy (n & 0x3f)+3 bytes from hi:lo bytes back in the block (never overlapping)
+ */
+#define Z_LITERAL_MAX           128
+#define Z_COPY_MIN              3
+#define Z_COPY_MAX              (0x3f + Z_COPY_MIN)
+#define Z_HASH_SIZE             1024
+#define Z_HASH(p)               ((((p)[0] << 6) ^ ((p)[1] << 3) ^ (p)[2]) & (Z_HASH_SIZE - 1))
+
+/* baud rates for the link to the helper from fastest to slowest */
+static uint32_t linkRates[] = { 2000000, 921600, 460800, 230400, BAUD_RATE };
+
+/* current baud rate of the link to the helper */
+static uint32_t linkBaudrate = BAUD_RATE;
+
+/* function to report the start of each load phase (or NULL) */
+static LoadPhaseFcn *loadPhase = NULL;
+static void *loadPhaseCookie = NULL;
 
 extern uint8_t serial_helper_array[];
 extern int serial_helper_size;
@@ -85,27 +167,62 @@ extern uint8_t flash_loader_array[];
 extern int flash_loader_size;
 extern uint8_t xbasic_vm_array[];
 extern int xbasic_vm_size;
+extern uint8_t xbasic_vm_hub_array[];
+extern int xbasic_vm_hub_size;
 
 static int ReadCogImage(System *sys, char *name, uint8_t *buf, int *pSize);
+static int PatchHubLoader(BoardConfig *config, char *path);
+static int PatchFlashLoader(System *sys, BoardConfig *config);
+static void FixChecksum(uint8_t *binary, int size);
+static uint8_t *VMImage(BoardConfig *config, int *pSize);
+static uint32_t HelperIdentity(uint8_t *cacheDriverImage, int imageSize, VMUVALUE *params, int paramsSize, uint8_t *vmImage, int vmSize, VMUVALUE keepVM);
+static int ImageStartsCogs(char *path);
+static uint32_t AddToHash(uint32_t hash, void *data, int size);
+static int FindResidentHelper(uint32_t identity);
+static int HelloResidentHelper(uint32_t *pIdentity);
 static FILE *OpenAndProbeFile(char *path, char *buf, int *pSize, int *pCnt, int *pType);
 static int WriteFileToMemory(char *path);
 static int WriteBuffer(uint8_t *buf, int size);
 static int WriteFile(FILE *fp, uint8_t *buf, int cnt, int size);
+static int UpdateFlash(FILE *fp, uint8_t *buf, int cnt, int size);
+static void HashBlock(uint8_t *p, int len, uint32_t *pSum, uint32_t *pSumOfSums);
+static uint32_t GetLong(uint8_t *p);
+static void SetLong(uint8_t *p, uint32_t value);
+static int QueueData(uint8_t *buf, int cnt);
+static int CompressBlock(uint8_t *src, int size, uint8_t *dst);
+static int RaiseBaudRate(uint32_t maxBaudrate);
+static int CheckLink(void);
+static int ChangeBaudRate(uint32_t baudrate);
+static void LoadPhase(const char *phase);
 static char *PacketTypeName(int type);
 static int Error(char *fmt, ...);
 
+void SetLoadPhaseFcn(LoadPhaseFcn *fcn, void *cookie)
+{
+    loadPhase = fcn;
+    loadPhaseCookie = cookie;
+}
+
 int InitPort(char *port)
 {
+    linkBaudrate = BAUD_RATE;
 	return serial_init(port, BAUD_RATE);
 }
 
+void ClosePort(void)
+{
+    serial_done();
+}
+
 int LoadImage(System *sys, BoardConfig *config, char *port, char *path)
 {    
 	SpinHdr *hdr = (SpinHdr *)serial_helper_array;
     SpinObj *obj = (SpinObj *)(serial_helper_array + hdr->objstart);
     SerialHelperDatHdr *dat = (SerialHelperDatHdr *)((uint8_t *)obj + (obj->pubcnt + obj->objcnt) * sizeof(uint32_t));
-    uint8_t cacheDriverImage[COG_IMAGE_MAX];
-    int imageSize, chksum, i;
+    uint8_t cacheDriverImage[COG_IMAGE_MAX], *vmImage;
+    int imageSize = 0, vmSize, resident;
+    VMUVALUE params[3], keepVM;
+    uint32_t identity;
 	
     /* patch serial helper for clock mode and frequency */
     hdr->clkfreq = config->clkfreq;
@@ -114,60 +231,164 @@ int LoadImage(System *sys, BoardConfig *config, char *port, char *path)
 	dat->rxpin = config->rxpin;
 	dat->txpin = config->txpin;
 	dat->tvpin = config->tvpin;
-        
-    /* recompute the checksum */
-    hdr->chksum = 0;
-    for (chksum = i = 0; i < serial_helper_size; ++i)
-        chksum += serial_helper_array[i];
-    hdr->chksum = SPIN_TARGET_CHECKSUM - chksum;
+    FixChecksum(serial_helper_array, serial_helper_size);
+    
+    /* read the cache driver now since a resident helper must have loaded the same one */
+    if (config->cacheDriver && !ReadCogImage(sys, config->cacheDriver, cacheDriverImage, &imageSize))
+        return Error("reading cache driver image failed: %s", config->cacheDriver);
+    params[0] = config->cacheSize;
+    params[1] = config->cacheParam1;
+    params[2] = config->cacheParam2;
+    vmImage = VMImage(config, &vmSize);
     
-	/* load the serial helper program */
-    if (ploadbuf(serial_helper_array, serial_helper_size, port, DOWNLOAD_RUN_BINARY) != 0)
-		return Error("helper load failed");
+    /* COGSTART starts more VM cogs from the VM code so only keep it in hub memory for a program that needs it
+       (the VMs of a cache board would need a cache cog that serves more than one VM) */
+    keepVM = !config->cacheDriver && ImageStartsCogs(path);
+    identity = HelperIdentity(cacheDriverImage, imageSize, params, sizeof(params), vmImage, vmSize, keepVM);
+    
+    /* reuse the helper, cache driver and VM if the last program halted and left them running */
+    LoadPhase("probe");
+    if ((resident = FindResidentHelper(identity)) != FALSE)
+        printf("Using resident helper\n");
+    
+    else {
+        /* load the serial helper program */
+        LoadPhase("ROM upload");
+        if (ploadbuf(serial_helper_array, serial_helper_size, port, DOWNLOAD_RUN_BINARY) != 0)
+            return Error("helper load failed");
+
+        /* wait for the serial helper to complete initialization */
+        if (!WaitForInitialAck())
+            return Error("failed to connect to helper");
+    }
 
-	/* wait for the serial helper to complete initialization */
-    if (!WaitForInitialAck())
-		return Error("failed to connect to helper");
+    /* the rest of the load doesn't depend on the ROM loader baud rate */
+    if (config->loadBaudrate > BAUD_RATE) {
+        LoadPhase("baud rate");
+        if (!RaiseBaudRate(config->loadBaudrate))
+            return Error("lost the helper while changing the baud rate");
+    }
     
-    /* load the cache driver */
-    if (config->cacheDriver) {
-        VMUVALUE params[3];
-        if (!ReadCogImage(sys, config->cacheDriver, cacheDriverImage, &imageSize))
-            return Error("reading cache driver image failed: %s", config->cacheDriver);
-		printf("Loading cache driver\n");
-        params[0] = config->cacheSize;
-        params[1] = config->cacheParam1;
-        params[2] = config->cacheParam2;
+    if (!resident) {
+    
+        /* load the cache driver */
+        if (config->cacheDriver) {
+            LoadPhase("cache driver");
+            printf("Loading cache driver\n");
+            if (!SendPacket(TYPE_HUB_WRITE, (uint8_t *)"", 0)
+            ||  !WriteBuffer(cacheDriverImage, imageSize)
+            ||  !SendPacket(TYPE_CACHE_INIT, (uint8_t *)params, sizeof(params)))
+                return Error("Loading cache driver failed");
+        }
+        
+        /* load the vm and record what is loaded for the next load */
+        LoadPhase("VM");
+        printf("Loading VM\n");
         if (!SendPacket(TYPE_HUB_WRITE, (uint8_t *)"", 0)
-        ||  !WriteBuffer(cacheDriverImage, imageSize)
-        ||  !SendPacket(TYPE_CACHE_INIT, (uint8_t *)params, sizeof(params)))
-            return Error("Loading cache driver failed");
+        ||  !WriteBuffer(vmImage, vmSize)
+        ||  !SendPacket(TYPE_VM_INIT, (uint8_t *)&keepVM, sizeof(keepVM))
+        ||  !SendPacket(TYPE_IDENTITY, (uint8_t *)&identity, sizeof(identity)))
+            return Error("Loading VM failed");
     }
     
-    /* load the vm */
-	printf("Loading VM\n");
-    if (!SendPacket(TYPE_HUB_WRITE, (uint8_t *)"", 0)
-    ||  !WriteBuffer(xbasic_vm_array, xbasic_vm_size)
-    ||  !SendPacket(TYPE_VM_INIT, (uint8_t *)"", 0))
-        return Error("Loading VM failed");
-    
     /* write the image to memory */
+    LoadPhase("image");
 	printf("Loading image\n");
 	if (!WriteFileToMemory(path)) {
 		fprintf(stderr, "error: image load failed\n");
 		return FALSE;
 	}
+    LoadPhase(NULL);
 	
 	/* return successfully */
 	return TRUE;
 }
 
 int WriteHubLoaderToEEPROM(System *sys, BoardConfig *config, char *port, char *path)
+{
+    if (!PatchHubLoader(config, path))
+        return FALSE;
+        
+	/* load the loader program to eeprom */
+    if (ploadbuf(hub_loader_array, hub_loader_size, port, DOWNLOAD_EEPROM) != 0)
+		return Error("loader load failed");
+	
+	/* return successfully */
+	return TRUE;
+}
+
+int WriteFlashLoaderToEEPROM(System *sys, BoardConfig *config, char *port)
+{
+    if (!PatchFlashLoader(sys, config))
+        return FALSE;
+        
+	/* load the loader program to eeprom */
+    if (ploadbuf(flash_loader_array, flash_loader_size, port, DOWNLOAD_EEPROM) != 0)
+		return Error("loader load failed");
+	
+	/* return successfully */
+	return TRUE;
+}
+
+int WriteLoaderFile(System *sys, BoardConfig *config, char *path, char *outfile, int eeprom)
+{
+    uint8_t *binary, *buf;
+    SpinHdr *hdr;
+    int size, fileSize;
+    FILE *fp;
+    
+    /* patch the loader for the board (the flash loader runs the program already in flash) */
+    if (config->cacheDriver) {
+        if (!PatchFlashLoader(sys, config))
+            return FALSE;
+        binary = flash_loader_array;
+        size = flash_loader_size;
+    }
+    else {
+        if (!PatchHubLoader(config, path))
+            return FALSE;
+        binary = hub_loader_array;
+        size = hub_loader_size;
+    }
+    
+    /* an eeprom file is all of hub memory the way the ROM loader leaves it after loading the binary */
+    fileSize = eeprom ? EEPROM_SIZE : size;
+    if (!(buf = (uint8_t *)calloc(fileSize, 1)))
+        return Error("insufficient memory");
+    memcpy(buf, binary, size);
+    if (eeprom) {
+        hdr = (SpinHdr *)buf;
+        if (hdr->stkstart < 8 || hdr->stkstart > EEPROM_SIZE) {
+            free(buf);
+            return Error("bad loader binary");
+        }
+        SetLong(buf + hdr->stkstart - 8, SPIN_STACK_MARKER);
+        SetLong(buf + hdr->stkstart - 4, SPIN_STACK_MARKER);
+    }
+    
+    /* write the file */
+    if (!(fp = fopen(outfile, "wb"))) {
+        free(buf);
+        return Error("can't create %s", outfile);
+    }
+    if (fwrite(buf, 1, fileSize, fp) != (size_t)fileSize) {
+        fclose(fp);
+        free(buf);
+        return Error("can't write %s", outfile);
+    }
+    fclose(fp);
+    free(buf);
+    
+	/* return successfully */
+	return TRUE;
+}
+
+/* PatchHubLoader - patch the hub loader for a board and copy in the VM and the program image */
+static int PatchHubLoader(BoardConfig *config, char *path)
 {
 	SpinHdr *hdr = (SpinHdr *)hub_loader_array;
     SpinObj *obj = (SpinObj *)(hub_loader_array + hdr->objstart);
     HubLoaderDatHdr *dat = (HubLoaderDatHdr *)((uint8_t *)obj + (obj->pubcnt + obj->objcnt) * sizeof(uint32_t));
-    int chksum, i;
     uint32_t size;
     FILE *fp;
 	
@@ -178,8 +399,8 @@ int WriteHubLoaderToEEPROM(System *sys, BoardConfig *config, char *port, char *p
 	dat->rxpin = config->rxpin;
 	dat->txpin = config->txpin;
     
-    /* copy the vm image to the binary file */
-    memcpy((uint8_t *)dat + dat->vm_code_off, xbasic_vm_array, xbasic_vm_size);
+    /* copy the hub vm image to the binary file */
+    memcpy((uint8_t *)dat + dat->vm_code_off, xbasic_vm_hub_array, xbasic_vm_hub_size);
     
     /* open the image file */
     if ((fp = fopen(path, "rb")) == NULL)
@@ -191,37 +412,34 @@ int WriteHubLoaderToEEPROM(System *sys, BoardConfig *config, char *port, char *p
     fseek(fp, 0, SEEK_SET);
     
     /* make sure the image will fit */
-    if (size > dat->max_image_size)
+    if (size > dat->max_image_size) {
+        fclose(fp);
         return Error("image too large");
+    }
         
     /* read the image into the binary file */
-    if (fread((uint8_t *)dat + dat->image_off, 1, size, fp) != size)
+    if (fread((uint8_t *)dat + dat->image_off, 1, size, fp) != size) {
+        fclose(fp);
         return Error("can't read image file");
+    }
         
     /* close the input file */
     fclose(fp);
 
-    /* recompute the checksum */
-    hdr->chksum = 0;
-    for (chksum = i = 0; i < hub_loader_size; ++i)
-        chksum += hub_loader_array[i];
-    hdr->chksum = SPIN_TARGET_CHECKSUM - chksum;
+    FixChecksum(hub_loader_array, hub_loader_size);
     
-	/* load the loader program to eeprom */
-    if (ploadbuf(hub_loader_array, hub_loader_size, port, DOWNLOAD_EEPROM) != 0)
-		return Error("loader load failed");
-	
 	/* return successfully */
 	return TRUE;
 }
 
-int WriteFlashLoaderToEEPROM(System *sys, BoardConfig *config, char *port)
+/* PatchFlashLoader - patch the flash loader for a board and copy in the VM and the cache driver */
+static int PatchFlashLoader(System *sys, BoardConfig *config)
 {
 	SpinHdr *hdr = (SpinHdr *)flash_loader_array;
     SpinObj *obj = (SpinObj *)(flash_loader_array + hdr->objstart);
     FlashLoaderDatHdr *dat = (FlashLoaderDatHdr *)((uint8_t *)obj + (obj->pubcnt + obj->objcnt) * sizeof(uint32_t));
     uint8_t cacheDriverImage[COG_IMAGE_MAX];
-    int imageSize, chksum, i;
+    int imageSize;
 	
     if (!ReadCogImage(sys, config->cacheDriver, cacheDriverImage, &imageSize))
         return Error("reading cache driver image failed: %s", config->cacheDriver);
@@ -239,27 +457,549 @@ int WriteFlashLoaderToEEPROM(System *sys, BoardConfig *config, char *port)
     /* copy the cache driver image to the binary file */
     memcpy((uint8_t *)dat + dat->cache_code_off, cacheDriverImage, imageSize);
     
-    /* get the cache size */
+    /* get the cache size and geometry */
     dat->cache_size = config->cacheSize;
+    dat->cache_param1 = config->cacheParam1;
+    dat->cache_param2 = config->cacheParam2;
     
-    /* recompute the checksum */
-    hdr->chksum = 0;
-    for (chksum = i = 0; i < flash_loader_size; ++i)
-        chksum += flash_loader_array[i];
-    hdr->chksum = SPIN_TARGET_CHECKSUM - chksum;
+    FixChecksum(flash_loader_array, flash_loader_size);
     
-	/* load the loader program to eeprom */
-    if (ploadbuf(flash_loader_array, flash_loader_size, port, DOWNLOAD_EEPROM) != 0)
-		return Error("loader load failed");
-	
 	/* return successfully */
 	return TRUE;
 }
 
+/* FixChecksum - recompute the checksum in the header of a patched binary */
+static void FixChecksum(uint8_t *binary, int size)
+{
+    SpinHdr *hdr = (SpinHdr *)binary;
+    int chksum, i;
+    hdr->chksum = 0;
+    for (chksum = i = 0; i < size; ++i)
+        chksum += binary[i];
+    hdr->chksum = SPIN_TARGET_CHECKSUM - chksum;
+}
+
 int RunLoadedProgram(int flags)
 {
     VMUVALUE arg = (VMUVALUE)flags;
-	return SendPacket(TYPE_RUN, (uint8_t *)&arg, sizeof(VMUVALUE));
+	if (!SendPacket(TYPE_RUN, (uint8_t *)&arg, sizeof(VMUVALUE)))
+        return FALSE;
+
+    /* the helper is gone so go back to the default rate */
+    if (linkBaudrate != BAUD_RATE) {
+        serial_baud(BAUD_RATE);
+        linkBaudrate = BAUD_RATE;
+    }
+
+    return TRUE;
+}
+
+/* ConnectToResidentHelper - connect to the helper left running after a program halted */
+int ConnectToResidentHelper(void)
+{
+    uint32_t identity;
+    return HelloResidentHelper(&identity) && identity != 0;
+}
+
+/* ReadTargetMemory - read a range of VM memory a packet at a time */
+int ReadTargetMemory(uint32_t address, uint8_t *buf, int count)
+{
+    uint8_t reply[PKTMAXLEN];
+    VMUVALUE params[2];
+    int type, n;
+    
+    while (count > 0) {
+    
+        /* the helper moves whole longs */
+        n = count < PKTMAXLEN ? (count + 3) & ~3 : PKTMAXLEN;
+        params[0] = address;
+        params[1] = n;
+        if (!SendPacket(TYPE_MEM_READ, (uint8_t *)params, sizeof(params))
+        ||  ReceivePacket(&type, reply, sizeof(reply), MEM_TIMEOUT) != n
+        ||  type != TYPE_MEM_READ)
+            return Error("memory read failed at %08x", address);
+            
+        /* copy the part of the block that was asked for */
+        if (n > count)
+            n = count;
+        memcpy(buf, reply, n);
+        address += n;
+        buf += n;
+        count -= n;
+    }
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* WriteTargetMemory - write a range of VM memory a packet at a time (count must be a multiple of 4) */
+int WriteTargetMemory(uint32_t address, uint8_t *buf, int count)
+{
+    int room = PKTMAXLEN - (int)sizeof(VMUVALUE), n;
+    uint8_t packet[PKTMAXLEN];
+    VMUVALUE vmAddress;
+    
+    while (count > 0) {
+        n = count < room ? count : room;
+        vmAddress = address;
+        memcpy(packet, &vmAddress, sizeof(vmAddress));
+        memcpy(&packet[sizeof(vmAddress)], buf, n);
+        if (!QueuePacket(TYPE_MEM_WRITE, packet, sizeof(vmAddress) + n))
+            return Error("memory write failed at %08x", address);
+        address += n;
+        buf += n;
+        count -= n;
+    }
+    
+    /* wait for the last of the writes to be acknowledged */
+    if (!FlushPackets())
+        return Error("memory write failed");
+        
+    /* return successfully */
+    return TRUE;
+}
+
+/* SetBreakpoint - have the helper stop the next run at the instruction at an address */
+int SetBreakpoint(uint32_t address)
+{
+    uint8_t reply[PKTMAXLEN];
+    VMUVALUE arg = address;
+    int type;
+    
+    if (!SendPacket(TYPE_BREAK_SET, (uint8_t *)&arg, sizeof(arg))
+    ||  ReceivePacket(&type, reply, sizeof(reply), MEM_TIMEOUT) != sizeof(VMUVALUE)
+    ||  type != TYPE_BREAK_SET)
+        return Error("setting a breakpoint failed at %08x", address);
+        
+    /* the helper can't patch flash and only has room for a few breakpoints */
+    if (!GetLong(reply))
+        return Error("can't set a breakpoint at %08x (code in flash or too many breakpoints)", address);
+        
+    /* return successfully */
+    return TRUE;
+}
+
+/* ClearBreakpoint - clear the breakpoint at an address or all of them with BREAK_ALL */
+int ClearBreakpoint(uint32_t address)
+{
+    VMUVALUE arg = address;
+    if (!SendPacket(TYPE_BREAK_CLEAR, (uint8_t *)&arg, sizeof(arg)))
+        return Error("clearing a breakpoint failed at %08x", address);
+    return TRUE;
+}
+
+/* ProfileNextRun - have the helper sample the next run of a loaded image into buckets covering its code */
+int ProfileNextRun(BoardConfig *config, char *path)
+{
+    ImageFileHdr *hdr;
+    VMUVALUE params[4], start, end, j;
+    uint8_t buf[PKTMAXLEN];
+    int cnt, shift;
+    FILE *fp;
+    
+    /* only the cache mailbox shows where the VM waits */
+    if (!config->cacheDriver)
+        return Error("profiling needs a board with a cache driver");
+    
+    /* find the section holding the main code */
+    if (!(fp = fopen(path, "rb")))
+        return Error("can't open image: %s", path);
+    cnt = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    hdr = (ImageFileHdr *)buf;
+    if (cnt < (int)sizeof(ImageFileHdr)
+    ||  sizeof(ImageFileHdr) + (hdr->sectionCount - 1) * sizeof(ImageFileSection) > (size_t)cnt)
+        return Error("bad file header: %s", path);
+    for (j = 0; j < hdr->sectionCount; ++j) {
+        start = hdr->sections[j].base;
+        end = start + hdr->sections[j].size;
+        if (hdr->mainCode >= start && hdr->mainCode < end)
+            break;
+    }
+    if (j >= hdr->sectionCount)
+        return Error("no code section: %s", path);
+    
+    /* use the smallest buckets that cover the section */
+    for (shift = PROFILE_MIN_SHIFT; ((end - start + (1 << shift) - 1) >> shift) > PROFILE_MAX_BUCKETS; ++shift)
+        ;
+    params[0] = start;
+    params[1] = shift;
+    params[2] = (end - start + (1 << shift) - 1) >> shift;
+    params[3] = PROFILE_PERIOD;
+    if (!SendPacket(TYPE_PROFILE_INIT, (uint8_t *)params, sizeof(params)))
+        return Error("SendPacket PROFILE_INIT failed");
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* ReadTargetProfile - read the profile of the last run from the helper left running after it halted */
+int ReadTargetProfile(TargetProfile *profile)
+{
+    uint8_t reply[PKTMAXLEN];
+    uint32_t offset, size;
+    VMUVALUE params[2];
+    int type, n, i;
+    
+    /* read the header */
+    params[0] = 0;
+    params[1] = PROFILE_HDR_LONGS * 4;
+    if (!SendPacket(TYPE_PROFILE_READ, (uint8_t *)params, sizeof(params))
+    ||  ReceivePacket(&type, reply, sizeof(reply), MEM_TIMEOUT) != PROFILE_HDR_LONGS * 4
+    ||  type != TYPE_PROFILE_READ)
+        return Error("no profile was taken (the program must be loaded with profiling)");
+    profile->samples = GetLong(&reply[0]);
+    profile->running = GetLong(&reply[4]);
+    profile->stalled = GetLong(&reply[8]);
+    profile->runtime = GetLong(&reply[12]);
+    profile->outside = GetLong(&reply[16]);
+    profile->base = GetLong(&reply[20]);
+    profile->shift = GetLong(&reply[24]);
+    profile->count = GetLong(&reply[28]);
+    if (profile->count > PROFILE_MAX_BUCKETS)
+        return Error("bad profile header");
+    
+    /* read the buckets a packet at a time */
+    if (!(profile->buckets = (uint32_t *)malloc((profile->count + 1) * sizeof(uint32_t))))
+        return Error("insufficient memory");
+    size = profile->count * 4;
+    for (offset = 0; offset < size; offset += n) {
+        params[0] = PROFILE_HDR_LONGS * 4 + offset;
+        params[1] = size - offset < PKTMAXLEN ? size - offset : PKTMAXLEN;
+        if (!SendPacket(TYPE_PROFILE_READ, (uint8_t *)params, sizeof(params))
+        ||  (n = ReceivePacket(&type, reply, sizeof(reply), MEM_TIMEOUT)) != (int)params[1]
+        ||  type != TYPE_PROFILE_READ) {
+            free(profile->buckets);
+            return Error("profile read failed at %u", (unsigned int)offset);
+        }
+        for (i = 0; i < n; i += 4)
+            profile->buckets[(offset + i) / 4] = GetLong(&reply[i]);
+    }
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* CountNextRun - have the helper count what the runtime and the cache driver do in the next run */
+int CountNextRun(void)
+{
+    if (!SendPacket(TYPE_COUNTERS_INIT, (uint8_t *)"", 0))
+        return Error("SendPacket COUNTERS_INIT failed");
+    return TRUE;
+}
+
+/* ReadTargetCounters - read the counters of the last run from the helper left running after it halted
+   and clear them when clear is set */
+int ReadTargetCounters(TargetCounters *counters, int clear)
+{
+    uint32_t offset, size, chunk = PKTMAXLEN / (COUNTERS_LINE_LONGS * 4) * (COUNTERS_LINE_LONGS * 4);
+    uint8_t reply[PKTMAXLEN];
+    TargetLineCounts *line;
+    VMUVALUE params[3];
+    int type, n, i;
+    
+    /* read the header (the counts are only cleared by the last read) */
+    params[0] = 0;
+    params[1] = COUNTERS_HDR_LONGS * 4;
+    params[2] = FALSE;
+    if (!SendPacket(TYPE_COUNTERS_READ, (uint8_t *)params, sizeof(params))
+    ||  ReceivePacket(&type, reply, sizeof(reply), MEM_TIMEOUT) != COUNTERS_HDR_LONGS * 4
+    ||  type != TYPE_COUNTERS_READ)
+        return Error("no counters were kept (the program must be loaded with counters)");
+    counters->wait = GetLong(&reply[0]);
+    counters->runtime = GetLong(&reply[4]);
+    counters->stack = GetLong(&reply[8]);
+    counters->lines = GetLong(&reply[12]);
+    counters->shift = GetLong(&reply[16]);
+    if (counters->lines > COUNTERS_MAX_LINES)
+        return Error("bad counters header");
+    
+    /* read whole lines a packet at a time (even without any so the last read can clear the counts) */
+    if (!(counters->counts = (TargetLineCounts *)malloc((counters->lines + 1) * sizeof(TargetLineCounts))))
+        return Error("insufficient memory");
+    size = counters->lines * COUNTERS_LINE_LONGS * 4;
+    offset = 0;
+    do {
+        params[0] = COUNTERS_HDR_LONGS * 4 + offset;
+        params[1] = size - offset < chunk ? size - offset : chunk;
+        params[2] = clear && offset + params[1] >= size;
+        if (!SendPacket(TYPE_COUNTERS_READ, (uint8_t *)params, sizeof(params))
+        ||  (n = ReceivePacket(&type, reply, sizeof(reply), MEM_TIMEOUT)) != (int)params[1]
+        ||  type != TYPE_COUNTERS_READ) {
+            free(counters->counts);
+            return Error("counters read failed at %u", (unsigned int)offset);
+        }
+        for (i = 0; i < n; i += COUNTERS_LINE_LONGS * 4) {
+            line = &counters->counts[(offset + i) / (COUNTERS_LINE_LONGS * 4)];
+            line->requests = GetLong(&reply[i]);
+            line->misses = GetLong(&reply[i + 4]);
+            line->writeBacks = GetLong(&reply[i + 8]);
+        }
+        offset += n;
+    } while (offset < size);
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* UpdateFlash - write the flash blocks whose contents differ from the image */
+static int UpdateFlash(FILE *fp, uint8_t *buf, int cnt, int size)
+{
+    int blockCount = (size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    int changed, first, count, type, offset, end, sent, n, i;
+    uint8_t reply[PKTMAXLEN], *image, *dirty;
+    uint32_t sum, sumOfSums;
+    VMUVALUE params[3];
+
+    /* read the rest of the image */
+    if (!(image = (uint8_t *)malloc(size + blockCount))) {
+        fclose(fp);
+        return Error("insufficient memory");
+    }
+    dirty = image + size;
+    memcpy(image, buf, cnt);
+    n = (int)fread(image + cnt, 1, size - cnt, fp);
+    fclose(fp);
+    if (n != size - cnt) {
+        free(image);
+        return Error("can't read image file");
+    }
+
+    /* compare the image with the hashes of the blocks in flash */
+    for (first = changed = 0; first < blockCount; first += count) {
+        if ((count = blockCount - first) > HASH_BATCH)
+            count = HASH_BATCH;
+        params[0] = first;
+        params[1] = count;
+        params[2] = size;
+        if (!SendPacket(TYPE_FLASH_HASH, (uint8_t *)params, sizeof(params))
+        ||  ReceivePacket(&type, reply, sizeof(reply), HASH_TIMEOUT(count)) != count * 8
+        ||  type != TYPE_FLASH_HASH) {
+            free(image);
+            return Error("getting the flash block hashes failed");
+        }
+        for (i = 0; i < count; ++i) {
+            offset = (first + i) * FLASH_BLOCK_SIZE;
+            HashBlock(image + offset, size - offset < FLASH_BLOCK_SIZE ? size - offset : FLASH_BLOCK_SIZE, &sum, &sumOfSums);
+            dirty[first + i] = sum != GetLong(&reply[i * 8]) || sumOfSums != GetLong(&reply[i * 8 + 4]);
+            changed += dirty[first + i];
+        }
+    }
+    printf("%d of %d flash blocks changed\n", changed, blockCount);
+
+    /* erase and write each changed block */
+    if (!SendPacket(TYPE_FLASH_UPDATE, (uint8_t *)"", 0)) {
+        free(image);
+        return Error("SendPacket FLASH_UPDATE failed");
+    }
+    for (i = sent = 0; i < blockCount; ++i) {
+        if (!dirty[i])
+            continue;
+        params[0] = offset = i * FLASH_BLOCK_SIZE;
+        if ((end = offset + FLASH_BLOCK_SIZE) > size)
+            end = size;
+        printf("%d bytes remaining             \r", size - offset); fflush(stdout);
+        if (!QueuePacket(TYPE_FLASH_SEEK, (uint8_t *)params, sizeof(VMUVALUE))) {
+            free(image);
+            return Error("QueuePacket FLASH_SEEK failed");
+        }
+        for (; offset < end; offset += n) {
+            if ((n = end - offset) > PKTMAXLEN)
+                n = PKTMAXLEN;
+            if (!CheckLink() || !QueueData(image + offset, n)) {
+                free(image);
+                return Error("QueuePacket DATA failed\n");
+            }
+            sent += n;
+        }
+    }
+    printf("%d bytes sent             \n", sent);
+    free(image);
+
+    if (!SendPacket(TYPE_EOF, (uint8_t *)"", 0))
+        return Error("SendPacket EOF failed");
+
+    return TRUE;
+}
+
+/* HashBlock - sum the longs and then any trailing bytes of a block along with the running sums */
+static void HashBlock(uint8_t *p, int len, uint32_t *pSum, uint32_t *pSumOfSums)
+{
+    uint32_t sum = 0, sumOfSums = 0;
+    for (; len >= 4; p += 4, len -= 4) {
+        sum += GetLong(p);
+        sumOfSums += sum;
+    }
+    for (; len > 0; --len) {
+        sum += *p++;
+        sumOfSums += sum;
+    }
+    *pSum = sum;
+    *pSumOfSums = sumOfSums;
+}
+
+/* GetLong - get a little endian long the way the Propeller stores it */
+static uint32_t GetLong(uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void SetLong(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+/* QueueData - queue a block of data compressing it when the helper can decode it */
+static int QueueData(uint8_t *buf, int cnt)
+{
+    uint8_t zbuf[PKTMAXLEN];
+    int zcnt;
+    if ((GetHelperFeatures() & FEATURE_DATA_Z) && (zcnt = CompressBlock(buf, cnt, zbuf)) > 0)
+        return QueuePacket(TYPE_DATA_Z, zbuf, zcnt);
+    return QueuePacket(TYPE_DATA, buf, cnt);
+}
+
+/* CompressBlock - compress a block returning its compressed size or -1 if it doesn't get smaller */
+static int CompressBlock(uint8_t *src, int size, uint8_t *dst)
+{
+    int16_t last[Z_HASH_SIZE];
+    int i, literal, out, run, copy, offset, limit, n;
+
+    for (i = 0; i < Z_HASH_SIZE; ++i)
+        last[i] = -1;
+
+    for (i = literal = out = 0; i < size; ) {
+
+        /* look for a run of the same byte */
+        for (run = 1; i + run < size && run < Z_COPY_MAX && src[i + run] == src[i]; ++run)
+            ;
+
+        /* look for an earlier copy of the bytes that doesn't overlap them */
+        copy = 0;
+        if (i + Z_COPY_MIN <= size) {
+            int h = Z_HASH(&src[i]), j = last[h];
+            last[h] = (int16_t)i;
+            if (j >= 0) {
+                if ((limit = i - j) > Z_COPY_MAX)
+                    limit = Z_COPY_MAX;
+                if (limit > size - i)
+                    limit = size - i;
+                for (n = 0; n < limit && src[j + n] == src[i + n]; ++n)
+                    ;
+                if (n >= Z_COPY_MIN) {
+                    copy = n;
+                    offset = i - j;
+                }
+            }
+        }
+
+        /* add the byte to the pending literals if neither is long enough */
+        if (run < Z_COPY_MIN && copy == 0) {
+            ++literal;
+            ++i;
+            if (literal < Z_LITERAL_MAX && i < size)
+                continue;
+        }
+
+        /* write the pending literals */
+        if (literal > 0) {
+            if (out + 1 + literal >= size)
+                return -1;
+            dst[out++] = (uint8_t)(literal - 1);
+            memcpy(&dst[out], &src[i - literal], literal);
+            out += literal;
+            literal = 0;
+        }
+
+        /* write the run or the copy */
+        if (run >= Z_COPY_MIN && run >= copy) {
+            if (out + 2 >= size)
+                return -1;
+            dst[out++] = (uint8_t)(0x80 | (run - Z_COPY_MIN));
+            dst[out++] = src[i];
+            i += run;
+        }
+        else if (copy > 0) {
+            if (out + 3 >= size)
+                return -1;
+            dst[out++] = (uint8_t)(0xc0 | (copy - Z_COPY_MIN));
+            dst[out++] = (uint8_t)(offset >> 8);
+            dst[out++] = (uint8_t)offset;
+            i += copy;
+        }
+    }
+
+    /* return the compressed size */
+    return out;
+}
+
+/* RaiseBaudRate - move the link to the fastest rate up to a maximum that works */
+static int RaiseBaudRate(uint32_t maxBaudrate)
+{
+    int i;
+    for (i = 0; linkRates[i] > linkBaudrate; ++i)
+        if (linkRates[i] <= maxBaudrate) {
+            if (!ChangeBaudRate(linkRates[i]))
+                return FALSE;
+            if (linkBaudrate == linkRates[i])
+                break;
+        }
+    return TRUE;
+}
+
+/* CheckLink - drop to the next slower rate when too many frames have to be resent */
+static int CheckLink(void)
+{
+    int sent, resent, i;
+
+    /* make sure there are enough frames to judge the link */
+    GetPacketCounts(&sent, &resent);
+    if (linkBaudrate <= BAUD_RATE || sent < LINK_CHECK_FRAMES || resent <= LINK_MAX_RESENDS(sent))
+        return TRUE;
+
+    /* find the next slower rate */
+    for (i = 0; linkRates[i] >= linkBaudrate; ++i)
+        ;
+
+    /* switch once every frame in flight is acknowledged */
+    printf("Too many errors at %u baud\n", (unsigned int)linkBaudrate);
+    return FlushPackets() && ChangeBaudRate(linkRates[i]);
+}
+
+/* ChangeBaudRate - move the link to the helper to a new rate or stay at the old one */
+static int ChangeBaudRate(uint32_t baudrate)
+{
+    VMUVALUE arg = (VMUVALUE)baudrate;
+
+    /* the helper restarts its packet driver at the new rate after the ACK */
+    if (!SendPacket(TYPE_BAUD, (uint8_t *)&arg, sizeof(arg)))
+        return FALSE;
+
+    /* the helper keeps the new rate only if it is confirmed at that rate */
+    if (serial_baud(baudrate)
+    &&  WaitForRestart(NEW_RATE_TIMEOUT)
+    &&  SendPacket(TYPE_BAUD, (uint8_t *)&arg, sizeof(arg))) {
+        printf("Loading at %u baud\n", (unsigned int)baudrate);
+        linkBaudrate = baudrate;
+        return TRUE;
+    }
+
+    /* otherwise it goes back to the old rate */
+    serial_baud(linkBaudrate);
+    if (WaitForRestart(OLD_RATE_TIMEOUT))
+        return TRUE;
+
+    /* unless the confirmation got through and only its ACK was lost */
+    if (serial_baud(baudrate) && WaitForRestart(NEW_RATE_TIMEOUT)) {
+        linkBaudrate = baudrate;
+        return TRUE;
+    }
+
+    /* the helper can't be found at either rate */
+    return FALSE;
 }
 
 static int ReadCogImage(System *sys, char *name, uint8_t *buf, int *pSize)
@@ -272,9 +1012,84 @@ static int ReadCogImage(System *sys, char *name, uint8_t *buf, int *pSize)
     return *pSize > 0;
 }
 
+/* VMImage - get the VM for a board (boards without a cache driver get the hub memory VM) */
+static uint8_t *VMImage(BoardConfig *config, int *pSize)
+{
+    if (config->cacheDriver) {
+        *pSize = xbasic_vm_size;
+        return xbasic_vm_array;
+    }
+    *pSize = xbasic_vm_hub_size;
+    return xbasic_vm_hub_array;
+}
+
+/* HelperIdentity - hash the patched helper, the cache driver and its parameters and the VM */
+static uint32_t HelperIdentity(uint8_t *cacheDriverImage, int imageSize, VMUVALUE *params, int paramsSize, uint8_t *vmImage, int vmSize, VMUVALUE keepVM)
+{
+    uint32_t hash = 2166136261u;
+    hash = AddToHash(hash, serial_helper_array, serial_helper_size);
+    hash = AddToHash(hash, cacheDriverImage, imageSize);
+    hash = AddToHash(hash, params, paramsSize);
+    hash = AddToHash(hash, vmImage, vmSize);
+    hash = AddToHash(hash, &keepVM, sizeof(keepVM));
+    return hash != 0 ? hash : 1; /* a freshly started helper reports zero */
+}
+
+/* ImageStartsCogs - check whether an image uses COGSTART (a bad image is reported when it is written) */
+static int ImageStartsCogs(char *path)
+{
+    ImageFileHdr hdr;
+    int cnt;
+    FILE *fp;
+    if ((fp = fopen(path, "rb")) == NULL)
+        return FALSE;
+    cnt = fread(&hdr, 1, sizeof(hdr), fp);
+    fclose(fp);
+    return cnt == sizeof(hdr) && (hdr.flags & IMAGE_COGS) != 0;
+}
+
+/* AddToHash - add a block of bytes to an FNV-1a hash */
+static uint32_t AddToHash(uint32_t hash, void *data, int size)
+{
+    uint8_t *p = (uint8_t *)data;
+    while (--size >= 0) {
+        hash ^= *p++;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/* FindResidentHelper - ask a helper left running after a program halted what it has loaded */
+static int FindResidentHelper(uint32_t identity)
+{
+    uint32_t residentIdentity;
+    return HelloResidentHelper(&residentIdentity) && residentIdentity == identity;
+}
+
+/* HelloResidentHelper - probe for a resident helper of this version and get its identity */
+static int HelloResidentHelper(uint32_t *pIdentity)
+{
+    uint8_t reply[PKTMAXLEN];
+    int type;
+    
+    /* the helper restarts its packet driver without an initial ACK so probe for it */
+    if (!WaitForRestart(HELLO_TIMEOUT)
+    ||  !SendPacket(TYPE_HELLO, (uint8_t *)"", 0)
+    ||  ReceivePacket(&type, reply, sizeof(reply), HELLO_TIMEOUT) < 12
+    ||  type != TYPE_HELLO
+    ||  GetLong(reply) != HELPER_VERSION)
+        return FALSE;
+        
+    /* the reply restates the window and features that came with the initial ACK */
+    *pIdentity = GetLong(&reply[4]);
+    SetHelperWindow((int)GetLong(&reply[8]));
+    return TRUE;
+}
+
 static FILE *OpenAndProbeFile(char *path, char *buf, int *pSize, int *pCnt, int *pType)
 {
     ImageFileHdr *hdr = (ImageFileHdr *)buf;
+    VMUVALUE end, j;
     FILE *fp;
 
     if ((fp = fopen(path, "rb")) == NULL)
@@ -313,6 +1128,22 @@ static FILE *OpenAndProbeFile(char *path, char *buf, int *pSize, int *pCnt, int
         return NULL;
     }
 
+    /* only send the section data (the symbol table and debug section that follow stay on the host) */
+    if (sizeof(ImageFileHdr) + (hdr->sectionCount - 1) * sizeof(ImageFileSection) > (size_t)*pCnt) {
+        Error("bad file header: %s", path);
+        return NULL;
+    }
+    for (end = 0, j = 0; j < hdr->sectionCount; ++j)
+        if (hdr->sections[j].offset + hdr->sections[j].size > end)
+            end = hdr->sections[j].offset + hdr->sections[j].size;
+    if (end > (VMUVALUE)*pSize) {
+        Error("truncated image file: %s", path);
+        return NULL;
+    }
+    *pSize = end;
+    if (*pCnt > *pSize)
+        *pCnt = *pSize;
+
     return fp;
 }
 
@@ -325,6 +1156,10 @@ static int WriteFileToMemory(char *path)
     if ((fp = OpenAndProbeFile(path, (char *)buf, &size, &cnt, &type)) == NULL)
         return FALSE;
 
+    /* only write the flash blocks that changed when the helper can hash them */
+    if (type == TYPE_FLASH_WRITE && (GetHelperFeatures() & FEATURE_FLASH_HASH))
+        return UpdateFlash(fp, buf, cnt, size);
+
     if (!SendPacket(type, (uint8_t *)"", 0))
         return Error("SendPacket %s failed", PacketTypeName(type));
 
@@ -337,10 +1172,10 @@ static int WriteFile(FILE *fp, uint8_t *buf, int cnt, int size)
 
     while (cnt > 0) {
         printf("%d bytes remaining             \r", remaining); fflush(stdout);
-        if (!SendPacket(TYPE_DATA, buf, cnt))
-            return Error("SendPacket DATA failed\n");
+        if (!CheckLink() || !QueueData(buf, cnt))
+            return Error("QueuePacket DATA failed\n");
         remaining -= cnt;
-        cnt = fread(buf, 1, PKTMAXLEN, fp);
+        cnt = fread(buf, 1, remaining < PKTMAXLEN ? remaining : PKTMAXLEN, fp);
     }
     printf("%d bytes sent             \n", size);
 
@@ -360,8 +1195,8 @@ static int WriteBuffer(uint8_t *buf, int size)
         if ((cnt = remaining) > PKTMAXLEN)
             cnt = PKTMAXLEN;
         printf("%d bytes remaining             \r", remaining); fflush(stdout);
-        if (!SendPacket(TYPE_DATA, buf, cnt))
-            return Error("SendPacket DATA failed\n");
+        if (!CheckLink() || !QueueData(buf, cnt))
+            return Error("QueuePacket DATA failed\n");
     }
     printf("%d bytes sent             \n", size);
 
@@ -371,6 +1206,13 @@ static int WriteBuffer(uint8_t *buf, int size)
     return TRUE;
 }
 
+/* LoadPhase - report the start of a load phase */
+static void LoadPhase(const char *phase)
+{
+    if (loadPhase)
+        (*loadPhase)(loadPhaseCookie, phase);
+}
+
 static char *PacketTypeName(int type)
 {
     char *typeName = "<unknown>";
@@ -383,6 +1225,17 @@ static char *PacketTypeName(int type)
     case TYPE_DATA:         typeName = "DATA";          break;
     case TYPE_EOF:          typeName = "EOF";           break;
     case TYPE_RUN:          typeName = "RUN";           break;
+    case TYPE_BAUD:         typeName = "BAUD";          break;
+    case TYPE_HELLO:        typeName = "HELLO";         break;
+    case TYPE_IDENTITY:     typeName = "IDENTITY";      break;
+    case TYPE_MEM_READ:     typeName = "MEM_READ";      break;
+    case TYPE_MEM_WRITE:    typeName = "MEM_WRITE";     break;
+    case TYPE_PROFILE_INIT: typeName = "PROFILE_INIT";  break;
+    case TYPE_PROFILE_READ: typeName = "PROFILE_READ";  break;
+    case TYPE_BREAK_SET:    typeName = "BREAK_SET";     break;
+    case TYPE_BREAK_CLEAR:  typeName = "BREAK_CLEAR";   break;
+    case TYPE_COUNTERS_INIT: typeName = "COUNTERS_INIT"; break;
+    case TYPE_COUNTERS_READ: typeName = "COUNTERS_READ"; break;
     }
     return typeName;
 }
@@ -7,10 +7,58 @@
 #define RUN_STEP    (1 << 0)
 #define RUN_PAUSE   (1 << 1)
 
+/* address that clears every breakpoint */
+#define BREAK_ALL   0xffffffff
+
+/* profile of the last run taken by the profiler cog */
+typedef struct {
+    uint32_t samples;   /* samples taken */
+    uint32_t running;   /* samples with the VM running from its cache lines */
+    uint32_t stalled;   /* samples with the VM waiting for a line of the code section */
+    uint32_t runtime;   /* samples with the runtime handling a trap */
+    uint32_t outside;   /* samples with the VM waiting for a line outside the code section */
+    uint32_t base;      /* address of the first bucket */
+    uint32_t shift;     /* log2 of the bytes in a bucket */
+    uint32_t count;     /* number of buckets */
+    uint32_t *buckets;  /* stalled samples for each bucket (free when done) */
+} TargetProfile;
+
+/* counts of a cache line */
+typedef struct {
+    uint32_t requests;      /* line requests */
+    uint32_t misses;        /* requests that read the line from external memory */
+    uint32_t writeBacks;    /* misses that wrote the line back first */
+} TargetLineCounts;
+
+/* counters of the last run kept by the runtime and the counters cog */
+typedef struct {
+    uint32_t wait;      /* clocks the cache driver took to answer line requests */
+    uint32_t runtime;   /* requests the runtime handled */
+    uint32_t stack;     /* most bytes of the main stack used */
+    uint32_t lines;     /* number of lines (zero without a cache) */
+    uint32_t shift;     /* log2 of the bytes in a line */
+    TargetLineCounts *counts;   /* counts of each line (free when done) */
+} TargetCounters;
+
+/* function called as each phase of a load starts (phase is NULL once the load is done) */
+typedef void LoadPhaseFcn(void *cookie, const char *phase);
+
+void SetLoadPhaseFcn(LoadPhaseFcn *fcn, void *cookie);
 int InitPort(char *port);
+void ClosePort(void);
 int LoadImage(System *sys, BoardConfig *config, char *port, char *path);
 int WriteHubLoaderToEEPROM(System *sys, BoardConfig *config, char *port, char *path);
 int WriteFlashLoaderToEEPROM(System *sys, BoardConfig *config, char *port);
+int WriteLoaderFile(System *sys, BoardConfig *config, char *path, char *outfile, int eeprom);
 int RunLoadedProgram(int flags);
+int ConnectToResidentHelper(void);
+int ReadTargetMemory(uint32_t address, uint8_t *buf, int count);
+int WriteTargetMemory(uint32_t address, uint8_t *buf, int count);
+int ProfileNextRun(BoardConfig *config, char *path);
+int ReadTargetProfile(TargetProfile *profile);
+int CountNextRun(void);
+int ReadTargetCounters(TargetCounters *counters, int clear);
+int SetBreakpoint(uint32_t address);
+int ClearBreakpoint(uint32_t address);
 
 #endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "db_packet.h"
+#include "db_system.h"
 #include "osint.h"
 
 #ifndef TRUE
@@ -12,6 +13,13 @@
 /* timeouts for waiting for ACK/NAK */
 #define INITIAL_TIMEOUT     10000   // 10 seconds
 #define PACKET_TIMEOUT      1000    // 1 second
+#define PROBE_TIMEOUT       100     // 100 milliseconds
+
+/* largest number of frames in flight (must divide 256) */
+#define WINDOW_MAX          8
+
+/* number of times to resend the frames in flight without making progress */
+#define MAX_RETRIES         5
 
 /* packet format: SOH pkt# type length-lo length-hi hdrchk length*data crc1 crc2 */
 #define HDR_SOH     0
@@ -34,6 +42,16 @@
 #define NAK     0x15    /* negative acknowledgement */
 #define ESC     0x1b    /* escape from terminal mode */
 
+/* keys that ask the runtime for the counters in terminal mode and what is sent for them
+   (see vm_runtime.spin) */
+#define CTRL_R          0x12    /* show and clear the counters */
+#define CTRL_T          0x14    /* show the counters */
+#define COUNTERS_ESC    0x1c
+
+/* terminal mode transfer size and the longest wait for input */
+#define TERMINAL_BUFSIZE    4096
+#define TERMINAL_WAIT       1000    // 1 second
+
 #define updcrc(crc, ch) (crctab[((crc) >> 8) & 0xff] ^ ((crc) << 8) ^ (ch))
 
 static const uint16_t crctab[256] = {
@@ -71,20 +89,117 @@ static const uint16_t crctab[256] = {
     0x6e17,  0x7e36,  0x4e55,  0x5e74,  0x2e93,  0x3eb2,  0x0ed1,  0x1ef0
 };
 
-static uint8_t snd_pktn = 0;
+/* a frame that hasn't been acknowledged yet */
+typedef struct {
+    uint8_t data[FRAMELEN];
+    int length;
+} Frame;
+
+/* frames in flight indexed by packet number */
+static Frame frames[WINDOW_MAX];
+
+static uint8_t snd_pktn = 0;    /* packet number of the last frame sent */
+static uint8_t ack_pktn = 0;    /* packet number of the last frame acknowledged */
+static int window = 1;          /* number of frames the helper can buffer */
+static int features = 0;        /* features the helper advertised with the window */
+static int outstanding = 0;     /* number of frames in flight */
+static int retries = 0;         /* resends since the last progress */
+static int sent = 0;            /* frames sent since the helper started */
+static int resent = 0;          /* frames resent since the helper started */
 
+static int WaitForWindow(int timeout);
+static int WaitForReply(void);
+static int AcknowledgeFrames(int pktn);
+static int ResendFrames(void);
+static int ReceiveBytes(uint8_t *buf, int len, int timeout);
 static int WaitForAckNak(int timeout);
+static void CaptureBytes(FILE *fp, uint8_t *buf, int cnt, int flags, unsigned long start, int *pLineStart);
+static void SendKeys(uint8_t *buf, int cnt, int flags);
 
+/* WaitForInitialAck - wait for the helper to start */
 int WaitForInitialAck(void)
 {
-    return WaitForAckNak(INITIAL_TIMEOUT) == ACK;
+    return WaitForWindow(INITIAL_TIMEOUT);
+}
+
+/* WaitForRestart - wait for the helper to restart its packet driver after a baud rate change */
+int WaitForRestart(int timeout)
+{
+    /* an empty frame numbered before the first one is answered with ACK 0 */
+    static uint8_t probe[PKTHDRLEN + PKTCRCLEN] = { SOH, 0, 0, 0, 0, 0, 0, 0 };
+    int elapsed;
+
+    /* the initial ACK may have been sent before the port was switched so keep probing */
+    for (elapsed = 0; elapsed < timeout; elapsed += PROBE_TIMEOUT) {
+        tx(probe, sizeof(probe));
+        if (WaitForAckNak(PROBE_TIMEOUT) == ACK && WaitForAckNak(PACKET_TIMEOUT) >= 0) {
+            snd_pktn = ack_pktn = 0;
+            outstanding = retries = 0;
+            sent = resent = 0;
+            return TRUE;
+        }
+    }
+
+    /* no answer */
+    return FALSE;
+}
+
+/* GetHelperFeatures - get the features the helper advertised */
+int GetHelperFeatures(void)
+{
+    return features;
+}
+
+/* SetHelperWindow - set the features and window size from a byte like the one after the initial ACK */
+void SetHelperWindow(int size)
+{
+    features = size >> 4;
+    size &= 0x0f;
+    window = size < 1 ? 1 : size > WINDOW_MAX ? WINDOW_MAX : size;
+}
+
+/* GetPacketCounts - get the number of frames sent and resent since the helper started */
+void GetPacketCounts(int *pSent, int *pResent)
+{
+    *pSent = sent;
+    *pResent = resent;
 }
 
+/* WaitForWindow - wait for the initial ACK followed by the helper features and window size */
+static int WaitForWindow(int timeout)
+{
+    int size;
+    if (WaitForAckNak(timeout) != ACK || (size = WaitForAckNak(PACKET_TIMEOUT)) < 0)
+        return FALSE;
+    SetHelperWindow(size);
+    snd_pktn = ack_pktn = 0;
+    outstanding = retries = 0;
+    sent = resent = 0;
+    return TRUE;
+}
+
+/* SendPacket - send a packet and wait for it and every packet before it to be acknowledged */
 int SendPacket(int type, uint8_t *buf, int len)
 {
-    uint8_t hdr[PKTHDRLEN], crc[PKTCRCLEN], *p;
+    return QueuePacket(type, buf, len) && FlushPackets();
+}
+
+/* QueuePacket - send a packet without waiting for it to be acknowledged */
+int QueuePacket(int type, uint8_t *buf, int len)
+{
+    uint8_t *hdr, *crc, *p;
     uint16_t crc16 = 0;
-    int cnt, ch;
+    Frame *frame;
+    int cnt;
+
+    /* wait for room in the window */
+    while (outstanding >= window)
+        if (!WaitForReply())
+            return FALSE;
+
+    /* keep a copy of the frame until it is acknowledged */
+    frame = &frames[(uint8_t)(snd_pktn + 1) % WINDOW_MAX];
+    hdr = frame->data;
 
     /* setup the frame header */
     hdr[HDR_SOH] = SOH;                                 /* SOH */
@@ -100,44 +215,115 @@ int SendPacket(int type, uint8_t *buf, int len)
     crc16 = updcrc(crc16, '\0');
     crc16 = updcrc(crc16, '\0');
 
-    /* add the crc to the frame */
+    /* add the data and the crc to the frame */
+    memcpy(&hdr[PKTHDRLEN], buf, len);
+    crc = &hdr[PKTHDRLEN + len];
     crc[0] = (uint8_t)(crc16 >> 8);
     crc[1] = (uint8_t)crc16;
+    frame->length = PKTHDRLEN + len + PKTCRCLEN;
 
     /* send the packet */
-    tx(hdr, PKTHDRLEN);
-    if (len > 0)
-        tx(buf, len);
-    tx(crc, PKTCRCLEN);
-
-    /* wait for an ACK/NAK */
-    if ((ch = WaitForAckNak(PACKET_TIMEOUT)) < 0) {
-        printf("Timeout waiting for ACK/NAK\n");
-        ch = NAK;
+    tx(frame->data, frame->length);
+    ++outstanding;
+    ++sent;
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* FlushPackets - wait for every packet sent to be acknowledged */
+int FlushPackets(void)
+{
+    while (outstanding > 0)
+        if (!WaitForReply())
+            return FALSE;
+    return TRUE;
+}
+
+/* WaitForReply - wait for an ACK/NAK and resend frames when the helper missed one */
+static int WaitForReply(void)
+{
+    int ch, pktn;
+
+    /* every reply is an ACK or NAK followed by a packet number */
+    if ((ch = WaitForAckNak(PACKET_TIMEOUT)) < 0 || (pktn = WaitForAckNak(PACKET_TIMEOUT)) < 0) {
+        if (!ResendFrames()) {
+            printf("Timeout waiting for ACK/NAK\n");
+            return FALSE;
+        }
+        return TRUE;
     }
 
-    /* return status */
-    return ch == ACK;
+    /* ACK pkt# acknowledges every frame up to pkt# */
+    if (ch == ACK)
+        AcknowledgeFrames(pktn);
+
+    /* NAK pkt# acknowledges the frames before pkt# and asks for the rest again */
+    else if (ch == NAK) {
+        if (AcknowledgeFrames(pktn - 1) && !ResendFrames()) {
+            printf("Too many NAKs\n");
+            return FALSE;
+        }
+    }
+
+    /* return successfully */
+    return TRUE;
 }
 
-int ReceivePacket(int *pType, uint8_t *buf, int len)
+/* AcknowledgeFrames - retire the frames in flight up to a packet number */
+static int AcknowledgeFrames(int pktn)
 {
-    uint8_t hdr[PKTHDRLEN], crc[PKTCRCLEN];
-    int actual_len, chk;
-    uint16_t crc16 = 0;
+    int count = (uint8_t)(pktn - ack_pktn);
 
-    /* look for start of packet */
-    do {
-        rx(&hdr[HDR_SOH], 1);
-    } while (hdr[HDR_SOH] != SOH);
+    /* ignore replies to frames that were already acknowledged */
+    if (count > outstanding)
+        return FALSE;
 
-    /* receive the rest of the header */
-    rx(&hdr[HDR_PKTN], PKTHDRLEN - 1);
+    /* any frame getting through is progress */
+    if (count > 0) {
+        ack_pktn = (uint8_t)pktn;
+        outstanding -= count;
+        retries = 0;
+    }
 
-    /* check the header checksum */
-    chk = (hdr[1] + hdr[2] + hdr[3] + hdr[4]) & 0xff;
-    if (hdr[HDR_CHK] != chk)
-        return -1;
+    /* return successfully */
+    return TRUE;
+}
+
+/* ResendFrames - resend every frame in flight */
+static int ResendFrames(void)
+{
+    int i;
+    if (++retries > MAX_RETRIES)
+        return FALSE;
+    for (i = 1; i <= outstanding; ++i) {
+        Frame *frame = &frames[(uint8_t)(ack_pktn + i) % WINDOW_MAX];
+        tx(frame->data, frame->length);
+        ++resent;
+    }
+    return TRUE;
+}
+
+/* ReceivePacket - receive a packet from the helper returning the length of its payload or -1 */
+int ReceivePacket(int *pType, uint8_t *buf, int len, int timeout)
+{
+    uint8_t hdr[PKTHDRLEN], crc[PKTCRCLEN];
+    int actual_len, chk, have, i;
+    uint16_t crc16 = 0;
+
+    /* look for a valid header (an ACK/NAK packet number can look like SOH) */
+    for (have = 0; ; have = PKTHDRLEN - i) {
+        if (ReceiveBytes(&hdr[have], PKTHDRLEN - have, timeout) != PKTHDRLEN - have)
+            return -1;
+        if (hdr[HDR_SOH] == SOH) {
+            chk = (hdr[1] + hdr[2] + hdr[3] + hdr[4]) & 0xff;
+            if (hdr[HDR_CHK] == chk)
+                break;
+        }
+        for (i = 1; i < PKTHDRLEN && hdr[i] != SOH; ++i)
+            ;
+        memmove(hdr, &hdr[i], PKTHDRLEN - i);
+    }
 
     /* make sure the buffer is big enough for the payload */
     actual_len = hdr[HDR_LEN_HI] << 8 | hdr[HDR_LEN_LO];
@@ -145,14 +331,16 @@ int ReceivePacket(int *pType, uint8_t *buf, int len)
         return -1;
     
     /* receive the packet payload */
-    rx(buf, actual_len);
+    if (ReceiveBytes(buf, actual_len, timeout) != actual_len)
+        return -1;
 
     /* compute the crc */
     for (len = actual_len; --len >= 0; )
         crc16 = updcrc(crc16, *buf++);
 
     /* receive the crc */
-    rx(crc, PKTCRCLEN);
+    if (ReceiveBytes(crc, PKTCRCLEN, timeout) != PKTCRCLEN)
+        return -1;
 
     /* check the crc */
     crc16 = updcrc(crc16, crc[0]);
@@ -165,23 +353,134 @@ int ReceivePacket(int *pType, uint8_t *buf, int len)
     return actual_len;
 }
 
+/* ReceiveBytes - receive a number of bytes returning how many arrived before a timeout */
+static int ReceiveBytes(uint8_t *buf, int len, int timeout)
+{
+    int count, n;
+    for (count = 0; count < len; count += n)
+        if ((n = rx_timeout(&buf[count], len - count, timeout)) <= 0)
+            break;
+    return count;
+}
+
 static int WaitForAckNak(int timeout)
 {
     uint8_t buf[1];
     return rx_timeout(buf, 1, timeout) == 1 ? buf[0] : -1;
 }
 
-void TerminalMode(void)
+/* TerminalMode - pass data between the console and the target until ESC is typed
+ *
+ * Both sides are waited on at once and moved in large blocks so a target that streams
+ * quickly isn't overrun.  Everything the target sends is also written to the capture
+ * file if one is given, each line preceded by the time since terminal mode started
+ * when TERMINAL_TIMESTAMPS is set.  With TERMINAL_COUNTERS the runtime shows the
+ * counters of a program loaded with them when Ctrl-T is typed and clears them too
+ * for Ctrl-R.
+ */
+void TerminalMode(char *capture, int flags)
 {
+    uint8_t buf[TERMINAL_BUFSIZE];
+    int mask = WAIT_SERIAL | WAIT_CONSOLE;
+    int lineStart = TRUE, ready, cnt, i;
+    unsigned long start;
+    FILE *fp = NULL;
+    
+    /* open the capture file */
+    if (capture && !(fp = fopen(capture, (flags & TERMINAL_TIMESTAMPS) ? "w" : "wb"))) {
+        printf("error: can't create capture file: %s\n", capture);
+        return;
+    }
+    
     printf("Entering terminal mode. Exit with ESC.\n");
+    if (flags & TERMINAL_COUNTERS)
+        printf("Ctrl-T shows the counters and Ctrl-R shows and clears them.\n");
+    fflush(stdout);
+    console_raw(TRUE);
+    start = xbGetMicroseconds();
+    
     for (;;) {
-        uint8_t buf[1];
-        if (rx_timeout(buf, 1, 0) != SERIAL_TIMEOUT)
-            console_putch(buf[0]);
-        else if (console_kbhit()) {
-            if ((buf[0] = console_getch()) == ESC)
+        ready = serial_console_wait(mask, TERMINAL_WAIT);
+        
+        /* show and capture everything the target has sent */
+        if (ready & WAIT_SERIAL) {
+            if ((cnt = rx_timeout(buf, sizeof(buf), 0)) == SERIAL_TIMEOUT) {
+                printf("\nSerial port closed\n");
                 break;
-            tx(buf, 1);
+            }
+            fwrite(buf, 1, cnt, stdout);
+            fflush(stdout);
+            if (fp)
+                CaptureBytes(fp, buf, cnt, flags, start, &lineStart);
+        }
+        
+        /* send the keys typed up to an ESC (keep capturing if the console is closed) */
+        if (ready & WAIT_CONSOLE) {
+            if ((cnt = console_read(buf, sizeof(buf))) < 0)
+                mask &= ~WAIT_CONSOLE;
+            else {
+                for (i = 0; i < cnt && buf[i] != ESC; ++i)
+                    ;
+                if (i > 0)
+                    SendKeys(buf, i, flags);
+                if (i < cnt)
+                    break;
+            }
+        }
+    }
+    
+    console_raw(FALSE);
+    if (fp)
+        fclose(fp);
+}
+
+/* SendKeys - send keys typed in terminal mode replacing the counters keys with their requests */
+static void SendKeys(uint8_t *buf, int cnt, int flags)
+{
+    uint8_t request[2];
+    int start, i;
+    
+    /* without counters every key goes to the program */
+    if (!(flags & TERMINAL_COUNTERS)) {
+        tx(buf, cnt);
+        return;
+    }
+    
+    for (start = i = 0; i < cnt; ++i) {
+        if (buf[i] == CTRL_T || buf[i] == CTRL_R) {
+            if (i > start)
+                tx(&buf[start], i - start);
+            request[0] = COUNTERS_ESC;
+            request[1] = buf[i] == CTRL_R ? 'z' : 'r';
+            tx(request, sizeof(request));
+            start = i + 1;
+        }
+    }
+    if (i > start)
+        tx(&buf[start], i - start);
+}
+
+/* CaptureBytes - write bytes received in terminal mode to the capture file */
+static void CaptureBytes(FILE *fp, uint8_t *buf, int cnt, int flags, unsigned long start, int *pLineStart)
+{
+    unsigned long ms;
+    int i;
+    
+    /* raw captures are written as they are */
+    if (!(flags & TERMINAL_TIMESTAMPS)) {
+        fwrite(buf, 1, cnt, fp);
+        return;
+    }
+    
+    /* start each line with the seconds since terminal mode started */
+    for (i = 0; i < cnt; ++i) {
+        if (*pLineStart) {
+            ms = (xbGetMicroseconds() - start) / 1000;
+            fprintf(fp, "[%6lu.%03lu] ", ms / 1000, ms % 1000);
+            *pLineStart = FALSE;
         }
+        putc(buf[i], fp);
+        if (buf[i] == '\n')
+            *pLineStart = TRUE;
     }
 }
@@ -5,9 +5,19 @@
 
 #define PKTMAXLEN   1024
 
+/* terminal mode flags */
+#define TERMINAL_TIMESTAMPS (1 << 0)
+#define TERMINAL_COUNTERS   (1 << 1)
+
 int WaitForInitialAck(void);
+int WaitForRestart(int timeout);
+int GetHelperFeatures(void);
+void SetHelperWindow(int size);
+void GetPacketCounts(int *pSent, int *pResent);
 int SendPacket(int type, uint8_t *buf, int len);
-int ReceivePacket(int *pType, uint8_t *buf, int len);
-void TerminalMode(void);
+int QueuePacket(int type, uint8_t *buf, int len);
+int FlushPackets(void);
+int ReceivePacket(int *pType, uint8_t *buf, int len, int timeout);
+void TerminalMode(char *capture, int flags);
 
 #endif
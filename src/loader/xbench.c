@@ -0,0 +1,1417 @@
+/* xbench.c - measure the loader against a simulated target on a pseudo-terminal
+ *
+ * The simulated target sits on the master side of a pseudo-terminal and acts
+ * like the Propeller ROM loader, the packet driver and the serial helper, so
+ * db_loader.c and db_packet.c run unchanged on the slave side.  The link
+ * between them moves bytes at the current baud rate and can add latency, limit
+ * the bandwidth and damage bytes.  The target keeps what is written to its
+ * memory so every load is checked against the image.
+ *
+ */
+
+/* for posix_openpt and cfmakeraw */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include "db_loader.h"
+#include "db_packet.h"
+#include "PLoadLib.h"
+#include "osint.h"
+
+/* defaults */
+#define DEF_BOARD           "hub"
+#define DEF_IMAGE_SIZE      (16 * 1024)
+
+/* most load phases and loads measured */
+#define MAXPHASES           16
+#define MAXLOADS            100
+
+/* packet header and crc lengths */
+#define PKTHDRLEN           6
+#define PKTCRCLEN           2
+
+/* protocol characters */
+#define SOH                 0x01
+#define ACK                 0x06
+#define NAK                 0x15
+
+/* packet types (see serial_helper.spin) */
+#define TYPE_VM_INIT        1
+#define TYPE_CACHE_INIT     2
+#define TYPE_FLASH_WRITE    3
+#define TYPE_RAM_WRITE      4
+#define TYPE_HUB_WRITE      5
+#define TYPE_DATA           6
+#define TYPE_EOF            7
+#define TYPE_RUN            8
+#define TYPE_BAUD           9
+#define TYPE_DATA_Z         10
+#define TYPE_FLASH_HASH     11
+#define TYPE_FLASH_UPDATE   12
+#define TYPE_FLASH_SEEK     13
+#define TYPE_HELLO          14
+#define TYPE_IDENTITY       15
+#define TYPE_MEM_READ       16
+#define TYPE_MEM_WRITE      17
+
+/* what the helper reports and advertises */
+#define HELPER_VERSION      3
+#define HELPER_FEATURES     0x30    /* DATA_Z and FLASH_HASH in the high nibble of the window */
+#define HELPER_SLOTS        4
+
+/* the ROM loader runs at a fixed rate and checks the download for this sum */
+#define ROM_BAUD_RATE       115200
+#define ROM_LFSR_BITS       250
+#define ROM_VERSION         1
+#define ROM_CHECKSUM        0x14
+#define ROM_IMAGE_MAX       (32 * 1024)
+
+/* target timing in microseconds */
+#define ROM_CHECK_TIME      95000   /* ROM loader checking the download */
+#define HELPER_START_TIME   20000   /* helper starting its packet driver */
+#define BAUD_SWITCH_TIME    50000   /* helper waiting for the PC to switch rates */
+#define BAUD_CONFIRM_TIME   2000000 /* helper waiting for the new rate to be confirmed */
+
+/* target memory */
+#define HUB_MEMORY_SIZE     (32 * 1024)
+#define RAM_MEMORY_SIZE     (1024 * 1024)
+#define FLASH_MEMORY_SIZE   (1024 * 1024)
+#define FLASH_BLOCK_SIZE    4096
+
+/* bytes in flight in each direction and the longest the target sleeps in microseconds */
+#define QUEUE_SIZE          (1 << 18)
+#define TARGET_WAIT         10000
+
+/* target states */
+enum {
+    ROM_IDLE,               /* waiting for the ROM loader sync (after a reset or while a program runs) */
+    ROM_ID,                 /* clocking out the LFSR bits and the version */
+    ROM_DOWNLOAD,           /* receiving the encoded download */
+    ROM_CHECK,              /* checking the download */
+    HELPER_START,           /* starting the helper */
+    HELPER                  /* running the helper */
+};
+
+/* packet receive states */
+enum {
+    RCV_HDR,
+    RCV_DATA
+};
+
+/* helper write modes */
+enum {
+    WRITE_NONE,
+    WRITE_FLASH,
+    WRITE_RAM,
+    WRITE_HUB,
+    WRITE_FLASH_BLOCKS
+};
+
+/* link and target counts */
+typedef struct {
+    unsigned long toTarget;     /* bytes delivered to the target */
+    unsigned long fromTarget;   /* bytes delivered to the PC */
+    unsigned long data;         /* bytes written to target memory */
+    unsigned long frames;       /* frames accepted by the target */
+    unsigned long resent;       /* frames received again or out of order */
+    unsigned long damaged;      /* frames with a bad header or crc */
+    unsigned long errors;       /* bytes damaged by the link */
+} LinkCounts;
+
+/* bytes moving in one direction across the link */
+typedef struct {
+    uint8_t data[QUEUE_SIZE];
+    double due[QUEUE_SIZE];     /* time each byte arrives */
+    int head;
+    int count;
+    double lineFree;            /* time the last byte finishes being sent */
+} ByteQueue;
+
+/* the simulated link and target */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int stop;
+    int master;                 /* master side of the pseudo-terminal */
+    int slave;                  /* kept open so the PC's port settings can be seen */
+
+    /* link */
+    double latency;             /* microseconds added in each direction */
+    double rateLimit;           /* bytes per second in each direction or zero */
+    double errorRate;           /* probability of a byte being damaged */
+    uint32_t maxBaudrate;       /* fastest rate the link works at or zero */
+    uint32_t random;
+    ByteQueue toTarget;
+    ByteQueue toHost;
+    LinkCounts counts;
+
+    /* target */
+    int state;
+    int resident;               /* programs halt and leave the helper running */
+    uint32_t baudrate;
+    double timer;               /* time of the next state change or zero */
+
+    /* ROM loader */
+    int syncCount;              /* LFSR bytes matched after a calibration byte or -1 */
+    uint8_t syncLFSR;
+    uint8_t lfsr;
+    int bitCount;
+    uint32_t romLong;
+    int romBits;
+    int romLongs;
+    uint32_t romType;
+    uint32_t romCount;
+    uint8_t romImage[ROM_IMAGE_MAX];
+
+    /* packet driver */
+    int rcvState;
+    uint8_t hdr[PKTHDRLEN];
+    int hdrCount;
+    uint8_t packet[PKTMAXLEN + PKTCRCLEN];
+    int packetLength;
+    int packetCount;
+    uint8_t expected;
+    uint8_t acked;
+    int nakSent;
+
+    /* helper */
+    uint32_t linkBaudrate;
+    uint32_t newBaudrate;
+    int baudPending;
+    int writeMode;
+    uint32_t loadAddress;
+    uint32_t identity;
+    int vmStarted;
+    uint8_t hub[HUB_MEMORY_SIZE];
+    uint8_t *ram;
+    uint8_t *flash;
+} Target;
+
+/* timing of a load phase */
+typedef struct {
+    const char *name;
+    unsigned long start;
+    LinkCounts counts;
+} Phase;
+
+/* the phases of a load */
+typedef struct {
+    Target *target;
+    Phase phases[MAXPHASES];
+    int count;
+} LoadTiming;
+
+/* totals of the loads */
+typedef struct {
+    const char *name;
+    unsigned long time;
+    LinkCounts counts;
+} PhaseTotal;
+
+static char *SwitchValue(int argc, char *argv[], int *pIndex);
+static int OpenTarget(Target *target, char **pName);
+static void CloseTarget(Target *target);
+static void *TargetThread(void *data);
+static void ReceiveFromHost(Target *target, uint8_t *buf, int cnt, double now);
+static void DeliverToTarget(Target *target, double now);
+static int DeliverToHost(Target *target, double now);
+static int LinkWorks(Target *target);
+static uint8_t DamageByte(Target *target, uint8_t byte);
+static void QueueByte(Target *target, ByteQueue *queue, uint8_t byte, double now);
+static double ByteTime(Target *target);
+static void SendBytes(Target *target, uint8_t *buf, int cnt);
+static void TargetTimer(Target *target);
+static void TargetByte(Target *target, uint8_t byte);
+static void ROMByte(Target *target, uint8_t byte);
+static int NextLFSRBit(uint8_t *pLFSR);
+static void StartDriver(Target *target, uint32_t baudrate, int quiet);
+static void PacketByte(Target *target, uint8_t byte);
+static void FrameReceived(Target *target);
+static void SendReply(Target *target, int ch, int pktn);
+static void SendPacketToHost(Target *target, int type, uint8_t *buf, int len);
+static void HandlePacket(Target *target, int type, uint8_t *buf, int len);
+static void WriteData(Target *target, uint8_t *buf, int len);
+static int DecodeBlock(uint8_t *src, int len, uint8_t *dst);
+static void HashFlash(Target *target, uint32_t offset, int len, uint8_t *p);
+static uint8_t *TargetMemory(Target *target, uint32_t address, uint32_t *pSize);
+static uint32_t GetLong(uint8_t *p);
+static void PutLong(uint8_t *p, uint32_t value);
+static uint32_t Random(Target *target);
+static int MakeImage(char *path, uint32_t base, int size);
+static int CheckImage(Target *target, char *path);
+static void PhaseStarted(void *cookie, const char *phase);
+static void ShowLoad(LoadTiming *timing, PhaseTotal *totals, int *pTotalCount);
+static void ShowCounts(const char *name, unsigned long time, LinkCounts *counts);
+static void SubtractCounts(LinkCounts *result, LinkCounts *end, LinkCounts *start);
+static void AddCounts(LinkCounts *total, LinkCounts *counts);
+static void Usage(void);
+static void ConstructFileName(const char *infile, char *outfile, char *ext);
+
+static void MyInfo(System *sys, const char *fmt, va_list ap);
+static void MyError(System *sys, const char *fmt, va_list ap);
+static SystemOps myOps = {
+    MyInfo,
+    MyError
+};
+
+static const uint16_t crctab[256] = {
+    0x0000,  0x1021,  0x2042,  0x3063,  0x4084,  0x50a5,  0x60c6,  0x70e7,
+    0x8108,  0x9129,  0xa14a,  0xb16b,  0xc18c,  0xd1ad,  0xe1ce,  0xf1ef,
+    0x1231,  0x0210,  0x3273,  0x2252,  0x52b5,  0x4294,  0x72f7,  0x62d6,
+    0x9339,  0x8318,  0xb37b,  0xa35a,  0xd3bd,  0xc39c,  0xf3ff,  0xe3de,
+    0x2462,  0x3443,  0x0420,  0x1401,  0x64e6,  0x74c7,  0x44a4,  0x5485,
+    0xa56a,  0xb54b,  0x8528,  0x9509,  0xe5ee,  0xf5cf,  0xc5ac,  0xd58d,
+    0x3653,  0x2672,  0x1611,  0x0630,  0x76d7,  0x66f6,  0x5695,  0x46b4,
+    0xb75b,  0xa77a,  0x9719,  0x8738,  0xf7df,  0xe7fe,  0xd79d,  0xc7bc,
+    0x48c4,  0x58e5,  0x6886,  0x78a7,  0x0840,  0x1861,  0x2802,  0x3823,
+    0xc9cc,  0xd9ed,  0xe98e,  0xf9af,  0x8948,  0x9969,  0xa90a,  0xb92b,
+    0x5af5,  0x4ad4,  0x7ab7,  0x6a96,  0x1a71,  0x0a50,  0x3a33,  0x2a12,
+    0xdbfd,  0xcbdc,  0xfbbf,  0xeb9e,  0x9b79,  0x8b58,  0xbb3b,  0xab1a,
+    0x6ca6,  0x7c87,  0x4ce4,  0x5cc5,  0x2c22,  0x3c03,  0x0c60,  0x1c41,
+    0xedae,  0xfd8f,  0xcdec,  0xddcd,  0xad2a,  0xbd0b,  0x8d68,  0x9d49,
+    0x7e97,  0x6eb6,  0x5ed5,  0x4ef4,  0x3e13,  0x2e32,  0x1e51,  0x0e70,
+    0xff9f,  0xefbe,  0xdfdd,  0xcffc,  0xbf1b,  0xaf3a,  0x9f59,  0x8f78,
+    0x9188,  0x81a9,  0xb1ca,  0xa1eb,  0xd10c,  0xc12d,  0xf14e,  0xe16f,
+    0x1080,  0x00a1,  0x30c2,  0x20e3,  0x5004,  0x4025,  0x7046,  0x6067,
+    0x83b9,  0x9398,  0xa3fb,  0xb3da,  0xc33d,  0xd31c,  0xe37f,  0xf35e,
+    0x02b1,  0x1290,  0x22f3,  0x32d2,  0x4235,  0x5214,  0x6277,  0x7256,
+    0xb5ea,  0xa5cb,  0x95a8,  0x8589,  0xf56e,  0xe54f,  0xd52c,  0xc50d,
+    0x34e2,  0x24c3,  0x14a0,  0x0481,  0x7466,  0x6447,  0x5424,  0x4405,
+    0xa7db,  0xb7fa,  0x8799,  0x97b8,  0xe75f,  0xf77e,  0xc71d,  0xd73c,
+    0x26d3,  0x36f2,  0x0691,  0x16b0,  0x6657,  0x7676,  0x4615,  0x5634,
+    0xd94c,  0xc96d,  0xf90e,  0xe92f,  0x99c8,  0x89e9,  0xb98a,  0xa9ab,
+    0x5844,  0x4865,  0x7806,  0x6827,  0x18c0,  0x08e1,  0x3882,  0x28a3,
+    0xcb7d,  0xdb5c,  0xeb3f,  0xfb1e,  0x8bf9,  0x9bd8,  0xabbb,  0xbb9a,
+    0x4a75,  0x5a54,  0x6a37,  0x7a16,  0x0af1,  0x1ad0,  0x2ab3,  0x3a92,
+    0xfd2e,  0xed0f,  0xdd6c,  0xcd4d,  0xbdaa,  0xad8b,  0x9de8,  0x8dc9,
+    0x7c26,  0x6c07,  0x5c64,  0x4c45,  0x3ca2,  0x2c83,  0x1ce0,  0x0cc1,
+    0xef1f,  0xff3e,  0xcf5d,  0xdf7c,  0xaf9b,  0xbfba,  0x8fd9,  0x9ff8,
+    0x6e17,  0x7e36,  0x4e55,  0x5e74,  0x2e93,  0x3eb2,  0x0ed1,  0x1ef0
+};
+
+#define updcrc(crc, ch) (crctab[((crc) >> 8) & 0xff] ^ ((crc) << 8) ^ (ch))
+
+int main(int argc, char *argv[])
+{
+    char *infile = NULL, *board = DEF_BOARD, fullName[FILENAME_MAX], *path, *port;
+    int imageSize = DEF_IMAGE_SIZE, loads = 1, totalCount = 0, failed = 0, i;
+    PhaseTotal totals[MAXPHASES];
+    uint32_t loadBaudrate = 0;
+    LoadTiming timing;
+    BoardConfig *config;
+    Section *section;
+    Target *target;
+    System sys;
+
+    /* the target is too big for the stack */
+    if (!(target = (Target *)calloc(1, sizeof(Target)))
+    ||  !(target->ram = (uint8_t *)malloc(RAM_MEMORY_SIZE))
+    ||  !(target->flash = (uint8_t *)malloc(FLASH_MEMORY_SIZE))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return 1;
+    }
+
+    /* get the arguments */
+    for(i = 1; i < argc; ++i) {
+
+        /* handle switches */
+        if(argv[i][0] == '-') {
+            switch(argv[i][1]) {
+            case 'b':   // select a target board
+                board = SwitchValue(argc, argv, &i);
+                break;
+            case 'I':   // add a directory to the search path
+                xbAddToPath(SwitchValue(argc, argv, &i));
+                break;
+            case 'B':   // fastest rate to load at
+                loadBaudrate = (uint32_t)strtoul(SwitchValue(argc, argv, &i), NULL, 0);
+                break;
+            case 'S':   // size of the generated image
+                if ((imageSize = atoi(SwitchValue(argc, argv, &i))) < (int)sizeof(ImageFileHdr) + 4)
+                    Usage();
+                break;
+            case 'n':   // number of loads
+                if ((loads = atoi(SwitchValue(argc, argv, &i))) < 1 || loads > MAXLOADS)
+                    Usage();
+                break;
+            case 'R':   // leave the helper resident after each run
+                target->resident = TRUE;
+                break;
+            case 'l':   // latency in milliseconds
+                target->latency = atof(SwitchValue(argc, argv, &i)) * 1000.0;
+                break;
+            case 'r':   // bandwidth limit in bytes per second
+                target->rateLimit = atof(SwitchValue(argc, argv, &i));
+                break;
+            case 'e':   // chance of a byte being damaged
+                target->errorRate = atof(SwitchValue(argc, argv, &i));
+                break;
+            case 'm':   // fastest rate the link works at
+                target->maxBaudrate = (uint32_t)strtoul(SwitchValue(argc, argv, &i), NULL, 0);
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+
+        /* handle the input filename */
+        else {
+            if (infile)
+                Usage();
+            infile = argv[i];
+        }
+    }
+
+    /* load the board configuration file from the search path */
+    sys.ops = &myOps;
+    xbAddEnvironmentPath();
+    ParseConfigurationFile(&sys, "xbasic.cfg");
+
+    /* setup for the selected board */
+    if (!(config = GetBoardConfig(board)))
+        Usage();
+    if (loadBaudrate)
+        config->loadBaudrate = loadBaudrate;
+
+    /* load the image given or generate one for the board's code section */
+    if (infile) {
+        ConstructFileName(infile, fullName, ".bai");
+        path = fullName;
+    }
+    else {
+        section = config->defaultTextSection ? GetSection(config, config->defaultTextSection) : NULL;
+        strcpy(fullName, "/tmp/xbenchXXXXXX");
+        if (!MakeImage(fullName, section ? section->base : HUB_BASE, imageSize)) {
+            fprintf(stderr, "error: can't create the image\n");
+            return 1;
+        }
+        path = fullName;
+    }
+
+    /* start the target */
+    if (!OpenTarget(target, &port)) {
+        fprintf(stderr, "error: can't start the target\n");
+        return 1;
+    }
+    if (!InitPort(port)) {
+        fprintf(stderr, "error: opening serial port\n");
+        return 1;
+    }
+
+    /* load and run the image recording the start of each phase */
+    timing.target = target;
+    SetLoadPhaseFcn(PhaseStarted, &timing);
+    for (i = 1; i <= loads; ++i) {
+        printf("Load %d of %d\n", i, loads);
+        timing.count = 0;
+        if (!LoadImage(&sys, config, port, path)) {
+            fprintf(stderr, "error: load failed\n");
+            ++failed;
+            break;
+        }
+        PhaseStarted(&timing, "run");
+        if (!RunLoadedProgram(0)) {
+            fprintf(stderr, "error: run failed\n");
+            ++failed;
+            break;
+        }
+        PhaseStarted(&timing, NULL);
+        if (CheckImage(target, path))
+            printf("Target memory matches the image\n");
+        else {
+            fprintf(stderr, "error: the target memory doesn't match the image\n");
+            ++failed;
+        }
+        ShowLoad(&timing, totals, &totalCount);
+    }
+
+    /* show the totals of every load */
+    if (loads > 1 && totalCount > 0) {
+        printf("\nAll loads\n");
+        ShowCounts(NULL, 0, NULL);
+        for (i = 0; i < totalCount; ++i)
+            ShowCounts(totals[i].name, totals[i].time, &totals[i].counts);
+    }
+    printf("%lu link errors injected\n", target->counts.errors);
+
+    /* stop the target */
+    ClosePort();
+    CloseTarget(target);
+    if (!infile)
+        remove(fullName);
+
+    return failed ? 1 : 0;
+}
+
+/* SwitchValue - get the value that follows a switch or is part of it */
+static char *SwitchValue(int argc, char *argv[], int *pIndex)
+{
+    if (argv[*pIndex][2])
+        return &argv[*pIndex][2];
+    if (++*pIndex >= argc)
+        Usage();
+    return argv[*pIndex];
+}
+
+/* OpenTarget - create the pseudo-terminal and start the target on its master side */
+static int OpenTarget(Target *target, char **pName)
+{
+    struct termios sparm;
+
+    /* create the pseudo-terminal */
+    if ((target->master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+    ||  grantpt(target->master) != 0
+    ||  unlockpt(target->master) != 0
+    ||  !(*pName = ptsname(target->master))
+    ||  (target->slave = open(*pName, O_RDWR | O_NOCTTY)) < 0)
+        return FALSE;
+
+    /* the target never waits for the PC to read */
+    fcntl(target->master, F_SETFL, fcntl(target->master, F_GETFL, 0) | O_NONBLOCK);
+    if (tcgetattr(target->slave, &sparm) == 0) {
+        cfmakeraw(&sparm);
+        tcsetattr(target->slave, TCSANOW, &sparm);
+    }
+
+    /* the target starts out reset */
+    memset(target->flash, 0xff, FLASH_MEMORY_SIZE);
+    target->random = 12345;
+    target->syncCount = -1;
+    target->state = ROM_IDLE;
+    target->baudrate = target->linkBaudrate = ROM_BAUD_RATE;
+
+    /* start the target */
+    pthread_mutex_init(&target->lock, NULL);
+    if (pthread_create(&target->thread, NULL, TargetThread, target) != 0)
+        return FALSE;
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* CloseTarget - stop the target */
+static void CloseTarget(Target *target)
+{
+    pthread_mutex_lock(&target->lock);
+    target->stop = TRUE;
+    pthread_mutex_unlock(&target->lock);
+    pthread_join(target->thread, NULL);
+    close(target->slave);
+    close(target->master);
+}
+
+/* TargetThread - move bytes across the link and run the target */
+static void *TargetThread(void *data)
+{
+    Target *target = (Target *)data;
+    uint8_t buf[1024];
+    struct timeval toval;
+    double now, next;
+    int busy, cnt;
+    fd_set set;
+
+    for (;;) {
+        pthread_mutex_lock(&target->lock);
+        if (target->stop) {
+            pthread_mutex_unlock(&target->lock);
+            break;
+        }
+
+        /* run the target on the bytes that have arrived and send what it has to say */
+        now = (double)xbGetMicroseconds();
+        DeliverToTarget(target, now);
+        if (target->timer != 0 && target->timer <= now) {
+            target->timer = 0;
+            TargetTimer(target);
+        }
+        busy = DeliverToHost(target, now);
+
+        /* sleep until the next byte arrives, the timer expires or the PC sends more */
+        next = now + TARGET_WAIT;
+        if (target->toTarget.count > 0 && target->toTarget.due[target->toTarget.head] < next)
+            next = target->toTarget.due[target->toTarget.head];
+        if (target->toHost.count > 0 && target->toHost.due[target->toHost.head] < next)
+            next = target->toHost.due[target->toHost.head];
+        if (busy && now + 1000 < next)
+            next = now + 1000;
+        if (target->timer != 0 && target->timer < next)
+            next = target->timer;
+        pthread_mutex_unlock(&target->lock);
+
+        toval.tv_sec = 0;
+        toval.tv_usec = next > now ? (long)(next - now) : 0;
+        FD_ZERO(&set);
+        if (target->toTarget.count < QUEUE_SIZE - (int)sizeof(buf))
+            FD_SET(target->master, &set);
+        if (select(target->master + 1, &set, NULL, NULL, &toval) > 0 && FD_ISSET(target->master, &set)) {
+            if ((cnt = read(target->master, buf, sizeof(buf))) > 0) {
+                pthread_mutex_lock(&target->lock);
+                ReceiveFromHost(target, buf, cnt, (double)xbGetMicroseconds());
+                pthread_mutex_unlock(&target->lock);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* ReceiveFromHost - start bytes from the PC across the link */
+static void ReceiveFromHost(Target *target, uint8_t *buf, int cnt, double now)
+{
+    while (--cnt >= 0)
+        QueueByte(target, &target->toTarget, *buf++, now);
+}
+
+/* DeliverToTarget - pass the bytes that have crossed the link to the target */
+static void DeliverToTarget(Target *target, double now)
+{
+    ByteQueue *queue = &target->toTarget;
+    uint8_t byte;
+    while (queue->count > 0 && queue->due[queue->head] <= now) {
+        byte = DamageByte(target, queue->data[queue->head]);
+        queue->head = (queue->head + 1) % QUEUE_SIZE;
+        --queue->count;
+        ++target->counts.toTarget;
+        TargetByte(target, byte);
+    }
+}
+
+/* DeliverToHost - write the bytes that have crossed the link to the PC returning true if it is full */
+static int DeliverToHost(Target *target, double now)
+{
+    ByteQueue *queue = &target->toHost;
+    uint8_t buf[1024];
+    int cnt, n, i;
+
+    for (;;) {
+
+        /* collect the bytes that have arrived */
+        for (cnt = 0, i = queue->head; cnt < queue->count && cnt < (int)sizeof(buf) && queue->due[i] <= now; ++cnt) {
+            buf[cnt] = queue->data[i];
+            i = (i + 1) % QUEUE_SIZE;
+        }
+        if (cnt == 0)
+            return FALSE;
+
+        /* drop the ones the PC takes */
+        if ((n = write(target->master, buf, cnt)) <= 0)
+            return TRUE;
+        queue->head = (queue->head + n) % QUEUE_SIZE;
+        queue->count -= n;
+        target->counts.fromTarget += n;
+    }
+}
+
+/* LinkWorks - check that both ends of the link are at the same rate and that it isn't too fast */
+static int LinkWorks(Target *target)
+{
+    static struct { speed_t speed; uint32_t baudrate; } speeds[] = {
+        { B38400,   38400   },
+        { B57600,   57600   },
+        { B115200,  115200  },
+        { B230400,  230400  },
+#ifdef B460800
+        { B460800,  460800  },
+#endif
+#ifdef B921600
+        { B921600,  921600  },
+#endif
+#ifdef B2000000
+        { B2000000, 2000000 },
+#endif
+        { 0,        0       }
+    };
+    struct termios sparm;
+    speed_t speed;
+    int i;
+
+    if (target->maxBaudrate && target->baudrate > target->maxBaudrate)
+        return FALSE;
+    if (tcgetattr(target->slave, &sparm) != 0)
+        return TRUE;
+    speed = cfgetospeed(&sparm);
+    for (i = 0; speeds[i].baudrate != 0; ++i)
+        if (speeds[i].speed == speed)
+            return speeds[i].baudrate == target->baudrate;
+    return FALSE;
+}
+
+/* DamageByte - garble a byte sent at the wrong rate or damage one to or from the helper at random
+ *
+ * The ROM loader has no way to recover from an error so bytes are only damaged while the helper
+ * is running, which is what the packet driver's retransmits are measured against.
+ */
+static uint8_t DamageByte(Target *target, uint8_t byte)
+{
+    if (!LinkWorks(target))
+        return (uint8_t)Random(target);
+    if (target->state == HELPER && target->errorRate > 0 && (double)Random(target) / 4294967296.0 < target->errorRate) {
+        ++target->counts.errors;
+        byte ^= 1 << (Random(target) & 7);
+    }
+    return byte;
+}
+
+/* QueueByte - start a byte across the link */
+static void QueueByte(Target *target, ByteQueue *queue, uint8_t byte, double now)
+{
+    int i;
+    if (queue->count >= QUEUE_SIZE)
+        return;
+    if (queue->lineFree < now)
+        queue->lineFree = now;
+    queue->lineFree += ByteTime(target);
+    i = (queue->head + queue->count++) % QUEUE_SIZE;
+    queue->data[i] = byte;
+    queue->due[i] = queue->lineFree + target->latency;
+}
+
+/* ByteTime - get the microseconds it takes to send a byte */
+static double ByteTime(Target *target)
+{
+    double time = 10000000.0 / target->baudrate;
+    if (target->rateLimit > 0 && 1000000.0 / target->rateLimit > time)
+        time = 1000000.0 / target->rateLimit;
+    return time;
+}
+
+/* SendBytes - send bytes from the target to the PC */
+static void SendBytes(Target *target, uint8_t *buf, int cnt)
+{
+    double now = (double)xbGetMicroseconds();
+    while (--cnt >= 0)
+        QueueByte(target, &target->toHost, DamageByte(target, *buf++), now);
+}
+
+/* TargetTimer - handle the end of a target delay */
+static void TargetTimer(Target *target)
+{
+    switch (target->state) {
+    case ROM_CHECK:
+        /* the ROM loader answers the next poll */
+        break;
+    case HELPER_START:
+        StartDriver(target, ROM_BAUD_RATE, FALSE);
+        target->state = HELPER;
+        break;
+    case HELPER:
+        /* the helper switches rates after a BAUD packet and gives up if it isn't confirmed */
+        if (target->newBaudrate) {
+            StartDriver(target, target->newBaudrate, FALSE);
+            target->newBaudrate = 0;
+            target->baudPending = TRUE;
+            target->timer = (double)xbGetMicroseconds() + BAUD_CONFIRM_TIME;
+        }
+        else if (target->baudPending) {
+            target->baudPending = FALSE;
+            StartDriver(target, target->linkBaudrate, FALSE);
+        }
+        break;
+    }
+}
+
+/* TargetByte - handle a byte that reached the target */
+static void TargetByte(Target *target, uint8_t byte)
+{
+    /* a calibration byte followed by the LFSR sequence means the PC reset the target */
+    if (byte == 0xf9) {
+        target->syncCount = 0;
+        target->syncLFSR = 'P';
+    }
+    else if (target->syncCount >= 0) {
+        if (byte != (NextLFSRBit(&target->syncLFSR) | 0xfe))
+            target->syncCount = -1;
+        else if (++target->syncCount == ROM_LFSR_BITS) {
+            target->syncCount = -1;
+            target->lfsr = target->syncLFSR;
+            target->bitCount = 0;
+            target->baudrate = target->linkBaudrate = ROM_BAUD_RATE;
+            target->timer = 0;
+            target->state = ROM_ID;
+            return;
+        }
+    }
+
+    if (target->state == HELPER)
+        PacketByte(target, byte);
+    else
+        ROMByte(target, byte);
+}
+
+/* ROMByte - handle a byte sent to the ROM loader */
+static void ROMByte(Target *target, uint8_t byte)
+{
+    uint8_t reply, sum;
+    uint32_t i;
+
+    switch (target->state) {
+    case ROM_ID:
+        /* each 0xf9 clocks out the next LFSR bit and then the version */
+        if (byte != 0xf9)
+            break;
+        if (target->bitCount < ROM_LFSR_BITS)
+            reply = 0xfe | NextLFSRBit(&target->lfsr);
+        else
+            reply = 0xfe | ((ROM_VERSION >> (target->bitCount - ROM_LFSR_BITS)) & 1);
+        SendBytes(target, &reply, 1);
+        if (++target->bitCount == ROM_LFSR_BITS + 8) {
+            target->romLong = 0;
+            target->romBits = target->romLongs = 0;
+            target->state = ROM_DOWNLOAD;
+        }
+        break;
+    case ROM_DOWNLOAD:
+        /* each byte carries three bits of a long (two in the last byte) */
+        target->romLong |= (uint32_t)((byte & 1) | ((byte >> 2) & 2) | ((byte >> 4) & 4)) << target->romBits;
+        if ((target->romBits += 3) < 32)
+            break;
+        if (target->romLongs == 0)
+            target->romType = target->romLong;
+        else if (target->romLongs == 1)
+            target->romCount = target->romLong;
+        else if ((i = (target->romLongs - 2) * 4) + 4 <= ROM_IMAGE_MAX)
+            PutLong(&target->romImage[i], target->romLong);
+        ++target->romLongs;
+        target->romLong = 0;
+        target->romBits = 0;
+        if (target->romLongs >= 2 && target->romLongs == (int)target->romCount + 2) {
+            target->counts.data += target->romCount * 4;
+            target->timer = (double)xbGetMicroseconds() + ROM_CHECK_TIME;
+            target->state = ROM_CHECK;
+        }
+        break;
+    case ROM_CHECK:
+        /* answer the first poll after the check with the result and run the download */
+        if (byte != 0xf9 || target->timer != 0)
+            break;
+        for (sum = 0, i = 0; i < target->romCount * 4 && i < ROM_IMAGE_MAX; ++i)
+            sum += target->romImage[i];
+        reply = sum == ROM_CHECKSUM ? 0xfe : 0xff;
+        SendBytes(target, &reply, 1);
+        if (reply == 0xfe && target->romType == DOWNLOAD_RUN_BINARY) {
+            target->timer = (double)xbGetMicroseconds() + HELPER_START_TIME;
+            target->state = HELPER_START;
+        }
+        else
+            target->state = ROM_IDLE;
+        break;
+    }
+}
+
+/* NextLFSRBit - get the next bit of the ROM loader LFSR sequence */
+static int NextLFSRBit(uint8_t *pLFSR)
+{
+    uint8_t lfsr = *pLFSR;
+    int bit = lfsr & 1;
+    *pLFSR = (uint8_t)((lfsr << 1) | (((lfsr >> 7) ^ (lfsr >> 5) ^ (lfsr >> 4) ^ (lfsr >> 1)) & 1));
+    return bit;
+}
+
+/* StartDriver - start the packet driver at a baud rate with or without the initial ACK */
+static void StartDriver(Target *target, uint32_t baudrate, int quiet)
+{
+    target->baudrate = baudrate;
+    target->rcvState = RCV_HDR;
+    target->hdrCount = 0;
+    target->expected = 1;
+    target->acked = 0;
+    target->nakSent = FALSE;
+    if (!quiet)
+        SendReply(target, ACK, HELPER_FEATURES | (HELPER_SLOTS - 1));
+}
+
+/* PacketByte - handle a byte sent to the packet driver */
+static void PacketByte(Target *target, uint8_t byte)
+{
+    uint8_t *hdr = target->hdr;
+    int chk;
+
+    switch (target->rcvState) {
+    case RCV_HDR:
+        if (target->hdrCount == 0 && byte != SOH)
+            break;
+        hdr[target->hdrCount++] = byte;
+        if (target->hdrCount < PKTHDRLEN)
+            break;
+        target->hdrCount = 0;
+
+        /* ask for the expected frame again if the header is bad */
+        chk = (hdr[1] + hdr[2] + hdr[3] + hdr[4]) & 0xff;
+        target->packetLength = hdr[3] << 8 | hdr[4];
+        if (hdr[5] != chk || target->packetLength > PKTMAXLEN) {
+            ++target->counts.damaged;
+            if (!target->nakSent) {
+                target->nakSent = TRUE;
+                SendReply(target, NAK, target->expected);
+            }
+            break;
+        }
+        target->packetCount = 0;
+        target->rcvState = RCV_DATA;
+        break;
+    case RCV_DATA:
+        target->packet[target->packetCount++] = byte;
+        if (target->packetCount == target->packetLength + PKTCRCLEN) {
+            target->rcvState = RCV_HDR;
+            FrameReceived(target);
+        }
+        break;
+    }
+}
+
+/* FrameReceived - acknowledge and handle a complete frame */
+static void FrameReceived(Target *target)
+{
+    int pktn = target->hdr[1], len = target->packetLength, i;
+    uint16_t crc = 0;
+
+    /* ask for the expected frame again if the crc is bad */
+    for (i = 0; i < len + PKTCRCLEN; ++i)
+        crc = updcrc(crc, target->packet[i]);
+    if (crc != 0) {
+        ++target->counts.damaged;
+        if (!target->nakSent) {
+            target->nakSent = TRUE;
+            SendReply(target, NAK, target->expected);
+        }
+        return;
+    }
+
+    /* a frame before the expected one means an ACK was lost (an empty frame 0 is a probe) */
+    if (pktn != target->expected) {
+        if ((uint8_t)(target->expected - pktn) < 128) {
+            if (pktn != 0 || len != 0)
+                ++target->counts.resent;
+            SendReply(target, ACK, target->acked);
+        }
+        else {
+            ++target->counts.resent;
+            if (!target->nakSent) {
+                target->nakSent = TRUE;
+                SendReply(target, NAK, target->expected);
+            }
+        }
+        return;
+    }
+
+    /* acknowledge the frame and handle it */
+    ++target->counts.frames;
+    target->acked = target->expected++;
+    target->nakSent = FALSE;
+    SendReply(target, ACK, target->acked);
+
+    /* the helper only takes the confirmation of a new rate while it waits for one */
+    if (target->baudPending) {
+        target->baudPending = FALSE;
+        target->timer = 0;
+        if (target->hdr[2] == TYPE_BAUD)
+            target->linkBaudrate = target->baudrate;
+        else
+            StartDriver(target, target->linkBaudrate, FALSE);
+        return;
+    }
+    HandlePacket(target, target->hdr[2], target->packet, len);
+}
+
+/* SendReply - send an ACK or a NAK and a packet number */
+static void SendReply(Target *target, int ch, int pktn)
+{
+    uint8_t reply[2];
+    reply[0] = (uint8_t)ch;
+    reply[1] = (uint8_t)pktn;
+    SendBytes(target, reply, 2);
+}
+
+/* SendPacketToHost - send an unnumbered packet to the PC */
+static void SendPacketToHost(Target *target, int type, uint8_t *buf, int len)
+{
+    uint8_t hdr[PKTHDRLEN], crc[PKTCRCLEN];
+    uint16_t crc16 = 0;
+    int i;
+
+    hdr[0] = SOH;
+    hdr[1] = 0;
+    hdr[2] = (uint8_t)type;
+    hdr[3] = (uint8_t)(len >> 8);
+    hdr[4] = (uint8_t)len;
+    hdr[5] = hdr[1] + hdr[2] + hdr[3] + hdr[4];
+    for (i = 0; i < len; ++i)
+        crc16 = updcrc(crc16, buf[i]);
+    crc16 = updcrc(crc16, '\0');
+    crc16 = updcrc(crc16, '\0');
+    crc[0] = (uint8_t)(crc16 >> 8);
+    crc[1] = (uint8_t)crc16;
+
+    SendBytes(target, hdr, PKTHDRLEN);
+    SendBytes(target, buf, len);
+    SendBytes(target, crc, PKTCRCLEN);
+}
+
+/* HandlePacket - handle a packet sent to the helper */
+static void HandlePacket(Target *target, int type, uint8_t *buf, int len)
+{
+    uint8_t reply[PKTMAXLEN], zbuf[PKTMAXLEN], *p;
+    uint32_t address, size, count, offset, i;
+    int n;
+
+    switch (type) {
+    case TYPE_VM_INIT:
+        target->vmStarted = TRUE;
+        break;
+    case TYPE_CACHE_INIT:
+        break;
+    case TYPE_FLASH_WRITE:
+        target->writeMode = WRITE_FLASH;
+        target->loadAddress = 0;
+        memset(target->flash, 0xff, FLASH_BLOCK_SIZE);
+        break;
+    case TYPE_FLASH_UPDATE:
+        target->writeMode = WRITE_FLASH_BLOCKS;
+        target->loadAddress = 0;
+        break;
+    case TYPE_FLASH_SEEK:
+        target->loadAddress = GetLong(buf) & (FLASH_MEMORY_SIZE - 1) & ~(FLASH_BLOCK_SIZE - 1);
+        memset(&target->flash[target->loadAddress], 0xff, FLASH_BLOCK_SIZE);
+        break;
+    case TYPE_FLASH_HASH:
+        count = GetLong(&buf[4]);
+        if (count > PKTMAXLEN / 8)
+            count = PKTMAXLEN / 8;
+        size = GetLong(&buf[8]);
+        for (i = 0; i < count; ++i) {
+            offset = (GetLong(buf) + i) * FLASH_BLOCK_SIZE;
+            if ((n = (int)(size - offset)) > FLASH_BLOCK_SIZE)
+                n = FLASH_BLOCK_SIZE;
+            HashFlash(target, offset, n, &reply[i * 8]);
+        }
+        SendPacketToHost(target, TYPE_FLASH_HASH, reply, count * 8);
+        break;
+    case TYPE_RAM_WRITE:
+        target->writeMode = WRITE_RAM;
+        target->loadAddress = 0;
+        break;
+    case TYPE_HUB_WRITE:
+        target->writeMode = WRITE_HUB;
+        target->loadAddress = 0;
+        break;
+    case TYPE_DATA:
+        WriteData(target, buf, len);
+        break;
+    case TYPE_DATA_Z:
+        WriteData(target, zbuf, DecodeBlock(buf, len, zbuf));
+        break;
+    case TYPE_EOF:
+        break;
+    case TYPE_RUN:
+        /* the program either halts at once leaving the helper waiting quietly or runs on */
+        if (target->resident)
+            StartDriver(target, ROM_BAUD_RATE, TRUE);
+        else {
+            target->baudrate = ROM_BAUD_RATE;
+            target->state = ROM_IDLE;
+        }
+        target->linkBaudrate = ROM_BAUD_RATE;
+        break;
+    case TYPE_BAUD:
+        target->newBaudrate = GetLong(buf);
+        target->timer = (double)xbGetMicroseconds() + BAUD_SWITCH_TIME;
+        break;
+    case TYPE_HELLO:
+        PutLong(&reply[0], HELPER_VERSION);
+        PutLong(&reply[4], target->identity);
+        PutLong(&reply[8], HELPER_FEATURES | (HELPER_SLOTS - 1));
+        SendPacketToHost(target, TYPE_HELLO, reply, 12);
+        break;
+    case TYPE_IDENTITY:
+        target->identity = GetLong(buf);
+        break;
+    case TYPE_MEM_READ:
+        address = GetLong(buf);
+        if ((count = GetLong(&buf[4])) > PKTMAXLEN)
+            count = PKTMAXLEN;
+        if (!target->vmStarted || !(p = TargetMemory(target, address, &size)) || count > size) {
+            p = reply;
+            count = 0;
+        }
+        SendPacketToHost(target, TYPE_MEM_READ, p, count & ~3);
+        break;
+    case TYPE_MEM_WRITE:
+        address = GetLong(buf);
+        if (target->vmStarted && len > 4 && (p = TargetMemory(target, address, &size)) != NULL)
+            memcpy(p, &buf[4], (uint32_t)(len - 4) < size ? (uint32_t)(len - 4) : size);
+        break;
+    }
+}
+
+/* WriteData - write a block of data the way the current write mode says */
+static void WriteData(Target *target, uint8_t *buf, int len)
+{
+    uint32_t size, address = target->loadAddress;
+    uint8_t *memory;
+
+    switch (target->writeMode) {
+    case WRITE_FLASH:
+    case WRITE_FLASH_BLOCKS:
+        memory = target->flash;
+        size = FLASH_MEMORY_SIZE;
+        target->loadAddress += len;
+        break;
+    case WRITE_RAM:
+        memory = target->ram;
+        size = RAM_MEMORY_SIZE;
+        target->loadAddress += (len + 3) & ~3;
+        break;
+    case WRITE_HUB:
+        memory = target->hub;
+        size = HUB_MEMORY_SIZE;
+        target->loadAddress += (len + 3) & ~3;
+        break;
+    default:
+        return;
+    }
+
+    /* count what is written */
+    if (address < size) {
+        if ((uint32_t)len > size - address)
+            len = size - address;
+        memcpy(&memory[address], buf, len);
+        target->counts.data += len;
+    }
+
+    /* flash is erased a block ahead while it is written from the start */
+    if (target->writeMode == WRITE_FLASH
+    &&  (target->loadAddress & (FLASH_BLOCK_SIZE - 1)) == 0
+    &&  target->loadAddress < FLASH_MEMORY_SIZE)
+        memset(&target->flash[target->loadAddress], 0xff, FLASH_BLOCK_SIZE);
+}
+
+/* DecodeBlock - decode a DATA_Z block returning its decoded size */
+static int DecodeBlock(uint8_t *src, int len, uint8_t *dst)
+{
+    uint8_t *end = src + len, *start = dst;
+    int n, offset;
+
+    while (src < end) {
+        n = *src++;
+        if (n < 0x80) {
+            if (dst + ++n > start + PKTMAXLEN)
+                break;
+            memcpy(dst, src, n);
+            src += n;
+        }
+        else if (n < 0xc0) {
+            if (dst + (n = (n & 0x3f) + 3) > start + PKTMAXLEN)
+                break;
+            memset(dst, *src++, n);
+        }
+        else {
+            if (dst + (n = (n & 0x3f) + 3) > start + PKTMAXLEN)
+                break;
+            offset = src[0] << 8 | src[1];
+            if (offset > dst - start)
+                break;
+            memcpy(dst, dst - offset, n);
+            src += 2;
+        }
+        dst += n;
+    }
+
+    return dst - start;
+}
+
+/* HashFlash - sum the longs and then any trailing bytes of a block of flash along with the running sums */
+static void HashFlash(Target *target, uint32_t offset, int len, uint8_t *p)
+{
+    uint32_t a = 0, b = 0;
+    for (; len >= 4 && offset + 4 <= FLASH_MEMORY_SIZE; offset += 4, len -= 4)
+        b += a += GetLong(&target->flash[offset]);
+    for (; len > 0 && offset < FLASH_MEMORY_SIZE; --len)
+        b += a += target->flash[offset++];
+    PutLong(p, a);
+    PutLong(p + 4, b);
+}
+
+/* TargetMemory - find the target memory at a VM address and the number of bytes after it */
+static uint8_t *TargetMemory(Target *target, uint32_t address, uint32_t *pSize)
+{
+    uint32_t offset = address & 0x0fffffff;
+    switch (address & 0xf0000000) {
+    case HUB_BASE:
+        if (offset >= HUB_MEMORY_SIZE)
+            return NULL;
+        *pSize = HUB_MEMORY_SIZE - offset;
+        return &target->hub[offset];
+    case RAM_BASE:
+        if (offset >= RAM_MEMORY_SIZE)
+            return NULL;
+        *pSize = RAM_MEMORY_SIZE - offset;
+        return &target->ram[offset];
+    case FLASH_BASE:
+        if (offset >= FLASH_MEMORY_SIZE)
+            return NULL;
+        *pSize = FLASH_MEMORY_SIZE - offset;
+        return &target->flash[offset];
+    }
+    return NULL;
+}
+
+/* GetLong - get a little endian long the way the Propeller stores it */
+static uint32_t GetLong(uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* PutLong - store a little endian long the way the Propeller stores it */
+static void PutLong(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+/* Random - get the next number of a repeatable pseudo random sequence */
+static uint32_t Random(Target *target)
+{
+    uint32_t x = target->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return target->random = x;
+}
+
+/* MakeImage - write an image of a section of code that is partly random and partly repetitive */
+static int MakeImage(char *path, uint32_t base, int size)
+{
+    ImageFileHdr hdr;
+    uint8_t *image;
+    uint32_t random = 1;
+    int fd, i, j, n;
+
+    if (!(image = (uint8_t *)malloc(size)))
+        return FALSE;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.tag, IMAGE_TAG, sizeof(hdr.tag));
+    hdr.version = IMAGE_VERSION;
+    hdr.mainCode = base;
+    hdr.sectionCount = 1;
+    hdr.sections[0].base = base;
+    hdr.sections[0].offset = sizeof(hdr);
+    hdr.sections[0].size = size - sizeof(hdr);
+    memcpy(image, &hdr, sizeof(hdr));
+
+    /* mix random bytes, runs and repeats of earlier bytes like compiled code */
+    for (i = sizeof(hdr); i < size; i += n) {
+        random = random * 1103515245 + 12345;
+        if ((n = 8 + ((random >> 16) & 31)) > size - i)
+            n = size - i;
+        switch ((random >> 8) & 3) {
+        case 0:
+            memset(&image[i], (random >> 24) & 3, n);
+            break;
+        case 1:
+            if (i > 256 + (int)sizeof(hdr)) {
+                memcpy(&image[i], &image[i - 64 - ((random >> 12) & 127)], n);
+                break;
+            }
+            /* fall through */
+        default:
+            for (j = 0; j < n; ++j) {
+                random = random * 1103515245 + 12345;
+                image[i + j] = (uint8_t)(random >> 16);
+            }
+            break;
+        }
+    }
+
+    /* write the image */
+    if ((fd = mkstemp(path)) < 0) {
+        free(image);
+        return FALSE;
+    }
+    n = write(fd, image, size);
+    close(fd);
+    free(image);
+    return n == size;
+}
+
+/* CheckImage - make sure the memory the image was written to matches it */
+static int CheckImage(Target *target, char *path)
+{
+    uint8_t buf[PKTMAXLEN], *memory;
+    ImageFileHdr *hdr = (ImageFileHdr *)buf;
+    uint32_t size, end, offset, i;
+    int match, n;
+    FILE *fp;
+
+    /* only the section data is loaded (the symbols and debug section stay on the host) */
+    if (!(fp = fopen(path, "rb")))
+        return FALSE;
+    if ((n = fread(buf, 1, sizeof(buf), fp)) < (int)sizeof(ImageFileHdr)) {
+        fclose(fp);
+        return FALSE;
+    }
+    for (end = 0, i = 0; i < hdr->sectionCount && sizeof(ImageFileHdr) + i * sizeof(ImageFileSection) <= (uint32_t)n; ++i)
+        if (hdr->sections[i].offset + hdr->sections[i].size > end)
+            end = hdr->sections[i].offset + hdr->sections[i].size;
+
+    /* the image is written from the start of the memory its first section is in */
+    pthread_mutex_lock(&target->lock);
+    match = (memory = TargetMemory(target, hdr->sections[0].base & 0xf0000000, &size)) != NULL && end <= size;
+    for (offset = 0; match && offset < end; offset += n) {
+        if (offset > 0 && (n = fread(buf, 1, sizeof(buf), fp)) <= 0)
+            match = FALSE;
+        else {
+            if ((uint32_t)n > end - offset)
+                n = end - offset;
+            match = memcmp(&memory[offset], buf, n) == 0;
+        }
+    }
+    pthread_mutex_unlock(&target->lock);
+    fclose(fp);
+
+    return match;
+}
+
+/* PhaseStarted - record the time and the link counts at the start of a phase */
+static void PhaseStarted(void *cookie, const char *name)
+{
+    LoadTiming *timing = (LoadTiming *)cookie;
+    Phase *phase;
+    if (timing->count >= MAXPHASES)
+        return;
+    phase = &timing->phases[timing->count++];
+    phase->name = name;
+    phase->start = xbGetMicroseconds();
+    pthread_mutex_lock(&timing->target->lock);
+    phase->counts = timing->target->counts;
+    pthread_mutex_unlock(&timing->target->lock);
+}
+
+/* ShowLoad - show the time and the traffic of each phase of a load and add them to the totals */
+static void ShowLoad(LoadTiming *timing, PhaseTotal *totals, int *pTotalCount)
+{
+    LinkCounts counts, all;
+    unsigned long time;
+    int i, j;
+
+    memset(&all, 0, sizeof(all));
+    ShowCounts(NULL, 0, NULL);
+    for (i = 0; i + 1 < timing->count; ++i) {
+        Phase *phase = &timing->phases[i];
+        if (!phase->name)
+            continue;
+        time = timing->phases[i + 1].start - phase->start;
+        SubtractCounts(&counts, &timing->phases[i + 1].counts, &phase->counts);
+        ShowCounts(phase->name, time, &counts);
+        AddCounts(&all, &counts);
+
+        /* add the phase to the totals */
+        for (j = 0; j < *pTotalCount && strcmp(totals[j].name, phase->name) != 0; ++j)
+            ;
+        if (j == *pTotalCount) {
+            if (j >= MAXPHASES)
+                continue;
+            totals[j].name = phase->name;
+            totals[j].time = 0;
+            memset(&totals[j].counts, 0, sizeof(totals[j].counts));
+            ++*pTotalCount;
+        }
+        totals[j].time += time;
+        AddCounts(&totals[j].counts, &counts);
+    }
+    if (timing->count > 0)
+        ShowCounts("total", timing->phases[timing->count - 1].start - timing->phases[0].start, &all);
+}
+
+/* ShowCounts - show a line of the phase table (or its heading) */
+static void ShowCounts(const char *name, unsigned long time, LinkCounts *counts)
+{
+    if (!counts)
+        printf("%-14s %10s %10s %10s %10s %10s %8s %8s %8s\n",
+               "phase", "ms", "to target", "from", "data", "data/s", "frames", "resent", "damaged");
+    else
+        printf("%-14s %10.1f %10lu %10lu %10lu %10.0f %8lu %8lu %8lu\n",
+               name,
+               time / 1000.0,
+               counts->toTarget,
+               counts->fromTarget,
+               counts->data,
+               time > 0 ? counts->data * 1000000.0 / time : 0.0,
+               counts->frames,
+               counts->resent,
+               counts->damaged);
+}
+
+/* SubtractCounts - get the counts between two snapshots */
+static void SubtractCounts(LinkCounts *result, LinkCounts *end, LinkCounts *start)
+{
+    result->toTarget = end->toTarget - start->toTarget;
+    result->fromTarget = end->fromTarget - start->fromTarget;
+    result->data = end->data - start->data;
+    result->frames = end->frames - start->frames;
+    result->resent = end->resent - start->resent;
+    result->damaged = end->damaged - start->damaged;
+    result->errors = end->errors - start->errors;
+}
+
+/* AddCounts - add counts to a total */
+static void AddCounts(LinkCounts *total, LinkCounts *counts)
+{
+    total->toTarget += counts->toTarget;
+    total->fromTarget += counts->fromTarget;
+    total->data += counts->data;
+    total->frames += counts->frames;
+    total->resent += counts->resent;
+    total->damaged += counts->damaged;
+    total->errors += counts->errors;
+}
+
+/* Usage - display a usage message and exit */
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbench\n\
+         [ -b <type> ]   select target board (c3 | ssf | eeprom | sd | hub | hub96 | host) (default is %s)\n\
+         [ -I <path> ]   add a directory to the search path\n\
+         [ -B <baud> ]   fastest rate to load at (default is the board's load-baudrate)\n\
+         [ -S <size> ]   size of the generated image (default is %d)\n\
+         [ -n <count> ]  number of loads (default is 1)\n\
+         [ -R ]          programs halt leaving the helper resident for the next load\n\
+         [ -l <ms> ]     latency added to each direction of the link\n\
+         [ -r <rate> ]   bytes per second limit on each direction of the link\n\
+         [ -e <rate> ]   chance of each helper byte being damaged (like 0.0001)\n\
+         [ -m <baud> ]   fastest rate the link works at\n\
+         [ <name> ]      image file to load instead of a generated one\n\
+", DEF_BOARD, DEF_IMAGE_SIZE);
+    exit(1);
+}
+
+/* ConstructFileName - construct a filename with an optional extension */
+static void ConstructFileName(const char *infile, char *outfile, char *ext)
+{
+    char *end = strrchr(infile, '.');
+    strcpy(outfile, infile);
+    if (!end || strchr(end, '/') || strchr(end, '\\'))
+        strcat(outfile, ext);
+}
+
+static void MyInfo(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stdout, fmt, ap);
+}
+
+static void MyError(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stderr, fmt, ap);
+}
@@ -5,6 +5,13 @@
 #include "db_loader.h"
 #include "db_packet.h"
 
+#if !defined(WIN32)
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#endif
+
 /* defaults */
 #if defined(CYGWIN) || defined(WIN32)
 #define DEF_PORT    "COM1"
@@ -17,11 +24,48 @@
 #endif
 #define DEF_BOARD   "c3"
 
+/* most ports loaded at once and the longest output line from a port */
+#define MAXPORTS    64
+#define MAXPORTLINE 256
+
+/* most breakpoints given on the command line (the helper may have room for fewer) */
+#define MAXBREAKS   16
+
+/* a function named by the image for the profile report */
+typedef struct {
+    uint32_t address;           /* address of its code */
+    char *name;                 /* its name */
+    uint32_t stalled;           /* stalled samples in buckets that start in its code */
+} ProfileFunction;
+
+/* a port being loaded by a child process */
+typedef struct {
+    char *name;                 /* port name */
+    int fd;                     /* read end of the pipe carrying the child's output or -1 */
+    int pid;                    /* child process id */
+    int passed;                 /* true if the load succeeded */
+    char line[MAXPORTLINE];     /* partial output line */
+    int length;                 /* length of the partial line */
+} PortLoad;
+
+static int DumpMemory(char *port, char *range);
+static int ShowProfile(char *port, char *path);
+static int ShowCounters(char *port, int clear);
+static ProfileFunction *ReadFunctions(char *path, uint8_t **pData, int *pCount);
+static int CompareAddresses(const void *p1, const void *p2);
+static int CompareStalls(const void *p1, const void *p2);
+static int SetBreakpoints(char *path);
+static int LoadPort(System *sys, BoardConfig *config, char *port, char *path, int runFlags, int profile, int counters);
+static int LoadPorts(System *sys, BoardConfig *config, char *ports, char *path, int runFlags);
 static void Usage(void);
 static void ConstructFileName(const char *infile, char *outfile, char *ext);
 
 static void MyInfo(System *sys, const char *fmt, va_list ap);
 static void MyError(System *sys, const char *fmt, va_list ap);
+/* breakpoints given as addresses or function names */
+static char *breaks[MAXBREAKS];
+static int breakCount = 0;
+
 static SystemOps myOps = {
     MyInfo,
     MyError
@@ -32,8 +76,12 @@ int main(int argc, char *argv[])
     char *infile = NULL, fullName[FILENAME_MAX];
     int runFlags = 0;
     int terminalMode = FALSE;
+    int terminalFlags = 0;
+    char *capture = NULL;
     BoardConfig *config;
-    char *port, *board;
+    char *port, *board, *ports = NULL, *dump = NULL;
+    int profile = FALSE, profileReport = FALSE;
+    int counters = FALSE, countersReport = FALSE, countersClear = FALSE;
     System sys;
     int i;
 
@@ -46,8 +94,48 @@ int main(int argc, char *argv[])
     /* get the arguments */
     for(i = 1; i < argc; ++i) {
 
+        /* load a comma separated list of ports at once */
+        if (strcmp(argv[i], "--ports") == 0) {
+            if (++i < argc)
+                ports = argv[i];
+            else
+                Usage();
+        }
+
+        /* dump memory from the helper left running after a program halted */
+        else if (strcmp(argv[i], "--dump") == 0) {
+            if (++i < argc)
+                dump = argv[i];
+            else
+                Usage();
+        }
+
+        /* sample where the program waits for the cache and show the samples after it halted */
+        else if (strcmp(argv[i], "--profile") == 0)
+            profile = TRUE;
+        else if (strcmp(argv[i], "--profile-report") == 0)
+            profileReport = TRUE;
+
+        /* count cache requests, misses and write-backs and show the counts after it halted
+           (or in terminal mode while it runs) */
+        else if (strcmp(argv[i], "--counters") == 0)
+            counters = TRUE;
+        else if (strcmp(argv[i], "--counters-report") == 0)
+            countersReport = TRUE;
+        else if (strcmp(argv[i], "--counters-clear") == 0)
+            countersReport = countersClear = TRUE;
+
+        /* stop at an address or a function and talk to the runtime in terminal mode */
+        else if (strcmp(argv[i], "--break") == 0) {
+            if (++i < argc && breakCount < MAXBREAKS)
+                breaks[breakCount++] = argv[i];
+            else
+                Usage();
+            terminalMode = TRUE;
+        }
+
         /* handle switches */
-        if(argv[i][0] == '-') {
+        else if(argv[i][0] == '-') {
             switch(argv[i][1]) {
             case 'b':   // select a target board
                 if (argv[i][2])
@@ -86,6 +174,17 @@ int main(int argc, char *argv[])
             case 't':
                 terminalMode = TRUE;
                 break;
+            case 'o':   // capture what the target sends in terminal mode
+            case 'L':   // the same with each line timestamped
+                terminalFlags = argv[i][1] == 'L' ? TERMINAL_TIMESTAMPS : 0;
+                if (argv[i][2])
+                    capture = &argv[i][2];
+                else if (++i < argc)
+                    capture = argv[i];
+                else
+                    Usage();
+                terminalMode = TRUE;
+                break;
             default:
                 Usage();
                 break;
@@ -103,49 +202,586 @@ int main(int argc, char *argv[])
     sys.ops = &myOps;
     ParseConfigurationFile(&sys, "xbasic.cfg");
 
+    /* a memory dump and a counters report don't load anything */
+    if (dump)
+        return DumpMemory(port, dump) ? 0 : 1;
+    if (countersReport)
+        return ShowCounters(port, countersClear) ? 0 : 1;
+
     /* make sure an input file was specified */
     if (!infile)
         Usage();
     ConstructFileName(infile, fullName, ".bai");
 
+    /* a profile report only reads the profile and names its functions from the image */
+    if (profileReport)
+        return ShowProfile(port, fullName) ? 0 : 1;
+
     /* setup for the selected board */
     if (!(config = GetBoardConfig(board)))
         Usage();
 
+    /* load a list of ports (there is no one to single step or talk to) */
+    if (ports) {
+        if (terminalMode || (runFlags & RUN_STEP) || profile || counters || breakCount > 0)
+            Usage();
+        return LoadPorts(&sys, config, ports, fullName, runFlags) ? 0 : 1;
+    }
+
+    /* load and run the compiled image */
+    if (!LoadPort(&sys, config, port, fullName, runFlags, profile, counters))
+        return 1;
+
+    /* enter terminal mode if requested */
+    if (terminalMode)
+        TerminalMode(capture, terminalFlags | (counters ? TERMINAL_COUNTERS : 0));
+    
+    return 0;
+}
+
+/* DumpMemory - show a range of VM memory given as <address>,<count> */
+static int DumpMemory(char *port, char *range)
+{
+    unsigned long address;
+    uint8_t *buf;
+    long count, i;
+    char *p;
+    
+    /* get the range */
+    address = strtoul(range, &p, 0);
+    if (*p != ',' || (count = strtol(p + 1, &p, 0)) <= 0 || *p != '\0')
+        Usage();
+        
+    /* connect to the helper */
+    if (!InitPort(port)) {
+        fprintf(stderr, "error: opening serial port\n");
+        return FALSE;
+    }
+    if (!ConnectToResidentHelper()) {
+        fprintf(stderr, "error: no helper is waiting (the last program must have halted)\n");
+        return FALSE;
+    }
+    
+    /* read the whole range */
+    if (!(buf = (uint8_t *)malloc(count))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        return FALSE;
+    }
+    if (!ReadTargetMemory((uint32_t)address, buf, (int)count)) {
+        free(buf);
+        return FALSE;
+    }
+    
+    /* show it sixteen bytes to a line */
+    for (i = 0; i < count; ++i) {
+        if (i % 16 == 0)
+            printf("%s%08lx:", i > 0 ? "\n" : "", address + i);
+        printf(" %02x", buf[i]);
+    }
+    putchar('\n');
+    free(buf);
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* ShowProfile - show the profile of the last run by function using the symbols of its image */
+static int ShowProfile(char *port, char *path)
+{
+    ProfileFunction *functions, *f;
+    TargetProfile profile;
+    uint32_t address;
+    uint8_t *data;
+    int count, lo, hi, mid, j;
+    
+    /* get the functions first so a bad image doesn't need the target */
+    if (!(functions = ReadFunctions(path, &data, &count)))
+        return FALSE;
+    
+    /* connect to the helper and read the profile */
+    if (!InitPort(port)) {
+        fprintf(stderr, "error: opening serial port\n");
+        return FALSE;
+    }
+    if (!ConnectToResidentHelper()) {
+        fprintf(stderr, "error: no helper is waiting (the last program must have halted)\n");
+        return FALSE;
+    }
+    if (!ReadTargetProfile(&profile))
+        return FALSE;
+    
+    /* charge each bucket to the function its first byte belongs to */
+    for (j = 0; j < (int)profile.count; ++j) {
+        if (profile.buckets[j] == 0)
+            continue;
+        address = profile.base + ((uint32_t)j << profile.shift);
+        for (lo = 0, hi = count - 1, f = NULL; lo <= hi; ) {
+            mid = (lo + hi) / 2;
+            if (functions[mid].address <= address) {
+                f = &functions[mid];
+                lo = mid + 1;
+            }
+            else
+                hi = mid - 1;
+        }
+        if (f)
+            f->stalled += profile.buckets[j];
+        else
+            functions[count].stalled += profile.buckets[j];
+    }
+    
+    /* show where the time went */
+    if (profile.samples == 0)
+        profile.samples = 1;
+    printf("%u samples\n", (unsigned int)profile.samples);
+    printf("  running  %10u %5.1f%%\n", (unsigned int)profile.running, profile.running * 100.0 / profile.samples);
+    printf("  stalled  %10u %5.1f%%  waiting for code\n", (unsigned int)profile.stalled, profile.stalled * 100.0 / profile.samples);
+    printf("  outside  %10u %5.1f%%  waiting for data\n", (unsigned int)profile.outside, profile.outside * 100.0 / profile.samples);
+    printf("  runtime  %10u %5.1f%%  traps\n", (unsigned int)profile.runtime, profile.runtime * 100.0 / profile.samples);
+    
+    /* show the functions that waited for code from most to least */
+    printf("\ncode stalls by function (buckets of %d bytes):\n", 1 << profile.shift);
+    qsort(functions, count + 1, sizeof(ProfileFunction), CompareStalls);
+    for (j = 0; j <= count && functions[j].stalled > 0; ++j)
+        printf("  %10u %5.1f%%  %s\n",
+               (unsigned int)functions[j].stalled,
+               functions[j].stalled * 100.0 / (profile.stalled ? profile.stalled : 1),
+               functions[j].name);
+    
+    free(profile.buckets);
+    free(functions);
+    free(data);
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* ShowCounters - show the counters of the last run and clear them if clear is set */
+static int ShowCounters(char *port, int clear)
+{
+    uint32_t requests = 0, misses = 0, writeBacks = 0;
+    TargetCounters counters;
+    TargetLineCounts *line;
+    int j;
+    
+    /* connect to the helper and read the counters */
+    if (!InitPort(port)) {
+        fprintf(stderr, "error: opening serial port\n");
+        return FALSE;
+    }
+    if (!ConnectToResidentHelper()) {
+        fprintf(stderr, "error: no helper is waiting (the last program must have halted)\n");
+        return FALSE;
+    }
+    if (!ReadTargetCounters(&counters, clear))
+        return FALSE;
+    
+    /* show the totals */
+    for (j = 0; j < (int)counters.lines; ++j) {
+        requests += counters.counts[j].requests;
+        misses += counters.counts[j].misses;
+        writeBacks += counters.counts[j].writeBacks;
+    }
+    printf("%u runtime requests\n", (unsigned int)counters.runtime);
+    printf("%u bytes of stack used\n", (unsigned int)counters.stack);
+    if (counters.lines == 0) {
+        free(counters.counts);
+        return TRUE;
+    }
+    printf("%u line requests  %u misses (%.1f%% hits)  %u write-backs\n",
+           (unsigned int)requests,
+           (unsigned int)misses,
+           requests ? (requests - misses) * 100.0 / requests : 100.0,
+           (unsigned int)writeBacks);
+    printf("%u clocks waiting for the cache (%.1f a request)\n",
+           (unsigned int)counters.wait,
+           requests ? (double)counters.wait / requests : 0.0);
+    
+    /* show the lines that were asked for */
+    printf("\nlines of %d bytes:\n", 1 << counters.shift);
+    printf("  line   requests     misses  write-backs\n");
+    for (j = 0; j < (int)counters.lines; ++j) {
+        line = &counters.counts[j];
+        if (line->requests > 0)
+            printf("  %4d %10u %10u %12u\n",
+                   j,
+                   (unsigned int)line->requests,
+                   (unsigned int)line->misses,
+                   (unsigned int)line->writeBacks);
+    }
+    
+    free(counters.counts);
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* ReadFunctions - read the function symbols of an image sorted by address (with an extra entry for
+   code that comes before them) */
+static ProfileFunction *ReadFunctions(char *path, uint8_t **pData, int *pCount)
+{
+    ImageFileSymbolHdr *symbolHdr, debugSymbols;
+    ProfileFunction *functions;
+    ImageFileDebugHdr *debugHdr;
+    ImageFileSection *debug;
+    ImageFileSymbol *entry;
+    ImageFileHdr *hdr;
+    uint8_t *data, *p;
+    VMUVALUE end, j;
+    long size;
+    int count;
+    FILE *fp;
+    
+    /* read the whole image */
+    if (!(fp = fopen(path, "rb"))) {
+        fprintf(stderr, "error: can't open image: %s\n", path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < (long)sizeof(ImageFileHdr) || !(data = (uint8_t *)malloc(size))) {
+        fprintf(stderr, "error: bad image: %s\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    if (fread(data, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "error: can't read image: %s\n", path);
+        fclose(fp);
+        free(data);
+        return NULL;
+    }
+    fclose(fp);
+    
+    /* the symbol table and then the debug section follow the section data */
+    hdr = (ImageFileHdr *)data;
+    if (memcmp(hdr->tag, IMAGE_TAG, sizeof(hdr->tag)) != 0
+    ||  sizeof(ImageFileHdr) + (hdr->sectionCount - 1) * sizeof(ImageFileSection) > (size_t)size) {
+        fprintf(stderr, "error: bad image: %s\n", path);
+        free(data);
+        return NULL;
+    }
+    for (end = 0, j = 0; j < hdr->sectionCount; ++j)
+        if (hdr->sections[j].offset + hdr->sections[j].size > end)
+            end = hdr->sections[j].offset + hdr->sections[j].size;
+    symbolHdr = NULL;
+    if ((hdr->flags & IMAGE_SYMBOLS) && end + sizeof(ImageFileSymbolHdr) <= (VMUVALUE)size) {
+        symbolHdr = (ImageFileSymbolHdr *)(data + end);
+        end += sizeof(ImageFileSymbolHdr) + symbolHdr->size;
+    }
+    if ((hdr->flags & IMAGE_DEBUG) && end + sizeof(ImageFileSection) <= (VMUVALUE)size) {
+        debug = (ImageFileSection *)(data + end);
+        if (debug->offset + sizeof(ImageFileDebugHdr) <= (VMUVALUE)size) {
+            debugHdr = (ImageFileDebugHdr *)(data + debug->offset);
+            debugSymbols.count = debugHdr->symbolCount;
+            debugSymbols.size = debugHdr->symbolSize;
+            symbolHdr = &debugSymbols;
+            end = debug->offset + sizeof(ImageFileDebugHdr);
+        }
+    }
+    if (!symbolHdr || end + symbolHdr->size > (VMUVALUE)size) {
+        fprintf(stderr, "error: the image has no function symbols (compile it with -g): %s\n", path);
+        free(data);
+        return NULL;
+    }
+    
+    /* make an entry for each symbol and the main code and one more for code before all of them */
+    if (!(functions = (ProfileFunction *)malloc((symbolHdr->count + 2) * sizeof(ProfileFunction)))) {
+        fprintf(stderr, "error: insufficient memory\n");
+        free(data);
+        return NULL;
+    }
+    for (p = data + end, count = 0; count < (int)symbolHdr->count; ++count, p += entry->size) {
+        entry = (ImageFileSymbol *)p;
+        if (entry->size <= sizeof(ImageFileSymbol) || p + entry->size > data + end + symbolHdr->size)
+            break;
+        functions[count].address = entry->value;
+        functions[count].name = (char *)(entry + 1);
+        functions[count].stalled = 0;
+    }
+    functions[count].address = hdr->mainCode;
+    functions[count].name = "<main>";
+    functions[count++].stalled = 0;
+    qsort(functions, count, sizeof(ProfileFunction), CompareAddresses);
+    functions[count].address = 0;
+    functions[count].name = "<unknown>";
+    functions[count].stalled = 0;
+    
+    /* return the functions and the image data their names are in */
+    *pData = data;
+    *pCount = count;
+    return functions;
+}
+
+static int CompareAddresses(const void *p1, const void *p2)
+{
+    const ProfileFunction *f1 = (const ProfileFunction *)p1;
+    const ProfileFunction *f2 = (const ProfileFunction *)p2;
+    return f1->address < f2->address ? -1 : f1->address > f2->address;
+}
+
+static int CompareStalls(const void *p1, const void *p2)
+{
+    const ProfileFunction *f1 = (const ProfileFunction *)p1;
+    const ProfileFunction *f2 = (const ProfileFunction *)p2;
+    return f1->stalled > f2->stalled ? -1 : f1->stalled < f2->stalled;
+}
+
+/* SetBreakpoints - set the breakpoints given as addresses or as function names found in the image */
+static int SetBreakpoints(char *path)
+{
+    ProfileFunction *functions = NULL;
+    unsigned long address;
+    uint8_t *data = NULL;
+    int count = 0, i, j;
+    char *p;
+    
+    /* start from an empty table in case the helper kept one from an earlier load */
+    if (!ClearBreakpoint(BREAK_ALL))
+        return FALSE;
+        
+    for (i = 0; i < breakCount; ++i) {
+    
+        /* an address */
+        address = strtoul(breaks[i], &p, 0);
+        if (p == breaks[i] || *p != '\0') {
+        
+            /* or the name of a function */
+            if (!functions && !(functions = ReadFunctions(path, &data, &count)))
+                return FALSE;
+            for (j = 0; j < count; ++j)
+                if (strcmp(functions[j].name, breaks[i]) == 0)
+                    break;
+            if (j >= count) {
+                fprintf(stderr, "error: no function named %s in the image\n", breaks[i]);
+                free(functions);
+                free(data);
+                return FALSE;
+            }
+            address = functions[j].address;
+        }
+        
+        if (!SetBreakpoint((uint32_t)address)) {
+            free(functions);
+            free(data);
+            return FALSE;
+        }
+    }
+    
+    free(functions);
+    free(data);
+    
+    /* return successfully */
+    return TRUE;
+}
+
+/* LoadPort - load and run the compiled image on a port leaving the port open */
+static int LoadPort(System *sys, BoardConfig *config, char *port, char *path, int runFlags, int profile, int counters)
+{
     /* initialize the serial port */
     if (!InitPort(port)) {
         fprintf(stderr, "error: opening serial port\n");
-        return 1;
+        return FALSE;
     }
 
     /* load the compiled image */
-    if (!LoadImage(&sys, config, port, fullName)) {
+    if (!LoadImage(sys, config, port, path)) {
         fprintf(stderr, "error: load failed\n");
-        return 1;
+        return FALSE;
+    }
+    
+    /* the helper starts the profiler with the program */
+    if (profile && !ProfileNextRun(config, path)) {
+        fprintf(stderr, "error: starting the profiler failed\n");
+        return FALSE;
+    }
+    
+    /* the helper starts counting with the program (after starting the profiler that goes above the counters) */
+    if (counters && !CountNextRun()) {
+        fprintf(stderr, "error: starting the counters failed\n");
+        return FALSE;
+    }
+    
+    /* the helper patches the breakpoints into the code as the program starts */
+    if (breakCount > 0 && !SetBreakpoints(path)) {
+        fprintf(stderr, "error: setting the breakpoints failed\n");
+        return FALSE;
     }
     
     /* run the loaded image */
     if (!RunLoadedProgram(runFlags)) {
         fprintf(stderr, "error: run failed\n");
-        return 1;
+        return FALSE;
     }
+    
+    /* return successfully */
+    return TRUE;
+}
 
-    /* enter terminal mode if requested */
-    if (terminalMode)
-        TerminalMode();
+#if defined(WIN32)
+
+/* LoadPorts - load each port in a comma separated list in turn and summarize the results */
+static int LoadPorts(System *sys, BoardConfig *config, char *ports, char *path, int runFlags)
+{
+    int passed[MAXPORTS], count = 0, failed = 0, i;
+    char *names[MAXPORTS], *name;
     
-    return 0;
+    /* load each port in turn */
+    for (name = strtok(ports, ","); name != NULL && count < MAXPORTS; name = strtok(NULL, ",")) {
+        printf("%s: loading\n", name);
+        names[count] = name;
+        if (!(passed[count] = LoadPort(sys, config, name, path, runFlags, FALSE, FALSE)))
+            ++failed;
+        ClosePort();
+        ++count;
+    }
+    
+    /* show the results */
+    for (i = 0; i < count; ++i)
+        printf("%-24s %s\n", names[i], passed[i] ? "PASS" : "FAIL");
+    printf("%d of %d ports passed\n", count - failed, count);
+    
+    /* return successfully if all of the ports were loaded */
+    return failed == 0;
 }
 
+#else
+
+static void ShowPortOutput(PortLoad *load, char *buf, int cnt);
+
+/* LoadPorts - load every port in a comma separated list at once and summarize the results
+ *
+ * Each port is loaded by a child process since the serial port, the packet state and the
+ * link baud rate are all process wide.  The parent reads the children's output from pipes
+ * and labels each line with the port it came from.
+ */
+static int LoadPorts(System *sys, BoardConfig *config, char *ports, char *path, int runFlags)
+{
+    PortLoad loads[MAXPORTS], *load;
+    int count = 0, active, failed, status, fds[2], maxfd, cnt, i;
+    char buf[MAXPORTLINE], *name;
+    fd_set readfds;
+    
+    /* start a child process for each port */
+    fflush(stdout);
+    fflush(stderr);
+    for (name = strtok(ports, ","); name != NULL && count < MAXPORTS; name = strtok(NULL, ",")) {
+        load = &loads[count++];
+        load->name = name;
+        load->fd = -1;
+        load->pid = -1;
+        load->passed = FALSE;
+        load->length = 0;
+        if (pipe(fds) != 0) {
+            fprintf(stderr, "error: %s: can't create pipe\n", name);
+            continue;
+        }
+        if ((load->pid = fork()) == 0) {
+            close(fds[0]);
+            dup2(fds[1], STDOUT_FILENO);
+            dup2(fds[1], STDERR_FILENO);
+            close(fds[1]);
+            setvbuf(stdout, NULL, _IOLBF, 0);
+            exit(LoadPort(sys, config, name, path, runFlags, FALSE, FALSE) ? 0 : 1);
+        }
+        close(fds[1]);
+        if (load->pid < 0) {
+            fprintf(stderr, "error: %s: can't start a process\n", name);
+            close(fds[0]);
+            continue;
+        }
+        load->fd = fds[0];
+    }
+    
+    /* show the output of the children until they have all finished */
+    do {
+        FD_ZERO(&readfds);
+        maxfd = -1;
+        for (i = 0, active = 0; i < count; ++i) {
+            if (loads[i].fd >= 0) {
+                FD_SET(loads[i].fd, &readfds);
+                if (loads[i].fd > maxfd)
+                    maxfd = loads[i].fd;
+                ++active;
+            }
+        }
+        if (active > 0 && select(maxfd + 1, &readfds, NULL, NULL, NULL) > 0) {
+            for (i = 0; i < count; ++i) {
+                load = &loads[i];
+                if (load->fd >= 0 && FD_ISSET(load->fd, &readfds)) {
+                    if ((cnt = read(load->fd, buf, sizeof(buf))) > 0)
+                        ShowPortOutput(load, buf, cnt);
+                    else {
+                        ShowPortOutput(load, "\n", load->length > 0 ? 1 : 0);
+                        close(load->fd);
+                        load->fd = -1;
+                    }
+                }
+            }
+        }
+    } while (active > 0);
+    
+    /* collect the results */
+    for (i = 0, failed = 0; i < count; ++i) {
+        load = &loads[i];
+        if (load->pid > 0 && waitpid(load->pid, &status, 0) == load->pid)
+            load->passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!load->passed)
+            ++failed;
+    }
+    
+    /* show the results */
+    for (i = 0; i < count; ++i)
+        printf("%-24s %s\n", loads[i].name, loads[i].passed ? "PASS" : "FAIL");
+    printf("%d of %d ports passed\n", count - failed, count);
+    
+    /* return successfully if all of the ports were loaded */
+    return failed == 0;
+}
+
+/* ShowPortOutput - show the complete lines of a child's output labeled with its port */
+static void ShowPortOutput(PortLoad *load, char *buf, int cnt)
+{
+    while (--cnt >= 0) {
+        int ch = *buf++;
+        if (ch != '\n' && load->length < MAXPORTLINE - 1)
+            load->line[load->length++] = ch;
+        else {
+            load->line[load->length] = '\0';
+            printf("%s: %s\n", load->name, load->line);
+            load->length = 0;
+            if (ch != '\n')
+                load->line[load->length++] = ch;
+        }
+    }
+    fflush(stdout);
+}
+
+#endif
+
 /* Usage - display a usage message and exit */
 static void Usage(void)
 {
     fprintf(stderr, "\
 usage: xload\n\
-         [ -b <type> ]   select target board (c3 | ssf | hub | hub96) (default is hub)\n\
+         [ -b <type> ]   select target board (c3 | ssf | eeprom | sd | hub | hub96 | host) (default is hub)\n\
          [ -p <port> ]   serial port (default is %s)\n\
+         [ --ports <port>,<port>,... ]\n\
+                         load and run on several ports at once\n\
+         [ --dump <address>,<count> ]\n\
+                         show memory after the last program halted\n\
+         [ --profile ]   sample where the program waits for the cache (c3 | ssf)\n\
+         [ --profile-report ]\n\
+                         show the samples by function after the profiled program halted\n\
+         [ --counters ]  count cache requests, misses and write-backs (Ctrl-T shows them in terminal mode)\n\
+         [ --counters-report | --counters-clear ]\n\
+                         show the counts after the program halted (and clear them)\n\
+         [ --break <address> | <function> ]\n\
+                         stop at an instruction in RAM or hub code (space steps, g goes on)\n\
          [ -s ]          single step program\n\
          [ -t ]          enter terminal mode after running the program\n\
+         [ -o <file> ]   terminal mode capturing what the target sends to a file\n\
+         [ -L <file> ]   the same with each captured line timestamped\n\
          <name>          file to compile\n\
 ", DEF_PORT);
     exit(1);
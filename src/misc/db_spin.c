@@ -90,7 +90,7 @@ void WriteSpinFile(BoardConfig *config, const char *imagefile, const char *spinf
     if (flashBoot) {
         fprintf(ofp, "\nPUB start | data, cache_line_mask\n");
         fprintf(ofp, "  data := @result + loader_stack_size\n");
-        fprintf(ofp, "  cache_line_mask := cacheint.start(@cache_code, cache_mbox, cache, %d, %d)\n", config->cacheParam1, config->cacheParam2);
+        fprintf(ofp, "  cache_line_mask := cacheint.start(@cache_code, cache_mbox, cache, cache_size, %d, %d)\n", config->cacheParam1, config->cacheParam2);
         fprintf(ofp, "  runtime.init(vm_mbox, vm_state, @vm_code, data, cache_mbox, cache_line_mask)\n");
         fprintf(ofp, "  runtime.load(vm_mbox, vm_state, runtime#FLASH_BASE, data_end)\n", hdr.stackSize);
     }
@@ -13,8 +13,69 @@
 #include "db_system.h"
 #include "db_vmimage.h"
 
+/* use the threaded dispatch engine when the compiler supports computed gotos */
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define USE_THREADED_DISPATCH
+#endif
+
+/* translate the code into host code on x86-64 hosts (the jit engine runs decoded elsewhere) */
+#if defined(USE_THREADED_DISPATCH) && defined(__x86_64__) && !defined(_WIN32) && !defined(NO_JIT)
+#define USE_JIT
+#endif
+
+/* size of the console output buffer */
+#define OUTPUT_BUFFER_SIZE  256
+
 /* forward type declarations */
 typedef struct Interpreter Interpreter;
+typedef struct CogTable CogTable;
+typedef struct TaskTable TaskTable;
+typedef struct Clock Clock;
+typedef struct Registers Registers;
+typedef struct Pins Pins;
+typedef struct Snapshot Snapshot;
+typedef struct IOLog IOLog;
+
+/* execution engines */
+typedef enum {
+    ENGINE_SWITCH,
+    ENGINE_THREADED,
+    ENGINE_DECODED,
+    ENGINE_JIT
+} EngineType;
+
+#ifdef USE_THREADED_DISPATCH
+#define ENGINE_DEFAULT  ENGINE_THREADED
+#else
+#define ENGINE_DEFAULT  ENGINE_SWITCH
+#endif
+
+/* execution profile */
+typedef struct {
+    ImageHdr *image;            /* image being profiled */
+    ImageSection *codeSection;  /* section containing the profiled code */
+    VMUVALUE codeSize;          /* size of the code section */
+    uint64_t *counts;           /* execution count for each code offset */
+    uint64_t *calls;            /* call count for each code offset */
+    uint64_t *pairCounts;       /* execution count for each pair of opcodes */
+    uint64_t total;             /* total number of instructions executed */
+    uint64_t outside;           /* instructions executed outside of the code section */
+    int lastOpcode;             /* previous opcode or -1 */
+} Profile;
+
+/* how a run stopped (aborted and halted are the FALSE and TRUE that Execute returns) */
+typedef enum {
+    EXEC_ABORTED,               /* Abort stopped the program (for an error or a trap it can't do) */
+    EXEC_HALTED,                /* the main code halted */
+    EXEC_EXHAUSTED,             /* ExecuteFor ran its instructions (the run can continue) */
+    EXEC_CANCELLED              /* CancelExecution stopped the run (the run can continue) */
+} ExecStatus;
+
+/* console operations (the default ones use the VM_ platform functions) */
+typedef struct {
+    int (*getChar)(void *cookie);
+    void (*write)(void *cookie, const char *buf, int size);
+} ConsoleOps;
 
 /* intrinsic function handler type */
 typedef void IntrinsicFcn(Interpreter *i);
@@ -23,20 +84,45 @@ typedef void IntrinsicFcn(Interpreter *i);
 struct Interpreter {
     System *sys;
     ImageHdr *image;
+    EngineType engine;
+    ImageSection *sectionMap[ADDR_REGIONS];
+    int checkAddresses;
+    Profile *profile;
+    CogTable *cogs;             /* cogs started by COGSTART and the locks (shared by every cog) */
+    TaskTable *tasks;           /* tasks started by TASK (each cog has its own) */
+    Clock *clock;               /* cycle estimates or NULL */
+    unsigned long startTime;    /* microseconds when the program started */
+    uint64_t skipped;           /* cycles the waits skipped without the clock */
+    int cogId;                  /* cog number (cog 0 runs the main code) */
+    Registers *registers;       /* cog registers (the first access creates them) */
+    Pins *pins;                 /* I/O pins (shared by every cog) or NULL */
+    Snapshot *snapshot;         /* snapshot to take or NULL */
+    IOLog *ioLog;               /* log the inputs are recorded to or replayed from or NULL */
+    ConsoleOps *console;        /* console input and output (shared by every cog) */
+    void *consoleCookie;        /* data passed to the console operations */
+    int budgeted;               /* ExecuteFor is counting the instructions */
+    uint64_t budget;            /* instructions ExecuteFor has left */
+    volatile int cancelled;     /* CancelExecution has asked the run to stop */
+    int finished;               /* the run has halted or aborted */
+    ExecStatus status;          /* how it finished */
     jmp_buf errorTarget;
     VMVALUE *stack;
     VMVALUE *stackTop;
+    uint8_t *codeBase;          /* calls push the pc as an offset from here */
     uint8_t *pc;
     VMVALUE *fp;
     VMVALUE *sp;
     VMVALUE tos;
     int argc;
     int linePos;
+    int outputCount;            /* number of characters in the output buffer */
+    char output[OUTPUT_BUFFER_SIZE];
 };
 
-/* stack manipulation macros */
-#define Reserve(i, n)   do {                                    \
-                            if ((i)->sp - (n) < (i)->stack)     \
+/* stack manipulation macros
+   (Reserve also checks for the d words a function pushes past its frame so Push doesn't have to) */
+#define Reserve(i, n, d) do {                                   \
+                            if ((i)->sp - (n) - (d) < (i)->stack) \
                                 StackOverflow(i);               \
                             else  {                             \
                                 int _cnt = (n);                 \
@@ -44,12 +130,6 @@ struct Interpreter {
                                     Push(i, 0);                 \
                             }                                   \
                         } while (0)
-#define CPush(i, v)     do {                                    \
-                            if ((i)->sp - 1 < (i)->stack)       \
-                                StackOverflow(i);               \
-                            else                                \
-                                Push(i, v);                     \
-                        } while (0)
 #define Push(i, v)      (*--(i)->sp = (v))
 #define Pop(i)          (*(i)->sp++)
 #define Top(i)          (*(i)->sp)
@@ -59,21 +139,111 @@ struct Interpreter {
 void Fatal(System *sys, const char *fmt, ...);
 
 /* prototypes from db_vmimage.c */
-ImageHdr *LoadImage(System *sys, const char *name);
+ImageHdr *LoadImage(System *sys, const char *name, int flags);
+ImageHdr *CopyImage(System *sys, ImageHdr *image);
+ImageSection *FindCodeSection(ImageHdr *image);
+ImageFileLine *FindSourceLine(ImageHdr *image, VMUVALUE addr);
+const char *SourceFileName(ImageHdr *image, ImageFileLine *line);
+int PredecodeImage(System *sys, ImageHdr *image);
+int PredecodeCode(ImageHdr *image, VMUVALUE addr);
 
-/* prototypes from db_vmint.c */
+/* prototypes from db_vmint.c
+   (a host runs a program in slices by calling InitExecution and then ExecuteFor until it
+   returns EXEC_HALTED or EXEC_ABORTED, with console and consoleCookie set for its I/O) */
 Interpreter *InitInterpreter(System *sys, ImageHdr *image);
 int Execute(Interpreter *i, ImageHdr *image);
+int Resume(Interpreter *i);
+void InitExecution(Interpreter *i);
+ExecStatus ExecuteFor(Interpreter *i, uint64_t maxInstructions);
+void CancelExecution(Interpreter *i);
+int ExecuteCode(Interpreter *i);
 void Abort(Interpreter *i, const char *fmt, ...);
 void StackOverflow(Interpreter *i);
+void IndexError(Interpreter *i, VMVALUE index, VMUVALUE bound);
 void ShowStack(Interpreter *i);
+uint8_t *MapBytes(Interpreter *i, VMUVALUE addr, VMVALUE size);
+uint8_t *MapAddress(Interpreter *i, VMUVALUE addr);
+VMVALUE LoadValue(Interpreter *i, VMUVALUE addr);
+VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr);
+VMVALUE LoadWordValue(Interpreter *i, VMUVALUE addr);
+void StoreValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
+void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
+void StoreWordValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
+VMVALUE LoadConstValue(Interpreter *i, VMUVALUE addr);
+void StoreConstValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
+void DoTrap(Interpreter *i, int op);
+void FlushOutput(Interpreter *i);
+
+/* prototypes from db_vmjit.c */
+int ExecuteJit(Interpreter *i);
+
+/* prototypes from db_vmprof.c */
+Profile *InitProfile(System *sys, ImageHdr *image);
+void ProfileInstruction(Profile *p, const uint8_t *pc);
+void ProfileCall(Profile *p, const uint8_t *pc);
+void GetOpcodeCounts(Profile *p, uint64_t *opcodeCounts);
+void ShowProfile(System *sys, Profile *p);
+int WriteProfileCSV(Profile *p, const char *path);
 
 /* prototypes and variables from db_vmfcn.c */
 extern IntrinsicFcn * FLASH_SPACE Intrinsics[];
 extern int IntrinsicCount;
 
+void DoArrayTrap(Interpreter *i, int op);
+void DoFloatTrap(Interpreter *i, int op);
+
+/* prototypes from db_vmclock.c */
+Clock *InitClock(System *sys, BoardConfig *config);
+void ClockInstruction(Interpreter *i);
+uint64_t ClockCycles(Interpreter *i);
+void ClockWait(Interpreter *i, uint64_t cycles);
+uint32_t ClockFrequency(Interpreter *i);
+void SetClockCycles(Interpreter *i, uint64_t cycles);
+void ShowClock(System *sys, Clock *clock);
+
+/* prototypes from db_vmcog.c */
+void DoCogTrap(Interpreter *i, int op);
+void WaitForCogs(Interpreter *i);
+
+/* prototypes from db_vmpins.c */
+Pins *InitPins(System *sys, uint32_t clkfreq, const char *stimulusPath, const char *tracePath);
+void ClosePins(Interpreter *i);
+uint8_t *MapRegister(Interpreter *i, VMUVALUE addr);
+void RegisterStored(Interpreter *i, VMUVALUE addr);
+void ReleaseRegisters(Interpreter *i);
+void DoNative(Interpreter *i, VMVALUE insn);
+
+/* prototypes from db_vmbatch.c */
+int RunBatch(System *sys, const char *manifest, EngineType engine, int verify, int jobs, uint64_t limit);
+
+/* prototypes from db_vmsnap.c */
+Snapshot *InitSnapshot(Interpreter *i, const char *at, const char *path);
+int CheckSnapshot(Interpreter *i);
+int RestoreSnapshot(Interpreter *i, const char *path);
+
+/* kinds of logged inputs */
+#define IOLOG_GETCHAR   0
+#define IOLOG_CNT       1
+#define IOLOG_INA       2
+
+/* LoggedInput - get an input the run records or replays (expr is only evaluated when it isn't replayed) */
+#define LoggedInput(i, kind, expr)  (!(i)->ioLog ? (int64_t)(expr)                           \
+                                    : IsReplaying((i)->ioLog) ? ReplayInput(i, kind)         \
+                                    : RecordInput(i, kind, (int64_t)(expr)))
+
+/* prototypes from db_vmreplay.c */
+IOLog *OpenIOLog(Interpreter *i, const char *path, int replay);
+int CloseIOLog(Interpreter *i);
+int IsReplaying(IOLog *log);
+int64_t RecordInput(Interpreter *i, int kind, int64_t value);
+int64_t ReplayInput(Interpreter *i, int kind);
+
+/* prototypes from db_vmtask.c */
+void DoTaskTrap(Interpreter *i, int op);
+
 void VM_getline(char *buf, int size);
 int VM_getchar(void);
 void VM_putchar(int ch);
+void VM_write(const char *buf, int size);
 
 #endif
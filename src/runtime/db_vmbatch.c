@@ -0,0 +1,517 @@
+/* db_vmbatch.c - run many programs in one process
+ *
+ * A manifest has a case on each line: an image, a file the program reads
+ * as its console input and a file with the output it should write ('-' for
+ * no input or for output that isn't checked).  Relative paths are from the
+ * directory of the manifest and '#' starts a comment.  Each image is loaded
+ * once and every run gets a copy of its sections so the cases can run at
+ * the same time on a pool of threads.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+#include "mem_arena.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* longest manifest line */
+#define MAX_LINE        1024
+
+/* most threads in the pool */
+#define MAX_JOBS        64
+
+#if defined(WIN32)
+typedef CRITICAL_SECTION BatchLock;
+typedef HANDLE BatchThread;
+#define InitLock(l)     InitializeCriticalSection(l)
+#define DeleteLock(l)   DeleteCriticalSection(l)
+#define Lock(l)         EnterCriticalSection(l)
+#define Unlock(l)       LeaveCriticalSection(l)
+#else
+typedef pthread_mutex_t BatchLock;
+typedef pthread_t BatchThread;
+#define InitLock(l)     pthread_mutex_init(l, NULL)
+#define DeleteLock(l)   pthread_mutex_destroy(l)
+#define Lock(l)         pthread_mutex_lock(l)
+#define Unlock(l)       pthread_mutex_unlock(l)
+#endif
+
+/* growable byte buffer */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t max;
+} Buffer;
+
+/* case from the manifest */
+typedef struct {
+    int line;                   /* manifest line of the case */
+    char *imagePath;            /* image to run */
+    char *inputPath;            /* console input or NULL */
+    char *expectedPath;         /* expected output or NULL */
+    ImageHdr *image;            /* image shared with the other cases or NULL if it can't be loaded */
+    int passed;                 /* the case passed */
+    char *message;              /* why it failed */
+} BatchCase;
+
+/* image loaded for the cases that run it */
+typedef struct {
+    char *path;
+    ImageHdr *image;
+} BatchImage;
+
+/* cases and the pool running them */
+typedef struct {
+    BatchLock lock;             /* lock for next */
+    BatchCase *cases;
+    int count;
+    int next;                   /* next case to run */
+    EngineType engine;
+    uint64_t limit;             /* instructions each run can execute or zero for no limit */
+} Batch;
+
+/* state of a run (the console operations of every cog of the run share it) */
+typedef struct {
+    SystemOps ops;              /* must be first so the system operations can find the run */
+    BatchLock lock;             /* lock for the console */
+    Buffer input;               /* console input */
+    size_t inputPos;            /* next character of the input */
+    Buffer output;              /* console output */
+    Buffer errors;              /* errors reported by the run */
+} BatchRun;
+
+static int ReadManifest(System *sys, Batch *b, const char *manifest);
+static char *CasePath(System *sys, const char *dir, size_t dirLength, const char *name);
+static int LoadCaseImages(System *sys, Batch *b, int verify);
+static void RunCases(Batch *b);
+static void RunCase(Batch *b, BatchCase *c);
+static char *RunMessage(const char *fmt, const char *detail);
+static int StartBatchThread(Batch *b, BatchThread *pThread);
+static void WaitForBatchThread(BatchThread thread);
+static int ProcessorCount(void);
+static int ReadBuffer(const char *path, Buffer *buf);
+static int AppendBuffer(Buffer *buf, const char *data, size_t size);
+static int BatchGetChar(void *cookie);
+static void BatchWrite(void *cookie, const char *buf, int size);
+static void BatchInfo(System *sys, const char *fmt, va_list ap);
+static void BatchError(System *sys, const char *fmt, va_list ap);
+
+static ConsoleOps batchConsole = {
+    BatchGetChar,
+    BatchWrite
+};
+
+/* RunBatch - run the cases of a manifest on jobs threads (zero for one a processor) and report them
+   (a limit stops each run after that many instructions, returns the number of cases that failed
+   or -1 if the manifest can't be run) */
+int RunBatch(System *sys, const char *manifest, EngineType engine, int verify, int jobs, uint64_t limit)
+{
+    BatchThread threads[MAX_JOBS];
+    unsigned long start;
+    int started, failed, j;
+    Batch b;
+
+    memset(&b, 0, sizeof(b));
+    b.engine = engine;
+    b.limit = limit;
+
+    if (!ReadManifest(sys, &b, manifest) || !LoadCaseImages(sys, &b, verify))
+        return -1;
+
+    if (jobs <= 0)
+        jobs = ProcessorCount();
+    if (jobs > b.count)
+        jobs = b.count;
+    if (jobs > MAX_JOBS)
+        jobs = MAX_JOBS;
+
+    /* this thread runs cases too once the others have started */
+    start = xbGetMicroseconds();
+    InitLock(&b.lock);
+    for (started = 0; started < jobs - 1 && StartBatchThread(&b, &threads[started]); ++started)
+        ;
+    RunCases(&b);
+    for (j = 0; j < started; ++j)
+        WaitForBatchThread(threads[j]);
+    DeleteLock(&b.lock);
+
+    /* report the failures in the order of the manifest */
+    for (failed = 0, j = 0; j < b.count; ++j) {
+        BatchCase *c = &b.cases[j];
+        if (!c->passed) {
+            xbInfo(sys, "FAIL %s(%d): %s: %s\n", manifest, c->line, c->imagePath, c->message ? c->message : "insufficient memory");
+            ++failed;
+        }
+        free(c->message);
+    }
+    free(b.cases);
+    xbInfo(sys, "%d passed, %d failed, %d cases in %lu ms on %d threads\n",
+           b.count - failed, failed, b.count, (xbGetMicroseconds() - start) / 1000, started + 1);
+
+    return failed;
+}
+
+/* ReadManifest - read the cases from a manifest */
+static int ReadManifest(System *sys, Batch *b, const char *manifest)
+{
+    char line[MAX_LINE], *fields[3], *p;
+    const char *dirEnd;
+    size_t dirLength;
+    int lineNumber = 0, max = 0, count;
+    BatchCase *c;
+    FILE *fp;
+
+    if (!(fp = fopen(manifest, "r"))) {
+        xbError(sys, "error: can't open '%s'\n", manifest);
+        return FALSE;
+    }
+
+    /* relative paths are from the directory of the manifest */
+    if ((dirEnd = strrchr(manifest, '/')) != NULL || (dirEnd = strrchr(manifest, '\\')) != NULL)
+        dirLength = dirEnd - manifest + 1;
+    else
+        dirLength = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        ++lineNumber;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+
+        /* split the line into the image, input and expected output */
+        for (count = 0, p = strtok(line, " \t\r\n"); p; p = strtok(NULL, " \t\r\n")) {
+            if (count >= 3) {
+                xbError(sys, "error: %s(%d): expecting an image, an input file and an output file\n", manifest, lineNumber);
+                fclose(fp);
+                return FALSE;
+            }
+            fields[count++] = p;
+        }
+        if (count == 0)
+            continue;
+
+        if (b->count >= max) {
+            max = max ? max * 2 : 64;
+            if (!(c = (BatchCase *)realloc(b->cases, max * sizeof(BatchCase)))) {
+                xbError(sys, "error: insufficient memory\n");
+                fclose(fp);
+                return FALSE;
+            }
+            b->cases = c;
+        }
+        c = &b->cases[b->count++];
+        memset(c, 0, sizeof(BatchCase));
+        c->line = lineNumber;
+        c->imagePath = CasePath(sys, manifest, dirLength, fields[0]);
+        if (count > 1 && strcmp(fields[1], "-") != 0)
+            c->inputPath = CasePath(sys, manifest, dirLength, fields[1]);
+        if (count > 2 && strcmp(fields[2], "-") != 0)
+            c->expectedPath = CasePath(sys, manifest, dirLength, fields[2]);
+    }
+
+    fclose(fp);
+
+    if (b->count == 0) {
+        xbError(sys, "error: no cases in '%s'\n", manifest);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* CasePath - make a manifest path relative to the directory of the manifest */
+static char *CasePath(System *sys, const char *dir, size_t dirLength, const char *name)
+{
+    char *path;
+    if (name[0] == '/' || name[0] == '\\' || (name[0] != '\0' && name[1] == ':'))
+        dirLength = 0;
+    if (!(path = (char *)xbGlobalAlloc(sys, dirLength + strlen(name) + 1)))
+        Fatal(sys, "insufficient memory");
+    memcpy(path, dir, dirLength);
+    strcpy(&path[dirLength], name);
+    return path;
+}
+
+/* LoadCaseImages - load each image once for all of the cases that run it */
+static int LoadCaseImages(System *sys, Batch *b, int verify)
+{
+    BatchImage *images;
+    int imageCount = 0, j, k;
+    FILE *fp;
+
+    if (!(images = (BatchImage *)malloc(b->count * sizeof(BatchImage)))) {
+        xbError(sys, "error: insufficient memory\n");
+        return FALSE;
+    }
+
+    for (j = 0; j < b->count; ++j) {
+        BatchCase *c = &b->cases[j];
+        for (k = 0; k < imageCount; ++k)
+            if (strcmp(images[k].path, c->imagePath) == 0)
+                break;
+        if (k >= imageCount) {
+            images[k].path = c->imagePath;
+            images[k].image = NULL;
+            ++imageCount;
+
+            /* a missing image only fails its cases (LoadImage gives up on the whole process) */
+            if ((fp = fopen(c->imagePath, "rb")) != NULL) {
+                fclose(fp);
+                images[k].image = LoadImage(sys, c->imagePath, 0);
+                if (images[k].image && verify) {
+                    if (VerifyImage(sys, images[k].image))
+                        images[k].image->flags |= IMAGE_VERIFIED;
+                    else
+                        images[k].image = NULL;
+                }
+            }
+        }
+        if (!(c->image = images[k].image))
+            c->message = RunMessage("can't load or verify the image%s", "");
+    }
+
+    free(images);
+    return TRUE;
+}
+
+/* RunCases - run cases until there are none left */
+static void RunCases(Batch *b)
+{
+    int j;
+    for (;;) {
+        Lock(&b->lock);
+        j = b->next++;
+        Unlock(&b->lock);
+        if (j >= b->count)
+            break;
+        if (b->cases[j].image)
+            RunCase(b, &b->cases[j]);
+    }
+}
+
+/* RunCase - run a case and check its output */
+static void RunCase(Batch *b, BatchCase *c)
+{
+    Buffer expected;
+    Interpreter *i;
+    ImageHdr *image;
+    BatchRun run;
+    System *sys;
+    size_t pos;
+    ExecStatus status;
+
+    memset(&run, 0, sizeof(run));
+    run.ops.info = BatchInfo;
+    run.ops.error = BatchError;
+    memset(&expected, 0, sizeof(expected));
+
+    if (c->inputPath && !ReadBuffer(c->inputPath, &run.input)) {
+        c->message = RunMessage("can't read '%s'", c->inputPath);
+        return;
+    }
+    if (c->expectedPath && !ReadBuffer(c->expectedPath, &expected)) {
+        c->message = RunMessage("can't read '%s'", c->expectedPath);
+        free(run.input.data);
+        return;
+    }
+
+    if (!(sys = MemInit())) {
+        free(run.input.data);
+        free(expected.data);
+        return;
+    }
+    sys->ops = &run.ops;
+    InitLock(&run.lock);
+
+    /* run a copy of the image with the console of the run */
+    if ((image = CopyImage(sys, c->image)) != NULL
+    &&  (i = InitInterpreter(sys, image)) != NULL
+    &&  (i->pins = InitPins(sys, ClockFrequency(i), NULL, NULL)) != NULL) {
+        i->engine = b->engine;
+        i->console = &batchConsole;
+        i->consoleCookie = &run;
+        InitExecution(i);
+        status = b->limit > 0 ? ExecuteFor(i, b->limit) : (ExecStatus)Resume(i);
+        ClosePins(i);
+        ReleaseRegisters(i);
+        AppendBuffer(&run.errors, "", 1);
+
+        if (status == EXEC_EXHAUSTED)
+            c->message = RunMessage("the program didn't halt within the instruction limit%s", "");
+        else if (status != EXEC_HALTED)
+            c->message = RunMessage("%s", run.errors.data && run.errors.data[0] ? run.errors.data : "aborted");
+        else if (c->expectedPath) {
+            for (pos = 0; pos < run.output.size && pos < expected.size && run.output.data[pos] == expected.data[pos]; ++pos)
+                ;
+            if (pos < run.output.size || pos < expected.size) {
+                char detail[64];
+                sprintf(detail, "%lu", (unsigned long)pos);
+                c->message = RunMessage("the output differs from the expected output at byte %s", detail);
+            }
+            else
+                c->passed = TRUE;
+        }
+        else
+            c->passed = TRUE;
+    }
+
+    DeleteLock(&run.lock);
+    MemFree(sys);
+    free(run.input.data);
+    free(run.output.data);
+    free(run.errors.data);
+    free(expected.data);
+}
+
+/* RunMessage - make the message for a case that failed (NULL if there isn't memory for it) */
+static char *RunMessage(const char *fmt, const char *detail)
+{
+    char *message;
+    size_t length;
+
+    if (!(message = (char *)malloc(strlen(fmt) + strlen(detail) + 1)))
+        return NULL;
+    sprintf(message, fmt, detail);
+
+    /* the errors of the run end with a newline */
+    if ((length = strlen(message)) > 0 && message[length - 1] == '\n')
+        message[length - 1] = '\0';
+    return message;
+}
+
+#if defined(WIN32)
+
+static DWORD WINAPI BatchThreadFcn(LPVOID cookie)
+{
+    RunCases((Batch *)cookie);
+    return 0;
+}
+
+/* StartBatchThread - start a thread of the pool */
+static int StartBatchThread(Batch *b, BatchThread *pThread)
+{
+    return (*pThread = CreateThread(NULL, 0, BatchThreadFcn, b, 0, NULL)) != NULL;
+}
+
+/* WaitForBatchThread - wait for a thread of the pool to run out of cases */
+static void WaitForBatchThread(BatchThread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+/* ProcessorCount - get the number of processors */
+static int ProcessorCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+static void *BatchThreadFcn(void *cookie)
+{
+    RunCases((Batch *)cookie);
+    return NULL;
+}
+
+/* StartBatchThread - start a thread of the pool */
+static int StartBatchThread(Batch *b, BatchThread *pThread)
+{
+    return pthread_create(pThread, NULL, BatchThreadFcn, b) == 0;
+}
+
+/* WaitForBatchThread - wait for a thread of the pool to run out of cases */
+static void WaitForBatchThread(BatchThread thread)
+{
+    pthread_join(thread, NULL);
+}
+
+/* ProcessorCount - get the number of processors */
+static int ProcessorCount(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+#endif
+
+/* ReadBuffer - read a whole file into a buffer */
+static int ReadBuffer(const char *path, Buffer *buf)
+{
+    char data[4096];
+    size_t count;
+    FILE *fp;
+    int ok = TRUE;
+
+    if (!(fp = fopen(path, "rb")))
+        return FALSE;
+    while (ok && (count = fread(data, 1, sizeof(data), fp)) > 0)
+        ok = AppendBuffer(buf, data, count);
+    fclose(fp);
+    return ok;
+}
+
+/* AppendBuffer - add data to the end of a buffer */
+static int AppendBuffer(Buffer *buf, const char *data, size_t size)
+{
+    char *newData;
+    size_t newMax;
+
+    if (buf->size + size > buf->max) {
+        for (newMax = buf->max ? buf->max : 256; newMax < buf->size + size; newMax *= 2)
+            ;
+        if (!(newData = (char *)realloc(buf->data, newMax)))
+            return FALSE;
+        buf->data = newData;
+        buf->max = newMax;
+    }
+    memcpy(&buf->data[buf->size], data, size);
+    buf->size += size;
+    return TRUE;
+}
+
+/* BatchGetChar - get the next character of the console input of a run */
+static int BatchGetChar(void *cookie)
+{
+    BatchRun *run = (BatchRun *)cookie;
+    int ch = -1;
+    Lock(&run->lock);
+    if (run->inputPos < run->input.size)
+        ch = (uint8_t)run->input.data[run->inputPos++];
+    Unlock(&run->lock);
+    return ch;
+}
+
+/* BatchWrite - add to the console output of a run (each cog of the run writes from a thread of its own) */
+static void BatchWrite(void *cookie, const char *buf, int size)
+{
+    BatchRun *run = (BatchRun *)cookie;
+    Lock(&run->lock);
+    AppendBuffer(&run->output, buf, size);
+    Unlock(&run->lock);
+}
+
+/* BatchInfo - add a message to the errors of a run */
+static void BatchInfo(System *sys, const char *fmt, va_list ap)
+{
+    BatchError(sys, fmt, ap);
+}
+
+/* BatchError - add a message to the errors of a run */
+static void BatchError(System *sys, const char *fmt, va_list ap)
+{
+    BatchRun *run = (BatchRun *)sys->ops;
+    char text[256];
+    vsnprintf(text, sizeof(text), fmt, ap);
+    Lock(&run->lock);
+    AppendBuffer(&run->errors, text, strlen(text));
+    Unlock(&run->lock);
+}
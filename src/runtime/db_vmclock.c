@@ -0,0 +1,428 @@
+/* db_vmclock.c - estimate the cycles the PASM VM would take to run a program
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * The clock charges each instruction the cycles the hub memory VM in
+ * xbasic_vm.spin spends on it counting four cycles for each PASM instruction
+ * and CYCLES_HUB for each hub access.  Code and data in external memory also
+ * go through a model of the board's cache.  The clock is also the time base of
+ * the CNT register and of the waits in db_vmpins.c.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+#include "db_vmdebug.h"
+
+/* cycles of n PASM instructions h of which access hub memory (a hub access waits half of the 16 cycle hub window on average) */
+#define CYCLES_HUB      16
+#define CYCLES(n, h)    ((n) * 4 + (h) * (CYCLES_HUB - 4))
+
+/* every instruction starts by fetching its opcode and jumping through the dispatch table */
+#define CYCLES_DISPATCH CYCLES(10, 1)
+
+/* a trap stores the VM state and waits while the Spin runtime finds its case and performs it
+   (the work of the string, memory and array traps isn't counted element by element) */
+#define CYCLES_TRAP     2000
+#define CYCLES_TRAP_CASE 150
+
+/* the hub VM reads clkfreq from hub address zero */
+#define DEFAULT_CLKFREQ 80000000
+
+/* external memory accesses in the line the VM used last or the one before it, in another line
+   the cache driver already holds and the default miss penalty for each byte of a line */
+#define CYCLES_LINE_HIT 36
+#define CYCLES_MBOX     150
+#define CYCLES_MISS_BYTE 200
+
+/* cycle estimates */
+struct Clock {
+    uint32_t clkfreq;           /* clock frequency in Hz */
+    uint64_t cycles;            /* cycles since the program started */
+    int cached;                 /* external memory goes through the cache */
+    VMUVALUE lineWidth;         /* number of bits in a cache line offset */
+    VMUVALUE sets;              /* number of sets of cache lines */
+    int ways;                   /* number of lines in each set */
+    int prefetch;               /* a miss also loads the following line */
+    uint32_t missCycles;        /* cycles the cache driver takes to load a line */
+    VMUVALUE *tags;             /* line number + 1 of each cached line or zero (most recently used first) */
+    VMUVALUE line, altLine;     /* the lines the VM used last (line number + 1 or zero) */
+    uint64_t hits;              /* accesses the cache driver found in a line it holds */
+    uint64_t misses;            /* accesses that made the cache driver load a line */
+    ImageSection *section;      /* section that held the last instruction */
+};
+
+static uint32_t InstructionCycles(Interpreter *i, Clock *clock, int op);
+static uint32_t AccessCycles(Clock *clock, VMUVALUE addr);
+static int CachedLine(Clock *clock, VMUVALUE line);
+static int BitLength(uint32_t value);
+
+/* InitClock - initialize the cycle estimates for a board (the hub VM at 80MHz without one) */
+Clock *InitClock(System *sys, BoardConfig *config)
+{
+    VMUVALUE width, lines;
+    Clock *clock;
+
+    if (!(clock = (Clock *)xbGlobalAlloc(sys, sizeof(Clock))))
+        return NULL;
+    memset(clock, 0, sizeof(Clock));
+    clock->clkfreq = config ? config->clkfreq : DEFAULT_CLKFREQ;
+
+    /* the geometry comes from the same settings the cache driver gets */
+    if (config && config->cacheDriver) {
+        width = config->cacheParam2 & 0xff;
+        clock->lineWidth = width ? width : 7;
+        clock->ways = (config->cacheParam2 & CACHE_TWO_WAY) ? 2 : 1;
+        clock->prefetch = (config->cacheParam2 & CACHE_PREFETCH) != 0;
+        lines = config->cacheSize >> clock->lineWidth;
+        if ((clock->sets = lines / clock->ways) == 0)
+            clock->sets = 1;
+        clock->missCycles = config->cacheMissCycles ? config->cacheMissCycles : CYCLES_MISS_BYTE << clock->lineWidth;
+        if (!(clock->tags = (VMUVALUE *)xbGlobalAlloc(sys, clock->sets * clock->ways * sizeof(VMUVALUE))))
+            return NULL;
+        memset(clock->tags, 0, clock->sets * clock->ways * sizeof(VMUVALUE));
+        clock->cached = TRUE;
+    }
+
+    return clock;
+}
+
+/* ClockInstruction - charge the cycles of the instruction at the pc before it executes */
+void ClockInstruction(Interpreter *i)
+{
+    Clock *clock = i->clock;
+    ImageSection *section = clock->section;
+    VMUVALUE addr;
+    int op, len;
+
+    op = VMCODEBYTE(i->pc);
+    clock->cycles += CYCLES_DISPATCH + InstructionCycles(i, clock, op);
+
+    /* fetch the instruction bytes through the cache if the code is in external memory */
+    if (clock->cached) {
+        if (!section || i->pc < section->data || i->pc >= section->data + section->fileSection->size) {
+            for (section = i->image->sections; section < &i->image->sections[i->image->sectionCount]; ++section)
+                if (i->pc >= section->data && i->pc < section->data + section->fileSection->size)
+                    break;
+            if (section >= &i->image->sections[i->image->sectionCount])
+                return;
+            clock->section = section;
+        }
+        addr = section->fileSection->base + (VMUVALUE)(i->pc - section->data);
+        for (len = InstructionLength(InstructionFormat(op)); --len >= 0; )
+            clock->cycles += AccessCycles(clock, addr++);
+    }
+}
+
+/* ClockCycles - get the cycles since the program started (without the clock they are 80MHz cycles of wall clock time) */
+uint64_t ClockCycles(Interpreter *i)
+{
+    if (i->clock)
+        return i->clock->cycles;
+    return (uint64_t)(xbGetMicroseconds() - i->startTime) * (DEFAULT_CLKFREQ / 1000000) + i->skipped;
+}
+
+/* ClockWait - let cycles pass for a wait (without the clock the wait returns at once and CNT skips them) */
+void ClockWait(Interpreter *i, uint64_t cycles)
+{
+    if (i->clock)
+        i->clock->cycles += cycles;
+    else
+        i->skipped += cycles;
+}
+
+/* SetClockCycles - count on from the cycles of an earlier run (CNT continues where a snapshot left it) */
+void SetClockCycles(Interpreter *i, uint64_t cycles)
+{
+    if (i->clock)
+        i->clock->cycles = cycles;
+    else
+        i->skipped = cycles;
+}
+
+/* ClockFrequency - get the clock frequency in Hz */
+uint32_t ClockFrequency(Interpreter *i)
+{
+    return i->clock ? i->clock->clkfreq : DEFAULT_CLKFREQ;
+}
+
+/* ShowClock - show the estimated cycle count and run time */
+void ShowClock(System *sys, Clock *clock)
+{
+    xbInfo(sys, "estimated cycles: %llu (%.6f seconds at %lu Hz)\n",
+           (unsigned long long)clock->cycles,
+           (double)clock->cycles / clock->clkfreq,
+           (unsigned long)clock->clkfreq);
+    if (clock->cached)
+        xbInfo(sys, "estimated cache: %llu hits, %llu misses (%lu byte lines, %lu sets of %d)\n",
+               (unsigned long long)clock->hits,
+               (unsigned long long)clock->misses,
+               1ul << clock->lineWidth,
+               (unsigned long)clock->sets,
+               clock->ways);
+}
+
+/* InstructionCycles - get the cycles an instruction takes after the dispatch */
+static uint32_t InstructionCycles(Interpreter *i, Clock *clock, int op)
+{
+    uint32_t cycles = 0;
+    uint8_t *p = i->pc + 1;
+    VMUVALUE addr;
+    VMVALUE a, b;
+    int cnt;
+
+    switch (op) {
+    case OP_HALT:
+        break;
+    case OP_BRT:
+    case OP_BRF:
+        if ((i->tos != 0) == (op == OP_BRT))
+            cycles = CYCLES(34, 5);
+        else
+            cycles = CYCLES(8, 1);
+        break;
+    case OP_BRTSC:
+    case OP_BRFSC:
+        if ((i->tos != 0) == (op == OP_BRTSC))
+            cycles = CYCLES(33, 4);
+        else
+            cycles = CYCLES(7, 1);
+        break;
+    case OP_BR:
+        cycles = CYCLES(32, 4);
+        break;
+    case OP_BRLT:
+    case OP_BRLE:
+    case OP_BREQ:
+    case OP_BRNE:
+    case OP_BRGE:
+    case OP_BRGT:
+    case OP_BRLTZ:
+    case OP_BRLEZ:
+    case OP_BRGEZ:
+    case OP_BRGTZ:
+        /* the VM stops and the Spin runtime performs them after checking for the word opcodes and breakpoints */
+        cycles = CYCLES_TRAP + CYCLES_TRAP_CASE * 3;
+        break;
+    case OP_BR8:
+        cycles = CYCLES(14, 1);
+        break;
+    case OP_BR16:
+        cycles = CYCLES(27, 2);
+        break;
+    case OP_NOT:
+    case OP_BNOT:
+        cycles = CYCLES(3, 0);
+        break;
+    case OP_NEG:
+        cycles = CYCLES(2, 0);
+        break;
+    case OP_ADD:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+        cycles = CYCLES(6, 1);
+        break;
+    case OP_SUB:
+        cycles = CYCLES(7, 1);
+        break;
+    case OP_MUL:
+        /* the multiply loop shifts out the bits of the smaller operand */
+        a = i->tos < 0 ? -i->tos : i->tos;
+        b = Top(i) < 0 ? -Top(i) : Top(i);
+        cnt = BitLength((uint32_t)(a < b ? a : b));
+        cycles = CYCLES(13 + 4 * (cnt ? cnt : 1), 1);
+        break;
+    case OP_DIV:
+    case OP_REM:
+        /* the divide loops run once for each leading zero of the divisor and once more */
+        cnt = 33 - BitLength((uint32_t)(i->tos < 0 ? -i->tos : i->tos));
+        cycles = CYCLES(20 + 6 * cnt, 1);
+        break;
+    case OP_SHL:
+    case OP_SHR:
+        cycles = CYCLES(8, 1);
+        break;
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+        cycles = CYCLES(9, 1);
+        break;
+    case OP_LIT:
+        cycles = CYCLES(36, 5);
+        break;
+    case OP_SLIT:
+        cycles = CYCLES(17, 2);
+        break;
+    case OP_LIT16:
+        cycles = CYCLES(31, 3);
+        break;
+    case OP_LOAD:
+        cycles = CYCLES(10, 1) + AccessCycles(clock, i->tos);
+        break;
+    case OP_LOADB:
+        cycles = CYCLES(8, 1) + AccessCycles(clock, i->tos);
+        break;
+    case OP_LOADW:
+        cycles = CYCLES(7, 1) + AccessCycles(clock, i->tos);
+        break;
+    case OP_STORE:
+        cycles = CYCLES(17, 3) + AccessCycles(clock, i->tos);
+        break;
+    case OP_STOREB:
+    case OP_STOREW:
+        cycles = CYCLES(14, 3) + AccessCycles(clock, i->tos);
+        break;
+    case OP_LOADX:
+        cycles = CYCLES(16, 2) + AccessCycles(clock, Top(i) + i->tos * sizeof(VMVALUE));
+        break;
+    case OP_STOREX:
+        cycles = CYCLES(23, 4) + AccessCycles(clock, Top(i) + i->tos * sizeof(VMVALUE));
+        break;
+    case OP_CHECK:
+        /* the Spin runtime performs them after checking for the other opcodes it emulates */
+        cycles = CYCLES_TRAP + CYCLES_TRAP_CASE * 4;
+        break;
+    case OP_VREF:
+    case OP_VSET:
+        cycles = CYCLES_TRAP + CYCLES_TRAP_CASE * 4 + AccessCycles(clock, Top(i) + i->tos * sizeof(VMVALUE));
+        break;
+    case OP_LOADA:
+    case OP_STOREA:
+    case OP_FORLOOPA:
+        for (addr = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+            addr = (addr << 8) | VMCODEBYTE(p++);
+        cycles = AccessCycles(clock, addr);
+        if (op == OP_LOADA)
+            cycles += CYCLES(44, 6);
+        else if (op == OP_STOREA)
+            cycles += CYCLES(41, 6);
+        else
+            cycles += CYCLES(93, 12);   /* loop branches are counted as taken */
+        break;
+    case OP_GREF:
+        cycles = CYCLES(21, 3);
+        break;
+    case OP_GREF16:
+        cycles = CYCLES(36, 4);
+        break;
+    case OP_GSET:
+        cycles = CYCLES(19, 3);
+        break;
+    case OP_GSET16:
+        cycles = CYCLES(35, 4);
+        break;
+    case OP_LREF:
+        cycles = CYCLES(17, 3);
+        break;
+    case OP_LSET:
+        cycles = CYCLES(16, 3);
+        break;
+    case OP_LINC:
+        cycles = CYCLES(28, 4);
+        break;
+    case OP_FORLOOP:
+        cycles = CYCLES(64, 9);         /* loop branches are counted as taken */
+        break;
+    case OP_INDEX:
+        cycles = CYCLES(7, 1);
+        break;
+    case OP_CALL:
+        cycles = CYCLES(38, 5);
+        break;
+    case OP_PUSHJ:
+        cycles = CYCLES(4, 0);
+        break;
+    case OP_POPJ:
+        cycles = CYCLES(5, 1);
+        break;
+    case OP_CLEAN:
+        cycles = CYCLES(9, 1);
+        break;
+    case OP_FRAME:
+        cycles = CYCLES(25, 3);
+        break;
+    case OP_RETURN:
+        cycles = CYCLES(7, 2);
+        break;
+    case OP_RETURNZ:
+        cycles = CYCLES(12, 3);
+        break;
+    case OP_RET:
+        cycles = CYCLES(14, 3);
+        break;
+    case OP_DROP:
+        cycles = CYCLES(3, 1);
+        break;
+    case OP_DUP:
+        cycles = CYCLES(5, 1);
+        break;
+    case OP_SWITCH:
+        cycles = CYCLES(15, 2);
+        break;
+    case OP_NATIVE:
+        cycles = CYCLES(37, 4);         /* the waits add their own cycles when they execute */
+        break;
+    case OP_TRAP:
+        cycles = CYCLES(18, 7) + CYCLES_TRAP + CYCLES_TRAP_CASE * VMCODEBYTE(p);
+        break;
+    }
+
+    return cycles;
+}
+
+/* AccessCycles - get the cycles of an access to a byte or long (only external memory costs extra) */
+static uint32_t AccessCycles(Clock *clock, VMUVALUE addr)
+{
+    VMUVALUE line;
+
+    if (!clock->cached || addr < RAM_BASE)
+        return 0;
+
+    /* the VM looks in the last two lines it used itself before asking the cache driver */
+    line = (addr >> clock->lineWidth) + 1;
+    if (line == clock->line || line == clock->altLine)
+        return CYCLES_LINE_HIT;
+    clock->altLine = clock->line;
+    clock->line = line;
+
+    if (CachedLine(clock, line)) {
+        ++clock->hits;
+        return CYCLES_LINE_HIT + CYCLES_MBOX;
+    }
+    ++clock->misses;
+    if (clock->prefetch)
+        CachedLine(clock, line + 1);
+    return CYCLES_LINE_HIT + CYCLES_MBOX + clock->missCycles;
+}
+
+/* CachedLine - look up a line in the cache loading it if it isn't there (returns TRUE if it was) */
+static int CachedLine(Clock *clock, VMUVALUE line)
+{
+    VMUVALUE *set = &clock->tags[((line - 1) % clock->sets) * clock->ways];
+    int j;
+
+    /* the least recently used way of the set gets the line */
+    for (j = 0; j < clock->ways - 1 && set[j] != line; ++j)
+        ;
+    memmove(&set[1], &set[0], j * sizeof(VMUVALUE));
+    if (set[j] == line) {
+        set[0] = line;
+        return TRUE;
+    }
+    set[0] = line;
+    return FALSE;
+}
+
+/* BitLength - get the number of bits in an unsigned value */
+static int BitLength(uint32_t value)
+{
+    int cnt;
+    for (cnt = 0; value != 0; value >>= 1)
+        ++cnt;
+    return cnt;
+}
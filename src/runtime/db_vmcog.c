@@ -0,0 +1,276 @@
+/* db_vmcog.c - cogs and locks for the interpreter
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Each cog started by COGSTART runs in a thread of its own with an interpreter
+ * that shares the image with the cog that started it.  Its stack is the COGSTART
+ * stack array so the cogs see each other's globals just as they would in hub
+ * memory.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* number of cogs that can be started (cog 0 runs the main code) and number of locks */
+#define MAX_COGS    7
+#define MAX_LOCKS   8
+
+/* cog states */
+#define COG_FREE    0
+#define COG_RUNNING 1
+#define COG_HALTED  2   /* halted but its thread hasn't been waited for */
+#define COG_WAITING 3   /* running with WaitForCogs waiting for its thread */
+
+#if defined(WIN32)
+typedef HANDLE CogThread;
+#define LockCogs(t)     EnterCriticalSection(&(t)->lock)
+#define UnlockCogs(t)   LeaveCriticalSection(&(t)->lock)
+#else
+typedef pthread_t CogThread;
+#define LockCogs(t)     pthread_mutex_lock(&(t)->lock)
+#define UnlockCogs(t)   pthread_mutex_unlock(&(t)->lock)
+#endif
+
+/* cogs and locks shared by every cog */
+struct CogTable {
+#if defined(WIN32)
+    CRITICAL_SECTION lock;      /* lock for everything else in the table */
+#else
+    pthread_mutex_t lock;       /* lock for everything else in the table */
+#endif
+    int state[MAX_COGS];        /* state of each cog */
+    CogThread thread[MAX_COGS]; /* thread running each cog that isn't free */
+    Interpreter cog[MAX_COGS];  /* interpreter for each cog */
+    int allocated[MAX_LOCKS];   /* locks handed out by LOCKNEW */
+    int set[MAX_LOCKS];         /* locks that are set */
+};
+
+static CogTable *GetCogTable(Interpreter *i);
+static VMVALUE StartCog(Interpreter *i, VMUVALUE code, VMUVALUE exit, VMUVALUE stack, VMVALUE first);
+static void RunCog(Interpreter *i);
+static int StartCogThread(Interpreter *i, CogThread *pThread);
+static void WaitForCogThread(CogThread thread);
+
+/* DoCogTrap - execute one of the cog or lock traps */
+void DoCogTrap(Interpreter *i, int op)
+{
+    CogTable *table = GetCogTable(i);
+    VMUVALUE code, exit, stack;
+    VMVALUE first;
+    int j;
+
+    switch (op) {
+    case TRAP_COGSTART:
+        first = i->tos;
+        stack = (VMUVALUE)Pop(i);
+        exit = (VMUVALUE)Pop(i);
+        code = (VMUVALUE)Pop(i);
+        i->tos = StartCog(i, code, exit, stack, first);
+        break;
+    case TRAP_LOCKNEW:
+        Push(i, i->tos);
+        LockCogs(table);
+        for (j = 0; j < MAX_LOCKS && table->allocated[j]; ++j)
+            ;
+        if (j < MAX_LOCKS) {
+            table->allocated[j] = TRUE;
+            i->tos = j;
+        }
+        else
+            i->tos = -1;
+        UnlockCogs(table);
+        break;
+    case TRAP_LOCKRET:
+        LockCogs(table);
+        table->allocated[i->tos & (MAX_LOCKS - 1)] = FALSE;
+        UnlockCogs(table);
+        i->tos = Pop(i);
+        break;
+    case TRAP_LOCKSET:
+    case TRAP_LOCKCLR:
+        j = i->tos & (MAX_LOCKS - 1);
+        LockCogs(table);
+        i->tos = table->set[j];
+        table->set[j] = (op == TRAP_LOCKSET);
+        UnlockCogs(table);
+        break;
+    }
+}
+
+/* WaitForCogs - wait for every cog to halt */
+void WaitForCogs(Interpreter *i)
+{
+    CogTable *table = i->cogs;
+    CogThread thread;
+    int j, busy;
+
+    /* cogs can start more cogs so keep waiting until none are left */
+    do {
+        busy = FALSE;
+        for (j = 0; j < MAX_COGS; ++j) {
+            LockCogs(table);
+            if (table->state[j] == COG_HALTED) {
+                WaitForCogThread(table->thread[j]);
+                table->state[j] = COG_FREE;
+                busy = TRUE;
+            }
+            else if (table->state[j] == COG_RUNNING) {
+                table->state[j] = COG_WAITING;
+                thread = table->thread[j];
+                UnlockCogs(table);
+                WaitForCogThread(thread);
+                LockCogs(table);
+                table->state[j] = COG_FREE;
+                busy = TRUE;
+            }
+            UnlockCogs(table);
+        }
+    } while (busy);
+}
+
+/* GetCogTable - get the table shared by every cog (the first cog trap creates it) */
+static CogTable *GetCogTable(Interpreter *i)
+{
+    if (!i->cogs) {
+        if (!(i->cogs = (CogTable *)malloc(sizeof(CogTable))))
+            Abort(i, "insufficient memory");
+        memset(i->cogs, 0, sizeof(CogTable));
+#if defined(WIN32)
+        InitializeCriticalSection(&i->cogs->lock);
+#else
+        pthread_mutex_init(&i->cogs->lock, NULL);
+#endif
+    }
+    return i->cogs;
+}
+
+/* StartCog - start a cog calling the function at code with its arguments at the end of the stack array
+   (returns the cog id or -1 if no cog is free) */
+static VMVALUE StartCog(Interpreter *i, VMUVALUE code, VMUVALUE exit, VMUVALUE stack, VMVALUE first)
+{
+    CogTable *table = i->cogs;
+    uint8_t *pc, *ret;
+    VMVALUE *base;
+    Interpreter *cog;
+    int j;
+
+    /* the stack must hold the reserved longs and the arguments */
+    if (first <= COG_RESERVED)
+        return -1;
+    base = (VMVALUE *)MapBytes(i, stack, first * sizeof(VMVALUE));
+    pc = MapBytes(i, code, 1);
+    ret = MapBytes(i, exit, 1);
+
+    /* find a free cog (the thread of one that has halted is done with the table) */
+    LockCogs(table);
+    for (j = 0; j < MAX_COGS && table->state[j] != COG_FREE && table->state[j] != COG_HALTED; ++j)
+        ;
+    if (j >= MAX_COGS) {
+        UnlockCogs(table);
+        return -1;
+    }
+    if (table->state[j] == COG_HALTED)
+        WaitForCogThread(table->thread[j]);
+
+    /* setup the interpreter as though the exit function had just called the function */
+    cog = &table->cog[j];
+    *cog = *i;
+    cog->profile = NULL;
+    cog->tasks = NULL;
+    cog->clock = NULL;
+    cog->snapshot = NULL;
+    cog->ioLog = NULL;
+    cog->budgeted = FALSE;
+    cog->cogId = j + 1;
+    cog->registers = NULL;
+    cog->stack = base + COG_RESERVED;
+    cog->stackTop = base + first;
+    cog->sp = cog->fp = cog->stackTop;
+    cog->pc = pc;
+    cog->tos = (VMVALUE)(ret - i->codeBase);
+    cog->linePos = 0;
+    cog->outputCount = 0;
+
+    /* decoded and translated code is bound by the cog that builds it so the other cogs use the threaded engine */
+    cog->checkAddresses = TRUE;
+    if (i->profile || i->clock || i->engine == ENGINE_SWITCH)
+        cog->engine = ENGINE_SWITCH;
+    else
+        cog->engine = ENGINE_THREADED;
+
+    /* start the thread */
+    if (!StartCogThread(cog, &table->thread[j])) {
+        table->state[j] = COG_FREE;
+        UnlockCogs(table);
+        return -1;
+    }
+    table->state[j] = COG_RUNNING;
+    UnlockCogs(table);
+
+    /* cog 0 runs the main code */
+    return j + 1;
+}
+
+/* RunCog - run a cog until it halts */
+static void RunCog(Interpreter *i)
+{
+    CogTable *table = i->cogs;
+    int j = i - table->cog;
+    ExecuteCode(i);
+    ReleaseRegisters(i);
+    LockCogs(table);
+    if (table->state[j] == COG_RUNNING)
+        table->state[j] = COG_HALTED;
+    UnlockCogs(table);
+}
+
+#if defined(WIN32)
+
+static DWORD WINAPI CogThreadFcn(LPVOID cookie)
+{
+    RunCog((Interpreter *)cookie);
+    return 0;
+}
+
+/* StartCogThread - start the thread for a cog */
+static int StartCogThread(Interpreter *i, CogThread *pThread)
+{
+    return (*pThread = CreateThread(NULL, 0, CogThreadFcn, i, 0, NULL)) != NULL;
+}
+
+/* WaitForCogThread - wait for the thread of a cog to finish */
+static void WaitForCogThread(CogThread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#else
+
+static void *CogThreadFcn(void *cookie)
+{
+    RunCog((Interpreter *)cookie);
+    return NULL;
+}
+
+/* StartCogThread - start the thread for a cog */
+static int StartCogThread(Interpreter *i, CogThread *pThread)
+{
+    return pthread_create(pThread, NULL, CogThreadFcn, i) == 0;
+}
+
+/* WaitForCogThread - wait for the thread of a cog to finish */
+static void WaitForCogThread(CogThread thread)
+{
+    pthread_join(thread, NULL);
+}
+
+#endif
@@ -46,7 +46,7 @@ FLASH_SPACE OTDEF OpcodeTable[] = {
 { OP_INDEX,     "INDEX",    FMT_NONE    },
 { OP_PUSHJ,     "PUSHJ",    FMT_NONE    },
 { OP_POPJ,      "POPJ",     FMT_NONE    },
-{ OP_FRAME,     "FRAME",    FMT_BYTE    },
+{ OP_FRAME,     "FRAME",    FMT_BYTE2   },
 { OP_RETURN,    "RETURN",   FMT_NONE    },
 { OP_RETURNZ,   "RETURNZ",  FMT_NONE    },
 { OP_CLEAN,     "CLEAN",    FMT_BYTE    },
@@ -54,10 +54,78 @@ FLASH_SPACE OTDEF OpcodeTable[] = {
 { OP_DUP,       "DUP",      FMT_NONE    },
 { OP_NATIVE,    "NATIVE",   FMT_NATIVE  },
 { OP_TRAP,      "TRAP",     FMT_BYTE    },
+{ OP_LINC,      "LINC",     FMT_SBYTE2  },
+{ OP_LOADA,     "LOADA",    FMT_WORD    },
+{ OP_STOREA,    "STOREA",   FMT_WORD    },
+{ OP_LOADX,     "LOADX",    FMT_NONE    },
+{ OP_STOREX,    "STOREX",   FMT_NONE    },
+{ OP_BR8,       "BR8",      FMT_BR8     },
+{ OP_BR16,      "BR16",     FMT_BR16    },
+{ OP_LIT16,     "LIT16",    FMT_HWORD   },
+{ OP_SWITCH,    "SWITCH",   FMT_BYTE    },
+{ OP_FORLOOP,   "FORLOOP",  FMT_LOOP    },
+{ OP_FORLOOPA,  "FORLOOPA", FMT_LOOPA   },
+{ OP_GREF,      "GREF",     FMT_BYTE    },
+{ OP_GSET,      "GSET",     FMT_BYTE    },
+{ OP_GREF16,    "GREF16",   FMT_HWORD   },
+{ OP_GSET16,    "GSET16",   FMT_HWORD   },
+{ OP_CALL,      "CALL",     FMT_WORD    },
+{ OP_RET,       "RET",      FMT_BYTE    },
+{ OP_LOADW,     "LOADW",    FMT_NONE    },
+{ OP_STOREW,    "STOREW",   FMT_NONE    },
+{ OP_BRLT,      "BRLT",     FMT_BR      },
+{ OP_BRLE,      "BRLE",     FMT_BR      },
+{ OP_BREQ,      "BREQ",     FMT_BR      },
+{ OP_BRNE,      "BRNE",     FMT_BR      },
+{ OP_BRGE,      "BRGE",     FMT_BR      },
+{ OP_BRGT,      "BRGT",     FMT_BR      },
+{ OP_BRLTZ,     "BRLTZ",    FMT_BR      },
+{ OP_BRLEZ,     "BRLEZ",    FMT_BR      },
+{ OP_BRGEZ,     "BRGEZ",    FMT_BR      },
+{ OP_BRGTZ,     "BRGTZ",    FMT_BR      },
+{ OP_CHECK,     "CHECK",    FMT_WORD    },
+{ OP_VREF,      "VREF",     FMT_WORD    },
+{ OP_VSET,      "VSET",     FMT_WORD    },
 { OP_RETURN,    "RETURNX",  FMT_NONE    },  // RETURN is an xbasic keyword
 { 0,            NULL,       0           }
 };
 
+/* InstructionFormat - get the operand format of an instruction (-1 if undefined) */
+int InstructionFormat(int opcode)
+{
+    FLASH_SPACE OTDEF *op;
+    for (op = OpcodeTable; op->name; ++op)
+        if (opcode == op->code)
+            return op->fmt;
+    return -1;
+}
+
+/* InstructionLength - get the length of an instruction with a given operand format */
+int InstructionLength(int fmt)
+{
+    switch (fmt) {
+    case FMT_BYTE:
+    case FMT_SBYTE:
+    case FMT_BR8:
+        return 2;
+    case FMT_SBYTE2:
+    case FMT_BYTE2:
+    case FMT_BR16:
+    case FMT_HWORD:
+        return 3;
+    case FMT_WORD:
+    case FMT_NATIVE:
+    case FMT_BR:
+        return 1 + sizeof(VMVALUE);
+    case FMT_LOOP:
+        return 3 + sizeof(VMVALUE);
+    case FMT_LOOPA:
+        return 2 + sizeof(VMVALUE) * 2;
+    default:
+        return 1;
+    }
+}
+
 /* DecodeFunction - decode the instructions in a function code object */
 void DecodeFunction(System *sys, VMUVALUE base, const uint8_t *code, int len)
 {
@@ -75,7 +143,7 @@ int DecodeInstruction(System *sys, VMUVALUE addr, const uint8_t *lc)
     uint8_t opcode, bytes[sizeof(VMVALUE)];
     FLASH_SPACE OTDEF *op;
     VMVALUE offset = 0;
-    int8_t sbyte;
+    int8_t sbyte, sbyte2;
     int n, i;
 
     /* get the opcode */
@@ -110,6 +178,24 @@ int DecodeInstruction(System *sys, VMUVALUE addr, const uint8_t *lc)
                 xbInfo(sys, "%s %d\n", op->name, sbyte);
                 n += 1;
                 break;
+            case FMT_SBYTE2:
+                sbyte = (int8_t)VMCODEBYTE(lc + 1);
+                sbyte2 = (int8_t)VMCODEBYTE(lc + 2);
+                xbInfo(sys, "%02x %02x ", (uint8_t)sbyte, (uint8_t)sbyte2);
+                for (i = 2; i < sizeof(VMVALUE); ++i)
+                    xbInfo(sys, "   ");
+                xbInfo(sys, "%s %d, %d\n", op->name, sbyte, sbyte2);
+                n += 2;
+                break;
+            case FMT_BYTE2:
+                bytes[0] = VMCODEBYTE(lc + 1);
+                bytes[1] = VMCODEBYTE(lc + 2);
+                xbInfo(sys, "%02x %02x ", bytes[0], bytes[1]);
+                for (i = 2; i < sizeof(VMVALUE); ++i)
+                    xbInfo(sys, "   ");
+                xbInfo(sys, "%s %d, %d\n", op->name, bytes[0], bytes[1]);
+                n += 2;
+                break;
             case FMT_WORD:
             case FMT_NATIVE:
                 for (i = 0; i < sizeof(VMVALUE); ++i) {
@@ -134,6 +220,44 @@ int DecodeInstruction(System *sys, VMUVALUE addr, const uint8_t *lc)
                 xbInfo(sys, " # %04x\n", addr + 1 + sizeof(VMVALUE) + offset);
                 n += sizeof(VMVALUE);
                 break;
+            case FMT_BR8:
+                sbyte = (int8_t)VMCODEBYTE(lc + 1);
+                xbInfo(sys, "%02x ", (uint8_t)sbyte);
+                for (i = 1; i < sizeof(VMVALUE); ++i)
+                    xbInfo(sys, "   ");
+                xbInfo(sys, "%s %02x # %04x\n", op->name, (uint8_t)sbyte, addr + 2 + sbyte);
+                n += 1;
+                break;
+            case FMT_BR16:
+            case FMT_HWORD:
+                bytes[0] = VMCODEBYTE(lc + 1);
+                bytes[1] = VMCODEBYTE(lc + 2);
+                offset = (int16_t)((bytes[0] << 8) | bytes[1]);
+                xbInfo(sys, "%02x %02x ", bytes[0], bytes[1]);
+                for (i = 2; i < sizeof(VMVALUE); ++i)
+                    xbInfo(sys, "   ");
+                if (op->fmt == FMT_BR16)
+                    xbInfo(sys, "%s %02x%02x # %04x\n", op->name, bytes[0], bytes[1], addr + 3 + offset);
+                else
+                    xbInfo(sys, "%s %d\n", op->name, offset);
+                n += 2;
+                break;
+            case FMT_LOOP:
+            case FMT_LOOPA:
+                n = InstructionLength(op->fmt);
+                for (i = 1; i < n; ++i)
+                    xbInfo(sys, "%02x ", VMCODEBYTE(lc + i));
+                xbInfo(sys, "%s ", op->name);
+                if (op->fmt == FMT_LOOP)
+                    xbInfo(sys, "%d", (int8_t)VMCODEBYTE(lc + 1));
+                else {
+                    for (i = 1; i <= sizeof(VMVALUE); ++i)
+                        xbInfo(sys, "%02x", VMCODEBYTE(lc + i));
+                }
+                for (i = n - sizeof(VMVALUE); i < n; ++i)
+                    offset = (offset << 8) | VMCODEBYTE(lc + i);
+                xbInfo(sys, ", %d # %04x\n", (int8_t)VMCODEBYTE(lc + n - sizeof(VMVALUE) - 1), addr + n + offset);
+                break;
             }
             return n;
         }
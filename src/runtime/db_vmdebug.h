@@ -11,6 +11,19 @@
 #define FMT_WORD        3
 #define FMT_NATIVE      4
 #define FMT_BR          5
+#define FMT_SBYTE2      6
+#define FMT_BR8         7
+#define FMT_BR16        8
+#define FMT_HWORD       9
+#define FMT_LOOP        10
+#define FMT_LOOPA       11
+#define FMT_BYTE2       12
+
+/* check for a branch instruction format */
+#define IsBranchFormat(fmt) ((fmt) == FMT_BR || (fmt) == FMT_BR8 || (fmt) == FMT_BR16)
+
+/* check for a loop instruction format (the last operand is a long branch displacement) */
+#define IsLoopFormat(fmt)   ((fmt) == FMT_LOOP || (fmt) == FMT_LOOPA)
 
 typedef struct {
     int code;
@@ -20,6 +33,8 @@ typedef struct {
 
 extern FLASH_SPACE OTDEF OpcodeTable[];
 
+int InstructionFormat(int opcode);
+int InstructionLength(int fmt);
 void DecodeFunction(System *sys, VMUVALUE base, const uint8_t *code, int len);
 int DecodeInstruction(System *sys, VMUVALUE addr, const uint8_t *lc);
 
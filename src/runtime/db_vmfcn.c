@@ -31,3 +31,223 @@ static void fcn_rnd(Interpreter *i)
 {
     i->tos = rand() % Pop(i);
 }
+
+/* largest element count or index accepted by the array traps */
+#define MAX_ELEMENTS    ((VMVALUE)(0x7fffffff / sizeof(VMVALUE)))
+
+static void PopArguments(Interpreter *i, VMVALUE *args, int count);
+static VMVALUE *MapArray(Interpreter *i, VMVALUE addr, VMVALUE start, VMVALUE count);
+static void Butterflies(Interpreter *i, VMVALUE *args);
+static float ValueToFloat(VMVALUE value);
+static VMVALUE FloatToValue(float f);
+static VMVALUE FloatToInteger(VMVALUE value);
+static VMVALUE FloatOrder(VMVALUE value);
+
+/* DoArrayTrap - execute one of the array kernel traps */
+void DoArrayTrap(Interpreter *i, int op)
+{
+    VMVALUE args[6], *a, *b, result = 0;
+    int j;
+
+    switch (op) {
+    case TRAP_ARRFILL:
+        PopArguments(i, args, 4);
+        a = MapArray(i, args[0], args[1], args[2]);
+        for (j = 0; j < args[2]; ++j)
+            a[j] = args[3];
+        return;
+    case TRAP_ARRCOPY:
+        PopArguments(i, args, 4);
+        a = MapArray(i, args[0], args[2], args[3]);
+        b = MapArray(i, args[1], args[2], args[3]);
+        memmove(a, b, args[3] * sizeof(VMVALUE));
+        return;
+    case TRAP_ARRADD:
+        PopArguments(i, args, 4);
+        a = MapArray(i, args[0], args[2], args[3]);
+        b = MapArray(i, args[1], args[2], args[3]);
+        for (j = 0; j < args[3]; ++j)
+            a[j] += b[j];
+        return;
+    case TRAP_ARRMAC:
+        PopArguments(i, args, 5);
+        a = MapArray(i, args[0], args[2], args[3]);
+        b = MapArray(i, args[1], args[2], args[3]);
+        for (j = 0; j < args[3]; ++j)
+            a[j] += b[j] * args[4];
+        return;
+    case TRAP_ARRSCALE:
+        PopArguments(i, args, 5);
+        a = MapArray(i, args[0], args[1], args[2]);
+        for (j = 0; j < args[2]; ++j)
+            a[j] = (a[j] * args[3]) >> args[4];
+        return;
+    case TRAP_ARRSUM:
+        PopArguments(i, args, 3);
+        a = MapArray(i, args[0], args[1], args[2]);
+        for (j = 0; j < args[2]; ++j)
+            result += a[j];
+        break;
+    case TRAP_ARRDOT:
+        PopArguments(i, args, 4);
+        a = MapArray(i, args[0], args[2], args[3]);
+        b = MapArray(i, args[1], args[2], args[3]);
+        for (j = 0; j < args[3]; ++j)
+            result += a[j] * b[j];
+        break;
+    case TRAP_ARRMIN:
+    case TRAP_ARRMAX:
+        PopArguments(i, args, 3);
+        a = MapArray(i, args[0], args[1], args[2]);
+        if (args[2] > 0) {
+            result = a[0];
+            for (j = 1; j < args[2]; ++j)
+                if (op == TRAP_ARRMIN ? a[j] < result : a[j] > result)
+                    result = a[j];
+        }
+        break;
+    case TRAP_BUTTERFLY:
+        PopArguments(i, args, 6);
+        Butterflies(i, args);
+        return;
+    default:
+        Abort(i, "undefined array trap 0x%02x", op);
+        return;
+    }
+
+    /* replace the arguments with the result */
+    Push(i, i->tos);
+    i->tos = result;
+}
+
+/* PopArguments - pop the arguments of a trap into args in the order they were pushed */
+static void PopArguments(Interpreter *i, VMVALUE *args, int count)
+{
+    while (--count >= 0) {
+        args[count] = i->tos;
+        i->tos = Pop(i);
+    }
+}
+
+/* MapArray - map count elements of an array beginning at element start */
+static VMVALUE *MapArray(Interpreter *i, VMVALUE addr, VMVALUE start, VMVALUE count)
+{
+    if (start < 0 || start > MAX_ELEMENTS || count < 0 || count > MAX_ELEMENTS)
+        Abort(i, "array range error");
+    return (VMVALUE *)MapBytes(i, (VMUVALUE)addr + (VMUVALUE)start * sizeof(VMVALUE), count * sizeof(VMVALUE));
+}
+
+/* Butterflies - apply the radix-2 FFT butterflies to time decimated samples
+   (this is the loop in FFT_bfly in samples/fft/fft.bas) */
+static void Butterflies(Interpreter *i, VMVALUE *args)
+{
+    VMVALUE *bx, *by, *wx, *wy, a, b, c, d, k1, k2, k3, tx, ty;
+    VMVALUE log2n = args[4], shift = args[5];
+    VMVALUE size, span, flight, k, b0, b1, w, wSkip;
+
+    if (log2n < 1 || log2n > 24)
+        Abort(i, "bad FFT size");
+    size = (VMVALUE)1 << log2n;
+    bx = MapArray(i, args[0], 0, size);
+    by = MapArray(i, args[1], 0, size);
+    wx = MapArray(i, args[2], 0, size >> 1);
+    wy = MapArray(i, args[3], 0, size >> 1);
+
+    /* each level has twice as many butterflies per flight and half as many flights */
+    for (span = 1, wSkip = size >> 1; span < size; span <<= 1, wSkip >>= 1) {
+        for (flight = 0; flight < size; flight += span << 1) {
+            for (k = 0, w = 0; k < span; ++k, w += wSkip) {
+                b0 = flight + k;
+                b1 = b0 + span;
+                a = bx[b1];
+                b = by[b1];
+                c = wx[w];
+                d = wy[w];
+                k1 = (a * (c + d)) >> shift;
+                k2 = (d * (a + b)) >> shift;
+                k3 = (c * (b - a)) >> shift;
+                tx = k1 - k2;
+                ty = k1 + k3;
+                k1 = bx[b0];
+                k2 = by[b0];
+                bx[b1] = k1 - tx;
+                by[b1] = k2 - ty;
+                bx[b0] = k1 + tx;
+                by[b0] = k2 + ty;
+            }
+        }
+    }
+}
+
+/* DoFloatTrap - execute one of the IEEE single precision float traps */
+void DoFloatTrap(Interpreter *i, int op)
+{
+    VMVALUE a, b;
+
+    /* handle the conversions */
+    switch (op) {
+    case TRAP_ITOF:
+        i->tos = FloatToValue((float)i->tos);
+        return;
+    case TRAP_FTOI:
+        i->tos = FloatToInteger(i->tos);
+        return;
+    }
+
+    /* the remaining traps have two operands */
+    b = i->tos;
+    a = Pop(i);
+    switch (op) {
+    case TRAP_FADD:
+        i->tos = FloatToValue(ValueToFloat(a) + ValueToFloat(b));
+        break;
+    case TRAP_FSUB:
+        i->tos = FloatToValue(ValueToFloat(a) - ValueToFloat(b));
+        break;
+    case TRAP_FMUL:
+        i->tos = FloatToValue(ValueToFloat(a) * ValueToFloat(b));
+        break;
+    case TRAP_FDIV:
+        i->tos = FloatToValue(ValueToFloat(a) / ValueToFloat(b));
+        break;
+    case TRAP_FCMP:
+        a = FloatOrder(a);
+        b = FloatOrder(b);
+        i->tos = (a < b ? -1 : a > b ? 1 : 0);
+        break;
+    default:
+        Abort(i, "undefined float trap 0x%02x", op);
+        break;
+    }
+}
+
+/* ValueToFloat - get the float stored in a value */
+static float ValueToFloat(VMVALUE value)
+{
+    float f;
+    memcpy(&f, &value, sizeof(f));
+    return f;
+}
+
+/* FloatToValue - store a float in a value */
+static VMVALUE FloatToValue(float f)
+{
+    VMVALUE value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+/* FloatToInteger - convert a float to an integer truncating toward zero (out of range values saturate like the float cog) */
+static VMVALUE FloatToInteger(VMVALUE value)
+{
+    float f = ValueToFloat(value);
+    if (f != f || f >= 2147483648.0f || f <= -2147483648.0f)
+        return value < 0 ? -0x7fffffff : 0x7fffffff;
+    return (VMVALUE)f;
+}
+
+/* FloatOrder - map a float to an integer with the same ordering (both zeros map to zero) */
+static VMVALUE FloatOrder(VMVALUE value)
+{
+    return value < 0 ? -(value & 0x7fffffff) : value;
+}
@@ -10,8 +10,119 @@
 #include "db_vmdebug.h"
 #include "db_vm.h"
 
+/* map image files into memory instead of reading them on systems that support it */
+#if defined(LINUX) || defined(MACOSX) || defined(CYGWIN)
+#define USE_MAPPED_IMAGES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* prototypes for local functions */
+#ifdef USE_MAPPED_IMAGES
+static ImageHdr *MapImage(System *sys, const char *name);
+#endif
+static ImageHdr *ReadImage(System *sys, const char *name);
+static ImageHdr *NewImage(System *sys, ImageFileHdr *fileHdr);
+static void CheckSections(System *sys, ImageHdr *image);
+static void LoadSymbols(System *sys, ImageHdr *image, FILE *fp);
+static void IndexSymbols(System *sys, ImageHdr *image, ImageFileSymbolHdr *hdr, uint8_t *data);
+static void LoadDebugSection(System *sys, ImageHdr *image, FILE *fp);
+static void IndexDebugSection(System *sys, ImageHdr *image, uint8_t *data, VMUVALUE size);
+
 /* LoadImage - load an image from a file */
-ImageHdr *LoadImage(System *sys, const char *name)
+ImageHdr *LoadImage(System *sys, const char *name, int flags)
+{
+    ImageHdr *image;
+    
+    /* map the image file or read it if it can't be mapped */
+#ifdef USE_MAPPED_IMAGES
+    if (!(image = MapImage(sys, name)))
+#endif
+        image = ReadImage(sys, name);
+    CheckSections(sys, image);
+    
+    /* translate the code into decoded form if requested */
+    if ((flags & LOAD_PREDECODE) && !PredecodeImage(sys, image))
+        Fatal(sys, "can't decode the code section");
+    
+    /* return the image */
+    return image;
+}
+
+#ifdef USE_MAPPED_IMAGES
+
+/* MapImage - map an image file into memory and use its sections in place
+   (the private mapping copies only the pages the program writes, returns NULL if the file can't be mapped) */
+static ImageHdr *MapImage(System *sys, const char *name)
+{
+    ImageFileSymbolHdr *symbolHdr;
+    ImageFileSection *src;
+    ImageFileHdr *fileHdr;
+    VMUVALUE end = 0;
+    ImageHdr *image;
+    struct stat st;
+    uint8_t *data;
+    int fd, j;
+    
+    /* map the whole file */
+    if ((fd = open(name, O_RDONLY)) < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(ImageFileHdr)) {
+        close(fd);
+        return NULL;
+    }
+    data = (uint8_t *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == (uint8_t *)MAP_FAILED)
+        return NULL;
+    
+    /* check the header and make sure the section headers are in the file */
+    fileHdr = (ImageFileHdr *)data;
+    image = NewImage(sys, fileHdr);
+    if (sizeof(ImageFileHdr) + (fileHdr->sectionCount - 1) * sizeof(ImageFileSection) > st.st_size)
+        Fatal(sys, "error reading image header");
+        
+    /* point each section at its data in the file */
+    for (j = 0, src = fileHdr->sections; j < image->sectionCount; ++j, ++src) {
+        if (src->offset > st.st_size || src->size > st.st_size - src->offset)
+            Fatal(sys, "error reading %08x section", src->base);
+        image->sections[j].fileSection = src;
+        image->sections[j].data = data + src->offset;
+        if (src->offset + src->size > end)
+            end = src->offset + src->size;
+    }
+    
+    /* the symbol table follows the section data */
+    if (fileHdr->flags & IMAGE_SYMBOLS) {
+        if (sizeof(ImageFileSymbolHdr) > st.st_size - end)
+            Fatal(sys, "error reading symbol table header");
+        symbolHdr = (ImageFileSymbolHdr *)(data + end);
+        if (symbolHdr->size > st.st_size - end - sizeof(ImageFileSymbolHdr))
+            Fatal(sys, "error reading symbol table");
+        IndexSymbols(sys, image, symbolHdr, (uint8_t *)(symbolHdr + 1));
+        end += sizeof(ImageFileSymbolHdr) + symbolHdr->size;
+    }
+    
+    /* the debug section entry follows the section data and the symbol table */
+    if (fileHdr->flags & IMAGE_DEBUG) {
+        if (sizeof(ImageFileSection) > st.st_size - end)
+            Fatal(sys, "error reading debug section header");
+        src = (ImageFileSection *)(data + end);
+        if (src->offset > st.st_size || src->size > st.st_size - src->offset)
+            Fatal(sys, "error reading debug section");
+        IndexDebugSection(sys, image, data + src->offset, src->size);
+    }
+    
+    /* return the image */
+    return image;
+}
+
+#endif
+
+/* ReadImage - read an image file into memory */
+static ImageHdr *ReadImage(System *sys, const char *name)
 {
     ImageFileHdr fileHdr;
     ImageFileSection *src;
@@ -27,18 +138,12 @@ ImageHdr *LoadImage(System *sys, const char *name)
     /* read the image file header */
     if (fread((uint8_t *)&fileHdr, 1, sizeof(ImageFileHdr), fp) != sizeof(ImageFileHdr))
         Fatal(sys, "error reading image header");
-        
-    /* get the section count */
-    count = fileHdr.sectionCount;
-        
-    /* allocate space for the image header */
-    if (!(image = (ImageHdr *)xbGlobalAlloc(sys, sizeof(ImageHdr) + (count - 1) * sizeof(ImageSection))))
-        Fatal(sys, "insufficient space for image header");
-        
-    /* initialize the image */
-    image->mainCode = fileHdr.mainCode;
-    image->stackSize = fileHdr.stackSize;
-    image->sectionCount = count;
+    image = NewImage(sys, &fileHdr);
+    count = image->sectionCount;
+    
+    /* read the first section which starts with the image file header */
+    if (fileHdr.sections[0].size < sizeof(ImageFileHdr) + (count - 1) * sizeof(ImageFileSection))
+        Fatal(sys, "error reading image header");
     if (!(image->sections[0].data = (uint8_t *)xbGlobalAlloc(sys, fileHdr.sections[0].size)))
         Fatal(sys, "insufficient space for %08x section", fileHdr.sections[0].base);
     memcpy(image->sections[0].data, &fileHdr, sizeof(ImageFileHdr));
@@ -63,9 +168,412 @@ ImageHdr *LoadImage(System *sys, const char *name)
             Fatal(sys, "error reading %08x section", src->base);
     }
     
+    /* read the symbol table if there is one */
+    if (fileHdr.flags & IMAGE_SYMBOLS)
+        LoadSymbols(sys, image, fp);
+    
+    /* read the debug section if there is one */
+    if (fileHdr.flags & IMAGE_DEBUG)
+        LoadDebugSection(sys, image, fp);
+    
     fclose(fp);
     
     /* return the image */
     return image;
 }
 
+/* CopyImage - copy an image for a run of its own
+   (the copy has its own section data and decodes its own code and shares the rest) */
+ImageHdr *CopyImage(System *sys, ImageHdr *image)
+{
+    size_t size = sizeof(ImageHdr) + (image->sectionCount - 1) * sizeof(ImageSection);
+    ImageHdr *copy;
+    int j;
+    
+    if (!(copy = (ImageHdr *)xbGlobalAlloc(sys, size)))
+        return NULL;
+    memcpy(copy, image, size);
+    copy->decoded = NULL;
+    copy->codeSection = NULL;
+    copy->outsideCalls = FALSE;
+    
+    for (j = 0; j < copy->sectionCount; ++j) {
+        ImageSection *section = &copy->sections[j];
+        VMUVALUE sectionSize = section->fileSection->size;
+        uint8_t *data;
+        if (!(data = (uint8_t *)xbGlobalAlloc(sys, sectionSize > 0 ? sectionSize : 1)))
+            return NULL;
+        memcpy(data, section->data, sectionSize);
+        section->data = data;
+    }
+    
+    return copy;
+}
+
+/* NewImage - check an image file header and allocate the image for it */
+static ImageHdr *NewImage(System *sys, ImageFileHdr *fileHdr)
+{
+    ImageHdr *image;
+    int count;
+    
+    /* check the image file header */
+    if (memcmp(fileHdr->tag, IMAGE_TAG, sizeof(fileHdr->tag)) != 0)
+        Fatal(sys, "not an image file");
+    if (fileHdr->version != IMAGE_VERSION)
+        Fatal(sys, "unsupported image version %04x", fileHdr->version);
+    if ((count = fileHdr->sectionCount) < 1)
+        Fatal(sys, "image has no sections");
+        
+    /* allocate space for the image header */
+    if (!(image = (ImageHdr *)xbGlobalAlloc(sys, sizeof(ImageHdr) + (count - 1) * sizeof(ImageSection))))
+        Fatal(sys, "insufficient space for image header");
+        
+    /* initialize the image */
+    image->mainCode = fileHdr->mainCode;
+    image->stackSize = fileHdr->stackSize;
+    image->sectionCount = count;
+    image->flags = fileHdr->flags;
+    image->decoded = NULL;
+    image->codeSection = NULL;
+    image->outsideCalls = FALSE;
+    image->symbols = NULL;
+    image->symbolCount = 0;
+    image->lines = NULL;
+    image->lineCount = 0;
+    image->files = NULL;
+    image->fileCount = 0;
+    
+    /* return the image */
+    return image;
+}
+
+/* CheckSections - check that the sections can be found by the region of an address
+   (each section starts a region and an empty section can share its region with another one) */
+static void CheckSections(System *sys, ImageHdr *image)
+{
+    int j, k;
+    
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *section = image->sections[j].fileSection;
+        if (ADDR_OFFSET(section->base) != 0)
+            Fatal(sys, "section base %08x not region aligned", section->base);
+        if (section->size == 0)
+            continue;
+        for (k = 0; k < j; ++k) {
+            ImageFileSection *other = image->sections[k].fileSection;
+            if (other->size != 0 && ADDR_REGION(other->base) == ADDR_REGION(section->base))
+                Fatal(sys, "sections %08x and %08x are in the same region", other->base, section->base);
+        }
+    }
+}
+
+/* LoadSymbols - load the symbol table that follows the section data */
+static void LoadSymbols(System *sys, ImageHdr *image, FILE *fp)
+{
+    ImageFileSymbolHdr hdr;
+    uint8_t *data;
+    
+    /* read the symbol table header and entries */
+    if (fread((uint8_t *)&hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+        Fatal(sys, "error reading symbol table header");
+    if (!(data = (uint8_t *)xbGlobalAlloc(sys, hdr.size)))
+        Fatal(sys, "insufficient space for symbol table");
+    if (fread(data, 1, hdr.size, fp) != hdr.size)
+        Fatal(sys, "error reading symbol table");
+    IndexSymbols(sys, image, &hdr, data);
+}
+
+/* IndexSymbols - build the symbol index for the symbol table entries in memory */
+static void IndexSymbols(System *sys, ImageHdr *image, ImageFileSymbolHdr *hdr, uint8_t *data)
+{
+    ImageFileSymbol *entry;
+    uint8_t *p;
+    VMUVALUE j;
+    
+    if (!(image->symbols = (ImageSymbol *)xbGlobalAlloc(sys, hdr->count * sizeof(ImageSymbol))))
+        Fatal(sys, "insufficient space for symbol table");
+    for (p = data, j = 0; j < hdr->count; ++j, p += entry->size) {
+        entry = (ImageFileSymbol *)p;
+        if (p + sizeof(ImageFileSymbol) > data + hdr->size
+        ||  entry->size <= sizeof(ImageFileSymbol) || entry->size > data + hdr->size - p
+        ||  !memchr(entry + 1, '\0', entry->size - sizeof(ImageFileSymbol)))
+            Fatal(sys, "bad symbol table entry");
+        image->symbols[j].value = entry->value;
+        image->symbols[j].name = (char *)(entry + 1);
+    }
+    image->symbolCount = hdr->count;
+}
+
+/* LoadDebugSection - load the debug section described by the entry that follows the section data */
+static void LoadDebugSection(System *sys, ImageHdr *image, FILE *fp)
+{
+    ImageFileSection section;
+    uint8_t *data;
+    
+    /* read the section entry and the debug data */
+    if (fread((uint8_t *)&section, 1, sizeof(section), fp) != sizeof(section))
+        Fatal(sys, "error reading debug section header");
+    if (!(data = (uint8_t *)xbGlobalAlloc(sys, section.size)))
+        Fatal(sys, "insufficient space for debug section");
+    if (fseek(fp, section.offset, SEEK_SET) != 0 || fread(data, 1, section.size, fp) != section.size)
+        Fatal(sys, "error reading debug section");
+    IndexDebugSection(sys, image, data, section.size);
+}
+
+/* IndexDebugSection - find the symbols, line table and file names in the debug data in memory */
+static void IndexDebugSection(System *sys, ImageHdr *image, uint8_t *data, VMUVALUE size)
+{
+    ImageFileSymbolHdr symbolHdr;
+    ImageFileDebugHdr *hdr;
+    uint8_t *p, *end;
+    VMUVALUE j;
+    
+    /* check the header and the sizes of the parts */
+    hdr = (ImageFileDebugHdr *)data;
+    if (size < sizeof(ImageFileDebugHdr)
+    ||  hdr->symbolSize > size - sizeof(ImageFileDebugHdr)
+    ||  hdr->lineCount > (size - sizeof(ImageFileDebugHdr) - hdr->symbolSize) / sizeof(ImageFileLine)
+    ||  hdr->fileSize > size - sizeof(ImageFileDebugHdr) - hdr->symbolSize - hdr->lineCount * sizeof(ImageFileLine))
+        Fatal(sys, "bad debug section");
+    
+    /* index the function symbols */
+    p = data + sizeof(ImageFileDebugHdr);
+    symbolHdr.count = hdr->symbolCount;
+    symbolHdr.size = hdr->symbolSize;
+    IndexSymbols(sys, image, &symbolHdr, p);
+    p += hdr->symbolSize;
+    
+    /* the line table is used in place */
+    image->lines = (ImageFileLine *)p;
+    image->lineCount = hdr->lineCount;
+    p += hdr->lineCount * sizeof(ImageFileLine);
+    
+    /* index the file names */
+    if (!(image->files = (char **)xbGlobalAlloc(sys, (hdr->fileCount + 1) * sizeof(char *))))
+        Fatal(sys, "insufficient space for debug section");
+    for (end = p + hdr->fileSize, j = 0; j < hdr->fileCount; ++j) {
+        image->files[j] = (char *)p;
+        while (p < end && *p != '\0')
+            ++p;
+        if (p >= end)
+            Fatal(sys, "bad debug section file name");
+        p = data + ROUND_TO_WORDS((p + 1) - data);
+    }
+    image->fileCount = hdr->fileCount;
+}
+
+/* FindSourceLine - find the line table entry for the code at an address or NULL if there is none */
+ImageFileLine *FindSourceLine(ImageHdr *image, VMUVALUE addr)
+{
+    int lo = 0, hi = image->lineCount - 1, mid;
+    ImageFileLine *line = NULL;
+    
+    /* find the last entry at or before the address */
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (image->lines[mid].address <= addr) {
+            line = &image->lines[mid];
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    
+    return line;
+}
+
+/* SourceFileName - get the name of the file of a line table entry (NULL for the main file) */
+const char *SourceFileName(ImageHdr *image, ImageFileLine *line)
+{
+    if (line->file == 0 || line->file >= (VMUVALUE)image->fileCount)
+        return NULL;
+    return image->files[line->file];
+}
+
+/* FindCodeSection - find the section containing the main code */
+ImageSection *FindCodeSection(ImageHdr *image)
+{
+    ImageSection *section;
+    VMUVALUE base, size;
+    int j;
+    
+    for (j = 0; j < image->sectionCount; ++j) {
+        section = &image->sections[j];
+        base = section->fileSection->base;
+        size = section->fileSection->size;
+        if (image->mainCode >= base && image->mainCode < base + size)
+            return section;
+    }
+    
+    return NULL;
+}
+
+/* PredecodeImage - translate the code reachable from the main code into decoded form */
+int PredecodeImage(System *sys, ImageHdr *image)
+{
+    ImageSection *section;
+    VMUVALUE size;
+    
+    /* find the section containing the main code */
+    if (!(section = FindCodeSection(image)))
+        return FALSE;
+    size = section->fileSection->size;
+        
+    /* allocate one decoded instruction slot for each byte of the section */
+    if (!(image->decoded = (DecodedInsn *)xbGlobalAlloc(sys, size * sizeof(DecodedInsn))))
+        return FALSE;
+    memset(image->decoded, 0, size * sizeof(DecodedInsn));
+    image->codeSection = section;
+    image->outsideCalls = FALSE;
+    
+    /* decode the main code and everything it calls */
+    return PredecodeCode(image, image->mainCode);
+}
+
+/* PredecodeCode - decode the instructions reachable from an address
+   (code that is only reached through computed calls is decoded later by the interpreter) */
+int PredecodeCode(ImageHdr *image, VMUVALUE addr)
+{
+    ImageSection *section = image->codeSection;
+    VMUVALUE size = section->fileSection->size;
+    VMUVALUE offset = addr - section->fileSection->base;
+    VMUVALUE start = offset, target;
+    DecodedInsn *ip, *lit = NULL;
+    VMVALUE operand, operand2, disp;
+    int opcode, len, i;
+    
+    /* make sure the address is in the code section */
+    if (offset >= size)
+        return FALSE;
+    image->decoded[offset].entry = TRUE;
+    
+    /* decode straight line code until control leaves the sequence */
+    while (offset < size && !(ip = &image->decoded[offset])->valid) {
+        uint8_t *p = section->data + offset;
+        
+        /* decode the operand */
+        opcode = VMCODEBYTE(p);
+        operand = operand2 = 0;
+        switch (InstructionFormat(opcode)) {
+        case FMT_NONE:
+            len = 1;
+            break;
+        case FMT_BYTE:
+            operand = VMCODEBYTE(p + 1);
+            len = 2;
+            break;
+        case FMT_SBYTE:
+            operand = (int8_t)VMCODEBYTE(p + 1);
+            len = 2;
+            break;
+        case FMT_SBYTE2:
+            operand = (int8_t)VMCODEBYTE(p + 1);
+            operand2 = (int8_t)VMCODEBYTE(p + 2);
+            len = 3;
+            break;
+        case FMT_BYTE2:
+            operand = VMCODEBYTE(p + 1);
+            operand2 = VMCODEBYTE(p + 2);
+            len = 3;
+            break;
+        case FMT_BR8:
+            operand = (int8_t)VMCODEBYTE(p + 1);
+            len = 2;
+            break;
+        case FMT_BR16:
+        case FMT_HWORD:
+            operand = (int16_t)((VMCODEBYTE(p + 1) << 8) | VMCODEBYTE(p + 2));
+            len = 3;
+            break;
+        case FMT_WORD:
+        case FMT_NATIVE:
+        case FMT_BR:
+            for (i = 1; i <= sizeof(VMUVALUE); ++i)
+                operand = (operand << 8) | VMCODEBYTE(p + i);
+            len = 1 + sizeof(VMUVALUE);
+            break;
+        case FMT_LOOP:
+            operand = (int8_t)VMCODEBYTE(p + 1);
+            operand2 = (int8_t)VMCODEBYTE(p + 2);
+            len = 3 + sizeof(VMUVALUE);
+            break;
+        case FMT_LOOPA:
+            for (i = 1; i <= sizeof(VMUVALUE); ++i)
+                operand = (operand << 8) | VMCODEBYTE(p + i);
+            operand2 = (int8_t)VMCODEBYTE(p + 1 + sizeof(VMUVALUE));
+            len = 2 + sizeof(VMUVALUE) * 2;
+            break;
+        default:
+            len = 1; // undefined opcodes abort when executed
+            break;
+        }
+        
+        /* don't decode instructions that run off the end of the section */
+        if (offset + len > size)
+            break;
+            
+        /* fill in the decoded instruction */
+        ip->opcode = opcode;
+        ip->operand = operand;
+        ip->operand2 = operand2;
+        ip->target = NULL;
+        ip->valid = TRUE;
+        ip->length = len;
+        
+        /* resolve branch targets and decode the code at the target
+           (the displacement of a loop instruction is its last operand) */
+        if (IsBranchFormat(InstructionFormat(opcode)) || IsLoopFormat(InstructionFormat(opcode))) {
+            disp = operand;
+            if (IsLoopFormat(InstructionFormat(opcode)))
+                for (disp = 0, i = len - sizeof(VMUVALUE); i < len; ++i)
+                    disp = (disp << 8) | VMCODEBYTE(p + i);
+            target = offset + len + disp;
+            if (target < size) {
+                ip->target = &image->decoded[target];
+                PredecodeCode(image, section->fileSection->base + target);
+            }
+        }
+        
+        /* decode functions called through a literal address */
+        else if (opcode == OP_PUSHJ && lit)
+            PredecodeCode(image, (VMUVALUE)lit->operand);
+        
+        /* resolve the target of a direct call and decode the function */
+        else if (opcode == OP_CALL) {
+            target = (VMUVALUE)operand - section->fileSection->base;
+            if (target < size) {
+                ip->target = &image->decoded[target];
+                PredecodeCode(image, (VMUVALUE)operand);
+            }
+            else
+                image->outsideCalls = TRUE;
+        }
+        
+        /* decode the switch table entries after the first (which is decoded as straight line code) */
+        else if (opcode == OP_SWITCH) {
+            for (i = 1; i <= operand; ++i)
+                PredecodeCode(image, section->fileSection->base + offset + len + i * (1 + sizeof(VMUVALUE)));
+        }
+        
+        /* stop after an instruction that doesn't fall through */
+        if (opcode == OP_HALT
+        ||  opcode == OP_BR
+        ||  opcode == OP_BR8
+        ||  opcode == OP_BR16
+        ||  opcode == OP_POPJ
+        ||  opcode == OP_RETURN
+        ||  opcode == OP_RETURNZ
+        ||  opcode == OP_RET
+        ||  InstructionFormat(opcode) < 0)
+            break;
+            
+        /* remember literals that might be function addresses */
+        lit = (opcode == OP_LIT || opcode == OP_LIT16 ? ip : NULL);
+        
+        /* move ahead to the next instruction */
+        offset += len;
+    }
+    
+    /* return true if the instruction at the requested address was decoded */
+    return image->decoded[start].valid;
+}
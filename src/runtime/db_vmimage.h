@@ -10,18 +10,58 @@
 #include "db_system.h"
 #include "db_image.h"
 
+/* address translation (each memory region has its own high address nibble) */
+#define ADDR_REGIONS        16
+#define ADDR_REGION(a)      ((VMUVALUE)(a) >> 28)
+#define ADDR_OFFSET(a)      ((VMUVALUE)(a) & 0x0fffffff)
+
 /* image file section */
 typedef struct {
     ImageFileSection *fileSection;
     uint8_t *data;
 } ImageSection;
 
+/* LoadImage flags */
+#define LOAD_PREDECODE  (1 << 0)    /* translate the code section into decoded form */
+
+/* pre-decoded instruction (one slot for each byte of the code section) */
+typedef struct DecodedInsn DecodedInsn;
+struct DecodedInsn {
+    void            *handler;   /* opcode handler (bound by the interpreter) */
+    DecodedInsn     *target;    /* branch target or NULL if out of range */
+    VMVALUE         operand;    /* decoded operand */
+    VMVALUE         operand2;   /* second operand (FMT_SBYTE2 and FMT_BYTE2) */
+    uint8_t         opcode;     /* opcode */
+    uint8_t         valid;      /* an instruction starts at this slot */
+    uint8_t         length;     /* length of the instruction in bytes */
+    uint8_t         entry;      /* code can reach this slot other than by falling into it */
+};
+
+/* image symbol */
+typedef struct {
+    VMUVALUE        value;      /* symbol address */
+    char            *name;      /* symbol name */
+} ImageSymbol;
+
 /* in-memory image header */
 typedef struct {
     VMUVALUE        mainCode;
     VMUVALUE        stackSize;
     VMUVALUE        sectionCount;
+    VMUVALUE        flags;          /* image flags from the image file */
+    DecodedInsn     *decoded;       /* decoded code section or NULL */
+    ImageSection    *codeSection;   /* section containing the decoded code */
+    int             outsideCalls;   /* the decoded code calls functions in other sections */
+    ImageSymbol     *symbols;       /* symbols from the image file or NULL */
+    int             symbolCount;    /* number of symbols */
+    ImageFileLine   *lines;         /* line table from the debug section or NULL */
+    int             lineCount;      /* number of line table entries */
+    char            **files;        /* file names from the debug section */
+    int             fileCount;      /* number of file names */
     ImageSection    sections[1];
 } ImageHdr;
 
+/* prototypes from db_vmverify.c */
+int VerifyImage(System *sys, ImageHdr *image);
+
 #endif
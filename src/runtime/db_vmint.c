@@ -13,27 +13,78 @@
 #include "db_vmdebug.h"
 
 /* prototypes for local functions */
-static uint8_t *MapAddress(Interpreter *i, VMUVALUE addr);
-static VMVALUE LoadValue(Interpreter *i, VMUVALUE addr);
-static VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr);
-static void StoreValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
-static void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value);
-static void DoTrap(Interpreter *i, int op);
+static int ExecuteSwitch(Interpreter *i);
+#ifdef USE_THREADED_DISPATCH
+static int ExecuteThreaded(Interpreter *i);
+static int ExecuteDecoded(Interpreter *i);
+#endif
+static uint8_t *MapAddressUnchecked(Interpreter *i, VMUVALUE addr);
 static void PrintC(Interpreter *i, int ch);
+static void PrintS(Interpreter *i, VMUVALUE addr, VMVALUE length);
+static VMVALUE StringLength(Interpreter *i, VMUVALUE addr);
+static VMVALUE CompareStrings(Interpreter *i, VMUVALUE addr1, VMUVALUE addr2);
+static int FormatNumber(Interpreter *i, char *buf, VMVALUE value, VMVALUE base, VMVALUE width);
+static VMVALUE ParseNumber(Interpreter *i, VMUVALUE addr, VMVALUE *pIndex, VMVALUE base);
+static int DefaultGetChar(void *cookie);
+static void DefaultWrite(void *cookie, const char *buf, int size);
+
+/* the console of a program run by itself */
+static ConsoleOps defaultConsole = {
+    DefaultGetChar,
+    DefaultWrite
+};
+
+/* largest number of digits a formatted number can have */
+#define MAX_DIGITS      (sizeof(VMVALUE) * 8)
+
+/* map a constant address using the variant selected for the image
+   (computed addresses aren't known to the verifier and are always checked) */
+#define MAP_ADDRESS(i, addr)    ((i)->checkAddresses ? MapAddress(i, addr) : MapAddressUnchecked(i, addr))
 
 /* InitInterpreter - initialize the interpreter */
 Interpreter *InitInterpreter(System *sys, ImageHdr *image)
 {
     Interpreter *i;
+    int j;
     
     if (!(i = (Interpreter *)xbGlobalAlloc(sys, sizeof(Interpreter))))
         return NULL;
         
-    if (!(i->stack = (VMVALUE *)xbGlobalAlloc(sys, image->stackSize * sizeof(VMVALUE))))
+    if (!(i->stack = (VMVALUE *)xbGlobalAlloc(sys, image->stackSize)))
         return NULL;
         
+    i->sys = sys;
     i->image = image;
-    i->stackTop = i->stack + image->stackSize;
+    i->engine = ENGINE_DEFAULT;
+    i->stackTop = i->stack + image->stackSize / sizeof(VMVALUE);
+    
+    /* build the address translation table (LoadImage has checked that each region has at most
+       one section that isn't empty) */
+    memset(i->sectionMap, 0, sizeof(i->sectionMap));
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageSection *section = &image->sections[j];
+        int region = ADDR_REGION(section->fileSection->base);
+        if (!i->sectionMap[region] || i->sectionMap[region]->fileSection->size == 0)
+            i->sectionMap[region] = section;
+    }
+    i->checkAddresses = TRUE;
+    i->profile = NULL;
+    i->cogs = NULL;
+    i->tasks = NULL;
+    i->clock = NULL;
+    i->skipped = 0;
+    i->cogId = 0;
+    i->registers = NULL;
+    i->pins = NULL;
+    i->snapshot = NULL;
+    i->ioLog = NULL;
+    i->console = &defaultConsole;
+    i->consoleCookie = NULL;
+    i->budgeted = FALSE;
+    i->budget = 0;
+    i->cancelled = FALSE;
+    i->finished = FALSE;
+    i->status = EXEC_HALTED;
     
     return i;
 }
@@ -41,28 +92,142 @@ Interpreter *InitInterpreter(System *sys, ImageHdr *image)
 /* Execute - execute the main code */
 int Execute(Interpreter *i, ImageHdr *image)
 {
-    VMVALUE tmp;
-    int8_t tmpb;
-    int cnt;
-
 	/* setup the new image */
 	i->image = image;
+    InitExecution(i);
 
-    /* initialize */    
+    return Resume(i);
+}
+
+/* InitExecution - get ready to execute the main code from the start */
+void InitExecution(Interpreter *i)
+{
     i->pc = (uint8_t *)MapAddress(i, i->image->mainCode);
+    i->codeBase = i->sectionMap[ADDR_REGION(i->image->mainCode)]->data;
     i->sp = i->fp = i->stackTop;
     i->linePos = 0;
+    i->outputCount = 0;
+    i->startTime = xbGetMicroseconds();
+    i->cancelled = FALSE;
+    i->finished = FALSE;
+}
+
+/* ExecuteFor - execute the main code for up to maxInstructions instructions (zero for no limit)
+   (a run that is exhausted or cancelled continues with the next call and a finished one just
+   returns how it finished) */
+ExecStatus ExecuteFor(Interpreter *i, uint64_t maxInstructions)
+{
+    ExecStatus status;
+
+    if (i->finished)
+        return i->status;
+
+    i->budgeted = TRUE;
+    i->budget = maxInstructions > 0 ? maxInstructions : ~(uint64_t)0;
+    status = (ExecStatus)ExecuteCode(i);
+    i->budgeted = FALSE;
+
+    /* the program isn't done until every cog it started halts */
+    if (status == EXEC_HALTED || status == EXEC_ABORTED) {
+        if (i->cogs)
+            WaitForCogs(i);
+        i->finished = TRUE;
+        i->status = status;
+    }
+    return status;
+}
+
+/* CancelExecution - stop ExecuteFor before the next instruction (another thread can call it) */
+void CancelExecution(Interpreter *i)
+{
+    i->cancelled = TRUE;
+}
+
+/* Resume - execute the main code from where the pc is (the start or a restored snapshot) */
+int Resume(Interpreter *i)
+{
+    int result;
+
+    i->startTime = xbGetMicroseconds();
+
+    /* the program isn't done until every cog it started halts */
+    result = ExecuteCode(i);
+    if (i->cogs)
+        WaitForCogs(i);
+    return result;
+}
+
+/* ExecuteCode - execute code from the current pc until it halts, aborts or a budget stops it */
+int ExecuteCode(Interpreter *i)
+{
+    ImageHdr *image = i->image;
+#ifdef USE_JIT
+    int result;
+#endif
 
     if (setjmp(i->errorTarget))
         return FALSE;
 
+    /* only the switch engine is instrumented for profiling, cycle estimates, snapshots and budgets */
+    if (i->profile || i->clock || i->snapshot || i->budgeted)
+        return ExecuteSwitch(i);
+
+#ifdef USE_THREADED_DISPATCH
+    if (i->engine == ENGINE_THREADED)
+        return ExecuteThreaded(i);
+    if (i->engine == ENGINE_DECODED || i->engine == ENGINE_JIT) {
+        if (!image->decoded && !PredecodeImage(i->sys, image))
+            Abort(i, "can't decode the code section");
+        
+        /* only the code section is decoded so code that calls functions placed elsewhere is threaded */
+        if (image->outsideCalls)
+            return ExecuteThreaded(i);
+            
+        /* only decoded code can trust the constant addresses of a verified image
+           (the other engines run code bytes that a store through a computed address could change) */
+        i->checkAddresses = !(image->flags & IMAGE_VERIFIED);
+#ifdef USE_JIT
+        /* the translated code is built from the decoded code (it runs decoded without executable memory) */
+        if (i->engine == ENGINE_JIT && (result = ExecuteJit(i)) >= 0)
+            return result;
+#endif
+        return ExecuteDecoded(i);
+    }
+#endif
+
+    return ExecuteSwitch(i);
+}
+
+/* ExecuteSwitch - execute code using a switch on each opcode */
+static int ExecuteSwitch(Interpreter *i)
+{
+    VMVALUE tmp, val;
+    int8_t tmpb;
+    int cnt;
+
     for (;;) {
 #if 0
         ShowStack(i);
         DecodeInstruction(UnmapAddress(i, i->pc), i->pc);
 #endif
+        if (i->snapshot && CheckSnapshot(i))
+            return TRUE;
+        if (i->budgeted) {
+            if (i->cancelled) {
+                i->cancelled = FALSE;
+                return EXEC_CANCELLED;
+            }
+            if (i->budget == 0)
+                return EXEC_EXHAUSTED;
+            --i->budget;
+        }
+        if (i->profile)
+            ProfileInstruction(i->profile, i->pc);
+        if (i->clock)
+            ClockInstruction(i);
         switch (VMCODEBYTE(i->pc++)) {
         case OP_HALT:
+            FlushOutput(i);
             return TRUE;
         case OP_BRT:
             for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
@@ -99,6 +264,90 @@ int Execute(Interpreter *i, ImageHdr *image)
                 tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
             i->pc += tmp;
             break;
+        case OP_BRLT:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = Pop(i);
+            if (val < i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRLE:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = Pop(i);
+            if (val <= i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BREQ:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = Pop(i);
+            if (val == i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRNE:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = Pop(i);
+            if (val != i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRGE:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = Pop(i);
+            if (val >= i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRGT:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = Pop(i);
+            if (val > i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRLTZ:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if (i->tos < 0)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRLEZ:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if (i->tos <= 0)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRGEZ:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if (i->tos >= 0)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BRGTZ:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if (i->tos > 0)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_BR8:
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            i->pc += tmpb;
+            break;
+        case OP_BR16:
+            tmp = (int16_t)((VMCODEBYTE(i->pc) << 8) | VMCODEBYTE(i->pc + 1));
+            i->pc += 2 + tmp;
+            break;
         case OP_NOT:
             i->tos = (i->tos ? FALSE : TRUE);
             break;
@@ -175,20 +424,29 @@ int Execute(Interpreter *i, ImageHdr *image)
         case OP_LIT:
             for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
                 tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
-            CPush(i, i->tos);
+            Push(i, i->tos);
             i->tos = tmp;
             break;
         case OP_SLIT:
             tmpb = (int8_t)VMCODEBYTE(i->pc++);
-            CPush(i, i->tos);
+            Push(i, i->tos);
             i->tos = tmpb;
             break;
+        case OP_LIT16:
+            tmp = (int16_t)((VMCODEBYTE(i->pc) << 8) | VMCODEBYTE(i->pc + 1));
+            i->pc += 2;
+            Push(i, i->tos);
+            i->tos = tmp;
+            break;
         case OP_LOAD:
             i->tos = LoadValue(i, (VMUVALUE)i->tos);
             break;
         case OP_LOADB:
             i->tos = LoadByteValue(i, (VMUVALUE)i->tos);
             break;
+        case OP_LOADW:
+            i->tos = LoadWordValue(i, (VMUVALUE)i->tos);
+            break;
         case OP_STORE:
             tmp = Pop(i);
             StoreValue(i, (VMUVALUE)i->tos, tmp);
@@ -199,9 +457,14 @@ int Execute(Interpreter *i, ImageHdr *image)
             StoreByteValue(i, (VMUVALUE)i->tos, tmp);
             i->tos = Pop(i);
             break;
+        case OP_STOREW:
+            tmp = Pop(i);
+            StoreWordValue(i, (VMUVALUE)i->tos, tmp);
+            i->tos = Pop(i);
+            break;
         case OP_LREF:
             tmpb = (int8_t)VMCODEBYTE(i->pc++);
-            CPush(i, i->tos);
+            Push(i, i->tos);
             i->tos = i->fp[(int)tmpb];
             break;
         case OP_LSET:
@@ -214,12 +477,14 @@ int Execute(Interpreter *i, ImageHdr *image)
             i->tos = tmp + i->tos * sizeof (VMVALUE);
             break;
         case OP_PUSHJ:
-            tmp = (VMVALUE)(i->pc - (uint8_t *)i->image);
+            tmp = (VMVALUE)(i->pc - i->codeBase);
             i->pc = (uint8_t *)MapAddress(i, i->tos);
             i->tos = tmp;
+            if (i->profile)
+                ProfileCall(i->profile, i->pc);
             break;
         case OP_POPJ:
-            i->pc = (uint8_t *)i->image + i->tos;
+            i->pc = i->codeBase + i->tos;
             i->tos = Pop(i);
             break;
         case OP_CLEAN:
@@ -228,17 +493,18 @@ int Execute(Interpreter *i, ImageHdr *image)
             break;
         case OP_FRAME:
             cnt = VMCODEBYTE(i->pc++);
+            val = VMCODEBYTE(i->pc++);
             tmp = (VMVALUE)(i->fp - i->stack);
             i->fp = i->sp;
-            Reserve(i, cnt);
+            Reserve(i, cnt, val);
             i->fp[F_FP] = tmp;
             break;
         case OP_RETURNZ:
-            CPush(i, i->tos);
+            Push(i, i->tos);
             i->tos = 0;
             // fall through
         case OP_RETURN:
-            i->pc = (uint8_t *)i->image + Top(i);
+            i->pc = i->codeBase + Top(i);
             i->sp = i->fp;
             i->fp = (VMVALUE *)(i->stack + i->fp[F_FP]);
             break;
@@ -246,15 +512,129 @@ int Execute(Interpreter *i, ImageHdr *image)
             i->tos = Pop(i);
             break;
         case OP_DUP:
-            CPush(i, i->tos);
+            Push(i, i->tos);
             break;
         case OP_NATIVE:
             for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
                 tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            DoNative(i, tmp);
             break;
         case OP_TRAP:
             DoTrap(i, VMCODEBYTE(i->pc++));
             break;
+        case OP_LINC:
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            i->fp[(int)tmpb] += (int8_t)VMCODEBYTE(i->pc++);
+            break;
+        case OP_LOADA:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            Push(i, i->tos);
+            i->tos = LoadConstValue(i, (VMUVALUE)tmp);
+            break;
+        case OP_STOREA:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            StoreConstValue(i, (VMUVALUE)tmp, i->tos);
+            i->tos = Pop(i);
+            break;
+        case OP_LOADX:
+            tmp = Pop(i);
+            i->tos = LoadValue(i, (VMUVALUE)(tmp + i->tos * sizeof (VMVALUE)));
+            break;
+        case OP_STOREX:
+            tmp = Pop(i);
+            tmp += i->tos * sizeof (VMVALUE);
+            StoreValue(i, (VMUVALUE)tmp, Pop(i));
+            i->tos = Pop(i);
+            break;
+        case OP_CHECK:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if ((VMUVALUE)i->tos >= (VMUVALUE)tmp)
+                IndexError(i, i->tos, (VMUVALUE)tmp);
+            break;
+        case OP_VREF:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if ((VMUVALUE)i->tos >= (VMUVALUE)tmp)
+                IndexError(i, i->tos, (VMUVALUE)tmp);
+            tmp = Pop(i);
+            i->tos = LoadValue(i, (VMUVALUE)(tmp + i->tos * sizeof (VMVALUE)));
+            break;
+        case OP_VSET:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if ((VMUVALUE)i->tos >= (VMUVALUE)tmp)
+                IndexError(i, i->tos, (VMUVALUE)tmp);
+            tmp = Pop(i);
+            tmp += i->tos * sizeof (VMVALUE);
+            StoreValue(i, (VMUVALUE)tmp, Pop(i));
+            i->tos = Pop(i);
+            break;
+        case OP_SWITCH:
+            cnt = VMCODEBYTE(i->pc++);
+            tmp = ((VMUVALUE)i->tos < (VMUVALUE)cnt ? i->tos : cnt);
+            i->pc += tmp * (1 + sizeof(VMUVALUE));
+            i->tos = Pop(i);
+            break;
+        case OP_FORLOOP:
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            val = (i->fp[(int)tmpb] += (int8_t)VMCODEBYTE(i->pc++));
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if (val <= i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_FORLOOPA:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            val = LoadConstValue(i, (VMUVALUE)tmp) + (int8_t)VMCODEBYTE(i->pc++);
+            StoreConstValue(i, (VMUVALUE)tmp, val);
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            if (val <= i->tos)
+                i->pc += tmp;
+            i->tos = Pop(i);
+            break;
+        case OP_GREF:
+            tmp = VMCODEBYTE(i->pc++);
+            Push(i, i->tos);
+            i->tos = LoadConstValue(i, (VMUVALUE)tmp * sizeof(VMVALUE));
+            break;
+        case OP_GSET:
+            tmp = VMCODEBYTE(i->pc++);
+            StoreConstValue(i, (VMUVALUE)tmp * sizeof(VMVALUE), i->tos);
+            i->tos = Pop(i);
+            break;
+        case OP_GREF16:
+            tmp = (VMCODEBYTE(i->pc) << 8) | VMCODEBYTE(i->pc + 1);
+            i->pc += 2;
+            Push(i, i->tos);
+            i->tos = LoadConstValue(i, (VMUVALUE)tmp * sizeof(VMVALUE));
+            break;
+        case OP_GSET16:
+            tmp = (VMCODEBYTE(i->pc) << 8) | VMCODEBYTE(i->pc + 1);
+            i->pc += 2;
+            StoreConstValue(i, (VMUVALUE)tmp * sizeof(VMVALUE), i->tos);
+            i->tos = Pop(i);
+            break;
+        case OP_CALL:
+            for (tmp = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            Push(i, i->tos);
+            i->tos = (VMVALUE)(i->pc - i->codeBase);
+            i->pc = (uint8_t *)MAP_ADDRESS(i, tmp);
+            if (i->profile)
+                ProfileCall(i->profile, i->pc);
+            break;
+        case OP_RET:
+            cnt = VMCODEBYTE(i->pc++);
+            i->pc = i->codeBase + Top(i);
+            i->sp = i->fp + cnt;
+            i->fp = (VMVALUE *)(i->stack + i->fp[F_FP]);
+            break;
         default:
             Abort(i, "undefined opcode 0x%02x", VMCODEBYTE(i->pc - 1));
             break;
@@ -262,70 +642,1573 @@ int Execute(Interpreter *i, ImageHdr *image)
     }
 }
 
-static uint8_t *MapAddress(Interpreter *i, VMUVALUE addr)
+#ifdef USE_THREADED_DISPATCH
+
+/* state access macros for the threaded engine */
+#define T_SAVE()        (i->pc = pc, i->sp = sp, i->fp = fp, i->tos = tos)
+#define T_RESTORE()     (pc = i->pc, sp = i->sp, fp = i->fp, tos = i->tos)
+#define T_NEXT()        goto *dispatch[VMCODEBYTE(pc++)]
+#define T_GETWORD(v)    do {                                            \
+                            for (v = 0, cnt = sizeof(VMUVALUE); --cnt >= 0; ) \
+                                v = (v << 8) | VMCODEBYTE(pc++);        \
+                        } while (0)
+#define T_GETHWORD(v)   do {                                            \
+                            v = (int16_t)((VMCODEBYTE(pc) << 8) | VMCODEBYTE(pc + 1)); \
+                            pc += 2;                                    \
+                        } while (0)
+#define T_PUSH(v)       (*--sp = (v))
+#define T_POP()         (*sp++)
+#define T_TOP()         (*sp)
+
+/* ExecuteThreaded - execute code using direct threaded dispatch
+   (this must produce exactly the same results as ExecuteSwitch) */
+static int ExecuteThreaded(Interpreter *i)
 {
-    int j;
-    for (j = 0; j < i->image->sectionCount; ++j) {
-        ImageSection *section = &i->image->sections[j];
-        VMUVALUE base = section->fileSection->base;
-        if (addr >= base && addr < base + 0x10000000) {
-            if (addr > base + section->fileSection->size)
-                Abort(i, "address error");
-            return (uint8_t *)(section->data + (addr - base));
+    static void *dispatch[256] = {
+        [0 ... 255]     = &&op_undefined,
+        [OP_HALT]       = &&op_halt,
+        [OP_BRT]        = &&op_brt,
+        [OP_BRTSC]      = &&op_brtsc,
+        [OP_BRF]        = &&op_brf,
+        [OP_BRFSC]      = &&op_brfsc,
+        [OP_BR]         = &&op_br,
+        [OP_NOT]        = &&op_not,
+        [OP_NEG]        = &&op_neg,
+        [OP_ADD]        = &&op_add,
+        [OP_SUB]        = &&op_sub,
+        [OP_MUL]        = &&op_mul,
+        [OP_DIV]        = &&op_div,
+        [OP_REM]        = &&op_rem,
+        [OP_BNOT]       = &&op_bnot,
+        [OP_BAND]       = &&op_band,
+        [OP_BOR]        = &&op_bor,
+        [OP_BXOR]       = &&op_bxor,
+        [OP_SHL]        = &&op_shl,
+        [OP_SHR]        = &&op_shr,
+        [OP_LT]         = &&op_lt,
+        [OP_LE]         = &&op_le,
+        [OP_EQ]         = &&op_eq,
+        [OP_NE]         = &&op_ne,
+        [OP_GE]         = &&op_ge,
+        [OP_GT]         = &&op_gt,
+        [OP_LIT]        = &&op_lit,
+        [OP_SLIT]       = &&op_slit,
+        [OP_LOAD]       = &&op_load,
+        [OP_LOADB]      = &&op_loadb,
+        [OP_STORE]      = &&op_store,
+        [OP_STOREB]     = &&op_storeb,
+        [OP_LREF]       = &&op_lref,
+        [OP_LSET]       = &&op_lset,
+        [OP_INDEX]      = &&op_index,
+        [OP_PUSHJ]      = &&op_pushj,
+        [OP_POPJ]       = &&op_popj,
+        [OP_CLEAN]      = &&op_clean,
+        [OP_FRAME]      = &&op_frame,
+        [OP_RETURN]     = &&op_return,
+        [OP_RETURNZ]    = &&op_returnz,
+        [OP_DROP]       = &&op_drop,
+        [OP_DUP]        = &&op_dup,
+        [OP_NATIVE]     = &&op_native,
+        [OP_TRAP]       = &&op_trap,
+        [OP_LINC]       = &&op_linc,
+        [OP_LOADA]      = &&op_loada,
+        [OP_STOREA]     = &&op_storea,
+        [OP_LOADX]      = &&op_loadx,
+        [OP_STOREX]     = &&op_storex,
+        [OP_BR8]        = &&op_br8,
+        [OP_BR16]       = &&op_br16,
+        [OP_LIT16]      = &&op_lit16,
+        [OP_SWITCH]     = &&op_switch,
+        [OP_FORLOOP]    = &&op_forloop,
+        [OP_FORLOOPA]   = &&op_forloopa,
+        [OP_GREF]       = &&op_gref,
+        [OP_GSET]       = &&op_gset,
+        [OP_GREF16]     = &&op_gref16,
+        [OP_GSET16]     = &&op_gset16,
+        [OP_CALL]       = &&op_call,
+        [OP_RET]        = &&op_ret,
+        [OP_LOADW]      = &&op_loadw,
+        [OP_STOREW]     = &&op_storew,
+        [OP_BRLT]       = &&op_brlt,
+        [OP_BRLE]       = &&op_brle,
+        [OP_BREQ]       = &&op_breq,
+        [OP_BRNE]       = &&op_brne,
+        [OP_BRGE]       = &&op_brge,
+        [OP_BRGT]       = &&op_brgt,
+        [OP_BRLTZ]      = &&op_brltz,
+        [OP_BRLEZ]      = &&op_brlez,
+        [OP_BRGEZ]      = &&op_brgez,
+        [OP_BRGTZ]      = &&op_brgtz,
+        [OP_CHECK]      = &&op_check,
+        [OP_VREF]       = &&op_vref,
+        [OP_VSET]       = &&op_vset
+    };
+    VMVALUE *stack = i->stack;
+    uint8_t *pc = i->pc;
+    VMVALUE *sp = i->sp;
+    VMVALUE *fp = i->fp;
+    VMVALUE tos = i->tos;
+    VMVALUE tmp, val;
+    int8_t tmpb;
+    int cnt;
+
+    T_NEXT();
+
+op_halt:
+    T_SAVE();
+    FlushOutput(i);
+    return TRUE;
+op_brt:
+    T_GETWORD(tmp);
+    if (tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brtsc:
+    T_GETWORD(tmp);
+    if (tos)
+        pc += tmp;
+    else
+        tos = T_POP();
+    T_NEXT();
+op_brf:
+    T_GETWORD(tmp);
+    if (!tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brfsc:
+    T_GETWORD(tmp);
+    if (!tos)
+        pc += tmp;
+    else
+        tos = T_POP();
+    T_NEXT();
+op_br:
+    T_GETWORD(tmp);
+    pc += tmp;
+    T_NEXT();
+op_brlt:
+    T_GETWORD(tmp);
+    val = T_POP();
+    if (val < tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brle:
+    T_GETWORD(tmp);
+    val = T_POP();
+    if (val <= tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_breq:
+    T_GETWORD(tmp);
+    val = T_POP();
+    if (val == tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brne:
+    T_GETWORD(tmp);
+    val = T_POP();
+    if (val != tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brge:
+    T_GETWORD(tmp);
+    val = T_POP();
+    if (val >= tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brgt:
+    T_GETWORD(tmp);
+    val = T_POP();
+    if (val > tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brltz:
+    T_GETWORD(tmp);
+    if (tos < 0)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brlez:
+    T_GETWORD(tmp);
+    if (tos <= 0)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brgez:
+    T_GETWORD(tmp);
+    if (tos >= 0)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_brgtz:
+    T_GETWORD(tmp);
+    if (tos > 0)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_br8:
+    tmpb = (int8_t)VMCODEBYTE(pc++);
+    pc += tmpb;
+    T_NEXT();
+op_br16:
+    T_GETHWORD(tmp);
+    pc += tmp;
+    T_NEXT();
+op_not:
+    tos = (tos ? FALSE : TRUE);
+    T_NEXT();
+op_neg:
+    tos = -tos;
+    T_NEXT();
+op_add:
+    tmp = T_POP();
+    tos = tmp + tos;
+    T_NEXT();
+op_sub:
+    tmp = T_POP();
+    tos = tmp - tos;
+    T_NEXT();
+op_mul:
+    tmp = T_POP();
+    tos = tmp * tos;
+    T_NEXT();
+op_div:
+    tmp = T_POP();
+    tos = (tos == 0 ? 0 : tmp / tos);
+    T_NEXT();
+op_rem:
+    tmp = T_POP();
+    tos = (tos == 0 ? 0 : tmp % tos);
+    T_NEXT();
+op_bnot:
+    tos = ~tos;
+    T_NEXT();
+op_band:
+    tmp = T_POP();
+    tos = tmp & tos;
+    T_NEXT();
+op_bor:
+    tmp = T_POP();
+    tos = tmp | tos;
+    T_NEXT();
+op_bxor:
+    tmp = T_POP();
+    tos = tmp ^ tos;
+    T_NEXT();
+op_shl:
+    tmp = T_POP();
+    tos = tmp << tos;
+    T_NEXT();
+op_shr:
+    tmp = T_POP();
+    tos = tmp >> tos;
+    T_NEXT();
+op_lt:
+    tmp = T_POP();
+    tos = (tmp < tos ? TRUE : FALSE);
+    T_NEXT();
+op_le:
+    tmp = T_POP();
+    tos = (tmp <= tos ? TRUE : FALSE);
+    T_NEXT();
+op_eq:
+    tmp = T_POP();
+    tos = (tmp == tos ? TRUE : FALSE);
+    T_NEXT();
+op_ne:
+    tmp = T_POP();
+    tos = (tmp != tos ? TRUE : FALSE);
+    T_NEXT();
+op_ge:
+    tmp = T_POP();
+    tos = (tmp >= tos ? TRUE : FALSE);
+    T_NEXT();
+op_gt:
+    tmp = T_POP();
+    tos = (tmp > tos ? TRUE : FALSE);
+    T_NEXT();
+op_lit:
+    T_GETWORD(tmp);
+    T_PUSH(tos);
+    tos = tmp;
+    T_NEXT();
+op_slit:
+    tmpb = (int8_t)VMCODEBYTE(pc++);
+    T_PUSH(tos);
+    tos = tmpb;
+    T_NEXT();
+op_lit16:
+    T_GETHWORD(tmp);
+    T_PUSH(tos);
+    tos = tmp;
+    T_NEXT();
+op_load:
+    tos = LoadValue(i, (VMUVALUE)tos);
+    T_NEXT();
+op_loadb:
+    tos = LoadByteValue(i, (VMUVALUE)tos);
+    T_NEXT();
+op_loadw:
+    tos = LoadWordValue(i, (VMUVALUE)tos);
+    T_NEXT();
+op_store:
+    tmp = T_POP();
+    StoreValue(i, (VMUVALUE)tos, tmp);
+    tos = T_POP();
+    T_NEXT();
+op_storeb:
+    tmp = T_POP();
+    StoreByteValue(i, (VMUVALUE)tos, tmp);
+    tos = T_POP();
+    T_NEXT();
+op_storew:
+    tmp = T_POP();
+    StoreWordValue(i, (VMUVALUE)tos, tmp);
+    tos = T_POP();
+    T_NEXT();
+op_lref:
+    tmpb = (int8_t)VMCODEBYTE(pc++);
+    T_PUSH(tos);
+    tos = fp[(int)tmpb];
+    T_NEXT();
+op_lset:
+    tmpb = (int8_t)VMCODEBYTE(pc++);
+    fp[(int)tmpb] = tos;
+    tos = T_POP();
+    T_NEXT();
+op_index:
+    tmp = T_POP();
+    tos = tmp + tos * sizeof (VMVALUE);
+    T_NEXT();
+op_pushj:
+    tmp = (VMVALUE)(pc - i->codeBase);
+    pc = (uint8_t *)MapAddress(i, tos);
+    tos = tmp;
+    T_NEXT();
+op_popj:
+    pc = i->codeBase + tos;
+    tos = T_POP();
+    T_NEXT();
+op_clean:
+    cnt = VMCODEBYTE(pc++);
+    sp += cnt;
+    T_NEXT();
+op_frame:
+    cnt = VMCODEBYTE(pc++);
+    val = VMCODEBYTE(pc++);
+    tmp = (VMVALUE)(fp - stack);
+    fp = sp;
+    if (sp - cnt - val < stack) {
+        T_SAVE();
+        StackOverflow(i);
+    }
+    while (--cnt >= 0)
+        T_PUSH(0);
+    fp[F_FP] = tmp;
+    T_NEXT();
+op_returnz:
+    T_PUSH(tos);
+    tos = 0;
+    // fall through
+op_return:
+    pc = i->codeBase + T_TOP();
+    sp = fp;
+    fp = (VMVALUE *)(stack + fp[F_FP]);
+    T_NEXT();
+op_drop:
+    tos = T_POP();
+    T_NEXT();
+op_dup:
+    T_PUSH(tos);
+    T_NEXT();
+op_native:
+    T_GETWORD(tmp);
+    T_SAVE();
+    DoNative(i, tmp);
+    T_RESTORE();
+    T_NEXT();
+op_trap:
+    cnt = VMCODEBYTE(pc++);
+    T_SAVE();
+    DoTrap(i, cnt);
+    T_RESTORE();
+    stack = i->stack;           /* a task switch changes the stack */
+    T_NEXT();
+op_linc:
+    tmpb = (int8_t)VMCODEBYTE(pc++);
+    fp[(int)tmpb] += (int8_t)VMCODEBYTE(pc++);
+    T_NEXT();
+op_loada:
+    T_GETWORD(tmp);
+    T_PUSH(tos);
+    tos = LoadConstValue(i, (VMUVALUE)tmp);
+    T_NEXT();
+op_storea:
+    T_GETWORD(tmp);
+    StoreConstValue(i, (VMUVALUE)tmp, tos);
+    tos = T_POP();
+    T_NEXT();
+op_loadx:
+    tmp = T_POP();
+    tos = LoadValue(i, (VMUVALUE)(tmp + tos * sizeof (VMVALUE)));
+    T_NEXT();
+op_storex:
+    tmp = T_POP();
+    tmp += tos * sizeof (VMVALUE);
+    StoreValue(i, (VMUVALUE)tmp, T_POP());
+    tos = T_POP();
+    T_NEXT();
+op_check:
+    T_GETWORD(tmp);
+    if ((VMUVALUE)tos >= (VMUVALUE)tmp)
+        goto index_error;
+    T_NEXT();
+op_vref:
+    T_GETWORD(tmp);
+    if ((VMUVALUE)tos >= (VMUVALUE)tmp)
+        goto index_error;
+    tmp = T_POP();
+    tos = LoadValue(i, (VMUVALUE)(tmp + tos * sizeof (VMVALUE)));
+    T_NEXT();
+op_vset:
+    T_GETWORD(tmp);
+    if ((VMUVALUE)tos >= (VMUVALUE)tmp)
+        goto index_error;
+    tmp = T_POP();
+    tmp += tos * sizeof (VMVALUE);
+    StoreValue(i, (VMUVALUE)tmp, T_POP());
+    tos = T_POP();
+    T_NEXT();
+op_switch:
+    cnt = VMCODEBYTE(pc++);
+    tmp = ((VMUVALUE)tos < (VMUVALUE)cnt ? tos : cnt);
+    pc += tmp * (1 + sizeof(VMUVALUE));
+    tos = T_POP();
+    T_NEXT();
+op_forloop:
+    tmpb = (int8_t)VMCODEBYTE(pc++);
+    val = (fp[(int)tmpb] += (int8_t)VMCODEBYTE(pc++));
+    T_GETWORD(tmp);
+    if (val <= tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_forloopa:
+    T_GETWORD(tmp);
+    val = LoadConstValue(i, (VMUVALUE)tmp) + (int8_t)VMCODEBYTE(pc++);
+    StoreConstValue(i, (VMUVALUE)tmp, val);
+    T_GETWORD(tmp);
+    if (val <= tos)
+        pc += tmp;
+    tos = T_POP();
+    T_NEXT();
+op_gref:
+    tmp = VMCODEBYTE(pc++);
+    T_PUSH(tos);
+    tos = LoadConstValue(i, (VMUVALUE)tmp * sizeof(VMVALUE));
+    T_NEXT();
+op_gset:
+    tmp = VMCODEBYTE(pc++);
+    StoreConstValue(i, (VMUVALUE)tmp * sizeof(VMVALUE), tos);
+    tos = T_POP();
+    T_NEXT();
+op_gref16:
+    T_GETHWORD(tmp);
+    T_PUSH(tos);
+    tos = LoadConstValue(i, (VMUVALUE)(uint16_t)tmp * sizeof(VMVALUE));
+    T_NEXT();
+op_gset16:
+    T_GETHWORD(tmp);
+    StoreConstValue(i, (VMUVALUE)(uint16_t)tmp * sizeof(VMVALUE), tos);
+    tos = T_POP();
+    T_NEXT();
+op_call:
+    T_GETWORD(tmp);
+    T_PUSH(tos);
+    tos = (VMVALUE)(pc - i->codeBase);
+    pc = (uint8_t *)MAP_ADDRESS(i, tmp);
+    T_NEXT();
+op_ret:
+    cnt = VMCODEBYTE(pc++);
+    pc = i->codeBase + T_TOP();
+    sp = fp + cnt;
+    fp = (VMVALUE *)(stack + fp[F_FP]);
+    T_NEXT();
+op_undefined:
+    T_SAVE();
+    Abort(i, "undefined opcode 0x%02x", VMCODEBYTE(pc - 1));
+    return FALSE; // not reached
+index_error:
+    T_SAVE();
+    IndexError(i, tos, (VMUVALUE)tmp);
+    return FALSE; // not reached
+}
+
+/* state access macros for the decoded engine */
+#define D_SAVE()        (i->sp = sp, i->fp = fp, i->tos = tos)
+#define D_RESTORE()     (sp = i->sp, fp = i->fp, tos = i->tos)
+#define D_NEXT(n)       do { ip += (n); goto *ip->handler; } while (0)
+#define D_JUMP(t)       do { ip = (t); goto *ip->handler; } while (0)
+
+/* ExecuteDecoded - execute the pre-decoded form of the code section
+   (this must produce exactly the same results as ExecuteSwitch) */
+static int ExecuteDecoded(Interpreter *i)
+{
+    static void *dispatch[256] = {
+        [0 ... 255]     = &&op_undefined,
+        [OP_HALT]       = &&op_halt,
+        [OP_BRT]        = &&op_brt,
+        [OP_BRTSC]      = &&op_brtsc,
+        [OP_BRF]        = &&op_brf,
+        [OP_BRFSC]      = &&op_brfsc,
+        [OP_BR]         = &&op_br,
+        [OP_NOT]        = &&op_not,
+        [OP_NEG]        = &&op_neg,
+        [OP_ADD]        = &&op_add,
+        [OP_SUB]        = &&op_sub,
+        [OP_MUL]        = &&op_mul,
+        [OP_DIV]        = &&op_div,
+        [OP_REM]        = &&op_rem,
+        [OP_BNOT]       = &&op_bnot,
+        [OP_BAND]       = &&op_band,
+        [OP_BOR]        = &&op_bor,
+        [OP_BXOR]       = &&op_bxor,
+        [OP_SHL]        = &&op_shl,
+        [OP_SHR]        = &&op_shr,
+        [OP_LT]         = &&op_lt,
+        [OP_LE]         = &&op_le,
+        [OP_EQ]         = &&op_eq,
+        [OP_NE]         = &&op_ne,
+        [OP_GE]         = &&op_ge,
+        [OP_GT]         = &&op_gt,
+        [OP_LIT]        = &&op_lit,
+        [OP_SLIT]       = &&op_slit,
+        [OP_LOAD]       = &&op_load,
+        [OP_LOADB]      = &&op_loadb,
+        [OP_STORE]      = &&op_store,
+        [OP_STOREB]     = &&op_storeb,
+        [OP_LREF]       = &&op_lref,
+        [OP_LSET]       = &&op_lset,
+        [OP_INDEX]      = &&op_index,
+        [OP_PUSHJ]      = &&op_pushj,
+        [OP_POPJ]       = &&op_popj,
+        [OP_CLEAN]      = &&op_clean,
+        [OP_FRAME]      = &&op_frame,
+        [OP_RETURN]     = &&op_return,
+        [OP_RETURNZ]    = &&op_returnz,
+        [OP_DROP]       = &&op_drop,
+        [OP_DUP]        = &&op_dup,
+        [OP_NATIVE]     = &&op_native,
+        [OP_TRAP]       = &&op_trap,
+        [OP_LINC]       = &&op_linc,
+        [OP_LOADA]      = &&op_loada,
+        [OP_STOREA]     = &&op_storea,
+        [OP_LOADX]      = &&op_loadx,
+        [OP_STOREX]     = &&op_storex,
+        [OP_BR8]        = &&op_br8,
+        [OP_BR16]       = &&op_br16,
+        [OP_LIT16]      = &&op_lit16,
+        [OP_SWITCH]     = &&op_switch,
+        [OP_FORLOOP]    = &&op_forloop,
+        [OP_FORLOOPA]   = &&op_forloopa,
+        [OP_GREF]       = &&op_gref,
+        [OP_GSET]       = &&op_gset,
+        [OP_GREF16]     = &&op_gref16,
+        [OP_GSET16]     = &&op_gset16,
+        [OP_CALL]       = &&op_call,
+        [OP_RET]        = &&op_ret,
+        [OP_LOADW]      = &&op_loadw,
+        [OP_STOREW]     = &&op_storew,
+        [OP_BRLT]       = &&op_brlt,
+        [OP_BRLE]       = &&op_brle,
+        [OP_BREQ]       = &&op_breq,
+        [OP_BRNE]       = &&op_brne,
+        [OP_BRGE]       = &&op_brge,
+        [OP_BRGT]       = &&op_brgt,
+        [OP_BRLTZ]      = &&op_brltz,
+        [OP_BRLEZ]      = &&op_brlez,
+        [OP_BRGEZ]      = &&op_brgez,
+        [OP_BRGTZ]      = &&op_brgtz,
+        [OP_CHECK]      = &&op_check,
+        [OP_VREF]       = &&op_vref,
+        [OP_VSET]       = &&op_vset
+    };
+    /* pushes that leave the old top of the stack in nos instead of memory */
+    static void *nosPush[256] = {
+        [OP_LIT]        = &&op_lit_nos,
+        [OP_SLIT]       = &&op_slit_nos,
+        [OP_LIT16]      = &&op_lit16_nos,
+        [OP_LREF]       = &&op_lref_nos,
+        [OP_GREF]       = &&op_gref_nos,
+        [OP_GREF16]     = &&op_gref16_nos,
+        [OP_LOADA]      = &&op_loada_nos,
+        [OP_DUP]        = &&op_dup_nos
+    };
+    /* instructions that take the value below the top of the stack from nos */
+    static void *nosPop[256] = {
+        [OP_ADD]        = &&op_add_nos,
+        [OP_SUB]        = &&op_sub_nos,
+        [OP_MUL]        = &&op_mul_nos,
+        [OP_DIV]        = &&op_div_nos,
+        [OP_REM]        = &&op_rem_nos,
+        [OP_BAND]       = &&op_band_nos,
+        [OP_BOR]        = &&op_bor_nos,
+        [OP_BXOR]       = &&op_bxor_nos,
+        [OP_SHL]        = &&op_shl_nos,
+        [OP_SHR]        = &&op_shr_nos,
+        [OP_LT]         = &&op_lt_nos,
+        [OP_LE]         = &&op_le_nos,
+        [OP_EQ]         = &&op_eq_nos,
+        [OP_NE]         = &&op_ne_nos,
+        [OP_GE]         = &&op_ge_nos,
+        [OP_GT]         = &&op_gt_nos,
+        [OP_INDEX]      = &&op_index_nos,
+        [OP_LOADX]      = &&op_loadx_nos,
+        [OP_VREF]       = &&op_vref_nos,
+        [OP_STORE]      = &&op_store_nos,
+        [OP_STOREB]     = &&op_storeb_nos,
+        [OP_STOREW]     = &&op_storew_nos,
+        [OP_BRLT]       = &&op_brlt_nos,
+        [OP_BRLE]       = &&op_brle_nos,
+        [OP_BREQ]       = &&op_breq_nos,
+        [OP_BRNE]       = &&op_brne_nos,
+        [OP_BRGE]       = &&op_brge_nos,
+        [OP_BRGT]       = &&op_brgt_nos
+    };
+    VMUVALUE base = i->image->codeSection->fileSection->base;
+    VMUVALUE size = i->image->codeSection->fileSection->size;
+    DecodedInsn *code = i->image->decoded;
+    VMVALUE *stack = i->stack;
+    VMVALUE *sp = i->sp;
+    VMVALUE *fp = i->fp;
+    VMVALUE tos = i->tos;
+    VMVALUE nos = 0;
+    DecodedInsn *ip, *next;
+    VMUVALUE offset;
+    VMVALUE tmp;
+    int cnt;
+
+    /* bind the opcode handlers */
+bind:
+    for (offset = 0; offset < size; ++offset)
+        code[offset].handler = code[offset].valid ? dispatch[code[offset].opcode] : &&op_undecoded;
+        
+    /* a push followed by an instruction that pops the value below it keeps that value in nos
+       (nos is only live between the two so calls, traps and branch targets never see it) */
+    for (offset = 0; offset < size; ++offset) {
+        ip = &code[offset];
+        if (ip->valid && nosPush[ip->opcode] && offset + ip->length < size) {
+            next = ip + ip->length;
+            if (next->valid && !next->entry && nosPop[next->opcode]) {
+                ip->handler = nosPush[ip->opcode];
+                next->handler = nosPop[next->opcode];
+            }
         }
     }
-    Abort(i, "address error");
-    return NULL; // not reached
+        
+    /* start with the instruction at the current pc */
+    ip = &code[i->pc - i->image->codeSection->data];
+    goto *ip->handler;
+
+op_undecoded:
+    i->pc = i->image->codeSection->data + (ip - code);
+    if (!PredecodeCode(i->image, base + (ip - code))) {
+        D_SAVE();
+        Abort(i, "address error");
+    }
+    goto bind;
+op_halt:
+    D_SAVE();
+    FlushOutput(i);
+    return TRUE;
+op_brt:
+    if ((tmp = tos) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (tmp)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brtsc:
+    if (tos) {
+        if (!ip->target)
+            goto branch_error;
+        D_JUMP(ip->target);
+    }
+    tos = T_POP();
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brf:
+    if ((tmp = tos) == 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (!tmp)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brfsc:
+    if (!tos) {
+        if (!ip->target)
+            goto branch_error;
+        D_JUMP(ip->target);
+    }
+    tos = T_POP();
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brlt:
+    if ((cnt = (T_TOP() < tos)) != 0 && !ip->target)
+        goto branch_error;
+    sp += 1;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brle:
+    if ((cnt = (T_TOP() <= tos)) != 0 && !ip->target)
+        goto branch_error;
+    sp += 1;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_breq:
+    if ((cnt = (T_TOP() == tos)) != 0 && !ip->target)
+        goto branch_error;
+    sp += 1;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brne:
+    if ((cnt = (T_TOP() != tos)) != 0 && !ip->target)
+        goto branch_error;
+    sp += 1;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brge:
+    if ((cnt = (T_TOP() >= tos)) != 0 && !ip->target)
+        goto branch_error;
+    sp += 1;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brgt:
+    if ((cnt = (T_TOP() > tos)) != 0 && !ip->target)
+        goto branch_error;
+    sp += 1;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brltz:
+    if ((cnt = (tos < 0)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brlez:
+    if ((cnt = (tos <= 0)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brgez:
+    if ((cnt = (tos >= 0)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brgtz:
+    if ((cnt = (tos > 0)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_br:
+op_br8:
+op_br16:
+    if (!ip->target)
+        goto branch_error;
+    D_JUMP(ip->target);
+op_not:
+    tos = (tos ? FALSE : TRUE);
+    D_NEXT(1);
+op_neg:
+    tos = -tos;
+    D_NEXT(1);
+op_add:
+    tmp = T_POP();
+    tos = tmp + tos;
+    D_NEXT(1);
+op_sub:
+    tmp = T_POP();
+    tos = tmp - tos;
+    D_NEXT(1);
+op_mul:
+    tmp = T_POP();
+    tos = tmp * tos;
+    D_NEXT(1);
+op_div:
+    tmp = T_POP();
+    tos = (tos == 0 ? 0 : tmp / tos);
+    D_NEXT(1);
+op_rem:
+    tmp = T_POP();
+    tos = (tos == 0 ? 0 : tmp % tos);
+    D_NEXT(1);
+op_bnot:
+    tos = ~tos;
+    D_NEXT(1);
+op_band:
+    tmp = T_POP();
+    tos = tmp & tos;
+    D_NEXT(1);
+op_bor:
+    tmp = T_POP();
+    tos = tmp | tos;
+    D_NEXT(1);
+op_bxor:
+    tmp = T_POP();
+    tos = tmp ^ tos;
+    D_NEXT(1);
+op_shl:
+    tmp = T_POP();
+    tos = tmp << tos;
+    D_NEXT(1);
+op_shr:
+    tmp = T_POP();
+    tos = tmp >> tos;
+    D_NEXT(1);
+op_lt:
+    tmp = T_POP();
+    tos = (tmp < tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_le:
+    tmp = T_POP();
+    tos = (tmp <= tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_eq:
+    tmp = T_POP();
+    tos = (tmp == tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_ne:
+    tmp = T_POP();
+    tos = (tmp != tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_ge:
+    tmp = T_POP();
+    tos = (tmp >= tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_gt:
+    tmp = T_POP();
+    tos = (tmp > tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_lit:
+    T_PUSH(tos);
+    tos = ip->operand;
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_slit:
+    T_PUSH(tos);
+    tos = ip->operand;
+    D_NEXT(2);
+op_lit16:
+    T_PUSH(tos);
+    tos = ip->operand;
+    D_NEXT(3);
+op_load:
+    tos = LoadValue(i, (VMUVALUE)tos);
+    D_NEXT(1);
+op_loadb:
+    tos = LoadByteValue(i, (VMUVALUE)tos);
+    D_NEXT(1);
+op_loadw:
+    tos = LoadWordValue(i, (VMUVALUE)tos);
+    D_NEXT(1);
+op_store:
+    tmp = T_POP();
+    StoreValue(i, (VMUVALUE)tos, tmp);
+    tos = T_POP();
+    D_NEXT(1);
+op_storeb:
+    tmp = T_POP();
+    StoreByteValue(i, (VMUVALUE)tos, tmp);
+    tos = T_POP();
+    D_NEXT(1);
+op_storew:
+    tmp = T_POP();
+    StoreWordValue(i, (VMUVALUE)tos, tmp);
+    tos = T_POP();
+    D_NEXT(1);
+op_lref:
+    T_PUSH(tos);
+    tos = fp[(int)ip->operand];
+    D_NEXT(2);
+op_lset:
+    fp[(int)ip->operand] = tos;
+    tos = T_POP();
+    D_NEXT(2);
+op_index:
+    tmp = T_POP();
+    tos = tmp + tos * sizeof (VMVALUE);
+    D_NEXT(1);
+op_pushj:
+    tmp = (VMVALUE)(ip - code) + 1;
+    if ((offset = (VMUVALUE)tos - base) >= size) {
+        D_SAVE();
+        MapAddress(i, tos);
+        Abort(i, "can't execute code outside of section %08x", base);
+    }
+    tos = tmp;
+    D_JUMP(&code[offset]);
+op_popj:
+    if ((offset = (VMUVALUE)tos) >= size)
+        goto return_error;
+    tos = T_POP();
+    D_JUMP(&code[offset]);
+op_clean:
+    sp += ip->operand;
+    D_NEXT(2);
+op_frame:
+    cnt = ip->operand;
+    tmp = (VMVALUE)(fp - stack);
+    fp = sp;
+    if (sp - cnt - ip->operand2 < stack) {
+        D_SAVE();
+        StackOverflow(i);
+    }
+    while (--cnt >= 0)
+        T_PUSH(0);
+    fp[F_FP] = tmp;
+    D_NEXT(3);
+op_returnz:
+    T_PUSH(tos);
+    tos = 0;
+    // fall through
+op_return:
+    if ((offset = (VMUVALUE)T_TOP()) >= size)
+        goto return_error;
+    sp = fp;
+    fp = (VMVALUE *)(stack + fp[F_FP]);
+    D_JUMP(&code[offset]);
+op_drop:
+    tos = T_POP();
+    D_NEXT(1);
+op_dup:
+    T_PUSH(tos);
+    D_NEXT(1);
+op_native:
+    D_SAVE();
+    i->pc = i->image->codeSection->data + (ip - code) + 1 + sizeof(VMUVALUE);
+    DoNative(i, ip->operand);
+    D_RESTORE();
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_trap:
+    D_SAVE();
+    i->pc = i->image->codeSection->data + (ip - code) + 2;
+    DoTrap(i, ip->operand);
+    D_RESTORE();
+    stack = i->stack;           /* a task switch changes the stack and the pc */
+    D_JUMP(&code[i->pc - i->image->codeSection->data]);
+op_linc:
+    fp[(int)ip->operand] += ip->operand2;
+    D_NEXT(3);
+op_loada:
+    T_PUSH(tos);
+    tos = LoadConstValue(i, (VMUVALUE)ip->operand);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_storea:
+    StoreConstValue(i, (VMUVALUE)ip->operand, tos);
+    tos = T_POP();
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_loadx:
+    tmp = T_POP();
+    tos = LoadValue(i, (VMUVALUE)(tmp + tos * sizeof (VMVALUE)));
+    D_NEXT(1);
+op_storex:
+    tmp = T_POP();
+    tmp += tos * sizeof (VMVALUE);
+    StoreValue(i, (VMUVALUE)tmp, T_POP());
+    tos = T_POP();
+    D_NEXT(1);
+op_check:
+    if ((VMUVALUE)tos >= (VMUVALUE)ip->operand)
+        goto index_error;
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_vref:
+    if ((VMUVALUE)tos >= (VMUVALUE)ip->operand)
+        goto index_error;
+    tmp = T_POP();
+    tos = LoadValue(i, (VMUVALUE)(tmp + tos * sizeof (VMVALUE)));
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_vset:
+    if ((VMUVALUE)tos >= (VMUVALUE)ip->operand)
+        goto index_error;
+    tmp = T_POP();
+    tmp += tos * sizeof (VMVALUE);
+    StoreValue(i, (VMUVALUE)tmp, T_POP());
+    tos = T_POP();
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_switch:
+    tmp = ((VMUVALUE)tos < (VMUVALUE)ip->operand ? tos : ip->operand);
+    tos = T_POP();
+    D_NEXT(2 + tmp * (1 + sizeof(VMUVALUE)));
+op_forloop:
+    if ((tmp = ((fp[(int)ip->operand] += ip->operand2) <= tos)) && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (tmp)
+        D_JUMP(ip->target);
+    D_NEXT(3 + sizeof(VMUVALUE));
+op_forloopa:
+    tmp = LoadConstValue(i, (VMUVALUE)ip->operand) + ip->operand2;
+    StoreConstValue(i, (VMUVALUE)ip->operand, tmp);
+    if ((tmp = (tmp <= tos)) && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (tmp)
+        D_JUMP(ip->target);
+    D_NEXT(2 + sizeof(VMUVALUE) * 2);
+op_gref:
+    T_PUSH(tos);
+    tos = LoadConstValue(i, (VMUVALUE)ip->operand * sizeof(VMVALUE));
+    D_NEXT(2);
+op_gset:
+    StoreConstValue(i, (VMUVALUE)ip->operand * sizeof(VMVALUE), tos);
+    tos = T_POP();
+    D_NEXT(2);
+op_gref16:
+    T_PUSH(tos);
+    tos = LoadConstValue(i, (VMUVALUE)(uint16_t)ip->operand * sizeof(VMVALUE));
+    D_NEXT(3);
+op_gset16:
+    StoreConstValue(i, (VMUVALUE)(uint16_t)ip->operand * sizeof(VMVALUE), tos);
+    tos = T_POP();
+    D_NEXT(3);
+op_call:
+    if (!ip->target) {
+        D_SAVE();
+        MapAddress(i, ip->operand);
+        Abort(i, "can't execute code outside of section %08x", base);
+    }
+    T_PUSH(tos);
+    tos = (VMVALUE)(ip - code) + 1 + sizeof(VMUVALUE);
+    D_JUMP(ip->target);
+op_ret:
+    if ((offset = (VMUVALUE)T_TOP()) >= size)
+        goto return_error;
+    sp = fp + ip->operand;
+    fp = (VMVALUE *)(stack + fp[F_FP]);
+    D_JUMP(&code[offset]);
+op_lit_nos:
+    nos = tos;
+    tos = ip->operand;
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_slit_nos:
+    nos = tos;
+    tos = ip->operand;
+    D_NEXT(2);
+op_lit16_nos:
+    nos = tos;
+    tos = ip->operand;
+    D_NEXT(3);
+op_lref_nos:
+    nos = tos;
+    tos = fp[(int)ip->operand];
+    D_NEXT(2);
+op_gref_nos:
+    nos = tos;
+    tos = LoadConstValue(i, (VMUVALUE)ip->operand * sizeof(VMVALUE));
+    D_NEXT(2);
+op_gref16_nos:
+    nos = tos;
+    tos = LoadConstValue(i, (VMUVALUE)(uint16_t)ip->operand * sizeof(VMVALUE));
+    D_NEXT(3);
+op_loada_nos:
+    nos = tos;
+    tos = LoadConstValue(i, (VMUVALUE)ip->operand);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_dup_nos:
+    nos = tos;
+    D_NEXT(1);
+op_add_nos:
+    tos = nos + tos;
+    D_NEXT(1);
+op_sub_nos:
+    tos = nos - tos;
+    D_NEXT(1);
+op_mul_nos:
+    tos = nos * tos;
+    D_NEXT(1);
+op_div_nos:
+    tos = (tos == 0 ? 0 : nos / tos);
+    D_NEXT(1);
+op_rem_nos:
+    tos = (tos == 0 ? 0 : nos % tos);
+    D_NEXT(1);
+op_band_nos:
+    tos = nos & tos;
+    D_NEXT(1);
+op_bor_nos:
+    tos = nos | tos;
+    D_NEXT(1);
+op_bxor_nos:
+    tos = nos ^ tos;
+    D_NEXT(1);
+op_shl_nos:
+    tos = nos << tos;
+    D_NEXT(1);
+op_shr_nos:
+    tos = nos >> tos;
+    D_NEXT(1);
+op_lt_nos:
+    tos = (nos < tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_le_nos:
+    tos = (nos <= tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_eq_nos:
+    tos = (nos == tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_ne_nos:
+    tos = (nos != tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_ge_nos:
+    tos = (nos >= tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_gt_nos:
+    tos = (nos > tos ? TRUE : FALSE);
+    D_NEXT(1);
+op_index_nos:
+    tos = nos + tos * sizeof (VMVALUE);
+    D_NEXT(1);
+op_loadx_nos:
+    tos = LoadValue(i, (VMUVALUE)(nos + tos * sizeof (VMVALUE)));
+    D_NEXT(1);
+op_vref_nos:
+    if ((VMUVALUE)tos >= (VMUVALUE)ip->operand) {
+        T_PUSH(nos);            /* the vector is on the stack again when the program stops */
+        goto index_error;
+    }
+    tos = LoadValue(i, (VMUVALUE)(nos + tos * sizeof (VMVALUE)));
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_store_nos:
+    StoreValue(i, (VMUVALUE)tos, nos);
+    tos = T_POP();
+    D_NEXT(1);
+op_storeb_nos:
+    StoreByteValue(i, (VMUVALUE)tos, nos);
+    tos = T_POP();
+    D_NEXT(1);
+op_storew_nos:
+    StoreWordValue(i, (VMUVALUE)tos, nos);
+    tos = T_POP();
+    D_NEXT(1);
+op_brlt_nos:
+    if ((cnt = (nos < tos)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brle_nos:
+    if ((cnt = (nos <= tos)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_breq_nos:
+    if ((cnt = (nos == tos)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brne_nos:
+    if ((cnt = (nos != tos)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brge_nos:
+    if ((cnt = (nos >= tos)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_brgt_nos:
+    if ((cnt = (nos > tos)) != 0 && !ip->target)
+        goto branch_error;
+    tos = T_POP();
+    if (cnt)
+        D_JUMP(ip->target);
+    D_NEXT(1 + sizeof(VMUVALUE));
+op_undefined:
+    D_SAVE();
+    Abort(i, "undefined opcode 0x%02x", ip->opcode);
+    return FALSE; // not reached
+branch_error:
+    D_SAVE();
+    Abort(i, "branch target out of range");
+    return FALSE; // not reached
+return_error:
+    D_SAVE();
+    Abort(i, "bad return address");
+    return FALSE; // not reached
+index_error:
+    D_SAVE();
+    IndexError(i, tos, (VMUVALUE)ip->operand);
+    return FALSE; // not reached
+}
+
+#endif
+
+/* MapAddress - map a VM address to a host address with bounds checking
+   (the cog registers are in db_vmpins.c unless the image has a section for them) */
+uint8_t *MapAddress(Interpreter *i, VMUVALUE addr)
+{
+    ImageSection *section = i->sectionMap[ADDR_REGION(addr)];
+    uint8_t *reg;
+    if (!section || ADDR_OFFSET(addr) > section->fileSection->size) {
+        if (!section && (reg = MapRegister(i, addr)) != NULL)
+            return reg;
+        Abort(i, "address error");
+    }
+    return (uint8_t *)(section->data + ADDR_OFFSET(addr));
 }
 
-static VMVALUE LoadValue(Interpreter *i, VMUVALUE addr)
+/* MapAddressUnchecked - map a VM address to a host address in a verified image */
+static uint8_t *MapAddressUnchecked(Interpreter *i, VMUVALUE addr)
+{
+    return (uint8_t *)(i->sectionMap[ADDR_REGION(addr)]->data + ADDR_OFFSET(addr));
+}
+
+VMVALUE LoadValue(Interpreter *i, VMUVALUE addr)
 {
     VMVALUE *p = (VMVALUE *)MapAddress(i, addr);
     return *p;
 }
 
-static VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr)
+VMVALUE LoadByteValue(Interpreter *i, VMUVALUE addr)
 {
     uint8_t *p = MapAddress(i, addr);
     return *p;
 }
 
-static void StoreValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
+void StoreValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
 {
     VMVALUE *p = (VMVALUE *)MapAddress(i, addr);
     *p = value;
+    if (ADDR_REGION(addr) == ADDR_REGION(COG_BASE))
+        RegisterStored(i, addr);
 }
 
-static void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
+void StoreByteValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
 {
     uint8_t *p = MapAddress(i, addr);
     *p = value;
+    if (ADDR_REGION(addr) == ADDR_REGION(COG_BASE))
+        RegisterStored(i, addr);
+}
+
+VMVALUE LoadWordValue(Interpreter *i, VMUVALUE addr)
+{
+    uint16_t *p = (uint16_t *)MapAddress(i, addr);
+    return *p;
+}
+
+void StoreWordValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
+{
+    uint16_t *p = (uint16_t *)MapAddress(i, addr);
+    *p = value;
+    if (ADDR_REGION(addr) == ADDR_REGION(COG_BASE))
+        RegisterStored(i, addr);
+}
+
+/* LoadConstValue - load a long from an address in an instruction operand */
+VMVALUE LoadConstValue(Interpreter *i, VMUVALUE addr)
+{
+    VMVALUE *p = (VMVALUE *)MAP_ADDRESS(i, addr);
+    return *p;
+}
+
+/* StoreConstValue - store a long at an address in an instruction operand */
+void StoreConstValue(Interpreter *i, VMUVALUE addr, VMVALUE value)
+{
+    VMVALUE *p = (VMVALUE *)MAP_ADDRESS(i, addr);
+    *p = value;
+    if (ADDR_REGION(addr) == ADDR_REGION(COG_BASE))
+        RegisterStored(i, addr);
 }
 
-static void DoTrap(Interpreter *i, int op)
+void DoTrap(Interpreter *i, int op)
 {
+    char digits[MAX_DIGITS + 2];
+    VMUVALUE dst, src;
+    VMVALUE size, value, base, width;
+    int j;
+
     switch (op) {
     case TRAP_GETCHAR:
+        FlushOutput(i);
         Push(i, i->tos);
-        i->tos = VM_getchar();
+        i->tos = (VMVALUE)LoggedInput(i, IOLOG_GETCHAR, (*i->console->getChar)(i->consoleCookie));
         break;
     case TRAP_PUTCHAR:
         PrintC(i, i->tos);
         i->tos = Pop(i);
         break;
+    case TRAP_PUTSTR:
+        PrintS(i, (VMUVALUE)Pop(i), i->tos);
+        i->tos = Pop(i);
+        break;
+    case TRAP_STRLEN:
+        i->tos = StringLength(i, (VMUVALUE)i->tos);
+        break;
+    case TRAP_STRCMP:
+        i->tos = CompareStrings(i, (VMUVALUE)Pop(i), (VMUVALUE)i->tos);
+        break;
+    case TRAP_STRCPY:
+        src = (VMUVALUE)i->tos;
+        dst = (VMUVALUE)Pop(i);
+        size = StringLength(i, src) + 1;
+        memmove(MapBytes(i, dst, size), MapBytes(i, src, size), size);
+        i->tos = Pop(i);
+        break;
+    case TRAP_MEMCPY:
+        size = i->tos;
+        src = (VMUVALUE)Pop(i);
+        dst = (VMUVALUE)Pop(i);
+        if (size > 0)
+            memmove(MapBytes(i, dst, size), MapBytes(i, src, size), size);
+        i->tos = Pop(i);
+        break;
+    case TRAP_FIXMUL:
+        value = Pop(i);
+        i->tos = (VMVALUE)(((int64_t)value * i->tos) >> 16);
+        break;
+    case TRAP_FIXDIV:
+        value = Pop(i);
+        i->tos = (i->tos == 0 ? 0 : (VMVALUE)(((int64_t)value * 65536) / i->tos));
+        break;
+    case TRAP_MEMSET:
+        size = i->tos;
+        value = Pop(i);
+        dst = (VMUVALUE)Pop(i);
+        if (size > 0)
+            memset(MapBytes(i, dst, size), (uint8_t)value, size);
+        i->tos = Pop(i);
+        break;
+    case TRAP_PUTNUM:
+        width = i->tos;
+        base = Pop(i);
+        value = Pop(i);
+        size = FormatNumber(i, digits, value, base, width);
+        for (j = 0; j < size; ++j)
+            PrintC(i, digits[j]);
+        i->tos = Pop(i);
+        break;
+    case TRAP_FMTNUM:
+        width = i->tos;
+        base = Pop(i);
+        value = Pop(i);
+        dst = (VMUVALUE)Pop(i);
+        size = FormatNumber(i, digits, value, base, width);
+        memcpy(MapBytes(i, dst, size + 1), digits, size + 1);
+        i->tos = size;
+        break;
+    case TRAP_PARSENUM:
+        dst = (VMUVALUE)i->tos;
+        base = Pop(i);
+        size = Pop(i);
+        src = (VMUVALUE)Pop(i);
+        i->tos = ParseNumber(i, src, &size, base);
+        if (dst)
+            StoreValue(i, dst, size);
+        break;
     default:
-        Abort(i, "undefined print opcode 0x%02x", op);
+        if (op >= TRAP_ARRFILL && op <= TRAP_BUTTERFLY)
+            DoArrayTrap(i, op);
+        else if (op >= TRAP_FADD && op <= TRAP_FTOI)
+            DoFloatTrap(i, op);
+        else if (op >= TRAP_COGSTART && op <= TRAP_LOCKCLR)
+            DoCogTrap(i, op);
+        else if (op >= TRAP_TASKSTART && op <= TRAP_TASKWAIT)
+            DoTaskTrap(i, op);
+        else
+            Abort(i, "undefined print opcode 0x%02x", op);
         break;
     }
 }
 
+/* PrintC - add a character to the output buffer and flush it at the end of a line or when it's full */
 static void PrintC(Interpreter *i, int ch)
 {
-    VM_putchar(ch);
-    if (ch == '\n')
+    i->output[i->outputCount++] = ch;
+    if (ch == '\n') {
         i->linePos = 0;
-    else
+        FlushOutput(i);
+    }
+    else {
         ++i->linePos;
+        if (i->outputCount >= OUTPUT_BUFFER_SIZE)
+            FlushOutput(i);
+    }
+}
+
+/* PrintS - print a string of bytes (a negative length prints up to a terminating zero) */
+static void PrintS(Interpreter *i, VMUVALUE addr, VMVALUE length)
+{
+    ImageSection *section = i->sectionMap[ADDR_REGION(addr)];
+    VMUVALUE offset = ADDR_OFFSET(addr);
+    int ch;
+
+    if (!section)
+        Abort(i, "address error");
+    for (; length != 0; --length) {
+        if (offset >= section->fileSection->size)
+            Abort(i, "address error");
+        if ((ch = section->data[offset++]) == '\0' && length < 0)
+            break;
+        PrintC(i, ch);
+    }
+}
+
+/* MapBytes - map a range of bytes that must lie within a single section */
+uint8_t *MapBytes(Interpreter *i, VMUVALUE addr, VMVALUE size)
+{
+    ImageSection *section = i->sectionMap[ADDR_REGION(addr)];
+    VMUVALUE offset = ADDR_OFFSET(addr);
+    if (!section || offset > section->fileSection->size || (VMUVALUE)size > section->fileSection->size - offset)
+        Abort(i, "address error");
+    return section->data + offset;
+}
+
+/* StringLength - find the length of a zero terminated string */
+static VMVALUE StringLength(Interpreter *i, VMUVALUE addr)
+{
+    ImageSection *section = i->sectionMap[ADDR_REGION(addr)];
+    VMUVALUE offset = ADDR_OFFSET(addr);
+    uint8_t *end;
+    if (!section || offset >= section->fileSection->size)
+        Abort(i, "address error");
+    if (!(end = memchr(section->data + offset, '\0', section->fileSection->size - offset)))
+        Abort(i, "address error");
+    return (VMVALUE)(end - (section->data + offset));
+}
+
+/* CompareStrings - compare two zero terminated strings returning -1, 0, or 1 */
+static VMVALUE CompareStrings(Interpreter *i, VMUVALUE addr1, VMUVALUE addr2)
+{
+    VMVALUE len1 = StringLength(i, addr1);
+    VMVALUE len2 = StringLength(i, addr2);
+    int cmp = memcmp(MapBytes(i, addr1, len1), MapBytes(i, addr2, len2), (len1 < len2 ? len1 : len2) + 1);
+    return cmp < 0 ? -1 : cmp > 0 ? 1 : 0;
+}
+
+/* FormatNumber - format a value with at least width digits followed by a terminating zero (returns the length) */
+static int FormatNumber(Interpreter *i, char *buf, VMVALUE value, VMVALUE base, VMVALUE width)
+{
+    char reversed[MAX_DIGITS];
+    VMUVALUE n = (VMUVALUE)value;
+    int count = 0, length = 0, digit;
+    
+    if (base < 2 || base > 36)
+        Abort(i, "bad number base %d", base);
+    if (width > MAX_DIGITS)
+        width = MAX_DIGITS;
+    
+    /* only decimal numbers are signed */
+    if (base == 10 && value < 0) {
+        buf[length++] = '-';
+        n = -n;
+    }
+    
+    /* collect the digits from the least significant one */
+    do {
+        digit = n % base;
+        reversed[count++] = (digit < 10 ? '0' + digit : 'A' + digit - 10);
+        n /= base;
+    } while (n != 0);
+    while (count < width)
+        reversed[count++] = '0';
+    
+    while (count > 0)
+        buf[length++] = reversed[--count];
+    buf[length] = '\0';
+    return length;
+}
+
+/* ParseNumber - parse the number starting at an index in a string and update the index to follow it
+   (the index is left alone if there are no digits) */
+static VMVALUE ParseNumber(Interpreter *i, VMUVALUE addr, VMVALUE *pIndex, VMVALUE base)
+{
+    VMUVALUE n = 0;
+    VMVALUE index = *pIndex, start;
+    int negative = FALSE, ch, digit;
+    
+    if (base < 2 || base > 36)
+        Abort(i, "bad number base %d", base);
+    
+    /* check for a sign */
+    if ((ch = *MapBytes(i, addr + index, 1)) == '-' || ch == '+') {
+        negative = (ch == '-');
+        ++index;
+    }
+    
+    /* accumulate the digits */
+    for (start = index; ; ++index) {
+        ch = *MapBytes(i, addr + index, 1);
+        if (ch >= '0' && ch <= '9')
+            digit = ch - '0';
+        else if (ch >= 'a' && ch <= 'z')
+            digit = ch - 'a' + 10;
+        else if (ch >= 'A' && ch <= 'Z')
+            digit = ch - 'A' + 10;
+        else
+            break;
+        if (digit >= base)
+            break;
+        n = n * base + digit;
+    }
+    
+    /* a sign without digits isn't a number */
+    if (index == start)
+        return 0;
+    *pIndex = index;
+    return (VMVALUE)(negative ? -n : n);
+}
+
+/* FlushOutput - write the characters in the output buffer */
+void FlushOutput(Interpreter *i)
+{
+    if (i->outputCount > 0) {
+        (*i->console->write)(i->consoleCookie, i->output, i->outputCount);
+        i->outputCount = 0;
+    }
+}
+
+static int DefaultGetChar(void *cookie)
+{
+    return VM_getchar();
+}
+
+static void DefaultWrite(void *cookie, const char *buf, int size)
+{
+    VM_write(buf, size);
 }
 
 void ShowStack(Interpreter *i)
@@ -347,9 +2230,15 @@ void StackOverflow(Interpreter *i)
     Abort(i, "stack overflow");
 }
 
+void IndexError(Interpreter *i, VMVALUE index, VMUVALUE bound)
+{
+    Abort(i, "array index %d out of bounds (the array has %u elements)", index, bound);
+}
+
 void Abort(Interpreter *i, const char *fmt, ...)
 {
     va_list ap;
+    FlushOutput(i);
     va_start(ap, fmt);
     xbError(i->sys, "abort: ");
     xbErrorV(i->sys, fmt, ap);
@@ -0,0 +1,1153 @@
+/* db_vmjit.c - translate bytecode into x86-64 code for a simple virtual machine
+ *
+ * Each function is translated the first time control reaches it.  A function
+ * runs from an OP_FRAME to the next one in the decoded code section and every
+ * instruction decoded in that range is replaced by a fixed sequence of host
+ * instructions.  Branches within the translated code jump directly to their
+ * targets and everything else (returns, computed calls and SWITCH) looks the
+ * target up in a table with an entry for each code offset, leaving the
+ * translated code when the target hasn't been translated yet.
+ *
+ * The VM state is kept in registers while the translated code runs:
+ *
+ *      rbx     interpreter
+ *      rbp     base of the stack (frames save fp as an offset from it)
+ *      r12     sp
+ *      r13     fp
+ *      r14d    tos
+ *      r15     table of the translated code for each code offset
+ *
+ * Loads and stores through computed addresses, traps, native instructions and
+ * errors call back into db_vmint.c so the results are exactly the same as the
+ * decoded engine's.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "db_vm.h"
+#include "db_vmdebug.h"
+
+#ifdef USE_JIT
+
+#include <sys/mman.h>
+
+/* host registers */
+#define RAX         0
+#define RCX         1
+#define RDX         2
+#define RBX         3
+#define RSP         4
+#define RBP         5
+#define RSI         6
+#define RDI         7
+#define R12         12
+#define R13         13
+#define R14         14
+#define R15         15
+
+/* registers holding the VM state */
+#define R_I         RBX
+#define R_STACK     RBP
+#define R_SP        R12
+#define R_FP        R13
+#define R_TOS       R14
+#define R_ENTRIES   R15
+
+/* displacement of n longs */
+#define LONGS(n)    ((int32_t)(n) * (int32_t)sizeof(VMVALUE))
+
+/* no index register in a memory operand */
+#define NO_INDEX    -1
+
+/* condition codes */
+#define CC_ALWAYS   -1
+#define CC_B        0x2
+#define CC_AE       0x3
+#define CC_E        0x4
+#define CC_NE       0x5
+#define CC_L        0xc
+#define CC_GE       0xd
+#define CC_LE       0xe
+#define CC_G        0xf
+
+/* conditions of the compare and branch opcodes from OP_BRLT to OP_BRGTZ */
+static const int branchConditions[] = { CC_L, CC_LE, CC_E, CC_NE, CC_GE, CC_G, CC_L, CC_LE, CC_GE, CC_G };
+
+/* host opcodes (the second operand is a register or memory) */
+#define X_ADD       0x03
+#define X_OR        0x0b
+#define X_AND       0x23
+#define X_SUB       0x2b
+#define X_XOR       0x33
+#define X_CMP       0x3b
+#define X_MOVSXD    0x63
+#define X_STORE     0x89        /* mov r/m, reg */
+#define X_LOAD      0x8b        /* mov reg, r/m */
+#define X_LEA       0x8d
+#define X_MOVI      0xc7        /* mov r/m, imm32 */
+#define X_TEST      0x85
+#define X_GROUP1    0x81        /* alu r/m, imm32 (0x83 for imm8) */
+#define X_GROUP2    0xd3        /* shift r/m, cl */
+#define X_GROUP3    0xf7        /* not, neg, idiv r/m */
+#define X_GROUP5    0xff        /* call, jmp r/m */
+#define X_IMUL      0x0faf
+#define X_CMOVAE    0x0f43
+
+/* group opcode extensions */
+#define G1_ADD      0
+#define G1_SUB      5
+#define G1_CMP      7
+#define G2_SHL      4
+#define G2_SAR      7
+#define G3_NOT      2
+#define G3_NEG      3
+#define G3_IDIV     7
+#define G5_CALL     2
+#define G5_JMP      4
+
+/* exit codes of the translated code */
+enum {
+    JIT_HALT,                   /* the program halted */
+    JIT_DISPATCH,               /* continue at i->pc */
+    JIT_UNDEFINED,              /* undefined opcode at i->pc */
+    JIT_BRANCH,                 /* branch target out of range */
+    JIT_RETURN,                 /* bad return address */
+    JIT_PUSHJ,                  /* PUSHJ to tos outside of the code section */
+    JIT_CALL,                   /* CALL at i->pc to a function outside of the code section */
+    JIT_OVERFLOW,               /* stack overflow */
+    JIT_INDEX                   /* index in tos out of the bounds of the CHECK, VREF or VSET at i->pc */
+};
+
+/* space for the translated code */
+#define JIT_CODE_SCALE  32              /* bytes of translated code for each byte of the code section */
+#define JIT_CODE_EXTRA  (64 * 1024)     /* bytes of translated code for the stubs and small programs */
+#define MAX_TEMPLATE    192             /* largest translation of one instruction */
+#define MAX_STUB        32              /* largest stub for a patched jump */
+
+/* jump to be patched at the end of the function */
+typedef struct {
+    uint8_t *at;                /* address of the 32 bit displacement */
+    int kind;                   /* JIT_DISPATCH for a code offset or the exit code of an error */
+    VMUVALUE offset;            /* code offset of the target or of the failing instruction */
+} JitPatch;
+
+/* entry stub (runs translated code until it exits) */
+typedef int JitEnter(Interpreter *i, uint8_t *code, uint8_t **entries);
+
+/* translator state */
+typedef struct {
+    Interpreter *i;
+    DecodedInsn *code;          /* decoded code section */
+    uint8_t *data;              /* code section data */
+    VMUVALUE base;              /* code section base address */
+    VMUVALUE size;              /* code section size */
+    uint8_t **entries;          /* translated code for each code offset or NULL */
+    uint8_t *buffer;            /* executable memory */
+    size_t bufferSize;          /* size of the executable memory */
+    uint8_t *first;             /* first byte after the stubs */
+    uint8_t *free;              /* next free byte */
+    JitEnter *enter;            /* enter the translated code */
+    uint8_t *leave;             /* save the state and return the exit code in eax */
+    uint8_t *leaveSaved;        /* return the exit code in eax with the state already saved */
+    uint8_t *dispatch;          /* continue at the code offset in eax */
+    uint8_t *switched;          /* continue at i->pc after a trap switched tasks */
+    JitPatch *patches;          /* jumps to patch */
+    int patchCount;             /* number of jumps to patch */
+} Jit;
+
+/* prototypes for local functions */
+static Jit *InitJit(Interpreter *i);
+static void FreeJit(Jit *jit);
+static int RunJit(Jit *jit);
+static void FlushJit(Jit *jit);
+static void TranslateFunction(Jit *jit, VMUVALUE offset);
+static int TranslateInstruction(Jit *jit, VMUVALUE offset);
+static void TranslateStubs(Jit *jit);
+static void ResolvePatches(Jit *jit);
+static VMVALUE *GlobalAddress(Jit *jit, VMUVALUE addr);
+static void EmitLoadGlobal(Jit *jit, VMUVALUE addr);
+static void EmitStoreGlobal(Jit *jit, VMUVALUE addr);
+static void EmitDivide(Jit *jit, int remainder);
+static void EmitCompare(Jit *jit, int cc);
+static void EmitFrame(Jit *jit, VMUVALUE offset, int count, int extra);
+static void EmitReturn(Jit *jit, VMUVALUE offset, int drop);
+static void EmitLoop(Jit *jit, DecodedInsn *ip, VMUVALUE offset);
+static void EmitPush(Jit *jit);
+static void EmitPop(Jit *jit);
+static void EmitDrop(Jit *jit, int count);
+static void EmitSave(Jit *jit);
+static void EmitRestore(Jit *jit);
+static void EmitCall(Jit *jit, void *fcn);
+static void EmitDispatch(Jit *jit);
+static void EmitJump(Jit *jit, int cc, int kind, VMUVALUE offset);
+static void EmitJumpTo(Jit *jit, int cc, uint8_t *target);
+static uint8_t *EmitShortJump(Jit *jit, int cc);
+static void FixShortJump(Jit *jit, uint8_t *at);
+static void EmitAluImm(Jit *jit, int w, int ext, int rm, VMVALUE value);
+static void EmitMovImm(Jit *jit, int reg, VMVALUE value);
+static void EmitMovImm64(Jit *jit, int reg, uint64_t value);
+static void EmitRR(Jit *jit, int w, int op, int reg, int rm);
+static void EmitRM(Jit *jit, int w, int op, int reg, int base, int index, int scale, int32_t disp);
+static void EmitRex(Jit *jit, int w, int reg, int index, int base);
+static void EmitOpcode(Jit *jit, int op);
+static void Emit1(Jit *jit, int byte);
+static void Emit4(Jit *jit, uint32_t value);
+static int JitTrap(Interpreter *i, int op, uint8_t *pc);
+static void JitNative(Interpreter *i, VMVALUE insn, uint8_t *pc);
+static VMVALUE JitForLoopA(Interpreter *i, VMUVALUE addr, VMVALUE step);
+
+/* ExecuteJit - execute code by translating it into host code
+   (returns -1 without running anything if there is no executable memory) */
+int ExecuteJit(Interpreter *i)
+{
+    jmp_buf saveTarget;
+    Jit *jit;
+    int result;
+
+    if (!(jit = InitJit(i)))
+        return -1;
+
+    /* release the translated code when the program aborts */
+    memcpy(saveTarget, i->errorTarget, sizeof(jmp_buf));
+    if (setjmp(i->errorTarget)) {
+        memcpy(i->errorTarget, saveTarget, sizeof(jmp_buf));
+        FreeJit(jit);
+        longjmp(i->errorTarget, 1);
+    }
+
+    result = RunJit(jit);
+
+    memcpy(i->errorTarget, saveTarget, sizeof(jmp_buf));
+    FreeJit(jit);
+    return result;
+}
+
+/* InitJit - allocate the executable memory and the tables and translate the stubs */
+static Jit *InitJit(Interpreter *i)
+{
+    ImageSection *section = i->image->codeSection;
+    VMUVALUE size = section->fileSection->size;
+    Jit *jit;
+
+    if (!(jit = (Jit *)malloc(sizeof(Jit))))
+        return NULL;
+    memset(jit, 0, sizeof(Jit));
+    jit->i = i;
+    jit->code = i->image->decoded;
+    jit->data = section->data;
+    jit->base = section->fileSection->base;
+    jit->size = size;
+
+    /* an instruction has at most three jumps to patch (one more for the jump to the code that follows it) */
+    jit->bufferSize = (size_t)size * JIT_CODE_SCALE + JIT_CODE_EXTRA;
+    if (!(jit->entries = (uint8_t **)calloc(size, sizeof(uint8_t *)))
+    ||  !(jit->patches = (JitPatch *)malloc((size * 3 + 4) * sizeof(JitPatch)))) {
+        FreeJit(jit);
+        return NULL;
+    }
+    jit->buffer = mmap(NULL, jit->bufferSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->buffer == MAP_FAILED) {
+        jit->buffer = NULL;
+        FreeJit(jit);
+        return NULL;
+    }
+
+    jit->free = jit->buffer;
+    TranslateStubs(jit);
+    jit->first = jit->free;
+
+    return jit;
+}
+
+/* FreeJit - release the executable memory and the tables */
+static void FreeJit(Jit *jit)
+{
+    if (jit->buffer)
+        munmap(jit->buffer, jit->bufferSize);
+    free(jit->entries);
+    free(jit->patches);
+    free(jit);
+}
+
+/* RunJit - run the translated code translating each function the first time it is reached */
+static int RunJit(Jit *jit)
+{
+    Interpreter *i = jit->i;
+    VMUVALUE offset;
+
+    for (;;) {
+
+        /* find the translated code for the pc */
+        offset = (VMUVALUE)(i->pc - jit->data);
+        if (offset >= jit->size)
+            Abort(i, "can't execute code outside of section %08x", jit->base);
+        if (!jit->entries[offset]) {
+            if (!jit->code[offset].valid && !PredecodeCode(i->image, jit->base + offset))
+                Abort(i, "address error");
+            TranslateFunction(jit, offset);
+        }
+
+        /* run until the translated code needs the interpreter */
+        switch ((*jit->enter)(i, jit->entries[offset], jit->entries)) {
+        case JIT_HALT:
+            FlushOutput(i);
+            return TRUE;
+        case JIT_DISPATCH:
+            break;
+        case JIT_UNDEFINED:
+            Abort(i, "undefined opcode 0x%02x", jit->code[i->pc - jit->data].opcode);
+            break;
+        case JIT_BRANCH:
+            Abort(i, "branch target out of range");
+            break;
+        case JIT_RETURN:
+            Abort(i, "bad return address");
+            break;
+        case JIT_PUSHJ:
+            MapAddress(i, i->tos);
+            Abort(i, "can't execute code outside of section %08x", jit->base);
+            break;
+        case JIT_CALL:
+            MapAddress(i, jit->code[i->pc - jit->data].operand);
+            Abort(i, "can't execute code outside of section %08x", jit->base);
+            break;
+        case JIT_OVERFLOW:
+            StackOverflow(i);
+            break;
+        case JIT_INDEX:
+            IndexError(i, i->tos, (VMUVALUE)jit->code[i->pc - jit->data].operand);
+            break;
+        }
+    }
+}
+
+/* FlushJit - discard all of the translated code (only the stubs are kept) */
+static void FlushJit(Jit *jit)
+{
+    memset(jit->entries, 0, jit->size * sizeof(uint8_t *));
+    jit->free = jit->first;
+}
+
+/* IsFrame - check for a decoded OP_FRAME at a code offset */
+#define IsFrame(jit, off)   ((jit)->code[off].valid && (jit)->code[off].opcode == OP_FRAME)
+
+/* TranslateFunction - translate the instructions of the function containing a code offset
+   (instructions that were translated before are left alone) */
+static void TranslateFunction(Jit *jit, VMUVALUE offset)
+{
+    VMUVALUE start, end, off, next = 0;
+    int flushed = FALSE, fallsThrough;
+
+    /* find the function */
+    for (start = offset; start > 0 && !IsFrame(jit, start); --start)
+        ;
+    for (end = offset + 1; end < jit->size && !IsFrame(jit, end); ++end)
+        ;
+
+    for (;;) {
+        jit->patchCount = 0;
+        fallsThrough = FALSE;
+
+        /* there is always room for the stubs of the jumps already translated */
+        for (off = start; off < end; ++off) {
+            if (!jit->code[off].valid || jit->entries[off])
+                continue;
+            if (jit->buffer + jit->bufferSize - jit->free < MAX_TEMPLATE + (jit->patchCount + 4) * MAX_STUB)
+                break;
+            if (fallsThrough && next != off)
+                EmitJump(jit, CC_ALWAYS, JIT_DISPATCH, next);
+            jit->entries[off] = jit->free;
+            if ((fallsThrough = TranslateInstruction(jit, off)) != FALSE)
+                next = off + InstructionLength(InstructionFormat(jit->code[off].opcode));
+        }
+
+        /* finish with the jumps that leave the function */
+        if (off >= end) {
+            if (fallsThrough)
+                EmitJump(jit, CC_ALWAYS, JIT_DISPATCH, next);
+            ResolvePatches(jit);
+            return;
+        }
+
+        /* start over with an empty buffer when the function doesn't fit */
+        if (flushed)
+            Abort(jit->i, "insufficient memory for the translated code");
+        FlushJit(jit);
+        flushed = TRUE;
+    }
+}
+
+/* TranslateInstruction - translate one instruction (returns true if it falls through to the next one) */
+static int TranslateInstruction(Jit *jit, VMUVALUE offset)
+{
+    DecodedInsn *ip = &jit->code[offset];
+    VMUVALUE target = (ip->target ? (VMUVALUE)(ip->target - jit->code) : 0);
+
+    switch (ip->opcode) {
+    case OP_HALT:
+        EmitJump(jit, CC_ALWAYS, JIT_HALT, offset);
+        return FALSE;
+    case OP_BRT:
+    case OP_BRF:
+        if (!ip->target) {
+            EmitRR(jit, 0, X_TEST, R_TOS, R_TOS);
+            EmitJump(jit, ip->opcode == OP_BRT ? CC_NE : CC_E, JIT_BRANCH, offset);
+        }
+        EmitRR(jit, 0, X_LOAD, RAX, R_TOS);
+        EmitPop(jit);
+        if (ip->target) {
+            EmitRR(jit, 0, X_TEST, RAX, RAX);
+            EmitJump(jit, ip->opcode == OP_BRT ? CC_NE : CC_E, JIT_DISPATCH, target);
+        }
+        return TRUE;
+    case OP_BRTSC:
+    case OP_BRFSC:
+        EmitRR(jit, 0, X_TEST, R_TOS, R_TOS);
+        if (ip->target)
+            EmitJump(jit, ip->opcode == OP_BRTSC ? CC_NE : CC_E, JIT_DISPATCH, target);
+        else
+            EmitJump(jit, ip->opcode == OP_BRTSC ? CC_NE : CC_E, JIT_BRANCH, offset);
+        EmitPop(jit);
+        return TRUE;
+    case OP_BRLT:
+    case OP_BRLE:
+    case OP_BREQ:
+    case OP_BRNE:
+    case OP_BRGE:
+    case OP_BRGT:
+    case OP_BRLTZ:
+    case OP_BRLEZ:
+    case OP_BRGEZ:
+    case OP_BRGTZ:
+        if (ip->opcode < OP_BRLTZ)
+            EmitRM(jit, 0, 0x39, R_TOS, R_SP, NO_INDEX, 0, 0); /* cmp [sp], tos */
+        else
+            EmitRR(jit, 0, X_TEST, R_TOS, R_TOS);
+        if (!ip->target)
+            EmitJump(jit, branchConditions[ip->opcode - OP_BRLT], JIT_BRANCH, offset);
+        if (ip->opcode < OP_BRLTZ) {
+            EmitRM(jit, 0, X_LOAD, R_TOS, R_SP, NO_INDEX, 0, LONGS(1));
+            EmitDrop(jit, 2);
+        }
+        else
+            EmitPop(jit);
+        if (ip->target)     /* mov and lea leave the flags alone */
+            EmitJump(jit, branchConditions[ip->opcode - OP_BRLT], JIT_DISPATCH, target);
+        return TRUE;
+    case OP_BR:
+    case OP_BR8:
+    case OP_BR16:
+        if (ip->target)
+            EmitJump(jit, CC_ALWAYS, JIT_DISPATCH, target);
+        else
+            EmitJump(jit, CC_ALWAYS, JIT_BRANCH, offset);
+        return FALSE;
+    case OP_NOT:
+        EmitRR(jit, 0, X_XOR, RAX, RAX);
+        EmitRR(jit, 0, X_TEST, R_TOS, R_TOS);
+        EmitRR(jit, 0, 0x0f90 | CC_E, 0, RAX);      /* sete al */
+        EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+        return TRUE;
+    case OP_NEG:
+        EmitRR(jit, 0, X_GROUP3, G3_NEG, R_TOS);
+        return TRUE;
+    case OP_BNOT:
+        EmitRR(jit, 0, X_GROUP3, G3_NOT, R_TOS);
+        return TRUE;
+    case OP_ADD:
+    case OP_MUL:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+        EmitRM(jit, 0, ip->opcode == OP_ADD ? X_ADD
+                     : ip->opcode == OP_MUL ? X_IMUL
+                     : ip->opcode == OP_BAND ? X_AND
+                     : ip->opcode == OP_BOR ? X_OR
+                     : X_XOR, R_TOS, R_SP, NO_INDEX, 0, 0);
+        EmitDrop(jit, 1);
+        return TRUE;
+    case OP_SUB:
+        EmitRM(jit, 0, X_LOAD, RAX, R_SP, NO_INDEX, 0, 0);
+        EmitDrop(jit, 1);
+        EmitRR(jit, 0, X_SUB, RAX, R_TOS);
+        EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+        return TRUE;
+    case OP_DIV:
+    case OP_REM:
+        EmitDivide(jit, ip->opcode == OP_REM);
+        return TRUE;
+    case OP_SHL:
+    case OP_SHR:
+        EmitRR(jit, 0, X_LOAD, RCX, R_TOS);
+        EmitPop(jit);
+        EmitRR(jit, 0, X_GROUP2, ip->opcode == OP_SHL ? G2_SHL : G2_SAR, R_TOS);
+        return TRUE;
+    case OP_LT:
+        EmitCompare(jit, CC_L);
+        return TRUE;
+    case OP_LE:
+        EmitCompare(jit, CC_LE);
+        return TRUE;
+    case OP_EQ:
+        EmitCompare(jit, CC_E);
+        return TRUE;
+    case OP_NE:
+        EmitCompare(jit, CC_NE);
+        return TRUE;
+    case OP_GE:
+        EmitCompare(jit, CC_GE);
+        return TRUE;
+    case OP_GT:
+        EmitCompare(jit, CC_G);
+        return TRUE;
+    case OP_LIT:
+    case OP_SLIT:
+    case OP_LIT16:
+        EmitPush(jit);
+        EmitMovImm(jit, R_TOS, ip->operand);
+        return TRUE;
+    case OP_LOAD:
+    case OP_LOADB:
+    case OP_LOADW:
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitRR(jit, 0, X_LOAD, RSI, R_TOS);
+        EmitCall(jit, ip->opcode == OP_LOAD ? (void *)LoadValue
+                    : ip->opcode == OP_LOADB ? (void *)LoadByteValue
+                    : (void *)LoadWordValue);
+        EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+        return TRUE;
+    case OP_STORE:
+    case OP_STOREB:
+    case OP_STOREW:
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitRR(jit, 0, X_LOAD, RSI, R_TOS);
+        EmitRM(jit, 0, X_LOAD, RDX, R_SP, NO_INDEX, 0, 0);
+        EmitCall(jit, ip->opcode == OP_STORE ? (void *)StoreValue
+                    : ip->opcode == OP_STOREB ? (void *)StoreByteValue
+                    : (void *)StoreWordValue);
+        EmitRM(jit, 0, X_LOAD, R_TOS, R_SP, NO_INDEX, 0, sizeof(VMVALUE));
+        EmitDrop(jit, 2);
+        return TRUE;
+    case OP_LREF:
+        EmitPush(jit);
+        EmitRM(jit, 0, X_LOAD, R_TOS, R_FP, NO_INDEX, 0, LONGS(ip->operand));
+        return TRUE;
+    case OP_LSET:
+        EmitRM(jit, 0, X_STORE, R_TOS, R_FP, NO_INDEX, 0, LONGS(ip->operand));
+        EmitPop(jit);
+        return TRUE;
+    case OP_INDEX:
+        EmitRM(jit, 0, X_LOAD, RAX, R_SP, NO_INDEX, 0, 0);
+        EmitDrop(jit, 1);
+        EmitRM(jit, 0, X_LEA, R_TOS, RAX, R_TOS, 2, 0);
+        return TRUE;
+    case OP_PUSHJ:
+        EmitRR(jit, 0, X_LOAD, RAX, R_TOS);
+        EmitAluImm(jit, 0, G1_SUB, RAX, (VMVALUE)jit->base);
+        EmitAluImm(jit, 0, G1_CMP, RAX, (VMVALUE)jit->size);
+        EmitJump(jit, CC_AE, JIT_PUSHJ, offset);
+        EmitMovImm(jit, R_TOS, (VMVALUE)offset + 1);
+        EmitDispatch(jit);
+        return FALSE;
+    case OP_POPJ:
+        EmitRR(jit, 0, X_LOAD, RAX, R_TOS);
+        EmitAluImm(jit, 0, G1_CMP, RAX, (VMVALUE)jit->size);
+        EmitJump(jit, CC_AE, JIT_RETURN, offset);
+        EmitPop(jit);
+        EmitDispatch(jit);
+        return FALSE;
+    case OP_CLEAN:
+        EmitDrop(jit, ip->operand);
+        return TRUE;
+    case OP_FRAME:
+        EmitFrame(jit, offset, ip->operand, ip->operand2);
+        return TRUE;
+    case OP_RETURNZ:
+        EmitPush(jit);
+        EmitRR(jit, 0, X_XOR, R_TOS, R_TOS);
+        EmitReturn(jit, offset, 0);
+        return FALSE;
+    case OP_RETURN:
+        EmitReturn(jit, offset, 0);
+        return FALSE;
+    case OP_RET:
+        EmitReturn(jit, offset, ip->operand);
+        return FALSE;
+    case OP_DROP:
+        EmitPop(jit);
+        return TRUE;
+    case OP_DUP:
+        EmitPush(jit);
+        return TRUE;
+    case OP_NATIVE:
+        EmitSave(jit);
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitMovImm(jit, RSI, ip->operand);
+        EmitMovImm64(jit, RDX, (uintptr_t)(jit->data + offset + 1 + sizeof(VMUVALUE)));
+        EmitCall(jit, (void *)JitNative);
+        EmitRestore(jit);
+        return TRUE;
+    case OP_TRAP:
+        EmitSave(jit);
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitMovImm(jit, RSI, ip->operand);
+        EmitMovImm64(jit, RDX, (uintptr_t)(jit->data + offset + 2));
+        EmitCall(jit, (void *)JitTrap);
+        EmitRR(jit, 0, X_TEST, RAX, RAX);
+        EmitJumpTo(jit, CC_NE, jit->switched);
+        EmitRestore(jit);
+        return TRUE;
+    case OP_LINC:
+        EmitRM(jit, 0, 0x83, G1_ADD, R_FP, NO_INDEX, 0, LONGS(ip->operand));
+        Emit1(jit, ip->operand2);
+        return TRUE;
+    case OP_LOADA:
+        EmitPush(jit);
+        EmitLoadGlobal(jit, (VMUVALUE)ip->operand);
+        return TRUE;
+    case OP_STOREA:
+        EmitStoreGlobal(jit, (VMUVALUE)ip->operand);
+        EmitPop(jit);
+        return TRUE;
+    case OP_LOADX:
+        EmitRM(jit, 0, X_LOAD, RSI, R_SP, NO_INDEX, 0, 0);
+        EmitDrop(jit, 1);
+        EmitRM(jit, 0, X_LEA, RSI, RSI, R_TOS, 2, 0);
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitCall(jit, (void *)LoadValue);
+        EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+        return TRUE;
+    case OP_CHECK:
+    case OP_VREF:
+    case OP_VSET:
+        /* an unsigned compare also catches negative indexes */
+        EmitAluImm(jit, 0, G1_CMP, R_TOS, ip->operand);
+        EmitJump(jit, CC_AE, JIT_INDEX, offset);
+        if (ip->opcode == OP_VREF) {
+            EmitRM(jit, 0, X_LOAD, RSI, R_SP, NO_INDEX, 0, 0);
+            EmitDrop(jit, 1);
+            EmitRM(jit, 0, X_LEA, RSI, RSI, R_TOS, 2, 0);
+            EmitRR(jit, 1, X_LOAD, RDI, R_I);
+            EmitCall(jit, (void *)LoadValue);
+            EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+        }
+        else if (ip->opcode == OP_VSET) {
+            EmitRM(jit, 0, X_LOAD, RSI, R_SP, NO_INDEX, 0, 0);
+            EmitRM(jit, 0, X_LEA, RSI, RSI, R_TOS, 2, 0);
+            EmitRM(jit, 0, X_LOAD, RDX, R_SP, NO_INDEX, 0, sizeof(VMVALUE));
+            EmitRM(jit, 0, X_LOAD, R_TOS, R_SP, NO_INDEX, 0, sizeof(VMVALUE) * 2);
+            EmitDrop(jit, 3);
+            EmitRR(jit, 1, X_LOAD, RDI, R_I);
+            EmitCall(jit, (void *)StoreValue);
+        }
+        return TRUE;
+    case OP_STOREX:
+        EmitRM(jit, 0, X_LOAD, RSI, R_SP, NO_INDEX, 0, 0);
+        EmitRM(jit, 0, X_LEA, RSI, RSI, R_TOS, 2, 0);
+        EmitRM(jit, 0, X_LOAD, RDX, R_SP, NO_INDEX, 0, sizeof(VMVALUE));
+        EmitRM(jit, 0, X_LOAD, R_TOS, R_SP, NO_INDEX, 0, sizeof(VMVALUE) * 2);
+        EmitDrop(jit, 3);
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitCall(jit, (void *)StoreValue);
+        return TRUE;
+    case OP_SWITCH:
+        /* the case number is limited to the default entry at the end of the table */
+        EmitRR(jit, 0, X_LOAD, RAX, R_TOS);
+        EmitMovImm(jit, RCX, ip->operand);
+        EmitRR(jit, 0, X_CMP, RAX, RCX);
+        EmitRR(jit, 0, X_CMOVAE, RAX, RCX);
+        EmitRM(jit, 0, X_LEA, RAX, RAX, RAX, 2, (int32_t)offset + 2);
+        EmitPop(jit);
+        EmitDispatch(jit);
+        return FALSE;
+    case OP_FORLOOP:
+        EmitRM(jit, 0, X_LOAD, RAX, R_FP, NO_INDEX, 0, LONGS(ip->operand));
+        EmitAluImm(jit, 0, G1_ADD, RAX, ip->operand2);
+        EmitRM(jit, 0, X_STORE, RAX, R_FP, NO_INDEX, 0, LONGS(ip->operand));
+        EmitLoop(jit, ip, offset);
+        return TRUE;
+    case OP_FORLOOPA:
+        if (GlobalAddress(jit, (VMUVALUE)ip->operand)) {
+            EmitMovImm64(jit, RDX, (uintptr_t)GlobalAddress(jit, (VMUVALUE)ip->operand));
+            EmitRM(jit, 0, X_LOAD, RAX, RDX, NO_INDEX, 0, 0);
+            EmitAluImm(jit, 0, G1_ADD, RAX, ip->operand2);
+            EmitRM(jit, 0, X_STORE, RAX, RDX, NO_INDEX, 0, 0);
+        }
+        else {
+            EmitRR(jit, 1, X_LOAD, RDI, R_I);
+            EmitMovImm(jit, RSI, ip->operand);
+            EmitMovImm(jit, RDX, ip->operand2);
+            EmitCall(jit, (void *)JitForLoopA);
+        }
+        EmitLoop(jit, ip, offset);
+        return TRUE;
+    case OP_GREF:
+        EmitPush(jit);
+        EmitLoadGlobal(jit, (VMUVALUE)LONGS(ip->operand));
+        return TRUE;
+    case OP_GSET:
+        EmitStoreGlobal(jit, (VMUVALUE)LONGS(ip->operand));
+        EmitPop(jit);
+        return TRUE;
+    case OP_GREF16:
+        EmitPush(jit);
+        EmitLoadGlobal(jit, (VMUVALUE)(uint16_t)LONGS(ip->operand));
+        return TRUE;
+    case OP_GSET16:
+        EmitStoreGlobal(jit, (VMUVALUE)(uint16_t)LONGS(ip->operand));
+        EmitPop(jit);
+        return TRUE;
+    case OP_CALL:
+        if (!ip->target) {
+            EmitJump(jit, CC_ALWAYS, JIT_CALL, offset);
+            return FALSE;
+        }
+        EmitPush(jit);
+        EmitMovImm(jit, R_TOS, (VMVALUE)offset + 1 + sizeof(VMUVALUE));
+        EmitJump(jit, CC_ALWAYS, JIT_DISPATCH, target);
+        return FALSE;
+    default:
+        EmitJump(jit, CC_ALWAYS, JIT_UNDEFINED, offset);
+        return FALSE;
+    }
+}
+
+/* TranslateStubs - translate the code shared by all of the functions */
+static void TranslateStubs(Jit *jit)
+{
+    static int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+    uint8_t *miss, *found;
+    int j;
+
+    /* enter(i, code, entries) saves the host registers and loads the VM state */
+    jit->enter = (JitEnter *)jit->free;
+    for (j = 0; j < sizeof(saved) / sizeof(saved[0]); ++j) {
+        EmitRex(jit, 0, 0, 0, saved[j]);
+        Emit1(jit, 0x50 + (saved[j] & 7));
+    }
+    EmitAluImm(jit, 1, G1_SUB, RSP, 8);     /* align the stack for calls */
+    EmitRR(jit, 1, X_LOAD, R_I, RDI);
+    EmitRR(jit, 1, X_LOAD, R_ENTRIES, RDX);
+    EmitRestore(jit);
+    EmitRM(jit, 1, X_LOAD, R_STACK, R_I, NO_INDEX, 0, offsetof(Interpreter, stack));
+    EmitRR(jit, 0, X_GROUP5, G5_JMP, RSI);
+
+    /* leave saves the VM state and restores the host registers */
+    jit->leave = jit->free;
+    EmitSave(jit);
+    jit->leaveSaved = jit->free;
+    EmitAluImm(jit, 1, G1_ADD, RSP, 8);
+    for (j = sizeof(saved) / sizeof(saved[0]); --j >= 0; ) {
+        EmitRex(jit, 0, 0, 0, saved[j]);
+        Emit1(jit, 0x58 + (saved[j] & 7));
+    }
+    Emit1(jit, 0xc3);                       /* ret */
+
+    /* a trap that switched tasks has saved the state of the new task */
+    jit->switched = jit->free;
+    EmitMovImm(jit, RAX, JIT_DISPATCH);
+    EmitJumpTo(jit, CC_ALWAYS, jit->leaveSaved);
+
+    /* dispatch jumps to the translated code for the offset in eax or leaves to translate it */
+    jit->dispatch = jit->free;
+    EmitAluImm(jit, 0, G1_CMP, RAX, (VMVALUE)jit->size);
+    miss = EmitShortJump(jit, CC_AE);
+    EmitRM(jit, 1, X_LOAD, RCX, R_ENTRIES, RAX, 3, 0);
+    EmitRR(jit, 1, X_TEST, RCX, RCX);
+    found = EmitShortJump(jit, CC_E);
+    EmitRR(jit, 0, X_GROUP5, G5_JMP, RCX);
+    FixShortJump(jit, miss);
+    FixShortJump(jit, found);
+    EmitMovImm64(jit, RCX, (uintptr_t)jit->data);
+    EmitRR(jit, 1, X_ADD, RCX, RAX);
+    EmitRM(jit, 1, X_STORE, RCX, R_I, NO_INDEX, 0, offsetof(Interpreter, pc));
+    EmitMovImm(jit, RAX, JIT_DISPATCH);
+    EmitJumpTo(jit, CC_ALWAYS, jit->leave);
+}
+
+/* ResolvePatches - point the jumps of a function at their targets adding stubs for the rest */
+static void ResolvePatches(Jit *jit)
+{
+    JitPatch *patch;
+    int32_t disp;
+    int j;
+
+    for (j = 0; j < jit->patchCount; ++j) {
+        patch = &jit->patches[j];
+
+        /* jump directly to translated code */
+        if (patch->kind == JIT_DISPATCH && jit->entries[patch->offset])
+            disp = (int32_t)(jit->entries[patch->offset] - (patch->at + 4));
+
+        /* dispatch to code that hasn't been translated yet */
+        else if (patch->kind == JIT_DISPATCH) {
+            disp = (int32_t)(jit->free - (patch->at + 4));
+            EmitMovImm(jit, RAX, (VMVALUE)patch->offset);
+            EmitJumpTo(jit, CC_ALWAYS, jit->dispatch);
+        }
+
+        /* leave with i->pc pointing to the failing instruction */
+        else {
+            disp = (int32_t)(jit->free - (patch->at + 4));
+            EmitMovImm64(jit, RCX, (uintptr_t)(jit->data + patch->offset));
+            EmitRM(jit, 1, X_STORE, RCX, R_I, NO_INDEX, 0, offsetof(Interpreter, pc));
+            EmitMovImm(jit, RAX, patch->kind);
+            EmitJumpTo(jit, CC_ALWAYS, jit->leave);
+        }
+
+        memcpy(patch->at, &disp, sizeof(disp));
+    }
+    jit->patchCount = 0;
+}
+
+/* GlobalAddress - get the host address of a long at a constant address
+   (returns NULL if it has to be mapped each time like the cog registers) */
+static VMVALUE *GlobalAddress(Jit *jit, VMUVALUE addr)
+{
+    ImageSection *section = jit->i->sectionMap[ADDR_REGION(addr)];
+    VMUVALUE offset = ADDR_OFFSET(addr);
+    if (!section
+    ||  ADDR_REGION(addr) == ADDR_REGION(COG_BASE)
+    ||  offset > section->fileSection->size
+    ||  section->fileSection->size - offset < sizeof(VMVALUE))
+        return NULL;
+    return (VMVALUE *)(section->data + offset);
+}
+
+/* EmitLoadGlobal - load tos from a constant address */
+static void EmitLoadGlobal(Jit *jit, VMUVALUE addr)
+{
+    VMVALUE *p;
+    if ((p = GlobalAddress(jit, addr)) != NULL) {
+        EmitMovImm64(jit, RAX, (uintptr_t)p);
+        EmitRM(jit, 0, X_LOAD, R_TOS, RAX, NO_INDEX, 0, 0);
+    }
+    else {
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitMovImm(jit, RSI, (VMVALUE)addr);
+        EmitCall(jit, (void *)LoadConstValue);
+        EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+    }
+}
+
+/* EmitStoreGlobal - store tos at a constant address */
+static void EmitStoreGlobal(Jit *jit, VMUVALUE addr)
+{
+    VMVALUE *p;
+    if ((p = GlobalAddress(jit, addr)) != NULL) {
+        EmitMovImm64(jit, RAX, (uintptr_t)p);
+        EmitRM(jit, 0, X_STORE, R_TOS, RAX, NO_INDEX, 0, 0);
+    }
+    else {
+        EmitRR(jit, 1, X_LOAD, RDI, R_I);
+        EmitMovImm(jit, RSI, (VMVALUE)addr);
+        EmitRR(jit, 0, X_LOAD, RDX, R_TOS);
+        EmitCall(jit, (void *)StoreConstValue);
+    }
+}
+
+/* EmitDivide - divide the value under tos by tos
+   (dividing by zero gives zero and dividing by -1 can't overflow like idiv does) */
+static void EmitDivide(Jit *jit, int remainder)
+{
+    uint8_t *zero, *other, *done;
+    EmitRM(jit, 0, X_LOAD, RAX, R_SP, NO_INDEX, 0, 0);
+    EmitDrop(jit, 1);
+    EmitRR(jit, 0, X_TEST, R_TOS, R_TOS);
+    zero = EmitShortJump(jit, CC_E);
+    EmitAluImm(jit, 0, G1_CMP, R_TOS, -1);
+    other = EmitShortJump(jit, CC_NE);
+    if (remainder)
+        EmitRR(jit, 0, X_XOR, R_TOS, R_TOS);
+    else {
+        EmitRR(jit, 0, X_GROUP3, G3_NEG, RAX);
+        EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+    }
+    done = EmitShortJump(jit, CC_ALWAYS);
+    FixShortJump(jit, other);
+    Emit1(jit, 0x99);                       /* cdq */
+    EmitRR(jit, 0, X_GROUP3, G3_IDIV, R_TOS);
+    EmitRR(jit, 0, X_LOAD, R_TOS, remainder ? RDX : RAX);
+    FixShortJump(jit, zero);
+    FixShortJump(jit, done);
+}
+
+/* EmitCompare - compare the value under tos with tos */
+static void EmitCompare(Jit *jit, int cc)
+{
+    EmitRR(jit, 0, X_XOR, RAX, RAX);
+    EmitRM(jit, 0, 0x39, R_TOS, R_SP, NO_INDEX, 0, 0);     /* cmp [sp], tos */
+    EmitRR(jit, 0, 0x0f90 | cc, 0, RAX);                    /* setcc al */
+    EmitDrop(jit, 1);
+    EmitRR(jit, 0, X_LOAD, R_TOS, RAX);
+}
+
+/* EmitFrame - set up a frame with count longs checking for the extra longs the function pushes */
+static void EmitFrame(Jit *jit, VMUVALUE offset, int count, int extra)
+{
+    uint8_t *loop;
+    int j;
+
+    /* eax = fp - stack, fp = sp */
+    EmitRR(jit, 1, X_LOAD, RAX, R_FP);
+    EmitRR(jit, 1, X_SUB, RAX, R_STACK);
+    EmitRex(jit, 1, 0, 0, RAX);
+    Emit1(jit, 0xc1);                       /* sar rax, 2 */
+    Emit1(jit, 0xc0 | G2_SAR << 3 | RAX);
+    Emit1(jit, 2);
+    EmitRR(jit, 1, X_LOAD, R_FP, R_SP);
+
+    /* check for a stack overflow */
+    EmitRM(jit, 1, X_LEA, RCX, R_SP, NO_INDEX, 0, LONGS(-(count + extra)));
+    EmitRR(jit, 1, X_CMP, RCX, R_STACK);
+    EmitJump(jit, CC_B, JIT_OVERFLOW, offset);
+
+    /* clear the locals */
+    if (count > 0) {
+        EmitDrop(jit, -count);
+        if (count <= 8) {
+            for (j = 0; j < count; ++j) {
+                EmitRM(jit, 0, X_MOVI, 0, R_SP, NO_INDEX, 0, LONGS(j));
+                Emit4(jit, 0);
+            }
+        }
+        else {
+            EmitMovImm(jit, RCX, count);
+            loop = jit->free;
+            EmitRM(jit, 0, X_MOVI, 0, R_SP, RCX, 2, LONGS(-1));
+            Emit4(jit, 0);
+            EmitRR(jit, 0, X_GROUP5, 1, RCX);   /* dec ecx */
+            Emit1(jit, 0x75);                   /* jnz loop */
+            Emit1(jit, (int)(loop - (jit->free + 1)));
+        }
+    }
+    EmitRM(jit, 0, X_STORE, RAX, R_FP, NO_INDEX, 0, LONGS(F_FP));
+}
+
+/* EmitReturn - return to the offset on the top of the stack leaving drop longs of the frame */
+static void EmitReturn(Jit *jit, VMUVALUE offset, int drop)
+{
+    EmitRM(jit, 0, X_LOAD, RAX, R_SP, NO_INDEX, 0, 0);
+    EmitAluImm(jit, 0, G1_CMP, RAX, (VMVALUE)jit->size);
+    EmitJump(jit, CC_AE, JIT_RETURN, offset);
+    if (drop)
+        EmitRM(jit, 1, X_LEA, R_SP, R_FP, NO_INDEX, 0, LONGS(drop));
+    else
+        EmitRR(jit, 1, X_LOAD, R_SP, R_FP);
+    EmitRM(jit, 1, X_MOVSXD, RCX, R_FP, NO_INDEX, 0, LONGS(F_FP));
+    EmitRM(jit, 1, X_LEA, R_FP, R_STACK, RCX, 2, 0);
+    EmitDispatch(jit);
+}
+
+/* EmitLoop - finish a loop instruction with the new value of the loop variable in eax */
+static void EmitLoop(Jit *jit, DecodedInsn *ip, VMUVALUE offset)
+{
+    EmitRR(jit, 0, X_CMP, RAX, R_TOS);
+    if (!ip->target)
+        EmitJump(jit, CC_LE, JIT_BRANCH, offset);
+
+    /* pop without changing the flags */
+    EmitRM(jit, 0, X_LOAD, R_TOS, R_SP, NO_INDEX, 0, 0);
+    EmitRM(jit, 1, X_LEA, R_SP, R_SP, NO_INDEX, 0, sizeof(VMVALUE));
+    if (ip->target)
+        EmitJump(jit, CC_LE, JIT_DISPATCH, (VMUVALUE)(ip->target - jit->code));
+}
+
+/* EmitPush - push tos */
+static void EmitPush(Jit *jit)
+{
+    EmitDrop(jit, -1);
+    EmitRM(jit, 0, X_STORE, R_TOS, R_SP, NO_INDEX, 0, 0);
+}
+
+/* EmitPop - pop tos */
+static void EmitPop(Jit *jit)
+{
+    EmitRM(jit, 0, X_LOAD, R_TOS, R_SP, NO_INDEX, 0, 0);
+    EmitDrop(jit, 1);
+}
+
+/* EmitDrop - drop longs from the stack (a negative count makes room for them) */
+static void EmitDrop(Jit *jit, int count)
+{
+    EmitRM(jit, 1, X_LEA, R_SP, R_SP, NO_INDEX, 0, LONGS(count));
+}
+
+/* EmitSave - save the VM state in the interpreter */
+static void EmitSave(Jit *jit)
+{
+    EmitRM(jit, 1, X_STORE, R_SP, R_I, NO_INDEX, 0, offsetof(Interpreter, sp));
+    EmitRM(jit, 1, X_STORE, R_FP, R_I, NO_INDEX, 0, offsetof(Interpreter, fp));
+    EmitRM(jit, 0, X_STORE, R_TOS, R_I, NO_INDEX, 0, offsetof(Interpreter, tos));
+}
+
+/* EmitRestore - load the VM state from the interpreter */
+static void EmitRestore(Jit *jit)
+{
+    EmitRM(jit, 1, X_LOAD, R_SP, R_I, NO_INDEX, 0, offsetof(Interpreter, sp));
+    EmitRM(jit, 1, X_LOAD, R_FP, R_I, NO_INDEX, 0, offsetof(Interpreter, fp));
+    EmitRM(jit, 0, X_LOAD, R_TOS, R_I, NO_INDEX, 0, offsetof(Interpreter, tos));
+}
+
+/* EmitCall - call a function in the interpreter */
+static void EmitCall(Jit *jit, void *fcn)
+{
+    EmitMovImm64(jit, RAX, (uintptr_t)fcn);
+    EmitRR(jit, 0, X_GROUP5, G5_CALL, RAX);
+}
+
+/* EmitDispatch - jump to the translated code for the offset in eax */
+static void EmitDispatch(Jit *jit)
+{
+    EmitJumpTo(jit, CC_ALWAYS, jit->dispatch);
+}
+
+/* EmitJump - emit a jump to a code offset or to an exit to be patched at the end of the function */
+static void EmitJump(Jit *jit, int cc, int kind, VMUVALUE offset)
+{
+    JitPatch *patch = &jit->patches[jit->patchCount++];
+    EmitJumpTo(jit, cc, jit->free);
+    patch->at = jit->free - 4;
+    patch->kind = kind;
+    patch->offset = offset;
+}
+
+/* EmitJumpTo - emit a jump to translated code */
+static void EmitJumpTo(Jit *jit, int cc, uint8_t *target)
+{
+    int32_t disp;
+    if (cc == CC_ALWAYS)
+        Emit1(jit, 0xe9);
+    else {
+        Emit1(jit, 0x0f);
+        Emit1(jit, 0x80 | cc);
+    }
+    disp = (int32_t)(target - (jit->free + 4));
+    Emit4(jit, (uint32_t)disp);
+}
+
+/* EmitShortJump - emit a short forward jump to be fixed with FixShortJump */
+static uint8_t *EmitShortJump(Jit *jit, int cc)
+{
+    Emit1(jit, cc == CC_ALWAYS ? 0xeb : 0x70 | cc);
+    Emit1(jit, 0);
+    return jit->free - 1;
+}
+
+/* FixShortJump - point a short jump at the next instruction */
+static void FixShortJump(Jit *jit, uint8_t *at)
+{
+    *at = (uint8_t)(jit->free - (at + 1));
+}
+
+/* EmitAluImm - emit a group 1 instruction with an immediate operand */
+static void EmitAluImm(Jit *jit, int w, int ext, int rm, VMVALUE value)
+{
+    if (value >= -128 && value <= 127) {
+        EmitRR(jit, w, 0x83, ext, rm);
+        Emit1(jit, (uint8_t)value);
+    }
+    else {
+        EmitRR(jit, w, X_GROUP1, ext, rm);
+        Emit4(jit, (uint32_t)value);
+    }
+}
+
+/* EmitMovImm - load a 32 bit register with a constant */
+static void EmitMovImm(Jit *jit, int reg, VMVALUE value)
+{
+    EmitRex(jit, 0, 0, 0, reg);
+    Emit1(jit, 0xb8 + (reg & 7));
+    Emit4(jit, (uint32_t)value);
+}
+
+/* EmitMovImm64 - load a 64 bit register with a constant */
+static void EmitMovImm64(Jit *jit, int reg, uint64_t value)
+{
+    EmitRex(jit, 1, 0, 0, reg);
+    Emit1(jit, 0xb8 + (reg & 7));
+    Emit4(jit, (uint32_t)value);
+    Emit4(jit, (uint32_t)(value >> 32));
+}
+
+/* EmitRR - emit an instruction with a register and a register r/m operand */
+static void EmitRR(Jit *jit, int w, int op, int reg, int rm)
+{
+    EmitRex(jit, w, reg, 0, rm);
+    EmitOpcode(jit, op);
+    Emit1(jit, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* EmitRM - emit an instruction with a register and a memory operand [base + index << scale + disp] */
+static void EmitRM(Jit *jit, int w, int op, int reg, int base, int index, int scale, int32_t disp)
+{
+    int mod = (disp == 0 && (base & 7) != RBP ? 0 : disp >= -128 && disp <= 127 ? 1 : 2);
+    EmitRex(jit, w, reg, index == NO_INDEX ? 0 : index, base);
+    EmitOpcode(jit, op);
+    if (index == NO_INDEX && (base & 7) != RSP)
+        Emit1(jit, mod << 6 | (reg & 7) << 3 | (base & 7));
+    else {
+        Emit1(jit, mod << 6 | (reg & 7) << 3 | RSP);
+        Emit1(jit, scale << 6 | (index == NO_INDEX ? RSP : index & 7) << 3 | (base & 7));
+    }
+    if (mod == 1)
+        Emit1(jit, (uint8_t)disp);
+    else if (mod == 2)
+        Emit4(jit, (uint32_t)disp);
+}
+
+/* EmitRex - emit a REX prefix if one is needed */
+static void EmitRex(Jit *jit, int w, int reg, int index, int base)
+{
+    int rex = (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (index & 8 ? 2 : 0) | (base & 8 ? 1 : 0);
+    if (rex)
+        Emit1(jit, 0x40 | rex);
+}
+
+/* EmitOpcode - emit a one or two byte opcode */
+static void EmitOpcode(Jit *jit, int op)
+{
+    if (op > 0xff)
+        Emit1(jit, op >> 8);
+    Emit1(jit, op & 0xff);
+}
+
+static void Emit1(Jit *jit, int byte)
+{
+    *jit->free++ = (uint8_t)byte;
+}
+
+static void Emit4(Jit *jit, uint32_t value)
+{
+    memcpy(jit->free, &value, sizeof(value));
+    jit->free += sizeof(value);
+}
+
+/* JitTrap - handle a trap for the translated code (returns true if it switched tasks) */
+static int JitTrap(Interpreter *i, int op, uint8_t *pc)
+{
+    VMVALUE *stack = i->stack;
+    i->pc = pc;
+    DoTrap(i, op);
+    return i->pc != pc || i->stack != stack;
+}
+
+/* JitNative - run a native instruction for the translated code */
+static void JitNative(Interpreter *i, VMVALUE insn, uint8_t *pc)
+{
+    i->pc = pc;
+    DoNative(i, insn);
+}
+
+/* JitForLoopA - step a loop variable at a constant address that has to be mapped each time */
+static VMVALUE JitForLoopA(Interpreter *i, VMUVALUE addr, VMVALUE step)
+{
+    VMVALUE value = LoadConstValue(i, addr) + step;
+    StoreConstValue(i, addr, value);
+    return value;
+}
+
+#endif
@@ -0,0 +1,760 @@
+/* db_vmpins.c - cog registers, native instructions and I/O pins for the interpreter
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Each cog has a file of 512 registers that LOADA, STOREA and the native
+ * instructions the host understands use.  The LMM code of NATIVE functions is
+ * run an instruction at a time with the jumps to the kernel routines in the
+ * hub VM done here and an ASM FCACHE block is run from the registers it is
+ * loaded into.  The pins are shared by every cog.
+ * They drive the outputs OUTA and DIRA select in any cog and read the levels
+ * a stimulus file gives for the others.  Changes of the outputs can be written
+ * to a VCD file.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "db_vm.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#define LockPins(p)     EnterCriticalSection(&(p)->lock)
+#define UnlockPins(p)   LeaveCriticalSection(&(p)->lock)
+#else
+#include <pthread.h>
+#define LockPins(p)     pthread_mutex_lock(&(p)->lock)
+#define UnlockPins(p)   pthread_mutex_unlock(&(p)->lock)
+#endif
+
+/* cog registers (the VM keeps tos in a register of its own) */
+#define COG_REGISTERS   512
+#define REG_TOS         0x005
+#define REG_SP          0x007
+#define REG_FP          0x008
+#define REG_INA         0x1f2
+#define REG_CNT         0x1f1
+#define REG_OUTA        0x1f4
+#define REG_DIRA        0x1f6
+
+/* fields of a native instruction */
+#define NATIVE_OPCODE(x) ((uint32_t)(x) >> 26)
+#define NATIVE_R(x)     (((uint32_t)(x) >> 23) & 1)
+#define NATIVE_I(x)     (((uint32_t)(x) >> 22) & 1)
+#define NATIVE_Z(x)     (((uint32_t)(x) >> 25) & 1)
+#define NATIVE_C(x)     (((uint32_t)(x) >> 24) & 1)
+#define NATIVE_COND(x)  (((uint32_t)(x) >> 18) & 0xf)
+#define NATIVE_DST(x)   (((uint32_t)(x) >> 9) & 0x1ff)
+#define NATIVE_SRC(x)   ((uint32_t)(x) & 0x1ff)
+
+/* an instruction runs if the bit of its condition selected by the flags is set */
+#define CONDITION_MET(regs, x) ((NATIVE_COND(x) >> ((regs)->c * 2 + (regs)->z)) & 1)
+
+/* native opcodes the host executes (the R bit selects a read or a write for the hub opcodes) */
+#define NATIVE_BYTE     0x00
+#define NATIVE_WORD     0x01
+#define NATIVE_LONG     0x02
+#define NATIVE_HUBOP    0x03
+#define NATIVE_SHR      0x0a
+#define NATIVE_SHL      0x0b
+#define NATIVE_SAR      0x0e
+#define NATIVE_REV      0x0f
+#define NATIVE_JMP      0x17
+#define NATIVE_AND      0x18
+#define NATIVE_ANDN     0x19
+#define NATIVE_OR       0x1a
+#define NATIVE_XOR      0x1b
+#define NATIVE_MUXC     0x1c
+#define NATIVE_MUXNC    0x1d
+#define NATIVE_MUXZ     0x1e
+#define NATIVE_MUXNZ    0x1f
+#define NATIVE_ADD      0x20
+#define NATIVE_SUB      0x21
+#define NATIVE_MOV      0x28
+#define NATIVE_NEG      0x29
+#define NATIVE_CMPS     0x30
+#define NATIVE_DJNZ     0x39
+#define NATIVE_TJNZ     0x3a
+#define NATIVE_TJZ      0x3b
+#define NATIVE_WAITPEQ  0x3c
+#define NATIVE_WAITPNE  0x3d
+#define NATIVE_WAITCNT  0x3e
+#define HUBOP_COGID     1
+
+/* the stack of the cog is seen by LMM code at these addresses (sp and fp hold hub addresses) */
+#define STACK_REGION    0xe
+#define STACK_BASE      ((VMUVALUE)STACK_REGION << 28)
+
+/* cycles the LMM kernel spends fetching and running an instruction and the extra for a hub access */
+#define CYCLES_LMM      32
+#define CYCLES_LMM_HUB  16
+
+/* cycles an instruction in the FCACHE buffer takes (a hub access takes CYCLES_LMM_HUB more) */
+#define CYCLES_COG      4
+
+/* number of cogs whose outputs are combined (cog 0 runs the main code) */
+#define MAX_PIN_COGS    8
+
+/* registers of one cog */
+struct Registers {
+    VMVALUE reg[COG_REGISTERS];
+    int z;                      /* Z flag */
+    int c;                      /* C flag */
+};
+
+/* change of the level of the pins a stimulus file drives */
+typedef struct {
+    uint64_t time;              /* cycle of the change */
+    VMUVALUE mask;              /* pins that change */
+    VMUVALUE value;             /* their new levels */
+} Stimulus;
+
+/* pins shared by every cog */
+struct Pins {
+#if defined(WIN32)
+    CRITICAL_SECTION lock;      /* lock for everything else */
+#else
+    pthread_mutex_t lock;       /* lock for everything else */
+#endif
+    VMUVALUE outa[MAX_PIN_COGS];/* OUTA of each cog */
+    VMUVALUE dira[MAX_PIN_COGS];/* DIRA of each cog */
+    VMUVALUE driven;            /* pins some cog drives */
+    VMUVALUE outputs;           /* levels of the driven pins */
+    uint32_t clkfreq;           /* clock frequency for the stimulus and trace times */
+    Stimulus *stimulus;         /* stimulus changes in order of time */
+    int stimulusCount;          /* number of stimulus changes */
+    FILE *trace;                /* VCD file or NULL */
+    uint64_t traceTime;         /* time of the last trace entry in ns */
+    VMUVALUE tracedDriven;      /* driven pins as of the last trace entry */
+    VMUVALUE tracedOutputs;     /* levels of the driven pins as of the last trace entry */
+};
+
+static void RunNative(Interpreter *i, VMUVALUE addr);
+static void RunCog(Interpreter *i, VMUVALUE addr);
+static int Native(Interpreter *i, VMUVALUE insn);
+static uint8_t *MapHub(Interpreter *i, VMUVALUE addr, VMVALUE size);
+static VMUVALUE FetchLong(Interpreter *i, VMUVALUE addr);
+static int Parity(VMUVALUE value);
+static Registers *GetRegisters(Interpreter *i);
+static VMVALUE ReadRegister(Interpreter *i, int r);
+static void WriteRegister(Interpreter *i, int r, VMVALUE value);
+static void Wait(Interpreter *i, VMUVALUE state, VMUVALUE mask, int equal);
+static void UpdatePins(Interpreter *i);
+static VMUVALUE InputLevels(Interpreter *i, uint64_t time);
+static VMUVALUE StimulusLevels(Pins *pins, uint64_t time);
+static void TracePins(Pins *pins, uint64_t time);
+static int ReadStimulus(System *sys, Pins *pins, const char *path);
+static int ParseStimulus(char *p, uint32_t clkfreq, uint64_t *pTime, int *pPin, int *pLevel);
+
+/* InitPins - initialize the pins reading the stimulus file and creating the VCD file if they are given */
+Pins *InitPins(System *sys, uint32_t clkfreq, const char *stimulusPath, const char *tracePath)
+{
+    Pins *pins;
+    int j;
+
+    if (!(pins = (Pins *)xbGlobalAlloc(sys, sizeof(Pins))))
+        return NULL;
+    memset(pins, 0, sizeof(Pins));
+#if defined(WIN32)
+    InitializeCriticalSection(&pins->lock);
+#else
+    pthread_mutex_init(&pins->lock, NULL);
+#endif
+    pins->clkfreq = clkfreq;
+
+    if (stimulusPath && !ReadStimulus(sys, pins, stimulusPath))
+        return NULL;
+
+    /* every pin starts out undriven */
+    if (tracePath) {
+        if (!(pins->trace = fopen(tracePath, "w"))) {
+            xbError(sys, "error: can't create '%s'\n", tracePath);
+            return NULL;
+        }
+        fprintf(pins->trace, "$timescale 1ns $end\n$scope module propeller $end\n");
+        for (j = 0; j < 32; ++j)
+            fprintf(pins->trace, "$var wire 1 %c P%d $end\n", '!' + j, j);
+        fprintf(pins->trace, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+        for (j = 0; j < 32; ++j)
+            fprintf(pins->trace, "z%c\n", '!' + j);
+        fprintf(pins->trace, "$end\n");
+    }
+
+    return pins;
+}
+
+/* ClosePins - finish the VCD file at the time the program halted */
+void ClosePins(Interpreter *i)
+{
+    Pins *pins = i->pins;
+    uint64_t time;
+    if (pins && pins->trace) {
+        time = ClockCycles(i) * 1000000000 / pins->clkfreq;
+        if (time > pins->traceTime)
+            fprintf(pins->trace, "#%llu\n", (unsigned long long)time);
+        fclose(pins->trace);
+        pins->trace = NULL;
+    }
+}
+
+/* MapRegister - map the address of a cog register (returns NULL if the address isn't one) */
+uint8_t *MapRegister(Interpreter *i, VMUVALUE addr)
+{
+    Registers *regs;
+    int r;
+
+    if (ADDR_REGION(addr) != ADDR_REGION(COG_BASE) || ADDR_OFFSET(addr) >= COG_REGISTERS * sizeof(VMVALUE))
+        return NULL;
+    regs = GetRegisters(i);
+
+    /* CNT and INA are read when the code reads them */
+    r = ADDR_OFFSET(addr) / sizeof(VMVALUE);
+    if (r == REG_CNT || r == REG_INA)
+        regs->reg[r] = ReadRegister(i, r);
+
+    return (uint8_t *)regs->reg + ADDR_OFFSET(addr);
+}
+
+/* RegisterStored - update the pins after a store to a cog register */
+void RegisterStored(Interpreter *i, VMUVALUE addr)
+{
+    int r = ADDR_OFFSET(addr) / sizeof(VMVALUE);
+    if (!i->sectionMap[ADDR_REGION(addr)] && (r == REG_OUTA || r == REG_DIRA))
+        UpdatePins(i);
+}
+
+/* ReleaseRegisters - release the outputs and registers of a cog that has halted */
+void ReleaseRegisters(Interpreter *i)
+{
+    if (i->registers) {
+        i->registers->reg[REG_OUTA] = i->registers->reg[REG_DIRA] = 0;
+        UpdatePins(i);
+        free(i->registers);
+        i->registers = NULL;
+    }
+}
+
+/* DoNative - execute a native instruction (jmp #LMM_ENTER runs the LMM code that follows it
+   and jmp #LMM_CALL the LMM code at the address in tos)
+   (the code of a NATIVE function starts at the first long at least two bytes past the NATIVE
+    instruction and the host's base register is zero so its hub addresses are VM addresses) */
+void DoNative(Interpreter *i, VMVALUE insn)
+{
+    ImageSection *section;
+    if ((VMUVALUE)insn == LMM_ENTER_INSN) {
+        section = i->sectionMap[ADDR_REGION(i->image->mainCode)];
+        RunNative(i, (section->fileSection->base + (VMUVALUE)(i->pc - section->data) + 5) & ~ALIGN_MASK);
+    }
+    else if ((VMUVALUE)insn == LMM_CALL_INSN)
+        RunNative(i, (VMUVALUE)i->tos);
+    else
+        Native(i, (VMUVALUE)insn);
+}
+
+/* RunNative - run LMM code until it jumps to LMM_RET or into the FCACHE buffer */
+static void RunNative(Interpreter *i, VMUVALUE addr)
+{
+    Registers *regs = GetRegisters(i);
+    VMUVALUE insn, target, *pc;
+
+    pc = (VMUVALUE *)&regs->reg[LMM_PC];
+    *pc = addr;
+    for (;;) {
+        insn = FetchLong(i, *pc);
+        *pc += sizeof(VMUVALUE);
+        if (i->clock)
+            ClockWait(i, CYCLES_LMM);
+
+        /* everything but the jumps to the kernel runs as it would in the VM cog */
+        if (NATIVE_OPCODE(insn) != NATIVE_JMP) {
+            if (Native(i, insn) && i->clock)
+                ClockWait(i, CYCLES_LMM_HUB);
+            continue;
+        }
+        if (!CONDITION_MET(regs, insn))
+            continue;
+        if (i->clock)
+            ClockWait(i, CYCLES_LMM);
+        target = NATIVE_I(insn) ? NATIVE_SRC(insn) : (VMUVALUE)ReadRegister(i, NATIVE_SRC(insn)) & 0x1ff;
+        switch (target) {
+        case LMM_JMP:
+            *pc = FetchLong(i, *pc);
+            break;
+        case LMM_LDI:
+            regs->reg[LMM_K] = (VMVALUE)FetchLong(i, *pc);
+            *pc += sizeof(VMUVALUE);
+            break;
+        case LMM_RET:
+            return;
+        default:
+            if (target < LMM_FCACHE || target >= LMM_FCACHE + LMM_FCACHE_SIZE)
+                Abort(i, "native code jumped to cog address 0x%03x", target);
+            RunCog(i, target);
+            return;
+        }
+    }
+}
+
+/* RunCog - run the block in the FCACHE buffer from a cog address until it jumps to LMM_RET
+   (the jumps it can use are JMP, JMPRET, DJNZ, TJNZ and TJZ within the buffer) */
+static void RunCog(Interpreter *i, VMUVALUE addr)
+{
+    Registers *regs = GetRegisters(i);
+    VMUVALUE insn, target;
+    VMVALUE d;
+    int op;
+
+    for (;;) {
+        if (addr < LMM_FCACHE || addr >= LMM_FCACHE + LMM_FCACHE_SIZE)
+            Abort(i, "FCACHE code jumped to cog address 0x%03x", addr);
+        insn = (VMUVALUE)regs->reg[addr++];
+        if (i->clock)
+            ClockWait(i, CYCLES_COG);
+
+        /* everything but the jumps runs as it would in LMM code */
+        op = NATIVE_OPCODE(insn);
+        if (op != NATIVE_JMP && (op < NATIVE_DJNZ || op > NATIVE_TJZ)) {
+            if (Native(i, insn) && i->clock)
+                ClockWait(i, CYCLES_LMM_HUB);
+            continue;
+        }
+        if (!CONDITION_MET(regs, insn))
+            continue;
+        target = NATIVE_I(insn) ? NATIVE_SRC(insn) : (VMUVALUE)ReadRegister(i, NATIVE_SRC(insn)) & 0x1ff;
+
+        /* JMPRET stores the return address in the source field of its destination */
+        if (op == NATIVE_JMP) {
+            if (NATIVE_R(insn)) {
+                d = ReadRegister(i, NATIVE_DST(insn));
+                WriteRegister(i, NATIVE_DST(insn), (VMVALUE)(((VMUVALUE)d & ~0x1ff) | addr));
+            }
+        }
+
+        /* DJNZ decrements its destination and DJNZ and TJNZ jump if it isn't zero and TJZ if it is */
+        else {
+            d = ReadRegister(i, NATIVE_DST(insn));
+            if (op == NATIVE_DJNZ) {
+                if (NATIVE_C(insn))
+                    regs->c = d == 0;
+                d = (VMVALUE)((VMUVALUE)d - 1);
+                if (NATIVE_R(insn))
+                    WriteRegister(i, NATIVE_DST(insn), d);
+            }
+            else if (NATIVE_C(insn))
+                regs->c = FALSE;
+            if (NATIVE_Z(insn))
+                regs->z = d == 0;
+            if ((d == 0) != (op == NATIVE_TJZ))
+                continue;
+        }
+
+        if (target == LMM_RET)
+            return;
+        addr = target;
+    }
+}
+
+/* Native - execute an instruction honoring its condition and setting the flags it writes
+   (the host only has the registers and hub memory so it skips jumps and the hub operations
+    other than COGID, returns TRUE if the instruction accessed hub memory) */
+static int Native(Interpreter *i, VMUVALUE insn)
+{
+    int op = NATIVE_OPCODE(insn), dst = NATIVE_DST(insn), src = NATIVE_SRC(insn);
+    Registers *regs = GetRegisters(i);
+    VMVALUE d, s, result;
+    uint64_t now, target;
+    int carry, hub = FALSE;
+    uint8_t *p;
+    int cnt;
+
+    if (!CONDITION_MET(regs, insn))
+        return FALSE;
+    d = ReadRegister(i, dst);
+    s = NATIVE_I(insn) ? src : ReadRegister(i, src);
+    carry = regs->c;
+
+    switch (op) {
+    case NATIVE_BYTE:
+    case NATIVE_WORD:
+    case NATIVE_LONG:
+        /* hub long zero holds clkfreq and the VM's own hub addresses are VM addresses */
+        hub = TRUE;
+        if (NATIVE_R(insn) && op == NATIVE_LONG && s == 0)
+            result = (VMVALUE)ClockFrequency(i);
+        else {
+            p = MapHub(i, (VMUVALUE)s, 1 << op);
+            if (NATIVE_R(insn))
+                result = op == NATIVE_BYTE ? *p : op == NATIVE_WORD ? *(uint16_t *)p : *(VMVALUE *)p;
+            else {
+                if (op == NATIVE_BYTE)
+                    *p = (uint8_t)d;
+                else if (op == NATIVE_WORD)
+                    *(uint16_t *)p = (uint16_t)d;
+                else
+                    *(VMVALUE *)p = d;
+                return hub;
+            }
+        }
+        break;
+    case NATIVE_HUBOP:
+        if (src != HUBOP_COGID || !NATIVE_I(insn))
+            return FALSE;
+        result = i->cogId;
+        hub = TRUE;
+        break;
+    case NATIVE_SHR:
+        result = (VMVALUE)((VMUVALUE)d >> (s & 31));
+        carry = d & 1;
+        break;
+    case NATIVE_SHL:
+        result = d << (s & 31);
+        carry = ((VMUVALUE)d >> 31) & 1;
+        break;
+    case NATIVE_SAR:
+        result = d >> (s & 31);
+        carry = d & 1;
+        break;
+    case NATIVE_REV:
+        /* reverse the bits and keep the 32 - s that were at the bottom */
+        carry = d & 1;
+        for (result = 0, cnt = 32; --cnt >= 0; d >>= 1)
+            result = (result << 1) | (d & 1);
+        result = (VMVALUE)((VMUVALUE)result >> (s & 31));
+        break;
+    case NATIVE_AND:
+        result = d & s;
+        carry = Parity((VMUVALUE)result);
+        break;
+    case NATIVE_ANDN:
+        result = d & ~s;
+        carry = Parity((VMUVALUE)result);
+        break;
+    case NATIVE_OR:
+        result = d | s;
+        carry = Parity((VMUVALUE)result);
+        break;
+    case NATIVE_XOR:
+        result = d ^ s;
+        carry = Parity((VMUVALUE)result);
+        break;
+    case NATIVE_MUXC:
+    case NATIVE_MUXNC:
+    case NATIVE_MUXZ:
+    case NATIVE_MUXNZ:
+        /* the flag selects whether the bits of the mask are set or cleared */
+        cnt = op == NATIVE_MUXC ? regs->c : op == NATIVE_MUXNC ? !regs->c : op == NATIVE_MUXZ ? regs->z : !regs->z;
+        result = cnt ? d | s : d & ~s;
+        carry = Parity((VMUVALUE)result);
+        break;
+    case NATIVE_ADD:
+        result = (VMVALUE)((VMUVALUE)d + (VMUVALUE)s);
+        carry = (VMUVALUE)result < (VMUVALUE)d;
+        break;
+    case NATIVE_SUB:
+        result = (VMVALUE)((VMUVALUE)d - (VMUVALUE)s);
+        carry = (VMUVALUE)d < (VMUVALUE)s;
+        break;
+    case NATIVE_CMPS:
+        result = (VMVALUE)((VMUVALUE)d - (VMUVALUE)s);
+        carry = d < s;
+        break;
+    case NATIVE_MOV:
+        result = s;
+        carry = ((VMUVALUE)s >> 31) & 1;
+        break;
+    case NATIVE_NEG:
+        result = (VMVALUE)(0 - (VMUVALUE)s);
+        carry = ((VMUVALUE)s >> 31) & 1;
+        break;
+    case NATIVE_WAITPEQ:
+    case NATIVE_WAITPNE:
+        Wait(i, (VMUVALUE)d, (VMUVALUE)s, op == NATIVE_WAITPEQ);
+        return FALSE;
+    case NATIVE_WAITCNT:
+        /* CNT must reach the target (the whole 32 bit period passes if it already has) */
+        now = ClockCycles(i);
+        target = now + 6 + (uint32_t)((uint32_t)d - (uint32_t)(now + 6));
+        ClockWait(i, target - now);
+        result = d + s;
+        break;
+    default:
+        return FALSE;
+    }
+
+    if (NATIVE_Z(insn))
+        regs->z = result == 0;
+    if (NATIVE_C(insn))
+        regs->c = carry;
+    if (NATIVE_R(insn))
+        WriteRegister(i, dst, result);
+    return hub;
+}
+
+/* MapHub - map a range of hub memory (the stack is at STACK_BASE and everything else is at its VM address) */
+static uint8_t *MapHub(Interpreter *i, VMUVALUE addr, VMVALUE size)
+{
+    VMUVALUE offset = ADDR_OFFSET(addr), stackSize;
+    if (ADDR_REGION(addr) != STACK_REGION)
+        return MapBytes(i, addr, size);
+    stackSize = (VMUVALUE)((uint8_t *)i->stackTop - (uint8_t *)i->stack);
+    if (offset > stackSize || (VMUVALUE)size > stackSize - offset)
+        Abort(i, "address error");
+    return (uint8_t *)i->stack + offset;
+}
+
+/* FetchLong - fetch a long of LMM code (hub memory is little endian) */
+static VMUVALUE FetchLong(Interpreter *i, VMUVALUE addr)
+{
+    uint8_t *p = MapHub(i, addr, sizeof(VMUVALUE));
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((VMUVALUE)p[3] << 24);
+}
+
+/* Parity - get the parity of a value (the C flag of the logic instructions) */
+static int Parity(VMUVALUE value)
+{
+    value ^= value >> 16;
+    value ^= value >> 8;
+    value ^= value >> 4;
+    value ^= value >> 2;
+    value ^= value >> 1;
+    return value & 1;
+}
+
+/* GetRegisters - get the registers of a cog (the first access creates them) */
+static Registers *GetRegisters(Interpreter *i)
+{
+    if (!i->registers) {
+        if (!(i->registers = (Registers *)malloc(sizeof(Registers))))
+            Abort(i, "insufficient memory");
+        memset(i->registers, 0, sizeof(Registers));
+        i->registers->reg[LMM_TAG] = -1;   /* no FCACHE block loaded as in the VM image */
+    }
+    return i->registers;
+}
+
+/* ReadRegister - read a cog register */
+static VMVALUE ReadRegister(Interpreter *i, int r)
+{
+    switch (r) {
+    case REG_TOS:
+        return i->tos;
+    case REG_SP:
+        return (VMVALUE)(STACK_BASE + (VMUVALUE)((uint8_t *)i->sp - (uint8_t *)i->stack));
+    case REG_FP:
+        return (VMVALUE)(STACK_BASE + (VMUVALUE)((uint8_t *)i->fp - (uint8_t *)i->stack));
+    case REG_CNT:
+        return (VMVALUE)LoggedInput(i, IOLOG_CNT, ClockCycles(i));
+    case REG_INA:
+        return (VMVALUE)LoggedInput(i, IOLOG_INA, InputLevels(i, ClockCycles(i)));
+    }
+    return GetRegisters(i)->reg[r];
+}
+
+/* WriteRegister - write a cog register (CNT and INA are read-only and the VM owns sp and fp) */
+static void WriteRegister(Interpreter *i, int r, VMVALUE value)
+{
+    switch (r) {
+    case REG_TOS:
+        i->tos = value;
+        break;
+    case REG_SP:
+    case REG_FP:
+    case REG_CNT:
+    case REG_INA:
+        break;
+    default:
+        GetRegisters(i)->reg[r] = value;
+        if (r == REG_OUTA || r == REG_DIRA)
+            UpdatePins(i);
+        break;
+    }
+}
+
+/* Wait - wait for the masked inputs to equal or differ from a state
+   (only the stimulus can change them while the cog waits) */
+static void Wait(Interpreter *i, VMUVALUE state, VMUVALUE mask, int equal)
+{
+    Pins *pins = i->pins;
+    uint64_t now = (uint64_t)LoggedInput(i, IOLOG_CNT, ClockCycles(i));
+    int j;
+
+    if (((InputLevels(i, now) & mask) == state) == equal)
+        return;
+    if (pins) {
+        for (j = 0; j < pins->stimulusCount; ++j) {
+            if (pins->stimulus[j].time > now && ((InputLevels(i, pins->stimulus[j].time) & mask) == state) == equal) {
+                ClockWait(i, pins->stimulus[j].time - now);
+                return;
+            }
+        }
+    }
+    Abort(i, "%s never returns", equal ? "waitpeq" : "waitpne");
+}
+
+/* UpdatePins - combine the outputs of a cog with those of the others */
+static void UpdatePins(Interpreter *i)
+{
+    Registers *regs = GetRegisters(i);
+    Pins *pins = i->pins;
+    VMUVALUE driven, outputs;
+    int j;
+
+    if (!pins || i->cogId >= MAX_PIN_COGS)
+        return;
+
+    LockPins(pins);
+    pins->outa[i->cogId] = (VMUVALUE)regs->reg[REG_OUTA];
+    pins->dira[i->cogId] = (VMUVALUE)regs->reg[REG_DIRA];
+    driven = outputs = 0;
+    for (j = 0; j < MAX_PIN_COGS; ++j) {
+        driven |= pins->dira[j];
+        outputs |= pins->outa[j] & pins->dira[j];
+    }
+    pins->driven = driven;
+    pins->outputs = outputs;
+    if (pins->trace)
+        TracePins(pins, ClockCycles(i));
+    UnlockPins(pins);
+}
+
+/* InputLevels - get the levels INA reads at a time */
+static VMUVALUE InputLevels(Interpreter *i, uint64_t time)
+{
+    Registers *regs = GetRegisters(i);
+    Pins *pins = i->pins;
+    VMUVALUE levels;
+
+    /* without the pins a cog only sees its own outputs */
+    if (!pins)
+        return (VMUVALUE)(regs->reg[REG_OUTA] & regs->reg[REG_DIRA]);
+
+    LockPins(pins);
+    levels = (StimulusLevels(pins, time) & ~pins->driven) | pins->outputs;
+    UnlockPins(pins);
+
+    return levels;
+}
+
+/* StimulusLevels - get the levels the stimulus gives the pins at a time (they start out low) */
+static VMUVALUE StimulusLevels(Pins *pins, uint64_t time)
+{
+    VMUVALUE levels = 0;
+    int j;
+    for (j = 0; j < pins->stimulusCount && pins->stimulus[j].time <= time; ++j)
+        levels = (levels & ~pins->stimulus[j].mask) | pins->stimulus[j].value;
+    return levels;
+}
+
+/* TracePins - write the levels of the pins that changed since the last trace entry */
+static void TracePins(Pins *pins, uint64_t time)
+{
+    uint64_t ns = time * 1000000000 / pins->clkfreq;
+    VMUVALUE changed, bit;
+    int j;
+
+    if (!(changed = (pins->driven ^ pins->tracedDriven) | (pins->outputs ^ pins->tracedOutputs)))
+        return;
+
+    /* cogs without the clock can be behind each other */
+    if (ns > pins->traceTime) {
+        fprintf(pins->trace, "#%llu\n", (unsigned long long)ns);
+        pins->traceTime = ns;
+    }
+
+    for (j = 0; j < 32; ++j) {
+        bit = (VMUVALUE)1 << j;
+        if (changed & bit)
+            fprintf(pins->trace, "%c%c\n", !(pins->driven & bit) ? 'z' : (pins->outputs & bit) ? '1' : '0', '!' + j);
+    }
+    pins->tracedDriven = pins->driven;
+    pins->tracedOutputs = pins->outputs;
+}
+
+/* ReadStimulus - read a stimulus file */
+static int ReadStimulus(System *sys, Pins *pins, const char *path)
+{
+    int lineNumber = 0, max = 0, pin, level;
+    char line[256], *p;
+    const char *error = NULL;
+    uint64_t time;
+    Stimulus *s;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r"))) {
+        xbError(sys, "error: can't open '%s'\n", path);
+        return FALSE;
+    }
+
+    while (!error && fgets(line, sizeof(line), fp)) {
+        ++lineNumber;
+
+        /* skip blank lines and comments */
+        for (p = line; isspace((unsigned char)*p); ++p)
+            ;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        /* add the change */
+        if (!ParseStimulus(p, pins->clkfreq, &time, &pin, &level))
+            error = "expecting a time, a pin number and a level of 0 or 1";
+        else if (pins->stimulusCount > 0 && time < pins->stimulus[pins->stimulusCount - 1].time)
+            error = "stimulus times can't go back";
+        else {
+            if (pins->stimulusCount >= max) {
+                max = max ? max * 2 : 64;
+                if (!(s = (Stimulus *)realloc(pins->stimulus, max * sizeof(Stimulus)))) {
+                    error = "insufficient memory";
+                    break;
+                }
+                pins->stimulus = s;
+            }
+            s = &pins->stimulus[pins->stimulusCount++];
+            s->time = time;
+            s->mask = (VMUVALUE)1 << pin;
+            s->value = (VMUVALUE)level << pin;
+        }
+    }
+    fclose(fp);
+
+    if (error) {
+        xbError(sys, "error: %s(%d): %s\n", path, lineNumber, error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* ParseStimulus - parse a stimulus line
+   (a time in cycles or with a suffix of us, ms or s, a pin number and a level) */
+static int ParseStimulus(char *p, uint32_t clkfreq, uint64_t *pTime, int *pPin, int *pLevel)
+{
+    uint64_t time, scale;
+    char unit[4], extra;
+    int n;
+
+    /* get the time */
+    if (!isdigit((unsigned char)*p))
+        return FALSE;
+    for (time = 0; isdigit((unsigned char)*p); ++p)
+        time = time * 10 + (*p - '0');
+    for (n = 0; isalpha((unsigned char)*p); ++p)
+        if (n < (int)sizeof(unit) - 1)
+            unit[n++] = tolower((unsigned char)*p);
+    unit[n] = '\0';
+    if (n == 0)
+        scale = 0;
+    else if (strcmp(unit, "us") == 0)
+        scale = 1000000;
+    else if (strcmp(unit, "ms") == 0)
+        scale = 1000;
+    else if (strcmp(unit, "s") == 0)
+        scale = 1;
+    else
+        return FALSE;
+    *pTime = scale ? time * clkfreq / scale : time;
+
+    /* get the pin and its level */
+    if (sscanf(p, "%d %d %c", pPin, pLevel, &extra) != 2)
+        return FALSE;
+    return *pPin >= 0 && *pPin <= 31 && (*pLevel == 0 || *pLevel == 1);
+}
@@ -0,0 +1,394 @@
+/* db_vmprof.c - execution profiler
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+#include "db_vmdebug.h"
+
+/* number of opcode pairs and source lines to show in the report */
+#define TOP_PAIRS   20
+#define TOP_LINES   20
+
+/* function profile entry */
+typedef struct {
+    VMUVALUE start;         /* offset of the function in the code section */
+    char *name;             /* function name or NULL if unknown */
+    uint64_t calls;         /* number of times the function was called */
+    uint64_t count;         /* number of instructions executed in the function */
+} FunctionProfile;
+
+/* sort entry for the opcode and pair reports */
+typedef struct {
+    int index;
+    uint64_t count;
+} CountEntry;
+
+/* prototypes for local functions */
+static FunctionProfile *BuildFunctionProfile(Profile *p, int *pCount);
+static void FunctionName(Profile *p, FunctionProfile *f, char *buf);
+static CountEntry *BuildLineProfile(Profile *p, int *pCount);
+static void LineName(Profile *p, int index, char *buf);
+static void OpcodeName(int opcode, char *buf);
+static int CompareFunctions(const void *p1, const void *p2);
+static int CompareCounts(const void *p1, const void *p2);
+static int CompareOffsets(const void *p1, const void *p2);
+static double Percent(uint64_t count, uint64_t total);
+
+/* InitProfile - initialize an execution profile for an image */
+Profile *InitProfile(System *sys, ImageHdr *image)
+{
+    ImageSection *section;
+    VMUVALUE size;
+    Profile *p;
+
+    /* find the section containing the main code */
+    if (!(section = FindCodeSection(image)))
+        return NULL;
+    size = section->fileSection->size;
+
+    /* allocate the profile */
+    if (!(p = (Profile *)xbGlobalAlloc(sys, sizeof(Profile))))
+        return NULL;
+    memset(p, 0, sizeof(Profile));
+    p->image = image;
+    p->codeSection = section;
+    p->codeSize = size;
+
+    /* allocate the counters */
+    if (!(p->counts = (uint64_t *)xbGlobalAlloc(sys, size * sizeof(uint64_t)))
+    ||  !(p->calls = (uint64_t *)xbGlobalAlloc(sys, size * sizeof(uint64_t)))
+    ||  !(p->pairCounts = (uint64_t *)xbGlobalAlloc(sys, 256 * 256 * sizeof(uint64_t))))
+        return NULL;
+    memset(p->counts, 0, size * sizeof(uint64_t));
+    memset(p->calls, 0, size * sizeof(uint64_t));
+    memset(p->pairCounts, 0, 256 * 256 * sizeof(uint64_t));
+    p->lastOpcode = -1;
+
+    /* return the new profile */
+    return p;
+}
+
+/* ProfileInstruction - count the execution of the instruction at pc */
+void ProfileInstruction(Profile *p, const uint8_t *pc)
+{
+    VMUVALUE offset = (VMUVALUE)(pc - p->codeSection->data);
+    int opcode = VMCODEBYTE(pc);
+    if (offset < p->codeSize)
+        ++p->counts[offset];
+    else
+        ++p->outside;
+    if (p->lastOpcode >= 0)
+        ++p->pairCounts[(p->lastOpcode << 8) | opcode];
+    p->lastOpcode = opcode;
+    ++p->total;
+}
+
+/* ProfileCall - count a call to the function at pc */
+void ProfileCall(Profile *p, const uint8_t *pc)
+{
+    VMUVALUE offset = (VMUVALUE)(pc - p->codeSection->data);
+    if (offset < p->codeSize)
+        ++p->calls[offset];
+}
+
+/* ShowProfile - display the profile report */
+void ShowProfile(System *sys, Profile *p)
+{
+    CountEntry entries[256], *pairs, *lines;
+    FunctionProfile *functions;
+    uint64_t opcodeCounts[256];
+    int count, n, j;
+    char name[256];
+
+    xbInfo(sys, "\nprofile: %llu instructions\n", (unsigned long long)p->total);
+    if (p->outside > 0)
+        xbInfo(sys, "  %llu instructions outside of the code section\n", (unsigned long long)p->outside);
+
+    /* show the functions with the most instructions executed first */
+    if ((functions = BuildFunctionProfile(p, &count)) != NULL) {
+        qsort(functions, count, sizeof(FunctionProfile), CompareFunctions);
+        xbInfo(sys, "\nfunctions:\n");
+        xbInfo(sys, "  %12s %12s %7s  %s\n", "calls", "instructions", "%", "name");
+        for (j = 0; j < count; ++j) {
+            FunctionProfile *f = &functions[j];
+            if (f->count > 0 || f->calls > 0) {
+                FunctionName(p, f, name);
+                xbInfo(sys, "  %12llu %12llu %6.2f%%  %s\n", (unsigned long long)f->calls, (unsigned long long)f->count, Percent(f->count, p->total), name);
+            }
+        }
+        free(functions);
+    }
+
+    /* show the source lines with the most instructions executed if the image has a line table */
+    if ((lines = BuildLineProfile(p, &count)) != NULL) {
+        qsort(lines, count, sizeof(CountEntry), CompareCounts);
+        xbInfo(sys, "\nlines:\n");
+        xbInfo(sys, "  %12s %7s  %s\n", "instructions", "%", "line");
+        for (j = 0; j < count && j < TOP_LINES && lines[j].count > 0; ++j) {
+            LineName(p, lines[j].index, name);
+            xbInfo(sys, "  %12llu %6.2f%%  %s\n", (unsigned long long)lines[j].count, Percent(lines[j].count, p->total), name);
+        }
+        free(lines);
+    }
+
+    /* show the opcode counts */
+    GetOpcodeCounts(p, opcodeCounts);
+    for (n = j = 0; j < 256; ++j)
+        if (opcodeCounts[j] > 0) {
+            entries[n].index = j;
+            entries[n].count = opcodeCounts[j];
+            ++n;
+        }
+    qsort(entries, n, sizeof(CountEntry), CompareCounts);
+    xbInfo(sys, "\nopcodes:\n");
+    xbInfo(sys, "  %12s %7s  %s\n", "count", "%", "opcode");
+    for (j = 0; j < n; ++j) {
+        OpcodeName(entries[j].index, name);
+        xbInfo(sys, "  %12llu %6.2f%%  %s\n", (unsigned long long)entries[j].count, Percent(entries[j].count, p->total), name);
+    }
+
+    /* show the most frequent opcode pairs */
+    for (count = j = 0; j < 256 * 256; ++j)
+        if (p->pairCounts[j] > 0)
+            ++count;
+    if (count > 0 && (pairs = (CountEntry *)malloc(count * sizeof(CountEntry))) != NULL) {
+        for (n = j = 0; j < 256 * 256; ++j)
+            if (p->pairCounts[j] > 0) {
+                pairs[n].index = j;
+                pairs[n].count = p->pairCounts[j];
+                ++n;
+            }
+        qsort(pairs, n, sizeof(CountEntry), CompareCounts);
+        xbInfo(sys, "\nopcode pairs:\n");
+        xbInfo(sys, "  %12s %7s  %s\n", "count", "%", "opcodes");
+        for (j = 0; j < n && j < TOP_PAIRS; ++j) {
+            char second[32];
+            OpcodeName(pairs[j].index >> 8, name);
+            OpcodeName(pairs[j].index & 0xff, second);
+            xbInfo(sys, "  %12llu %6.2f%%  %s %s\n", (unsigned long long)pairs[j].count, Percent(pairs[j].count, p->total), name, second);
+        }
+        free(pairs);
+    }
+}
+
+/* WriteProfileCSV - write the profile as a CSV file
+   (rows are in address and opcode order so profiles can be compared with diff) */
+int WriteProfileCSV(Profile *p, const char *path)
+{
+    FunctionProfile *functions;
+    uint64_t opcodeCounts[256];
+    char name[256], second[32];
+    CountEntry *lines;
+    int count, j;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "w")))
+        return FALSE;
+
+    fprintf(fp, "kind,name,count,calls\n");
+
+    /* write the functions */
+    if ((functions = BuildFunctionProfile(p, &count)) != NULL) {
+        for (j = 0; j < count; ++j) {
+            FunctionProfile *f = &functions[j];
+            FunctionName(p, f, name);
+            fprintf(fp, "function,%s,%llu,%llu\n", name, (unsigned long long)f->count, (unsigned long long)f->calls);
+        }
+        free(functions);
+    }
+
+    /* write the source lines that were executed */
+    if ((lines = BuildLineProfile(p, &count)) != NULL) {
+        for (j = 0; j < count; ++j)
+            if (lines[j].count > 0) {
+                LineName(p, lines[j].index, name);
+                fprintf(fp, "line,%s,%llu,\n", name, (unsigned long long)lines[j].count);
+            }
+        free(lines);
+    }
+
+    /* write the opcodes */
+    GetOpcodeCounts(p, opcodeCounts);
+    for (j = 0; j < 256; ++j)
+        if (opcodeCounts[j] > 0) {
+            OpcodeName(j, name);
+            fprintf(fp, "opcode,%s,%llu,\n", name, (unsigned long long)opcodeCounts[j]);
+        }
+
+    /* write the opcode pairs */
+    for (j = 0; j < 256 * 256; ++j)
+        if (p->pairCounts[j] > 0) {
+            OpcodeName(j >> 8, name);
+            OpcodeName(j & 0xff, second);
+            fprintf(fp, "pair,%s %s,%llu,\n", name, second, (unsigned long long)p->pairCounts[j]);
+        }
+
+    fclose(fp);
+    return TRUE;
+}
+
+/* GetOpcodeCounts - compute the opcode counts from the instruction counts */
+void GetOpcodeCounts(Profile *p, uint64_t *opcodeCounts)
+{
+    VMUVALUE offset;
+    memset(opcodeCounts, 0, 256 * sizeof(uint64_t));
+    for (offset = 0; offset < p->codeSize; ++offset)
+        if (p->counts[offset] > 0)
+            opcodeCounts[VMCODEBYTE(p->codeSection->data + offset)] += p->counts[offset];
+}
+
+/* BuildFunctionProfile - build the per-function counts in address order
+   (functions start at the main code, at each symbol and at each call target) */
+static FunctionProfile *BuildFunctionProfile(Profile *p, int *pCount)
+{
+    VMUVALUE base = p->codeSection->fileSection->base;
+    ImageHdr *image = p->image;
+    FunctionProfile *functions;
+    VMUVALUE offset, *starts;
+    int maxCount, count, j, k;
+
+    /* collect the function start offsets */
+    maxCount = 1 + image->symbolCount;
+    for (offset = 0; offset < p->codeSize; ++offset)
+        if (p->calls[offset] > 0)
+            ++maxCount;
+    if (!(starts = (VMUVALUE *)malloc(maxCount * sizeof(VMUVALUE))))
+        return NULL;
+    count = 0;
+    starts[count++] = image->mainCode - base;
+    for (j = 0; j < image->symbolCount; ++j) {
+        offset = image->symbols[j].value - base;
+        if (offset < p->codeSize)
+            starts[count++] = offset;
+    }
+    for (offset = 0; offset < p->codeSize; ++offset)
+        if (p->calls[offset] > 0)
+            starts[count++] = offset;
+    qsort(starts, count, sizeof(VMUVALUE), CompareOffsets);
+
+    /* remove duplicates */
+    for (j = k = 0; j < count; ++j)
+        if (k == 0 || starts[j] != starts[k - 1])
+            starts[k++] = starts[j];
+    count = k;
+
+    /* build the function table */
+    if (!(functions = (FunctionProfile *)malloc(count * sizeof(FunctionProfile)))) {
+        free(starts);
+        return NULL;
+    }
+    for (j = 0; j < count; ++j) {
+        FunctionProfile *f = &functions[j];
+        VMUVALUE end = j + 1 < count ? starts[j + 1] : p->codeSize;
+        f->start = starts[j];
+        f->name = NULL;
+        for (k = 0; k < image->symbolCount; ++k)
+            if (image->symbols[k].value == base + f->start)
+                f->name = image->symbols[k].name;
+        f->calls = p->calls[f->start];
+        for (f->count = 0, offset = f->start; offset < end; ++offset)
+            f->count += p->counts[offset];
+    }
+    free(starts);
+
+    /* return the function table */
+    *pCount = count;
+    return functions;
+}
+
+/* FunctionName - get the name of a function for the report */
+static void FunctionName(Profile *p, FunctionProfile *f, char *buf)
+{
+    VMUVALUE addr = p->codeSection->fileSection->base + f->start;
+    if (f->name)
+        sprintf(buf, "%.200s", f->name);
+    else if (addr == p->image->mainCode)
+        strcpy(buf, "[main]");
+    else
+        sprintf(buf, "%08x", addr);
+}
+
+/* BuildLineProfile - build the per-line counts in line table order (returns NULL without a line table) */
+static CountEntry *BuildLineProfile(Profile *p, int *pCount)
+{
+    VMUVALUE base = p->codeSection->fileSection->base;
+    ImageHdr *image = p->image;
+    VMUVALUE start, end, offset;
+    CountEntry *lines;
+    int j;
+
+    if (image->lineCount == 0 || !(lines = (CountEntry *)malloc(image->lineCount * sizeof(CountEntry))))
+        return NULL;
+    for (j = 0; j < image->lineCount; ++j) {
+        start = image->lines[j].address - base;
+        end = j + 1 < image->lineCount ? image->lines[j + 1].address - base : p->codeSize;
+        lines[j].index = j;
+        lines[j].count = 0;
+        for (offset = start; offset < end && offset < p->codeSize; ++offset)
+            lines[j].count += p->counts[offset];
+    }
+
+    *pCount = image->lineCount;
+    return lines;
+}
+
+/* LineName - get the name of a line table entry for the report */
+static void LineName(Profile *p, int index, char *buf)
+{
+    ImageFileLine *line = &p->image->lines[index];
+    const char *file = SourceFileName(p->image, line);
+    if (file)
+        sprintf(buf, "%.200s:%d", file, (int)line->line);
+    else
+        sprintf(buf, "%d", (int)line->line);
+}
+
+/* OpcodeName - get the name of an opcode for the report */
+static void OpcodeName(int opcode, char *buf)
+{
+    FLASH_SPACE OTDEF *op;
+    for (op = OpcodeTable; op->name; ++op)
+        if (op->code == opcode) {
+            strcpy(buf, op->name);
+            return;
+        }
+    sprintf(buf, "%02x", opcode);
+}
+
+/* CompareFunctions - sort functions by decreasing instruction count */
+static int CompareFunctions(const void *p1, const void *p2)
+{
+    const FunctionProfile *f1 = (const FunctionProfile *)p1;
+    const FunctionProfile *f2 = (const FunctionProfile *)p2;
+    if (f1->count != f2->count)
+        return f1->count < f2->count ? 1 : -1;
+    return f1->start < f2->start ? -1 : f1->start > f2->start;
+}
+
+/* CompareCounts - sort count entries by decreasing count */
+static int CompareCounts(const void *p1, const void *p2)
+{
+    const CountEntry *e1 = (const CountEntry *)p1;
+    const CountEntry *e2 = (const CountEntry *)p2;
+    if (e1->count != e2->count)
+        return e1->count < e2->count ? 1 : -1;
+    return e1->index - e2->index;
+}
+
+/* CompareOffsets - sort code offsets in increasing order */
+static int CompareOffsets(const void *p1, const void *p2)
+{
+    VMUVALUE o1 = *(const VMUVALUE *)p1;
+    VMUVALUE o2 = *(const VMUVALUE *)p2;
+    return o1 < o2 ? -1 : o1 > o2;
+}
+
+/* Percent - compute a percentage of the total instruction count */
+static double Percent(uint64_t count, uint64_t total)
+{
+    return total == 0 ? 0.0 : (count * 100.0) / total;
+}
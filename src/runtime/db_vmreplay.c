@@ -0,0 +1,169 @@
+/* db_vmreplay.c - record and replay of the inputs of a run
+ *
+ * A run that records its inputs writes every character TRAP_GETCHAR reads,
+ * every value of CNT and every value of INA the main code reads to a log.
+ * A later run of the same image that replays the log gets the same values
+ * in the same order without waiting for the console or depending on the
+ * wall clock so it does exactly what the recorded run did.  The cogs the
+ * main code starts run on threads of their own and aren't logged.
+ *
+ * Each event is the difference from the last value of its kind in zigzag
+ * form.  The first byte of an event has a continuation bit, the kind in two
+ * bits and the low five bits of the difference and the bytes after it have a
+ * continuation bit and seven more bits.  Most events take a byte or two.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+
+#define IOLOG_TAG           "XIOL"
+#define IOLOG_VERSION       1
+
+#define IOLOG_KINDS         3
+
+/* log of the inputs of a run */
+struct IOLog {
+    const char *path;           /* log file */
+    FILE *fp;
+    int replay;                 /* the run reads the log instead of writing it */
+    int64_t last[IOLOG_KINDS];  /* last value of each kind */
+};
+
+/* log file header (followed by the events) */
+typedef struct {
+    uint8_t tag[4];             /* should be 'XIOL' */
+    VMUVALUE version;           /* version number */
+    VMUVALUE mainCode;          /* main code of the image */
+    VMUVALUE stackSize;         /* stack size of the image */
+    VMUVALUE sectionCount;      /* sections of the image */
+} IOLogHdr;
+
+static char *kindNames[IOLOG_KINDS] = { "a character", "CNT", "INA" };
+
+/* OpenIOLog - open a log to record the inputs of a run to or replay them from */
+IOLog *OpenIOLog(Interpreter *i, const char *path, int replay)
+{
+    ImageHdr *image = i->image;
+    IOLogHdr hdr, logHdr;
+    IOLog *log;
+
+    if (!(log = (IOLog *)xbGlobalAlloc(i->sys, sizeof(IOLog)))) {
+        xbError(i->sys, "error: insufficient memory\n");
+        return NULL;
+    }
+    memset(log, 0, sizeof(IOLog));
+    log->path = path;
+    log->replay = replay;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.tag, IOLOG_TAG, sizeof(hdr.tag));
+    hdr.version = IOLOG_VERSION;
+    hdr.mainCode = image->mainCode;
+    hdr.stackSize = image->stackSize;
+    hdr.sectionCount = image->sectionCount;
+
+    if (!(log->fp = fopen(path, replay ? "rb" : "wb"))) {
+        xbError(i->sys, "error: can't %s '%s'\n", replay ? "open" : "create", path);
+        return NULL;
+    }
+
+    /* a recorded log starts with the header of a replayed one */
+    if (!replay) {
+        if (fwrite(&hdr, sizeof(hdr), 1, log->fp) != 1) {
+            xbError(i->sys, "error: can't write '%s'\n", path);
+            fclose(log->fp);
+            return NULL;
+        }
+    }
+    else if (fread(&logHdr, sizeof(logHdr), 1, log->fp) != 1
+         ||  memcmp(logHdr.tag, IOLOG_TAG, sizeof(logHdr.tag)) != 0
+         ||  logHdr.version != IOLOG_VERSION) {
+        xbError(i->sys, "error: '%s' isn't an input log\n", path);
+        fclose(log->fp);
+        return NULL;
+    }
+    else if (memcmp(&logHdr, &hdr, sizeof(hdr)) != 0) {
+        xbError(i->sys, "error: input log '%s' isn't of this image\n", path);
+        fclose(log->fp);
+        return NULL;
+    }
+
+    return log;
+}
+
+/* CloseIOLog - finish the log of a run (returns FALSE if a recorded log couldn't be written) */
+int CloseIOLog(Interpreter *i)
+{
+    IOLog *log = i->ioLog;
+    int ok = TRUE;
+
+    if (log->replay) {
+        if (getc(log->fp) != EOF)
+            xbInfo(i->sys, "warning: the run didn't read all of input log '%s'\n", log->path);
+    }
+    else if (ferror(log->fp))
+        ok = FALSE;
+    if (fclose(log->fp) != 0)
+        ok = FALSE;
+    if (!ok)
+        xbError(i->sys, "error: can't write '%s'\n", log->path);
+
+    i->ioLog = NULL;
+    return ok;
+}
+
+/* IsReplaying - check for a log the run is replaying */
+int IsReplaying(IOLog *log)
+{
+    return log->replay;
+}
+
+/* RecordInput - write an input to the log (returns the value) */
+int64_t RecordInput(Interpreter *i, int kind, int64_t value)
+{
+    IOLog *log = i->ioLog;
+    uint64_t diff, zigzag;
+    int byte;
+
+    diff = (uint64_t)value - (uint64_t)log->last[kind];
+    zigzag = (diff << 1) ^ ((diff >> 63) ? ~(uint64_t)0 : 0);
+    log->last[kind] = value;
+
+    byte = (kind << 5) | (int)(zigzag & 0x1f);
+    zigzag >>= 5;
+    while (zigzag) {
+        putc(byte | 0x80, log->fp);
+        byte = (int)(zigzag & 0x7f);
+        zigzag >>= 7;
+    }
+    putc(byte, log->fp);
+
+    return value;
+}
+
+/* ReplayInput - read an input from the log (the run must read the same kind of input the recorded one did) */
+int64_t ReplayInput(Interpreter *i, int kind)
+{
+    IOLog *log = i->ioLog;
+    uint64_t zigzag;
+    int byte, shift;
+
+    if ((byte = getc(log->fp)) == EOF)
+        Abort(i, "input log '%s' ended before the run did", log->path);
+    if (((byte >> 5) & 3) != kind)
+        Abort(i, "the run doesn't match input log '%s' (it read %s where the log has %s)", log->path,
+              kindNames[kind], ((byte >> 5) & 3) < IOLOG_KINDS ? kindNames[(byte >> 5) & 3] : "garbage");
+
+    zigzag = byte & 0x1f;
+    for (shift = 5; byte & 0x80; shift += 7) {
+        if ((byte = getc(log->fp)) == EOF || shift > 63)
+            Abort(i, "input log '%s' is truncated", log->path);
+        zigzag |= (uint64_t)(byte & 0x7f) << shift;
+    }
+
+    log->last[kind] = (int64_t)((uint64_t)log->last[kind] + ((zigzag >> 1) ^ ((zigzag & 1) ? ~(uint64_t)0 : 0)));
+    return log->last[kind];
+}
@@ -0,0 +1,242 @@
+/* db_vmsnap.c - execution snapshots
+ *
+ * A snapshot holds the state of the main code taken partway through a run
+ * so later runs of the same image can start from it instead of repeating
+ * the work before it.  It has the registers of the interpreter, the live
+ * part of the stack, the cycle count CNT is based on and the contents of
+ * every section since the VM can write to any of them.  Snapshots are in
+ * the byte order of the host and are only good for the image they were
+ * taken from.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+
+#define SNAPSHOT_TAG        "XSNP"
+#define SNAPSHOT_VERSION    1
+
+/* snapshot to take */
+struct Snapshot {
+    const char *path;       /* file to write */
+    uint8_t *target;        /* take it when the pc gets here or NULL */
+    uint64_t count;         /* or when this many instructions have executed */
+    uint64_t executed;      /* instructions executed so far */
+};
+
+/* snapshot file header (followed by the stack and the section contents) */
+typedef struct {
+    uint8_t tag[4];         /* should be 'XSNP' */
+    VMUVALUE version;       /* version number */
+    VMUVALUE mainCode;      /* main code of the image */
+    VMUVALUE stackSize;     /* stack size of the image */
+    VMUVALUE sectionCount;  /* sections of the image */
+    VMUVALUE pc;            /* address of the next instruction */
+    VMUVALUE sp;            /* stack pointer as an index into the stack */
+    VMUVALUE fp;            /* frame pointer as an index into the stack */
+    VMVALUE tos;            /* top of stack */
+    VMVALUE linePos;        /* console output column */
+    uint64_t cycles;        /* cycles CNT counts from */
+    uint64_t executed;      /* instructions executed before the snapshot */
+} SnapshotHdr;
+
+/* snapshot section header (followed by the section contents) */
+typedef struct {
+    VMUVALUE base;
+    VMUVALUE size;
+} SnapshotSection;
+
+static int WriteSnapshot(Interpreter *i, const char *path);
+static int UnmapPC(Interpreter *i, VMUVALUE *pAddr);
+
+/* InitSnapshot - setup a snapshot at an address, a function name or an instruction count */
+Snapshot *InitSnapshot(Interpreter *i, const char *at, const char *path)
+{
+    ImageHdr *image = i->image;
+    ImageSection *section;
+    VMUVALUE addr;
+    Snapshot *s;
+    char *end;
+    int j;
+
+    if (!(s = (Snapshot *)xbGlobalAlloc(i->sys, sizeof(Snapshot))))
+        return NULL;
+    memset(s, 0, sizeof(Snapshot));
+    s->path = path;
+
+    /* a decimal number is an instruction count */
+    if (at[0] >= '1' && at[0] <= '9') {
+        s->count = strtoull(at, &end, 10);
+        if (*end)
+            return NULL;
+        return s;
+    }
+
+    /* a hex number is an address and anything else is the name of a function */
+    if (at[0] == '0' && (at[1] == 'x' || at[1] == 'X')) {
+        addr = (VMUVALUE)strtoul(at, &end, 16);
+        if (*end)
+            return NULL;
+    }
+    else {
+        for (j = 0; j < image->symbolCount; ++j)
+            if (strcmp(image->symbols[j].name, at) == 0)
+                break;
+        if (j >= image->symbolCount)
+            return NULL;
+        addr = image->symbols[j].value;
+    }
+
+    /* the address must be in a section */
+    if (!(section = i->sectionMap[ADDR_REGION(addr)]) || ADDR_OFFSET(addr) >= section->fileSection->size)
+        return NULL;
+    s->target = section->data + ADDR_OFFSET(addr);
+
+    return s;
+}
+
+/* CheckSnapshot - take the snapshot if this is the place for it (returns TRUE to stop the run)
+   (the snapshot is cleared once it is written) */
+int CheckSnapshot(Interpreter *i)
+{
+    Snapshot *s = i->snapshot;
+
+    if (s->target ? i->pc != s->target : s->executed != s->count) {
+        ++s->executed;
+        return FALSE;
+    }
+
+    /* the other cogs and tasks and the cog registers aren't part of a snapshot */
+    if (i->cogs || i->tasks || i->registers)
+        Abort(i, "can't take a snapshot after starting cogs or tasks or using the cog registers");
+
+    FlushOutput(i);
+    if (!WriteSnapshot(i, s->path))
+        Abort(i, "can't write snapshot '%s'", s->path);
+    i->snapshot = NULL;
+    return TRUE;
+}
+
+/* WriteSnapshot - write the state of the main code to a snapshot file */
+static int WriteSnapshot(Interpreter *i, const char *path)
+{
+    ImageHdr *image = i->image;
+    SnapshotSection sectionHdr;
+    SnapshotHdr hdr;
+    FILE *fp;
+    int ok, j;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.tag, SNAPSHOT_TAG, sizeof(hdr.tag));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.mainCode = image->mainCode;
+    hdr.stackSize = image->stackSize;
+    hdr.sectionCount = image->sectionCount;
+    if (!UnmapPC(i, &hdr.pc))
+        return FALSE;
+    hdr.sp = (VMUVALUE)(i->sp - i->stack);
+    hdr.fp = (VMUVALUE)(i->fp - i->stack);
+    hdr.tos = i->tos;
+    hdr.linePos = i->linePos;
+    hdr.cycles = ClockCycles(i);
+    hdr.executed = i->snapshot->executed;
+
+    if (!(fp = fopen(path, "wb")))
+        return FALSE;
+
+    /* only the live part of the stack is written */
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+      && fwrite(i->sp, sizeof(VMVALUE), i->stackTop - i->sp, fp) == (size_t)(i->stackTop - i->sp);
+
+    for (j = 0; ok && j < image->sectionCount; ++j) {
+        ImageSection *section = &image->sections[j];
+        sectionHdr.base = section->fileSection->base;
+        sectionHdr.size = section->fileSection->size;
+        ok = fwrite(&sectionHdr, sizeof(sectionHdr), 1, fp) == 1
+          && fwrite(section->data, 1, sectionHdr.size, fp) == sectionHdr.size;
+    }
+
+    if (fclose(fp) != 0)
+        ok = FALSE;
+    return ok;
+}
+
+/* RestoreSnapshot - restore the state of the main code from a snapshot file */
+int RestoreSnapshot(Interpreter *i, const char *path)
+{
+    ImageHdr *image = i->image;
+    SnapshotSection sectionHdr;
+    ImageSection *section;
+    SnapshotHdr hdr;
+    FILE *fp;
+    int ok, j;
+
+    if (!(fp = fopen(path, "rb"))) {
+        xbError(i->sys, "error: can't open '%s'\n", path);
+        return FALSE;
+    }
+
+    /* the snapshot must be of this image */
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+    ||  memcmp(hdr.tag, SNAPSHOT_TAG, sizeof(hdr.tag)) != 0
+    ||  hdr.version != SNAPSHOT_VERSION) {
+        xbError(i->sys, "error: '%s' isn't a snapshot\n", path);
+        fclose(fp);
+        return FALSE;
+    }
+    if (hdr.mainCode != image->mainCode
+    ||  hdr.stackSize != image->stackSize
+    ||  hdr.sectionCount != image->sectionCount
+    ||  hdr.fp > hdr.stackSize / sizeof(VMVALUE)
+    ||  hdr.sp > hdr.fp
+    ||  !(section = i->sectionMap[ADDR_REGION(hdr.pc)])
+    ||  ADDR_OFFSET(hdr.pc) >= section->fileSection->size) {
+        xbError(i->sys, "error: snapshot '%s' isn't of this image\n", path);
+        fclose(fp);
+        return FALSE;
+    }
+
+    i->pc = section->data + ADDR_OFFSET(hdr.pc);
+    i->codeBase = i->sectionMap[ADDR_REGION(image->mainCode)]->data;
+    i->sp = i->stack + hdr.sp;
+    i->fp = i->stack + hdr.fp;
+    i->tos = hdr.tos;
+    i->linePos = hdr.linePos;
+    i->outputCount = 0;
+    i->startTime = xbGetMicroseconds();
+    i->cancelled = FALSE;
+    i->finished = FALSE;
+    SetClockCycles(i, hdr.cycles);
+
+    ok = fread(i->sp, sizeof(VMVALUE), i->stackTop - i->sp, fp) == (size_t)(i->stackTop - i->sp);
+
+    for (j = 0; ok && j < image->sectionCount; ++j) {
+        section = &image->sections[j];
+        ok = fread(&sectionHdr, sizeof(sectionHdr), 1, fp) == 1
+          && sectionHdr.base == section->fileSection->base
+          && sectionHdr.size == section->fileSection->size
+          && fread(section->data, 1, sectionHdr.size, fp) == sectionHdr.size;
+    }
+
+    if (!ok)
+        xbError(i->sys, "error: snapshot '%s' is truncated or isn't of this image\n", path);
+    fclose(fp);
+    return ok;
+}
+
+/* UnmapPC - get the VM address of the pc */
+static int UnmapPC(Interpreter *i, VMUVALUE *pAddr)
+{
+    ImageHdr *image = i->image;
+    int j;
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageSection *section = &image->sections[j];
+        if (i->pc >= section->data && i->pc < section->data + section->fileSection->size) {
+            *pAddr = section->fileSection->base + (VMUVALUE)(i->pc - section->data);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
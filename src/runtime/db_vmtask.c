@@ -0,0 +1,156 @@
+/* db_vmtask.c - cooperative tasks for the interpreter
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * A task started by TASK shares the interpreter with the code that started it
+ * and only runs when the task before it yields so switching tasks is just a
+ * matter of saving the interpreter state of one and loading that of the next.
+ * Each task runs on a slice of its TASK stack array.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "db_vm.h"
+
+/* number of tasks including the code that started the first one */
+#define MAX_TASKS   8
+
+/* saved state of a task */
+typedef struct {
+    int active;                 /* the task hasn't exited */
+    uint8_t *pc;
+    VMVALUE *stack;
+    VMVALUE *stackTop;
+    VMVALUE *fp;
+    VMVALUE *sp;
+    VMVALUE tos;
+    unsigned long timerStart;   /* time WAITFOR started the timer in microseconds */
+    VMVALUE timeout;            /* WAITFOR timeout in milliseconds or negative to wait forever */
+} Task;
+
+/* tasks of one interpreter */
+struct TaskTable {
+    int current;                /* task that is running (its entry is only up to date when it isn't) */
+    Task task[MAX_TASKS];
+};
+
+static TaskTable *GetTaskTable(Interpreter *i);
+static VMVALUE StartTask(Interpreter *i, VMUVALUE code, VMUVALUE exit, VMUVALUE stack, VMVALUE first);
+static void SwitchTask(Interpreter *i);
+
+/* DoTaskTrap - execute one of the task traps */
+void DoTaskTrap(Interpreter *i, int op)
+{
+    TaskTable *table = GetTaskTable(i);
+    Task *task = &table->task[table->current];
+    VMUVALUE code, exit, stack;
+    VMVALUE first;
+
+    switch (op) {
+    case TRAP_TASKSTART:
+        first = i->tos;
+        stack = (VMUVALUE)Pop(i);
+        exit = (VMUVALUE)Pop(i);
+        code = (VMUVALUE)Pop(i);
+        i->tos = StartTask(i, code, exit, stack, first);
+        break;
+    case TRAP_TASKEXIT:
+        /* the last task falls into the HALT that follows the trap */
+        task->active = FALSE;
+        SwitchTask(i);
+        break;
+    case TRAP_YIELD:
+        SwitchTask(i);
+        break;
+    case TRAP_TASKTIMER:
+        task->timerStart = xbGetMicroseconds();
+        task->timeout = i->tos;
+        i->tos = Pop(i);
+        break;
+    case TRAP_TASKWAIT:
+        Push(i, i->tos);
+        if (task->timeout >= 0 && (xbGetMicroseconds() - task->timerStart) / 1000 >= (unsigned long)task->timeout)
+            i->tos = TRUE;
+        else {
+            i->tos = FALSE;
+            SwitchTask(i);
+        }
+        break;
+    }
+}
+
+/* GetTaskTable - get the task table (the first task trap creates it with the running code as task 0) */
+static TaskTable *GetTaskTable(Interpreter *i)
+{
+    if (!i->tasks) {
+        if (!(i->tasks = (TaskTable *)malloc(sizeof(TaskTable))))
+            Abort(i, "insufficient memory");
+        memset(i->tasks, 0, sizeof(TaskTable));
+        i->tasks->task[0].active = TRUE;
+        i->tasks->task[0].timeout = -1;
+    }
+    return i->tasks;
+}
+
+/* StartTask - add a task calling the function at code with its arguments at the end of the stack array
+   (returns the task id or -1 if the table is full) */
+static VMVALUE StartTask(Interpreter *i, VMUVALUE code, VMUVALUE exit, VMUVALUE stack, VMVALUE first)
+{
+    TaskTable *table = i->tasks;
+    VMVALUE *base;
+    Task *task;
+    int j;
+
+    /* find a free entry */
+    if (first <= 0)
+        return -1;
+    for (j = 0; j < MAX_TASKS && table->task[j].active; ++j)
+        ;
+    if (j >= MAX_TASKS)
+        return -1;
+
+    /* setup the task as though the exit function had just called the function */
+    base = (VMVALUE *)MapBytes(i, stack, first * sizeof(VMVALUE));
+    task = &table->task[j];
+    task->pc = MapBytes(i, code, 1);
+    task->tos = (VMVALUE)(MapBytes(i, exit, 1) - i->codeBase);
+    task->stack = base;
+    task->stackTop = base + first;
+    task->sp = task->fp = task->stackTop;
+    task->timeout = -1;
+    task->active = TRUE;
+    return j;
+}
+
+/* SwitchTask - save the state of the running task and load the next active one */
+static void SwitchTask(Interpreter *i)
+{
+    TaskTable *table = i->tasks;
+    Task *task;
+    int j;
+
+    /* find the next active task round-robin (the running task keeps running if it's the only one) */
+    for (j = (table->current + 1) % MAX_TASKS; j != table->current; j = (j + 1) % MAX_TASKS)
+        if (table->task[j].active)
+            break;
+    if (j == table->current)
+        return;
+
+    task = &table->task[table->current];
+    task->pc = i->pc;
+    task->stack = i->stack;
+    task->stackTop = i->stackTop;
+    task->fp = i->fp;
+    task->sp = i->sp;
+    task->tos = i->tos;
+
+    task = &table->task[j];
+    i->pc = task->pc;
+    i->stack = task->stack;
+    i->stackTop = task->stackTop;
+    i->fp = task->fp;
+    i->sp = task->sp;
+    i->tos = task->tos;
+    table->current = j;
+}
@@ -0,0 +1,759 @@
+/* db_vmverify.c - bytecode verifier
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include "db_vmimage.h"
+#include "db_vmdebug.h"
+
+/* size of a switch table entry (an OP_BR instruction) */
+#define SWITCH_ENTRY_SIZE   (1 + sizeof(VMUVALUE))
+
+/* function found in the code */
+typedef struct {
+    VMUVALUE entry;         /* offset of the first instruction */
+    int pops;               /* arguments removed by its returns (-1 if it never returns) */
+    int frameSize;          /* words reserved by its FRAME (0 if none) */
+    int frameDepth;         /* words its FRAME checks for past the frame */
+    int callDepth;          /* largest argument offset every call leaves room for (INT_MAX if none) */
+    int maxArgument;        /* largest argument offset it uses (-1 if none) */
+} VerifyFunction;
+
+/* verifier state */
+typedef struct {
+    System *sys;
+    ImageHdr *image;
+    uint8_t *code;          /* data of all of the sections one after another (code can be in any of them) */
+    VMUVALUE *sectionStarts; /* offset of each section in the code */
+    VMUVALUE size;          /* size of all of the sections */
+    int *owners;            /* index plus one of the function containing each byte (0 if none) */
+    int *entries;           /* index plus one of the function starting at each offset (0 if none) */
+    int *depths;            /* stack depth on entry to each instruction (-1 if not reached yet) */
+    uint8_t *starts;        /* nonzero where an instruction starts */
+    VMUVALUE *work;         /* instructions that still need to be checked */
+    int count;              /* number of instructions on the work list */
+    VerifyFunction *functions;
+    int functionCount;
+} Verifier;
+
+/* prototypes for local functions */
+static int ScanFunction(Verifier *v, int index);
+static int CheckFunction(Verifier *v, int index);
+static int CheckOperands(Verifier *v, VerifyFunction *f, int op, VMUVALUE offset, int *pPops, int *pPushes);
+static int CheckAddress(Verifier *v, VMUVALUE offset, VMUVALUE addr, int store);
+static int CheckLocal(Verifier *v, VerifyFunction *f, VMUVALUE offset, int local);
+static int AddFunction(Verifier *v, VMUVALUE offset, VMUVALUE target, int *pIndex);
+static int SetPops(Verifier *v, int index, VMUVALUE offset, int pops);
+static int Claim(Verifier *v, int index, VMUVALUE from, VMUVALUE offset);
+static int SetDepth(Verifier *v, VMUVALUE from, VMUVALUE offset, int depth);
+static VMUVALUE BranchTarget(Verifier *v, VMUVALUE offset);
+static VMVALUE GetWord(Verifier *v, VMUVALUE offset);
+static VMUVALUE CodeOffset(Verifier *v, VMUVALUE addr);
+static VMUVALUE CodeAddress(Verifier *v, VMUVALUE offset);
+static VMUVALUE SectionEnd(Verifier *v, VMUVALUE offset);
+static int VerifyError(Verifier *v, VMUVALUE offset, const char *fmt, ...);
+
+/* VerifyImage - check that the code reachable from the main code is safe to run without address checks
+   (the work space comes from the local heap and is left for the caller to free) */
+int VerifyImage(System *sys, ImageHdr *image)
+{
+    ImageSection *section = NULL;
+    Verifier v;
+    VMUVALUE j;
+    int index;
+
+    /* every section must start a memory region (this is what the interpreter maps) */
+    v.size = 0;
+    for (index = 0; index < image->sectionCount; ++index) {
+        ImageFileSection *fileSection = image->sections[index].fileSection;
+        if (ADDR_OFFSET(fileSection->base) != 0) {
+            xbError(sys, "verify: %08x: section isn't at the start of a region\n", fileSection->base);
+            return FALSE;
+        }
+        if (!section && image->mainCode >= fileSection->base && image->mainCode < fileSection->base + fileSection->size)
+            section = &image->sections[index];
+        v.size += fileSection->size;
+    }
+
+    /* find the code */
+    if (!section) {
+        xbError(sys, "verify: %08x: main code isn't in a section\n", image->mainCode);
+        return FALSE;
+    }
+    v.sys = sys;
+    v.image = image;
+    
+    /* functions can be placed in any section so the code is checked as if the sections were one */
+    v.code = (uint8_t *)xbLocalAlloc(sys, v.size);
+    v.sectionStarts = (VMUVALUE *)xbLocalAlloc(sys, image->sectionCount * sizeof(VMUVALUE));
+    if (!v.code || !v.sectionStarts) {
+        xbError(sys, "verify: insufficient memory\n");
+        return FALSE;
+    }
+    for (j = index = 0; index < image->sectionCount; ++index) {
+        VMUVALUE size = image->sections[index].fileSection->size;
+        memcpy(v.code + j, image->sections[index].data, size);
+        v.sectionStarts[index] = j;
+        j += size;
+    }
+
+    /* allocate the work space */
+    v.owners = (int *)xbLocalAlloc(sys, v.size * sizeof(int));
+    v.entries = (int *)xbLocalAlloc(sys, v.size * sizeof(int));
+    v.depths = (int *)xbLocalAlloc(sys, v.size * sizeof(int));
+    v.starts = (uint8_t *)xbLocalAlloc(sys, v.size);
+    v.work = (VMUVALUE *)xbLocalAlloc(sys, v.size * sizeof(VMUVALUE));
+    v.functions = (VerifyFunction *)xbLocalAlloc(sys, v.size * sizeof(VerifyFunction));
+    if (!v.owners || !v.entries || !v.depths || !v.starts || !v.work || !v.functions) {
+        xbError(sys, "verify: insufficient memory\n");
+        return FALSE;
+    }
+    memset(v.owners, 0, v.size * sizeof(int));
+    memset(v.entries, 0, v.size * sizeof(int));
+    memset(v.starts, 0, v.size);
+    for (j = 0; j < v.size; ++j)
+        v.depths[j] = -1;
+    v.count = 0;
+    v.functionCount = 0;
+
+    /* find the instructions of the main code and every function it calls
+       (this also finds how many arguments each function removes when it returns) */
+    if (!AddFunction(&v, CodeOffset(&v, image->mainCode), CodeOffset(&v, image->mainCode), &index))
+        return FALSE;
+    for (index = 0; index < v.functionCount; ++index)
+        if (!ScanFunction(&v, index))
+            return FALSE;
+
+    /* check the stack usage of each one */
+    for (index = 0; index < v.functionCount; ++index)
+        if (!CheckFunction(&v, index))
+            return FALSE;
+
+    /* a function can only use the arguments that every call leaves on the stack */
+    for (index = 1; index < v.functionCount; ++index) {
+        VerifyFunction *f = &v.functions[index];
+        if (f->maxArgument > f->callDepth)
+            return VerifyError(&v, f->entry, "argument %d is outside of the stack", f->maxArgument);
+    }
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* ScanFunction - find the instructions of a function and the functions it calls */
+static int ScanFunction(Verifier *v, int index)
+{
+    VerifyFunction *f = &v->functions[index];
+    VMUVALUE offset, next;
+    int op, fmt, n;
+
+    /* functions must start by building their stack frame */
+    if (!Claim(v, index, f->entry, f->entry))
+        return FALSE;
+    if (v->code[f->entry] == OP_FRAME) {
+        f->frameSize = v->code[f->entry + 1];
+        f->frameDepth = v->code[f->entry + 2];
+    }
+    else if (index > 0)
+        return VerifyError(v, f->entry, "function doesn't start with FRAME");
+
+    /* follow every path through the function */
+    while (v->count > 0) {
+        offset = v->work[--v->count];
+        op = v->code[offset];
+        fmt = InstructionFormat(op);
+        next = offset + InstructionLength(fmt);
+
+        switch (op) {
+
+        /* instructions that end a path */
+        case OP_HALT:
+            break;
+        case OP_RETURN:
+        case OP_RETURNZ:
+            if (!SetPops(v, index, offset, 0))
+                return FALSE;
+            break;
+        case OP_RET:
+            if (!SetPops(v, index, offset, v->code[offset + 1]))
+                return FALSE;
+            break;
+
+        /* the stack frame is only built on entry to a function */
+        case OP_FRAME:
+            if (offset != f->entry)
+                return VerifyError(v, offset, "FRAME isn't at the start of a function");
+            if (!Claim(v, index, offset, next))
+                return FALSE;
+            break;
+
+        /* branches */
+        case OP_BR:
+        case OP_BR8:
+        case OP_BR16:
+            if (!Claim(v, index, offset, BranchTarget(v, offset)))
+                return FALSE;
+            break;
+        case OP_BRT:
+        case OP_BRTSC:
+        case OP_BRF:
+        case OP_BRFSC:
+        case OP_BRLT:
+        case OP_BRLE:
+        case OP_BREQ:
+        case OP_BRNE:
+        case OP_BRGE:
+        case OP_BRGT:
+        case OP_BRLTZ:
+        case OP_BRLEZ:
+        case OP_BRGEZ:
+        case OP_BRGTZ:
+        case OP_FORLOOP:
+        case OP_FORLOOPA:
+            if (!Claim(v, index, offset, BranchTarget(v, offset)) || !Claim(v, index, offset, next))
+                return FALSE;
+            break;
+
+        /* the switch table entries must all be branches */
+        case OP_SWITCH:
+            for (n = 0; n <= v->code[offset + 1]; ++n) {
+                VMUVALUE entry = next + n * SWITCH_ENTRY_SIZE;
+                if (!Claim(v, index, offset, entry))
+                    return FALSE;
+                if (v->code[entry] != OP_BR)
+                    return VerifyError(v, entry, "switch table entry isn't a branch");
+            }
+            break;
+
+        /* direct calls add the called function */
+        case OP_CALL:
+            if (!AddFunction(v, offset, CodeOffset(v, GetWord(v, offset + 1)), &n) || !Claim(v, index, offset, next))
+                return FALSE;
+            break;
+
+        /* jumps through a computed address can't be followed */
+        case OP_PUSHJ:
+        case OP_POPJ:
+            return VerifyError(v, offset, "computed jumps can't be verified");
+
+        /* everything else falls through to the next instruction */
+        default:
+            if (!Claim(v, index, offset, next))
+                return FALSE;
+            break;
+        }
+    }
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* CheckFunction - check the stack depth at each instruction of a function */
+static int CheckFunction(Verifier *v, int index)
+{
+    VerifyFunction *f = &v->functions[index];
+    int maxDepth = 0, limit;
+
+    /* follow every path through the function from its entry */
+    SetDepth(v, f->entry, f->entry, 0);
+    while (v->count > 0) {
+        VMUVALUE offset = v->work[--v->count];
+        int depth = v->depths[offset];
+        int op = v->code[offset];
+        VMUVALUE next = offset + InstructionLength(InstructionFormat(op));
+        int pops, pushes, n;
+        VerifyFunction *callee;
+
+        switch (op) {
+
+        /* the return address is on top of the stack frame when a function returns */
+        case OP_HALT:
+            break;
+        case OP_RETURN:
+        case OP_RET:
+            if (depth != f->frameSize + 1)
+                return VerifyError(v, offset, "stack depth %d doesn't match the frame on return", depth);
+            break;
+        case OP_RETURNZ:
+            if (depth != f->frameSize)
+                return VerifyError(v, offset, "stack depth %d doesn't match the frame on return", depth);
+            if (depth + 1 > maxDepth)
+                maxDepth = depth + 1;
+            break;
+
+        /* branches */
+        case OP_BR:
+        case OP_BR8:
+        case OP_BR16:
+            if (!SetDepth(v, offset, BranchTarget(v, offset), depth))
+                return FALSE;
+            break;
+        case OP_FORLOOP:
+            if (!CheckLocal(v, f, offset, (int8_t)v->code[offset + 1]))
+                return FALSE;
+            // fall through
+        case OP_BRT:
+        case OP_BRF:
+        case OP_BRLTZ:
+        case OP_BRLEZ:
+        case OP_BRGEZ:
+        case OP_BRGTZ:
+            if (depth < 1)
+                return VerifyError(v, offset, "stack underflow");
+            if (!SetDepth(v, offset, BranchTarget(v, offset), depth - 1) || !SetDepth(v, offset, next, depth - 1))
+                return FALSE;
+            break;
+        case OP_BRLT:
+        case OP_BRLE:
+        case OP_BREQ:
+        case OP_BRNE:
+        case OP_BRGE:
+        case OP_BRGT:
+            if (depth < 2)
+                return VerifyError(v, offset, "stack underflow");
+            if (!SetDepth(v, offset, BranchTarget(v, offset), depth - 2) || !SetDepth(v, offset, next, depth - 2))
+                return FALSE;
+            break;
+        case OP_FORLOOPA:
+            if (depth < 1)
+                return VerifyError(v, offset, "stack underflow");
+            if (!CheckAddress(v, offset, (VMUVALUE)GetWord(v, offset + 1), TRUE)
+            ||  !SetDepth(v, offset, BranchTarget(v, offset), depth - 1)
+            ||  !SetDepth(v, offset, next, depth - 1))
+                return FALSE;
+            break;
+        case OP_BRTSC:
+        case OP_BRFSC:
+            if (depth < 1)
+                return VerifyError(v, offset, "stack underflow");
+            if (!SetDepth(v, offset, BranchTarget(v, offset), depth) || !SetDepth(v, offset, next, depth - 1))
+                return FALSE;
+            break;
+        case OP_SWITCH:
+            if (depth < 1)
+                return VerifyError(v, offset, "stack underflow");
+            for (n = 0; n <= v->code[offset + 1]; ++n)
+                if (!SetDepth(v, offset, next + n * SWITCH_ENTRY_SIZE, depth - 1))
+                    return FALSE;
+            break;
+
+        /* a call pushes the return address and the called function may remove its arguments
+           (the words it can use as arguments are the ones pushed after this function's return address) */
+        case OP_CALL:
+            callee = &v->functions[v->entries[CodeOffset(v, GetWord(v, offset + 1))] - 1];
+            n = (index == 0 ? depth : depth - f->frameSize - 1);
+            if (n < callee->callDepth)
+                callee->callDepth = n;
+            if (depth + 1 > maxDepth)
+                maxDepth = depth + 1;
+            if (callee->pops < 0)
+                break;
+            if (n + 1 < callee->pops)
+                return VerifyError(v, offset, "stack underflow");
+            if (!SetDepth(v, offset, next, depth - callee->pops + 1))
+                return FALSE;
+            break;
+
+        /* everything else just pops and pushes */
+        default:
+            if (!CheckOperands(v, f, op, offset, &pops, &pushes))
+                return FALSE;
+            if ((depth -= pops) < 0)
+                return VerifyError(v, offset, "stack underflow");
+            depth += pushes;
+            if (depth > maxDepth)
+                maxDepth = depth;
+            if (!SetDepth(v, offset, next, depth))
+                return FALSE;
+            break;
+        }
+    }
+
+    /* functions check for their stack in their frames but the main code must fit in the stack */
+    if (index == 0) {
+        if (maxDepth > (limit = v->image->stackSize / sizeof(VMVALUE)))
+            return VerifyError(v, f->entry, "main code needs %d stack words but the stack has %d", maxDepth, limit);
+    }
+    else if (maxDepth > (limit = f->frameSize + f->frameDepth))
+        return VerifyError(v, f->entry, "function needs %d stack words but its frame checks for %d", maxDepth, limit);
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* CheckOperands - check the operands of an instruction that falls through and get its stack effect */
+static int CheckOperands(Verifier *v, VerifyFunction *f, int op, VMUVALUE offset, int *pPops, int *pPushes)
+{
+    *pPops = 0;
+    *pPushes = 0;
+    switch (op) {
+    case OP_LIT:
+    case OP_SLIT:
+    case OP_LIT16:
+    case OP_DUP:
+        *pPushes = 1;
+        break;
+    case OP_LREF:
+        if (!CheckLocal(v, f, offset, (int8_t)v->code[offset + 1]))
+            return FALSE;
+        *pPushes = 1;
+        break;
+    case OP_LOADA:
+        if (!CheckAddress(v, offset, (VMUVALUE)GetWord(v, offset + 1), FALSE))
+            return FALSE;
+        *pPushes = 1;
+        break;
+    case OP_GREF:
+        if (!CheckAddress(v, offset, (VMUVALUE)v->code[offset + 1] * sizeof(VMVALUE), FALSE))
+            return FALSE;
+        *pPushes = 1;
+        break;
+    case OP_GREF16:
+        if (!CheckAddress(v, offset, (VMUVALUE)(uint16_t)((v->code[offset + 1] << 8) | v->code[offset + 2]) * sizeof(VMVALUE), FALSE))
+            return FALSE;
+        *pPushes = 1;
+        break;
+    case OP_NOT:
+    case OP_NEG:
+    case OP_BNOT:
+    case OP_LOAD:
+    case OP_LOADB:
+    case OP_LOADW:
+    case OP_NATIVE:
+    case OP_CHECK:
+        break;
+    case OP_LINC:
+        if (!CheckLocal(v, f, offset, (int8_t)v->code[offset + 1]))
+            return FALSE;
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GE:
+    case OP_GT:
+    case OP_INDEX:
+    case OP_LOADX:
+    case OP_VREF:
+    case OP_DROP:
+        *pPops = 1;
+        break;
+    case OP_LSET:
+        if (!CheckLocal(v, f, offset, (int8_t)v->code[offset + 1]))
+            return FALSE;
+        *pPops = 1;
+        break;
+    case OP_STOREA:
+        if (!CheckAddress(v, offset, (VMUVALUE)GetWord(v, offset + 1), TRUE))
+            return FALSE;
+        *pPops = 1;
+        break;
+    case OP_GSET:
+        if (!CheckAddress(v, offset, (VMUVALUE)v->code[offset + 1] * sizeof(VMVALUE), TRUE))
+            return FALSE;
+        *pPops = 1;
+        break;
+    case OP_GSET16:
+        if (!CheckAddress(v, offset, (VMUVALUE)(uint16_t)((v->code[offset + 1] << 8) | v->code[offset + 2]) * sizeof(VMVALUE), TRUE))
+            return FALSE;
+        *pPops = 1;
+        break;
+    case OP_STORE:
+    case OP_STOREB:
+    case OP_STOREW:
+        *pPops = 2;
+        break;
+    case OP_STOREX:
+    case OP_VSET:
+        *pPops = 3;
+        break;
+    case OP_FRAME:
+        *pPushes = v->code[offset + 1];
+        break;
+    case OP_CLEAN:
+        *pPops = v->code[offset + 1];
+        break;
+    case OP_TRAP:
+        switch (v->code[offset + 1]) {
+        case TRAP_GETCHAR:
+        case TRAP_LOCKNEW:
+        case TRAP_TASKWAIT:
+            *pPushes = 1;
+            break;
+        case TRAP_PUTCHAR:
+        case TRAP_LOCKRET:
+        case TRAP_TASKTIMER:
+            *pPops = 1;
+            break;
+        case TRAP_PUTSTR:
+        case TRAP_STRCPY:
+            *pPops = 2;
+            break;
+        case TRAP_STRLEN:
+        case TRAP_LOCKSET:
+        case TRAP_LOCKCLR:
+        case TRAP_TASKEXIT:
+        case TRAP_YIELD:
+            break;
+        case TRAP_STRCMP:
+            *pPops = 1;
+            break;
+        case TRAP_MEMCPY:
+        case TRAP_MEMSET:
+        case TRAP_ARRDOT:
+        case TRAP_COGSTART:
+        case TRAP_TASKSTART:
+        case TRAP_PUTNUM:
+        case TRAP_FMTNUM:
+        case TRAP_PARSENUM:
+            *pPops = 3;
+            break;
+        case TRAP_ARRSUM:
+        case TRAP_ARRMIN:
+        case TRAP_ARRMAX:
+            *pPops = 2;
+            break;
+        case TRAP_FIXMUL:
+        case TRAP_FIXDIV:
+        case TRAP_FADD:
+        case TRAP_FSUB:
+        case TRAP_FMUL:
+        case TRAP_FDIV:
+        case TRAP_FCMP:
+            *pPops = 1;
+            break;
+        case TRAP_ITOF:
+        case TRAP_FTOI:
+            break;
+        case TRAP_ARRFILL:
+        case TRAP_ARRCOPY:
+        case TRAP_ARRADD:
+            *pPops = 4;
+            break;
+        case TRAP_ARRMAC:
+        case TRAP_ARRSCALE:
+            *pPops = 5;
+            break;
+        case TRAP_BUTTERFLY:
+            *pPops = 6;
+            break;
+        default:
+            return VerifyError(v, offset, "undefined trap 0x%02x", v->code[offset + 1]);
+        }
+        break;
+    default:
+        return VerifyError(v, offset, "undefined opcode 0x%02x", op);
+    }
+    return TRUE;
+}
+
+/* CheckAddress - check that a constant address refers to a long inside of a section
+   (stores can't change the code that has been verified) */
+static int CheckAddress(Verifier *v, VMUVALUE offset, VMUVALUE addr, int store)
+{
+    VMUVALUE code;
+    int j, k;
+
+    /* the interpreter maps each region to the first section in it */
+    for (j = 0; j < v->image->sectionCount; ++j) {
+        ImageFileSection *section = v->image->sections[j].fileSection;
+        if (ADDR_REGION(section->base) == ADDR_REGION(addr)) {
+            if (ADDR_OFFSET(addr) > section->size || section->size - ADDR_OFFSET(addr) < sizeof(VMVALUE))
+                break;
+            if (store && (code = CodeOffset(v, addr)) < v->size)
+                for (k = 0; k < sizeof(VMVALUE); ++k)
+                    if (v->owners[code + k])
+                        return VerifyError(v, offset, "store into the code at %08x", addr);
+            return TRUE;
+        }
+    }
+
+    /* address isn't in a section */
+    return VerifyError(v, offset, "address %08x is outside of its section", addr);
+}
+
+/* CheckLocal - check that a local variable offset is inside of the stack frame
+   (positive offsets are the arguments which only functions have and are checked against its calls) */
+static int CheckLocal(Verifier *v, VerifyFunction *f, VMUVALUE offset, int local)
+{
+    if (local < 0 ? (local == F_FP || -local > f->frameSize) : f == v->functions)
+        return VerifyError(v, offset, "local variable %d is outside of the stack frame", local);
+    if (local > f->maxArgument)
+        f->maxArgument = local;
+    return TRUE;
+}
+
+/* AddFunction - add a function called at an offset unless it's already known */
+static int AddFunction(Verifier *v, VMUVALUE offset, VMUVALUE target, int *pIndex)
+{
+    VerifyFunction *f;
+
+    /* check for a function that is already known */
+    if (target >= v->size)
+        return VerifyError(v, offset, "call outside of the code section");
+    if (v->entries[target]) {
+        *pIndex = v->entries[target] - 1;
+        return TRUE;
+    }
+    if (v->owners[target])
+        return VerifyError(v, offset, "call into the middle of a function");
+
+    /* add a new function */
+    *pIndex = v->functionCount;
+    f = &v->functions[v->functionCount++];
+    f->entry = target;
+    f->pops = -1;
+    f->frameSize = 0;
+    f->frameDepth = 0;
+    f->callDepth = INT_MAX;
+    f->maxArgument = -1;
+    v->entries[target] = v->functionCount;
+
+    /* return successfully */
+    return TRUE;
+}
+
+/* SetPops - set the number of arguments a function removes when it returns
+   (returns FALSE if its returns don't agree or it's the main code) */
+static int SetPops(Verifier *v, int index, VMUVALUE offset, int pops)
+{
+    VerifyFunction *f = &v->functions[index];
+    if (index == 0)
+        return VerifyError(v, offset, "return from the main code");
+    if (f->pops >= 0 && f->pops != pops)
+        return VerifyError(v, offset, "function returns remove different numbers of arguments");
+    f->pops = pops;
+    return TRUE;
+}
+
+/* Claim - add an instruction to a function and to the work list if it's new
+   (returns FALSE if the instruction belongs to another function, overlaps another or runs off the end) */
+static int Claim(Verifier *v, int index, VMUVALUE from, VMUVALUE offset)
+{
+    int fmt, length, k;
+
+    /* check for an instruction that has already been claimed (branches can't leave their section) */
+    if (offset >= v->size || SectionEnd(v, offset) != SectionEnd(v, from))
+        return VerifyError(v, from, "branch outside of the code section");
+    if (v->owners[offset] || (v->entries[offset] && v->entries[offset] != index + 1)) {
+        if (v->owners[offset] != index + 1)
+            return VerifyError(v, from, "branch into another function");
+        if (!v->starts[offset])
+            return VerifyError(v, from, "branch into the middle of an instruction");
+        return TRUE;
+    }
+
+    /* decode the instruction */
+    if ((fmt = InstructionFormat(v->code[offset])) < 0)
+        return VerifyError(v, offset, "undefined opcode 0x%02x", v->code[offset]);
+    length = InstructionLength(fmt);
+    if (length > SectionEnd(v, offset) - offset)
+        return VerifyError(v, offset, "instruction runs off the end of the code section");
+    for (k = 0; k < length; ++k)
+        if (v->owners[offset + k])
+            return VerifyError(v, offset, "instruction overlaps another one");
+
+    /* add it to the function */
+    for (k = 0; k < length; ++k)
+        v->owners[offset + k] = index + 1;
+    v->starts[offset] = TRUE;
+    v->work[v->count++] = offset;
+    return TRUE;
+}
+
+/* SetDepth - set the stack depth on entry to an instruction and add it to the work list if it's new
+   (returns FALSE if it is reached with different depths) */
+static int SetDepth(Verifier *v, VMUVALUE from, VMUVALUE offset, int depth)
+{
+    if (v->depths[offset] < 0) {
+        v->depths[offset] = depth;
+        v->work[v->count++] = offset;
+    }
+    else if (v->depths[offset] != depth)
+        return VerifyError(v, from, "stack depth %d doesn't match %d at %08x", depth, v->depths[offset], CodeAddress(v, offset));
+    return TRUE;
+}
+
+/* BranchTarget - get the target offset of a branch or loop instruction */
+static VMUVALUE BranchTarget(Verifier *v, VMUVALUE offset)
+{
+    int length = InstructionLength(InstructionFormat(v->code[offset]));
+    switch (InstructionFormat(v->code[offset])) {
+    case FMT_BR8:
+        return offset + length + (int8_t)v->code[offset + 1];
+    case FMT_BR16:
+        return offset + length + (int16_t)((v->code[offset + 1] << 8) | v->code[offset + 2]);
+    default:
+        return offset + length + GetWord(v, offset + length - sizeof(VMVALUE));
+    }
+}
+
+/* GetWord - get a long operand from the code */
+static VMVALUE GetWord(Verifier *v, VMUVALUE offset)
+{
+    VMUVALUE value = 0;
+    int cnt;
+    for (cnt = 0; cnt < sizeof(VMVALUE); ++cnt)
+        value = (value << 8) | v->code[offset + cnt];
+    return (VMVALUE)value;
+}
+
+/* CodeOffset - get the offset in the code of an address (the size of the code if it isn't in a section) */
+static VMUVALUE CodeOffset(Verifier *v, VMUVALUE addr)
+{
+    int j;
+    for (j = 0; j < v->image->sectionCount; ++j) {
+        ImageFileSection *section = v->image->sections[j].fileSection;
+        if (addr - section->base < section->size)
+            return v->sectionStarts[j] + addr - section->base;
+    }
+    return v->size;
+}
+
+/* CodeAddress - get the address of an offset in the code */
+static VMUVALUE CodeAddress(Verifier *v, VMUVALUE offset)
+{
+    int j;
+    for (j = 0; j < v->image->sectionCount; ++j)
+        if (offset - v->sectionStarts[j] < v->image->sections[j].fileSection->size)
+            return v->image->sections[j].fileSection->base + offset - v->sectionStarts[j];
+    return offset;
+}
+
+/* SectionEnd - get the offset in the code of the end of the section containing an offset */
+static VMUVALUE SectionEnd(Verifier *v, VMUVALUE offset)
+{
+    int j;
+    for (j = 0; j < v->image->sectionCount; ++j) {
+        VMUVALUE end = v->sectionStarts[j] + v->image->sections[j].fileSection->size;
+        if (offset < end)
+            return end;
+    }
+    return v->size;
+}
+
+/* VerifyError - report a verification error and return FALSE */
+static int VerifyError(Verifier *v, VMUVALUE offset, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    xbError(v->sys, "verify: %08x: ", CodeAddress(v, offset));
+    xbErrorV(v->sys, fmt, ap);
+    xbError(v->sys, "\n");
+    va_end(ap);
+    return FALSE;
+}
@@ -0,0 +1,846 @@
+/* xbdump.c - static bytecode and size report for an image file
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * The functions are found by following every path from the main code and
+ * from each function it calls, the same way the verifier finds them.  The
+ * function symbols of the debug section (xbcom -g) name them and add the
+ * ones that are never called.  Function addresses pushed as literals (for
+ * COGSTART and TASKSTART) add the function found there.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_system.h"
+#include "mem_arena.h"
+#include "db_vm.h"
+#include "db_vmdebug.h"
+
+/* number of opcode pairs to show in the report */
+#define TOP_PAIRS   20
+
+/* size of a switch table entry (an OP_BR instruction) */
+#define SWITCH_ENTRY_SIZE   (1 + sizeof(VMUVALUE))
+
+/* function found in the code */
+typedef struct {
+    VMUVALUE entry;         /* offset of the first instruction */
+    VMUVALUE end;           /* offset past its last instruction or dead byte */
+    char *name;             /* function name or NULL if unknown */
+    int section;            /* index of the section containing the function */
+    int instructions;       /* number of reachable instructions */
+    VMUVALUE code;          /* bytes of reachable instructions */
+    VMUVALUE dead;          /* bytes of instructions no path reaches */
+    VMUVALUE padding;       /* zero bytes that align the next function */
+    int fanIn;              /* number of functions that call it */
+    int callSites;          /* number of calls to it */
+    int addressTaken;       /* number of literals with its address */
+} DumpFunction;
+
+/* call graph edge */
+typedef struct {
+    int caller;             /* index of the calling function */
+    int callee;             /* index of the called function */
+    int count;              /* number of calls */
+} DumpCall;
+
+/* width counts of the literal and branch forms */
+typedef struct {
+    int count;              /* instructions of this form */
+    int fits8;              /* operands that fit in a signed byte */
+    int fits16;             /* operands that fit in a signed half word but not a byte */
+} WidthCount;
+
+/* literal forms */
+#define LIT_SHORT   0       /* SLIT */
+#define LIT_HALF    1       /* LIT16 */
+#define LIT_LONG    2       /* LIT */
+#define LIT_FORMS   3
+
+/* branch forms */
+#define BR_SHORT    0       /* BR8 */
+#define BR_HALF     1       /* BR16 */
+#define BR_LONG     2       /* BR */
+#define BR_COND     3       /* BRT, BRTSC, BRF, BRFSC and the compare and branch opcodes */
+#define BR_LOOP     4       /* FORLOOP and FORLOOPA */
+#define BR_FORMS    5
+
+/* sort entry for the opcode and pair reports */
+typedef struct {
+    int index;
+    int count;
+} CountEntry;
+
+/* dump state */
+typedef struct {
+    System *sys;
+    ImageHdr *image;
+    uint8_t *code;          /* data of all of the sections one after another */
+    VMUVALUE *sectionStarts; /* offset of each section in the code */
+    VMUVALUE size;          /* size of all of the sections */
+    int *owners;            /* index plus one of the function containing each byte (0 if none) */
+    int *entries;           /* index plus one of the function starting at each offset (0 if none) */
+    uint8_t *starts;        /* nonzero where a reachable instruction starts */
+    VMUVALUE *work;         /* instructions that still need to be followed */
+    int count;              /* number of instructions on the work list */
+    DumpFunction *functions;
+    int functionCount;
+    DumpCall *calls;
+    int callCount;
+    int maxCalls;
+    int opcodeCounts[256];  /* reachable instructions of each opcode */
+    VMUVALUE opcodeBytes[256]; /* bytes of those instructions */
+    int *pairCounts;        /* adjacent opcode pairs in straight line code */
+    WidthCount literals[LIT_FORMS];
+    WidthCount branches[BR_FORMS];
+} Dumper;
+
+/* prototypes for local functions */
+static void Usage(void);
+static void FindFunctions(Dumper *d);
+static void ScanFunction(Dumper *d, int index);
+static void ClaimInstruction(Dumper *d, int index, VMUVALUE from, VMUVALUE offset);
+static int AddFunction(Dumper *d, VMUVALUE offset, char *name);
+static void AddCall(Dumper *d, int caller, int callee);
+static void MeasureFunctions(Dumper *d);
+static void CountInstructions(Dumper *d);
+static void CountWidth(WidthCount *w, VMVALUE value);
+static void ShowReport(Dumper *d, const char *infile);
+static void ShowWidths(Dumper *d, const char *title, WidthCount *counts, const char **names, int count);
+static int WriteCSV(Dumper *d, const char *path);
+static void FunctionName(Dumper *d, int index, char *buf);
+static void OpcodeName(int opcode, char *buf);
+static int IsPathEnd(int op);
+static VMUVALUE BranchTarget(Dumper *d, VMUVALUE offset);
+static VMVALUE GetWord(Dumper *d, VMUVALUE offset);
+static VMUVALUE CodeOffset(Dumper *d, VMUVALUE addr);
+static VMUVALUE CodeAddress(Dumper *d, VMUVALUE offset);
+static int SectionIndex(Dumper *d, VMUVALUE offset);
+static VMUVALUE SectionEnd(Dumper *d, VMUVALUE offset);
+static void *Allocate(Dumper *d, size_t size);
+static int CompareEntries(const void *p1, const void *p2);
+static int CompareCounts(const void *p1, const void *p2);
+static double Percent(VMUVALUE count, VMUVALUE total);
+static DumpFunction *sortFunctions;
+static void MyInfo(System *sys, const char *fmt, va_list ap);
+static void MyError(System *sys, const char *fmt, va_list ap);
+static SystemOps myOps = {
+    MyInfo,
+    MyError
+};
+
+/* names of the literal and branch forms */
+static const char *literalNames[LIT_FORMS] = { "SLIT", "LIT16", "LIT" };
+static const char *branchNames[BR_FORMS] = { "BR8", "BR16", "BR", "BRT/BRF", "FORLOOP" };
+
+int main(int argc, char *argv[])
+{
+    char *infile = NULL, *csvfile = NULL;
+    ImageHdr *image;
+    Dumper d;
+    VMUVALUE j;
+    int index;
+
+    /* get the arguments */
+    for (index = 1; index < argc; ++index) {
+
+        /* handle switches */
+        if (argv[index][0] == '-') {
+            switch (argv[index][1]) {
+            case 'C':   // write the report as CSV
+                if (argv[index][2])
+                    csvfile = &argv[index][2];
+                else if (++index < argc)
+                    csvfile = argv[index];
+                else
+                    Usage();
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+
+        /* handle the input filename */
+        else {
+            if (infile)
+                Usage();
+            infile = argv[index];
+        }
+    }
+
+    /* make sure an input file was specified */
+    if (!infile)
+        Usage();
+
+    memset(&d, 0, sizeof(d));
+    d.sys = MemInit();
+    d.sys->ops = &myOps;
+
+    if (!(image = LoadImage(d.sys, infile, 0)))
+        Fatal(d.sys, "can't load image '%s'", infile);
+    d.image = image;
+
+    /* functions can be placed in any section so the code is scanned as if the sections were one */
+    for (index = 0; index < image->sectionCount; ++index)
+        d.size += image->sections[index].fileSection->size;
+    d.code = (uint8_t *)Allocate(&d, d.size + 1);
+    d.sectionStarts = (VMUVALUE *)Allocate(&d, image->sectionCount * sizeof(VMUVALUE));
+    for (j = index = 0; index < image->sectionCount; ++index) {
+        VMUVALUE size = image->sections[index].fileSection->size;
+        memcpy(d.code + j, image->sections[index].data, size);
+        d.sectionStarts[index] = j;
+        j += size;
+    }
+
+    /* allocate the work space */
+    d.owners = (int *)Allocate(&d, (d.size + 1) * sizeof(int));
+    d.entries = (int *)Allocate(&d, (d.size + 1) * sizeof(int));
+    d.starts = (uint8_t *)Allocate(&d, d.size + 1);
+    d.work = (VMUVALUE *)Allocate(&d, (d.size + 1) * sizeof(VMUVALUE));
+    d.functions = (DumpFunction *)Allocate(&d, (d.size + 1) * sizeof(DumpFunction));
+    d.pairCounts = (int *)Allocate(&d, 256 * 256 * sizeof(int));
+
+    /* find the functions and measure them */
+    FindFunctions(&d);
+    MeasureFunctions(&d);
+    CountInstructions(&d);
+
+    ShowReport(&d, infile);
+    if (csvfile && !WriteCSV(&d, csvfile))
+        Fatal(d.sys, "can't write report '%s'", csvfile);
+
+    return 0;
+}
+
+/* Usage - display a usage message and exit */
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbdump\n\
+         [ -C <file> ]   also write the report to a CSV file\n\
+         <name>          image file to report on (compile with -g for the function names)\n\
+");
+    exit(1);
+}
+
+/* FindFunctions - find the main code, the functions it calls and the functions with symbols */
+static void FindFunctions(Dumper *d)
+{
+    ImageHdr *image = d->image;
+    int index, j;
+
+    AddFunction(d, CodeOffset(d, image->mainCode), NULL);
+    for (j = 0; j < image->symbolCount; ++j)
+        if ((index = AddFunction(d, CodeOffset(d, image->symbols[j].value), image->symbols[j].name)) >= 0)
+            d->functions[index].name = image->symbols[j].name;
+    for (index = 0; index < d->functionCount; ++index)
+        ScanFunction(d, index);
+}
+
+/* ScanFunction - find the reachable instructions of a function and the functions it calls */
+static void ScanFunction(Dumper *d, int index)
+{
+    DumpFunction *f = &d->functions[index];
+    VMUVALUE offset, next, target;
+    int op, n;
+
+    ClaimInstruction(d, index, f->entry, f->entry);
+    while (d->count > 0) {
+        offset = d->work[--d->count];
+        op = d->code[offset];
+        next = offset + InstructionLength(InstructionFormat(op));
+
+        switch (op) {
+
+        /* instructions that end a path (computed jumps can't be followed) */
+        case OP_HALT:
+        case OP_RETURN:
+        case OP_RETURNZ:
+        case OP_RET:
+        case OP_PUSHJ:
+        case OP_POPJ:
+            break;
+
+        /* branches */
+        case OP_BR:
+        case OP_BR8:
+        case OP_BR16:
+            ClaimInstruction(d, index, offset, BranchTarget(d, offset));
+            break;
+        case OP_BRT:
+        case OP_BRTSC:
+        case OP_BRF:
+        case OP_BRFSC:
+        case OP_BRLT:
+        case OP_BRLE:
+        case OP_BREQ:
+        case OP_BRNE:
+        case OP_BRGE:
+        case OP_BRGT:
+        case OP_BRLTZ:
+        case OP_BRLEZ:
+        case OP_BRGEZ:
+        case OP_BRGTZ:
+        case OP_FORLOOP:
+        case OP_FORLOOPA:
+            ClaimInstruction(d, index, offset, BranchTarget(d, offset));
+            ClaimInstruction(d, index, offset, next);
+            break;
+
+        /* the switch table entries are branches */
+        case OP_SWITCH:
+            for (n = 0; n <= d->code[offset + 1]; ++n)
+                ClaimInstruction(d, index, offset, next + n * SWITCH_ENTRY_SIZE);
+            break;
+
+        /* direct calls add the called function */
+        case OP_CALL:
+            if ((n = AddFunction(d, CodeOffset(d, GetWord(d, offset + 1)), NULL)) >= 0)
+                AddCall(d, index, n);
+            ClaimInstruction(d, index, offset, next);
+            break;
+
+        /* a literal with the address of a FRAME is a function address */
+        case OP_LIT16:
+        case OP_LIT:
+        case OP_LOADA:
+            if (op == OP_LIT16)
+                target = CodeOffset(d, (int16_t)((d->code[offset + 1] << 8) | d->code[offset + 2]));
+            else
+                target = CodeOffset(d, GetWord(d, offset + 1));
+            if (target < d->size && d->code[target] == OP_FRAME && (n = AddFunction(d, target, NULL)) >= 0 && n != index)
+                ++d->functions[n].addressTaken;
+            ClaimInstruction(d, index, offset, next);
+            break;
+
+        /* everything else falls through to the next instruction */
+        default:
+            ClaimInstruction(d, index, offset, next);
+            break;
+        }
+    }
+}
+
+/* ClaimInstruction - add a reachable instruction to a function and to the work list if it's new
+   (paths that run into another function, an undefined opcode or the end of the section stop there) */
+static void ClaimInstruction(Dumper *d, int index, VMUVALUE from, VMUVALUE offset)
+{
+    DumpFunction *f = &d->functions[index];
+    int fmt, length, k;
+
+    if (offset >= d->size || SectionEnd(d, offset) != SectionEnd(d, from))
+        return;
+    if (d->owners[offset] || (d->entries[offset] && d->entries[offset] != index + 1))
+        return;
+    if ((fmt = InstructionFormat(d->code[offset])) < 0)
+        return;
+    length = InstructionLength(fmt);
+    if (length > SectionEnd(d, offset) - offset)
+        return;
+    for (k = 0; k < length; ++k)
+        if (d->owners[offset + k])
+            return;
+
+    for (k = 0; k < length; ++k)
+        d->owners[offset + k] = index + 1;
+    d->starts[offset] = TRUE;
+    d->work[d->count++] = offset;
+    f->code += length;
+    ++f->instructions;
+    if (offset + length > f->end)
+        f->end = offset + length;
+}
+
+/* AddFunction - add a function unless it's already known (returns its index or -1 if it can't start there) */
+static int AddFunction(Dumper *d, VMUVALUE offset, char *name)
+{
+    DumpFunction *f;
+
+    if (offset >= d->size)
+        return -1;
+    if (d->entries[offset])
+        return d->entries[offset] - 1;
+    if (d->owners[offset])
+        return -1;
+
+    f = &d->functions[d->functionCount++];
+    memset(f, 0, sizeof(DumpFunction));
+    f->entry = offset;
+    f->end = offset;
+    f->name = name;
+    f->section = SectionIndex(d, offset);
+    d->entries[offset] = d->functionCount;
+    return d->functionCount - 1;
+}
+
+/* AddCall - count a call in the call graph */
+static void AddCall(Dumper *d, int caller, int callee)
+{
+    DumpCall *call;
+    int j;
+
+    ++d->functions[callee].callSites;
+    for (j = 0; j < d->callCount; ++j)
+        if (d->calls[j].caller == caller && d->calls[j].callee == callee) {
+            ++d->calls[j].count;
+            return;
+        }
+
+    if (d->callCount >= d->maxCalls) {
+        d->maxCalls = d->maxCalls ? d->maxCalls * 2 : 64;
+        if (!(d->calls = (DumpCall *)realloc(d->calls, d->maxCalls * sizeof(DumpCall))))
+            Fatal(d->sys, "insufficient memory");
+    }
+    call = &d->calls[d->callCount++];
+    call->caller = caller;
+    call->callee = callee;
+    call->count = 1;
+    ++d->functions[callee].fanIn;
+}
+
+/* MeasureFunctions - find the dead code and padding of each function
+   (the bytes between its last reachable instruction and the next function are dead
+   code if they decode as instructions, the last function of a section is followed by data) */
+static void MeasureFunctions(Dumper *d)
+{
+    int *order, j, k;
+
+    order = (int *)Allocate(d, (d->functionCount + 1) * sizeof(int));
+    for (j = 0; j < d->functionCount; ++j)
+        order[j] = j;
+    sortFunctions = d->functions;
+    qsort(order, d->functionCount, sizeof(int), CompareEntries);
+
+    for (j = 0; j < d->functionCount; ++j) {
+        DumpFunction *f = &d->functions[order[j]];
+        VMUVALUE offset, next, end;
+
+        /* bytes inside the function that no path reaches are dead code */
+        f->dead = f->end - f->entry - f->code;
+
+        /* look at the gap up to the next function in the same section */
+        if (j + 1 >= d->functionCount || d->functions[order[j + 1]].section != f->section)
+            continue;
+        next = d->functions[order[j + 1]].entry;
+        end = next;
+        if (next % sizeof(VMVALUE) == 0)
+            while (end > f->end && next - end < sizeof(VMVALUE) && d->code[end - 1] == 0 && !d->owners[end - 1])
+                --end;
+        for (offset = f->end; offset < end; offset += k) {
+            int fmt = InstructionFormat(d->code[offset]);
+            if (fmt < 0 || d->owners[offset])
+                break;
+            k = InstructionLength(fmt);
+        }
+        if (offset == end) {
+            f->dead += end - f->end;
+            f->padding = next - end;
+            f->end = next;
+        }
+    }
+}
+
+/* CountInstructions - count the opcodes, pairs, literals and branches of the reachable instructions */
+static void CountInstructions(Dumper *d)
+{
+    VMUVALUE offset, next;
+    int op, fmt, length;
+
+    for (offset = 0; offset < d->size; ++offset) {
+        if (!d->starts[offset])
+            continue;
+        op = d->code[offset];
+        fmt = InstructionFormat(op);
+        length = InstructionLength(fmt);
+        next = offset + length;
+        ++d->opcodeCounts[op];
+        d->opcodeBytes[op] += length;
+
+        /* pairs are counted where the next instruction follows this one */
+        if (!IsPathEnd(op) && next < d->size && d->starts[next] && d->owners[next] == d->owners[offset])
+            ++d->pairCounts[(op << 8) | d->code[next]];
+
+        switch (op) {
+        case OP_SLIT:
+            CountWidth(&d->literals[LIT_SHORT], (int8_t)d->code[offset + 1]);
+            break;
+        case OP_LIT16:
+            CountWidth(&d->literals[LIT_HALF], (int16_t)((d->code[offset + 1] << 8) | d->code[offset + 2]));
+            break;
+        case OP_LIT:
+            CountWidth(&d->literals[LIT_LONG], GetWord(d, offset + 1));
+            break;
+        case OP_BR8:
+            CountWidth(&d->branches[BR_SHORT], (VMVALUE)(BranchTarget(d, offset) - next));
+            break;
+        case OP_BR16:
+            CountWidth(&d->branches[BR_HALF], (VMVALUE)(BranchTarget(d, offset) - next));
+            break;
+        case OP_BR:
+            CountWidth(&d->branches[BR_LONG], (VMVALUE)(BranchTarget(d, offset) - next));
+            break;
+        case OP_BRT:
+        case OP_BRTSC:
+        case OP_BRF:
+        case OP_BRFSC:
+        case OP_BRLT:
+        case OP_BRLE:
+        case OP_BREQ:
+        case OP_BRNE:
+        case OP_BRGE:
+        case OP_BRGT:
+        case OP_BRLTZ:
+        case OP_BRLEZ:
+        case OP_BRGEZ:
+        case OP_BRGTZ:
+            CountWidth(&d->branches[BR_COND], (VMVALUE)(BranchTarget(d, offset) - next));
+            break;
+        case OP_FORLOOP:
+        case OP_FORLOOPA:
+            CountWidth(&d->branches[BR_LOOP], (VMVALUE)(BranchTarget(d, offset) - next));
+            break;
+        }
+    }
+}
+
+/* CountWidth - count an operand by the smallest width that holds it */
+static void CountWidth(WidthCount *w, VMVALUE value)
+{
+    ++w->count;
+    if (value >= -128 && value <= 127)
+        ++w->fits8;
+    else if (value >= -32768 && value <= 32767)
+        ++w->fits16;
+}
+
+/* ShowReport - display the report */
+static void ShowReport(Dumper *d, const char *infile)
+{
+    ImageHdr *image = d->image;
+    VMUVALUE totalCode = 0, totalDead = 0, totalPadding = 0, totalSize = 0;
+    CountEntry entries[256], *pairs;
+    int total = 0, count, n, j, k;
+    char name[256], second[32];
+
+    xbInfo(d->sys, "image: %s\n", infile);
+    xbInfo(d->sys, "  main code %08x, stack %d bytes, %d functions\n", image->mainCode, image->stackSize, d->functionCount);
+
+    /* show the sections */
+    xbInfo(d->sys, "\nsections:\n");
+    xbInfo(d->sys, "  %8s %8s %8s %8s %8s %8s\n", "base", "size", "code", "dead", "padding", "data");
+    for (j = 0; j < image->sectionCount; ++j) {
+        ImageFileSection *section = image->sections[j].fileSection;
+        VMUVALUE code = 0, dead = 0, padding = 0;
+        for (k = 0; k < d->functionCount; ++k) {
+            DumpFunction *f = &d->functions[k];
+            if (f->section == j) {
+                code += f->code;
+                dead += f->dead;
+                padding += f->padding;
+            }
+        }
+        xbInfo(d->sys, "  %08x %8d %8d %8d %8d %8d\n", section->base, section->size, code, dead, padding, section->size - code - dead - padding);
+        totalSize += section->size;
+        totalCode += code;
+        totalDead += dead;
+        totalPadding += padding;
+    }
+    if (image->sectionCount > 1)
+        xbInfo(d->sys, "  %8s %8d %8d %8d %8d %8d\n", "total", totalSize, totalCode, totalDead, totalPadding, totalSize - totalCode - totalDead - totalPadding);
+
+    /* show the functions in address order */
+    xbInfo(d->sys, "\nfunctions:\n");
+    xbInfo(d->sys, "  %8s %8s %8s %8s %8s %8s  %s\n", "address", "size", "insns", "dead", "fan-in", "calls", "name");
+    for (n = 0; n < d->size; ++n) {
+        if (!d->entries[n])
+            continue;
+        j = d->entries[n] - 1;
+        FunctionName(d, j, name);
+        xbInfo(d->sys, "  %08x %8d %8d %8d %8d %8d  %s%s\n", CodeAddress(d, d->functions[j].entry),
+               d->functions[j].end - d->functions[j].entry, d->functions[j].instructions,
+               d->functions[j].dead, d->functions[j].fanIn, d->functions[j].callSites, name,
+               j > 0 && d->functions[j].callSites == 0 && d->functions[j].addressTaken == 0 ? " (never called)" : "");
+    }
+
+    /* show the static opcode counts */
+    for (n = j = 0; j < 256; ++j)
+        if (d->opcodeCounts[j] > 0) {
+            entries[n].index = j;
+            entries[n].count = d->opcodeCounts[j];
+            total += d->opcodeCounts[j];
+            ++n;
+        }
+    qsort(entries, n, sizeof(CountEntry), CompareCounts);
+    xbInfo(d->sys, "\nopcodes:\n");
+    xbInfo(d->sys, "  %8s %7s %8s %7s  %s\n", "count", "%", "bytes", "%", "opcode");
+    for (j = 0; j < n; ++j) {
+        OpcodeName(entries[j].index, name);
+        xbInfo(d->sys, "  %8d %6.2f%% %8d %6.2f%%  %s\n", entries[j].count, Percent(entries[j].count, total),
+               d->opcodeBytes[entries[j].index], Percent(d->opcodeBytes[entries[j].index], totalCode), name);
+    }
+
+    /* show the most frequent opcode pairs (the candidates for superinstructions) */
+    for (count = j = 0; j < 256 * 256; ++j)
+        if (d->pairCounts[j] > 0)
+            ++count;
+    if (count > 0 && (pairs = (CountEntry *)malloc(count * sizeof(CountEntry))) != NULL) {
+        for (n = j = 0; j < 256 * 256; ++j)
+            if (d->pairCounts[j] > 0) {
+                pairs[n].index = j;
+                pairs[n].count = d->pairCounts[j];
+                ++n;
+            }
+        qsort(pairs, n, sizeof(CountEntry), CompareCounts);
+        xbInfo(d->sys, "\nopcode pairs:\n");
+        xbInfo(d->sys, "  %8s %7s  %s\n", "count", "%", "opcodes");
+        for (j = 0; j < n && j < TOP_PAIRS; ++j) {
+            OpcodeName(pairs[j].index >> 8, name);
+            OpcodeName(pairs[j].index & 0xff, second);
+            xbInfo(d->sys, "  %8d %6.2f%%  %s %s\n", pairs[j].count, Percent(pairs[j].count, total), name, second);
+        }
+        free(pairs);
+    }
+
+    /* show the operand widths */
+    ShowWidths(d, "literals", d->literals, literalNames, LIT_FORMS);
+    ShowWidths(d, "branches", d->branches, branchNames, BR_FORMS);
+
+    /* show the call graph */
+    xbInfo(d->sys, "\ncall graph:\n");
+    for (n = 0; n < d->size; ++n) {
+        if (!d->entries[n])
+            continue;
+        j = d->entries[n] - 1;
+        FunctionName(d, j, name);
+        xbInfo(d->sys, "  %s (fan-in %d%s)\n", name, d->functions[j].fanIn, d->functions[j].addressTaken ? ", address taken" : "");
+        for (k = 0; k < d->callCount; ++k)
+            if (d->calls[k].caller == j) {
+                FunctionName(d, d->calls[k].callee, name);
+                xbInfo(d->sys, "    %6d  %s\n", d->calls[k].count, name);
+            }
+    }
+}
+
+/* ShowWidths - display the operand widths of the literal or branch forms */
+static void ShowWidths(Dumper *d, const char *title, WidthCount *counts, const char **names, int count)
+{
+    int j;
+    xbInfo(d->sys, "\n%s:\n", title);
+    xbInfo(d->sys, "  %8s %8s %8s %8s  %s\n", "count", "8 bit", "16 bit", "32 bit", "form");
+    for (j = 0; j < count; ++j) {
+        WidthCount *w = &counts[j];
+        if (w->count > 0)
+            xbInfo(d->sys, "  %8d %8d %8d %8d  %s\n", w->count, w->fits8, w->fits16, w->count - w->fits8 - w->fits16, names[j]);
+    }
+}
+
+/* WriteCSV - write the report as a CSV file
+   (rows are in address and opcode order so reports can be compared with diff) */
+static int WriteCSV(Dumper *d, const char *path)
+{
+    char name[256], second[32];
+    FILE *fp;
+    int n, j;
+
+    if (!(fp = fopen(path, "w")))
+        return FALSE;
+
+    fprintf(fp, "kind,name,bytes,count,dead,fanin\n");
+
+    for (j = 0; j < d->image->sectionCount; ++j) {
+        ImageFileSection *section = d->image->sections[j].fileSection;
+        fprintf(fp, "section,%08x,%d,,,\n", section->base, section->size);
+    }
+    for (n = 0; n < d->size; ++n)
+        if (d->entries[n]) {
+            DumpFunction *f = &d->functions[d->entries[n] - 1];
+            FunctionName(d, d->entries[n] - 1, name);
+            fprintf(fp, "function,%s,%d,%d,%d,%d\n", name, f->end - f->entry, f->instructions, f->dead, f->fanIn);
+        }
+    for (j = 0; j < 256; ++j)
+        if (d->opcodeCounts[j] > 0) {
+            OpcodeName(j, name);
+            fprintf(fp, "opcode,%s,%d,%d,,\n", name, d->opcodeBytes[j], d->opcodeCounts[j]);
+        }
+    for (j = 0; j < 256 * 256; ++j)
+        if (d->pairCounts[j] > 0) {
+            OpcodeName(j >> 8, name);
+            OpcodeName(j & 0xff, second);
+            fprintf(fp, "pair,%s %s,,%d,,\n", name, second, d->pairCounts[j]);
+        }
+    for (j = 0; j < LIT_FORMS; ++j)
+        if (d->literals[j].count > 0)
+            fprintf(fp, "literal,%s,,%d,,\n", literalNames[j], d->literals[j].count);
+    for (j = 0; j < BR_FORMS; ++j)
+        if (d->branches[j].count > 0)
+            fprintf(fp, "branch,%s,,%d,,\n", branchNames[j], d->branches[j].count);
+
+    fclose(fp);
+    return TRUE;
+}
+
+/* FunctionName - get the name of a function for the report */
+static void FunctionName(Dumper *d, int index, char *buf)
+{
+    DumpFunction *f = &d->functions[index];
+    if (f->name)
+        sprintf(buf, "%.200s", f->name);
+    else if (index == 0)
+        strcpy(buf, "[main]");
+    else
+        sprintf(buf, "%08x", CodeAddress(d, f->entry));
+}
+
+/* OpcodeName - get the name of an opcode for the report */
+static void OpcodeName(int opcode, char *buf)
+{
+    FLASH_SPACE OTDEF *op;
+    for (op = OpcodeTable; op->name; ++op)
+        if (opcode == op->code) {
+            strcpy(buf, op->name);
+            return;
+        }
+    sprintf(buf, "%02x", opcode);
+}
+
+/* IsPathEnd - check for an instruction that never falls through to the next one */
+static int IsPathEnd(int op)
+{
+    switch (op) {
+    case OP_HALT:
+    case OP_RETURN:
+    case OP_RETURNZ:
+    case OP_RET:
+    case OP_PUSHJ:
+    case OP_POPJ:
+    case OP_BR:
+    case OP_BR8:
+    case OP_BR16:
+    case OP_SWITCH:
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* BranchTarget - get the target offset of a branch or loop instruction */
+static VMUVALUE BranchTarget(Dumper *d, VMUVALUE offset)
+{
+    int length = InstructionLength(InstructionFormat(d->code[offset]));
+    switch (InstructionFormat(d->code[offset])) {
+    case FMT_BR8:
+        return offset + length + (int8_t)d->code[offset + 1];
+    case FMT_BR16:
+        return offset + length + (int16_t)((d->code[offset + 1] << 8) | d->code[offset + 2]);
+    default:
+        return offset + length + GetWord(d, offset + length - sizeof(VMVALUE));
+    }
+}
+
+/* GetWord - get a long operand from the code */
+static VMVALUE GetWord(Dumper *d, VMUVALUE offset)
+{
+    VMUVALUE value = 0;
+    int cnt;
+    for (cnt = 0; cnt < sizeof(VMVALUE); ++cnt)
+        value = (value << 8) | d->code[offset + cnt];
+    return (VMVALUE)value;
+}
+
+/* CodeOffset - get the offset in the code of an address (the size of the code if it isn't in a section) */
+static VMUVALUE CodeOffset(Dumper *d, VMUVALUE addr)
+{
+    int j;
+    for (j = 0; j < d->image->sectionCount; ++j) {
+        ImageFileSection *section = d->image->sections[j].fileSection;
+        if (addr - section->base < section->size)
+            return d->sectionStarts[j] + addr - section->base;
+    }
+    return d->size;
+}
+
+/* CodeAddress - get the address of an offset in the code */
+static VMUVALUE CodeAddress(Dumper *d, VMUVALUE offset)
+{
+    int j = SectionIndex(d, offset);
+    if (j < 0)
+        return offset;
+    return d->image->sections[j].fileSection->base + offset - d->sectionStarts[j];
+}
+
+/* SectionIndex - get the index of the section containing an offset (-1 if none) */
+static int SectionIndex(Dumper *d, VMUVALUE offset)
+{
+    int j;
+    for (j = 0; j < d->image->sectionCount; ++j)
+        if (offset - d->sectionStarts[j] < d->image->sections[j].fileSection->size)
+            return j;
+    return -1;
+}
+
+/* SectionEnd - get the offset in the code of the end of the section containing an offset */
+static VMUVALUE SectionEnd(Dumper *d, VMUVALUE offset)
+{
+    int j;
+    for (j = 0; j < d->image->sectionCount; ++j) {
+        VMUVALUE end = d->sectionStarts[j] + d->image->sections[j].fileSection->size;
+        if (offset < end)
+            return end;
+    }
+    return d->size;
+}
+
+/* Allocate - allocate zeroed work space or exit */
+static void *Allocate(Dumper *d, size_t size)
+{
+    void *p;
+    if (!(p = malloc(size)))
+        Fatal(d->sys, "insufficient memory");
+    memset(p, 0, size);
+    return p;
+}
+
+/* CompareEntries - compare function indices by entry (qsort has no context so the functions are in sortFunctions) */
+static int CompareEntries(const void *p1, const void *p2)
+{
+    VMUVALUE e1 = sortFunctions[*(const int *)p1].entry;
+    VMUVALUE e2 = sortFunctions[*(const int *)p2].entry;
+    return e1 < e2 ? -1 : e1 > e2 ? 1 : 0;
+}
+
+static int CompareCounts(const void *p1, const void *p2)
+{
+    const CountEntry *c1 = (const CountEntry *)p1;
+    const CountEntry *c2 = (const CountEntry *)p2;
+    if (c1->count != c2->count)
+        return c1->count < c2->count ? 1 : -1;
+    return c1->index - c2->index;
+}
+
+static double Percent(VMUVALUE count, VMUVALUE total)
+{
+    return total ? (count * 100.0) / total : 0.0;
+}
+
+static void MyInfo(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stdout, fmt, ap);
+}
+
+static void MyError(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stderr, fmt, ap);
+}
+
+void Fatal(System *sys, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    xbError(sys, "error: ");
+    xbErrorV(sys, fmt, ap);
+    xbError(sys, "\n");
+    va_end(ap);
+    exit(1);
+}
@@ -2,9 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "db_system.h"
-#include "mem_malloc.h"
+#include "mem_arena.h"
 #include "db_vm.h"
 
+static void Usage(void);
 static void MyInfo(System *sys, const char *fmt, va_list ap);
 static void MyError(System *sys, const char *fmt, va_list ap);
 static SystemOps myOps = {
@@ -14,31 +15,253 @@ static SystemOps myOps = {
 
 int main(int argc, char *argv[])
 {
+    EngineType engine = ENGINE_DEFAULT;
+    char *infile = NULL, *csvfile = NULL, *board = NULL, *stimulus = NULL, *trace = NULL, *p;
+    char *snapshotAt = NULL, *snapshotFile = NULL, *restoreFile = NULL, *manifest = NULL;
+    char *limitText = NULL, *recordFile = NULL, *replayFile = NULL;
+    uint64_t limit = 0;
+    ExecStatus status;
+    int jobs = 0, failed;
+    int profile = FALSE, verify = FALSE, timing = FALSE;
+    BoardConfig *config = NULL;
     ImageHdr *image;
     Interpreter *i;
-    char *infile;
     System *sys;
+    int j;
     
-    if (argc != 2) {
-        fprintf(stderr, "usage: xbint <file>\n");
-        return 1;
+    /* get the arguments */
+    for (j = 1; j < argc; ++j) {
+
+        /* handle switches */
+        if (argv[j][0] == '-') {
+            switch (argv[j][1]) {
+            case '-':
+                if (strcmp(&argv[j][2], "snapshot-at") == 0 && j + 2 < argc) {
+                    snapshotAt = argv[++j];
+                    snapshotFile = argv[++j];
+                }
+                else if (strcmp(&argv[j][2], "restore") == 0 && j + 1 < argc)
+                    restoreFile = argv[++j];
+                else if (strcmp(&argv[j][2], "record") == 0 && j + 1 < argc)
+                    recordFile = argv[++j];
+                else if (strcmp(&argv[j][2], "replay") == 0 && j + 1 < argc)
+                    replayFile = argv[++j];
+                else if (strcmp(&argv[j][2], "batch") == 0 && j + 1 < argc)
+                    manifest = argv[++j];
+                else if (strcmp(&argv[j][2], "limit") == 0 && j + 1 < argc) {
+                    limitText = argv[++j];
+                    if ((limit = strtoull(limitText, &p, 10)) == 0 || *p)
+                        Usage();
+                }
+                else
+                    Usage();
+                break;
+            case 'e':   // select an execution engine
+                if (argv[j][2])
+                    p = &argv[j][2];
+                else if (++j < argc)
+                    p = argv[j];
+                else
+                    Usage();
+                if (strcmp(p, "switch") == 0)
+                    engine = ENGINE_SWITCH;
+#ifdef USE_THREADED_DISPATCH
+                else if (strcmp(p, "threaded") == 0)
+                    engine = ENGINE_THREADED;
+                else if (strcmp(p, "decoded") == 0)
+                    engine = ENGINE_DECODED;
+                else if (strcmp(p, "jit") == 0)
+                    engine = ENGINE_JIT;
+#endif
+                else
+                    Usage();
+                break;
+            case 'j':   // number of threads running the cases of a batch
+                if (argv[j][2])
+                    p = &argv[j][2];
+                else if (++j < argc)
+                    p = argv[j];
+                else
+                    Usage();
+                if ((jobs = atoi(p)) <= 0)
+                    Usage();
+                break;
+            case 'P':   // profile the execution
+                profile = TRUE;
+                break;
+            case 'V':   // verify the code before running it
+                verify = TRUE;
+                break;
+            case 'T':   // estimate the run time on the propeller
+                timing = TRUE;
+                break;
+            case 'b':   // select the board for the run time estimate
+                if (argv[j][2])
+                    board = &argv[j][2];
+                else if (++j < argc)
+                    board = argv[j];
+                else
+                    Usage();
+                timing = TRUE;
+                break;
+            case 'S':   // drive the input pins from a stimulus file
+                if (argv[j][2])
+                    stimulus = &argv[j][2];
+                else if (++j < argc)
+                    stimulus = argv[j];
+                else
+                    Usage();
+                break;
+            case 'W':   // write the output pins to a VCD file
+                if (argv[j][2])
+                    trace = &argv[j][2];
+                else if (++j < argc)
+                    trace = argv[j];
+                else
+                    Usage();
+                break;
+            case 'I':   // add a directory to search for xbasic.cfg
+                if (argv[j][2])
+                    p = &argv[j][2];
+                else if (++j < argc)
+                    p = argv[j];
+                else
+                    Usage();
+                xbAddToPath(p);
+                break;
+            case 'C':   // write the profile as CSV
+                if (argv[j][2])
+                    csvfile = &argv[j][2];
+                else if (++j < argc)
+                    csvfile = argv[j];
+                else
+                    Usage();
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+
+        /* handle the input filename */
+        else {
+            if (infile)
+                Usage();
+            infile = argv[j];
+        }
+    }
+    
+    /* a batch runs the images of its manifest with only the engine and verification options */
+    if (manifest) {
+        if (infile || profile || csvfile || timing || stimulus || trace || snapshotAt || restoreFile
+        ||  recordFile || replayFile)
+            Usage();
+        sys = MemInit();
+        sys->ops = &myOps;
+        if ((failed = RunBatch(sys, manifest, engine, verify, jobs, limit)) < 0)
+            return 1;   // RunBatch has reported the error
+        return failed > 0 ? 1 : 0;
     }
-    infile = argv[1];
+
+    /* make sure an input file was specified */
+    if (!infile || (recordFile && replayFile))
+        Usage();
     
     sys = MemInit();
     sys->ops = &myOps;
 
-    if (!(image = LoadImage(sys, infile)))
+    /* the run time estimate uses the clock and cache of the board */
+    if (board) {
+        xbAddEnvironmentPath();
+        ParseConfigurationFile(sys, "xbasic.cfg");
+        if (!(config = GetBoardConfig(board)))
+            Fatal(sys, "no board type: %s", board);
+    }
+
+    if (!(image = LoadImage(sys, infile, engine == ENGINE_DECODED || engine == ENGINE_JIT ? LOAD_PREDECODE : 0)))
         Fatal(sys, "can't load image '%s'", infile);
+    
+    /* the decoded and jit engines run a verified image without checking its constant addresses */
+    if (verify) {
+        if (!VerifyImage(sys, image))
+            Fatal(sys, "image '%s' failed verification", infile);
+        image->flags |= IMAGE_VERIFIED;
+    }
 
     if (!(i = (Interpreter *)InitInterpreter(sys, image)))
         Fatal(sys, "insufficient memory");
+    i->engine = engine;
+    
+    if ((profile || csvfile) && !(i->profile = InitProfile(sys, image)))
+        Fatal(sys, "insufficient memory for profile");
+    if (timing && !(i->clock = InitClock(sys, config)))
+        Fatal(sys, "insufficient memory for the run time estimate");
+    if (!(i->pins = InitPins(sys, ClockFrequency(i), stimulus, trace)))
+        return 1;   // InitPins has reported the error
+    if (snapshotAt && !(i->snapshot = InitSnapshot(i, snapshotAt, snapshotFile)))
+        Fatal(sys, "no instruction count, address or function: %s%s", snapshotAt,
+              image->symbolCount == 0 ? " (function names need an image compiled with -g)" : "");
+    if (recordFile && !(i->ioLog = OpenIOLog(i, recordFile, FALSE)))
+        return 1;   // OpenIOLog has reported the error
+    if (replayFile && !(i->ioLog = OpenIOLog(i, replayFile, TRUE)))
+        return 1;   // OpenIOLog has reported the error
         
-    Execute(i, image);
+    /* a restored run starts where the snapshot was taken */
+    if (restoreFile) {
+        if (!RestoreSnapshot(i, restoreFile))
+            return 1;   // RestoreSnapshot has reported the error
+    }
+    else
+        InitExecution(i);
+    status = limit > 0 ? ExecuteFor(i, limit) : (ExecStatus)Resume(i);
+    ClosePins(i);
+    if (i->ioLog && !CloseIOLog(i))
+        return 1;   // CloseIOLog has reported the error
+    if (status == EXEC_EXHAUSTED)
+        Fatal(sys, "the program didn't halt within %s instructions", limitText);
+    if (i->snapshot)
+        Fatal(sys, "the program ended before the snapshot point: %s", snapshotAt);
+    
+    if (profile)
+        ShowProfile(sys, i->profile);
+    if (csvfile && !WriteProfileCSV(i->profile, csvfile))
+        Fatal(sys, "can't write profile '%s'", csvfile);
+    if (timing)
+        ShowClock(sys, i->clock);
     
     return 0;
 }
 
+/* Usage - display a usage message and exit */
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbint\n\
+         [ -e <engine> ] select the execution engine (switch | threaded | decoded | jit) (default is %s)\n\
+         [ -P ]          profile the execution and show a report (uses the switch engine)\n\
+         [ -C <file> ]   profile the execution and write the report to a CSV file\n\
+         [ -T ]          estimate the run time on the propeller (uses the switch engine)\n\
+         [ -b <board> ]  estimate the run time with the clock and cache of a board (implies -T)\n\
+         [ -S <file> ]   drive the input pins from a stimulus file (lines of time pin level)\n\
+         [ -W <file> ]   write the changes of the output pins to a VCD file\n\
+         [ -I <path> ]   add a directory to search for xbasic.cfg\n\
+         [ -V ]          verify the code so the decoded and jit engines can skip their address checks\n\
+         [ --snapshot-at <n|addr|function> <file> ]\n\
+                         write the state to a snapshot file and stop after n instructions or\n\
+                         when the pc reaches a hex address or a function (uses the switch engine)\n\
+         [ --restore <file> ] start from a snapshot file written by a run of the same image\n\
+         [ --record <file> ] write the console input and the values of CNT and INA to a log\n\
+         [ --replay <file> ] read the console input and CNT and INA from a log written by a\n\
+                         run of the same image instead of the console, the clock and the pins\n\
+         [ --batch <manifest> ] run the cases of a manifest instead of an image (lines of an\n\
+                         image, an input file and an expected output file or '-' for none)\n\
+         [ -j <n> ]      threads running the cases of a batch (default is one a processor)\n\
+         [ --limit <n> ] stop a run that hasn't halted after n instructions (uses the switch engine)\n\
+         <name>          image file to execute\n\
+", ENGINE_DEFAULT == ENGINE_THREADED ? "threaded" : "switch");
+    exit(1);
+}
+
 static void MyInfo(System *sys, const char *fmt, va_list ap)
 {
     vfprintf(stdout, fmt, ap);
@@ -0,0 +1,738 @@
+/* xbperf.c - benchmark the interpreter over a list of programs
+ *
+ * Copyright (c) 2011 by David Michael Betz.  All rights reserved.
+ *
+ * Each program in the list is compiled with xbcom and run once under the
+ * profile (and with -T the run time estimate) to count the instructions and
+ * cycles and then n times with the selected engine to time it.  Most of the
+ * samples end in an idle loop so a program can be given a text that stops it
+ * as soon as its output contains it.  The results are written as JSON and
+ * can be compared with those of an earlier run.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_system.h"
+#include "mem_arena.h"
+#include "db_vm.h"
+
+/* maximum number of programs in a list and of timed runs of each */
+#define MAX_PROGRAMS    64
+#define MAX_RUNS        100
+
+/* maximum length of a line of the list or of the baseline */
+#define MAX_LINE        256
+
+/* maximum length of the text that stops a program */
+#define MAX_STOP        64
+
+/* default percentage by which a result must be worse than the baseline to count as a regression */
+#define DEF_THRESHOLD   5.0
+
+/* program to benchmark */
+typedef struct {
+    char *path;                 /* source file path */
+    char *name;                 /* source file name as given in the list */
+    char *stop;                 /* text whose output stops the program or NULL */
+    char *error;                /* reason the benchmark failed or NULL */
+    long imageSize;             /* size of the image file */
+    VMUVALUE codeSize;          /* size of the code section */
+    uint64_t instructions;      /* instructions executed */
+    uint64_t cycles;            /* estimated propeller cycles */
+    unsigned long wallMedian;   /* median of the run times in microseconds */
+    unsigned long wallMin;      /* shortest run time in microseconds */
+} BenchProgram;
+
+/* result of an earlier run */
+typedef struct {
+    char name[MAX_LINE];
+    double imageSize;
+    double codeSize;
+    double instructions;
+    double cycles;              /* negative if the baseline has no cycle estimate */
+    double wallMedian;
+} BaselineProgram;
+
+static void Usage(void);
+static int ReadList(System *sys, const char *path, BenchProgram *programs);
+static void BenchmarkProgram(System *sys, BenchProgram *b);
+static int CompileProgram(BenchProgram *b);
+static int MeasureProgram(BenchProgram *b, const char *image);
+static int TimeProgram(BenchProgram *b, const char *image);
+static int RunProgram(Interpreter *i, ImageHdr *image, const char *stop);
+static void ShowResults(System *sys, BenchProgram *programs, int count);
+static int WriteJSON(BenchProgram *programs, int count, const char *path);
+static int ReadBaseline(const char *path, BaselineProgram *baseline);
+static int CompareResults(System *sys, BenchProgram *programs, int count, BaselineProgram *baseline, int baselineCount, const char *path);
+static int CompareResult(System *sys, const char *name, const char *metric, double baseline, double current);
+static int GetField(const char *line, const char *key, char *buf, int size);
+static char *CopyString(System *sys, const char *str);
+static const char *EngineName(EngineType engine);
+static long FileSize(const char *path);
+static int CompareTimes(const void *p1, const void *p2);
+static void MyInfo(System *sys, const char *fmt, va_list ap);
+static void MyError(System *sys, const char *fmt, va_list ap);
+static SystemOps myOps = {
+    MyInfo,
+    MyError
+};
+
+/* benchmark settings */
+static EngineType engine = ENGINE_DEFAULT;
+static const char *compiler = "xbcom";
+static const char *compilerFlags = "";
+static const char *includePath = NULL;
+static const char *board = NULL;
+static BoardConfig *config = NULL;
+static int timing = FALSE;
+static int runs = 5;
+static double threshold = DEF_THRESHOLD;
+
+/* program whose output is being watched for its stop text */
+static Interpreter *running = NULL;
+static const char *stopText = NULL;
+static int stopped;
+static char window[MAX_STOP * 2 + 1];
+static int windowCount;
+
+static BenchProgram programs[MAX_PROGRAMS];
+static BaselineProgram baseline[MAX_PROGRAMS];
+
+int main(int argc, char *argv[])
+{
+    char *listfile = NULL, *jsonfile = NULL, *baselinefile = NULL, *p;
+    int count, baselineCount = 0, regressions = 0;
+    System *sys;
+    int j;
+
+    /* get the arguments */
+    for (j = 1; j < argc; ++j) {
+
+        /* handle switches */
+        if (argv[j][0] == '-') {
+            switch (argv[j][1]) {
+            case 'e':   // select an execution engine
+                if (argv[j][2])
+                    p = &argv[j][2];
+                else if (++j < argc)
+                    p = argv[j];
+                else
+                    Usage();
+                if (strcmp(p, "switch") == 0)
+                    engine = ENGINE_SWITCH;
+#ifdef USE_THREADED_DISPATCH
+                else if (strcmp(p, "threaded") == 0)
+                    engine = ENGINE_THREADED;
+                else if (strcmp(p, "decoded") == 0)
+                    engine = ENGINE_DECODED;
+                else if (strcmp(p, "jit") == 0)
+                    engine = ENGINE_JIT;
+#endif
+                else
+                    Usage();
+                break;
+            case 'n':   // number of timed runs
+                if (argv[j][2])
+                    p = &argv[j][2];
+                else if (++j < argc)
+                    p = argv[j];
+                else
+                    Usage();
+                if ((runs = atoi(p)) < 1 || runs > MAX_RUNS)
+                    Usage();
+                break;
+            case 'T':   // estimate the run time on the propeller
+                timing = TRUE;
+                break;
+            case 'b':   // select the board for the run time estimate
+                if (argv[j][2])
+                    board = &argv[j][2];
+                else if (++j < argc)
+                    board = argv[j];
+                else
+                    Usage();
+                timing = TRUE;
+                break;
+            case 'X':   // compiler to use
+                if (argv[j][2])
+                    compiler = &argv[j][2];
+                else if (++j < argc)
+                    compiler = argv[j];
+                else
+                    Usage();
+                break;
+            case 'F':   // compiler options
+                if (argv[j][2])
+                    compilerFlags = &argv[j][2];
+                else if (++j < argc)
+                    compilerFlags = argv[j];
+                else
+                    Usage();
+                break;
+            case 'I':   // set the path for include files and xbasic.cfg
+                if (argv[j][2])
+                    includePath = &argv[j][2];
+                else if (++j < argc)
+                    includePath = argv[j];
+                else
+                    Usage();
+                xbAddToPath(includePath);
+                break;
+            case 'o':   // write the results as JSON
+                if (argv[j][2])
+                    jsonfile = &argv[j][2];
+                else if (++j < argc)
+                    jsonfile = argv[j];
+                else
+                    Usage();
+                break;
+            case 'B':   // compare the results with a baseline
+                if (argv[j][2])
+                    baselinefile = &argv[j][2];
+                else if (++j < argc)
+                    baselinefile = argv[j];
+                else
+                    Usage();
+                break;
+            case 't':   // regression threshold
+                if (argv[j][2])
+                    p = &argv[j][2];
+                else if (++j < argc)
+                    p = argv[j];
+                else
+                    Usage();
+                threshold = atof(p);
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+
+        /* handle the list filename */
+        else {
+            if (listfile)
+                Usage();
+            listfile = argv[j];
+        }
+    }
+
+    /* make sure a list file was specified */
+    if (!listfile)
+        Usage();
+
+    sys = MemInit();
+    sys->ops = &myOps;
+
+    /* the run time estimate uses the clock and cache of the board */
+    if (board) {
+        xbAddEnvironmentPath();
+        ParseConfigurationFile(sys, "xbasic.cfg");
+        if (!(config = GetBoardConfig(board)))
+            Fatal(sys, "no board type: %s", board);
+    }
+
+    /* read the baseline first so a bad path doesn't waste a run */
+    if (baselinefile && (baselineCount = ReadBaseline(baselinefile, baseline)) < 0)
+        Fatal(sys, "can't read baseline '%s'", baselinefile);
+
+    /* benchmark each program */
+    count = ReadList(sys, listfile, programs);
+    for (j = 0; j < count; ++j)
+        BenchmarkProgram(sys, &programs[j]);
+
+    ShowResults(sys, programs, count);
+    if (jsonfile && !WriteJSON(programs, count, jsonfile))
+        Fatal(sys, "can't write results '%s'", jsonfile);
+    if (baselinefile)
+        regressions = CompareResults(sys, programs, count, baseline, baselineCount, baselinefile);
+
+    /* failures and regressions fail the benchmark */
+    for (j = 0; j < count; ++j)
+        if (programs[j].error)
+            return 1;
+    return regressions ? 1 : 0;
+}
+
+/* Usage - display a usage message and exit */
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbperf\n\
+         [ -e <engine> ] select the execution engine (switch | threaded | decoded | jit) (default is %s)\n\
+         [ -n <runs> ]   time each program this many times (default is 5)\n\
+         [ -T ]          estimate the run time on the propeller\n\
+         [ -b <board> ]  estimate the run time with the clock and cache of a board (implies -T)\n\
+         [ -X <path> ]   compiler to use (default is xbcom)\n\
+         [ -F <flags> ]  options to pass to the compiler (e.g. \"-O2 -V\")\n\
+         [ -I <path> ]   set the path for include files and xbasic.cfg\n\
+         [ -o <file> ]   write the results to a JSON file\n\
+         [ -B <file> ]   compare the results with the JSON file of an earlier run\n\
+         [ -t <pct> ]    percentage by which a result must be worse to fail the comparison (default is 5)\n\
+         <name>          list of programs (lines of file [text that stops it])\n\
+", EngineName(ENGINE_DEFAULT));
+    exit(1);
+}
+
+/* ReadList - read the list of programs (paths are relative to the directory of the list) */
+static int ReadList(System *sys, const char *path, BenchProgram *programs)
+{
+    char line[MAX_LINE], file[MAX_LINE], *dirEnd, *p, *end;
+    int dirLength, count = 0;
+    BenchProgram *b;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r")))
+        Fatal(sys, "can't open '%s'", path);
+
+    /* find the directory of the list */
+    if ((dirEnd = strrchr(path, '/')) != NULL || (dirEnd = strrchr(path, '\\')) != NULL)
+        dirLength = dirEnd - path + 1;
+    else
+        dirLength = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+
+        /* skip blank lines and comments */
+        for (p = line; *p == ' ' || *p == '\t'; ++p)
+            ;
+        if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#')
+            continue;
+
+        /* trim the end of the line */
+        for (end = p + strlen(p); end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'); --end)
+            ;
+        *end = '\0';
+
+        if (count >= MAX_PROGRAMS)
+            Fatal(sys, "too many programs in '%s'", path);
+        b = &programs[count++];
+        memset(b, 0, sizeof(BenchProgram));
+
+        /* get the file name and the stop text that follows it */
+        for (end = p; *end && *end != ' ' && *end != '\t'; ++end)
+            ;
+        if (*end) {
+            *end++ = '\0';
+            while (*end == ' ' || *end == '\t')
+                ++end;
+            if (strlen(end) > MAX_STOP)
+                Fatal(sys, "stop text for '%s' is longer than %d characters", p, MAX_STOP);
+            b->stop = CopyString(sys, end);
+        }
+        if (dirLength + strlen(p) >= sizeof(file))
+            Fatal(sys, "file name too long: %s", p);
+        memcpy(file, path, dirLength);
+        strcpy(&file[dirLength], p);
+        b->name = CopyString(sys, p);
+        b->path = CopyString(sys, file);
+    }
+
+    fclose(fp);
+    return count;
+}
+
+/* BenchmarkProgram - compile a program, count what it executes and time it */
+static void BenchmarkProgram(System *sys, BenchProgram *b)
+{
+    char image[MAX_LINE], *p;
+
+    xbInfo(sys, "%s\n", b->name);
+
+    /* the compiler writes the image next to the source */
+    strcpy(image, b->path);
+    if ((p = strrchr(image, '.')) != NULL && !strchr(p, '/') && !strchr(p, '\\'))
+        *p = '\0';
+    strcat(image, ".bai");
+
+    if (!CompileProgram(b))
+        b->error = "compile failed";
+    else if ((b->imageSize = FileSize(image)) < 0)
+        b->error = "no image";
+    else if (!MeasureProgram(b, image))
+        b->error = "profiled run failed";
+    else if (!TimeProgram(b, image))
+        b->error = "timed run failed";
+}
+
+/* CompileProgram - compile a program with xbcom (its own directory is searched for includes first) */
+static int CompileProgram(BenchProgram *b)
+{
+    char command[MAX_LINE * 4], dir[MAX_LINE], *end;
+
+    if (strlen(compiler) + strlen(compilerFlags) + 2 * strlen(b->path) + (includePath ? strlen(includePath) : 0) + 32 > sizeof(command))
+        return FALSE;
+
+    strcpy(dir, b->path);
+    if ((end = strrchr(dir, '/')) != NULL || (end = strrchr(dir, '\\')) != NULL)
+        *end = '\0';
+    else
+        strcpy(dir, ".");
+
+    sprintf(command, "\"%s\" %s -I \"%s\"", compiler, compilerFlags, dir);
+    if (includePath)
+        sprintf(&command[strlen(command)], " -I \"%s\"", includePath);
+    sprintf(&command[strlen(command)], " \"%s\"", b->path);
+    return system(command) == 0;
+}
+
+/* MeasureProgram - run a program under the profile and the run time estimate */
+static int MeasureProgram(BenchProgram *b, const char *path)
+{
+    ImageHdr *image;
+    Interpreter *i;
+    System *sys;
+    int result;
+
+    sys = MemInit();
+    sys->ops = &myOps;
+
+    if (!(image = LoadImage(sys, path, 0)))
+        Fatal(sys, "can't load image '%s'", path);
+    if (!(i = InitInterpreter(sys, image)))
+        Fatal(sys, "insufficient memory");
+    b->codeSize = FindCodeSection(image)->fileSection->size;
+
+    if (!(i->profile = InitProfile(sys, image)))
+        Fatal(sys, "insufficient memory for profile");
+    if (timing && !(i->clock = InitClock(sys, config)))
+        Fatal(sys, "insufficient memory for the run time estimate");
+    if (!(i->pins = InitPins(sys, ClockFrequency(i), NULL, NULL)))
+        Fatal(sys, "can't setup the pins");
+
+    result = RunProgram(i, image, b->stop);
+    b->instructions = i->profile->total;
+    if (timing)
+        b->cycles = ClockCycles(i);
+
+    ClosePins(i);
+    ReleaseRegisters(i);
+    MemFree(sys);
+    return result;
+}
+
+/* TimeProgram - time the runs of a program with the selected engine */
+static int TimeProgram(BenchProgram *b, const char *path)
+{
+    unsigned long times[MAX_RUNS], start;
+    ImageHdr *image;
+    Interpreter *i;
+    System *sys;
+    int result, run;
+
+    for (run = 0; run < runs; ++run) {
+        sys = MemInit();
+        sys->ops = &myOps;
+
+        /* decoding the image is part of loading it so it isn't timed */
+        if (!(image = LoadImage(sys, path, engine == ENGINE_DECODED || engine == ENGINE_JIT ? LOAD_PREDECODE : 0)))
+            Fatal(sys, "can't load image '%s'", path);
+        if (!(i = InitInterpreter(sys, image)))
+            Fatal(sys, "insufficient memory");
+        i->engine = engine;
+        if (!(i->pins = InitPins(sys, ClockFrequency(i), NULL, NULL)))
+            Fatal(sys, "can't setup the pins");
+
+        start = xbGetMicroseconds();
+        result = RunProgram(i, image, b->stop);
+        times[run] = xbGetMicroseconds() - start;
+
+        ClosePins(i);
+        ReleaseRegisters(i);
+        MemFree(sys);
+        if (!result)
+            return FALSE;
+    }
+
+    qsort(times, runs, sizeof(unsigned long), CompareTimes);
+    b->wallMin = times[0];
+    b->wallMedian = runs & 1 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    return TRUE;
+}
+
+/* RunProgram - run a program until it halts or prints its stop text */
+static int RunProgram(Interpreter *i, ImageHdr *image, const char *stop)
+{
+    int result;
+    running = i;
+    stopText = stop;
+    stopped = FALSE;
+    windowCount = 0;
+    result = Execute(i, image);
+    running = NULL;
+    return result || stopped;
+}
+
+/* ShowResults - show the results of the benchmark */
+static void ShowResults(System *sys, BenchProgram *programs, int count)
+{
+    BenchProgram *b;
+    int j;
+
+    xbInfo(sys, "\n%s engine, %d runs, compiled with '%s'\n", EngineName(engine), runs, compilerFlags);
+    xbInfo(sys, "%-20s %8s %8s %14s %14s %12s %12s\n", "program", "image", "code", "instructions", "cycles", "median us", "min us");
+    for (j = 0; j < count; ++j) {
+        b = &programs[j];
+        if (b->error)
+            xbInfo(sys, "%-20s %s\n", b->name, b->error);
+        else if (timing)
+            xbInfo(sys, "%-20s %8ld %8lu %14llu %14llu %12lu %12lu\n", b->name, b->imageSize, (unsigned long)b->codeSize,
+                   (unsigned long long)b->instructions, (unsigned long long)b->cycles, b->wallMedian, b->wallMin);
+        else
+            xbInfo(sys, "%-20s %8ld %8lu %14llu %14s %12lu %12lu\n", b->name, b->imageSize, (unsigned long)b->codeSize,
+                   (unsigned long long)b->instructions, "-", b->wallMedian, b->wallMin);
+    }
+}
+
+/* WriteJSON - write the results as JSON (one program to a line so the baseline reader stays simple) */
+static int WriteJSON(BenchProgram *programs, int count, const char *path)
+{
+    BenchProgram *b;
+    FILE *fp;
+    int j;
+
+    if (!(fp = fopen(path, "w")))
+        return FALSE;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"engine\": \"%s\",\n", EngineName(engine));
+    fprintf(fp, "  \"compiler\": \"%s\",\n", compilerFlags);
+    fprintf(fp, "  \"runs\": %d,\n", runs);
+    if (timing)
+        fprintf(fp, "  \"board\": \"%s\",\n", board ? board : "default");
+    fprintf(fp, "  \"programs\": [\n");
+    for (j = 0; j < count; ++j) {
+        b = &programs[j];
+        fprintf(fp, "    { \"name\": \"%s\"", b->name);
+        if (b->error)
+            fprintf(fp, ", \"error\": \"%s\"", b->error);
+        else {
+            fprintf(fp, ", \"image\": %ld, \"code\": %lu", b->imageSize, (unsigned long)b->codeSize);
+            fprintf(fp, ", \"instructions\": %llu", (unsigned long long)b->instructions);
+            if (timing)
+                fprintf(fp, ", \"cycles\": %llu", (unsigned long long)b->cycles);
+            fprintf(fp, ", \"wall_us\": %lu, \"wall_min_us\": %lu", b->wallMedian, b->wallMin);
+        }
+        fprintf(fp, " }%s\n", j < count - 1 ? "," : "");
+    }
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+
+    fclose(fp);
+    return TRUE;
+}
+
+/* ReadBaseline - read the programs of a JSON file written by WriteJSON (returns -1 if it can't be read) */
+static int ReadBaseline(const char *path, BaselineProgram *baseline)
+{
+    char line[MAX_LINE], value[MAX_LINE];
+    BaselineProgram *b;
+    int count = 0;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r")))
+        return -1;
+
+    while (count < MAX_PROGRAMS && fgets(line, sizeof(line), fp)) {
+
+        /* programs that failed have no results to compare */
+        if (!GetField(line, "name", value, sizeof(value)) || GetField(line, "error", NULL, 0))
+            continue;
+
+        b = &baseline[count++];
+        strcpy(b->name, value);
+        b->imageSize = GetField(line, "image", value, sizeof(value)) ? atof(value) : 0;
+        b->codeSize = GetField(line, "code", value, sizeof(value)) ? atof(value) : 0;
+        b->instructions = GetField(line, "instructions", value, sizeof(value)) ? atof(value) : 0;
+        b->cycles = GetField(line, "cycles", value, sizeof(value)) ? atof(value) : -1;
+        b->wallMedian = GetField(line, "wall_us", value, sizeof(value)) ? atof(value) : 0;
+    }
+
+    fclose(fp);
+    return count;
+}
+
+/* CompareResults - compare the results with a baseline (returns the number of regressions) */
+static int CompareResults(System *sys, BenchProgram *programs, int count, BaselineProgram *baseline, int baselineCount, const char *path)
+{
+    int regressions = 0, j, k;
+    BaselineProgram *base;
+    BenchProgram *b;
+
+    xbInfo(sys, "\ncompared with %s (worse by more than %g%% is a regression)\n", path, threshold);
+    xbInfo(sys, "%-20s %-14s %14s %14s %9s\n", "program", "", "baseline", "current", "change");
+    for (j = 0; j < count; ++j) {
+        b = &programs[j];
+        if (b->error)
+            continue;
+        for (k = 0; k < baselineCount && strcmp(baseline[k].name, b->name) != 0; ++k)
+            ;
+        if (k >= baselineCount) {
+            xbInfo(sys, "%-20s not in the baseline\n", b->name);
+            continue;
+        }
+        base = &baseline[k];
+        regressions += CompareResult(sys, b->name, "image", base->imageSize, (double)b->imageSize);
+        regressions += CompareResult(sys, b->name, "code", base->codeSize, (double)b->codeSize);
+        regressions += CompareResult(sys, b->name, "instructions", base->instructions, (double)b->instructions);
+        if (timing && base->cycles >= 0)
+            regressions += CompareResult(sys, b->name, "cycles", base->cycles, (double)b->cycles);
+        regressions += CompareResult(sys, b->name, "wall us", base->wallMedian, (double)b->wallMedian);
+    }
+
+    if (regressions)
+        xbInfo(sys, "%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    else
+        xbInfo(sys, "no regressions\n");
+    return regressions;
+}
+
+/* CompareResult - compare one result with its baseline (returns TRUE if it's a regression) */
+static int CompareResult(System *sys, const char *name, const char *metric, double baseline, double current)
+{
+    double change = baseline > 0 ? (current - baseline) * 100.0 / baseline : 0.0;
+    int regression = change > threshold;
+    xbInfo(sys, "%-20s %-14s %14.0f %14.0f %+8.1f%%%s\n", name, metric, baseline, current, change, regression ? "  REGRESSION" : "");
+    return regression;
+}
+
+/* GetField - get the value of a field from a line of JSON (buf can be NULL to test for the field) */
+static int GetField(const char *line, const char *key, char *buf, int size)
+{
+    char pattern[MAX_LINE];
+    const char *p, *end;
+
+    sprintf(pattern, "\"%s\":", key);
+    if (!(p = strstr(line, pattern)))
+        return FALSE;
+    for (p += strlen(pattern); *p == ' '; ++p)
+        ;
+
+    /* strings are quoted and numbers end at the next delimiter */
+    if (*p == '"') {
+        for (end = ++p; *end && *end != '"'; ++end)
+            ;
+    }
+    else {
+        for (end = p; *end && *end != ',' && *end != ' ' && *end != '}'; ++end)
+            ;
+    }
+
+    if (buf) {
+        if (end - p >= size)
+            return FALSE;
+        memcpy(buf, p, end - p);
+        buf[end - p] = '\0';
+    }
+    return TRUE;
+}
+
+/* CopyString - make a copy of a string in the global heap */
+static char *CopyString(System *sys, const char *str)
+{
+    char *copy;
+    if (!(copy = (char *)xbGlobalAlloc(sys, strlen(str) + 1)))
+        Fatal(sys, "insufficient memory");
+    strcpy(copy, str);
+    return copy;
+}
+
+static const char *EngineName(EngineType engine)
+{
+    switch (engine) {
+    case ENGINE_THREADED:
+        return "threaded";
+    case ENGINE_DECODED:
+        return "decoded";
+    case ENGINE_JIT:
+        return "jit";
+    default:
+        return "switch";
+    }
+}
+
+/* FileSize - get the size of a file (returns -1 if it can't be opened) */
+static long FileSize(const char *path)
+{
+    long size;
+    FILE *fp;
+    if (!(fp = fopen(path, "rb")))
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static int CompareTimes(const void *p1, const void *p2)
+{
+    unsigned long t1 = *(const unsigned long *)p1;
+    unsigned long t2 = *(const unsigned long *)p2;
+    return t1 < t2 ? -1 : t1 > t2 ? 1 : 0;
+}
+
+/* the programs have no input and their output is only watched for the stop text */
+
+void VM_getline(char *buf, int size)
+{
+    if (size > 0)
+        *buf = '\0';
+}
+
+int VM_getchar(void)
+{
+    return -1;
+}
+
+void VM_putchar(int ch)
+{
+    char c = ch;
+    VM_write(&c, 1);
+}
+
+/* VM_write - watch the output for the stop text and stop the program when it appears
+   (the stop text must be printed by the main code since the cogs run in threads of their own) */
+void VM_write(const char *buf, int size)
+{
+    int length;
+
+    if (!stopText || stopped)
+        return;
+    length = strlen(stopText);
+
+    /* keep the last characters of the output so the text can span writes */
+    while (--size >= 0) {
+        if (windowCount >= (int)sizeof(window) - 1) {
+            memmove(window, &window[windowCount - length], length);
+            windowCount = length;
+        }
+        window[windowCount++] = *buf++;
+        if (windowCount >= length && memcmp(&window[windowCount - length], stopText, length) == 0) {
+            stopped = TRUE;
+            longjmp(running->errorTarget, 1);
+        }
+    }
+}
+
+static void MyInfo(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stdout, fmt, ap);
+}
+
+static void MyError(System *sys, const char *fmt, va_list ap)
+{
+    vfprintf(stderr, fmt, ap);
+}
+
+void Fatal(System *sys, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    xbError(sys, "error: ");
+    xbErrorV(sys, fmt, ap);
+    xbError(sys, "\n");
+    va_end(ap);
+    exit(1);
+}
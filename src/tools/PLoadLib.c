@@ -37,6 +37,15 @@
 #include "PLoadLib.h"
 #include "osint.h"
 
+// upload write size and the baud rate the ROM loader is run at
+#define UPLOAD_CHUNK            1024
+#define UPLOAD_BAUD_RATE        115200
+
+// checksum ack polling in milliseconds
+#define UPLOAD_ACK_POLL         10
+#define UPLOAD_ACK_POLL_MAX     80
+#define UPLOAD_ACK_TIMEOUT      10000
+
 uint8_t LFSR = 80; // 'P'
 int iterate(void)
 {
@@ -66,12 +75,12 @@ int getBit(int* status)
  * @param status - pointer to transaction status 0 on error
  * @returns bit state 1 or 0
  */
-int getAck(int* status)
+int getAck(int* status, int timeout)
 {
     uint8_t mybuf[2];
-    int rc = rx(mybuf, 1);
+    int rc = rx_timeout(mybuf, 1, timeout);
     if(status)
-        *status = rc;
+        *status = rc <= 0 ? 0 : 1;
     return *mybuf & 1;
 }
 
@@ -134,20 +143,6 @@ int sendlong(uint32_t data)
     return tx(mybuf, 11);
 }
 
-/**
- * encodelong ... encode a long word to buffer for propeller
- * @param hSerial - file handle to serial port
- * @param data - value to send
- * @param bigbuf - buffer for encode ... user controls size
- * @param position - buffer position for encode
- * @returns next position for bigbuf
- */
-int encodelong(uint32_t data, uint8_t* bigbuf, int position)
-{
-    makelong(data, bigbuf);
-    return position+11;
-}
-
 /**
  * hwfind ... find propeller using sync-up sequence.
  * @param hSerial - file handle to serial port
@@ -224,10 +219,23 @@ int findprop(char* port)
     return version != 0 ? 0 : 1;
 }
 
+/**
+ * encodelong ... encode a long word to buffer for propeller
+ * @param data - value to send
+ * @param bigbuf - buffer for encode ... user controls size
+ * @param position - buffer position for encode
+ * @returns next position for bigbuf
+ */
+int encodelong(uint32_t data, uint8_t* bigbuf, int position)
+{
+    makelong(data, &bigbuf[position]);
+    return position+11;
+}
+
 /**
  * Upload file image to propeller on port.
  * A successful call to findprop must be completed before calling this function.
- * @param hSerial - file handle to serial port
+ * The whole download is encoded first and sent in UPLOAD_CHUNK byte writes.
  * @param dlbuf - pointer to file buffer
  * @param count - number of bytes in image
  * @param type - type of upload
@@ -237,64 +245,60 @@ int upload(uint8_t* dlbuf, int count, int type)
 {
     int  n  = 0;
     int  rc = 0;
-    int  wv = 100;
+    int  to = UPLOAD_ACK_POLL;
+    int  elapsed = 0;
+    int  position = 0;
     uint32_t data = 0;
+    uint8_t buf[1];
 
-    int  sendone = 1; // send one at a time ... Propeller can't handle a bigbuf blast.
-    int  position = 0;
     int  longcount = count/4;
 
     uint8_t* bigbuf;
 
-    // send type
-    if(sendlong(type) == 0) {
-        printf("sendlong type failed.\n");
+    // encode the type, the count and the image
+    bigbuf = (uint8_t*)malloc((longcount+2)*11);
+    if(!bigbuf) {
+        printf("no memory for upload buffer.\n");
         return 1;
     }
-
-    // send count
-    if(sendlong(longcount) == 0) {
-        printf("sendlong count failed.\n");
-        return 1;
+    position = encodelong(type, bigbuf, position);
+    position = encodelong(longcount, bigbuf, position);
+    for(n = 0; n < longcount*4; n+=4) {
+        data = dlbuf[n] | (dlbuf[n+1] << 8) | (dlbuf[n+2] << 16) | ((uint32_t)dlbuf[n+3] << 24) ;
+        position = encodelong(data, bigbuf, position);
     }
-    //if(1) {
-    //} else position = encodelong(longcount, bigbuf, position);
 
     printf("Writing %d bytes to %s.\n",count,(type == DOWNLOAD_RUN_BINARY) ? "Propeller RAM":"EEPROM");
-    //msleep(100);
-
-    bigbuf = (uint8_t*)malloc(count*11+1); // for encodelong -> tx bigbuf only.
-
-    for(n = 0; n < count; n+=4) {
-        //printf("%d ",n);
-        data = dlbuf[n] | (dlbuf[n+1] << 8) | (dlbuf[n+2] << 16) | (dlbuf[n+3] << 24) ;
-        if(sendone) {
-            if(sendlong(data) == 0) {
-                printf("sendlong error");
-                free(bigbuf);
-                return 1;
-            }
+
+    for(n = 0; n < position; n += rc) {
+        rc = position-n < UPLOAD_CHUNK ? position-n : UPLOAD_CHUNK;
+        if(tx(&bigbuf[n], rc) != rc) {
+            printf("upload write error.\n");
+            free(bigbuf);
+            return 1;
         }
-        else position = encodelong(data, bigbuf, position);
-        //if(n % 0x40 == 0) putchar('.');
     }
-    if(!sendone) tx(bigbuf, position);
+    free(bigbuf);
 
-    msleep(150);                // wait for checksum calculation on Propeller ... 95ms is minimum
-    sendlong(0xF9);
+    // writes return once the bytes are queued so wait for them to go out
+    msleep(position*10/(UPLOAD_BAUD_RATE/1000) + 1);
+
+    buf[0] = 0xF9;              // need to send this to get Propeller to send the ack
 
     printf("Verifying ... ");
     fflush(stdout);
 
-    for(n = 0; n < wv; n++) {
-        msleep(25);
-        getAck(&rc);
-        if(rc) break;
+    // the checksum takes about 95ms so poll quickly at first and then back off
+    for(rc = 0; !rc && elapsed < UPLOAD_ACK_TIMEOUT; ) {
+        tx(buf, 1);
+        getAck(&rc, to);
+        elapsed += to;
+        if(to*2 <= UPLOAD_ACK_POLL_MAX)
+            to *= 2;
     }
-    if(n >= wv) printf("Upload Timeout Error!\n");
-    else        printf("Upload OK!\n");
+    if(!rc) printf("Upload Timeout Error!\n");
+    else    printf("Upload OK!\n");
 
-    free(bigbuf);
     return 0;
 }
 
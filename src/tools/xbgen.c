@@ -0,0 +1,257 @@
+/* xbgen.c - generate a synthetic xbasic program for benchmarking the compiler
+ *
+ * The program is a main file and a chain of include files, each one including
+ * the next.  The functions are spread over the chain with the deepest file
+ * holding the first ones so every call is to a function that is already
+ * defined.  The same options always generate the same program.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* generation settings */
+static int functions = 1000;    /* functions with ordinary bodies */
+static int depth = 10;          /* include files in the chain */
+static int selects = 10;        /* functions with a SELECT */
+static int cases = 100;         /* CASE clauses in each SELECT */
+static int arrays = 10;         /* arrays with initializers */
+static int elements = 1000;     /* elements in each initializer */
+static unsigned long seed = 1;
+
+static void Usage(void);
+static void GenerateFile(const char *base, const char *name, int level);
+static void GenerateFunction(FILE *fp, int n);
+static void GenerateSelect(FILE *fp, int n);
+static void GenerateArray(FILE *fp, int n);
+static void GenerateMain(FILE *fp);
+static int First(int count, int level);
+static int Random(int range);
+static int GetCount(int argc, char *argv[], int *pi);
+
+int main(int argc, char *argv[])
+{
+    char *base = NULL, *name;
+    int i;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            switch (argv[i][1]) {
+            case 'f':
+                functions = GetCount(argc, argv, &i);
+                break;
+            case 'd':
+                depth = GetCount(argc, argv, &i);
+                break;
+            case 's':
+                selects = GetCount(argc, argv, &i);
+                break;
+            case 'c':
+                cases = GetCount(argc, argv, &i);
+                break;
+            case 'a':
+                arrays = GetCount(argc, argv, &i);
+                break;
+            case 'e':
+                elements = GetCount(argc, argv, &i);
+                break;
+            case 'r':
+                seed = GetCount(argc, argv, &i);
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+        else {
+            if (base)
+                Usage();
+            base = argv[i];
+        }
+    }
+
+    if (!base || cases < 1 || elements < 1)
+        Usage();
+
+    /* the include statements name the files without the directory */
+    if ((name = strrchr(base, '/')) != NULL || (name = strrchr(base, '\\')) != NULL)
+        ++name;
+    else
+        name = base;
+
+    for (i = 0; i <= depth; ++i)
+        GenerateFile(base, name, i);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: xbgen\n\
+         [ -f <n> ]      number of functions (default is 1000)\n\
+         [ -d <n> ]      number of files in the include chain (default is 10)\n\
+         [ -s <n> ]      number of functions with a SELECT (default is 10)\n\
+         [ -c <n> ]      number of cases in each SELECT (default is 100)\n\
+         [ -a <n> ]      number of arrays with initializers (default is 10)\n\
+         [ -e <n> ]      number of elements in each initializer (default is 1000)\n\
+         [ -r <n> ]      seed for the generated constants (default is 1)\n\
+         <name>          path of the main file without the .bas (the includes are name_1.bas ...)\n\
+");
+    exit(1);
+}
+
+/* GenerateFile - generate the main file (level 0) or one of the include files */
+static void GenerateFile(const char *base, const char *name, int level)
+{
+    char path[256];
+    FILE *fp;
+    int n;
+
+    if (strlen(base) + 16 > sizeof(path)) {
+        fprintf(stderr, "error: name too long: %s\n", base);
+        exit(1);
+    }
+    if (level == 0)
+        sprintf(path, "%s.bas", base);
+    else
+        sprintf(path, "%s_%d.bas", base, level);
+
+    if (!(fp = fopen(path, "w"))) {
+        fprintf(stderr, "error: can't create: %s\n", path);
+        exit(1);
+    }
+
+    fprintf(fp, "REM %s - generated by xbgen\n\n", path + strlen(base) - strlen(name));
+    if (level == 0)
+        fprintf(fp, "include \"print.bas\"\n");
+    if (level < depth)
+        fprintf(fp, "include \"%s_%d.bas\"\n", name, level + 1);
+    fprintf(fp, "\n");
+
+    /* each level gets its share of the functions, selects and arrays */
+    for (n = First(arrays, level); n < First(arrays, level - 1); ++n)
+        GenerateArray(fp, n);
+    for (n = First(functions, level); n < First(functions, level - 1); ++n)
+        GenerateFunction(fp, n);
+    for (n = First(selects, level); n < First(selects, level - 1); ++n)
+        GenerateSelect(fp, n);
+
+    if (level == 0)
+        GenerateMain(fp);
+
+    fclose(fp);
+}
+
+/* GenerateFunction - generate a function with locals, a loop, a condition and a call */
+static void GenerateFunction(FILE *fp, int n)
+{
+    fprintf(fp, "def K%d = %d\n\n", n, Random(1000));
+    fprintf(fp, "def f%d(a, b)\n", n);
+    fprintf(fp, "    dim t = a + K%d\n", n);
+    fprintf(fp, "    dim j\n");
+    fprintf(fp, "    for j = 1 to b\n");
+    fprintf(fp, "        t = t + (j * %d) - (a / %d)\n", Random(10) + 1, Random(10) + 1);
+    fprintf(fp, "    next j\n");
+    fprintf(fp, "    if t > %d then\n", Random(10000));
+    if (n > 0)
+        fprintf(fp, "        t = t - f%d(a, 1)\n", Random(n));
+    else
+        fprintf(fp, "        t = t - 1\n");
+    fprintf(fp, "    else if t < 0 then\n");
+    fprintf(fp, "        t = -t\n");
+    fprintf(fp, "    else\n");
+    fprintf(fp, "        t = (t << 1) & 0xffff\n");
+    fprintf(fp, "    end if\n");
+    fprintf(fp, "    return t\n");
+    fprintf(fp, "end def\n\n");
+}
+
+/* GenerateSelect - generate a function with a SELECT of single values, value lists and ranges */
+static void GenerateSelect(FILE *fp, int n)
+{
+    int i, value = 0;
+    fprintf(fp, "def sel%d(x)\n", n);
+    fprintf(fp, "    select x\n");
+    for (i = 0; i < cases; ++i) {
+        switch (i % 3) {
+        case 0:
+            fprintf(fp, "    case %d\n", value);
+            value += 1;
+            break;
+        case 1:
+            fprintf(fp, "    case %d, %d\n", value, value + 2);
+            value += 3;
+            break;
+        default:
+            fprintf(fp, "    case %d to %d\n", value, value + 4);
+            value += 5;
+            break;
+        }
+        fprintf(fp, "        return %d\n", Random(1000));
+    }
+    fprintf(fp, "    case else\n");
+    fprintf(fp, "        return -1\n");
+    fprintf(fp, "    end select\n");
+    fprintf(fp, "end def\n\n");
+}
+
+/* GenerateArray - generate an array in the text section with an initializer (ten values to a line) */
+static void GenerateArray(FILE *fp, int n)
+{
+    int i;
+    fprintf(fp, "dim tbl%d(%d) in \"text\" = {\n", n, elements);
+    for (i = 0; i < elements; ++i) {
+        if (i % 10 == 0)
+            fprintf(fp, "   ");
+        fprintf(fp, " %d%s", Random(100000) - 50000, i % 10 != 9 && i < elements - 1 ? "," : "");
+        if (i % 10 == 9 || i == elements - 1)
+            fprintf(fp, "\n");
+    }
+    fprintf(fp, "}\n\n");
+}
+
+/* GenerateMain - generate the main code that uses a few of everything */
+static void GenerateMain(FILE *fp)
+{
+    int i;
+    fprintf(fp, "dim total = 0\n");
+    for (i = 0; i < functions && i < 10; ++i)
+        fprintf(fp, "total = total + f%d(%d, %d)\n", Random(functions), Random(100), Random(10));
+    for (i = 0; i < selects && i < 10; ++i)
+        fprintf(fp, "total = total + sel%d(%d)\n", Random(selects), Random(cases * 3));
+    for (i = 0; i < arrays && i < 10; ++i)
+        fprintf(fp, "total = total + tbl%d(%d)\n", Random(arrays), Random(elements));
+    fprintf(fp, "print total\n");
+}
+
+/* First - get the index of the first of count things in a level (the deepest level comes first) */
+static int First(int count, int level)
+{
+    if (level < 0)
+        return count;
+    return (int)((long)count * (depth - level) / (depth + 1));
+}
+
+/* Random - get a pseudo random number from 0 to range - 1 */
+static int Random(int range)
+{
+    seed = (seed * 1103515245 + 12345) & 0xffffffff;
+    return (int)((seed >> 8) % range);
+}
+
+static int GetCount(int argc, char *argv[], int *pi)
+{
+    char *p;
+    if (argv[*pi][2])
+        p = &argv[*pi][2];
+    else if (++*pi < argc)
+        p = argv[*pi];
+    else
+        Usage();
+    if (*p < '0' || *p > '9')
+        Usage();
+    return atoi(p);
+}
@@ -2,9 +2,24 @@
 #include "PortListener.h"
 #include <QtDebug>
 
+/* milliseconds between terminal updates and the most received bytes kept for one */
+#define UPDATE_INTERVAL 40
+#define RX_BUFFER_MAX   (64*1024)
+
+/* milliseconds between writes while bytes are waiting to be sent */
+#define TX_INTERVAL     10
+
 PortListener::PortListener()
 {
     port = NULL;
+    textEditor = NULL;
+    lineDelay = 0;
+    flowControl = FLOW_OFF;
+    updateTimer.setSingleShot(true);
+    updateTimer.setInterval(UPDATE_INTERVAL);
+    connect(&updateTimer, SIGNAL(timeout()), this, SLOT(updateTerminal()));
+    txTimer.setSingleShot(true);
+    connect(&txTimer, SIGNAL(timeout()), this, SLOT(writeTx()));
 }
 
 void PortListener::init(const QString & portName, BaudRateType baud)
@@ -18,7 +33,7 @@ void PortListener::init(const QString & portName, BaudRateType baud)
     }
     this->port = new QextSerialPort(portName, QextSerialPort::EventDriven);
     port->setBaudRate(baud);
-    port->setFlowControl(FLOW_OFF);
+    port->setFlowControl(flowControl);
     port->setParity(PAR_NONE);
     port->setDataBits(DATA_8);
     port->setStopBits(STOP_1);
@@ -43,6 +58,8 @@ bool PortListener::open()
 
 void PortListener::close()
 {
+    cancelSend();
+
     if(port == NULL)
         return;
 
@@ -55,44 +72,146 @@ void PortListener::setTerminalWindow(QPlainTextEdit *editor)
     textEditor = editor;
 }
 
+/*
+ * the editor drops the oldest lines once it holds this many
+ */
+void PortListener::setMaxLines(int lines)
+{
+    if(textEditor)
+        textEditor->setMaximumBlockCount(lines);
+}
+
+void PortListener::setLineDelay(int msecs)
+{
+    lineDelay = msecs;
+}
+
+/*
+ * the driver holds back what we write while the board asks it to wait
+ */
+void PortListener::setFlowControl(FlowType flow)
+{
+    flowControl = flow;
+    if(port != NULL)
+        port->setFlowControl(flow);
+}
+
+/*
+ * queue the bytes to be written to the port behind anything already waiting
+ */
 void PortListener::send(QByteArray &data)
 {
-    port->write(data.constData(),1);
+    txBuffer.append(data);
+    if(!txTimer.isActive())
+        writeTx();
+}
+
+/*
+ * queue the lines of a file to be sent with the line delay between them so
+ * the board's input routines have time to take each one
+ */
+bool PortListener::sendFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+    while(!file.atEnd())
+        txLines.append(file.readLine());
+    file.close();
+
+    if(!txTimer.isActive())
+        writeTx();
+    return true;
+}
+
+void PortListener::cancelSend()
+{
+    txTimer.stop();
+    txBuffer.clear();
+    txLines.clear();
+}
+
+bool PortListener::isSending()
+{
+    return !txBuffer.isEmpty() || !txLines.isEmpty();
+}
+
+/*
+ * write as much as the port takes in one interval at its baud rate and
+ * keep the rest for the next one
+ */
+void PortListener::writeTx()
+{
+    if(port == NULL || !port->isOpen()) {
+        cancelSend();
+        emit sendDone();
+        return;
+    }
+
+    if(txBuffer.isEmpty() && !txLines.isEmpty())
+        txBuffer = txLines.takeFirst();
+
+    if(!txBuffer.isEmpty()) {
+        int chunk = (int)port->baudRate() / 10 * TX_INTERVAL / 1000;
+        if(chunk < 1)
+            chunk = 1;
+        qint64 count = port->write(txBuffer.constData(), qMin(chunk, txBuffer.length()));
+        if(count > 0)
+            txBuffer.remove(0, (int)count);
+    }
+
+    if(!txBuffer.isEmpty())
+        txTimer.start(TX_INTERVAL);
+    else if(!txLines.isEmpty())
+        txTimer.start(qMax(lineDelay, TX_INTERVAL));
+    else
+        emit sendDone();
 }
 
 void PortListener::onReadyRead()
 {
-    const int blen = 1024;
-    char buff[blen+1];
-    int len = port->bytesAvailable();
-    if(len > blen)
-        len = blen;
-    int ret = port->read(buff, len);
+    rxBuffer.append(port->readAll());
 
-    if(ret > -1)
+    /* the editor can't keep up with more than this between updates so drop the oldest bytes */
+    if(rxBuffer.length() > RX_BUFFER_MAX)
+        rxBuffer.remove(0, rxBuffer.length() - RX_BUFFER_MAX);
+
+    if(!updateTimer.isActive())
+        updateTimer.start();
+}
+
+/*
+ * append the bytes received since the last update at the end of the editor
+ * (each backspace removes the character before it in place)
+ */
+void PortListener::updateTerminal()
+{
+    if(!textEditor || rxBuffer.isEmpty())
+        return;
+
+    QTextCursor cursor(textEditor->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.beginEditBlock();
+
+    int start = 0;
+    for(int n = 0; n < rxBuffer.length(); n++)
     {
-        buff[ret] = '\0';
-        QString sbuff(buff);
-        if(sbuff.indexOf('\b') < 0) // if no backspace, just append buffer
-        {
-            textEditor->setPlainText(textEditor->toPlainText() + buff);
-            textEditor->moveCursor(QTextCursor::End);
-        }
-        else // if backspaces, do it the slow way.
+        if(rxBuffer.at(n) == '\b')
         {
-            for(int n = 0; n < ret; n++)
-            {
-                QString text = textEditor->toPlainText();
-                int tlen = text.length();
-                if(buff[n] == '\b')
-                    textEditor->setPlainText(text.mid(0,tlen-1));
-                else
-                    textEditor->setPlainText(text + buff[n]);
-            }
-            textEditor->moveCursor(QTextCursor::End);
+            if(n > start)
+                cursor.insertText(QString::fromLatin1(rxBuffer.constData() + start, n - start));
+            cursor.deletePreviousChar();
+            start = n + 1;
         }
-        textEditor->repaint(); // yay!
     }
+    if(rxBuffer.length() > start)
+        cursor.insertText(QString::fromLatin1(rxBuffer.constData() + start, rxBuffer.length() - start));
+
+    cursor.endEditBlock();
+    rxBuffer.clear();
+
+    textEditor->moveCursor(QTextCursor::End);
+    textEditor->ensureCursorVisible();
 }
 
 void PortListener::onDsrChanged(bool status)
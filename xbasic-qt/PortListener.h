@@ -18,15 +18,33 @@ public:
     bool open();
     void close();
     void setTerminalWindow(QPlainTextEdit *editor);
+    void setMaxLines(int lines);
+    void setLineDelay(int msecs);
+    void setFlowControl(FlowType flow);
     void send(QByteArray &data);
+    bool sendFile(const QString &fileName);
+    void cancelSend();
+    bool isSending();
 
     QextSerialPort  *port;
 
+signals:
+    void sendDone();
+
 private:
     QPlainTextEdit  *textEditor;
+    QByteArray      rxBuffer;       // received bytes waiting for the next terminal update
+    QTimer          updateTimer;    // coalesces the updates to one per frame
+    QByteArray      txBuffer;       // bytes waiting to be written to the port
+    QList<QByteArray> txLines;      // lines of a file waiting for their turn
+    QTimer          txTimer;        // paces the writes to the port
+    int             lineDelay;      // milliseconds between the lines of a file
+    FlowType        flowControl;
 
 private slots:
     void onReadyRead();
+    void updateTerminal();
+    void writeTx();
     void onDsrChanged(bool status);
 
 };
@@ -425,3 +425,18 @@ int PropellerID::findprop(const char* name)
 
     return version != 0 ? 1 : 0;
 }
+
+PropellerProbe::PropellerProbe(const QString &portName, QObject *parent) : QThread(parent)
+{
+    name = portName;
+}
+
+/*
+ * the PropellerID is made here so its port events are handled in this thread
+ */
+void PropellerProbe::run()
+{
+    PropellerID propid;
+    bool found = propid.isDevice(name) > 0;
+    emit probed(name, found);
+}
@@ -156,4 +156,28 @@ signals:
 
 };
 
+/*
+ * PropellerProbe looks for a Propeller on one port in a thread of its own
+ * so every port can be checked at once without stalling the GUI.
+ */
+class PropellerProbe : public QThread
+{
+Q_OBJECT
+public:
+    PropellerProbe(const QString &portName, QObject *parent = 0);
+
+    QString portName() {
+        return name;
+    }
+
+protected:
+    void run();
+
+signals:
+    void probed(QString portName, bool found);
+
+private:
+    QString name;
+};
+
 #endif // PROPELLERID_H
@@ -43,126 +43,147 @@
 #include "highlighter.h"
 
 //! [0]
+/*
+ * the keywords are those of ktab in db_scan.c and the words the parser
+ * looks for as identifiers (keep them in step with the compiler)
+ */
+static const char *keywordList[] = {
+    "REM", "OPTION", "INCLUDE", "DEF", "DIM", "AS", "IN", "LET", "IF", "THEN",
+    "ELSE", "SELECT", "CASE", "END", "FOR", "TO", "STEP", "NEXT", "DO", "WHILE",
+    "UNTIL", "LOOP", "GOTO", "MOD", "AND", "OR", "XOR", "NOT", "STOP", "RETURN",
+    "INPUT", "PRINT", "ASM", "COGSTART", "TASK", "YIELD", "WAITFOR",
+    "STACKSIZE", "INTEGER", "BYTE", "WORD", "FIXED", "FLOAT",
+    NULL
+};
+
+/* the registers AddRegister defines in db_compiler.c and CLKFREQ from propeller.bas */
+static const char *registerList[] = {
+    "PAR", "CNT", "INA", "INB", "OUTA", "OUTB", "DIRA", "DIRB",
+    "CTRA", "CTRB", "FRQA", "FRQB", "PHSA", "PHSB", "VCFG", "VSCL",
+    "CLKFREQ",
+    NULL
+};
+
+static bool identifierChar(QChar ch)
+{
+    return ch.isLetterOrNumber() || ch == '_';
+}
+
 Highlighter::Highlighter(QTextDocument *parent)
     : QSyntaxHighlighter(parent)
 {
-    HighlightingRule rule;
+    for(int n = 0; keywordList[n]; n++)
+        keywords.insert(keywordList[n]);
+    for(int n = 0; registerList[n]; n++)
+        registers.insert(registerList[n]);
 
     keywordFormat.setForeground(Qt::blue);
     keywordFormat.setFontWeight(QFont::Bold);
-    QStringList keywordPatterns;
-    keywordPatterns << "\\b[Ii][Nn][Cc][Ll][Uu][Dd][Ee]\\b"
-                    << "\\b[Oo][Pp][Tt][Ii][Oo][Nn]\\b"
-                    << "\\b[Ss][Tt][Aa][Cc][Kk][Ss]][Ii][Zz][Ee]\\b"
-                    << "\\b[Aa][Ss]\\b" << "\\b[Bb][Yy][Tt][Ee]\\b"
-                    << "\\b[Ii][Nn][Tt][Ee][Gg][Ee][Rr]\\b"
-                    << "\\b[Ii][Nn]\\b"
-                    << "\\b[Rr][Ee][Mm]\\b"
-                    << "\\b[Dd][Ee][Ff]\\b" << "\\b[Dd][Ii][Mm]\\b"
-                    << "\\b[Ee][Nn][Dd]\\b"
-                    << "\\b[Ii][Ff]\\b" << "\\b[Tt][Hh][Ee][Nn]\\b"
-                    << "\\b[Ee][Ll][Ss][Ee]\\b" << "\\b[Nn][Oo][Tt]\\b"
-                    << "\\b[Ss][Ee][Ll][Ee][Cc][Tt]\\b" << "\\b[Cc][Aa][Ss][Ee]\\b"
-                    << "\\b[Tt][Oo]\\b" << "\\b[Gg][Oo][Tt][Oo]\\b"
-                    << "\\b[Ss][Tt][Oo][Pp]\\b" << "\\b[Ee][Nn][Dd]\\b"
-                    << "\\b[Ff][Oo][Rr]\\b" << "\\b[Nn][Ee][Xx][Tt]\\b"
-                    << "\\b[Dd][Oo]\\b" << "\\b[Ww][Hh][Ii][Ll][Ee]\\b"
-                    << "\\b[Ll][Oo][Oo][Pp]\\b" << "\\b[Uu][Nn][Tt][Ii][Ll]\\b"
-                    << "\\b[Rr][Ee][Tt][Uu][Rr][Nn]\\b"
-                    << "\\b[Pp][Rr][Ii][Nn][Tt]\\b"
-                    << "\\b[Ii][Nn][Pp][Uu][Tt]\\b"
-                    << "\\b[Pp][Aa][Rr]\\b" << "\\b[Cc][Nn][Tt]\\b"
-                    << "\\b[Ii][Nn][Aa]\\b" << "\\b[Ii][Nn][Bb]\\b"
-                    << "\\b[Oo][Uu][Tt][Aa]\\b" << "\\b[Oo][Uu][Tt][Bb]\\b"
-                    << "\\b[Dd][Ii][Rr][Aa]\\b" << "\\b[Dd][Ii][Rr][Bb]\\b"
-                    << "\\b[Cc][Tt][Rr][Aa]\\b" << "\\b[Cc][Tt][Rr][Bb]\\b"
-                    << "\\b[Ff][Rr][Qq][Aa]\\b" << "\\b[Ff][Rr][Qq][Bb]\\b"
-                    << "\\b[Pp][Hh][Ss][Aa]\\b" << "\\b[Pp][Hh][Ss][Bb]\\b"
-                    << "\\b[Vv][Cc][Ff][Gg]\\b" << "\\b[Vv][Ss][Cc][Ll]\\b"
-                    << "\\b[Cc][Ll][Kk][Ff][Rr][Ee][Qq]\\b"
-                    << "={2,}" << "-{2,}" << "_{2,}" << "\\{2,}"
-                    ;
-    foreach (const QString &pattern, keywordPatterns) {
-        rule.pattern = QRegExp(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
-//! [0] //! [1]
-    }
-//! [1]
 
-//! [2]
     classFormat.setFontWeight(QFont::Bold);
     classFormat.setForeground(Qt::darkGreen);
-    rule.pattern = QRegExp("\\b[Rr][Ee][Mm][^\n]*");
-    rule.format = classFormat;
-    highlightingRules.append(rule);
-//! [2]
 
-//! [3]
     singleLineCommentFormat.setForeground(Qt::darkGreen);
-    rule.pattern = QRegExp("//[^\n]*");
-    rule.format = singleLineCommentFormat;
-    highlightingRules.append(rule);
-
     multiLineCommentFormat.setForeground(Qt::darkGreen);
-//! [3]
 
-//! [4]
     quotationFormat.setForeground(Qt::red);
-    rule.pattern = QRegExp("\".*\"");
-    rule.format = quotationFormat;
-    highlightingRules.append(rule);
-//! [4]
 
-//! [5]
     functionFormat.setFontItalic(true);
     functionFormat.setForeground(Qt::blue);
-    rule.pattern = QRegExp("\\b[A-Za-z0-9_]+(?=\\()");
-    rule.format = functionFormat;
-    highlightingRules.append(rule);
-//! [5]
-
-//! [6]
-    commentStartExpression = QRegExp("/\\*");
-    commentEndExpression = QRegExp("\\*/");
 }
-//! [6]
+//! [0]
 
-//! [7]
+/*
+ * scan the block once the way db_scan.c does and format each token
+ */
 void Highlighter::highlightBlock(const QString &text)
 {
-    foreach (const HighlightingRule &rule, highlightingRules) {
-        QRegExp expression(rule.pattern);
-        int index = expression.indexIn(text);
-        while (index >= 0) {
-            int length = expression.matchedLength();
-            setFormat(index, length, rule.format);
-            index = expression.indexIn(text, index + length);
+    int length = text.length();
+    int start = 0;
+
+    setCurrentBlockState(NormalState);
+    if(previousBlockState() == CommentState)
+        start = highlightComment(text, 0, 0);
+
+    while(start < length) {
+        QChar ch = text.at(start);
+        QChar next = start + 1 < length ? text.at(start + 1) : QChar();
+        int end;
+
+        if(ch == '/' && next == '/') {
+            setFormat(start, length - start, singleLineCommentFormat);
+            break;
         }
-    }
-//! [7] //! [8]
-    setCurrentBlockState(0);
-//! [8]
-
-//! [9]
-    int startIndex = 0;
-    if (previousBlockState() != 1)
-        startIndex = commentStartExpression.indexIn(text);
-
-//! [9] //! [10]
-    while (startIndex >= 0) {
-//! [10] //! [11]
-        int endIndex = commentEndExpression.indexIn(text, startIndex);
-        int commentLength;
-        if (endIndex == -1) {
-            setCurrentBlockState(1);
-            commentLength = text.length() - startIndex;
-        } else {
-            commentLength = endIndex - startIndex
-                            + commentEndExpression.matchedLength();
+        else if(ch == '/' && next == '*') {
+            start = highlightComment(text, start, 2);
+        }
+        else if(ch == '"' || ch == '\'') {
+            end = skipQuoted(text, start, ch);
+            setFormat(start, end - start, quotationFormat);
+            start = end;
         }
-        setFormat(startIndex, commentLength, multiLineCommentFormat);
-        startIndex = commentStartExpression.indexIn(text, startIndex + commentLength);
+        else if(ch.isDigit()) {
+            /* numbers can't start identifiers (this also skips 0x and 1e3 style suffixes) */
+            for(end = start + 1; end < length && (identifierChar(text.at(end)) || text.at(end) == '.'); end++)
+                ;
+            start = end;
+        }
+        else if(identifierChar(ch)) {
+            for(end = start + 1; end < length && identifierChar(text.at(end)); end++)
+                ;
+            QString word = text.mid(start, end - start).toUpper();
+            if(word == "REM") {
+                setFormat(start, length - start, classFormat);
+                break;
+            }
+            if(keywords.contains(word) || registers.contains(word))
+                setFormat(start, end - start, keywordFormat);
+            else if(end < length && text.at(end) == '(')
+                setFormat(start, end - start, functionFormat);
+            start = end;
+        }
+        else if((ch == '=' || ch == '-') && next == ch) {
+            /* separator lines */
+            for(end = start + 2; end < length && text.at(end) == ch; end++)
+                ;
+            setFormat(start, end - start, keywordFormat);
+            start = end;
+        }
+        else {
+            start++;
+        }
+    }
+}
+
+/*
+ * format a comment starting at start up to its end or the end of the block
+ * (skip is the length of the opening delimiter) and return the position after it
+ */
+int Highlighter::highlightComment(const QString &text, int start, int skip)
+{
+    int end = text.indexOf("*/", start + skip);
+    if(end < 0) {
+        setCurrentBlockState(CommentState);
+        end = text.length();
+    }
+    else {
+        end += 2;
+    }
+    setFormat(start, end - start, multiLineCommentFormat);
+    return end;
+}
+
+/*
+ * find the end of a string or character constant (a backslash escapes the next character)
+ */
+int Highlighter::skipQuoted(const QString &text, int start, QChar quote)
+{
+    int length = text.length();
+    int end = start + 1;
+    while(end < length && text.at(end) != quote) {
+        if(text.at(end) == '\\')
+            end++;
+        end++;
     }
+    return end < length ? end + 1 : length;
 }
-//! [11]
@@ -43,7 +43,7 @@
 
 #include <QSyntaxHighlighter>
 
-#include <QHash>
+#include <QSet>
 #include <QTextCharFormat>
 
 QT_BEGIN_NAMESPACE
@@ -62,15 +62,14 @@ protected:
     void highlightBlock(const QString &text);
 
 private:
-    struct HighlightingRule
-    {
-        QRegExp pattern;
-        QTextCharFormat format;
-    };
-    QVector<HighlightingRule> highlightingRules;
+    /* block states (a block that ends inside of a comment continues it in the next block) */
+    enum { NormalState = 0, CommentState = 1 };
 
-    QRegExp commentStartExpression;
-    QRegExp commentEndExpression;
+    int highlightComment(const QString &text, int start, int skip);
+    int skipQuoted(const QString &text, int start, QChar quote);
+
+    QSet<QString> keywords;
+    QSet<QString> registers;
 
     QTextCharFormat keywordFormat;
     QTextCharFormat classFormat;
@@ -0,0 +1,117 @@
+#include <QFile>
+#include <QRegExp>
+
+#include "includeindex.h"
+
+IncludeIndex::IncludeIndex(QObject *parent) : QObject(parent)
+{
+    connect(&watcher,SIGNAL(fileChanged(QString)),this,SLOT(fileChanged(QString)));
+}
+
+/*
+ * get the lines of a file that isn't open, reading it only the first time
+ * it is asked for or after it has changed on disk
+ */
+QList<IncludeIndex::Line> IncludeIndex::lines(const QString &filePath)
+{
+    QHash<QString, Entry>::iterator it = entries.find(filePath);
+    if(it != entries.end() && !it->fromText)
+        return it->lines;
+
+    Entry entry;
+    entry.textHash = 0;
+    entry.fromText = false;
+    QFile file(filePath);
+    if (file.open(QFile::ReadOnly | QFile::Text))
+    {
+        QString text = file.readAll();
+        file.close();
+        entry.lines = scanText(text);
+        if(!watcher.files().contains(filePath))
+            watcher.addPath(filePath);
+    }
+    entries.insert(filePath, entry);
+    return entry.lines;
+}
+
+/*
+ * get the lines of the text in an editor, scanning it again only when the
+ * text has changed since the last time
+ */
+QList<IncludeIndex::Line> IncludeIndex::lines(const QString &filePath, const QString &text)
+{
+    uint hash = qHash(text);
+    QHash<QString, Entry>::iterator it = entries.find(filePath);
+    if(it != entries.end() && it->fromText && it->textHash == hash)
+        return it->lines;
+
+    Entry entry;
+    entry.lines = scanText(text);
+    entry.textHash = hash;
+    entry.fromText = true;
+    entries.insert(filePath, entry);
+    return entry.lines;
+}
+
+/*
+ * find an include file next to the file including it or in the include path
+ * (returns an empty string if it is in neither)
+ */
+QString IncludeIndex::findInclude(const QString &filePath, const QString &name,
+                                  const QString &incPath, const QString &separator)
+{
+    QString newPath = filePath.mid(0,(filePath.lastIndexOf(separator)+1))+name;
+    if(QFile::exists(newPath))
+        return newPath;
+    QString newInc = incPath+name;
+    if(QFile::exists(newInc))
+        return newInc;
+    return QString();
+}
+
+void IncludeIndex::fileChanged(const QString &filePath)
+{
+    QHash<QString, Entry>::iterator it = entries.find(filePath);
+    if(it != entries.end() && !it->fromText)
+        entries.erase(it);
+
+    /* an editor saving a file may replace it which drops the watch */
+    if(QFile::exists(filePath) && !watcher.files().contains(filePath))
+        watcher.addPath(filePath);
+
+    emit includesChanged();
+}
+
+QList<IncludeIndex::Line> IncludeIndex::scanText(const QString &text)
+{
+    QList<Line> list;
+    QStringList st = text.split('\n');
+    QRegExp rx("(include) ([^\n]*)");
+    rx.setCaseSensitivity(Qt::CaseInsensitive);
+
+    QRegExp dx("def ([^\n]*)");
+    dx.setCaseSensitivity(Qt::CaseInsensitive);
+
+    int len = st.length();
+    for(int n = 0; n < len; n++)
+    {
+        const QString &s = st.at(n);
+        Line line;
+
+        if(dx.indexIn(s) > -1) {
+            line.include = false;
+            line.name = dx.cap(0);
+            list.append(line);
+        }
+
+        if(rx.indexIn(s) > -1) {
+            QString cap = rx.cap(2);
+            if(cap != "" && cap.indexOf("\"") > -1) {
+                line.include = true;
+                line.name = cap.split("\"").at(1).trimmed();
+                list.append(line);
+            }
+        }
+    }
+    return list;
+}
@@ -0,0 +1,52 @@
+#ifndef INCLUDEINDEX_H
+#define INCLUDEINDEX_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+#include <QFileSystemWatcher>
+
+/*
+ * IncludeIndex keeps the include and def lines of every file the project
+ * and reference trees have looked at so a tree update doesn't have to read
+ * and scan the whole include tree again. Files read from disk are watched
+ * and dropped from the index when they change.
+ */
+class IncludeIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    /* one include or def line of a file in the order it appears */
+    struct Line {
+        bool    include;    // name is an include file name, otherwise a def line
+        QString name;
+    };
+
+    IncludeIndex(QObject *parent = 0);
+
+    QList<Line> lines(const QString &filePath);
+    QList<Line> lines(const QString &filePath, const QString &text);
+    QString findInclude(const QString &filePath, const QString &name,
+                        const QString &incPath, const QString &separator);
+
+signals:
+    void includesChanged();
+
+private slots:
+    void fileChanged(const QString &filePath);
+
+private:
+    struct Entry {
+        QList<Line> lines;
+        uint        textHash;   // hash of the editor text the lines came from
+        bool        fromText;
+    };
+
+    static QList<Line> scanText(const QString &text);
+
+    QHash<QString, Entry> entries;
+    QFileSystemWatcher watcher;
+};
+
+#endif // INCLUDEINDEX_H
@@ -24,6 +24,13 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     projectModel = NULL;
     referenceModel = NULL;
 
+    /* include and def lines of the project files for the trees */
+    includeIndex = new IncludeIndex(this);
+    connect(includeIndex,SIGNAL(includesChanged()),this,SLOT(includesChanged()));
+
+    proc = NULL;
+    debugAfterBuild = false;
+
     /* setup gui components */
     setupFileMenu();
     setupHelpMenu();
@@ -61,6 +68,11 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     statusBar->addPermanentWidget(sizeLabel,15);
     statusBar->addPermanentWidget(progress,15);
 
+    btnCancel = new QPushButton(tr("Cancel"));
+    btnCancel->setVisible(false);
+    connect(btnCancel,SIGNAL(clicked()),this,SLOT(cancelBuild()));
+    statusBar->addPermanentWidget(btnCancel);
+
     this->setStatusBar(statusBar);
 
 
@@ -75,14 +87,18 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     /* get available ports at startup */
     enumeratePorts();
 
-#if 0
-#if defined(Q_WS_WIN32)
-    /* connect windows USB change detect signal to enumerator */
-    connect(this,SIGNAL(doPortEnumerate()),this, SLOT(enumeratePortsEvent()));
-#endif
+    /* keep the port list up to date as ports come and go */
+    portEnumerator = new QextSerialEnumerator(this);
+    devWatcher = NULL;
+#if defined(Q_WS_WIN32) || defined(Q_WS_MAC)
+    connect(portEnumerator,SIGNAL(deviceDiscovered(QextPortInfo)),this,SLOT(portDiscovered(QextPortInfo)));
+    connect(portEnumerator,SIGNAL(deviceRemoved(QextPortInfo)),this,SLOT(portRemoved(QextPortInfo)));
+    portEnumerator->setUpNotifications();
 #else
-    portConnectionMonitor = new PortConnectionMonitor();
-    connect(portConnectionMonitor, SIGNAL(portChanged()), this, SLOT(enumeratePortsEvent()));
+    /* the enumerator has no notifications here but ports show up in /dev */
+    devWatcher = new QFileSystemWatcher(this);
+    devWatcher->addPath("/dev");
+    connect(devWatcher,SIGNAL(directoryChanged(QString)),this,SLOT(enumeratePortsEvent()));
 #endif
 
     /* these are read once per app startup */
@@ -112,6 +128,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     /* tell port listener to use terminal editor for i/o */
     termEditor = term->getEditor();
     portListener->setTerminalWindow(termEditor);
+    portListener->setMaxLines(settings->value(terminalLinesKey, TERMINAL_LINES).toInt());
+    portListener->setLineDelay(settings->value(terminalDelayKey, TERMINAL_LINE_DELAY).toInt());
+    portListener->setFlowControl((FlowType)settings->value(terminalFlowKey, FLOW_OFF).toInt());
     term->setPortListener(portListener);
 
     /* load the last file into the editor to make user happy */
@@ -138,25 +157,6 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     connect(hardwareDialog,SIGNAL(accepted()),this,SLOT(initBoardTypes()));
 }
 
-#if defined(Q_WS_WIN32)
-bool MainWindow::winEvent(MSG *message, long *result)
-{
-    if (message->message==WM_DEVICECHANGE)
-    {
-        qDebug() << ("WM_DEVICECHANGE message received");
-        if (message->wParam==DBT_DEVICEARRIVAL) {
-            qDebug() << ("A new device has arrived");
-            emit doPortEnumerate();
-        }
-        if (message->wParam==DBT_DEVICEREMOVECOMPLETE) {
-            qDebug() << ("A device has been removed");
-            emit doPortEnumerate();
-        }
-    }
-    return false;
-}
-#endif
-
 void MainWindow::keyHandler(QKeyEvent* event)
 {
     //qDebug() << "MainWindow::keyHandler";
@@ -283,6 +283,7 @@ void MainWindow::exitSave()
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+    cancelBuild();
     portListener->close();
 
     exitSave(); // find
@@ -517,6 +518,9 @@ void MainWindow::propertiesAccepted()
 {
     getApplicationSettings();
     initBoardTypes();
+    portListener->setMaxLines(settings->value(terminalLinesKey, TERMINAL_LINES).toInt());
+    portListener->setLineDelay(settings->value(terminalDelayKey, TERMINAL_LINE_DELAY).toInt());
+    portListener->setFlowControl((FlowType)settings->value(terminalFlowKey, FLOW_OFF).toInt());
 }
 
 void MainWindow::setCurrentBoard(int index)
@@ -617,6 +621,9 @@ QStringList MainWindow::getCompilerParameters(QString copts)
 
 int  MainWindow::runCompiler(QString copts)
 {
+    if(proc != NULL)            // a build is already running
+        return -1;
+
     if(projectModel == NULL || projectFile.isNull()) {
         QMessageBox mbox(QMessageBox::Critical, "Error No Project",
             "Please select a tab and press F4 to set main project file.", QMessageBox::Ok);
@@ -640,10 +647,6 @@ int  MainWindow::runCompiler(QString copts)
 #endif
     setCurrentPort(cbPort->currentIndex());
 
-    QString result;
-    int exitCode = 0;
-    int exitStatus = 0;
-
     int index = editorTabs->currentIndex();
     QString fileName = editorTabs->tabToolTip(index);
     QString text = editors->at(index)->toPlainText();
@@ -669,95 +672,127 @@ int  MainWindow::runCompiler(QString copts)
 
     checkAndSaveFiles();
 
-    QMessageBox mbox;
-    mbox.setStandardButtons(QMessageBox::Ok);
-
-    QProcess proc(this);
-    this->proc = &proc;
+    /* the compiler and the download run while the editor stays responsive */
+    compileResult.clear();
+    buildCancelled = false;
 
-    connect(this->proc, SIGNAL(readyReadStandardOutput()),this,SLOT(procReadyRead()));
-    proc.setProcessChannelMode(QProcess::MergedChannels);
+    proc = new QProcess(this);
+    connect(proc, SIGNAL(readyReadStandardOutput()),this,SLOT(procReadyRead()));
+    connect(proc, SIGNAL(finished(int,QProcess::ExitStatus)),this,SLOT(compilerFinished(int,QProcess::ExitStatus)));
+    connect(proc, SIGNAL(error(QProcess::ProcessError)),this,SLOT(compilerError(QProcess::ProcessError)));
+    proc->setProcessChannelMode(QProcess::MergedChannels);
 
-    proc.setWorkingDirectory(xBasicCompilerPath);
+    proc->setWorkingDirectory(xBasicCompilerPath);
 
-    proc.start(xBasicCompiler,args);
+    setBuildActionsEnabled(false);
+    btnCancel->setVisible(true);
+    progress->setValue(10);
 
-    if(!proc.waitForStarted()) {
-        mbox.setInformativeText(tr("Could not start compiler."));
-        mbox.exec();
-        goto error;
-    }
+    proc->start(xBasicCompiler,args);
+    return 0;
+}
 
-    progress->setValue(10);
+/*
+ * stop the compiler or the download in progress
+ */
+void MainWindow::cancelBuild()
+{
+    if(proc == NULL || proc->state() == QProcess::NotRunning)
+        return;
+    buildCancelled = true;
+    msgLabel->setText(tr("Cancelling"));
+    proc->kill();
+}
 
-    if(!proc.waitForFinished()) {
-        mbox.setInformativeText(tr("Error waiting for compiler to finish."));
-        mbox.exec();
-        goto error;
-    }
+void MainWindow::compilerError(QProcess::ProcessError error)
+{
+    qDebug() << error;
+    /* the other errors are followed by finished */
+    if(error != QProcess::FailedToStart)
+        return;
+    QMessageBox mbox;
+    mbox.setStandardButtons(QMessageBox::Ok);
+    mbox.setInformativeText(tr("Could not start compiler."));
+    mbox.exec();
+    buildDone(false);
+}
 
-    progress->setValue(20);
+void MainWindow::compilerFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    qDebug() << exitCode << exitStatus;
 
-    exitCode = proc.exitCode();
-    exitStatus = proc.exitStatus();
+    /* pick up anything the compiler wrote just before it exited */
+    procReadyRead();
 
+    QMessageBox mbox;
+    mbox.setStandardButtons(QMessageBox::Ok);
     mbox.setInformativeText(compileResult);
+
+    if(buildCancelled)
+    {
+        msgLabel->setText(tr("Build Cancelled"));
+        buildDone(false);
+        return;
+    }
     msgLabel->setText("");
 
     if(exitStatus == QProcess::CrashExit)
     {
         mbox.setText(tr("xBasic Compiler Crashed"));
         mbox.exec();
-        goto error;
+        buildDone(false);
+        return;
     }
-    progress->setValue(30);
     if(exitCode != 0)
     {
         if(compileResult.toLower().indexOf("helper") > 0) {
-            mbox.setInformativeText(result +
+            mbox.setInformativeText(compileResult +
                  "\nDid you set the right board type?" +
                  "\nHUB and C3 set 80MHz clock." +
                  "\nHUB96 and SSF set 96MHz clock.");
         }
         mbox.setText(tr("xBasic Compile Error"));
         mbox.exec();
-        goto error;
+        buildDone(false);
+        return;
     }
-    progress->setValue(40);
     if(compileResult.indexOf("error") > -1)
     { // just in case we get an error without exitCode
         mbox.setText(tr("xBasic Compile Error"));
         mbox.exec();
-        goto error;
+        buildDone(false);
+        return;
     }
 
     msgLabel->setText("Build Complete");
-    progress->setValue(100);
-    progress->setVisible(false);
-    disconnect(this->proc, SIGNAL(readyReadStandardOutput()),this,SLOT(procReadyRead()));
-    return 0;
-
-    error:
-
-    sizeLabel->setText("Error");
+    buildDone(true);
+}
 
-    exitCode = proc.exitCode();
-    exitStatus = proc.exitStatus();
+/*
+ * clean up after the compiler and start the terminal if the build was for debugging
+ */
+void MainWindow::buildDone(bool ok)
+{
+    if(!ok)
+        sizeLabel->setText("Error");
 
     progress->setValue(100);
     progress->setVisible(false);
-    disconnect(this->proc, SIGNAL(readyReadStandardOutput()),this,SLOT(procReadyRead()));
-    return -1;
-}
+    btnCancel->setVisible(false);
+    setBuildActionsEnabled(true);
 
-void MainWindow::compilerError(QProcess::ProcessError error)
-{
-    qDebug() << error;
+    proc->deleteLater();
+    proc = NULL;
+
+    if(ok && debugAfterBuild)
+        startTerminal();
+    debugAfterBuild = false;
 }
 
-void MainWindow::compilerFinished(int exitCode, QProcess::ExitStatus status)
+void MainWindow::setBuildActionsEnabled(bool enable)
 {
-    qDebug() << exitCode << status;
+    debugMenu->setEnabled(enable);
+    debugToolBar->setEnabled(enable);
 }
 
 void MainWindow::procReadyRead()
@@ -773,7 +808,7 @@ void MainWindow::procReadyRead()
 #endif
     bytes = bytes.replace("\r\n","\n");
 
-    compileResult = QString(bytes);
+    compileResult += QString(bytes);
     QStringList lines = QString(bytes).split("\n",QString::SkipEmptyParts);
     if(bytes.contains("bytes")) {
         for (int n = 0; n < lines.length(); n++) {
@@ -831,6 +866,10 @@ void MainWindow::procReadyRead()
                 }
             }
             */
+            if(line.startsWith("error",Qt::CaseInsensitive)) {
+                msgLabel->setText(line);    // show diagnostics as they arrive
+            }
+            else
             if(line.contains("Propeller Version",Qt::CaseInsensitive)) {
                 msgLabel->setText(line+eol);
                 progress->setValue(0);
@@ -899,9 +938,12 @@ void MainWindow::programRun()
 
 void MainWindow::programDebug()
 {
-    if(runCompiler("-r"))
-        return; // don't start terminal if compile failed
+    /* the terminal starts when the build finishes if it doesn't fail */
+    debugAfterBuild = runCompiler("-r") == 0;
+}
 
+void MainWindow::startTerminal()
+{
     /*
      * setting the position of a new dialog doesn't work very nice
      * Term dialog will not close/reopen on debug so it doesn't matter.
@@ -1054,19 +1096,25 @@ void MainWindow::addToolButton(QToolBar *bar, QToolButton *btn, QString imgfile)
     bar->addWidget(btn);
 }
 
+/*
+ * the models are kept between updates and only the rows that changed are
+ * replaced so the trees don't flicker or lose their place while editing
+ */
 void MainWindow::updateProjectTree(QString fileName, QString text)
 {
     projectFile = fileName;
     QString s = this->shortFileName(fileName);
     basicPath = fileName.mid(0,fileName.lastIndexOf('/')+1);
 
-    if(projectModel != NULL) delete projectModel;
-    projectModel = new TreeModel(s, this);
-    if(text.length() > 0) {
-        projectModel->xBasicIncludes(fileName, this->xBasicIncludes, this->xBasicSeparator, text, true);
+    if(projectModel == NULL) {
+        projectModel = new TreeModel(s, this);
+        projectTree->setModel(projectModel);
     }
+    else {
+        projectModel->setTreeName(s);
+    }
+    projectModel->xBasicIncludes(includeIndex, fileName, this->xBasicIncludes, this->xBasicSeparator, text);
     projectTree->setWindowTitle(s);
-    projectTree->setModel(projectModel);
     projectTree->show();
 
 }
@@ -1076,16 +1124,27 @@ void MainWindow::updateReferenceTree(QString fileName, QString text)
     QString s = this->shortFileName(fileName);
     basicPath = fileName.mid(0,fileName.lastIndexOf('/')+1);
 
-    if(referenceModel != NULL) delete referenceModel;
-    referenceModel = new TreeModel(s, this);
-    if(text.length() > 0) {
-        referenceModel->addFileReferences(fileName, xBasicIncludes, xBasicSeparator, text, true);
+    if(referenceModel == NULL) {
+        referenceModel = new TreeModel(s, this);
+        referenceTree->setModel(referenceModel);
     }
+    else {
+        referenceModel->setTreeName(s);
+    }
+    referenceModel->addFileReferences(includeIndex, fileName, xBasicIncludes, xBasicSeparator, text);
     referenceTree->setWindowTitle(s);
-    referenceTree->setModel(referenceModel);
     referenceTree->show();
 }
 
+/*
+ * an include file changed on disk so show its new includes and defs
+ */
+void MainWindow::includesChanged()
+{
+    if(projectModel != NULL)
+        setProject();
+}
+
 void MainWindow::setEditorTab(int num, QString shortName, QString fileName, QString text)
 {
     QPlainTextEdit *editor = editors->at(num);
@@ -1120,89 +1179,114 @@ void MainWindow::checkConfigSerialPort()
 void MainWindow::enumeratePortsEvent()
 {
     enumeratePorts();
-    int len = this->cbPort->count();
-
-    // need to check if the port we are using disappeared.
-    if(this->btnConnected->isChecked()) {
-        bool notFound = true;
-        QString plPortName = this->term->getPortName();
-        for(int n = this->cbPort->count()-1; n > -1; n--) {
-            QString name = cbPort->itemText(n);
-            if(!name.compare(plPortName)) {
-                notFound = false;
-            }
-        }
-        if(notFound) {
-            btnConnected->setChecked(false);
-            connectButton();
-        }
-    }
-    else if(len > 1) {
-        this->cbPort->showPopup();
-    }
+    checkConnectedPort();
+}
 
+/*
+ * a port was plugged in
+ */
+void MainWindow::portDiscovered(const QextPortInfo &info)
+{
+    addPort(portDisplayName(info));
 }
 
-void MainWindow::enumeratePorts()
+/*
+ * a port was unplugged
+ */
+void MainWindow::portRemoved(const QextPortInfo &info)
+{
+    removePort(portDisplayName(info));
+    checkConnectedPort();
+}
+
+/*
+ * close the terminal if the port it is using disappeared
+ */
+void MainWindow::checkConnectedPort()
+{
+    if(!this->btnConnected->isChecked())
+        return;
+    QString plPortName = this->term->getPortName();
+    if(cbPort->findText(plPortName) < 0) {
+        btnConnected->setChecked(false);
+        connectButton();
+    }
+}
+
+/*
+ * the name shown in the port list or an empty string for ports that
+ * can't have a board on them
+ */
+QString MainWindow::portDisplayName(const QextPortInfo &info)
 {
-    if(cbPort != NULL) cbPort->clear();
-    QList<QextPortInfo> ports = QextSerialEnumerator::getPorts();
-    QStringList stringlist;
     QString name;
-    stringlist << "List of ports:";
-#ifdef AUTOPORT
-    int index = -1;
-    progress->setValue(0);
-    progress->setVisible(true);
-#endif
-    for (int i = 0; i < ports.size(); i++) {
-        progress->setValue(i*100/ports.size());
-        stringlist << "port name:" << ports.at(i).portName;
-        stringlist << "friendly name:" << ports.at(i).friendName;
-        stringlist << "physical name:" << ports.at(i).physName;
-        stringlist << "enumerator name:" << ports.at(i).enumName;
-        stringlist << "vendor ID:" << QString::number(ports.at(i).vendorID, 16);
-        stringlist << "product ID:" << QString::number(ports.at(i).productID, 16);
-        stringlist << "===================================";
 #if defined(Q_WS_WIN32)
-        if(name.contains(QString("LPT"),Qt::CaseInsensitive) == false) {
-            name = ports.at(i).portName;
-            cbPort->addItem(name);
-        }
+    name = info.portName;
+    if(name.contains(QString("LPT"),Qt::CaseInsensitive))
+        name = "";
 #elif defined(Q_WS_MAC)
-        name = ports.at(i).portName;
-        if(name.indexOf("usbserial",0,Qt::CaseInsensitive) > -1)
-            cbPort->addItem(name);
+    name = info.portName;
+    if(name.indexOf("usbserial",0,Qt::CaseInsensitive) < 0)
+        name = "";
 #else
-        name = "/"+ports.at(i).physName;
-        if(name.indexOf("usb",0,Qt::CaseInsensitive) > -1)
-            cbPort->addItem(name);
+    name = "/"+info.physName;
+    if(name.indexOf("usb",0,Qt::CaseInsensitive) < 0)
+        name = "";
 #endif
+    return name;
+}
+
+void MainWindow::addPort(QString name)
+{
+    if(name.length() == 0 || cbPort->findText(name) > -1)
+        return;
+    cbPort->addItem(name);
 #ifdef AUTOPORT
-        index++;
-        /* test for valid port */
-        if(name.length() && !portListener->port->isOpen()) {
-            portListener->init(name, BAUD115200);  // signals get hooked up internally
-            if(portListener->open()) {
-                portListener->close();
-                PropellerID propid;
-                if(!propid.isDevice(name)) {
-                    cbPort->removeItem(index);
-                    index--;
-                }
-            }
-            else {
-                cbPort->removeItem(index);
-                index--;
-            }
-        }
-#endif
+    /* ports without a Propeller are dropped when their probe finishes */
+    if(portListener->port == NULL || !portListener->port->isOpen()) {
+        PropellerProbe *probe = new PropellerProbe(name, this);
+        connect(probe,SIGNAL(probed(QString,bool)),this,SLOT(portProbed(QString,bool)));
+        connect(probe,SIGNAL(finished()),probe,SLOT(deleteLater()));
+        probe->start();
     }
-#ifdef AUTOPORT
-    progress->setValue(100);
 #endif
 }
 
+void MainWindow::removePort(QString name)
+{
+    int index = cbPort->findText(name);
+    if(name.length() == 0 || index < 0)
+        return;
+    cbPort->removeItem(index);
+}
+
+void MainWindow::portProbed(QString name, bool found)
+{
+    if(!found)
+        removePort(name);
+}
+
+/*
+ * bring the port list up to date keeping the ports that are still there
+ */
+void MainWindow::enumeratePorts()
+{
+    QList<QextPortInfo> ports = QextSerialEnumerator::getPorts();
+    QStringList names;
+    for (int i = 0; i < ports.size(); i++) {
+        QString name = portDisplayName(ports.at(i));
+        if(name.length())
+            names.append(name);
+    }
+
+    for(int n = cbPort->count()-1; n > -1; n--) {
+        if(!names.contains(cbPort->itemText(n)))
+            cbPort->removeItem(n);
+    }
+    for(int n = 0; n < names.count(); n++)
+        addPort(names.at(n));
+}
+
 void MainWindow::connectButton()
 {
     if(btnConnected->isChecked()) {
@@ -1312,7 +1396,7 @@ void MainWindow::setupFileMenu()
     projMenu->addAction(QIcon(":/images/properties.png"), tr("Properties"), this, SLOT(properties()), Qt::Key_F5);
     projMenu->addAction(QIcon(":/images/hardware.png"), tr("Configuration"), this, SLOT(hardware()), Qt::Key_F6);
 
-    QMenu *debugMenu = new QMenu(tr("&Debug"), this);
+    debugMenu = new QMenu(tr("&Debug"), this);
     menuBar()->addMenu(debugMenu);
 
     debugMenu->addAction(QIcon(":/images/debug.png"), tr("Debug"), this, SLOT(programDebug()), Qt::Key_F8);
@@ -57,12 +57,8 @@
 #include "xbasicboard.h"
 #include "console.h"
 #include "hardware.h"
-#include "PortConnectionMonitor.h"
-
-#if defined(Q_WS_WIN32)
-#include <qt_windows.h>
-#include <dbt.h>
-#endif
+#include "PropellerID.h"
+#include "qextserialenumerator.h"
 
 #define untitledstr "Untitled"
 
@@ -78,9 +74,6 @@ class MainWindow : public QMainWindow
 public:
     MainWindow(QWidget *parent = 0);
 
-signals:
-    void doPortEnumerate();
-
 public slots:
     void terminalEditorTextChanged();
     void newFile();
@@ -100,6 +93,7 @@ public slots:
     void connectButton();
     void terminalClosed();
     void setProject();
+    void includesChanged();
     void hardware();
     void properties();
     void propertiesAccepted();
@@ -107,6 +101,7 @@ public slots:
     void programBurnEE();
     void programRun();
     void programDebug();
+    void cancelBuild();
     void compilerError(QProcess::ProcessError error);
     void compilerFinished(int exitCode, QProcess::ExitStatus status);
     void procReadyRead();
@@ -116,6 +111,9 @@ public slots:
     void keyHandler(QKeyEvent* event);
     void enumeratePorts();
     void enumeratePortsEvent();
+    void portDiscovered(const QextPortInfo &info);
+    void portRemoved(const QextPortInfo &info);
+    void portProbed(QString name, bool found);
     void initBoardTypes();
 
 private:
@@ -124,6 +122,9 @@ private:
     int  checkCompilerInfo();
     QStringList getCompilerParameters(QString compilerOptions);
     int  runCompiler(QString compilerOptions);
+    void buildDone(bool ok);
+    void setBuildActionsEnabled(bool enable);
+    void startTerminal();
     void openFileName(QString fileName);
     void checkAndSaveFiles();
     void setupEditor();
@@ -137,6 +138,10 @@ private:
     void setEditorTab(int num, QString shortName, QString fileName, QString text);
     QString shortFileName(QString fileName);
     void checkConfigSerialPort();
+    void checkConnectedPort();
+    QString portDisplayName(const QextPortInfo &info);
+    void addPort(QString name);
+    void removePort(QString name);
 
     QSettings   *settings;
     QString     xBasicCompiler;
@@ -151,6 +156,7 @@ private:
     QToolBar    *propToolBar;
     QToolBar    *debugToolBar;
     QToolBar    *ctrlToolBar;
+    QMenu       *debugMenu;
 
     QSplitter   *leftSplit;
 
@@ -163,6 +169,7 @@ private:
     QTreeView   *projectTree;
     TreeModel   *referenceModel;
     QTreeView   *referenceTree;
+    IncludeIndex *includeIndex;
 
     QString     basicPath;
     QString     includePath;
@@ -183,7 +190,9 @@ private:
     QString     portName;
     QString     boardName;
 
-    QProcess    *proc;
+    QProcess    *proc;          // compiler and loader while a build runs or NULL
+    bool        buildCancelled;
+    bool        debugAfterBuild;    // start the terminal when the build finishes
 
     Hardware    *hardwareDialog;
 
@@ -192,14 +201,11 @@ private:
     QLabel *sizeLabel;
     QLabel *msgLabel ;
     QProgressBar *progress;
+    QPushButton *btnCancel;
     QString compileResult;
 
-    PortConnectionMonitor *portConnectionMonitor;
-
-#if defined(Q_WS_WIN32)
-protected:
-    bool winEvent(MSG *msg,long * result);
-#endif
+    QextSerialEnumerator *portEnumerator;
+    QFileSystemWatcher *devWatcher;     // where the enumerator has no notifications
 
 };
 //! [0]
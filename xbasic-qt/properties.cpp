@@ -18,6 +18,27 @@ Properties::Properties(QWidget *parent) : QDialog(parent)
     ilayout->addWidget(leditIncludes);
     ilayout->addWidget(btnIncludesBrowse);
 
+    QGroupBox *gbTerminal = new QGroupBox(tr("Terminal Lines"), this);
+    spinTermLines = new QSpinBox(this);
+    spinTermLines->setRange(100,100000);
+    spinTermLines->setSingleStep(1000);
+    QHBoxLayout *tlayout = new QHBoxLayout();
+    tlayout->addWidget(spinTermLines);
+
+    /* the combo box order matches FlowType */
+    QGroupBox *gbSend = new QGroupBox(tr("Terminal Send"), this);
+    spinLineDelay = new QSpinBox(this);
+    spinLineDelay->setRange(0,10000);
+    spinLineDelay->setSingleStep(10);
+    spinLineDelay->setSuffix(tr(" ms per line"));
+    cbFlowControl = new QComboBox(this);
+    cbFlowControl->addItem(tr("No flow control"));
+    cbFlowControl->addItem(tr("Hardware flow control"));
+    cbFlowControl->addItem(tr("XON/XOFF flow control"));
+    QHBoxLayout *slayout = new QHBoxLayout();
+    slayout->addWidget(spinLineDelay);
+    slayout->addWidget(cbFlowControl);
+
     QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
 
     connect(btnCompilerBrowse, SIGNAL(clicked()), this, SLOT(browseCompiler()));
@@ -27,9 +48,13 @@ Properties::Properties(QWidget *parent) : QDialog(parent)
 
     gbCompiler->setLayout(clayout);
     gbIncludes->setLayout(ilayout);
+    gbTerminal->setLayout(tlayout);
+    gbSend->setLayout(slayout);
 
     layout->addWidget(gbCompiler);
     layout->addWidget(gbIncludes);
+    layout->addWidget(gbTerminal);
+    layout->addWidget(gbSend);
     layout->addWidget(buttonBox);
 
     setLayout(layout);
@@ -37,6 +62,9 @@ Properties::Properties(QWidget *parent) : QDialog(parent)
     QSettings settings(publisherKey, xBasicGuiKey,this);
     QVariant compv = settings.value(compilerKey);
     QVariant incv = settings.value(includesKey);
+    QVariant termv = settings.value(terminalLinesKey, TERMINAL_LINES);
+    QVariant delayv = settings.value(terminalDelayKey, TERMINAL_LINE_DELAY);
+    QVariant flowv = settings.value(terminalFlowKey, 0);
 
     if(compv.canConvert(QVariant::String)) {
         QString s = compv.toString();
@@ -50,8 +78,21 @@ Properties::Properties(QWidget *parent) : QDialog(parent)
         leditIncludes->setText(s);
     }
 
+    if(termv.canConvert(QVariant::Int))
+        spinTermLines->setValue(termv.toInt());
+    else
+        spinTermLines->setValue(TERMINAL_LINES);
+
+    if(delayv.canConvert(QVariant::Int))
+        spinLineDelay->setValue(delayv.toInt());
+    else
+        spinLineDelay->setValue(TERMINAL_LINE_DELAY);
+
+    if(flowv.canConvert(QVariant::Int) && flowv.toInt() >= 0 && flowv.toInt() < cbFlowControl->count())
+        cbFlowControl->setCurrentIndex(flowv.toInt());
+
     setWindowFlags(Qt::Tool);
-    resize(400,260);
+    resize(400,320);
 }
 
 
@@ -91,6 +132,9 @@ void Properties::accept()
     settings.setValue(compilerKey,leditCompiler->text());
     settings.setValue(includesKey,leditIncludes->text());
     settings.setValue(configFileKey,leditIncludes->text()+tr("xbasic.cfg"));
+    settings.setValue(terminalLinesKey,spinTermLines->value());
+    settings.setValue(terminalDelayKey,spinLineDelay->value());
+    settings.setValue(terminalFlowKey,cbFlowControl->currentIndex());
     done(QDialog::Accepted);
 }
 
@@ -98,6 +142,9 @@ void Properties::reject()
 {
     leditCompiler->setText(compilerstr);
     leditIncludes->setText(includesstr);
+    spinTermLines->setValue(termlines);
+    spinLineDelay->setValue(linedelay);
+    cbFlowControl->setCurrentIndex(flowcontrol);
     done(QDialog::Rejected);
 }
 
@@ -105,6 +152,9 @@ void Properties::showProperties()
 {
     compilerstr = leditCompiler->text();
     includesstr = leditIncludes->text();
+    termlines = spinTermLines->value();
+    linedelay = spinLineDelay->value();
+    flowcontrol = cbFlowControl->currentIndex();
     this->setWindowTitle("xBasic IDE Compiler Properties");
     this->show();
 }
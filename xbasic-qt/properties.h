@@ -14,6 +14,15 @@
 #define lastTermXposKey     "LastTermXposition"
 #define lastTermYposKey     "LastTermYposition"
 #define lastDirectoryKey    "LastDirectory"
+#define terminalLinesKey    "TerminalLines"
+#define terminalDelayKey    "TerminalLineDelay"
+#define terminalFlowKey     "TerminalFlowControl"
+
+/* default number of lines the terminal keeps */
+#define TERMINAL_LINES      2000
+
+/* default milliseconds between the lines of a file sent from the terminal */
+#define TERMINAL_LINE_DELAY 20
 
 #include <QtGui>
 
@@ -35,8 +44,14 @@ public slots:
 private:
     QLineEdit   *leditCompiler;
     QLineEdit   *leditIncludes;
+    QSpinBox    *spinTermLines;
+    QSpinBox    *spinLineDelay;
+    QComboBox   *cbFlowControl;
     QString     compilerstr;
     QString     includesstr;
+    int         termlines;
+    int         linedelay;
+    int         flowcontrol;
 };
 
 #endif // PROPERTIES_H
@@ -9,12 +9,15 @@ Terminal::Terminal(QWidget *parent) : QDialog(parent)
     termLayout->addWidget(termEditor);
     QPushButton *cls = new QPushButton(tr("Clear"),this);
     connect(cls,SIGNAL(clicked()), this, SLOT(clearScreen()));
+    btnSend = new QPushButton(tr("Send File"),this);
+    connect(btnSend,SIGNAL(clicked()), this, SLOT(sendFile()));
     QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok);
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
     connect(buttonBox, SIGNAL(rejected()), this, SLOT(reject()));
     QHBoxLayout *butLayout = new QHBoxLayout();
     termLayout->addLayout(butLayout);
     butLayout->addWidget(cls);
+    butLayout->addWidget(btnSend);
     butLayout->addWidget(&portLabel);
     butLayout->addWidget(buttonBox);
     setLayout(termLayout);
@@ -31,6 +34,7 @@ Console *Terminal::getEditor()
 void Terminal::setPortListener(PortListener *listener)
 {
     portListener = listener;
+    connect(listener,SIGNAL(sendDone()), this, SLOT(sendDone()));
     if(listener->port) {
         if(listener->port->portName().isEmpty() == false)
             portLabel.setText(listener->port->portName());
@@ -75,3 +79,33 @@ void Terminal::clearScreen()
 {
     termEditor->setPlainText("");
 }
+
+/*
+ * send a file to the board a line at a time or stop the one being sent
+ */
+void Terminal::sendFile()
+{
+    if(portListener == NULL)
+        return;
+
+    if(portListener->isSending()) {
+        portListener->cancelSend();
+        sendDone();
+        return;
+    }
+
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Send File"), "", "All Files (*)");
+    if(fileName.length() == 0)
+        return;
+    if(!portListener->sendFile(fileName)) {
+        QMessageBox::critical(this, tr("Send File"), tr("Can't open ") + fileName);
+        return;
+    }
+    if(portListener->isSending())
+        btnSend->setText(tr("Stop Sending"));
+}
+
+void Terminal::sendDone()
+{
+    btnSend->setText(tr("Send File"));
+}
@@ -20,9 +20,12 @@ public:
 
 public slots:
     void clearScreen();
+    void sendFile();
+    void sendDone();
 
 private:
     PortListener *portListener;
+    QPushButton *btnSend;
     QLabel  portLabel;
     Console *termEditor;
 };
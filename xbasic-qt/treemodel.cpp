@@ -75,6 +75,15 @@ QString TreeModel::getTreeName()
     return treeName;
 }
 
+void TreeModel::setTreeName(const QString &name)
+{
+    if(name == treeName)
+        return;
+    treeName = name;
+    rootItem->itemData[0] = name;
+    emit headerDataChanged(Qt::Horizontal, 0, 0);
+}
+
 //! [2]
 int TreeModel::columnCount(const QModelIndex &parent) const
 {
@@ -254,122 +263,133 @@ bool TreeModel::isDuplicate(TreeItem *item, QString str)
 
 
 /*
- * this should be part of a child class, but I'm lazy right now
+ * fill the tree with every file included by the file and the files it
+ * includes using the index so only files that changed get scanned again
  */
-void TreeModel::xBasicIncludes(QString &filePath, QString &incPath, QString &separator, QString &text, bool root)
+void TreeModel::xBasicIncludes(IncludeIndex *includes, QString &filePath, QString &incPath, QString &separator, QString &text)
 {
-    QString inc, cap, s;
-    QStringList st = text.split('\n');
-    QRegExp rx("(include) ([^\n]*)");
-
-    rx.setCaseSensitivity(Qt::CaseInsensitive);
+    QStringList names;
+    QSet<QString> visited;
+    visited.insert(filePath);
+    collectIncludes(includes, includes->lines(filePath, text), filePath, incPath, separator, names, visited);
+    setRows(names, QStringList());
+}
 
-    int len = st.length();
-    for(int n = 0; n < len; n++)
+void TreeModel::collectIncludes(IncludeIndex *includes, const QList<IncludeIndex::Line> &lines,
+                                const QString &filePath, const QString &incPath, const QString &separator,
+                                QStringList &names, QSet<QString> &visited)
+{
+    for(int n = 0; n < lines.length(); n++)
     {
-        s = st.at(n);
-        int gotit = rx.indexIn(s);
-        if(gotit > -1) {
-            QList<QVariant> clist;
-            inc = rx.cap(1);
-            cap = rx.cap(2);
-            if(cap != "" && cap.indexOf("\"") > -1) {
-                QStringList caps = cap.split("\"");
-                cap = caps.at(1);
-                cap = cap.trimmed();
-                clist << cap;
-                if(!isDuplicate(rootItem, cap))
-                    rootItem->appendChild(new TreeItem(clist, rootItem));
-            }
+        const IncludeIndex::Line &line = lines.at(n);
+        if(!line.include)
+            continue;
+        if(!names.contains(line.name))
+            names.append(line.name);
+
+        /* a file included more than once (or by itself) is only followed once */
+        QString filename = includes->findInclude(filePath, line.name, incPath, separator);
+        if(filename.isEmpty() || visited.contains(filename))
+            continue;
+        visited.insert(filename);
+        collectIncludes(includes, includes->lines(filename), filename, incPath, separator, names, visited);
+    }
+}
 
-            QString newPath = filePath.mid(0,(filePath.lastIndexOf(separator)+1))+cap;
-            QString newInc = incPath+cap;
-            if(QFile::exists(newPath) == true)
-            {
-                QString filename = newPath;
-                QFile myfile(filename);
-                if (myfile.open(QFile::ReadOnly | QFile::Text))
-                {
-                    text = myfile.readAll();
-                    myfile.close();
-                    xBasicIncludes(filename, incPath, separator, text);
-                }
-            }
-            else if(QFile::exists(newInc) == true)
-            {
-                QString filename = newInc;
-                QFile myfile(filename);
-                if (myfile.open(QFile::ReadOnly | QFile::Text))
-                {
-                    text = myfile.readAll();
-                    myfile.close();
-                    xBasicIncludes(filename, incPath, separator, text);
-                }
+/*
+ * fill the tree with the defs of the file and the files it includes
+ */
+void TreeModel::addFileReferences(IncludeIndex *includes, QString &filePath, QString &incPath, QString &separator, QString &text)
+{
+    QStringList names;
+    QStringList files;
+    QSet<QString> visited;
+    visited.insert(filePath);
+    collectReferences(includes, includes->lines(filePath, text), filePath, incPath, separator, true, names, files, visited);
+    setRows(names, files);
+}
+
+void TreeModel::collectReferences(IncludeIndex *includes, const QList<IncludeIndex::Line> &lines,
+                                  const QString &filePath, const QString &incPath, const QString &separator,
+                                  bool root, QStringList &names, QStringList &files, QSet<QString> &visited)
+{
+    for(int n = 0; n < lines.length(); n++)
+    {
+        const IncludeIndex::Line &line = lines.at(n);
+        if(!line.include) {
+            QString def = root ? line.name : "  " + line.name;
+            if(!names.contains(def)) {
+                names.append(def);
+                files.append(filePath);
             }
+            continue;
         }
+        if(!names.contains(line.name)) {
+            names.append(line.name);
+            files.append(QString());
+        }
+
+        QString filename = includes->findInclude(filePath, line.name, incPath, separator);
+        if(filename.isEmpty() || visited.contains(filename))
+            continue;
+        visited.insert(filename);
+        collectReferences(includes, includes->lines(filename), filename, incPath, separator, false, names, files, visited);
     }
 }
 
 /*
- * this should be part of a child class, but I'm lazy right now
+ * replace the rows with new ones only removing and inserting the rows in
+ * the middle that changed so the views keep their scroll position and
+ * selection while the text is edited
  */
-void TreeModel::xBasicIncludes(QString &text)
+void TreeModel::setRows(const QStringList &names, const QStringList &files)
 {
-    QString inc, cap, s;
-    QStringList st = text.split('\n');
-    QRegExp rx("(include) ([^\n]*)");
-    rx.setCaseSensitivity(Qt::CaseInsensitive);
-
-    int len = st.length();
-    for(int n = 0; n < len; n++)
-    {
-        s = st.at(n);
-        int gotit = rx.indexIn(s);
-        if(gotit > -1) {
+    int oldCount = rootItem->childCount();
+    int newCount = names.count();
+    int first = 0;
+    int last = 0;
+
+    while(first < oldCount && first < newCount &&
+          rootItem->child(first)->data(0).toString() == names.at(first) &&
+          rootItem->child(first)->file() == files.value(first))
+        first++;
+    while(last < oldCount-first && last < newCount-first &&
+          rootItem->child(oldCount-1-last)->data(0).toString() == names.at(newCount-1-last) &&
+          rootItem->child(oldCount-1-last)->file() == files.value(newCount-1-last))
+        last++;
+
+    if(oldCount-last > first) {
+        beginRemoveRows(QModelIndex(), first, oldCount-last-1);
+        for(int n = first; n < oldCount-last; n++)
+            delete rootItem->childItems.takeAt(first);
+        endRemoveRows();
+    }
+    if(newCount-last > first) {
+        beginInsertRows(QModelIndex(), first, newCount-last-1);
+        for(int n = first; n < newCount-last; n++) {
             QList<QVariant> clist;
-            inc = rx.cap(1);
-            cap = rx.cap(2);
-            if(cap != "" && cap.indexOf("\"") > -1) {
-                QStringList caps = cap.split("\"");
-                cap = caps.at(1);
-                cap = cap.trimmed();
-                clist << cap;
-                if(!isDuplicate(rootItem, cap))
-                    rootItem->appendChild(new TreeItem(clist, rootItem));
-            }
+            QString file = files.value(n);
+            clist << names.at(n);
+            rootItem->childItems.insert(n, new TreeItem(clist, rootItem, file));
         }
+        endInsertRows();
     }
 }
 
 /*
  * this should be part of a child class, but I'm lazy right now
  */
-void TreeModel::addFileReferences(QString &filePath, QString &incPath, QString &separator, QString &text, bool root)
+void TreeModel::xBasicIncludes(QString &text)
 {
     QString inc, cap, s;
     QStringList st = text.split('\n');
     QRegExp rx("(include) ([^\n]*)");
     rx.setCaseSensitivity(Qt::CaseInsensitive);
 
-    QRegExp dx("def ([^\n]*)");
-    dx.setCaseSensitivity(Qt::CaseInsensitive);
-
     int len = st.length();
     for(int n = 0; n < len; n++)
     {
         s = st.at(n);
-        int gotdef = dx.indexIn(s);
-
-        if(gotdef > -1) {
-            QList<QVariant> clist;
-            inc = dx.cap(0);
-            if(!root)
-                inc = "  " + inc;
-            clist << inc;
-            if(!isDuplicate(rootItem, inc))
-                rootItem->appendChild(new TreeItem(clist, rootItem, filePath));
-        }
-
         int gotit = rx.indexIn(s);
         if(gotit > -1) {
             QList<QVariant> clist;
@@ -383,33 +403,6 @@ void TreeModel::addFileReferences(QString &filePath, QString &incPath, QString &
                 if(!isDuplicate(rootItem, cap))
                     rootItem->appendChild(new TreeItem(clist, rootItem));
             }
-
-            QString newPath = filePath.mid(0,(filePath.lastIndexOf(separator)+1));
-            QFile file;
-            if(file.exists(newPath+cap))
-            {
-                QString filename = newPath+cap;
-                QFile myfile(filename);
-                if (myfile.open(QFile::ReadOnly | QFile::Text))
-                {
-                    text = myfile.readAll();
-                    myfile.close();
-                    addFileReferences(filename, incPath, separator, text);
-                }
-            }
-            else if(file.exists(incPath+cap))
-            {
-                QString filename = incPath+cap;
-                QFile myfile(filename);
-                if (myfile.open(QFile::ReadOnly | QFile::Text))
-                {
-                    text = myfile.readAll();
-                    myfile.close();
-                    addFileReferences(filename, incPath, separator, text);
-                }
-            }
         }
     }
 }
-
-
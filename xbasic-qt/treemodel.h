@@ -44,6 +44,9 @@
 #include <QAbstractItemModel>
 #include <QModelIndex>
 #include <QVariant>
+#include <QSet>
+
+#include "includeindex.h"
 
 class TreeItem;
 
@@ -57,6 +60,7 @@ public:
     ~TreeModel();
 
     QString     getTreeName();
+    void        setTreeName(const QString &name);
     QVariant data(const QModelIndex &index, int role) const;
     Qt::ItemFlags flags(const QModelIndex &index) const;
     QVariant headerData(int section, Qt::Orientation orientation,
@@ -72,11 +76,18 @@ public:
     bool isDuplicate(TreeItem *item, QString str);
 
     void xBasicIncludes(QString &text);
-    void xBasicIncludes(QString &filePath, QString &incPath, QString &separator, QString &text, bool root = false);
-    void addFileReferences(QString &filePath, QString &incPath, QString &separator, QString &text, bool root = false);
+    void xBasicIncludes(IncludeIndex *includes, QString &filePath, QString &incPath, QString &separator, QString &text);
+    void addFileReferences(IncludeIndex *includes, QString &filePath, QString &incPath, QString &separator, QString &text);
 
 private:
     void setupModelData(const QStringList &lines, TreeItem *parent);
+    void collectIncludes(IncludeIndex *includes, const QList<IncludeIndex::Line> &lines,
+                         const QString &filePath, const QString &incPath, const QString &separator,
+                         QStringList &names, QSet<QString> &visited);
+    void collectReferences(IncludeIndex *includes, const QList<IncludeIndex::Line> &lines,
+                           const QString &filePath, const QString &incPath, const QString &separator,
+                           bool root, QStringList &names, QStringList &files, QSet<QString> &visited);
+    void setRows(const QStringList &names, const QStringList &files);
 
     TreeItem *rootItem;
     QString treeName;
@@ -47,6 +47,7 @@ SOURCES += main.cpp\
     highlighter.cpp \
     treemodel.cpp \
     treeitem.cpp \
+    includeindex.cpp \
     qextserialport.cpp \
     PortListener.cpp \
     terminal.cpp \
@@ -56,13 +57,13 @@ SOURCES += main.cpp\
     console.cpp \
     hardware.cpp \
     qextserialenumerator.cpp \
-    PropellerID.cpp \
-    PortConnectionMonitor.cpp
+    PropellerID.cpp
 
 HEADERS  += mainwindow.h \
     highlighter.h \
     treemodel.h \
     treeitem.h \
+    includeindex.h \
     qextserialport.h \
     qextserialenumerator.h \
     PortListener.h \
@@ -72,8 +73,7 @@ HEADERS  += mainwindow.h \
     xbasicboard.h \
     console.h \
     hardware.h \
-    PropellerID.h \
-    PortConnectionMonitor.h
+    PropellerID.h
 
 OTHER_FILES +=
 
@@ -89,6 +89,7 @@ macx {
 win32 {
   SOURCES          += qextserialport_win.cpp
   SOURCES          += qextserialenumerator_win.cpp
+  DEFINES          += HAS_QWIDGET  # lets the enumerator register for device notifications
   DEFINES          += WINVER=0x0501 # needed for mingw to pull in appropriate dbt business...probably a better way to do this
   LIBS             += -lsetupapi
 }
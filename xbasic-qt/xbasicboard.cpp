@@ -6,6 +6,7 @@ const QString XBasicBoard::clkmode = "clkmode";
 const QString XBasicBoard::pllmode = "pllmode";
 const QString XBasicBoard::clkfreq = "clkfreq";
 const QString XBasicBoard::baudrate = "baudrate";
+const QString XBasicBoard::loadbaudrate = "load-baudrate";
 const QString XBasicBoard::rxpin = "rxpin";
 const QString XBasicBoard::txpin = "txpin";
 const QString XBasicBoard::tvpin = "tvpin";
@@ -17,6 +18,9 @@ const QString XBasicBoard::cachedriver = "cache-driver";
 const QString XBasicBoard::cachesize = "cache-size";
 const QString XBasicBoard::cacheparam1 = "cache-param1";
 const QString XBasicBoard::cacheparam2 = "cache-param2";
+const QString XBasicBoard::cachelinesize = "cache-line-size";
+const QString XBasicBoard::cacheways = "cache-ways";
+const QString XBasicBoard::cacheprefetch = "cache-prefetch";
 
 XBasicBoard::XBasicBoard()
 {
@@ -25,6 +29,7 @@ XBasicBoard::XBasicBoard()
     propNames->append("clkmode");
     propNames->append("clkfreq");
     propNames->append("baudrate");
+    propNames->append("load-baudrate");
     propNames->append("rxpin");
     propNames->append("txpin");
     propNames->append("tvpin");
@@ -36,6 +41,9 @@ XBasicBoard::XBasicBoard()
     propNames->append("cache-size");
     propNames->append("cache-param1");
     propNames->append("cache-param2");
+    propNames->append("cache-line-size");
+    propNames->append("cache-ways");
+    propNames->append("cache-prefetch");
 }
 
 XBasicBoard::~XBasicBoard()
@@ -142,6 +150,7 @@ QStringList *XBasicBoard::getAll()
     al->append("clkfreq: " + get("clkfreq"));
     al->append("clkmode: " + get("clkmode"));
     al->append("baudrate: " + get("baudrate"));
+    al->append("load-baudrate: " + get("load-baudrate"));
     al->append("rxpin: " + get("rxpin"));
     al->append("txpin: " + get("txpin"));
     al->append("tvpin: " + get("tvpin"));
@@ -153,6 +162,9 @@ QStringList *XBasicBoard::getAll()
     al->append("cache-size: " + get("cache-size"));
     al->append("cache-param1: " + get("cache-param1"));
     al->append("cache-param2: " + get("cache-param2"));
+    al->append("cache-line-size: " + get("cache-line-size"));
+    al->append("cache-ways: " + get("cache-ways"));
+    al->append("cache-prefetch: " + get("cache-prefetch"));
     return al;
 }
 
@@ -22,6 +22,7 @@ public:
     static const QString pllmode;
     static const QString clkfreq;
     static const QString baudrate;
+    static const QString loadbaudrate;
     static const QString rxpin;
     static const QString txpin;
     static const QString tvpin;
@@ -33,6 +34,9 @@ public:
     static const QString cachesize;
     static const QString cacheparam1;
     static const QString cacheparam2;
+    static const QString cachelinesize;
+    static const QString cacheways;
+    static const QString cacheprefetch;
 
 private:
 
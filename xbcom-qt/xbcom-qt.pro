@@ -31,17 +31,28 @@ SOURCES += \
     ../src/compiler/db_symbols.c \
     ../src/compiler/db_statement.c \
     ../src/compiler/db_scan.c \
+    ../src/compiler/db_stack.c \
     ../src/compiler/db_generate.c \
+    ../src/compiler/db_hash.c \
+    ../src/compiler/db_inline.c \
+    ../src/compiler/db_loop.c \
+    ../src/compiler/db_native.c \
+    ../src/compiler/db_peep.c \
+    ../src/compiler/db_relax.c \
+    ../src/compiler/db_reuse.c \
+    ../src/compiler/db_unit.c \
     ../src/compiler/db_expr.c \
     ../src/compiler/db_compiler.c \
     ../src/loader/PLoadLib.c \
     ../src/loader/db_packet.c \
     ../src/loader/db_loader.c \
     ../src/runtime/db_vmdebug.c \
+    ../src/runtime/db_vmverify.c \
     ../src/common/osint_qt.c \
-    ../src/common/mem_malloc.c \
+    ../src/common/mem_arena.c \
     ../src/compiler/xb_api.c \
     xbasic_vm.c \
+    xbasic_vm_hub.c \
     serial_helper.c \
     hub_loader.c \
     flash_loader.c \
@@ -53,6 +64,7 @@ HEADERS += \
     ../src/common/db_image.h \
     ../src/common/db_config.h \
     ../src/compiler/db_compiler.h \
+    ../src/compiler/db_hash.h \
     ../src/loader/PLoadLib.h \
     ../src/loader/db_packet.h \
     ../src/loader/db_loader.h \
@@ -60,5 +72,5 @@ HEADERS += \
     ../src/runtime/db_vmimage.h \
     ../src/runtime/db_vmdebug.h \
     ../src/runtime/db_vm.h \
-    ../src/common/mem_malloc.h \
+    ../src/common/mem_arena.h \
     ../src/compiler/xb_api.h